@@ -0,0 +1,1167 @@
+/****************************************************************************
+ *
+ * MODULE:             6LoWPANd
+ *
+ * COMPONENT:          Simulated border router module for benchmarking
+ *
+ * REVISION:           $Revision$
+ *
+ * DATED:              $Date$
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** ModuleSim stands in for the JN51xx border router node at the other end
+ *  of 6LoWPANd's serial link. It creates a pseudo terminal for 6LoWPANd to
+ *  open, answers the version / config / address / ping handshake and then
+ *  pushes timestamped UDP packets through the daemon in both directions,
+ *  paced at the emulated baud rate, to measure throughput, latency and the
+ *  CPU time the daemon spends per packet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+/* Serial link framing, as SerialLink.c */
+#define SL_START_CHAR           0x01
+#define SL_ESC_CHAR             0x02
+#define SL_END_CHAR             0x03
+
+/* Message types, as teSL_MsgType in SerialLink.h */
+#define E_SL_MSG_VERSION_REQUEST      0
+#define E_SL_MSG_VERSION              1
+#define E_SL_MSG_IPV6               101
+#define E_SL_MSG_CONFIG             102
+#define E_SL_MSG_RUN_COORDINATOR    103
+#define E_SL_MSG_RESET              104
+#define E_SL_MSG_ADDR               105
+#define E_SL_MSG_CONFIG_REQUEST     106
+#define E_SL_MSG_SECURITY           107
+#define E_SL_MSG_LOG                108
+#define E_SL_MSG_PING               109
+#define E_SL_MSG_RUN_ROUTER         111
+#define E_SL_MSG_RUN_COMMISIONING   112
+
+/** Version reported to 6LoWPANd. 1.4.0 enables ping, config and frontend messages */
+#define SIM_VERSION_MAJOR       1
+#define SIM_VERSION_MINOR       4
+#define SIM_VERSION_REV         0
+
+/** Magic number at the start of every benchmark payload */
+#define BENCH_MAGIC             0x4c6f5750
+#define BENCH_PORT              7777
+
+/** Payload padding. Avoids bytes < 0x10 so the padding is not escaped on the serial link */
+#define BENCH_FILL              0xa5
+
+#define MAX_MESSAGE_LENGTH      2048
+#define IPV6_HEADER_LENGTH      40
+#define UDP_HEADER_LENGTH       8
+
+/** Bits on the wire per byte: 8N1 */
+#define BITS_PER_BYTE           10
+
+
+/** Payload carried in every benchmark UDP packet */
+typedef struct
+{
+    uint32_t    u32Magic;
+    uint32_t    u32Sequence;
+    uint64_t    u64Timestamp;           /**< CLOCK_MONOTONIC in ns at time of sending */
+} __attribute__((__packed__)) tsBenchPayload;
+
+
+/** Network configuration as sent by 6LoWPANd (tsModule_ConfigV11) */
+typedef struct
+{
+    uint8_t     u8Region;
+    uint8_t     u8Channel;
+    uint16_t    u16PanID;
+    uint32_t    u32NetworkID;
+    uint32_t    u64NetworkPrefixMSB;
+    uint32_t    u64NetworkPrefixLSB;
+} __attribute__((__packed__)) tsModule_Config;
+
+
+/** Results of one direction of a benchmark run */
+typedef struct
+{
+    const char *pcName;
+    uint32_t    u32Sent;
+    uint32_t    u32Received;
+    uint32_t   *pu32Latency;            /**< Latency of each received packet in us */
+    uint8_t    *pu8Seen;                /**< Per sequence number flag to discard duplicates */
+    uint64_t    u64FirstTx;
+    uint64_t    u64LastRx;
+    uint64_t    u64CPUStart;
+    uint64_t    u64CPUEnd;
+} tsPhase;
+
+
+/** Emulated serial line */
+static struct
+{
+    int             iMaster;            /**< Pty master - our end of the "UART" */
+    int             iSlave;             /**< Held open so the pty survives 6LoWPANd reopening it */
+    uint32_t        u32BaudRate;
+    uint64_t        u64TxFreeAt;        /**< Time at which the line is free to transmit again */
+    uint64_t        u64RxFreeAt;        /**< Time at which the next byte may be received */
+    pthread_mutex_t mutex;              /**< Serialise framed writes from multiple threads */
+} sSerial;
+
+
+/** Simulated module state */
+static struct
+{
+    volatile int    iRunning;           /**< 6LoWPANd has completed the handshake */
+    volatile int    iConfigured;        /**< Network configuration received */
+    struct in6_addr sNodeAddress;       /**< Address reported to 6LoWPANd */
+    struct in6_addr sHostAddress;       /**< Address of the tun interface */
+    uint32_t        u32Pings;
+    uint32_t        u32Logs;
+} sModule;
+
+
+static volatile sig_atomic_t bRunning = 1;
+
+static int          iVerbosity          = 0;
+static uint32_t     u32PacketCount      = 1000;
+static uint32_t     u32PacketRate       = 0;
+static uint32_t     u32PayloadSize      = 64;
+static uint32_t     u32LogInterval      = 1000;
+static uint32_t     u32StartupTimeout   = 30;
+static const char  *pcLinkName          = NULL;
+static const char  *pcPidFile           = NULL;
+static int          iDirectionUp        = 1;
+static int          iDirectionDown      = 1;
+
+static tsPhase      sPhaseUp            = { "module->host" };
+static tsPhase      sPhaseDown          = { "host->module" };
+static tsPhase     *psPhaseDown         = NULL; /**< Set while the host->module phase is in progress */
+
+static int          iSocket             = -1;
+static volatile int iSocketReaderRunning = 0;
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "ModuleSim Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -L --link          <path>              Create a symlink to the simulated serial port at path\n");
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -h --help                              Print this help.\n");
+    fprintf(stderr, "    -v --verbosity     <verbosity>         Verbosity level. Default %d.\n", iVerbosity);
+    fprintf(stderr, "    -B --baud          <baud rate>         Emulated serial baud rate. Default %u.\n", sSerial.u32BaudRate);
+    fprintf(stderr, "    -p --pidfile       <file>              File containing the PID of 6LoWPANd, for CPU accounting.\n");
+    fprintf(stderr, "    -H --host          <IPv6 address>      Address assigned to the tun interface. Default fd04:bd3:80e8:2::1.\n");
+    fprintf(stderr, "    -N --node          <IPv6 address>      Address reported by the simulated module. Default fd04:bd3:80e8:2::2.\n");
+    fprintf(stderr, "    -c --count         <packets>           Packets to send in each direction. Default %u.\n", u32PacketCount);
+    fprintf(stderr, "    -r --rate          <packets/s>         Offered load. 0 for 80%% of the serial line rate. Default %u.\n", u32PacketRate);
+    fprintf(stderr, "    -s --size          <bytes>             UDP payload size. Default %u.\n", u32PayloadSize);
+    fprintf(stderr, "    -d --direction     <up,down,both>      Directions to measure. Default both.\n");
+    fprintf(stderr, "    -l --loginterval   <ms>                Interval between module log messages. 0 to disable. Default %u.\n", u32LogInterval);
+    fprintf(stderr, "    -t --timeout       <seconds>           Time to wait for 6LoWPANd to start. Default %u.\n", u32StartupTimeout);
+    exit(EXIT_FAILURE);
+}
+
+
+static void vQuitSignalHandler(int sig)
+{
+    bRunning = 0;
+}
+
+
+static uint64_t u64Now(void)
+{
+    struct timespec sTime;
+    clock_gettime(CLOCK_MONOTONIC, &sTime);
+    return ((uint64_t)sTime.tv_sec * 1000000000ULL) + sTime.tv_nsec;
+}
+
+
+static void vSleepUntil(uint64_t u64When)
+{
+    struct timespec sTime;
+    sTime.tv_sec  = u64When / 1000000000ULL;
+    sTime.tv_nsec = u64When % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sTime, NULL) == EINTR);
+}
+
+
+/** Time taken to clock u32Bytes over the emulated serial line, in ns */
+static uint64_t u64LineTime(uint32_t u32Bytes)
+{
+    return ((uint64_t)u32Bytes * BITS_PER_BYTE * 1000000000ULL) / sSerial.u32BaudRate;
+}
+
+
+/** Read the CPU time consumed by a process, in ns.
+ *  Uses schedstat where available for ns resolution, otherwise falls back to
+ *  the tick based utime + stime from stat.
+ */
+static uint64_t u64ProcessCPUTime(pid_t iPid)
+{
+    char acPath[64];
+    FILE *psFile;
+    unsigned long long ullRunTime;
+    unsigned long ulUTime, ulSTime;
+
+    if (iPid <= 0)
+    {
+        return 0;
+    }
+
+    snprintf(acPath, sizeof(acPath), "/proc/%d/schedstat", (int)iPid);
+    psFile = fopen(acPath, "r");
+    if (psFile)
+    {
+        if (fscanf(psFile, "%llu", &ullRunTime) == 1)
+        {
+            fclose(psFile);
+            return ullRunTime;
+        }
+        fclose(psFile);
+    }
+
+    snprintf(acPath, sizeof(acPath), "/proc/%d/stat", (int)iPid);
+    psFile = fopen(acPath, "r");
+    if (psFile)
+    {
+        if (fscanf(psFile, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ulUTime, &ulSTime) == 2)
+        {
+            fclose(psFile);
+            return ((uint64_t)(ulUTime + ulSTime) * 1000000000ULL) / sysconf(_SC_CLK_TCK);
+        }
+        fclose(psFile);
+    }
+    return 0;
+}
+
+
+static pid_t iDaemonPid(void)
+{
+    FILE *psFile;
+    int iPid = 0;
+
+    if (!pcPidFile)
+    {
+        return 0;
+    }
+    psFile = fopen(pcPidFile, "r");
+    if (psFile)
+    {
+        if (fscanf(psFile, "%d", &iPid) != 1)
+        {
+            iPid = 0;
+        }
+        fclose(psFile);
+    }
+    return iPid;
+}
+
+
+/****************************************************************************/
+/***        Serial link                                                   ***/
+/****************************************************************************/
+
+static int iSerialOpen(void)
+{
+    struct termios sOptions;
+    char *pcSlaveName;
+
+    sSerial.iMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if (sSerial.iMaster < 0)
+    {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    if ((grantpt(sSerial.iMaster) < 0) || (unlockpt(sSerial.iMaster) < 0))
+    {
+        perror("grantpt");
+        return -1;
+    }
+
+    pcSlaveName = ptsname(sSerial.iMaster);
+    if (!pcSlaveName)
+    {
+        perror("ptsname");
+        return -1;
+    }
+
+    sSerial.iSlave = open(pcSlaveName, O_RDWR | O_NOCTTY);
+    if (sSerial.iSlave < 0)
+    {
+        perror("open slave");
+        return -1;
+    }
+
+    /* Raw mode on the slave so that no bytes are echoed or translated before 6LoWPANd configures it */
+    if (tcgetattr(sSerial.iSlave, &sOptions) == 0)
+    {
+        cfmakeraw(&sOptions);
+        tcsetattr(sSerial.iSlave, TCSANOW, &sOptions);
+    }
+
+    if (pcLinkName)
+    {
+        unlink(pcLinkName);
+        if (symlink(pcSlaveName, pcLinkName) < 0)
+        {
+            fprintf(stderr, "Could not link %s to %s (%s)\n", pcLinkName, pcSlaveName, strerror(errno));
+            return -1;
+        }
+    }
+
+    printf("Simulated module on %s at %u baud\n", pcSlaveName, sSerial.u32BaudRate);
+    fflush(stdout);
+    return 0;
+}
+
+
+static uint8_t u8CalculateCRC(uint8_t u8Type, uint16_t u16Length, const uint8_t *pu8Data)
+{
+    uint8_t u8CRC = u8Type ^ (u16Length >> 8) ^ (u16Length & 0xff);
+    int n;
+
+    for (n = 0; n < u16Length; n++)
+    {
+        u8CRC ^= pu8Data[n];
+    }
+    return u8CRC;
+}
+
+
+static int iEncodeByte(uint8_t *pu8Buffer, uint8_t u8Data)
+{
+    if (u8Data < 0x10)
+    {
+        pu8Buffer[0] = SL_ESC_CHAR;
+        pu8Buffer[1] = u8Data ^ 0x10;
+        return 2;
+    }
+    pu8Buffer[0] = u8Data;
+    return 1;
+}
+
+
+/** Frame and write a message to 6LoWPANd. The write is delayed by the time
+ *  the frame would take to transmit at the emulated baud rate.
+ */
+static int iSerialWriteMessage(uint8_t u8Type, uint16_t u16Length, const uint8_t *pu8Data)
+{
+    uint8_t au8Frame[(MAX_MESSAGE_LENGTH + 8) * 2];
+    int iLength = 0, iWritten = 0, n;
+    uint64_t u64Done;
+
+    au8Frame[iLength++] = SL_START_CHAR;
+    iLength += iEncodeByte(&au8Frame[iLength], u8Type);
+    iLength += iEncodeByte(&au8Frame[iLength], u16Length >> 8);
+    iLength += iEncodeByte(&au8Frame[iLength], u16Length & 0xff);
+    iLength += iEncodeByte(&au8Frame[iLength], u8CalculateCRC(u8Type, u16Length, pu8Data));
+    for (n = 0; n < u16Length; n++)
+    {
+        iLength += iEncodeByte(&au8Frame[iLength], pu8Data[n]);
+    }
+    au8Frame[iLength++] = SL_END_CHAR;
+
+    pthread_mutex_lock(&sSerial.mutex);
+
+    /* The frame is complete at the far end once its last byte has been clocked out */
+    u64Done = u64Now();
+    if (sSerial.u64TxFreeAt > u64Done)
+    {
+        u64Done = sSerial.u64TxFreeAt;
+    }
+    u64Done += u64LineTime(iLength);
+    vSleepUntil(u64Done);
+
+    while (iWritten < iLength)
+    {
+        n = write(sSerial.iMaster, &au8Frame[iWritten], iLength - iWritten);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            pthread_mutex_unlock(&sSerial.mutex);
+            perror("write");
+            return -1;
+        }
+        iWritten += n;
+    }
+
+    sSerial.u64TxFreeAt = u64Done;
+
+    pthread_mutex_unlock(&sSerial.mutex);
+    return 0;
+}
+
+
+/****************************************************************************/
+/***        IPv6 packets                                                  ***/
+/****************************************************************************/
+
+static uint16_t u16UDPChecksum(const struct in6_addr *psSource, const struct in6_addr *psDest,
+                               const uint8_t *pu8UDP, uint32_t u32Length)
+{
+    uint32_t u32Sum = 0;
+    uint32_t n;
+
+    for (n = 0; n < 16; n += 2)
+    {
+        u32Sum += (psSource->s6_addr[n] << 8) | psSource->s6_addr[n + 1];
+        u32Sum += (psDest->s6_addr[n] << 8)   | psDest->s6_addr[n + 1];
+    }
+    u32Sum += u32Length;
+    u32Sum += IPPROTO_UDP;
+
+    for (n = 0; n + 1 < u32Length; n += 2)
+    {
+        u32Sum += (pu8UDP[n] << 8) | pu8UDP[n + 1];
+    }
+    if (n < u32Length)
+    {
+        u32Sum += pu8UDP[n] << 8;
+    }
+
+    while (u32Sum >> 16)
+    {
+        u32Sum = (u32Sum & 0xffff) + (u32Sum >> 16);
+    }
+    u32Sum = ~u32Sum & 0xffff;
+    return u32Sum ? u32Sum : 0xffff;
+}
+
+
+/** Build an IPv6/UDP benchmark packet from the simulated node to the host */
+static uint32_t u32BuildPacket(uint8_t *pu8Packet, uint32_t u32Sequence)
+{
+    uint32_t u32UDPLength = UDP_HEADER_LENGTH + u32PayloadSize;
+    uint8_t *pu8UDP = &pu8Packet[IPV6_HEADER_LENGTH];
+    tsBenchPayload sPayload;
+    uint16_t u16Checksum;
+
+    memset(pu8Packet, 0, IPV6_HEADER_LENGTH + UDP_HEADER_LENGTH);
+    memset(pu8UDP + UDP_HEADER_LENGTH, BENCH_FILL, u32PayloadSize);
+
+    pu8Packet[0] = 0x60;
+    pu8Packet[4] = u32UDPLength >> 8;
+    pu8Packet[5] = u32UDPLength & 0xff;
+    pu8Packet[6] = IPPROTO_UDP;
+    pu8Packet[7] = 64;
+    memcpy(&pu8Packet[8],  &sModule.sNodeAddress, sizeof(struct in6_addr));
+    memcpy(&pu8Packet[24], &sModule.sHostAddress, sizeof(struct in6_addr));
+
+    pu8UDP[0] = BENCH_PORT >> 8;
+    pu8UDP[1] = BENCH_PORT & 0xff;
+    pu8UDP[2] = BENCH_PORT >> 8;
+    pu8UDP[3] = BENCH_PORT & 0xff;
+    pu8UDP[4] = u32UDPLength >> 8;
+    pu8UDP[5] = u32UDPLength & 0xff;
+
+    sPayload.u32Magic       = htonl(BENCH_MAGIC);
+    sPayload.u32Sequence    = htonl(u32Sequence);
+    sPayload.u64Timestamp   = u64Now();
+    memcpy(&pu8UDP[UDP_HEADER_LENGTH], &sPayload, sizeof(tsBenchPayload));
+
+    u16Checksum = u16UDPChecksum(&sModule.sNodeAddress, &sModule.sHostAddress, pu8UDP, u32UDPLength);
+    pu8UDP[6] = u16Checksum >> 8;
+    pu8UDP[7] = u16Checksum & 0xff;
+
+    return IPV6_HEADER_LENGTH + u32UDPLength;
+}
+
+
+static void vPhaseRecord(tsPhase *psPhase, const uint8_t *pu8Payload, uint32_t u32Length)
+{
+    tsBenchPayload sPayload;
+    uint32_t u32Sequence;
+    uint64_t u64Time = u64Now();
+
+    if (u32Length < sizeof(tsBenchPayload))
+    {
+        return;
+    }
+    memcpy(&sPayload, pu8Payload, sizeof(tsBenchPayload));
+    if (ntohl(sPayload.u32Magic) != BENCH_MAGIC)
+    {
+        return;
+    }
+    u32Sequence = ntohl(sPayload.u32Sequence);
+    if ((u32Sequence >= u32PacketCount) || psPhase->pu8Seen[u32Sequence])
+    {
+        return;
+    }
+    psPhase->pu8Seen[u32Sequence] = 1;
+    psPhase->pu32Latency[psPhase->u32Received++] = (uint32_t)((u64Time - sPayload.u64Timestamp) / 1000);
+    psPhase->u64LastRx = u64Time;
+}
+
+
+/** Handle an IPv6 packet written to the module by 6LoWPANd */
+static void vHandleIPv6(const uint8_t *pu8Packet, uint32_t u32Length)
+{
+    tsPhase *psPhase = psPhaseDown;
+
+    if (!psPhase || (u32Length < IPV6_HEADER_LENGTH + UDP_HEADER_LENGTH))
+    {
+        return;
+    }
+    if (((pu8Packet[0] >> 4) != 6) || (pu8Packet[6] != IPPROTO_UDP))
+    {
+        return;
+    }
+    if ((((pu8Packet[IPV6_HEADER_LENGTH + 2] << 8) | pu8Packet[IPV6_HEADER_LENGTH + 3])) != BENCH_PORT)
+    {
+        return;
+    }
+    vPhaseRecord(psPhase, &pu8Packet[IPV6_HEADER_LENGTH + UDP_HEADER_LENGTH],
+                 u32Length - IPV6_HEADER_LENGTH - UDP_HEADER_LENGTH);
+}
+
+
+/****************************************************************************/
+/***        Module protocol                                               ***/
+/****************************************************************************/
+
+static void vHandleMessage(uint8_t u8Type, uint16_t u16Length, uint8_t *pu8Data)
+{
+    if (iVerbosity > 1)
+    {
+        printf("Message type %d length %d\n", u8Type, u16Length);
+    }
+
+    switch (u8Type)
+    {
+        case (E_SL_MSG_VERSION_REQUEST):
+        {
+            uint8_t au8Version[3] = { SIM_VERSION_MAJOR, SIM_VERSION_MINOR, SIM_VERSION_REV };
+            iSerialWriteMessage(E_SL_MSG_VERSION, sizeof(au8Version), au8Version);
+            break;
+        }
+
+        case (E_SL_MSG_CONFIG):
+            if (u16Length >= sizeof(tsModule_Config))
+            {
+                tsModule_Config sConfig;
+                memcpy(&sConfig, pu8Data, sizeof(tsModule_Config));
+                if (iVerbosity)
+                {
+                    printf("Configured channel %d PAN 0x%04x\n", sConfig.u8Channel, ntohs(sConfig.u16PanID));
+                }
+                sModule.iConfigured = 1;
+            }
+            break;
+
+        case (E_SL_MSG_RUN_COORDINATOR):
+        case (E_SL_MSG_RUN_ROUTER):
+        case (E_SL_MSG_RUN_COMMISIONING):
+        case (E_SL_MSG_CONFIG_REQUEST):
+        {
+            /* Network is "up" immediately - report the configuration back, as the real module does */
+            tsModule_Config sConfig;
+            memset(&sConfig, 0, sizeof(tsModule_Config));
+            sConfig.u8Channel           = 15;
+            sConfig.u16PanID            = htons(0x1234);
+            sConfig.u32NetworkID        = htonl(0x11121112);
+            memcpy(&sConfig.u64NetworkPrefixMSB, &sModule.sNodeAddress.s6_addr[0], 4);
+            memcpy(&sConfig.u64NetworkPrefixLSB, &sModule.sNodeAddress.s6_addr[4], 4);
+            iSerialWriteMessage(E_SL_MSG_CONFIG, sizeof(tsModule_Config), (uint8_t *)&sConfig);
+            break;
+        }
+
+        case (E_SL_MSG_ADDR):
+            iSerialWriteMessage(E_SL_MSG_ADDR, sizeof(struct in6_addr), sModule.sNodeAddress.s6_addr);
+            if (!sModule.iRunning)
+            {
+                printf("Handshake with 6LoWPANd complete\n");
+                fflush(stdout);
+            }
+            sModule.iRunning = 1;
+            break;
+
+        case (E_SL_MSG_PING):
+            sModule.u32Pings++;
+            iSerialWriteMessage(E_SL_MSG_PING, 0, NULL);
+            break;
+
+        case (E_SL_MSG_IPV6):
+            vHandleIPv6(pu8Data, u16Length);
+            break;
+
+        case (E_SL_MSG_RESET):
+            sModule.iRunning = 0;
+            sModule.iConfigured = 0;
+            break;
+
+        default:
+            /* Security, profile, frontend, activity LED etc. are accepted silently */
+            break;
+    }
+}
+
+
+/** Serial reader thread. Decodes frames from 6LoWPANd, pacing reads at the
+ *  emulated baud rate so that the daemon sees realistic back pressure.
+ */
+static void *pvSerialReaderThread(void *pvArg)
+{
+    static uint8_t au8Message[MAX_MESSAGE_LENGTH];
+    uint8_t au8Buffer[64];
+    uint8_t u8Type = 0, u8CRC = 0;
+    uint16_t u16Length = 0, u16Bytes = 0;
+    int iState = 0, iInEsc = 0;
+    uint64_t u64LastLog = u64Now();
+
+    while (bRunning)
+    {
+        fd_set sFds;
+        struct timeval sTimeout = { 0, 100000 };
+        int iBytes, n;
+
+        FD_ZERO(&sFds);
+        FD_SET(sSerial.iMaster, &sFds);
+
+        if (select(sSerial.iMaster + 1, &sFds, NULL, NULL, &sTimeout) > 0)
+        {
+            vSleepUntil(sSerial.u64RxFreeAt);
+
+            iBytes = read(sSerial.iMaster, au8Buffer, sizeof(au8Buffer));
+            if (iBytes <= 0)
+            {
+                if ((iBytes < 0) && (errno != EAGAIN) && (errno != EINTR) && (errno != EIO))
+                {
+                    perror("read");
+                    break;
+                }
+                usleep(1000);
+                continue;
+            }
+
+            sSerial.u64RxFreeAt = u64Now() + u64LineTime(iBytes);
+
+            for (n = 0; n < iBytes; n++)
+            {
+                uint8_t u8Data = au8Buffer[n];
+
+                switch (u8Data)
+                {
+                    case (SL_START_CHAR):
+                        iState = 1;
+                        iInEsc = 0;
+                        u16Bytes = 0;
+                        break;
+
+                    case (SL_ESC_CHAR):
+                        iInEsc = 1;
+                        break;
+
+                    case (SL_END_CHAR):
+                        if ((iState == 5) && (u16Bytes == u16Length) &&
+                            (u8CRC == u8CalculateCRC(u8Type, u16Length, au8Message)))
+                        {
+                            vHandleMessage(u8Type, u16Length, au8Message);
+                        }
+                        else if (iVerbosity)
+                        {
+                            printf("Bad frame from 6LoWPANd\n");
+                        }
+                        iState = 0;
+                        break;
+
+                    default:
+                        if (iInEsc)
+                        {
+                            u8Data ^= 0x10;
+                            iInEsc = 0;
+                        }
+                        switch (iState)
+                        {
+                            case 1: u8Type = u8Data;                    iState++; break;
+                            case 2: u16Length = u8Data << 8;            iState++; break;
+                            case 3: u16Length |= u8Data;
+                                    iState = (u16Length > sizeof(au8Message)) ? 0 : iState + 1;
+                                    break;
+                            case 4: u8CRC = u8Data;                     iState++; break;
+                            case 5:
+                                if (u16Bytes < u16Length)
+                                {
+                                    au8Message[u16Bytes++] = u8Data;
+                                }
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
+                }
+            }
+        }
+
+        if (sModule.iRunning && u32LogInterval && ((u64Now() - u64LastLog) / 1000000 >= u32LogInterval))
+        {
+            /* Periodic log message, exercising the E_SL_MSG_LOG path of 6LoWPANd */
+            char acLog[32];
+            int iLength;
+
+            acLog[0] = 7; /* LOG_DEBUG */
+            iLength = 1 + snprintf(&acLog[1], sizeof(acLog) - 1, "sim log %u", sModule.u32Logs++);
+            iSerialWriteMessage(E_SL_MSG_LOG, iLength, (uint8_t *)acLog);
+            u64LastLog = u64Now();
+        }
+    }
+    return NULL;
+}
+
+
+/** Host side UDP receiver for the module->host direction */
+static void *pvSocketReaderThread(void *pvArg)
+{
+    tsPhase *psPhase = (tsPhase *)pvArg;
+    uint8_t au8Buffer[MAX_MESSAGE_LENGTH];
+
+    while (bRunning && iSocketReaderRunning)
+    {
+        fd_set sFds;
+        struct timeval sTimeout = { 0, 100000 };
+        int iBytes;
+
+        FD_ZERO(&sFds);
+        FD_SET(iSocket, &sFds);
+
+        if (select(iSocket + 1, &sFds, NULL, NULL, &sTimeout) > 0)
+        {
+            iBytes = recv(iSocket, au8Buffer, sizeof(au8Buffer), 0);
+            if (iBytes > 0)
+            {
+                vPhaseRecord(psPhase, au8Buffer, iBytes);
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/****************************************************************************/
+/***        Benchmark                                                     ***/
+/****************************************************************************/
+
+static int iSocketOpen(void)
+{
+    struct sockaddr_in6 sAddress;
+    uint64_t u64Deadline = u64Now() + (uint64_t)u32StartupTimeout * 1000000000ULL;
+
+    iSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (iSocket < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sAddress, 0, sizeof(struct sockaddr_in6));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(BENCH_PORT);
+    sAddress.sin6_addr   = sModule.sHostAddress;
+
+    /* The address is only available once the tun interface has been configured */
+    while (bind(iSocket, (struct sockaddr *)&sAddress, sizeof(struct sockaddr_in6)) < 0)
+    {
+        if ((errno != EADDRNOTAVAIL) || (u64Now() > u64Deadline) || !bRunning)
+        {
+            perror("bind");
+            return -1;
+        }
+        usleep(100000);
+    }
+    return 0;
+}
+
+
+static uint64_t u64PacketInterval(void)
+{
+    uint32_t u32Rate = u32PacketRate;
+
+    if (u32Rate == 0)
+    {
+        /* Frame overhead is start, type, length, crc, end. Assume ~1/16 of bytes are escaped. */
+        uint32_t u32FrameBytes = 6 + ((IPV6_HEADER_LENGTH + UDP_HEADER_LENGTH + u32PayloadSize) * 17) / 16;
+        u32Rate = ((sSerial.u32BaudRate / BITS_PER_BYTE) * 8) / (u32FrameBytes * 10);
+        if (u32Rate == 0)
+        {
+            u32Rate = 1;
+        }
+    }
+    return 1000000000ULL / u32Rate;
+}
+
+
+static int iPhaseInit(tsPhase *psPhase)
+{
+    psPhase->pu32Latency = calloc(u32PacketCount, sizeof(uint32_t));
+    psPhase->pu8Seen     = calloc(u32PacketCount, sizeof(uint8_t));
+    if (!psPhase->pu32Latency || !psPhase->pu8Seen)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/** Wait for in-flight packets to arrive, giving up after a second without progress */
+static void vPhaseDrain(tsPhase *psPhase)
+{
+    uint32_t u32LastCount = psPhase->u32Received;
+    uint64_t u64LastProgress = u64Now();
+
+    while (bRunning && (psPhase->u32Received < psPhase->u32Sent))
+    {
+        usleep(10000);
+        if (psPhase->u32Received != u32LastCount)
+        {
+            u32LastCount = psPhase->u32Received;
+            u64LastProgress = u64Now();
+        }
+        else if ((u64Now() - u64LastProgress) > 1000000000ULL)
+        {
+            break;
+        }
+    }
+}
+
+
+static void vPhaseRunUp(tsPhase *psPhase, pid_t iPid)
+{
+    uint8_t au8Packet[MAX_MESSAGE_LENGTH];
+    uint64_t u64Interval = u64PacketInterval();
+    uint64_t u64Next;
+    pthread_t sThread;
+    uint32_t u32Sequence;
+
+    iSocketReaderRunning = 1;
+    pthread_create(&sThread, NULL, pvSocketReaderThread, psPhase);
+
+    psPhase->u64CPUStart = u64ProcessCPUTime(iPid);
+    psPhase->u64FirstTx  = u64Next = u64Now();
+
+    for (u32Sequence = 0; bRunning && (u32Sequence < u32PacketCount); u32Sequence++)
+    {
+        uint32_t u32Length;
+
+        vSleepUntil(u64Next);
+        u64Next += u64Interval;
+
+        u32Length = u32BuildPacket(au8Packet, u32Sequence);
+        if (iSerialWriteMessage(E_SL_MSG_IPV6, u32Length, au8Packet) < 0)
+        {
+            break;
+        }
+        psPhase->u32Sent++;
+    }
+
+    vPhaseDrain(psPhase);
+    psPhase->u64CPUEnd = u64ProcessCPUTime(iPid);
+
+    iSocketReaderRunning = 0;
+    pthread_join(sThread, NULL);
+}
+
+
+static void vPhaseRunDown(tsPhase *psPhase, pid_t iPid)
+{
+    uint8_t au8Payload[MAX_MESSAGE_LENGTH];
+    uint64_t u64Interval = u64PacketInterval();
+    uint64_t u64Next;
+    uint32_t u32Sequence;
+    struct sockaddr_in6 sDest;
+
+    memset(au8Payload, BENCH_FILL, sizeof(au8Payload));
+    memset(&sDest, 0, sizeof(struct sockaddr_in6));
+    sDest.sin6_family = AF_INET6;
+    sDest.sin6_port   = htons(BENCH_PORT);
+    sDest.sin6_addr   = sModule.sNodeAddress;
+
+    psPhaseDown = psPhase;
+
+    psPhase->u64CPUStart = u64ProcessCPUTime(iPid);
+    psPhase->u64FirstTx  = u64Next = u64Now();
+
+    for (u32Sequence = 0; bRunning && (u32Sequence < u32PacketCount); u32Sequence++)
+    {
+        tsBenchPayload sPayload;
+
+        vSleepUntil(u64Next);
+        u64Next += u64Interval;
+
+        sPayload.u32Magic       = htonl(BENCH_MAGIC);
+        sPayload.u32Sequence    = htonl(u32Sequence);
+        sPayload.u64Timestamp   = u64Now();
+        memcpy(au8Payload, &sPayload, sizeof(tsBenchPayload));
+
+        if (sendto(iSocket, au8Payload, u32PayloadSize, 0, (struct sockaddr *)&sDest, sizeof(struct sockaddr_in6)) < 0)
+        {
+            perror("sendto");
+            break;
+        }
+        psPhase->u32Sent++;
+    }
+
+    vPhaseDrain(psPhase);
+    psPhase->u64CPUEnd = u64ProcessCPUTime(iPid);
+
+    psPhaseDown = NULL;
+}
+
+
+static int iCompareU32(const void *pvA, const void *pvB)
+{
+    uint32_t a = *(const uint32_t *)pvA, b = *(const uint32_t *)pvB;
+    return (a > b) - (a < b);
+}
+
+
+static uint32_t u32Percentile(const uint32_t *pu32Sorted, uint32_t u32Count, uint32_t u32Percent)
+{
+    uint32_t u32Index;
+    if (u32Count == 0)
+    {
+        return 0;
+    }
+    u32Index = ((uint64_t)u32Count * u32Percent + 99) / 100;
+    return pu32Sorted[(u32Index ? u32Index : 1) - 1];
+}
+
+
+static void vPhaseReport(tsPhase *psPhase)
+{
+    double dDuration;
+    uint64_t u64CPU = psPhase->u64CPUEnd - psPhase->u64CPUStart;
+
+    if (psPhase->u32Sent == 0)
+    {
+        return;
+    }
+
+    qsort(psPhase->pu32Latency, psPhase->u32Received, sizeof(uint32_t), iCompareU32);
+
+    dDuration = (psPhase->u64LastRx > psPhase->u64FirstTx) ?
+                (double)(psPhase->u64LastRx - psPhase->u64FirstTx) / 1e9 : 0.0;
+
+    printf("%s:\n", psPhase->pcName);
+    printf("  Packets sent/received : %u/%u (%.2f%% lost)\n", psPhase->u32Sent, psPhase->u32Received,
+           100.0 * (psPhase->u32Sent - psPhase->u32Received) / psPhase->u32Sent);
+    printf("  Throughput            : %.1f packets/s\n", dDuration > 0 ? psPhase->u32Received / dDuration : 0.0);
+    printf("  Latency (us)          : p50 %u p90 %u p99 %u max %u\n",
+           u32Percentile(psPhase->pu32Latency, psPhase->u32Received, 50),
+           u32Percentile(psPhase->pu32Latency, psPhase->u32Received, 90),
+           u32Percentile(psPhase->pu32Latency, psPhase->u32Received, 99),
+           u32Percentile(psPhase->pu32Latency, psPhase->u32Received, 100));
+    if (psPhase->u64CPUStart || psPhase->u64CPUEnd)
+    {
+        printf("  6LoWPANd CPU          : %.1f us/packet\n",
+               psPhase->u32Received ? (double)u64CPU / 1000.0 / psPhase->u32Received : 0.0);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_t sReaderThread;
+    uint64_t u64Deadline;
+    pid_t iPid;
+    int iResult = EXIT_SUCCESS;
+
+    sSerial.u32BaudRate = 1000000;
+    inet_pton(AF_INET6, "fd04:bd3:80e8:2::1", &sModule.sHostAddress);
+    inet_pton(AF_INET6, "fd04:bd3:80e8:2::2", &sModule.sNodeAddress);
+
+    {
+        static struct option long_options[] =
+        {
+            {"link",                    required_argument,  NULL, 'L'},
+            {"help",                    no_argument,        NULL, 'h'},
+            {"verbosity",               required_argument,  NULL, 'v'},
+            {"baud",                    required_argument,  NULL, 'B'},
+            {"pidfile",                 required_argument,  NULL, 'p'},
+            {"host",                    required_argument,  NULL, 'H'},
+            {"node",                    required_argument,  NULL, 'N'},
+            {"count",                   required_argument,  NULL, 'c'},
+            {"rate",                    required_argument,  NULL, 'r'},
+            {"size",                    required_argument,  NULL, 's'},
+            {"direction",               required_argument,  NULL, 'd'},
+            {"loginterval",             required_argument,  NULL, 'l'},
+            {"timeout",                 required_argument,  NULL, 't'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "L:hv:B:p:H:N:c:r:s:d:l:t:", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'L': pcLinkName = optarg;                              break;
+                case 'v': iVerbosity = atoi(optarg);                        break;
+                case 'B': sSerial.u32BaudRate = strtoul(optarg, NULL, 0);   break;
+                case 'p': pcPidFile = optarg;                               break;
+                case 'c': u32PacketCount = strtoul(optarg, NULL, 0);        break;
+                case 'r': u32PacketRate = strtoul(optarg, NULL, 0);         break;
+                case 's': u32PayloadSize = strtoul(optarg, NULL, 0);        break;
+                case 'l': u32LogInterval = strtoul(optarg, NULL, 0);        break;
+                case 't': u32StartupTimeout = strtoul(optarg, NULL, 0);     break;
+                case 'H':
+                    if (inet_pton(AF_INET6, optarg, &sModule.sHostAddress) <= 0)
+                    {
+                        printf("Invalid host address '%s'\n", optarg);
+                        print_usage_exit(argv);
+                    }
+                    break;
+                case 'N':
+                    if (inet_pton(AF_INET6, optarg, &sModule.sNodeAddress) <= 0)
+                    {
+                        printf("Invalid node address '%s'\n", optarg);
+                        print_usage_exit(argv);
+                    }
+                    break;
+                case 'd':
+                    iDirectionUp   = (strcmp(optarg, "up") == 0)   || (strcmp(optarg, "both") == 0);
+                    iDirectionDown = (strcmp(optarg, "down") == 0) || (strcmp(optarg, "both") == 0);
+                    if (!iDirectionUp && !iDirectionDown)
+                    {
+                        printf("Unknown direction '%s'\n", optarg);
+                        print_usage_exit(argv);
+                    }
+                    break;
+                default: /* '?' */
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if (!pcLinkName || (sSerial.u32BaudRate == 0) || (u32PacketCount == 0) ||
+        (u32PayloadSize < sizeof(tsBenchPayload)) ||
+        (u32PayloadSize > MAX_MESSAGE_LENGTH - IPV6_HEADER_LENGTH - UDP_HEADER_LENGTH))
+    {
+        print_usage_exit(argv);
+    }
+
+    signal(SIGTERM, vQuitSignalHandler);
+    signal(SIGINT, vQuitSignalHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_mutex_init(&sSerial.mutex, NULL);
+
+    if ((iSerialOpen() < 0) || (iPhaseInit(&sPhaseUp) < 0) || (iPhaseInit(&sPhaseDown) < 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (pthread_create(&sReaderThread, NULL, pvSerialReaderThread, NULL) != 0)
+    {
+        perror("pthread_create");
+        return EXIT_FAILURE;
+    }
+
+    /* Wait for 6LoWPANd to connect and complete the handshake */
+    u64Deadline = u64Now() + (uint64_t)u32StartupTimeout * 1000000000ULL;
+    while (bRunning && !sModule.iRunning)
+    {
+        if (u64Now() > u64Deadline)
+        {
+            fprintf(stderr, "Timeout waiting for 6LoWPANd handshake\n");
+            bRunning = 0;
+            iResult = EXIT_FAILURE;
+            break;
+        }
+        usleep(10000);
+    }
+
+    if (bRunning && (iSocketOpen() < 0))
+    {
+        bRunning = 0;
+        iResult = EXIT_FAILURE;
+    }
+
+    if (bRunning)
+    {
+        iPid = iDaemonPid();
+
+        printf("Benchmark: %u packets of %u bytes each way at %u baud, %.1f packets/s offered\n",
+               u32PacketCount, u32PayloadSize, sSerial.u32BaudRate, 1e9 / u64PacketInterval());
+        fflush(stdout);
+
+        if (iDirectionUp)
+        {
+            vPhaseRunUp(&sPhaseUp, iPid);
+            vPhaseReport(&sPhaseUp);
+            if (sPhaseUp.u32Received == 0)
+            {
+                iResult = EXIT_FAILURE;
+            }
+        }
+        if (iDirectionDown && bRunning)
+        {
+            vPhaseRunDown(&sPhaseDown, iPid);
+            vPhaseReport(&sPhaseDown);
+            if (sPhaseDown.u32Received == 0)
+            {
+                iResult = EXIT_FAILURE;
+            }
+        }
+        printf("Module: %u pings answered, %u log messages sent\n", sModule.u32Pings, sModule.u32Logs);
+    }
+
+    bRunning = 0;
+    pthread_join(sReaderThread, NULL);
+
+    if (pcLinkName)
+    {
+        unlink(pcLinkName);
+    }
+    return iResult;
+}
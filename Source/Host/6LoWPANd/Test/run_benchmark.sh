@@ -0,0 +1,132 @@
+#!/bin/sh
+
+# Hardware-free throughput benchmark of 6LoWPANd.
+#
+# Runs 6LoWPANd against ModuleSim (a simulated border router module on a pty)
+# with its tun interface inside a private network namespace, so it can run on
+# any Linux box with user namespaces or as root, without touching the host's
+# network configuration.
+#
+# Exits non-zero if the daemon fails to start or no packets get through, so
+# it can be used as a CI smoke test as well as a benchmark.
+
+BAUD=1000000
+COUNT=1000
+RATE=0
+SIZE=64
+DIRECTION=both
+
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+DAEMON=${DAEMON:-$TEST_DIR/../Build/6LoWPANd}
+MODULESIM=${MODULESIM:-$TEST_DIR/ModuleSim}
+
+INTERFACE=lowpan-bench
+HOST_ADDRESS=fd04:bd3:80e8:2::1
+NODE_ADDRESS=fd04:bd3:80e8:2::2
+
+usage()
+{
+    echo ""
+    echo "Usage: $0 [options]"
+    echo "Options:"
+    echo "-B <baud rate>       Emulated serial baud rate. Default $BAUD"
+    echo "-c <packets>         Packets to send in each direction. Default $COUNT"
+    echo "-r <packets/s>       Offered load, 0 for 80% of the serial line rate. Default $RATE"
+    echo "-s <bytes>           UDP payload size. Default $SIZE"
+    echo "-d <up,down,both>    Directions to measure. Default $DIRECTION"
+    echo ""
+}
+
+while getopts "B:c:r:s:d:h" opt
+do
+    case $opt in
+        B) BAUD=$OPTARG ;;
+        c) COUNT=$OPTARG ;;
+        r) RATE=$OPTARG ;;
+        s) SIZE=$OPTARG ;;
+        d) DIRECTION=$OPTARG ;;
+        *) usage; exit 1 ;;
+    esac
+done
+
+for BINARY in "$DAEMON" "$MODULESIM"
+do
+    if [ ! -x "$BINARY" ]
+    then
+        echo "$BINARY not found - run make first"
+        exit 1
+    fi
+done
+
+# Re-run ourselves in a new network namespace. Use a user namespace too when not root.
+if [ -z "$SIXLOWPAND_BENCH_NETNS" ]
+then
+    export SIXLOWPAND_BENCH_NETNS=1
+    if [ "$(id -u)" = "0" ]
+    then
+        exec unshare --net "$0" "$@"
+    else
+        exec unshare --map-root-user --net "$0" "$@"
+    fi
+fi
+
+WORK_DIR=$(mktemp -d /tmp/6LoWPANd-bench.XXXXXX)
+PTY_LINK=$WORK_DIR/pty
+PID_FILE=$WORK_DIR/6LoWPANd.pid
+
+SIM_PID=""
+DAEMON_PID=""
+
+cleanup()
+{
+    [ -n "$DAEMON_PID" ] && kill "$DAEMON_PID" 2>/dev/null
+    [ -n "$SIM_PID" ] && kill "$SIM_PID" 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$WORK_DIR" "/tmp/6LoWPANd.$INTERFACE"
+}
+trap cleanup EXIT INT TERM
+
+ip link set lo up
+
+"$MODULESIM" -L "$PTY_LINK" -p "$PID_FILE" -B "$BAUD" -c "$COUNT" -r "$RATE" -s "$SIZE" -d "$DIRECTION" \
+             -H "$HOST_ADDRESS" -N "$NODE_ADDRESS" &
+SIM_PID=$!
+
+# Wait for the simulated serial port to appear
+TRIES=0
+while [ ! -e "$PTY_LINK" ]
+do
+    TRIES=$((TRIES + 1))
+    if [ $TRIES -gt 50 ] || ! kill -0 "$SIM_PID" 2>/dev/null
+    then
+        echo "ModuleSim failed to start"
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$DAEMON" -f -v 4 -s "$PTY_LINK" -B "$BAUD" -I "$INTERFACE" &
+DAEMON_PID=$!
+echo "$DAEMON_PID" > "$PID_FILE"
+
+# Wait for the tun interface, then give it the host address
+TRIES=0
+while ! ip link show "$INTERFACE" >/dev/null 2>&1
+do
+    TRIES=$((TRIES + 1))
+    if [ $TRIES -gt 50 ] || ! kill -0 "$DAEMON_PID" 2>/dev/null
+    then
+        echo "6LoWPANd failed to create $INTERFACE"
+        exit 1
+    fi
+    sleep 0.1
+done
+
+ip link set "$INTERFACE" up
+ip -6 addr add "$HOST_ADDRESS/64" dev "$INTERFACE" nodad
+
+wait "$SIM_PID"
+RESULT=$?
+SIM_PID=""
+
+exit $RESULT
@@ -40,6 +40,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -61,23 +62,83 @@
 
 #define OND_BLOCK_SIZE 32
 
+/** Number of blocks sent between adjustments of the adaptive block interval */
+#define OND_RATE_WINDOW             32
+
+/** Percentage by which the estimated goodput must fall before the interval is adjusted in the other direction */
+#define OND_RATE_GOODPUT_MARGIN     20
+
+/** The configured interval is the fastest the download will go. It may back off
+ *  to (configured interval * OND_RATE_MAX_MULTIPLIER) */
+#define OND_RATE_MAX_MULTIPLIER     4
+
+/** Repairs stop, leaving any stragglers to the server thread, once this many times the image has been sent */
+#define OND_MAX_SEND_FACTOR         8
+
+/** Minimum time to wait for block requests after a round before declaring the download finished */
+#define OND_REPAIR_HOLDOFF_MS       1000
+
+/** Hold off is at least this many configured block intervals */
+#define OND_REPAIR_HOLDOFF_INTERVALS 50
+
+/** Longest the scheduler sleeps before looking for new downloads and block requests */
+#define OND_SCHEDULER_POLL_MS       50
+
+/** Number of packets the global rate limit lets go back to back after a quiet period */
+#define OND_SCHEDULER_BURST         2
+
 extern int verbosity;
 
-/** Structure to represent a download thread */
+
+/** State of a broadcast download */
+typedef enum
+{
+    E_OND_DOWNLOAD_BROADCASTING,        /** < Broadcasting the blocks in the missing block bitmap */
+    E_OND_DOWNLOAD_HOLDING_OFF,         /** < Round complete, waiting for block requests */
+    E_OND_DOWNLOAD_FINISHED,            /** < Complete or failed, waiting to be removed by the scheduler */
+} teONDDownloadState;
+
+
+/** Structure to represent a broadcast download.
+ *  Downloads are run by the scheduler thread, which is the only thread that frees them.
+ *  All fields are protected by sONDDownloadListLock. */
 typedef struct _tsONDDownload
 {
-    tsLock                  sStopSignal;        /** < Lock used to signal thread to stop.
-                                                      Remains locked by main thread unless thread is to stop. */    
-    
     tsOND *psOND;                               /** < Pointer to OND information */
     teFlags eFlags;                             /** < Flags for the download */
     struct in6_addr         sCoordinatorAddress;/** < IPv6 address of coordinator node */
+    char                    acCoordinatorAddress[INET6_ADDRSTRLEN]; /** < Printable coordinator address */
     tsFirmwareID            sFirmwareID;        /** < ID of firmware to download */
 
     uint16_t                u16BlockInterval;   /** < Amount of time between blocks, (in units of 10ms) */
-    tsThread                sThreadInfo;        /** < Monitor Thread data */
+
+    teONDDownloadState      eState;             /** < Current state of the download */
+    int                     iSendInitiate;      /** < Set when the initiate packet is to be sent next */
+    int                     iCancelled;         /** < Set when the download has been cancelled */
+
+    uint32_t                u32TotalBlocks;     /** < Number of blocks in the image */
+    uint32_t                *pu32MissingBlocks; /** < Bitmap of blocks still to be broadcast, aggregated
+                                                      across all requesting nodes. NULL until the broadcast starts */
+    uint32_t                u32MissingBlocks;   /** < Number of bits set in pu32MissingBlocks */
+    uint32_t                u32NewRequests;     /** < Blocks newly marked missing since the last rate adjustment */
+
+    uint32_t                u32Timeout;         /** < Node timeout sent in block packets */
+    uint32_t                u32Cursor;          /** < Position in the current round */
+    uint32_t                u32Round;           /** < Number of repair rounds so far */
+    uint32_t                u32BlocksSent;      /** < Number of blocks broadcast so far */
+    uint32_t                u32BaseIntervalMs;  /** < Configured block interval, and the fastest allowed */
+    uint32_t                u32MaxIntervalMs;   /** < Slowest block interval allowed */
+    uint32_t                u32IntervalMs;      /** < Current adaptive block interval */
+    uint32_t                u32HoldOffMs;       /** < Time to wait for requests after a round */
+    uint32_t                u32PrevGoodput;     /** < Goodput estimate for the last rate window */
+    int                     iSpeedUp;           /** < Direction of the last interval adjustment */
+
+    uint64_t                u64NextSendTime;    /** < Earliest time of the next packet at this download's own pace (us) */
+    uint64_t                u64HoldOffEnd;      /** < Time the hold off after a round ends (us) */
+    uint64_t                u64VirtualTime;     /** < Fair queueing virtual time. The ready download with the lowest goes next */
+
     struct _tsONDDownload   *psNext;            /** < Pointer to next in list */
-} tsONDDownloadThreadInfo;
+} tsONDDownload;
 
 
 /** Structure to represent a reset thread */
@@ -85,11 +146,11 @@ typedef struct _tsONDReset
 {
     tsOND *psOND;                               /** < Pointer to OND information */
     struct in6_addr sCoordinatorAddress;        /** < IPv6 address of coordinator node */
-    uint32_t u32DeviceID;                       /** < Device ID to reset */                       
-    
+    uint32_t u32DeviceID;                       /** < Device ID to reset */
+
     uint16_t u16Timeout;                        /** < Timeout for reset (units of 10ms) */
     uint16_t u16DepthInfluence;                 /** < Amount of depth infulence to apply */
-    
+
     uint16_t u16RepeatCount;                    /** < How many times to repeat the command */
     uint16_t u16RepeatTime;                     /** < Time between repeats (units of 10ms) */
 
@@ -98,11 +159,23 @@ typedef struct _tsONDReset
 
 
 /** Head of linked list */
-static tsONDDownloadThreadInfo *psONDDownloadThread_ListHead = NULL;
+static tsONDDownload *psONDDownload_ListHead = NULL;
+
 
+/** Thread protection for the OND downloads linked list, and the scheduler state below */
+static tsLock sONDDownloadListLock;
 
-/** Thread protection for OND Download threads linked list */
-static tsLock sONDDownloadThreadListLock;
+
+/** Time between packets at the global packet rate limit (us). 0 if there is no limit */
+static uint64_t u64ONDScheduler_PacketInterval = 0;
+
+
+/** Time from which the global packet rate limit allows the next packet (us) */
+static uint64_t u64ONDScheduler_NextSendTime = 0;
+
+
+/** Virtual time of the last packet sent by the scheduler */
+static uint64_t u64ONDScheduler_VirtualTime = 0;
 
 
 /** Firmware server thread
@@ -113,18 +186,25 @@ static tsLock sONDDownloadThreadListLock;
 static void *ONDServerThread(void *psThreadInfoVoid);
 
 
-/** Firmware download thread
- *  These threads do a broadcast download of blocks of a signel firmware image.
- *  After successful download, the thread quits.
- *  Any missing blocks are sent by the server thread
- *  \param psThreadInfoVoid  Pointer to ThreadInfo structure containging pointer to tsONDDownloadThreadInfo structure
+/** Download scheduler thread
+ *  This thread runs every broadcast download. The first round of a download broadcasts every
+ *  block. Block requests received while the download is running are folded into its missing
+ *  block bitmap by the server thread, and further repair rounds broadcast only the requested
+ *  blocks. Each download adapts its own block interval to the rate of requests. When no more
+ *  requests arrive the download finishes, and any later requests are sent individually by the
+ *  server thread.
+ *  Packets of all downloads share one link, so they are multiplexed by weighted fair queueing:
+ *  of the downloads ready to send at their own pace, the one with the lowest virtual time goes
+ *  next, and its virtual time advances by its block interval. Under the global packet rate limit
+ *  each download therefore gets a share in proportion to the rate it asked for.
+ *  \param psThreadInfoVoid  Pointer to ThreadInfo structure containing pointer to OND structure
  *  \return None
  */
-static void *ONDDownloadThread(void *psThreadInfoVoid);
+static void *ONDSchedulerThread(void *psThreadInfoVoid);
 
 
 /** Function to send a single block of a firmware image.
- *  Used by both the server thread and all download threads
+ *  Used by both the server thread and the scheduler thread
  *  \param psOND                Pointer to OND structure (used for network access)
  *  \param sCoordinatorAddress  IPv6 Address of Coordinator
  *  \param u32AddressH          High word of Desitnation node MAC address
@@ -132,49 +212,146 @@ static void *ONDDownloadThread(void *psThreadInfoVoid);
  *  \param sFirmwareID          Structure defining the firmware to be sent
  *  \param u16BlockNumber       Which block number of the image to send
  *  \param u16TotalBlocks       Total number of blocks in the image
+ *  \param u16RemainingBlocks   Number of blocks still to send, for the status log
  *  \param u32Timeout           Timeout for node. (Or'ing with 0x80000000 means reset immediately after download)
  *                              Timeout measured in xxx fractions of a second
  *  \return OND_STATUS_OK on success
  */
-static teONDStatus eONDSendBlock(tsOND *psOND, struct in6_addr sCoordinatorAddress, 
-                                 uint32_t u32AddressH, uint32_t u32AddressL, tsFirmwareID sFirmwareID, 
-                                 uint16_t u16BlockNumber, uint16_t u16TotalBlocks, uint32_t u32Timeout);
+static teONDStatus eONDSendBlock(tsOND *psOND, struct in6_addr sCoordinatorAddress,
+                                 uint32_t u32AddressH, uint32_t u32AddressL, tsFirmwareID sFirmwareID,
+                                 uint16_t u16BlockNumber, uint16_t u16TotalBlocks,
+                                 uint16_t u16RemainingBlocks, uint32_t u32Timeout);
+
+
+/** Function to send the packet informing nodes that a download is about to begin.
+ *  \param psOND                Pointer to OND structure (used for network access)
+ *  \param sCoordinatorAddress  IPv6 Address of Coordinator
+ *  \param sFirmwareID          Structure defining the firmware to be sent
+ *  \return OND_STATUS_OK on success
+ */
+static teONDStatus eONDSendInitiate(tsOND *psOND, struct in6_addr sCoordinatorAddress, tsFirmwareID sFirmwareID);
+
+
+/** Work out a download's interval limits and node timeout from its configured block interval,
+ *  and store the timeout in the firmware record for the server thread.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param psDownload           Pointer to download structure
+ *  \return OND_STATUS_OK on success
+ */
+static teONDStatus eONDDownload_Configure(tsONDDownload *psDownload);
+
+
+/** Update a download after its initiate packet has been sent. Starts the first round of the
+ *  broadcast, or finishes the download if only the initiate packet was wanted.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param psDownload           Pointer to download structure
+ *  \param u64Now               Current time (us)
+ *  \return None
+ */
+static void vONDDownload_Initiated(tsONDDownload *psDownload, uint64_t u64Now);
+
+
+/** Handle the end of a round. Holds off for requests if no blocks are outstanding,
+ *  otherwise starts a new round.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param psDownload           Pointer to download structure
+ *  \param u64Now               Current time (us)
+ *  \return None
+ */
+static void vONDDownload_EndRound(tsONDDownload *psDownload, uint64_t u64Now);
+
+
+/** Start a repair round of the outstanding blocks, unless the download has sent too many already.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param psDownload           Pointer to download structure
+ *  \return None
+ */
+static void vONDDownload_NewRound(tsONDDownload *psDownload);
+
+
+/** Adapt a download's block interval to the rate of block requests over the last window.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param psDownload           Pointer to download structure
+ *  \return None
+ */
+static void vONDDownload_AdaptInterval(tsONDDownload *psDownload);
+
+
+/** Mark a block as needing to be broadcast again by a download.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param psDownload           Pointer to download structure
+ *  \param u16BlockNumber       Block that has been requested
+ *  \return None
+ */
+static void vONDDownload_MarkBlock(tsONDDownload *psDownload, uint16_t u16BlockNumber);
+
+
+/** Get the next block to broadcast in the current round and clear it from the missing block bitmap.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param psDownload           Pointer to download structure
+ *  \param pu32Cursor           Position in the current round. Updated to follow the returned block.
+ *  \return Block number, or -1 if there are no more blocks to send in this round
+ */
+static int iONDDownload_NextBlock(tsONDDownload *psDownload, uint32_t *pu32Cursor);
+
 
+/** Account for a packet against the global packet rate limit.
+ *  The calling function should hold \ref sONDDownloadListLock.
+ *  \param u64Now               Current time (us)
+ *  \return None
+ */
+static void vONDScheduler_Charge(uint64_t u64Now);
+
+
+/** Get the time from a monotonic clock
+ *  \return Time in microseconds
+ */
+static uint64_t u64ONDTimeNow(void);
 
-/** Find a reference to an ongoing download thread
- *  The calling function should lock the \ref sONDDownloadThreadListLock before calling
+
+/** Find a reference to an ongoing download
+ *  The calling function should lock the \ref sONDDownloadListLock before calling
  *  this function to ensure any returned reference is still valid.
+ *  Downloads that have finished or been cancelled, but not yet been removed, are not returned.
  *  \param sCoordinatorAddress  IPv6 address of network entry point
  *  \param u32DeviceID          Device ID of the destination nodes
  *  \param u16ChipType          Chip type of the destination nodes
  *  \param u16Revision          Which revision to broadcast
- *  \return Pointer to download thread info structure if found, otherwise NULL.
+ *  \return Pointer to download structure if found, otherwise NULL.
  */
-static tsONDDownloadThreadInfo *psONDDownloadThread_Find(struct in6_addr sCoordinatorAddress, uint32_t u32DeviceID, 
+static tsONDDownload *psONDDownload_Find(struct in6_addr sCoordinatorAddress, uint32_t u32DeviceID,
                               uint16_t u16ChipType, uint16_t u16Revision);
 
 
 /* Initialise module */
-teONDStatus eONDInitialise(tsOND *psOND, const char *pcBindAddress, const char *pcPortNumber)
+teONDStatus eONDInitialise(tsOND *psOND, const char *pcBindAddress, const char *pcPortNumber, uint32_t u32MaxPacketRate)
 {
     teONDStatus eONDStatus;
-    
+
     /* Initialise network */
     eONDStatus = eONDNetworkInitialise(&psOND->sONDNetwork, pcBindAddress, pcPortNumber);
     if (eONDStatus != OND_STATUS_OK)
     {
         return eONDStatus;
     }
-    
-    /* Initialise download threads related items */
-    if (eLockCreate(&sONDDownloadThreadListLock) != E_LOCK_OK)
+
+    /* Initialise download related items */
+    if (eLockCreate(&sONDDownloadListLock) != E_LOCK_OK)
     {
         daemon_log(LOG_CRIT, "OND: Failed to initialise lock");
         return OND_STATUS_ERROR;
     }
-    psONDDownloadThread_ListHead = NULL;
-    
-    
+    psONDDownload_ListHead = NULL;
+
+    u64ONDScheduler_PacketInterval = u32MaxPacketRate ? (1000000 / u32MaxPacketRate) : 0;
+    u64ONDScheduler_NextSendTime = 0;
+    u64ONDScheduler_VirtualTime = 0;
+
+    if (u32MaxPacketRate)
+    {
+        daemon_log(LOG_INFO, "OND: Downloads limited to %d packets per second", u32MaxPacketRate);
+    }
+
     /* Initialise server thread releated items */
     if (eLockCreate(&psOND->sServerLock) != E_LOCK_OK)
     {
@@ -190,6 +367,14 @@ teONDStatus eONDInitialise(tsOND *psOND, const char *pcBindAddress, const char *
         return OND_STATUS_ERROR;
     }
 
+    psOND->sSchedulerThread.pvThreadData = psOND;
+
+    if (eThreadStart(ONDSchedulerThread, &psOND->sSchedulerThread) != E_THREAD_OK)
+    {
+        daemon_log(LOG_CRIT, "OND: Failed to start scheduler thread");
+        return OND_STATUS_ERROR;
+    }
+
     return OND_STATUS_OK;
 }
 
@@ -254,7 +439,7 @@ static void *ONDServerThread(void *psThreadInfoVoid)
                 }
                 
                 /* Check that a valid block is being requested */
-                if (sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u16BlockNumber > u32TotalBlocks)
+                if (sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u16BlockNumber >= u32TotalBlocks)
                 {
                     if (verbosity > 5)
                     {
@@ -265,10 +450,36 @@ static void *ONDServerThread(void *psThreadInfoVoid)
                                    sFirmwareID.u16Revision, sFirmwareID.u32DeviceID, buffer,
                                    sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u32AddressH,
                                    sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u32AddressL);
-                        continue;
                     }
+                    continue;
                 }
                 
+                /* If a broadcast of this image to this coordinator is in progress, add the block to its
+                 * missing block bitmap. One repair broadcast then serves every node that missed it. */
+                {
+                    tsONDDownload *psDownload;
+                    int iQueued = 0;
+                    
+                    eLockLock(&sONDDownloadListLock);
+                    psDownload = psONDDownload_Find(sAddress, sFirmwareID.u32DeviceID, 
+                                                    sFirmwareID.u16ChipType, sFirmwareID.u16Revision);
+                    if (psDownload && psDownload->pu32MissingBlocks)
+                    {
+                        vONDDownload_MarkBlock(psDownload, sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u16BlockNumber);
+                        iQueued = 1;
+                    }
+                    else
+                    {
+                        /* The unicast goes out straight away, but counts against the scheduler's packet rate */
+                        vONDScheduler_Charge(u64ONDTimeNow());
+                    }
+                    eLockUnlock(&sONDDownloadListLock);
+                    
+                    if (iQueued)
+                    {
+                        continue;
+                    }
+                }
                 
                 if (eFirmware_Get_Timeout(sFirmwareID, &u32Timeout) == FW_STATUS_OK)
                 {
@@ -279,7 +490,9 @@ static void *ONDServerThread(void *psThreadInfoVoid)
                                     sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u32AddressL,
                                     sFirmwareID, 
                                     sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u16BlockNumber,
-                                    u32TotalBlocks, u32Timeout);
+                                    u32TotalBlocks, 
+                                    (u32TotalBlocks - 1) - sONDReceivedPacket.uPayload.sONDPacketBlockRequest.u16BlockNumber,
+                                    u32Timeout);
                 }
             }
         }
@@ -289,276 +502,337 @@ static void *ONDServerThread(void *psThreadInfoVoid)
 
 
 /* Start a download */
-teONDStatus eONDStartDownload(tsOND *psOND, struct in6_addr sCoordinatorAddress, 
-                              uint32_t u32DeviceID, uint16_t u16ChipType, uint16_t u16Revision, 
+teONDStatus eONDStartDownload(tsOND *psOND, struct in6_addr sCoordinatorAddress,
+                              uint32_t u32DeviceID, uint16_t u16ChipType, uint16_t u16Revision,
                               uint16_t u16BlockInterval, teFlags eFlags)
 {
-    tsONDDownloadThreadInfo *psDownloadThreadInfo;
-    
+    tsONDDownload *psDownload;
+    tsFirmwareID sFirmwareID;
+    uint32_t u32TotalBlocks;
+    char buffer[INET6_ADDRSTRLEN] = "Could not determine address\n";
+
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
-    
-    eLockLock(&sONDDownloadThreadListLock);
-    
-    if (psONDDownloadThread_Find(sCoordinatorAddress, u32DeviceID, u16ChipType, u16Revision) != NULL)
+
+    inet_ntop(AF_INET6, &sCoordinatorAddress, buffer, INET6_ADDRSTRLEN);
+
+    sFirmwareID.u32DeviceID = u32DeviceID;
+    sFirmwareID.u16ChipType = u16ChipType;
+    sFirmwareID.u16Revision = u16Revision;
+
+    /* Get total number of blocks in the image, if we have it loaded */
+    if (eFirmware_Get_Total_Blocks(sFirmwareID, OND_BLOCK_SIZE, &u32TotalBlocks) != FW_STATUS_OK)
     {
-        char buffer[INET6_ADDRSTRLEN] = "Could not determine address\n";
-        inet_ntop(AF_INET6, &sCoordinatorAddress, buffer, INET6_ADDRSTRLEN);
-        daemon_log(LOG_INFO, "OND: Download already running for coordinator %s, Device ID 0x%08x, ChipType 0x%04x, Revision 0x%04x\n",
-                    buffer, u32DeviceID, u16ChipType, u16Revision);
-        
-        eLockUnlock(&sONDDownloadThreadListLock);
+        daemon_log(LOG_ERR, "OND: No firmware revision %d for device ID 0x%08x for coordinator \"%s\"",
+                   u16Revision, u32DeviceID, buffer);
         return OND_STATUS_ERROR;
     }
 
-    psDownloadThreadInfo = malloc(sizeof(tsONDDownloadThreadInfo));
-    if (!psDownloadThreadInfo)
+    eLockLock(&sONDDownloadListLock);
+
+    psDownload = psONDDownload_Find(sCoordinatorAddress, u32DeviceID, u16ChipType, u16Revision);
+    if (psDownload != NULL)
     {
-        daemon_log(LOG_CRIT, "OND: Out of memory");
-        return OND_STATUS_ERROR;
+        /* One broadcast serves every node behind the coordinator, so join the running download
+         * rather than sending the image twice. Send the initiate packet again for any nodes that
+         * have joined since, and they will request the blocks they missed. */
+        daemon_log(LOG_INFO, "OND: Joining download already running for coordinator %s, Device ID 0x%08x, ChipType 0x%04x, Revision 0x%04x\n",
+                    buffer, u32DeviceID, u16ChipType, u16Revision);
+
+        if (!(eFlags & E_DOWNLOAD_FLAG_INITIATE_ONLY))
+        {
+            psDownload->eFlags &= ~E_DOWNLOAD_FLAG_INITIATE_ONLY;
+        }
+        psDownload->eFlags |= (eFlags & E_DOWNLOAD_FLAG_IMMEDIATE_RESET);
+
+        if (u16BlockInterval < psDownload->u16BlockInterval)
+        {
+            psDownload->u16BlockInterval = u16BlockInterval;
+        }
+        psDownload->iSendInitiate = 1;
+
+        eLockUnlock(&sONDDownloadListLock);
+        return OND_STATUS_OK;
     }
-    
-    DBG_vPrintf(DBG_OND, "Allocated new Thread info at %p\n", psDownloadThreadInfo);
-    
-    memset(psDownloadThreadInfo, 0, sizeof(tsONDDownloadThreadInfo));
-    
-    psDownloadThreadInfo->sThreadInfo.pvThreadData = psDownloadThreadInfo;
-    
-    psDownloadThreadInfo->psOND = psOND;
-    psDownloadThreadInfo->eFlags = eFlags;
-    psDownloadThreadInfo->sCoordinatorAddress = sCoordinatorAddress;
-    psDownloadThreadInfo->sFirmwareID.u32DeviceID = u32DeviceID;
-    psDownloadThreadInfo->sFirmwareID.u16ChipType = u16ChipType;
-    psDownloadThreadInfo->sFirmwareID.u16Revision = u16Revision;
-    psDownloadThreadInfo->u16BlockInterval        = u16BlockInterval;
-    eLockCreate(&psDownloadThreadInfo->sStopSignal);
-    
-    /* Lock mutex to main thread. Will be released to stop the thread. */
-    eLockLock(&psDownloadThreadInfo->sStopSignal);
-    
-    DBG_vPrintf(DBG_OND, "Starting thread\n");
-    
-    if (eThreadStart(ONDDownloadThread, &psDownloadThreadInfo->sThreadInfo) != E_THREAD_OK)
+
+    psDownload = malloc(sizeof(tsONDDownload));
+    if (!psDownload)
     {
-        daemon_log(LOG_CRIT, "OND: Failed to start download thread");
-        eLockUnlock(&sONDDownloadThreadListLock);
+        daemon_log(LOG_CRIT, "OND: Out of memory");
+        eLockUnlock(&sONDDownloadListLock);
         return OND_STATUS_ERROR;
     }
-    
-    if (psONDDownloadThread_ListHead == NULL)
+
+    DBG_vPrintf(DBG_OND, "Allocated new download at %p\n", psDownload);
+
+    memset(psDownload, 0, sizeof(tsONDDownload));
+
+    psDownload->psOND = psOND;
+    psDownload->eFlags = eFlags;
+    psDownload->sCoordinatorAddress = sCoordinatorAddress;
+    strcpy(psDownload->acCoordinatorAddress, buffer);
+    psDownload->sFirmwareID         = sFirmwareID;
+    psDownload->u16BlockInterval    = u16BlockInterval;
+    psDownload->u32TotalBlocks      = u32TotalBlocks;
+    psDownload->eState              = E_OND_DOWNLOAD_BROADCASTING;
+    psDownload->iSendInitiate       = 1;
+    psDownload->iSpeedUp            = 1;
+
+    /* Start level with the downloads already running, so it neither waits behind nor jumps ahead of them */
+    psDownload->u64VirtualTime      = u64ONDScheduler_VirtualTime;
+
+    /* Add to the end of the list for the scheduler to pick up */
+    if (psONDDownload_ListHead == NULL)
     {
         /* First in list */
-        psONDDownloadThread_ListHead = psDownloadThreadInfo;
+        psONDDownload_ListHead = psDownload;
     }
     else
     {
-        tsONDDownloadThreadInfo *psListPosition = psONDDownloadThread_ListHead;
+        tsONDDownload *psListPosition = psONDDownload_ListHead;
         while (psListPosition->psNext)
         {
             psListPosition = psListPosition->psNext;
         }
-        psListPosition->psNext = psDownloadThreadInfo;
+        psListPosition->psNext = psDownload;
     }
 
-    eLockUnlock(&sONDDownloadThreadListLock);
+    eLockUnlock(&sONDDownloadListLock);
+
+    daemon_log(LOG_INFO, "OND: Starting download of image revision %d for device ID 0x%08x to coordinator \"%s\"",
+               u16Revision, u32DeviceID, buffer);
 
     return OND_STATUS_OK;
 }
 
 
-teONDStatus eONDCancelDownload(tsOND *psOND, struct in6_addr sCoordinatorAddress, uint32_t u32DeviceID, 
+teONDStatus eONDCancelDownload(tsOND *psOND, struct in6_addr sCoordinatorAddress, uint32_t u32DeviceID,
                                uint16_t u16ChipType, uint16_t u16Revision)
 {
-    tsONDDownloadThreadInfo *psDownloadThreadInfo;
+    tsONDDownload *psDownload;
     char buffer[INET6_ADDRSTRLEN] = "Could not determine address\n";
     inet_ntop(AF_INET6, &sCoordinatorAddress, buffer, INET6_ADDRSTRLEN);
-    
-    eLockLock(&sONDDownloadThreadListLock);
-    
-    psDownloadThreadInfo = psONDDownloadThread_Find(sCoordinatorAddress, u32DeviceID, u16ChipType, u16Revision);
-    
-    if (psDownloadThreadInfo != NULL)
+
+    eLockLock(&sONDDownloadListLock);
+
+    psDownload = psONDDownload_Find(sCoordinatorAddress, u32DeviceID, u16ChipType, u16Revision);
+
+    if (psDownload != NULL)
     {
         daemon_log(LOG_INFO, "OND: Download still running for coordinator %s, Device ID 0x%08x, ChipType 0x%04x, Revision 0x%04x\n",
                     buffer, u32DeviceID, u16ChipType, u16Revision);
-        
-        /* Unlock mutex to signal the thread to stop. */
-        eLockUnlock(&psDownloadThreadInfo->sStopSignal);
-        
-        /* Thread should have stopped by now, and the pointer we had is no longer valid. This is a bit messy. */
-        psDownloadThreadInfo = NULL;
+
+        /* Flag the download for the scheduler to remove. */
+        psDownload->iCancelled = 1;
     }
-    eLockUnlock(&sONDDownloadThreadListLock);
-    
+    eLockUnlock(&sONDDownloadListLock);
+
     daemon_log(LOG_INFO, "OND: Clearing status for coordinator %s, Device ID 0x%08x, ChipType 0x%04x, Revision 0x%04x\n",
                     buffer, u32DeviceID, u16ChipType, u16Revision);
-    
+
     {
         tsFirmwareID sFirmwareID;
         sFirmwareID.u32DeviceID = u32DeviceID;
         sFirmwareID.u16ChipType = u16ChipType;
         sFirmwareID.u16Revision = u16Revision;
-        
+
         /* Clear the broadcast entry, and all other entries */
         (void)StatusLogRemove(sFirmwareID, sCoordinatorAddress, 0xffffffff, 0xffffffff);
     }
-    
+
     return OND_STATUS_OK;
 }
 
 
-/* Broadcast download thread */
-static void *ONDDownloadThread(void *psThreadInfoVoid)
+/* Download scheduler thread */
+static void *ONDSchedulerThread(void *psThreadInfoVoid)
 {
     tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
-    tsONDDownloadThreadInfo *psDownloadThreadInfo = (tsONDDownloadThreadInfo *)psThreadInfo->pvThreadData;
-    char     acCoordinatorAddress[INET6_ADDRSTRLEN] = "Could not determine address\n";
-    uint16_t u16BlockNumber = 0;
-    uint32_t u32TotalBlocks;
-    uint32_t u32Timeout = 0;
-    teFWStatus eFWStatus;
-    
+    tsOND *psOND = (tsOND *)psThreadInfo->pvThreadData;
+
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s (%p)\n", __FUNCTION__, psThreadInfoVoid);
-    
-    inet_ntop(AF_INET6, &psDownloadThreadInfo->sCoordinatorAddress, acCoordinatorAddress, INET6_ADDRSTRLEN);
 
-    /* Get total number of blocks in the image, if we have it loaded */
-    eFWStatus = eFirmware_Get_Total_Blocks(psDownloadThreadInfo->sFirmwareID, OND_BLOCK_SIZE, &u32TotalBlocks);
-    if (eFWStatus != FW_STATUS_OK)
+    while (1)
     {
-        daemon_log(LOG_ERR, "OND: No firmware revision %d for device ID 0x%08x for coordinator \"%s\"",
-                   psDownloadThreadInfo->sFirmwareID.u16Revision, psDownloadThreadInfo->sFirmwareID.u32DeviceID, acCoordinatorAddress);
-        goto exit;
-    }
+        tsONDDownload **ppsDownload;
+        tsONDDownload *psSelected = NULL;
+        uint64_t u64Now, u64Wake;
+        int iInitiate = 0;
+        int iBlockNumber = -1;
+        uint32_t u32RemainingBlocks = 0;
+        teONDStatus eStatus;
+
+        eLockLock(&sONDDownloadListLock);
+
+        u64Now  = u64ONDTimeNow();
+        u64Wake = u64Now + (OND_SCHEDULER_POLL_MS * 1000);
+
+        /* Update the state of each download, and find the one to send the next packet */
+        ppsDownload = &psONDDownload_ListHead;
+        while (*ppsDownload)
+        {
+            tsONDDownload *psDownload = *ppsDownload;
 
-    daemon_log(LOG_INFO, "OND: Starting download of image revision %d for device ID 0x%08x to coordinator \"%s\"",
-               psDownloadThreadInfo->sFirmwareID.u16Revision, psDownloadThreadInfo->sFirmwareID.u32DeviceID, 
-               acCoordinatorAddress);
+            if (psDownload->eState == E_OND_DOWNLOAD_HOLDING_OFF)
+            {
+                if (psDownload->u32MissingBlocks)
+                {
+                    /* Blocks have been requested */
+                    vONDDownload_NewRound(psDownload);
+                }
+                else if (u64Now >= psDownload->u64HoldOffEnd)
+                {
+                    /* No more requests, we're done */
+                    daemon_log(LOG_INFO, "OND: Finished download of image revision %d for device ID 0x%08x to coordinator \"%s\" (%d blocks sent in %d rounds)",
+                               psDownload->sFirmwareID.u16Revision, psDownload->sFirmwareID.u32DeviceID,
+                               psDownload->acCoordinatorAddress, psDownload->u32BlocksSent, psDownload->u32Round + 1);
+                    psDownload->eState = E_OND_DOWNLOAD_FINISHED;
+                }
+                else if (psDownload->u64HoldOffEnd < u64Wake)
+                {
+                    u64Wake = psDownload->u64HoldOffEnd;
+                }
+            }
 
-    {
-        /* Send the initialise packet */
-        tsONDPacket sONDPacket;
-        
-        sONDPacket.eType = OND_PACKET_INITIATE;
-        sONDPacket.uPayload.sONDPacketInitiate.u32DeviceID = psDownloadThreadInfo->sFirmwareID.u32DeviceID;
-        sONDPacket.uPayload.sONDPacketInitiate.u16ChipType = psDownloadThreadInfo->sFirmwareID.u16ChipType;
-        sONDPacket.uPayload.sONDPacketInitiate.u16Revision = psDownloadThreadInfo->sFirmwareID.u16Revision;
-        
-        if (eONDNetworkSendPacket(&psDownloadThreadInfo->psOND->sONDNetwork, psDownloadThreadInfo->sCoordinatorAddress, &sONDPacket) != OND_STATUS_OK)
-        {
-            daemon_log(LOG_ERR, "OND: Error sending initiate packet");
-            goto exit;
+            if (psDownload->iCancelled || (psDownload->eState == E_OND_DOWNLOAD_FINISHED))
+            {
+                if (psDownload->iCancelled)
+                {
+                    daemon_log(LOG_INFO, "OND: Cancelled download of image revision %d for device ID 0x%08x to coordinator \"%s\"",
+                               psDownload->sFirmwareID.u16Revision, psDownload->sFirmwareID.u32DeviceID,
+                               psDownload->acCoordinatorAddress);
+                }
+
+                /* Remove from linked list and clean up */
+                *ppsDownload = psDownload->psNext;
+                free(psDownload->pu32MissingBlocks);
+                free(psDownload);
+                continue;
+            }
+
+            if (psDownload->iSendInitiate || (psDownload->eState == E_OND_DOWNLOAD_BROADCASTING))
+            {
+                if (psDownload->u64NextSendTime <= u64Now)
+                {
+                    if ((psSelected == NULL) || (psDownload->u64VirtualTime < psSelected->u64VirtualTime))
+                    {
+                        psSelected = psDownload;
+                    }
+                }
+                else if (psDownload->u64NextSendTime < u64Wake)
+                {
+                    u64Wake = psDownload->u64NextSendTime;
+                }
+            }
+
+            ppsDownload = &psDownload->psNext;
         }
-        
-    }
-    
-    if (psDownloadThreadInfo->eFlags & E_DOWNLOAD_FLAG_INITIATE_ONLY)
-    {
-        daemon_log(LOG_INFO, "OND: Initiate packet sent for image revision %d for device ID 0x%08x to coordinator \"%s\"",
-                   psDownloadThreadInfo->sFirmwareID.u16Revision, psDownloadThreadInfo->sFirmwareID.u32DeviceID, acCoordinatorAddress);
-        goto exit;
-    }
 
-    // Block timeout is 62500 / second. Block interval is passed in units of 10ms
-    // 1 second = 62500 timeout, 100 interval.
-    u32Timeout = 625 * psDownloadThreadInfo->u16BlockInterval;
-    
-    if (psDownloadThreadInfo->eFlags & E_DOWNLOAD_FLAG_IMMEDIATE_RESET)
-    {
-        /* Set the auto-reset flag */
-        u32Timeout |= 0x80000000;
-    }
-    else
-    {
-        /* Clear the auto-reset flag */
-        u32Timeout &= ~0x80000000;
-    }
-    
-    if (eFirmware_Set_Timeout(psDownloadThreadInfo->sFirmwareID, u32Timeout) != FW_STATUS_OK)
-    {
-        /* Store the potentially modified timeout value back to the firmware record */
-        daemon_log(LOG_ERR, "OND: Error setting firmware timeout value");
-        goto exit;
-    }
-    
-    /* Now the main loop broadcasting each block in turn */
-    for (u16BlockNumber = 0; 
-        (u16BlockNumber < u32TotalBlocks); 
-         u16BlockNumber++)
-    {
-        
-        if (eONDSendBlock(psDownloadThreadInfo->psOND, psDownloadThreadInfo->sCoordinatorAddress, 
-                          0xFFFFFFFF,
-                          0xFFFFFFFF,
-                          psDownloadThreadInfo->sFirmwareID, 
-                          u16BlockNumber,
-                          u32TotalBlocks, u32Timeout) != OND_STATUS_OK)
+        if (psSelected && u64ONDScheduler_PacketInterval && (u64ONDScheduler_NextSendTime > u64Now))
         {
-            daemon_log(LOG_ERR, "OND: Error sending block %d/%d to coordinator \"%s\"", 
-                       u16BlockNumber, u32TotalBlocks, acCoordinatorAddress);
-            goto exit;
+            /* Over the global packet rate. Wait for it to allow another */
+            if (u64ONDScheduler_NextSendTime < u64Wake)
+            {
+                u64Wake = u64ONDScheduler_NextSendTime;
+            }
+            psSelected = NULL;
         }
-        
-        /* Now attempt to lock a mutex for the block interval. */
-        /* Block interval is in units of 10 milliseconds */
-        switch (eLockLockTimed(&psDownloadThreadInfo->sStopSignal, psDownloadThreadInfo->u16BlockInterval * 10))
+
+        if (psSelected)
         {
-            case(E_LOCK_OK):
-                /* We have grabbed the lock, so the main thread has let go of it to signal us to stop. */
-                daemon_log(LOG_INFO, "OND: Cancelled download of image revision %d for device ID 0x%08x to coordinator \"%s\"",
-                            psDownloadThreadInfo->sFirmwareID.u16Revision, psDownloadThreadInfo->sFirmwareID.u32DeviceID, 
-                            acCoordinatorAddress);
-                goto exit;
-
-            case(E_LOCK_ERROR_FAILED):
-            case(E_LOCK_ERROR_TIMEOUT):
-            default:
-                /* No signal, keep going. */
-                if (verbosity >= LOG_DEBUG)
+            if (psSelected->iSendInitiate)
+            {
+                iInitiate = 1;
+                psSelected->iSendInitiate = 0;
+            }
+            else
+            {
+                iBlockNumber = iONDDownload_NextBlock(psSelected, &psSelected->u32Cursor);
+                if (iBlockNumber < 0)
                 {
-                    daemon_log(LOG_DEBUG, "OND: No signal received, keep downloading.");
+                    /* End of a round. Look again without sending */
+                    vONDDownload_EndRound(psSelected, u64Now);
+                    eLockUnlock(&sONDDownloadListLock);
+                    continue;
                 }
+                u32RemainingBlocks = psSelected->u32MissingBlocks;
+            }
+
+            /* Advance the virtual time by the download's interval, so downloads asking for a
+             * faster rate get a bigger share. Downloads that have been idle start from the
+             * current virtual time, so they don't build up credit. */
+            if (psSelected->u64VirtualTime < u64ONDScheduler_VirtualTime)
+            {
+                psSelected->u64VirtualTime = u64ONDScheduler_VirtualTime;
+            }
+            u64ONDScheduler_VirtualTime = psSelected->u64VirtualTime;
+            psSelected->u64VirtualTime += psSelected->u32IntervalMs ? psSelected->u32IntervalMs : 1;
+
+            vONDScheduler_Charge(u64Now);
         }
 
-    }
+        eLockUnlock(&sONDDownloadListLock);
+
+        if (!psSelected)
+        {
+            if (u64Wake > u64Now)
+            {
+                usleep(u64Wake - u64Now);
+            }
+            continue;
+        }
 
-    daemon_log(LOG_INFO, "OND: Finished download of image revision %d for device ID 0x%08x to coordinator \"%s\"",
-               psDownloadThreadInfo->sFirmwareID.u16Revision, psDownloadThreadInfo->sFirmwareID.u32DeviceID, 
-               acCoordinatorAddress);
+        /* Send without holding the lock, so the server thread isn't held up.
+         * Only this thread frees downloads, and the address and firmware ID don't change,
+         * so they can be used here safely. */
+        if (iInitiate)
+        {
+            eStatus = eONDSendInitiate(psOND, psSelected->sCoordinatorAddress, psSelected->sFirmwareID);
+        }
+        else
+        {
+            eStatus = eONDSendBlock(psOND, psSelected->sCoordinatorAddress,
+                                    0xFFFFFFFF,
+                                    0xFFFFFFFF,
+                                    psSelected->sFirmwareID,
+                                    iBlockNumber,
+                                    psSelected->u32TotalBlocks, u32RemainingBlocks, psSelected->u32Timeout);
+        }
 
-exit:
-    /* Remove from linked list */
-    eLockLock(&sONDDownloadThreadListLock);
-    
-    if (psONDDownloadThread_ListHead == psDownloadThreadInfo)
-    {
-        /* First in list */
-        psONDDownloadThread_ListHead = psDownloadThreadInfo->psNext;
-    }
-    else
-    {
-        tsONDDownloadThreadInfo *psListPosition = psONDDownloadThread_ListHead;
-        while (psListPosition->psNext)
+        eLockLock(&sONDDownloadListLock);
+
+        u64Now = u64ONDTimeNow();
+
+        if (eStatus != OND_STATUS_OK)
         {
-            if (psListPosition->psNext == psDownloadThreadInfo)
+            if (iInitiate)
             {
-                psListPosition->psNext = psListPosition->psNext->psNext;
-                break;
+                daemon_log(LOG_ERR, "OND: Error sending initiate packet");
+            }
+            else
+            {
+                daemon_log(LOG_ERR, "OND: Error sending block %d/%d to coordinator \"%s\"",
+                           iBlockNumber, psSelected->u32TotalBlocks, psSelected->acCoordinatorAddress);
+            }
+            psSelected->eState = E_OND_DOWNLOAD_FINISHED;
+        }
+        else if (iInitiate)
+        {
+            vONDDownload_Initiated(psSelected, u64Now);
+        }
+        else
+        {
+            psSelected->u32BlocksSent++;
+            if ((psSelected->u32BlocksSent % OND_RATE_WINDOW) == 0)
+            {
+                vONDDownload_AdaptInterval(psSelected);
             }
-            psListPosition = psListPosition->psNext;
         }
-    }
 
-    eLockUnlock(&sONDDownloadThreadListLock);
+        psSelected->u64NextSendTime = u64Now + (psSelected->u32IntervalMs * 1000);
 
-    if (verbosity >= LOG_DEBUG)
-    {
-        daemon_log(LOG_DEBUG, "OND: Download thread exit");
+        eLockUnlock(&sONDDownloadListLock);
     }
-    
-    /* Clean up thread's storage */
-    eLockDestroy(&psDownloadThreadInfo->sStopSignal);
-    free(psDownloadThreadInfo);
-    eThreadFinish(ONDDownloadThread, psThreadInfo);
+
     return NULL;
 }
 
@@ -567,7 +841,8 @@ exit:
 static teONDStatus eONDSendBlock(tsOND *psOND, struct in6_addr sCoordinatorAddress, 
                                  uint32_t u32AddressH, uint32_t u32AddressL, 
                                  tsFirmwareID sFirmwareID, 
-                                 uint16_t u16BlockNumber, uint16_t u16TotalBlocks, uint32_t u32Timeout)
+                                 uint16_t u16BlockNumber, uint16_t u16TotalBlocks, 
+                                 uint16_t u16RemainingBlocks, uint32_t u32Timeout)
 {
     tsONDPacket sONDPacket;
     teFWStatus eFWStatus;
@@ -615,12 +890,26 @@ static teONDStatus eONDSendBlock(tsOND *psOND, struct in6_addr sCoordinatorAddre
                     sFirmwareID.u16Revision, sFirmwareID.u32DeviceID, buffer);
     }
     
-    StatusLogRemainingBlocks(sFirmwareID, sCoordinatorAddress, u32AddressH, u32AddressL, (u16TotalBlocks - 1) - u16BlockNumber, u16TotalBlocks);
+    StatusLogRemainingBlocks(sFirmwareID, sCoordinatorAddress, u32AddressH, u32AddressL, u16RemainingBlocks, u16TotalBlocks);
 
     return OND_STATUS_OK;
 }
 
 
+/* Send the initiate packet */
+static teONDStatus eONDSendInitiate(tsOND *psOND, struct in6_addr sCoordinatorAddress, tsFirmwareID sFirmwareID)
+{
+    tsONDPacket sONDPacket;
+
+    sONDPacket.eType = OND_PACKET_INITIATE;
+    sONDPacket.uPayload.sONDPacketInitiate.u32DeviceID = sFirmwareID.u32DeviceID;
+    sONDPacket.uPayload.sONDPacketInitiate.u16ChipType = sFirmwareID.u16ChipType;
+    sONDPacket.uPayload.sONDPacketInitiate.u16Revision = sFirmwareID.u16Revision;
+
+    return eONDNetworkSendPacket(&psOND->sONDNetwork, sCoordinatorAddress, &sONDPacket);
+}
+
+
 /* Broadcast reset thread */
 static void *ONDResetThread(void *psThreadInfoVoid)
 {
@@ -726,37 +1015,330 @@ teONDStatus eONDRequestReset(tsOND *psOND, struct in6_addr sCoordinatorAddress,
 }
 
 
-/* Thread to send reset request packets */
-static tsONDDownloadThreadInfo *psONDDownloadThread_Find(struct in6_addr sCoordinatorAddress, uint32_t u32DeviceID, 
+/* Set up the block interval and node timeout of a download */
+static teONDStatus eONDDownload_Configure(tsONDDownload *psDownload)
+{
+    /* The block interval is adapted between these limits. Internally it is kept in milliseconds */
+    psDownload->u32BaseIntervalMs = psDownload->u16BlockInterval * 10;
+    psDownload->u32MaxIntervalMs  = psDownload->u32BaseIntervalMs * OND_RATE_MAX_MULTIPLIER;
+
+    if (psDownload->u32IntervalMs < psDownload->u32BaseIntervalMs)
+    {
+        psDownload->u32IntervalMs = psDownload->u32BaseIntervalMs;
+    }
+    if (psDownload->u32IntervalMs > psDownload->u32MaxIntervalMs)
+    {
+        psDownload->u32IntervalMs = psDownload->u32MaxIntervalMs;
+    }
+
+    psDownload->u32HoldOffMs = psDownload->u32BaseIntervalMs * OND_REPAIR_HOLDOFF_INTERVALS;
+    if (psDownload->u32HoldOffMs < OND_REPAIR_HOLDOFF_MS)
+    {
+        psDownload->u32HoldOffMs = OND_REPAIR_HOLDOFF_MS;
+    }
+
+    // Block timeout is 62500 / second. Block interval is passed in units of 10ms
+    // 1 second = 62500 timeout, 100 interval.
+    // Use the slowest interval the download may back off to, so nodes don't time out.
+    psDownload->u32Timeout = 625 * (psDownload->u32MaxIntervalMs / 10);
+
+    if (psDownload->eFlags & E_DOWNLOAD_FLAG_IMMEDIATE_RESET)
+    {
+        /* Set the auto-reset flag */
+        psDownload->u32Timeout |= 0x80000000;
+    }
+    else
+    {
+        /* Clear the auto-reset flag */
+        psDownload->u32Timeout &= ~0x80000000;
+    }
+
+    if (eFirmware_Set_Timeout(psDownload->sFirmwareID, psDownload->u32Timeout) != FW_STATUS_OK)
+    {
+        /* Store the potentially modified timeout value back to the firmware record */
+        daemon_log(LOG_ERR, "OND: Error setting firmware timeout value");
+        return OND_STATUS_ERROR;
+    }
+    return OND_STATUS_OK;
+}
+
+
+/* The initiate packet has gone, start the broadcast */
+static void vONDDownload_Initiated(tsONDDownload *psDownload, uint64_t u64Now)
+{
+    uint32_t u32Words;
+
+    if (psDownload->pu32MissingBlocks)
+    {
+        /* Another download has joined this one. Its settings may have changed ours */
+        if (eONDDownload_Configure(psDownload) != OND_STATUS_OK)
+        {
+            psDownload->eState = E_OND_DOWNLOAD_FINISHED;
+        }
+        else if (psDownload->eState == E_OND_DOWNLOAD_HOLDING_OFF)
+        {
+            /* Give any new nodes time to ask for blocks */
+            psDownload->u64HoldOffEnd = u64Now + (psDownload->u32HoldOffMs * 1000);
+        }
+        return;
+    }
+
+    if (psDownload->eFlags & E_DOWNLOAD_FLAG_INITIATE_ONLY)
+    {
+        daemon_log(LOG_INFO, "OND: Initiate packet sent for image revision %d for device ID 0x%08x to coordinator \"%s\"",
+                   psDownload->sFirmwareID.u16Revision, psDownload->sFirmwareID.u32DeviceID, psDownload->acCoordinatorAddress);
+        psDownload->eState = E_OND_DOWNLOAD_FINISHED;
+        return;
+    }
+
+    if (eONDDownload_Configure(psDownload) != OND_STATUS_OK)
+    {
+        psDownload->eState = E_OND_DOWNLOAD_FINISHED;
+        return;
+    }
+
+    /* Every block is missing to begin with. From now on, requests are added to the bitmap */
+    u32Words = (psDownload->u32TotalBlocks + 31) / 32;
+    psDownload->pu32MissingBlocks = malloc(u32Words * sizeof(uint32_t));
+    if (!psDownload->pu32MissingBlocks)
+    {
+        daemon_log(LOG_CRIT, "OND: Out of memory");
+        psDownload->eState = E_OND_DOWNLOAD_FINISHED;
+        return;
+    }
+
+    memset(psDownload->pu32MissingBlocks, 0xFF, u32Words * sizeof(uint32_t));
+    if (psDownload->u32TotalBlocks % 32)
+    {
+        psDownload->pu32MissingBlocks[u32Words - 1] = (1U << (psDownload->u32TotalBlocks % 32)) - 1;
+    }
+    psDownload->u32MissingBlocks    = psDownload->u32TotalBlocks;
+    psDownload->u32NewRequests      = 0;
+    psDownload->u32Cursor           = 0;
+    psDownload->eState              = E_OND_DOWNLOAD_BROADCASTING;
+}
+
+
+/* Every block marked at the start of a round has been sent */
+static void vONDDownload_EndRound(tsONDDownload *psDownload, uint64_t u64Now)
+{
+    if (psDownload->u32MissingBlocks == 0)
+    {
+        /* Nothing outstanding. Give the nodes time to request anything they missed */
+        psDownload->eState = E_OND_DOWNLOAD_HOLDING_OFF;
+        psDownload->u64HoldOffEnd = u64Now + (psDownload->u32HoldOffMs * 1000);
+    }
+    else
+    {
+        vONDDownload_NewRound(psDownload);
+    }
+}
+
+
+/* Broadcast the requested blocks again */
+static void vONDDownload_NewRound(tsONDDownload *psDownload)
+{
+    if (psDownload->u32BlocksSent >= (psDownload->u32TotalBlocks * OND_MAX_SEND_FACTOR))
+    {
+        daemon_log(LOG_INFO, "OND: Giving up repairs after %d blocks with %d blocks outstanding to coordinator \"%s\"",
+                   psDownload->u32BlocksSent, psDownload->u32MissingBlocks, psDownload->acCoordinatorAddress);
+        psDownload->eState = E_OND_DOWNLOAD_FINISHED;
+        return;
+    }
+
+    psDownload->u32Round++;
+    if (verbosity >= LOG_DEBUG)
+    {
+        daemon_log(LOG_DEBUG, "OND: Repair round %d of image revision %d for device ID 0x%08x to coordinator \"%s\": %d blocks, interval %dms",
+                   psDownload->u32Round, psDownload->sFirmwareID.u16Revision, psDownload->sFirmwareID.u32DeviceID,
+                   psDownload->acCoordinatorAddress, psDownload->u32MissingBlocks, psDownload->u32IntervalMs);
+    }
+
+    psDownload->u32Cursor = 0;
+    psDownload->eState = E_OND_DOWNLOAD_BROADCASTING;
+}
+
+
+/* Adjust the block interval of a download */
+static void vONDDownload_AdaptInterval(tsONDDownload *psDownload)
+{
+    /* Adapt the block interval by hill climbing on goodput - the rate of blocks that no node
+     * has had to ask for again. Random loss affects every rate alike, so it keeps the interval
+     * coming down, while congestion makes goodput fall as the rate rises and turns it back up.
+     * Speed up gradually and back off multiplicatively. */
+    uint32_t u32NewRequests;
+    uint32_t u32Goodput;
+
+    u32NewRequests = psDownload->u32NewRequests;
+    psDownload->u32NewRequests = 0;
+
+    if (u32NewRequests > OND_RATE_WINDOW)
+    {
+        u32NewRequests = OND_RATE_WINDOW;
+    }
+
+    u32Goodput = ((OND_RATE_WINDOW - u32NewRequests) * 1000) / (psDownload->u32IntervalMs ? psDownload->u32IntervalMs : 1);
+
+    if (u32NewRequests == OND_RATE_WINDOW)
+    {
+        /* Nothing is getting through */
+        psDownload->iSpeedUp = 0;
+    }
+    else if ((u32Goodput * 100) < (psDownload->u32PrevGoodput * (100 - OND_RATE_GOODPUT_MARGIN)))
+    {
+        /* The last change made things worse */
+        psDownload->iSpeedUp = !psDownload->iSpeedUp;
+    }
+    psDownload->u32PrevGoodput = u32Goodput;
+
+    if (psDownload->iSpeedUp)
+    {
+        uint32_t u32Step = (psDownload->u32BaseIntervalMs / 8) ? (psDownload->u32BaseIntervalMs / 8) : 1;
+
+        psDownload->u32IntervalMs = (psDownload->u32IntervalMs > (psDownload->u32BaseIntervalMs + u32Step)) ?
+                                    (psDownload->u32IntervalMs - u32Step) : psDownload->u32BaseIntervalMs;
+    }
+    else
+    {
+        psDownload->u32IntervalMs = ((psDownload->u32IntervalMs * 3) / 2) + 1;
+        if (psDownload->u32IntervalMs > psDownload->u32MaxIntervalMs)
+        {
+            psDownload->u32IntervalMs = psDownload->u32MaxIntervalMs;
+        }
+    }
+
+    if (verbosity >= LOG_DEBUG)
+    {
+        daemon_log(LOG_DEBUG, "OND: %d new requests in last %d blocks to coordinator \"%s\", goodput %d, interval now %dms",
+                   u32NewRequests, OND_RATE_WINDOW, psDownload->acCoordinatorAddress, u32Goodput, psDownload->u32IntervalMs);
+    }
+}
+
+
+/* Add a requested block to a download's missing block bitmap */
+static void vONDDownload_MarkBlock(tsONDDownload *psDownload, uint16_t u16BlockNumber)
+{
+    uint32_t u32Mask = 1U << (u16BlockNumber % 32);
+    
+    if (u16BlockNumber >= psDownload->u32TotalBlocks)
+    {
+        return;
+    }
+    
+    if (psDownload->pu32MissingBlocks[u16BlockNumber / 32] & u32Mask)
+    {
+        /* Already due to be sent, so this request is covered by another node's */
+        return;
+    }
+    
+    psDownload->pu32MissingBlocks[u16BlockNumber / 32] |= u32Mask;
+    psDownload->u32MissingBlocks++;
+    psDownload->u32NewRequests++;
+    
+    if (verbosity >= LOG_DEBUG)
+    {
+        daemon_log(LOG_DEBUG, "OND: Block %d queued for repair, %d blocks outstanding", 
+                   u16BlockNumber, psDownload->u32MissingBlocks);
+    }
+}
+
+
+/* Take the next missing block at or after the cursor */
+static int iONDDownload_NextBlock(tsONDDownload *psDownload, uint32_t *pu32Cursor)
+{
+    uint32_t u32Block = *pu32Cursor;
+    
+    while (u32Block < psDownload->u32TotalBlocks)
+    {
+        uint32_t u32Word = psDownload->pu32MissingBlocks[u32Block / 32] >> (u32Block % 32);
+        
+        if (u32Word == 0)
+        {
+            /* Skip to the start of the next word */
+            u32Block = (u32Block + 32) & ~31;
+            continue;
+        }
+        
+        u32Block += __builtin_ctz(u32Word);
+        if (u32Block >= psDownload->u32TotalBlocks)
+        {
+            break;
+        }
+        
+        psDownload->pu32MissingBlocks[u32Block / 32] &= ~(1U << (u32Block % 32));
+        psDownload->u32MissingBlocks--;
+        *pu32Cursor = u32Block + 1;
+        return u32Block;
+    }
+    
+    *pu32Cursor = psDownload->u32TotalBlocks;
+    return -1;
+}
+
+
+/* Take a packet from the global packet rate */
+static void vONDScheduler_Charge(uint64_t u64Now)
+{
+    uint64_t u64Burst = (OND_SCHEDULER_BURST - 1) * u64ONDScheduler_PacketInterval;
+
+    if (!u64ONDScheduler_PacketInterval)
+    {
+        return;
+    }
+
+    /* Don't let a quiet period build up more than a small burst */
+    if ((u64ONDScheduler_NextSendTime + u64Burst) < u64Now)
+    {
+        u64ONDScheduler_NextSendTime = u64Now - u64Burst;
+    }
+    u64ONDScheduler_NextSendTime += u64ONDScheduler_PacketInterval;
+}
+
+
+/* Read the monotonic clock */
+static uint64_t u64ONDTimeNow(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000) + (sNow.tv_nsec / 1000);
+}
+
+
+/* Find a download in the list */
+static tsONDDownload *psONDDownload_Find(struct in6_addr sCoordinatorAddress, uint32_t u32DeviceID, 
                               uint16_t u16ChipType, uint16_t u16Revision)
 {
-    tsONDDownloadThreadInfo *psDownloadThreadInfo = psONDDownloadThread_ListHead;
+    tsONDDownload *psDownload = psONDDownload_ListHead;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
     
-    while (psDownloadThreadInfo)
+    while (psDownload)
     {
-        DBG_vPrintf(DBG_OND, "Looking at entry %p\n", psDownloadThreadInfo);
+        DBG_vPrintf(DBG_OND, "Looking at entry %p\n", psDownload);
         
-        if ((memcmp(&psDownloadThreadInfo->sCoordinatorAddress, &sCoordinatorAddress, sizeof(struct in6_addr)) == 0) &&
-            (psDownloadThreadInfo->sFirmwareID.u32DeviceID == u32DeviceID) &&
-            (psDownloadThreadInfo->sFirmwareID.u16ChipType == u16ChipType) &&
-            (psDownloadThreadInfo->sFirmwareID.u16Revision == u16Revision))
+        if ((memcmp(&psDownload->sCoordinatorAddress, &sCoordinatorAddress, sizeof(struct in6_addr)) == 0) &&
+            (psDownload->sFirmwareID.u32DeviceID == u32DeviceID) &&
+            (psDownload->sFirmwareID.u16ChipType == u16ChipType) &&
+            (psDownload->sFirmwareID.u16Revision == u16Revision) &&
+            (!psDownload->iCancelled) &&
+            (psDownload->eState != E_OND_DOWNLOAD_FINISHED))
         {
             if (verbosity >= LOG_DEBUG)
             {
                 char buffer[INET6_ADDRSTRLEN] = "Could not determine address\n";
                 inet_ntop(AF_INET6, &sCoordinatorAddress, buffer, INET6_ADDRSTRLEN);
-                daemon_log(LOG_DEBUG, "OND: Download thread found for coordinator %s, Device ID 0x%08x, ChipType 0x%04x, Revision 0x%04x\n",
+                daemon_log(LOG_DEBUG, "OND: Download found for coordinator %s, Device ID 0x%08x, ChipType 0x%04x, Revision 0x%04x\n",
                         buffer, u32DeviceID, u16ChipType, u16Revision);
             }
             /* Break and return current value */
             break;
         }
         /* Next in list */
-        psDownloadThreadInfo = psDownloadThreadInfo->psNext;
+        psDownload = psDownload->psNext;
     }
     
-    return psDownloadThreadInfo;
+    return psDownload;
 }
 
+
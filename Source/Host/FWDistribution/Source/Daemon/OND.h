@@ -50,6 +50,10 @@ typedef enum
 
 } teONDStatus;
 
+
+/** Default limit on the packets per second sent by all downloads together */
+#define OND_DEFAULT_MAX_PACKET_RATE 100
+
 #include "OND_Network.h"
 #include "Threads.h"
 
@@ -71,17 +75,24 @@ typedef struct
     
     tsThread        sServerThread;      /** < Server Thread data */
     
+    tsThread        sSchedulerThread;   /** < Download scheduler thread data */
+    
 } tsOND;
 
 
 /** Initialise the OND engine.
- *  Set up structures and start a server thread
+ *  Set up structures and start the server and download scheduler threads
+ *  \param psOND                Pointer to the OND structure to initialise
+ *  \param pcBindAddress        Local address to bind to
+ *  \param pcPortNumber         UDP port number
+ *  \param u32MaxPacketRate     Maximum packets per second sent by all downloads together. 0 for no limit.
  *  \return OND_STATUS_OK on success
  */
-teONDStatus eONDInitialise(tsOND *psOND, const char *pcBindAddress, const char *pcPortNumber);
+teONDStatus eONDInitialise(tsOND *psOND, const char *pcBindAddress, const char *pcPortNumber, uint32_t u32MaxPacketRate);
 
 
 /** Start a broadcast download of a firmware image
+ *  If the same image is already being sent to the coordinator, the request joins that download.
  *  \param psOND                Pointer to the initialised OND structure
  *  \param sCoordinatorAddress  IPv6 address of network entry point
  *  \param u32DeviceID          Device ID of the destination nodes
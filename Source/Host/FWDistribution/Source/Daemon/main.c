@@ -69,6 +69,7 @@ int daemonize = 1;              /** Run as daemon */
 
 const char *pcBindAddress = "::";
 const char *pcPortNumber = "1874";
+uint32_t u32MaxPacketRate = OND_DEFAULT_MAX_PACKET_RATE;
 
 void print_usage_exit(char *argv[])
 {
@@ -80,6 +81,7 @@ void print_usage_exit(char *argv[])
     fprintf(stderr, "    -v --verbosity         <verbosity>     Verbosity level. Increses amount of debug information. Default 0.\n");
     fprintf(stderr, "    -b --bind              <bind addr>     Local address to bind server to. Default \"%s\".\n", pcBindAddress);
     fprintf(stderr, "    -p --port              <port>          Local / Remote UDP port number to use. Default %s.\n", pcPortNumber);
+    fprintf(stderr, "    -r --rate              <packets/s>     Maximum packets per second sent by all downloads together, 0 for no limit. Default %d.\n", u32MaxPacketRate);
     
     fprintf(stderr, "    -f --firmware          <firmware>      Load firmware binary file.\n");
     fprintf(stderr, "    -d --directory         <firmware dir>  Directory to monitor for firmware files.\n");
@@ -109,6 +111,7 @@ int main (int argc, char **argv)
             {"verbosity",               required_argument,  NULL, 'v'},
             {"bind",                    required_argument,  NULL, 'b'},
             {"port",                    required_argument,  NULL, 'p'},
+            {"rate",                    required_argument,  NULL, 'r'},
             {"firmware",                required_argument,  NULL, 'f'},
             {"directory",               required_argument,  NULL, 'd'},
             
@@ -117,7 +120,7 @@ int main (int argc, char **argv)
         signed char opt;
         int option_index;
         
-        while ((opt = getopt_long(argc, argv, "hVFv:f:d:b:p:", long_options, &option_index)) != -1) 
+        while ((opt = getopt_long(argc, argv, "hVFv:f:d:b:p:r:", long_options, &option_index)) != -1) 
         {
             switch (opt) 
             {
@@ -171,6 +174,10 @@ int main (int argc, char **argv)
                 case  'p':
                     pcPortNumber = optarg;
                     break;
+                
+                case  'r':
+                    u32MaxPacketRate = atoi(optarg);
+                    break;
                     
                 default: /* '?' */
                     print_usage_exit(argv);
@@ -264,7 +271,7 @@ int main (int argc, char **argv)
     }
     
     
-    if (eONDInitialise(&sOND, pcBindAddress, pcPortNumber) != OND_STATUS_OK)
+    if (eONDInitialise(&sOND, pcBindAddress, pcPortNumber, u32MaxPacketRate) != OND_STATUS_OK)
     {
         daemon_log(LOG_CRIT, "Error starting up networking\n");
         goto finish;
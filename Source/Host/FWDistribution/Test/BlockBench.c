@@ -0,0 +1,399 @@
+/****************************************************************************
+ *
+ * MODULE:             Firmware Distribution Daemon
+ *
+ * COMPONENT:          Block packet send microbenchmark
+ *
+ * REVISION:           $Revision$
+ *
+ * DATED:              $Date$
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** BlockBench measures the CPU cost of sending firmware block packets. The
+ *  image is loaded by the daemon's own firmware module, and every block is
+ *  sent in turn over the loopback interface to a socket that is never read.
+ *  The daemon's way, copying the block out of the image and encoding the
+ *  whole packet (eFirmware_Get_Block and eONDNetworkSendPacket), is compared
+ *  with two ways of sending from a mapping of the image behind a pre-built
+ *  header: copying header and block into one buffer for sendto, and handing
+ *  them to sendmsg as an iovec each, so that the kernel reads the block
+ *  straight from the mapping. Blocks per second of process CPU time are
+ *  reported for each, with the time per block split between the sending
+ *  code itself (user) and the kernel (system).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include <libdaemon/daemon.h>
+
+#include "Firmwares.h"
+#include "OND.h"
+#include "OND_Network.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+/** Block size used by the daemon, as OND_BLOCK_SIZE in OND.c */
+#define BLOCK_SIZE                  32
+
+/** Offset of the first block in an image file, as FIRMWARE_BIN_FILE_OFFSET in Firmwares.c */
+#define IMAGE_BLOCK_OFFSET          4
+
+/** Length of a block data packet up to the block data */
+#define BLOCK_HEADER_LENGTH         30
+
+/** Default number of blocks to send with each method */
+#define DEFAULT_COUNT               1000000
+
+/** Default number of times each method is run. The best run is reported */
+#define DEFAULT_REPEATS             5
+
+/** Port blocks are sent to on the loopback interface */
+#define BENCH_PORT                  28999
+
+int verbosity = LOG_ERR;
+
+/** Method of sending a block */
+typedef teONDStatus (*tprSendBlock)(tsONDNetwork *psONDNetwork, tsFirmwareID sFirmwareID, uint16_t u16BlockNumber);
+
+static const uint8_t *pu8Image;
+static uint8_t au8Template[BLOCK_HEADER_LENGTH];
+static uint32_t u32TotalBlocks;
+static struct in6_addr sLoopback;
+static struct sockaddr_in6 sDestination;
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "Block packet send benchmark Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s -f <image> [options]\n", argv[0]);
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -f <file>          Firmware image to send blocks of.\n");
+    fprintf(stderr, "    -c <count>         Number of blocks to send in each run. Default %d.\n", DEFAULT_COUNT);
+    fprintf(stderr, "    -r <repeats>       Number of runs of each method, alternating. The best is reported. Default %d.\n", DEFAULT_REPEATS);
+    exit(EXIT_FAILURE);
+}
+
+
+/** CPU time used by a run */
+typedef struct
+{
+    double dUser;                       /** < Time spent in the benchmark itself (s) */
+    double dSystem;                     /** < Time spent in the kernel sending the packets (s) */
+} tsCpuTime;
+
+
+/* Read the CPU time used by the process so far */
+static void vCpuTime(tsCpuTime *psCpuTime)
+{
+    struct rusage sUsage;
+
+    getrusage(RUSAGE_SELF, &sUsage);
+    psCpuTime->dUser   = sUsage.ru_utime.tv_sec + (sUsage.ru_utime.tv_usec / 1e6);
+    psCpuTime->dSystem = sUsage.ru_stime.tv_sec + (sUsage.ru_stime.tv_usec / 1e6);
+}
+
+
+/* Encode the fields that are the same in every block packet of the image, as eONDNetworkSendPacket lays them out */
+static void vTemplateInit(tsFirmwareID sFirmwareID)
+{
+    uint16_t u16Temp;
+    uint32_t u32Temp;
+
+    memset(au8Template, 0, sizeof(au8Template));
+    au8Template[1] = OND_PACKET_BLOCK_DATA;
+    u32Temp = htonl(sFirmwareID.u32DeviceID);
+    memcpy(&au8Template[12], &u32Temp, sizeof(uint32_t));
+    u16Temp = htons(sFirmwareID.u16ChipType);
+    memcpy(&au8Template[16], &u16Temp, sizeof(uint16_t));
+    u16Temp = htons(sFirmwareID.u16Revision);
+    memcpy(&au8Template[18], &u16Temp, sizeof(uint16_t));
+    u16Temp = htons(u32TotalBlocks);
+    memcpy(&au8Template[22], &u16Temp, sizeof(uint16_t));
+    u16Temp = htons(BLOCK_SIZE);
+    memcpy(&au8Template[28], &u16Temp, sizeof(uint16_t));
+}
+
+
+/* Fill in the fields of the header that differ per block */
+static void vHeaderBuild(uint8_t *pu8Header, uint16_t u16BlockNumber)
+{
+    uint16_t u16Temp;
+    uint32_t u32Temp;
+
+    memcpy(pu8Header, au8Template, BLOCK_HEADER_LENGTH);
+    u32Temp = htonl(0xFFFFFFFF);
+    memcpy(&pu8Header[4], &u32Temp, sizeof(uint32_t));
+    memcpy(&pu8Header[8], &u32Temp, sizeof(uint32_t));
+    u16Temp = htons(u16BlockNumber);
+    memcpy(&pu8Header[20], &u16Temp, sizeof(uint16_t));
+    u32Temp = htonl(62500);
+    memcpy(&pu8Header[24], &u32Temp, sizeof(uint32_t));
+}
+
+
+/* Copy the block out of the image and encode the whole packet, as the daemon does */
+static teONDStatus eSendDaemon(tsONDNetwork *psONDNetwork, tsFirmwareID sFirmwareID, uint16_t u16BlockNumber)
+{
+    tsONDPacket sONDPacket;
+
+    sONDPacket.eType = OND_PACKET_BLOCK_DATA;
+    sONDPacket.uPayload.sONDPacketBlockData.u32AddressH     = 0xFFFFFFFF;
+    sONDPacket.uPayload.sONDPacketBlockData.u32AddressL     = 0xFFFFFFFF;
+    sONDPacket.uPayload.sONDPacketBlockData.u32DeviceID     = sFirmwareID.u32DeviceID;
+    sONDPacket.uPayload.sONDPacketBlockData.u16ChipType     = sFirmwareID.u16ChipType;
+    sONDPacket.uPayload.sONDPacketBlockData.u16Revision     = sFirmwareID.u16Revision;
+    sONDPacket.uPayload.sONDPacketBlockData.u16BlockNumber  = u16BlockNumber;
+    sONDPacket.uPayload.sONDPacketBlockData.u16TotalBlocks  = u32TotalBlocks;
+    sONDPacket.uPayload.sONDPacketBlockData.u32Timeout      = 62500;
+    sONDPacket.uPayload.sONDPacketBlockData.u16Length       = BLOCK_SIZE;
+
+    if (eFirmware_Get_Block(sFirmwareID, u16BlockNumber, BLOCK_SIZE,
+                            sONDPacket.uPayload.sONDPacketBlockData.au8Data) != FW_STATUS_OK)
+    {
+        return OND_STATUS_ERROR;
+    }
+    return eONDNetworkSendPacket(psONDNetwork, sLoopback, &sONDPacket);
+}
+
+
+/* Copy the pre-built header and the block from the mapping into one buffer and send it */
+static teONDStatus eSendBuffer(tsONDNetwork *psONDNetwork, tsFirmwareID sFirmwareID, uint16_t u16BlockNumber)
+{
+    uint8_t au8Buffer[BLOCK_HEADER_LENGTH + BLOCK_SIZE];
+
+    vHeaderBuild(au8Buffer, u16BlockNumber);
+    memcpy(&au8Buffer[BLOCK_HEADER_LENGTH], &pu8Image[IMAGE_BLOCK_OFFSET + (u16BlockNumber * BLOCK_SIZE)], BLOCK_SIZE);
+
+    if (sendto(psONDNetwork->iSocket, au8Buffer, sizeof(au8Buffer), 0,
+               (struct sockaddr *)&sDestination, sizeof(struct sockaddr_in6)) != sizeof(au8Buffer))
+    {
+        return OND_STATUS_ERROR;
+    }
+    return OND_STATUS_OK;
+}
+
+
+/* Send the pre-built header and the block in the mapping as an iovec each */
+static teONDStatus eSendIovec(tsONDNetwork *psONDNetwork, tsFirmwareID sFirmwareID, uint16_t u16BlockNumber)
+{
+    uint8_t au8Header[BLOCK_HEADER_LENGTH];
+    struct iovec asIov[2];
+    struct msghdr sMsg;
+
+    vHeaderBuild(au8Header, u16BlockNumber);
+
+    asIov[0].iov_base   = au8Header;
+    asIov[0].iov_len    = BLOCK_HEADER_LENGTH;
+    asIov[1].iov_base   = (void *)&pu8Image[IMAGE_BLOCK_OFFSET + (u16BlockNumber * BLOCK_SIZE)];
+    asIov[1].iov_len    = BLOCK_SIZE;
+
+    memset(&sMsg, 0, sizeof(struct msghdr));
+    sMsg.msg_name       = &sDestination;
+    sMsg.msg_namelen    = sizeof(struct sockaddr_in6);
+    sMsg.msg_iov        = asIov;
+    sMsg.msg_iovlen     = 2;
+
+    if (sendmsg(psONDNetwork->iSocket, &sMsg, 0) != (BLOCK_HEADER_LENGTH + BLOCK_SIZE))
+    {
+        return OND_STATUS_ERROR;
+    }
+    return OND_STATUS_OK;
+}
+
+
+/* Send a number of blocks with one method and keep the run that used the least CPU time */
+static int iRun(const char *pcName, tprSendBlock prSendBlock, tsONDNetwork *psONDNetwork,
+                tsFirmwareID sFirmwareID, uint32_t u32Count, tsCpuTime *psBest)
+{
+    tsCpuTime sStart, sEnd;
+    uint32_t i;
+
+    vCpuTime(&sStart);
+
+    for (i = 0; i < u32Count; i++)
+    {
+        if (prSendBlock(psONDNetwork, sFirmwareID, i % u32TotalBlocks) != OND_STATUS_OK)
+        {
+            fprintf(stderr, "%s: Error sending block %d\n", pcName, i % u32TotalBlocks);
+            return -1;
+        }
+    }
+
+    vCpuTime(&sEnd);
+    sEnd.dUser   -= sStart.dUser;
+    sEnd.dSystem -= sStart.dSystem;
+    if (((psBest->dUser + psBest->dSystem) == 0) ||
+        ((sEnd.dUser + sEnd.dSystem) < (psBest->dUser + psBest->dSystem)))
+    {
+        *psBest = sEnd;
+    }
+    return 0;
+}
+
+
+/* Report the rate of a method */
+static void vReport(const char *pcName, uint32_t u32Count, tsCpuTime *psCpuTime)
+{
+    double dCpu = psCpuTime->dUser + psCpuTime->dSystem;
+
+    printf("%-8s %10u blocks in %6.3fs CPU: %10.0f blocks/s per CPU, %6.0f ns/block (%4.0f user, %6.0f system)\n",
+           pcName, u32Count, dCpu, u32Count / dCpu, (dCpu * 1e9) / u32Count,
+           (psCpuTime->dUser * 1e9) / u32Count, (psCpuTime->dSystem * 1e9) / u32Count);
+}
+
+
+int main(int argc, char *argv[])
+{
+    tsONDNetwork sONDNetwork;
+    tsFirmwareID sFirmwareID;
+    const char *pcImage = NULL;
+    uint32_t u32Count = DEFAULT_COUNT;
+    uint32_t u32Repeats = DEFAULT_REPEATS;
+    tsCpuTime sDaemon = { 0, 0 }, sBuffer = { 0, 0 }, sIovec = { 0, 0 };
+    struct stat sStat;
+    uint32_t i;
+    uint8_t au8Header[0x1c];
+    uint32_t u32Temp;
+    uint16_t u16Temp;
+    int iReceiver;
+    int iFd;
+    int iBufferSize = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:c:r:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'f': pcImage = optarg; break;
+            case 'c': u32Count = strtoul(optarg, NULL, 0); break;
+            case 'r': u32Repeats = strtoul(optarg, NULL, 0); break;
+            default: print_usage_exit(argv);
+        }
+    }
+
+    if (!pcImage || !u32Count || !u32Repeats)
+    {
+        print_usage_exit(argv);
+    }
+
+    /* Read the firmware ID from the image header, and map the image for the methods that send from a mapping */
+    iFd = open(pcImage, O_RDONLY);
+    if ((iFd < 0) || (read(iFd, au8Header, sizeof(au8Header)) != sizeof(au8Header)) || (fstat(iFd, &sStat) < 0))
+    {
+        fprintf(stderr, "Could not read image \"%s\"\n", pcImage);
+        return EXIT_FAILURE;
+    }
+    pu8Image = mmap(NULL, sStat.st_size, PROT_READ, MAP_PRIVATE, iFd, 0);
+    close(iFd);
+    if (pu8Image == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map image \"%s\" (%s)\n", pcImage, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    memcpy(&u32Temp, &au8Header[0x14], sizeof(uint32_t)); sFirmwareID.u32DeviceID = ntohl(u32Temp);
+    memcpy(&u16Temp, &au8Header[0x18], sizeof(uint16_t)); sFirmwareID.u16ChipType = ntohs(u16Temp);
+    memcpy(&u16Temp, &au8Header[0x1a], sizeof(uint16_t)); sFirmwareID.u16Revision = ntohs(u16Temp);
+
+    if ((eFirmware_Init() != FW_STATUS_OK) ||
+        (eFirmware_Open(pcImage) != FW_STATUS_OK) ||
+        (eFirmware_Get_Total_Blocks(sFirmwareID, BLOCK_SIZE, &u32TotalBlocks) != FW_STATUS_OK))
+    {
+        fprintf(stderr, "Could not load image \"%s\"\n", pcImage);
+        return EXIT_FAILURE;
+    }
+    if ((IMAGE_BLOCK_OFFSET + (u32TotalBlocks * BLOCK_SIZE)) > sStat.st_size)
+    {
+        /* Do not read past the end of the mapping */
+        u32TotalBlocks--;
+    }
+    vTemplateInit(sFirmwareID);
+
+    /* Blocks go to a socket that is never read. Its receive queue soon fills and the kernel
+     * drops them, so the benchmark never waits for a reader */
+    sLoopback = in6addr_loopback;
+    memset(&sDestination, 0, sizeof(struct sockaddr_in6));
+    sDestination.sin6_family   = AF_INET6;
+    sDestination.sin6_port     = htons(BENCH_PORT);
+    sDestination.sin6_addr     = sLoopback;
+
+    iReceiver = socket(AF_INET6, SOCK_DGRAM, 0);
+    if ((iReceiver < 0) || (bind(iReceiver, (struct sockaddr *)&sDestination, sizeof(struct sockaddr_in6)) < 0))
+    {
+        fprintf(stderr, "Could not bind receiver socket (%s)\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    setsockopt(iReceiver, SOL_SOCKET, SO_RCVBUF, &iBufferSize, sizeof(int));
+
+    sONDNetwork.iSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+    sONDNetwork.u16PortNumber = BENCH_PORT;
+    if (sONDNetwork.iSocket < 0)
+    {
+        fprintf(stderr, "Could not create socket (%s)\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("Image \"%s\": %d blocks of %d bytes\n", pcImage, u32TotalBlocks, BLOCK_SIZE);
+
+    /* Alternate the methods so that they see the same conditions */
+    for (i = 0; i < u32Repeats; i++)
+    {
+        if ((iRun("daemon", eSendDaemon, &sONDNetwork, sFirmwareID, u32Count, &sDaemon) < 0) ||
+            (iRun("buffer", eSendBuffer, &sONDNetwork, sFirmwareID, u32Count, &sBuffer) < 0) ||
+            (iRun("iovec",  eSendIovec,  &sONDNetwork, sFirmwareID, u32Count, &sIovec) < 0))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    vReport("daemon", u32Count, &sDaemon);
+    vReport("buffer", u32Count, &sBuffer);
+    vReport("iovec",  u32Count, &sIovec);
+
+    munmap((void *)pu8Image, sStat.st_size);
+    close(sONDNetwork.iSocket);
+    close(iReceiver);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,796 @@
+/****************************************************************************
+ *
+ * MODULE:             Firmware Distribution Daemon
+ *
+ * COMPONENT:          Simulated lossy network for download benchmarking
+ *
+ * REVISION:           $Revision$
+ *
+ * DATED:              $Date$
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** ONDSim stands in for a coordinator and the nodes behind it. It asks
+ *  FWDistributiond over IPC to download an image to it, then passes each
+ *  block the daemon sends through a simple model of a lossy, bandwidth
+ *  limited radio network to a number of simulated nodes. Nodes request the
+ *  blocks they miss, both as soon as they see a gap and periodically once
+ *  blocks stop arriving, backing off while their requests go unanswered. The
+ *  total time until every node holds a complete, verified image is reported.
+ *
+ *  The network model is a shared channel of fixed capacity with a short
+ *  queue (packets offered faster than the channel drains are dropped for
+ *  every node once the queue is full) plus independent random loss on each
+ *  hop to each node.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "../Source/Common/FWDistribution_IPC.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+/* Packet types, as teONDPacketType in OND_Packet.h */
+#define OND_PACKET_INITIATE         0
+#define OND_PACKET_BLOCK_DATA       1
+#define OND_PACKET_BLOCK_REQUEST    2
+
+/** Block size used by the daemon, as OND_BLOCK_SIZE in OND.c */
+#define OND_BLOCK_SIZE              32
+
+/** Offset of block 0 in the image file, as FIRMWARE_BIN_FILE_OFFSET in Firmwares.h */
+#define FIRMWARE_BIN_FILE_OFFSET    4
+
+/** Length of the block data packet header */
+#define BLOCK_DATA_HEADER_LENGTH    (4 + 4 + 4 + 4 + 2 + 2 + 2 + 2 + 4 + 2)
+
+#define MAX_PACKET_LENGTH           1024
+
+/** Upper 32 bits of the simulated nodes' MAC addresses */
+#define NODE_MAC_HIGH               0x00158d00
+
+
+/** State of one simulated node */
+typedef struct
+{
+    uint32_t    u32AddressL;            /**< Low word of MAC address */
+    uint8_t    *pu8Have;                /**< Per block flag, set once the block has been received */
+    uint32_t    u32Received;            /**< Number of blocks received */
+    uint32_t    u32NextExpected;        /**< One past the highest block received */
+    uint64_t    u64LastBlock;           /**< Time the last block arrived */
+    uint64_t    u64LastRequest;         /**< Time of the last idle request burst */
+    uint32_t    u32Backoff;             /**< Multiplier of the idle time, doubled for each unanswered request */
+    uint32_t    u32JitterMs;            /**< Random extra idle time, so nodes don't all ask at once */
+    uint64_t    u64Complete;            /**< Time the image was completed, 0 if not yet */
+} tsNode;
+
+
+/** Simulation state */
+typedef struct
+{
+    int         iSocket;
+    struct sockaddr_in6 sDaemonAddress;
+
+    uint8_t    *pu8Image;
+    uint32_t    u32ImageSize;
+    uint32_t    u32TotalBlocks;
+    uint32_t    u32DeviceID;
+    uint16_t    u16ChipType;
+    uint16_t    u16Revision;
+
+    tsNode     *psNodes;
+    int         iNumNodes;
+    int         iNodesComplete;
+
+    double      dLoss;                  /**< Per hop loss probability */
+    double      dCapacity;              /**< Channel capacity in packets/s */
+    double      dChannelFreeAt;         /**< Time at which the channel has drained, in s */
+    uint32_t    u32QueueDepth;          /**< Packets the channel can buffer */
+
+    uint32_t    u32IdleTimeoutMs;       /**< Time without blocks before a node requests missing ones */
+    uint32_t    u32RequestsPerIdle;     /**< Blocks a node requests each idle timeout */
+    uint32_t    u32RequestsPerGap;      /**< Blocks a node requests when it sees a gap */
+
+    uint64_t    u64Start;
+    uint64_t    u64Initiate;
+    uint64_t    u64FirstBlock;          /**< Time the first block packet arrived */
+    uint64_t    u64LastBlock;           /**< Time the last block packet arrived */
+
+    uint32_t    u32BroadcastBlocks;
+    uint32_t    u32UnicastBlocks;
+    uint32_t    u32CongestionDrops;
+    uint32_t    u32Requests;
+    uint32_t    u32BadBlocks;
+} tsSim;
+
+
+static int verbosity = 0;
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "ONDSim Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -h                 Print this help.\n");
+    fprintf(stderr, "    -v <verbosity>     Verbosity level. Default 0.\n");
+    fprintf(stderr, "    -G <file>          Generate a test image of -b blocks into <file> and exit.\n");
+    fprintf(stderr, "    -b <blocks>        Number of blocks in generated image. Default 512.\n");
+    fprintf(stderr, "    -f <file>          Image the daemon has loaded, used to verify blocks.\n");
+    fprintf(stderr, "    -D <address>       IPv6 address of FWDistributiond. Default fd00::1.\n");
+    fprintf(stderr, "    -C <address>       IPv6 address of this simulated coordinator. Default fd00::2.\n");
+    fprintf(stderr, "    -p <port>          OND UDP port. Default 1874.\n");
+    fprintf(stderr, "    -n <nodes>         Number of nodes. Default 8.\n");
+    fprintf(stderr, "    -l <percent>       Random loss on each hop to each node. Default 2.\n");
+    fprintf(stderr, "    -c <packets/s>     Channel capacity. Default 150.\n");
+    fprintf(stderr, "    -q <packets>       Channel queue depth. Default 8.\n");
+    fprintf(stderr, "    -I <interval>      Block interval to request (units of 10ms). Default 1.\n");
+    fprintf(stderr, "    -i <ms>            Node idle time before requesting missing blocks. Default 250.\n");
+    fprintf(stderr, "    -k <blocks>        Blocks requested by a node per idle time. Default 4.\n");
+    fprintf(stderr, "    -g <blocks>        Blocks requested by a node when it sees a gap. Default 4.\n");
+    fprintf(stderr, "    -R <requests>      Number of times to request the download. Default 1.\n");
+    fprintf(stderr, "    -t <seconds>       Give up after this long. Default 300.\n");
+    fprintf(stderr, "    -s <seed>          Random seed. Default 1.\n");
+    exit(EXIT_FAILURE);
+}
+
+
+static uint64_t u64Now(void)
+{
+    struct timespec sTime;
+    clock_gettime(CLOCK_MONOTONIC, &sTime);
+    return ((uint64_t)sTime.tv_sec * 1000000ULL) + (sTime.tv_nsec / 1000);
+}
+
+
+static double dRandom(void)
+{
+    return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+
+/** Write a test image with a valid header and pseudo random contents.
+ *  The image is sized so that the last block lies entirely within the file.
+ */
+static int iGenerateImage(const char *pcFile, uint32_t u32Blocks)
+{
+    uint32_t u32Size = FIRMWARE_BIN_FILE_OFFSET + (u32Blocks * OND_BLOCK_SIZE);
+    uint8_t *pu8Image;
+    uint32_t u32Temp;
+    uint16_t u16Temp;
+    uint32_t i;
+    FILE *psFile;
+
+    if (u32Size < 0x20)
+    {
+        u32Size = 0x20;
+    }
+
+    pu8Image = malloc(u32Size);
+    if (!pu8Image)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < u32Size; i++)
+    {
+        pu8Image[i] = rand();
+    }
+
+    u32Temp = htonl(0x12345678); memcpy(&pu8Image[0x04], &u32Temp, sizeof(uint32_t));
+    u32Temp = htonl(0x11223344); memcpy(&pu8Image[0x08], &u32Temp, sizeof(uint32_t));
+    u32Temp = htonl(0x55667788); memcpy(&pu8Image[0x0c], &u32Temp, sizeof(uint32_t));
+    u32Temp = htonl(0x0000beef); memcpy(&pu8Image[0x14], &u32Temp, sizeof(uint32_t));
+    u16Temp = htons(0x0008);     memcpy(&pu8Image[0x18], &u16Temp, sizeof(uint16_t));
+    u16Temp = htons(0x0001);     memcpy(&pu8Image[0x1a], &u16Temp, sizeof(uint16_t));
+
+    psFile = fopen(pcFile, "w");
+    if (!psFile)
+    {
+        fprintf(stderr, "Could not create %s (%s)\n", pcFile, strerror(errno));
+        free(pu8Image);
+        return -1;
+    }
+    if (fwrite(pu8Image, 1, u32Size, psFile) != u32Size)
+    {
+        fprintf(stderr, "Could not write %s (%s)\n", pcFile, strerror(errno));
+        fclose(psFile);
+        free(pu8Image);
+        return -1;
+    }
+    fclose(psFile);
+    free(pu8Image);
+    return 0;
+}
+
+
+/** Load the image the daemon is serving, to verify received blocks against */
+static int iLoadImage(tsSim *psSim, const char *pcFile)
+{
+    struct stat sStat;
+    FILE *psFile;
+    uint32_t u32Temp;
+    uint16_t u16Temp;
+
+    psFile = fopen(pcFile, "r");
+    if (!psFile || (fstat(fileno(psFile), &sStat) < 0))
+    {
+        fprintf(stderr, "Could not open %s (%s)\n", pcFile, strerror(errno));
+        return -1;
+    }
+
+    psSim->u32ImageSize = sStat.st_size;
+    psSim->pu8Image = malloc(psSim->u32ImageSize);
+    if (!psSim->pu8Image || (fread(psSim->pu8Image, 1, psSim->u32ImageSize, psFile) != psSim->u32ImageSize))
+    {
+        fprintf(stderr, "Could not read %s\n", pcFile);
+        fclose(psFile);
+        return -1;
+    }
+    fclose(psFile);
+
+    memcpy(&u32Temp, &psSim->pu8Image[0x14], sizeof(uint32_t)); psSim->u32DeviceID = ntohl(u32Temp);
+    memcpy(&u16Temp, &psSim->pu8Image[0x18], sizeof(uint16_t)); psSim->u16ChipType = ntohs(u16Temp);
+    memcpy(&u16Temp, &psSim->pu8Image[0x1a], sizeof(uint16_t)); psSim->u16Revision = ntohs(u16Temp);
+
+    /* As eFirmware_Get_Total_Blocks */
+    psSim->u32TotalBlocks = psSim->u32ImageSize / OND_BLOCK_SIZE;
+    return 0;
+}
+
+
+/** Offer a packet to the shared channel.
+ *  \return 1 if the channel accepted it, 0 if it was dropped due to congestion
+ */
+static int iChannelOffer(tsSim *psSim)
+{
+    double dNow = (double)u64Now() / 1e6;
+    double dSlot = 1.0 / psSim->dCapacity;
+
+    if (psSim->dChannelFreeAt < dNow)
+    {
+        psSim->dChannelFreeAt = dNow;
+    }
+
+    if ((psSim->dChannelFreeAt - dNow) > (psSim->u32QueueDepth * dSlot))
+    {
+        psSim->u32CongestionDrops++;
+        return 0;
+    }
+
+    psSim->dChannelFreeAt += dSlot;
+    return 1;
+}
+
+
+/** Send a block request from a node to the daemon */
+static void vSendRequest(tsSim *psSim, tsNode *psNode, uint16_t u16BlockNumber, uint16_t u16RemainingBlocks)
+{
+    uint8_t au8Buffer[32];
+    uint32_t u32Temp;
+    uint16_t u16Temp;
+    int iLength = 4;
+
+    psSim->u32Requests++;
+
+    /* Requests travel over the same channel, and may be lost on the way */
+    if (!iChannelOffer(psSim) || (dRandom() < psSim->dLoss))
+    {
+        return;
+    }
+
+    au8Buffer[0] = 0;
+    au8Buffer[1] = OND_PACKET_BLOCK_REQUEST;
+    au8Buffer[2] = 0;
+    au8Buffer[3] = 0;
+
+    u32Temp = htonl(NODE_MAC_HIGH);         memcpy(&au8Buffer[iLength], &u32Temp, sizeof(uint32_t)); iLength += sizeof(uint32_t);
+    u32Temp = htonl(psNode->u32AddressL);   memcpy(&au8Buffer[iLength], &u32Temp, sizeof(uint32_t)); iLength += sizeof(uint32_t);
+    u32Temp = htonl(psSim->u32DeviceID);    memcpy(&au8Buffer[iLength], &u32Temp, sizeof(uint32_t)); iLength += sizeof(uint32_t);
+    u16Temp = htons(psSim->u16ChipType);    memcpy(&au8Buffer[iLength], &u16Temp, sizeof(uint16_t)); iLength += sizeof(uint16_t);
+    u16Temp = htons(psSim->u16Revision);    memcpy(&au8Buffer[iLength], &u16Temp, sizeof(uint16_t)); iLength += sizeof(uint16_t);
+    u16Temp = htons(u16BlockNumber);        memcpy(&au8Buffer[iLength], &u16Temp, sizeof(uint16_t)); iLength += sizeof(uint16_t);
+    u16Temp = htons(u16RemainingBlocks);    memcpy(&au8Buffer[iLength], &u16Temp, sizeof(uint16_t)); iLength += sizeof(uint16_t);
+
+    if (sendto(psSim->iSocket, au8Buffer, iLength, 0,
+               (struct sockaddr *)&psSim->sDaemonAddress, sizeof(struct sockaddr_in6)) != iLength)
+    {
+        fprintf(stderr, "Error sending request (%s)\n", strerror(errno));
+    }
+}
+
+
+/** Request up to the given number of the lowest missing blocks below a limit */
+static void vRequestMissing(tsSim *psSim, tsNode *psNode, uint32_t u32Limit, uint32_t u32Count)
+{
+    uint32_t u32Block;
+
+    for (u32Block = 0; (u32Block < u32Limit) && u32Count; u32Block++)
+    {
+        if (!psNode->pu8Have[u32Block])
+        {
+            vSendRequest(psSim, psNode, u32Block, psSim->u32TotalBlocks - psNode->u32Received);
+            u32Count--;
+        }
+    }
+}
+
+
+/** Deliver a block to a node */
+static void vNodeReceiveBlock(tsSim *psSim, tsNode *psNode, uint16_t u16BlockNumber, const uint8_t *pu8Data)
+{
+    uint64_t u64Time = u64Now();
+
+    if (memcmp(pu8Data, &psSim->pu8Image[FIRMWARE_BIN_FILE_OFFSET + (u16BlockNumber * OND_BLOCK_SIZE)], OND_BLOCK_SIZE) != 0)
+    {
+        psSim->u32BadBlocks++;
+        return;
+    }
+
+    if (psNode->pu8Have[u16BlockNumber])
+    {
+        return;
+    }
+
+    /* Only new blocks count as progress. Repeats of blocks it already has don't stop a node asking for more */
+    psNode->u64LastBlock = u64Time;
+    psNode->u32Backoff = 1;
+
+    /* A block beyond the next expected one reveals a gap. Request the blocks in it straight away,
+     * so the server learns about losses while it is still sending */
+    if (u16BlockNumber > psNode->u32NextExpected)
+    {
+        uint32_t u32Block, u32Count = psSim->u32RequestsPerGap;
+
+        for (u32Block = psNode->u32NextExpected; (u32Block < u16BlockNumber) && u32Count; u32Block++)
+        {
+            if (!psNode->pu8Have[u32Block])
+            {
+                vSendRequest(psSim, psNode, u32Block, psSim->u32TotalBlocks - psNode->u32Received);
+                u32Count--;
+            }
+        }
+    }
+    if (u16BlockNumber >= psNode->u32NextExpected)
+    {
+        psNode->u32NextExpected = u16BlockNumber + 1;
+    }
+
+    psNode->pu8Have[u16BlockNumber] = 1;
+    psNode->u32Received++;
+
+    if (psNode->u32Received == psSim->u32TotalBlocks)
+    {
+        psNode->u64Complete = u64Time;
+        psSim->iNodesComplete++;
+
+        /* Tell the server we're done */
+        vSendRequest(psSim, psNode, 0, 0);
+
+        if (verbosity > 0)
+        {
+            printf("Node 0x%08x%08x complete after %.2fs\n", NODE_MAC_HIGH, psNode->u32AddressL,
+                   (double)(u64Time - psSim->u64Start) / 1e6);
+        }
+    }
+}
+
+
+/** Handle a packet from the daemon */
+static void vHandlePacket(tsSim *psSim, const uint8_t *pu8Packet, int iLength)
+{
+    uint32_t u32AddressH, u32AddressL, u32DeviceID;
+    uint16_t u16BlockNumber, u16Length;
+    uint32_t u32Temp;
+    uint16_t u16Temp;
+    int i;
+
+    if (iLength < 4)
+    {
+        return;
+    }
+
+    if (pu8Packet[1] == OND_PACKET_INITIATE)
+    {
+        if (!psSim->u64Initiate)
+        {
+            psSim->u64Initiate = u64Now();
+        }
+        return;
+    }
+
+    if ((pu8Packet[1] != OND_PACKET_BLOCK_DATA) || (iLength < BLOCK_DATA_HEADER_LENGTH))
+    {
+        return;
+    }
+
+    memcpy(&u32Temp, &pu8Packet[4],  sizeof(uint32_t)); u32AddressH     = ntohl(u32Temp);
+    memcpy(&u32Temp, &pu8Packet[8],  sizeof(uint32_t)); u32AddressL     = ntohl(u32Temp);
+    memcpy(&u32Temp, &pu8Packet[12], sizeof(uint32_t)); u32DeviceID     = ntohl(u32Temp);
+    memcpy(&u16Temp, &pu8Packet[20], sizeof(uint16_t)); u16BlockNumber  = ntohs(u16Temp);
+    memcpy(&u16Temp, &pu8Packet[28], sizeof(uint16_t)); u16Length       = ntohs(u16Temp);
+
+    if ((u32DeviceID != psSim->u32DeviceID) || (u16BlockNumber >= psSim->u32TotalBlocks) ||
+        (u16Length != OND_BLOCK_SIZE) || (iLength < BLOCK_DATA_HEADER_LENGTH + OND_BLOCK_SIZE))
+    {
+        psSim->u32BadBlocks++;
+        return;
+    }
+
+    psSim->u64LastBlock = u64Now();
+    if (!psSim->u64FirstBlock)
+    {
+        psSim->u64FirstBlock = psSim->u64LastBlock;
+    }
+
+    if ((u32AddressH == 0xFFFFFFFF) && (u32AddressL == 0xFFFFFFFF))
+    {
+        psSim->u32BroadcastBlocks++;
+    }
+    else
+    {
+        psSim->u32UnicastBlocks++;
+    }
+
+    if (!iChannelOffer(psSim))
+    {
+        /* Lost to every node */
+        return;
+    }
+
+    for (i = 0; i < psSim->iNumNodes; i++)
+    {
+        tsNode *psNode = &psSim->psNodes[i];
+
+        if ((u32AddressH != 0xFFFFFFFF) &&
+            ((u32AddressH != NODE_MAC_HIGH) || (u32AddressL != psNode->u32AddressL)))
+        {
+            continue;
+        }
+        if (psNode->u64Complete || (dRandom() < psSim->dLoss))
+        {
+            continue;
+        }
+        vNodeReceiveBlock(psSim, psNode, u16BlockNumber, &pu8Packet[BLOCK_DATA_HEADER_LENGTH]);
+    }
+}
+
+
+/** Ask the daemon to start the download */
+static int iStartDownload(tsSim *psSim, struct in6_addr *psCoordinator, uint16_t u16BlockInterval)
+{
+    tsFWDistributionIPCHeader sHeader;
+    tsFWDistributionIPCStartDownload sDownload;
+    struct sockaddr_un sAddr;
+    int iTries, s;
+
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        fprintf(stderr, "Could not create IPC socket (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&sAddr, 0, sizeof(struct sockaddr_un));
+    sAddr.sun_family = AF_UNIX;
+    strcpy(sAddr.sun_path, FWDistributionIPCSockPath);
+
+    /* The daemon may still be starting up */
+    for (iTries = 0; connect(s, (struct sockaddr *)&sAddr, sizeof(struct sockaddr_un)) < 0; iTries++)
+    {
+        if (iTries > 50)
+        {
+            fprintf(stderr, "Could not connect to %s (%s)\n", FWDistributionIPCSockPath, strerror(errno));
+            close(s);
+            return -1;
+        }
+        usleep(100000);
+    }
+
+    memset(&sHeader, 0, sizeof(sHeader));
+    sHeader.eType = IPC_START_DOWNLOAD;
+    sHeader.u32PayloadLength = sizeof(tsFWDistributionIPCStartDownload);
+
+    memset(&sDownload, 0, sizeof(sDownload));
+    sDownload.u32DeviceID       = psSim->u32DeviceID;
+    sDownload.u16ChipType       = psSim->u16ChipType;
+    sDownload.u16Revision       = psSim->u16Revision;
+    sDownload.u16BlockInterval  = u16BlockInterval;
+    sDownload.sAddress          = *psCoordinator;
+
+    if (!psSim->u64Start)
+    {
+        psSim->u64Start = u64Now();
+    }
+
+    if ((send(s, &sHeader, sizeof(sHeader), 0) != sizeof(sHeader)) ||
+        (send(s, &sDownload, sizeof(sDownload), 0) != sizeof(sDownload)))
+    {
+        fprintf(stderr, "Could not send download request (%s)\n", strerror(errno));
+        close(s);
+        return -1;
+    }
+
+    close(s);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    tsSim sSim;
+    const char *pcGenerate = NULL;
+    const char *pcImage = NULL;
+    const char *pcDaemonAddress = "fd00::1";
+    const char *pcCoordinatorAddress = "fd00::2";
+    struct in6_addr sCoordinator;
+    struct sockaddr_in6 sBind;
+    uint32_t u32GenerateBlocks = 512;
+    uint16_t u16Port = 1874;
+    uint16_t u16BlockInterval = 1;
+    uint32_t u32TimeoutS = 300;
+    unsigned int uSeed = 1;
+    int iRequests = 1;
+    int opt, i;
+
+    memset(&sSim, 0, sizeof(sSim));
+    sSim.iNumNodes          = 8;
+    sSim.dLoss              = 0.02;
+    sSim.dCapacity          = 150;
+    sSim.u32QueueDepth      = 8;
+    sSim.u32IdleTimeoutMs   = 250;
+    sSim.u32RequestsPerIdle = 4;
+    sSim.u32RequestsPerGap  = 4;
+
+    while ((opt = getopt(argc, argv, "hv:G:b:f:D:C:p:n:l:c:q:I:i:k:g:R:t:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'v': verbosity = atoi(optarg); break;
+            case 'G': pcGenerate = optarg; break;
+            case 'b': u32GenerateBlocks = strtoul(optarg, NULL, 0); break;
+            case 'f': pcImage = optarg; break;
+            case 'D': pcDaemonAddress = optarg; break;
+            case 'C': pcCoordinatorAddress = optarg; break;
+            case 'p': u16Port = atoi(optarg); break;
+            case 'n': sSim.iNumNodes = atoi(optarg); break;
+            case 'l': sSim.dLoss = atof(optarg) / 100.0; break;
+            case 'c': sSim.dCapacity = atof(optarg); break;
+            case 'q': sSim.u32QueueDepth = atoi(optarg); break;
+            case 'I': u16BlockInterval = atoi(optarg); break;
+            case 'i': sSim.u32IdleTimeoutMs = atoi(optarg); break;
+            case 'k': sSim.u32RequestsPerIdle = atoi(optarg); break;
+            case 'g': sSim.u32RequestsPerGap = atoi(optarg); break;
+            case 'R': iRequests = atoi(optarg); break;
+            case 't': u32TimeoutS = atoi(optarg); break;
+            case 's': uSeed = strtoul(optarg, NULL, 0); break;
+            default:  print_usage_exit(argv);
+        }
+    }
+
+    srand(uSeed);
+
+    if (pcGenerate)
+    {
+        return iGenerateImage(pcGenerate, u32GenerateBlocks) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!pcImage || (sSim.iNumNodes < 1) || (sSim.dCapacity <= 0))
+    {
+        print_usage_exit(argv);
+    }
+
+    if (iLoadImage(&sSim, pcImage) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    memset(&sSim.sDaemonAddress, 0, sizeof(struct sockaddr_in6));
+    sSim.sDaemonAddress.sin6_family = AF_INET6;
+    sSim.sDaemonAddress.sin6_port   = htons(u16Port);
+    if ((inet_pton(AF_INET6, pcDaemonAddress, &sSim.sDaemonAddress.sin6_addr) != 1) ||
+        (inet_pton(AF_INET6, pcCoordinatorAddress, &sCoordinator) != 1))
+    {
+        fprintf(stderr, "Invalid address\n");
+        return EXIT_FAILURE;
+    }
+
+    sSim.psNodes = calloc(sSim.iNumNodes, sizeof(tsNode));
+    if (!sSim.psNodes)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < sSim.iNumNodes; i++)
+    {
+        sSim.psNodes[i].u32AddressL = 0x00000100 + i;
+        sSim.psNodes[i].u32Backoff  = 1;
+        sSim.psNodes[i].pu8Have = calloc(sSim.u32TotalBlocks, 1);
+        if (!sSim.psNodes[i].pu8Have)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    sSim.iSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sSim.iSocket < 0)
+    {
+        fprintf(stderr, "Could not create socket (%s)\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    memset(&sBind, 0, sizeof(struct sockaddr_in6));
+    sBind.sin6_family = AF_INET6;
+    sBind.sin6_port   = htons(u16Port);
+    sBind.sin6_addr   = sCoordinator;
+
+    /* Wait for the coordinator address to be configured, so the daemon can reach us */
+    for (i = 0; bind(sSim.iSocket, (struct sockaddr *)&sBind, sizeof(struct sockaddr_in6)) < 0; i++)
+    {
+        if ((errno != EADDRNOTAVAIL) || (i > 100))
+        {
+            fprintf(stderr, "Could not bind to [%s]:%d (%s)\n", pcCoordinatorAddress, u16Port, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        usleep(100000);
+    }
+
+    printf("Image: %d blocks, %d nodes, %.1f%% loss per hop, channel %.0f packets/s, queue %d, interval %dms\n",
+           sSim.u32TotalBlocks, sSim.iNumNodes, sSim.dLoss * 100.0, sSim.dCapacity, sSim.u32QueueDepth,
+           u16BlockInterval * 10);
+
+    /* Repeated requests for the same download should be merged by the daemon, not sent again */
+    for (i = 0; i < iRequests; i++)
+    {
+        if (iStartDownload(&sSim, &sCoordinator, u16BlockInterval) < 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    while (sSim.iNodesComplete < sSim.iNumNodes)
+    {
+        uint8_t au8Buffer[MAX_PACKET_LENGTH];
+        struct timeval sTimeout = { 0, 10000 };
+        uint64_t u64Time;
+        fd_set sFds;
+
+        FD_ZERO(&sFds);
+        FD_SET(sSim.iSocket, &sFds);
+
+        if (select(sSim.iSocket + 1, &sFds, NULL, NULL, &sTimeout) > 0)
+        {
+            int iLength = recv(sSim.iSocket, au8Buffer, sizeof(au8Buffer), 0);
+            if (iLength > 0)
+            {
+                vHandlePacket(&sSim, au8Buffer, iLength);
+            }
+        }
+
+        u64Time = u64Now();
+        if ((u64Time - sSim.u64Start) > ((uint64_t)u32TimeoutS * 1000000ULL))
+        {
+            break;
+        }
+
+        if (!sSim.u64Initiate)
+        {
+            continue;
+        }
+
+        /* Nodes that have heard nothing for a while ask for what they are missing */
+        for (i = 0; i < sSim.iNumNodes; i++)
+        {
+            tsNode *psNode = &sSim.psNodes[i];
+            uint64_t u64Last = psNode->u64LastBlock > psNode->u64LastRequest ? psNode->u64LastBlock : psNode->u64LastRequest;
+
+            if (u64Last == 0)
+            {
+                u64Last = sSim.u64Initiate;
+            }
+            if (psNode->u64Complete || 
+                ((u64Time - u64Last) < (((sSim.u32IdleTimeoutMs * psNode->u32Backoff) + psNode->u32JitterMs) * 1000ULL)))
+            {
+                continue;
+            }
+
+            psNode->u64LastRequest = u64Time;
+            psNode->u32JitterMs = dRandom() * sSim.u32IdleTimeoutMs;
+            if (psNode->u32Backoff < 16)
+            {
+                psNode->u32Backoff *= 2;
+            }
+            vRequestMissing(&sSim, psNode, sSim.u32TotalBlocks, sSim.u32RequestsPerIdle);
+        }
+    }
+
+    {
+        double dTotal = 0, dFirst = 0, dLast = 0;
+        int iComplete = 0;
+
+        for (i = 0; i < sSim.iNumNodes; i++)
+        {
+            if (sSim.psNodes[i].u64Complete)
+            {
+                double dTime = (double)(sSim.psNodes[i].u64Complete - sSim.u64Start) / 1e6;
+
+                if ((iComplete == 0) || (dTime < dFirst))
+                {
+                    dFirst = dTime;
+                }
+                if (dTime > dLast)
+                {
+                    dLast = dTime;
+                }
+                dTotal += dTime;
+                iComplete++;
+            }
+        }
+
+        printf("Nodes complete:      %d/%d\n", iComplete, sSim.iNumNodes);
+        if (iComplete)
+        {
+            printf("Completion time:     first %.2fs, mean %.2fs, last %.2fs\n", dFirst, dTotal / iComplete, dLast);
+        }
+        printf("Blocks sent:         %d broadcast, %d unicast (%.2f per image block)\n",
+               sSim.u32BroadcastBlocks, sSim.u32UnicastBlocks,
+               (double)(sSim.u32BroadcastBlocks + sSim.u32UnicastBlocks) / sSim.u32TotalBlocks);
+        if (sSim.u64LastBlock > sSim.u64FirstBlock)
+        {
+            printf("Arrival rate:        %.1f packets/s\n",
+                   (double)(sSim.u32BroadcastBlocks + sSim.u32UnicastBlocks) * 1e6 / (sSim.u64LastBlock - sSim.u64FirstBlock));
+        }
+        printf("Block requests:      %d\n", sSim.u32Requests);
+        printf("Congestion drops:    %d\n", sSim.u32CongestionDrops);
+        if (sSim.u32BadBlocks)
+        {
+            printf("Bad blocks:          %d\n", sSim.u32BadBlocks);
+        }
+
+        return ((iComplete == sSim.iNumNodes) && (sSim.u32BadBlocks == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,150 @@
+#!/bin/sh
+
+# Benchmark of FWDistributiond over-network downloads on a simulated lossy network.
+#
+# Runs FWDistributiond in a private network namespace, and ONDSim (a simulated
+# coordinator and nodes) in a second one joined to it by a veth pair, so the
+# daemon and the simulator can both use the OND port without touching the
+# host's network configuration. Reports the time taken until every simulated
+# node holds a complete image.
+#
+# With -m, several simulated coordinators download the image at once, each in
+# a namespace of its own, to check they share the daemon's packet rate fairly.
+#
+# Note the daemon's IPC socket path is fixed, so this should not be run on a
+# machine where FWDistributiond is already running.
+
+BLOCKS=512
+NODES=8
+LOSS=2
+CAPACITY=150
+INTERVAL=1
+VERBOSITY=4
+COORDINATORS=1
+REQUESTS=1
+RATE=""
+
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+DAEMON=${DAEMON:-$TEST_DIR/../Build/FWDistributiond}
+ONDSIM=${ONDSIM:-$TEST_DIR/ONDSim}
+
+
+usage()
+{
+    echo ""
+    echo "Usage: $0 [options]"
+    echo "Options:"
+    echo "-b <blocks>          Image size in blocks. Default $BLOCKS"
+    echo "-n <nodes>           Number of simulated nodes. Default $NODES"
+    echo "-l <percent>         Random loss on each hop to each node. Default $LOSS"
+    echo "-c <packets/s>       Channel capacity. Default $CAPACITY"
+    echo "-I <interval>        Block interval (units of 10ms). Default $INTERVAL"
+    echo "-v <verbosity>       FWDistributiond verbosity. Default $VERBOSITY"
+    echo "-m <coordinators>    Number of simulated coordinators downloading at once. Default $COORDINATORS"
+    echo "-R <requests>        Times each coordinator requests the download. Default $REQUESTS"
+    echo "-r <packets/s>       FWDistributiond packet rate limit. Default the daemon's own"
+    echo ""
+}
+
+while getopts "b:n:l:c:I:v:m:R:r:h" opt
+do
+    case $opt in
+        b) BLOCKS=$OPTARG ;;
+        n) NODES=$OPTARG ;;
+        l) LOSS=$OPTARG ;;
+        c) CAPACITY=$OPTARG ;;
+        I) INTERVAL=$OPTARG ;;
+        v) VERBOSITY=$OPTARG ;;
+        m) COORDINATORS=$OPTARG ;;
+        R) REQUESTS=$OPTARG ;;
+        r) RATE=$OPTARG ;;
+        *) usage; exit 1 ;;
+    esac
+done
+
+for BINARY in "$DAEMON" "$ONDSIM"
+do
+    if [ ! -x "$BINARY" ]
+    then
+        echo "$BINARY not found - run make first"
+        exit 1
+    fi
+done
+
+# Re-run ourselves in a new network namespace. Use a user namespace too when not root.
+if [ -z "$FWDIST_BENCH_NETNS" ]
+then
+    export FWDIST_BENCH_NETNS=1
+    if [ "$(id -u)" = "0" ]
+    then
+        exec unshare --net "$0" "$@"
+    else
+        exec unshare --map-root-user --net "$0" "$@"
+    fi
+fi
+
+WORK_DIR=$(mktemp -d /tmp/FWDistribution-bench.XXXXXX)
+IMAGE=$WORK_DIR/image.bin
+
+SIM_PIDS=""
+DAEMON_PID=""
+
+cleanup()
+{
+    [ -n "$DAEMON_PID" ] && kill "$DAEMON_PID" 2>/dev/null
+    [ -n "$SIM_PIDS" ] && kill $SIM_PIDS 2>/dev/null
+    wait 2>/dev/null
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT INT TERM
+
+"$ONDSIM" -G "$IMAGE" -b "$BLOCKS" || exit 1
+
+ip link set lo up
+
+"$DAEMON" -F -v "$VERBOSITY" ${RATE:+-r "$RATE"} -f "$IMAGE" &
+DAEMON_PID=$!
+
+# Each simulated coordinator gets a network namespace of its own, joined to ours by a veth pair,
+# with coordinator N on subnet fd00:N::/64. They wait for their address before starting the download.
+N=0
+while [ $N -lt "$COORDINATORS" ]
+do
+    unshare --net "$ONDSIM" -f "$IMAGE" -n "$NODES" -l "$LOSS" -c "$CAPACITY" -I "$INTERVAL" -R "$REQUESTS" \
+                            -s $((N + 1)) -D "fd00:$N::1" -C "fd00:$N::2" > "$WORK_DIR/sim$N.log" 2>&1 &
+    SIM_PID=$!
+    SIM_PIDS="$SIM_PIDS $SIM_PID"
+
+    # Wait for the simulator to be in its own namespace before plumbing it in
+    TRIES=0
+    while [ "$(readlink /proc/$SIM_PID/ns/net)" = "$(readlink /proc/$$/ns/net)" ] || \
+          ! ip link add "ond$N" type veth peer name ond1 netns "$SIM_PID" 2>/dev/null
+    do
+        TRIES=$((TRIES + 1))
+        if [ $TRIES -gt 50 ] || ! kill -0 "$SIM_PID" 2>/dev/null
+        then
+            echo "Could not create veth pair to ONDSim"
+            exit 1
+        fi
+        sleep 0.1
+    done
+
+    ip link set "ond$N" up
+    ip -6 addr add "fd00:$N::1/64" dev "ond$N" nodad
+    nsenter -t "$SIM_PID" -n sh -c "ip link set lo up && ip link set ond1 up && ip -6 addr add fd00:$N::2/64 dev ond1 nodad"
+    N=$((N + 1))
+done
+
+RESULT=0
+N=0
+for SIM_PID in $SIM_PIDS
+do
+    wait "$SIM_PID" || RESULT=1
+    echo ""
+    echo "Coordinator fd00:$N::2"
+    cat "$WORK_DIR/sim$N.log"
+    N=$((N + 1))
+done
+SIM_PIDS=""
+
+exit $RESULT
@@ -318,6 +318,7 @@ int jip_discover   (char *);
 int jip_load       (char *);
 int jip_save       (char *);
 int jip_print      (char *);
+int jip_changes    (char *);
 int jip_ipv6       (char *);
 int jip_device     (char *);
 int jip_mib        (char *);
@@ -348,6 +349,7 @@ COMMAND commands[] = {
     { "save",       jip_save,          "<File name>",              "Save network contents to file (name optional)" },
     
     { "print",      jip_print,         NULL,                       "Print active section of discovered network" },
+    { "changes",    jip_changes,       NULL,                       "Print variables of active section changed since last print" },
     
     { "ipv6",       jip_ipv6,          "<IPv6 address>",           "Change active IPv6 address" },
     { "device",     jip_device,        "<Device ID>",              "Change active device ID" },
@@ -1241,34 +1243,39 @@ int jip_save (char *arg)
 /* Print */
 
 
-/** Callback funtion to print node details */
-int jip_print_node (tsNode *psNode, void *pvUser)
+/** Generation of the last snapshot printed, for printing the changes since */
+static uint32_t u32PrintGeneration = 0;
+
+
+/** Print node details from a snapshot */
+static void jip_print_node (tsJIP_SnapshotNode *psNode)
 {
     char buffer[INET6_ADDRSTRLEN] = "Could not determine address\n";
 
-    inet_ntop(AF_INET6, &psNode->sNode_Address.sin6_addr, buffer, INET6_ADDRSTRLEN);
+    inet_ntop(AF_INET6, psNode->au8Address, buffer, INET6_ADDRSTRLEN);
 
     printf("  Node: %s", buffer);
     printf("    Device ID: 0x%08x\n\r", psNode->u32DeviceId);
-
-    return 1;
 }
 
 
-/** Callback funtion to print MiB details */
-int jip_print_mib (tsMib *psMib, void *pvUser)
+/** Print MiB details from a snapshot */
+static void jip_print_mib (tsJIP_SnapshotMib *psMib)
 {
-    printf("    Mib: '%s', ID 0x%08x\n\r", psMib->pcName, psMib->u32MibId);
-    return 1;
+    printf("    Mib: '%.*s', ID 0x%08x\n\r", psMib->u8NameLength, psMib->acName, psMib->u32MibId);
 }
 
 
-/** Callback funtion to print variable details */
-int jip_print_var (tsVar *psVar, void *pvUser)
+/** Print variable details and value from a snapshot 
+ *  \param psVar        Variable record
+ *  \param pu8Value     Value following the variable record, if it has one
+ */
+static void jip_print_var (tsJIP_SnapshotVar *psVar, const uint8_t *pu8Value)
 {
-    printf("      Var: '%s', Index %d%s\n\r", psVar->pcName, psVar->u8Index & 0xFF, psVar->eEnable == E_JIP_VAR_DISABLED ? " (disabled)": "");
+    printf("      Var: '%.*s', Index %d%s\n\r", psVar->u8NameLength, psVar->acName, psVar->u8Index,
+           (psVar->u8Flags & JIP_SNAPSHOT_VAR_ENABLED) ? "" : " (disabled)");
     printf("        ");
-    switch (psVar->eVarType)
+    switch (psVar->u8VarType)
     {
 #define TEST(a) case  (a): printf(#a); break
         TEST(E_JIP_VAR_TYPE_INT8);
@@ -1289,7 +1296,7 @@ int jip_print_var (tsVar *psVar, void *pvUser)
     }
     
     printf(", ");
-    switch (psVar->eAccessType)
+    switch (psVar->u8AccessType)
     {
 #define TEST(a) case  (a): printf(#a); break
         TEST(E_JIP_ACCESS_TYPE_CONST);
@@ -1300,7 +1307,7 @@ int jip_print_var (tsVar *psVar, void *pvUser)
     }             
 
     printf(", ");
-    switch (psVar->eSecurity)
+    switch (psVar->u8Security)
     {
 #define TEST(a) case  (a): printf(#a); break
         TEST(E_JIP_SECURITY_NONE);
@@ -1310,66 +1317,232 @@ int jip_print_var (tsVar *psVar, void *pvUser)
     printf("\n\r");
     
     printf("          Value: ");
-    if (psVar->pvData)
-    {
-        switch (psVar->eVarType)
-        {
-#define TEST(a, b, c) case  (a): printf(b, *psVar->c); break
-            TEST(E_JIP_VAR_TYPE_INT8,   "%d\n\r",   pi8Data);
-            TEST(E_JIP_VAR_TYPE_UINT8,  "%u\n\r",   pu8Data);
-            TEST(E_JIP_VAR_TYPE_INT16,  "%d\n\r",   pi16Data);
-            TEST(E_JIP_VAR_TYPE_UINT16, "%u\n\r",   pu16Data);
-            TEST(E_JIP_VAR_TYPE_INT32,  "%d\n\r",   pi32Data);
-            TEST(E_JIP_VAR_TYPE_UINT32, "%u\n\r",   pu32Data);
-            TEST(E_JIP_VAR_TYPE_INT64,  "%lld\n\r", pi64Data);
-            TEST(E_JIP_VAR_TYPE_UINT64, "%llu\n\r", pu64Data);
-            TEST(E_JIP_VAR_TYPE_FLT,    "%f\n\r",   pfData);
-            TEST(E_JIP_VAR_TYPE_DBL,    "%f\n\r",   pdData);
+    if (!(psVar->u8Flags & JIP_SNAPSHOT_VAR_VALUE))
+    {
+        printf("?\n\r");
+    }
+    else if (psVar->u8VarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        uint16_t u16NumRows;
+        int i;
+        
+        memcpy(&u16NumRows, pu8Value, sizeof(uint16_t));
+        pu8Value += sizeof(uint16_t);
+        printf("\n");
+        for (i = 0; i < u16NumRows; i++)
+        {
+            tsJIP_SnapshotRow *psRow = (tsJIP_SnapshotRow *)pu8Value;
+            uint32_t j;
+            
+            pu8Value += sizeof(tsJIP_SnapshotRow);
+            printf("            %03d {", psRow->u16Index);
+            for (j = 0; j < psRow->u16Length; j++)
+            {
+                printf(" 0x%02x", pu8Value[j]);
+            }
+            printf(" }\n");
+            pu8Value += psRow->u16Length;
+        }
+    }
+    else
+    {
+        uint8_t u8Length = pu8Value[0];
+        /* Values are not aligned in the snapshot */
+        union
+        {
+            int8_t      i8Data;
+            int16_t     i16Data;
+            int32_t     i32Data;
+            long long int i64Data;
+            uint8_t     u8Data;
+            uint16_t    u16Data;
+            uint32_t    u32Data;
+            unsigned long long int u64Data;
+            float       fData;
+            double      dData;
+        } uValue;
+        
+        pu8Value += sizeof(uint8_t);
+        memset(&uValue, 0, sizeof(uValue));
+        memcpy(&uValue, pu8Value, (u8Length < sizeof(uValue)) ? u8Length : sizeof(uValue));
+        
+        switch (psVar->u8VarType)
+        {
+#define TEST(a, b, c) case  (a): printf(b, uValue.c); break
+            TEST(E_JIP_VAR_TYPE_INT8,   "%d\n\r",   i8Data);
+            TEST(E_JIP_VAR_TYPE_UINT8,  "%u\n\r",   u8Data);
+            TEST(E_JIP_VAR_TYPE_INT16,  "%d\n\r",   i16Data);
+            TEST(E_JIP_VAR_TYPE_UINT16, "%u\n\r",   u16Data);
+            TEST(E_JIP_VAR_TYPE_INT32,  "%d\n\r",   i32Data);
+            TEST(E_JIP_VAR_TYPE_UINT32, "%u\n\r",   u32Data);
+            TEST(E_JIP_VAR_TYPE_INT64,  "%lld\n\r", i64Data);
+            TEST(E_JIP_VAR_TYPE_UINT64, "%llu\n\r", u64Data);
+            TEST(E_JIP_VAR_TYPE_FLT,    "%f\n\r",   fData);
+            TEST(E_JIP_VAR_TYPE_DBL,    "%f\n\r",   dData);
+#undef TEST
             case  (E_JIP_VAR_TYPE_STR): 
-                printf("%s\n\r", psVar->pcData); 
+                printf("%.*s\n\r", u8Length, pu8Value); 
                 break;
             case (E_JIP_VAR_TYPE_BLOB):
             {
                 uint32_t i;
                 printf("{");
-                for (i = 0; i < psVar->u8Size; i++)
+                for (i = 0; i < u8Length; i++)
                 {
-                    printf(" 0x%02x", psVar->pbData[i]);
+                    printf(" 0x%02x", pu8Value[i]);
                 }
                 printf(" }\n\r");
                 break;
             }
+            default: printf("Unknown Type\n\r");
+        }
+    }
+    printf("\n\r");
+}
+
+
+/** Step past the value of a variable in a snapshot
+ *  \param psVar        Variable record
+ *  \return Pointer to the record following the variable
+ */
+static uint8_t *jip_snapshot_skip_var (tsJIP_SnapshotVar *psVar)
+{
+    uint8_t *pu8Next = (uint8_t *)&psVar->acName[psVar->u8NameLength];
+    
+    if (!(psVar->u8Flags & JIP_SNAPSHOT_VAR_VALUE))
+    {
+        return pu8Next;
+    }
+    if (psVar->u8VarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        uint16_t u16NumRows;
+        
+        memcpy(&u16NumRows, pu8Next, sizeof(uint16_t));
+        pu8Next += sizeof(uint16_t);
+        while (u16NumRows--)
+        {
+            pu8Next += sizeof(tsJIP_SnapshotRow) + ((tsJIP_SnapshotRow *)pu8Next)->u16Length;
+        }
+        return pu8Next;
+    }
+    return pu8Next + sizeof(uint8_t) + pu8Next[0];
+}
+
+
+/** Compare a name from a snapshot with a filter, which may be an index or ID instead */
+static int jip_snapshot_match (const char *filter, uint32_t u32Id, const char *pcName, uint8_t u8NameLength)
+{
+    char *pcEnd;
+    uint32_t u32FilterId = strtoul(filter, &pcEnd, 0);
+    
+    if ((pcEnd != filter) && (*pcEnd == '\0')) /* Whole string has been converted - must be a legit number */
+    {
+        return u32FilterId == u32Id;
+    }
+    return (strlen(filter) == u8NameLength) && (strncmp(filter, pcName, u8NameLength) == 0);
+}
+
+
+/** Print the active section of the network from one snapshot.
+ *  \param u32SinceGeneration   Generation to print the changes since, or 0 to print every variable
+ *  \return non-zero on success.
+ */
+static int jip_print_snapshot (uint32_t u32SinceGeneration)
+{
+    tsJIP_SnapshotHeader *psHeader;
+    uint8_t *pu8Snapshot, *pu8Record;
+    uint32_t u32Length;
+    uint32_t Device_ID = E_JIP_DEVICEID_ALL;
+    uint32_t MiB_ID = E_JIP_MIBID_ALL;
+    struct in6_addr node_addr;
+    int is_multicast = 0;
+    uint32_t NodeIndex;
+    
+    if (filter_ipv6)
+    {
+        if (inet_pton(AF_INET6, filter_ipv6, &node_addr) != 1)
+        {
+            fprintf(stderr, "Invalid IPv6 address '%s'\n\r", filter_ipv6);
+            return 0;
+        }
+        
+        if ((strncmp(filter_ipv6, "FF", 2) == 0) || (strncmp(filter_ipv6, "ff", 2) == 0))
+        {
+            is_multicast = 1;
+        }
+    }
+    
+    if (filter_device)
+    {
+        char *pcEnd;
+        errno = 0;
+        Device_ID = strtoul(filter_device, &pcEnd, 0);
+        if (errno || (*pcEnd != '\0'))
+        {
+            fprintf(stderr, "Device ID '%s' cannot be converted to 32 bit integer\n\r", filter_device);
+            return 0;
+        }
+    }
+    
+    if (filter_mib)
+    {
+        char *pcEnd;
+        uint32_t u32MibId = strtoul(filter_mib, &pcEnd, 0);
+        
+        if ((pcEnd != filter_mib) && (*pcEnd == '\0'))
+        {
+            /* Let libJIP filter on the ID, names are compared below */
+            MiB_ID = u32MibId;
+        }
+    }
+    
+    if (eJIP_GetNetworkSnapshot(&sJIP_Context, Device_ID, MiB_ID, u32SinceGeneration, &pu8Snapshot, &u32Length) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error reading network snapshot\n");
+        return 0;
+    }
+    psHeader = (tsJIP_SnapshotHeader *)pu8Snapshot;
+    u32PrintGeneration = psHeader->u32Generation;
+    
+    pu8Record = pu8Snapshot + sizeof(tsJIP_SnapshotHeader);
+    for (NodeIndex = 0; NodeIndex < psHeader->u32NumNodes; NodeIndex++)
+    {
+        tsJIP_SnapshotNode *psNode = (tsJIP_SnapshotNode *)pu8Record;
+        int print_node = !filter_ipv6 || is_multicast || (memcmp(psNode->au8Address, &node_addr, sizeof(struct in6_addr)) == 0);
+        uint32_t MibIndex;
+        
+        if (print_node)
+        {
+            jip_print_node(psNode);
+        }
+        
+        pu8Record += sizeof(tsJIP_SnapshotNode);
+        for (MibIndex = 0; MibIndex < psNode->u16NumMibs; MibIndex++)
+        {
+            tsJIP_SnapshotMib *psMib = (tsJIP_SnapshotMib *)pu8Record;
+            int print_mib = print_node && (!filter_mib || jip_snapshot_match(filter_mib, psMib->u32MibId, psMib->acName, psMib->u8NameLength));
+            uint32_t VarIndex;
+            
+            if (print_mib)
+            {
+                jip_print_mib(psMib);
+            }
             
-            case (E_JIP_VAR_TYPE_TABLE_BLOB):
+            pu8Record = (uint8_t *)&psMib->acName[psMib->u8NameLength];
+            for (VarIndex = 0; VarIndex < psMib->u16NumVars; VarIndex++)
             {
-                tsTableRow *psTableRow;
-                int i;
-                printf("\n");
-                for (i = 0; i < psVar->ptData->u32NumRows; i++)
+                tsJIP_SnapshotVar *psVar = (tsJIP_SnapshotVar *)pu8Record;
+                
+                if (print_mib && (!filter_var || jip_snapshot_match(filter_var, psVar->u8Index, psVar->acName, psVar->u8NameLength)))
                 {
-                    psTableRow = &psVar->ptData->psRows[i];
-                    if (psTableRow->pvData)
-                    {
-                        uint32_t j;
-                        printf("            %03d {", i);
-                        for (j = 0; j < psTableRow->u32Length; j++)
-                        {
-                            printf(" 0x%02x", psTableRow->pbData[j]);
-                        }
-                        printf(" }\n");
-                    }
+                    jip_print_var(psVar, (uint8_t *)&psVar->acName[psVar->u8NameLength]);
                 }
-                break;
+                pu8Record = jip_snapshot_skip_var(psVar);
             }
-            default: printf("Unknown Type\n\r");
-#undef TEST
         }
     }
-    else
-    {
-        printf("?\n\r");
-    }
-    printf("\n\r");
+    
+    free(pu8Snapshot);
     return 1;
 }
 
@@ -1377,7 +1550,18 @@ int jip_print_var (tsVar *psVar, void *pvUser)
 /** Print filtered network */
 int jip_print(char *arg)
 {
-    return jip_iterate(jip_print_node, NULL, jip_print_mib, NULL, jip_print_var, NULL);
+    return jip_print_snapshot(0);
+}
+
+
+/** Print the variables of the filtered network that have changed since the last print */
+int jip_changes(char *arg)
+{
+    if (u32PrintGeneration == 0)
+    {
+        printf("Nothing printed yet, printing everything\n\r");
+    }
+    return jip_print_snapshot(u32PrintGeneration);
 }
 
 
@@ -173,6 +173,12 @@
 /** Default port number for JIP service */
 #define JIP_DEFAULT_PORT 1873
 
+/** Default size in bytes of the MiB and variable query responses asked for during discovery (\ref iQueryPageSize) */
+#define JIP_QUERY_PAGE_SIZE 1024
+
+/** Default number of times a table variable is read without being read in full before it is read in full anyway (\ref iTableRereadInterval) */
+#define JIP_TABLE_REREAD_INTERVAL 16
+
 /* Define some useful convenience macros. */
 #define STRING(a) stringize(a)
 #define stringize(s) #s
@@ -188,6 +194,14 @@
 #define E_JIP_DEVICEID_ALL      (0xFFFFFFFF)
 
 
+/** \ingroup Snapshot
+ * Special MiB ID for all MiBs.
+ * When passed to \ref eJIP_GetNetworkSnapshot,
+ * the variables of every MiB are returned.
+ */
+#define E_JIP_MIBID_ALL         (0xFFFFFFFF)
+
+
 /** \ingroup Convenience
  *  Standard MIB IDs
  * @{
@@ -215,6 +229,10 @@
 /** @} */                                                    
 
 
+/** Most variables that may be set together with \ref eJIP_SetVars */
+#define JIP_SET_VARS_MAX        (16)
+
+
 /** Typedef for boolean values */
 typedef enum 
 {
@@ -362,6 +380,16 @@ typedef teJIP_Status (*tprCbVarGet)(struct _tsVar *psVar);
  */
 typedef teJIP_Status (*tprCbVarSet)(struct _tsVar *psVar, tsJIPAddress *psMulticastAddress);
 
+/** Server callback function for when several variables of a node are set together by a client,
+ *  with \ref eJIP_SetVars. The data from the client has been set in every variable before it is called,
+ *  so the application can act on the new values at once rather than one variable at a time.
+ *  \param psNode       Pointer to the node
+ *  \param apsVars      The variables being updated, in the order of the request
+ *  \param u32NumVars   Number of variables in apsVars
+ *  \return E_JIP_OK if update was successful
+ */
+typedef teJIP_Status (*tprCbNodeSet)(struct _tsNode *psNode, struct _tsVar **apsVars, uint32_t u32NumVars);
+
 
 /** Function prototype for a trap callback
  *  \ingroup Traps
@@ -464,6 +492,20 @@ typedef struct _tsVar
     uint8_t                 u8Size;             /**< Used for Blobs - Number of bytes of data */
     
     uint8_t                 u8TrapHandle;       /**< A handle value associated with traps from this variable */
+    
+    tprCbVarSet             prCbVarGroupSet;    /**< Function to be called upon a multicast set, if the application acts on the
+                                                 * whole group at once (e.g. by a single broadcast to the group).
+                                                 * The data is set in every member of the group, but this is called only once per
+                                                 * multicast request for each MiB and variable, with the variable of the first member.
+                                                 * If it is left as NULL, \ref prCbVarSet is called for each member of the group.
+                                                 */
+    
+    void*                   pvTablePriv;        /**< Private to libJIP. Storage of the rows of a \ref E_JIP_VAR_TYPE_TABLE_BLOB
+                                                 * variable read from the network with \ref eJIP_GetVar, or the change
+                                                 * stamps of the rows of one that is served */
+    
+    uint32_t                u32Generation;      /**< Generation at which the variable was added or its data last changed.
+                                                 * See \ref eJIP_GetNetworkSnapshot */
 } tsVar;
 
 
@@ -506,6 +548,12 @@ typedef struct _tsNode
                                                  */
                                                  
     uint32_t                u32NumMibs;         /**< The number of MiBs that this node has */
+    
+    tprCbNodeSet            prCbNodeSet;        /**< Function to be called upon a unicast set of several variables of the node
+                                                 * together. If it is left as NULL, \ref tsVar::prCbVarSet of each variable
+                                                 * is called in turn. Multicast sets of several variables always call
+                                                 * the setters of each variable.
+                                                 */
 } tsNode;
 
 
@@ -536,6 +584,20 @@ typedef struct _tsJIP_Context
                                                      default interface. */
     int                     iMulticastSendCount;/**< The number of times to send each multicast set request.
                                                      The default is 2 to send each request twice. */
+    int                     iQueryPageSize;     /**< Largest size in bytes of the MiB and variable query responses to ask
+                                                     nodes for when discovering them. Each type of device starts with 4
+                                                     entries at a time and doubles the page while it is answered. A page
+                                                     that is not answered is asked for once, with a short timeout, and the
+                                                     type of device then stays with the largest page it answered. 0 always
+                                                     requests 4 entries at a time, as earlier versions did. The default
+                                                     is \ref JIP_QUERY_PAGE_SIZE. */
+    int                     iTableRereadInterval;/**< A table variable is only read in full when the version in the node's
+                                                     first response differs from when it was last read. Nodes served by
+                                                     libJIP send only the rows that have changed since the table was last
+                                                     read. As the version is a hash, the table is read in full anyway
+                                                     after it has been read this many times without being read in full.
+                                                     0 reads tables in full every time, as earlier versions did. The
+                                                     default is \ref JIP_TABLE_REREAD_INTERVAL. */
     
     
 } tsJIP_Context;
@@ -719,6 +781,31 @@ teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint32_t u3
 teJIP_Status eJIP_SetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvNewData, uint32_t u32Size, uint32_t u32Flags);
 
 
+/** One variable to set with \ref eJIP_SetVars */
+typedef struct
+{
+    tsVar*                  psVar;              /**< Pointer to the variable to set */
+    void*                   pvData;             /**< Pointer to the data to set the variable with */
+    uint32_t                u32Size;            /**< Size of the data, as for \ref eJIP_SetVar */
+} tsJIP_SetVarsEntry;
+
+
+/** Sets several variables of one node together, in a single request. The node sets every variable 
+ *  before acting on any of them, so that it can make the change in one step, e.g. a lamp going to a
+ *  new level and colour without passing through the old colour at the new level.
+ *  If any variable can not be set (wrong type, read only, disabled...), none are.
+ *  If the request succeeds, the pvData member of each variable is updated as by \ref eJIP_SetVar.
+ *  This is only supported in CLIENT mode.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param asVars               Array of variables to set, all of the same node, and their data
+ *  \param u32NumVars           Number of variables in asVars, up to \ref JIP_SET_VARS_MAX
+ *  \param u32Flags             Logical OR of flags to be used. See \ref E_JIP_FLAG_NONE etc.
+ *  \param pu32FailedVar        If not NULL, on failure of a variable this is set to its index in asVars
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_SetVars(tsJIP_Context *psJIP_Context, tsJIP_SetVarsEntry *asVars, uint32_t u32NumVars, uint32_t u32Flags, uint32_t *pu32FailedVar);
+
+
 /** Sets a variable using a IPv6 multicast. A request is made to the IPv6 multicast address to update the data content of this variable.
  *  The psVar parameter can be the relevant variable on any node in, or out of, the multicast group. It is used for
  *  all information except the destination IPv6 address, which is contained in psAddress.
@@ -977,6 +1064,115 @@ teJIP_Status eJIP_PrintNetworkContent(tsJIP_Context *psJIP_Context);
 /** @} */
 
 
+/** \defgroup Snapshot Network snapshots
+ *  \ref eJIP_GetNetworkSnapshot copies the nodes, MiBs and variables of the network, or a subset of them,
+ *  into one buffer, so that a front end may read the whole network with one call and no locking, rather than
+ *  looking up and locking every node in turn.
+ *
+ *  Every change to the data of a variable takes a new generation number, from a counter shared by all
+ *  contexts. A snapshot states the generation it was taken at, and may be limited to the variables that have
+ *  changed since the generation of an earlier snapshot. Nodes that leave the network do not appear in such
+ *  a snapshot - they are found from a full snapshot, or with \ref eJIPService_MonitorNetwork.
+ *
+ *  The buffer is made up of records that follow each other without padding. Multi byte fields are in
+ *  host byte order, apart from the port of a node, which is in network byte order as in \ref tsJIPAddress.
+ *  Names are not NULL terminated.
+ *  \code
+    tsJIP_SnapshotHeader
+    tsJIP_SnapshotNode                                      u16NumMibs of:
+        tsJIP_SnapshotMib, acName[u8NameLength]             u16NumVars of:
+            tsJIP_SnapshotVar, acName[u8NameLength]
+            if u8Flags has JIP_SNAPSHOT_VAR_VALUE:
+                table variables:    uint16_t u16NumRows     the rows that are not empty, each:
+                                    tsJIP_SnapshotRow, data[u16Length]
+                other variables:    uint8_t u8Length, data[u8Length]
+                                    Strings are not NULL terminated
+    tsJIP_SnapshotNode
+        ...
+    \endcode
+ * @{ */
+
+
+/** Flags of a variable in a snapshot */
+#define JIP_SNAPSHOT_VAR_ENABLED    0x01        /**< The variable is enabled */
+#define JIP_SNAPSHOT_VAR_VALUE      0x02        /**< The data of the variable is known, and follows the name */
+
+
+/** Start of a network snapshot */
+typedef struct
+{
+    uint32_t    u32Length;                      /**< Length of the snapshot in bytes, including this header */
+    uint32_t    u32Generation;                  /**< Generation the snapshot was taken at. Changes after this
+                                                     appear in a snapshot of changes since this generation */
+    uint32_t    u32NumNodes;                    /**< Number of node records that follow */
+} PACK tsJIP_SnapshotHeader;
+
+
+/** A node in a network snapshot */
+typedef struct
+{
+    uint8_t     au8Address[16];                 /**< IPv6 address of the node */
+    uint16_t    u16Port;                        /**< Port of the JIP service on the node, in network byte order */
+    uint32_t    u32DeviceId;                    /**< Device ID of the node */
+    uint16_t    u16NumMibs;                     /**< Number of MiB records that follow */
+} PACK tsJIP_SnapshotNode;
+
+
+/** A MiB in a network snapshot */
+typedef struct
+{
+    uint32_t    u32MibId;                       /**< ID of the MiB */
+    uint8_t     u8Index;                        /**< Index of the MiB within the node */
+    uint16_t    u16NumVars;                     /**< Number of variable records that follow the name */
+    uint8_t     u8NameLength;                   /**< Length of the name that follows */
+    char        acName[];
+} PACK tsJIP_SnapshotMib;
+
+
+/** A variable in a network snapshot */
+typedef struct
+{
+    uint8_t     u8Index;                        /**< Index of the variable within the MiB */
+    uint8_t     u8VarType;                      /**< \ref teJIP_VarType of the variable */
+    uint8_t     u8AccessType;                   /**< \ref teJIP_AccessType of the variable */
+    uint8_t     u8Security;                     /**< \ref teJIP_Security of the variable */
+    uint8_t     u8Flags;                        /**< JIP_SNAPSHOT_VAR_ flags */
+    uint8_t     u8NameLength;                   /**< Length of the name that follows */
+    char        acName[];
+} PACK tsJIP_SnapshotVar;
+
+
+/** A row of a table variable in a network snapshot */
+typedef struct
+{
+    uint16_t    u16Index;                       /**< Index of the row in the table */
+    uint16_t    u16Length;                      /**< Length of the row data that follows */
+} PACK tsJIP_SnapshotRow;
+
+
+/** Take a snapshot of the network.
+ *  The nodes are filtered by u32DeviceIdFilter, as in \ref eJIP_GetNodeAddressList, and their MiBs by
+ *  u32MibIdFilter, which may be \ref E_JIP_MIBID_ALL.
+ *  If u32SinceGeneration is 0, every variable of the matching MiBs is included. Otherwise only the variables
+ *  added or changed after that generation are, along with the MiBs and nodes they belong to. Pass the
+ *  u32Generation of the previous snapshot to get the changes since it was taken.
+ *  Each node is locked while it is copied, so the snapshot of a node is consistent.
+ *  *ppu8Buffer is malloc'd by libJIP, and should be free'd when the application is done with it.
+ *  \param psJIP_Context        Pointer to JIP Context
+ *  \param u32DeviceIdFilter    Device ID to filter the nodes with
+ *  \param u32MibIdFilter       MiB ID to filter the MiBs with
+ *  \param u32SinceGeneration   Generation to include changes after, or 0 for all variables
+ *  \param ppu8Buffer[out]      Pointer to a location in which to store the snapshot
+ *  \param pu32Length[out]      Pointer to a location in which to store the length of the snapshot
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_GetNetworkSnapshot(tsJIP_Context *psJIP_Context, const uint32_t u32DeviceIdFilter, const uint32_t u32MibIdFilter,
+                                     const uint32_t u32SinceGeneration, uint8_t **ppu8Buffer, uint32_t *pu32Length);
+
+
+/** @} */
+
+
 /** \defgroup server Server Context functions
  *  These are functions for operating the library in server mode.
  *  The library should first be initialised using \ref eJIP_Init and \ref E_JIP_CONTEXT_SERVER.
@@ -1039,6 +1235,58 @@ teJIP_Status eJIPserver_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode)
 teJIP_Status eJIPserver_Listen(tsJIP_Context *psJIP_Context, const int iPort);
 
 
+/** Set the minimum time between trap notifications sent to each subscriber.
+ *  Clients trap variables using \ref eJIP_TrapVar. Whenever the server application changes the value
+ *  of a trapped variable with \ref eJIP_SetVar or \ref eJIP_SetVarValue, a notification of the new value is
+ *  sent to each subscriber. Setting a variable to the value it already has does not send a notification.
+ *  No subscriber is sent notifications more often than this interval. Changes made in the meantime are 
+ *  coalesced, so that the subscriber is sent only the latest value when the interval expires.
+ *  The default is 100ms. An interval of 0 sends every change immediately.
+ *  \param psJIP_Context        Pointer to JIP Context (Must be an E_JIP_CONTEXT_SERVER context)
+ *  \param u32MinIntervalMs     Minimum time between notifications to a subscriber, in milliseconds
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIPserver_TrapMinInterval(tsJIP_Context *psJIP_Context, uint32_t u32MinIntervalMs);
+
+
+/** Get a summary of the latencies of requests handled by the server, by command.
+ *  Requests are timed from when they arrive until the response is sent. The time is split into
+ *  the stages of \ref teUtilsLatencyStage. Stages are recorded by any code that runs on the
+ *  thread handling the request, so time spent by a node's callbacks waiting for a lock or for
+ *  another device is included. Tracing can be turned off with \ref vUtils_LatencyEnable.
+ *  \param psJIP_Context        Pointer to JIP Context (Must be an E_JIP_CONTEXT_SERVER context)
+ *  \param u8Command            Command of the requests, as sent in the JIP header (0x10 for get requests)
+ *  \param eStage               Stage of the requests to summarise
+ *  \param psSummary[out]       Pointer to location to store the summary
+ *  \return E_JIP_OK on success, E_JIP_ERROR_BAD_VALUE if the command or stage is not known.
+ */
+teJIP_Status eJIPserver_LatencyCommand(tsJIP_Context *psJIP_Context, uint8_t u8Command,
+                                       teUtilsLatencyStage eStage, tsUtilsHistogramSummary *psSummary);
+
+
+/** Get a summary of the latencies of unicast requests handled by the server, by node.
+ *  Nodes are numbered from 0 in the order in which they were first sent a request. Numbers
+ *  stay the same while the context exists, even if the node is removed.
+ *  \param psJIP_Context        Pointer to JIP Context (Must be an E_JIP_CONTEXT_SERVER context)
+ *  \param u32Index             Number of the node
+ *  \param psAddress[out]       Pointer to location to store the address of the node
+ *  \param eStage               Stage of the requests to summarise
+ *  \param psSummary[out]       Pointer to location to store the summary
+ *  \return E_JIP_OK on success, E_JIP_ERROR_BAD_VALUE if there is no node with that number
+ *          or the stage is not known.
+ */
+teJIP_Status eJIPserver_LatencyNode(tsJIP_Context *psJIP_Context, uint32_t u32Index, struct in6_addr *psAddress,
+                                    teUtilsLatencyStage eStage, tsUtilsHistogramSummary *psSummary);
+
+
+/** Write a table of the latencies of requests handled by the server, by command and by node.
+ *  \param psJIP_Context        Pointer to JIP Context (Must be an E_JIP_CONTEXT_SERVER context)
+ *  \param psStream             Stream to write the table to
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIPserver_LatencyDump(tsJIP_Context *psJIP_Context, FILE *psStream);
+
+
 /** Join a node to a multicast group.
  *  This function causes the node psNode to join the IPv6 multicast address given 
  *  by pcMulticastAddress. The node should be locked via \ref eJIP_LockNode.
@@ -1087,6 +1335,8 @@ void vJIPserver_GroupMibCompressedAddressToIn6(struct in6_addr *psAddress, uint8
  *  This function free's any allocated storage for the variable, then
  *  mallocs u32Size new bytes and copies the passed data into it.
  *  The psVar must belong to a \ref tsNode than has been locked using \ref eJIP_LockNode.
+ *  If the variable already holds the passed data it is left as it is. Otherwise, in a server context,
+ *  clients that have trapped the variable are notified of the new value.
  *  \param psVar            Pointer to variable to update
  *  \param pvData           Pointer to location containing new data. This will be copied into the variable
  *  \param u32Size          Size (in bytes) of new data
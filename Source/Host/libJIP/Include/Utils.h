@@ -52,21 +52,14 @@
 #endif /* DBG_LOCKS */
 
 
-#if DBG_LOCKS
-
 #define UTILS_STRINGIZE(x) UTILS_STRINGIZE2(x)
 #define UTILS_STRINGIZE2(x) #x
 #define UTILS_LINE_STRING UTILS_STRINGIZE(__LINE__)
 
+/* Locks are passed the source line creating or acquiring them, for debugging and for the lock profile */
+#define eUtils_LockCreateHere(psLock)                   eUtils_LockCreateImpl(psLock, __FILE__ ":" UTILS_LINE_STRING)
 #define eUtils_LockLock(psLock)                         eUtils_LockLockImpl(psLock, __FILE__ ":" UTILS_LINE_STRING)
-#define eUtils_LockLockTimed(psLock, u32WaitTimeout)    eUtils_LockLockImpl(psLock, u32WaitTimeout, __FILE__ ":" UTILS_LINE_STRING)
-
-#else
-
-#define eUtils_LockLock(psLock)                         eUtils_LockLockImpl(psLock, NULL)
-#define eUtils_LockLockTimed(psLock, u32WaitTimeout)    eUtils_LockLockImpl(psLock, u32WaitTimeout, NULL)
-
-#endif /* DBG_LOCKS */
+#define eUtils_LockLockTimed(psLock, u32WaitTimeout)    eUtils_LockLockTimedImpl(psLock, u32WaitTimeout, __FILE__ ":" UTILS_LINE_STRING)
 
 
 
@@ -155,10 +148,21 @@ teUtilsStatus eUtils_ThreadWait(tsUtilsThread *psThreadInfo);
 teUtilsStatus eUtils_ThreadYield(void);
 
 
-/** Enumerated type of thread status's */
-
+/** Create a lock.
+ *  Locks created this way are profiled together. \ref eUtils_LockCreateHere profiles them by the line creating them.
+ *  \param  psLock  Pointer to lock structure
+ *  \return E_UTILS_OK if created
+ */
 teUtilsStatus eUtils_LockCreate(tsUtilsLock *psLock);
 
+/** Create a lock
+ *  \param  psLock  Pointer to lock structure
+ *  \param  pcLocation String describing source line that is creating the lock, or NULL.
+ *                     Locks created by the same line are profiled together.
+ *  \return E_UTILS_OK if created
+ */
+teUtilsStatus eUtils_LockCreateImpl(tsUtilsLock *psLock, const char *pcLocation);
+
 teUtilsStatus eUtils_LockDestroy(tsUtilsLock *psLock);
 
 /** Lock the data structure associated with this lock
@@ -193,9 +197,32 @@ teUtilsStatus eUtils_LockTryLock(tsUtilsLock *psLock);
 teUtilsStatus eUtils_LockUnlock(tsUtilsLock *psLock);
 
 
+/** Start profiling lock contention. Each lock, and each source line that acquires it,
+ *  then has its acquisitions, contended acquisitions, and wait and hold times recorded,
+ *  as does the order in which locks are taken. Locks are grouped by the line that
+ *  created them, so, for example, the locks of all nodes are profiled together.
+ *  \param  pcReportFile    File to write the report to each time the process is sent SIGUSR1, or NULL for none
+ *  \return E_UTILS_OK if started
+ */
+teUtilsStatus eUtils_LockProfileStart(const char *pcReportFile);
+
+
+/** Stop profiling lock contention. What has been recorded is kept for \ref vUtils_LockProfileDump */
+void vUtils_LockProfileStop(void);
+
+
+/** Write the lock profile: the acquiring lines ranked by time spent waiting,
+ *  the order in which locks have been taken, and any inversions of that order.
+ *  \param  psStream    Stream to write to
+ */
+void vUtils_LockProfileDump(FILE *psStream);
+
+
 /** @{ Queue flags */
 #define UTILS_QUEUE_NONBLOCK_INPUT      (UTILS_FLAG(0))     /**< Attempts to add items to the queue will not block if the queue is full */
 #define UTILS_QUEUE_NONBLOCK_OUTPUT     (UTILS_FLAG(1))     /**< Attempts to remove items from the queue will not block if the queue is empty */
+#define UTILS_QUEUE_SINGLE_CONSUMER     (UTILS_FLAG(2))     /**< Only one thread removes items from the queue, so on Linux it may be lock free.
+                                                                 The capacity is then rounded up to a power of 2 */
 /** @} */
     
     
@@ -214,6 +241,16 @@ teUtilsStatus eUtils_QueueDequeue(tsUtilsQueue *psQueue, void **ppvData);
 
 teUtilsStatus eUtils_QueueDequeueTimed(tsUtilsQueue *psQueue, uint32_t u32WaitMs, void **ppvData);
 
+/** Remove as many items as are queued, up to a maximum, waiting for the first.
+ *  \param psQueue          Queue to remove items from
+ *  \param u32WaitMs        Time to wait for the first item, 0 not to wait
+ *  \param apvData          Array to store the items in
+ *  \param u32MaxItems      Size of the array
+ *  \param pu32NumItems     Pointer to location to store the number of items removed
+ *  \return E_UTILS_OK if at least one item was removed, E_UTILS_ERROR_TIMEOUT if none were
+ */
+teUtilsStatus eUtils_QueueDequeueBatch(tsUtilsQueue *psQueue, uint32_t u32WaitMs, void **apvData, uint32_t u32MaxItems, uint32_t *pu32NumItems);
+
 
 /** Atomically add a 32 bit value to another.
  *  \param pu32Value        Pointer to value to update
@@ -226,4 +263,116 @@ uint32_t u32AtomicAdd(volatile uint32_t *pu32Value, uint32_t u32Operand);
 /** Atomically get the value of a 32 bit value */
 #define u32AtomicGet(pu32Value) u32AtomicAdd(pu32Value, 0)
 
+
+/** Stages of a request that latency is recorded for.
+ *  Stages are recorded against the calling thread while a trace is active,
+ *  so a request must be handled on one thread from begin to end.
+ */
+typedef enum
+{
+    E_UTILS_LATENCY_TOTAL,          /**< Whole request, from arrival to response */
+    E_UTILS_LATENCY_LOCK,           /**< Waiting for locks that were held by another thread */
+    E_UTILS_LATENCY_TX,             /**< Writing messages to the serial link */
+    E_UTILS_LATENCY_TX_STATUS,      /**< Waiting for the status of serial link commands */
+    E_UTILS_LATENCY_RESPONSE,       /**< Waiting for responses from the network */
+    E_UTILS_LATENCY_OTHER,          /**< Time not accounted for by the other stages */
+    E_UTILS_LATENCY_NUM_STAGES,
+} teUtilsLatencyStage;
+
+
+/** Number of histogram buckets in each power of 2 */
+#define UTILS_HISTOGRAM_SUB_BUCKETS     8
+
+/** Number of histogram buckets. Values up to 2^24us (about 16s) are recorded
+ *  with a precision of 1/8th, larger values are recorded in the last bucket. */
+#define UTILS_HISTOGRAM_BUCKETS         (UTILS_HISTOGRAM_SUB_BUCKETS * 22)
+
+
+/** Histogram of latencies in microseconds.
+ *  Buckets are log-linear, so the relative precision is the same for all values.
+ *  Recording is lock free, so a histogram may be shared between threads.
+ */
+typedef struct
+{
+    volatile uint32_t   au32Buckets[UTILS_HISTOGRAM_BUCKETS];   /**< Number of values in each bucket */
+    volatile uint32_t   u32Count;                               /**< Number of values recorded */
+    volatile uint32_t   u32Max;                                 /**< Largest value recorded */
+    volatile uint64_t   u64Total;                               /**< Sum of the values recorded */
+} tsUtilsHistogram;
+
+
+/** Summary of a histogram. Percentiles are the upper bounds of the buckets they fall in. */
+typedef struct
+{
+    uint32_t            u32Count;                               /**< Number of values recorded */
+    uint32_t            u32Mean;                                /**< Mean value */
+    uint32_t            u32P50;                                 /**< 50th percentile */
+    uint32_t            u32P90;                                 /**< 90th percentile */
+    uint32_t            u32P95;                                 /**< 95th percentile */
+    uint32_t            u32P99;                                 /**< 99th percentile */
+    uint32_t            u32Max;                                 /**< Largest value */
+} tsUtilsHistogramSummary;
+
+
+/** Latencies of the stages of one request */
+typedef struct
+{
+    int                 iActive;                                /**< True while the request is being traced */
+    uint64_t            u64Start;                               /**< Time that the request began */
+    uint32_t            au32Stages[E_UTILS_LATENCY_NUM_STAGES]; /**< Time spent in each stage (us) */
+} tsUtilsLatencyTrace;
+
+
+/** Record a value in a histogram
+ *  \param psHistogram      Histogram to update
+ *  \param u32Value         Value to record (us)
+ */
+void vUtils_HistogramRecord(tsUtilsHistogram *psHistogram, uint32_t u32Value);
+
+
+/** Summarise the values recorded in a histogram.
+ *  The histogram may be recorded into at the same time, in which case the
+ *  summary may be very slightly inconsistent.
+ *  \param psHistogram      Histogram to summarise
+ *  \param psSummary        Pointer to location to store the summary
+ */
+void vUtils_HistogramSummarise(tsUtilsHistogram *psHistogram, tsUtilsHistogramSummary *psSummary);
+
+
+/** Enable or disable latency tracing. Tracing is enabled by default.
+ *  \param bEnable          True to trace requests that begin after this call.
+ */
+void vUtils_LatencyEnable(int bEnable);
+
+
+/** Get a monotonic time stamp
+ *  \return Time in microseconds
+ */
+uint64_t u64Utils_LatencyNow(void);
+
+
+/** Begin tracing a request handled by the calling thread */
+void vUtils_LatencyBegin(void);
+
+
+/** Get the start time of a stage of the request being traced
+ *  \return Time stamp to pass to \ref vUtils_LatencyStage, or 0 if no request is being traced.
+ */
+uint64_t u64Utils_LatencyStart(void);
+
+
+/** Add the time since a stage started to the request being traced.
+ *  Does nothing if no request is being traced.
+ *  \param eStage           Stage to add the time to
+ *  \param u64Start         Value returned by \ref u64Utils_LatencyStart when the stage started
+ */
+void vUtils_LatencyStage(teUtilsLatencyStage eStage, uint64_t u64Start);
+
+
+/** Finish tracing the request handled by the calling thread.
+ *  \return Pointer to the latencies of the request, valid until the calling thread
+ *          begins another trace, or NULL if no request was being traced.
+ */
+tsUtilsLatencyTrace *psUtils_LatencyEnd(void);
+
 #endif /* __UTILS_H__ */
@@ -29,10 +29,11 @@ import sys
 import atexit
 import random
 import copy
+import struct
 from ctypes import *
 from socket import AF_INET, AF_INET6, AF_PACKET, inet_ntop, inet_pton, ntohs, htons
 
-libJIP_Name = "libJIP.so.2"
+libJIP_Name = "libJIP.so.4"
 cdll.LoadLibrary(libJIP_Name)
 libJIP = CDLL(libJIP_Name)
 
@@ -61,6 +62,9 @@ JIP_DEFAULT_PORT = 1873
 ## Device ID to retrieve all devices
 JIP_DEVICEID_ALL = 0xFFFFFFFF
 
+## MiB ID to retrieve all MiBs in a snapshot
+JIP_MIBID_ALL = 0xFFFFFFFF
+
 
 ## Flags for \ref eJIP_GetVar
 JIP_FLAG_NONE                       = 0
@@ -424,6 +428,9 @@ JIP_Var._fields_ = [
                 ("Index",           c_uint8),
                 ("Size",            c_uint8),
                 ("TrapHandle",      c_uint8),
+                ("GroupSetCb",      c_void_p),
+                ("_TablePriv",      c_void_p),
+                ("Generation",      c_uint32),
         ]
     
 class JIP_Var_iterator:
@@ -574,6 +581,8 @@ class JIP_Context(Structure):
         ("Network", JIP_Network), 
         ("MulticastInterface", c_int),
         ("MulticastSendCount", c_int),
+        ("QueryPageSize", c_int),
+        ("TableRereadInterval", c_int),
     ]
     
     def __init__(self, ctx_type=E_JIP_CONTEXT_CLIENT):
@@ -627,6 +636,10 @@ class JIP_Context(Structure):
 
     def eSetVar(self, var, value):
         return eJIP_SetVar(self, var, value)
+
+    def Snapshot(self, DeviceIdFilter=JIP_DEVICEID_ALL, MibIdFilter=JIP_MIBID_ALL, SinceGeneration=0):
+        """ Copy of the network contents, or of the changes since an earlier snapshot """
+        return eJIP_GetNetworkSnapshot(self, DeviceIdFilter, MibIdFilter, SinceGeneration)
     
     
 
@@ -851,6 +864,145 @@ def eJIP_GetNodeAddressList(context, DeviceIdFilter = JIP_DEVICEID_ALL):
         return ([], 0)
             
     
+## Flags of a variable in a snapshot
+JIP_SNAPSHOT_VAR_ENABLED            = 0x01
+JIP_SNAPSHOT_VAR_VALUE              = 0x02
+
+## struct formats of the scalar variable types in a snapshot
+JIP_Snapshot_Formats = {
+    E_JIP_VAR_TYPE_INT8:           '=b',
+    E_JIP_VAR_TYPE_INT16:          '=h',
+    E_JIP_VAR_TYPE_INT32:          '=i',
+    E_JIP_VAR_TYPE_INT64:          '=q',
+    E_JIP_VAR_TYPE_UINT8:          '=B',
+    E_JIP_VAR_TYPE_UINT16:         '=H',
+    E_JIP_VAR_TYPE_UINT32:         '=I',
+    E_JIP_VAR_TYPE_UINT64:         '=Q',
+    E_JIP_VAR_TYPE_FLT:            '=f',
+    E_JIP_VAR_TYPE_DBL:            '=d',
+}
+
+class JIP_SnapshotVar:
+    """A variable decoded from a network snapshot"""
+    def __init__(self, Index, Name, Type, AccessType, Security, Enable, Data):
+        self.Index = Index
+        self.Name = Name
+        self.Type = Type
+        self.AccessType = AccessType
+        self.Security = Security
+        self.Enable = Enable
+        ## Python representation of the value, as JIP_Var.Data, or None if it is not known
+        self.Data = Data
+
+    def __repr__(self):
+        string = "Var " + str(self.Index) + " - '" + self.Name + "'"
+        string = string + (" (disabled)" if self.Enable == E_JIP_VAR_DISABLED else "")
+        string = string + "\n"
+        string = string + "  Type: " + JIP_Var_Type_Strings.get(self.Type, "Unknown Variable type") + "\n"
+        string = string + "  Security: " + JIP_Var_Security_Type_Strings.get(self.Security, "Unknown Security Type") + "\n"
+        string = string + "  AccessType: " + JIP_Var_Access_Type_Strings.get(self.AccessType, "Unknown Access type") + "\n"
+        string = string + "  Data: " + str(self.Data) + "\n"
+        return string
+
+class JIP_SnapshotMib:
+    """A MiB decoded from a network snapshot"""
+    def __init__(self, MibId, Index, Name):
+        self.MibId = MibId
+        self.Index = Index
+        self.Name = Name
+        self.Vars = []
+
+    def __iter__(self):
+        return iter(self.Vars)
+
+    def __repr__(self):
+        return "Mib, ID:" + hex(self.MibId) + " - '" + self.Name + "'"
+
+class JIP_SnapshotNode:
+    """A node decoded from a network snapshot"""
+    def __init__(self, Address, DeviceId):
+        ## The Node's IPv6 Address and port
+        self.Address = Address
+        self.DeviceId = DeviceId
+        self.Mibs = []
+
+    def __iter__(self):
+        return iter(self.Mibs)
+
+    def __repr__(self):
+        return "Node: " + self.Address + " ID: 0x%08x" % (self.DeviceId)
+
+class JIP_Snapshot:
+    """Network contents decoded from the buffer of eJIP_GetNetworkSnapshot.
+       Generation may be passed to a later snapshot to get the changes since this one."""
+    def __init__(self, buf):
+        (self.Length, self.Generation, NumNodes) = struct.unpack_from('=III', buf, 0)
+        self.Nodes = []
+        offset = 12
+        for n in range(NumNodes):
+            (address, port, DeviceId, NumMibs) = struct.unpack_from('=16sHIH', buf, offset)
+            offset += 24
+            node = JIP_SnapshotNode("[" + inet_ntop(AF_INET6, address) + "]:%d" % (ntohs(port)), DeviceId)
+            for m in range(NumMibs):
+                (MibId, Index, NumVars, NameLength) = struct.unpack_from('=IBHB', buf, offset)
+                offset += 8
+                mib = JIP_SnapshotMib(MibId, Index, buf[offset:offset + NameLength])
+                offset += NameLength
+                for v in range(NumVars):
+                    (Index, Type, AccessType, Security, Flags, NameLength) = struct.unpack_from('=6B', buf, offset)
+                    offset += 6
+                    Name = buf[offset:offset + NameLength]
+                    offset += NameLength
+                    Data = None
+                    if Flags & JIP_SNAPSHOT_VAR_VALUE:
+                        (Data, offset) = self._decode_value(buf, offset, Type)
+                    mib.Vars.append(JIP_SnapshotVar(Index, Name, Type, AccessType, Security,
+                                    E_JIP_VAR_ENABLED if Flags & JIP_SNAPSHOT_VAR_ENABLED else E_JIP_VAR_DISABLED, Data))
+                node.Mibs.append(mib)
+            self.Nodes.append(node)
+
+    def _decode_value(self, buf, offset, Type):
+        """Return the python representation of a value in the snapshot, and the offset following it"""
+        if Type == E_JIP_VAR_TYPE_TABLE_BLOB:
+            rows = {}
+            (NumRows,) = struct.unpack_from('=H', buf, offset)
+            offset += 2
+            for r in range(NumRows):
+                (RowIndex, RowLength) = struct.unpack_from('=HH', buf, offset)
+                offset += 4
+                rows[RowIndex] = [ord(byte) for byte in buf[offset:offset + RowLength]]
+                offset += RowLength
+            return (rows, offset)
+
+        Length = ord(buf[offset])
+        offset += 1
+        data = buf[offset:offset + Length]
+        if Type in JIP_Snapshot_Formats:
+            value = struct.unpack_from(JIP_Snapshot_Formats[Type], data)[0]
+        elif Type == E_JIP_VAR_TYPE_STR:
+            value = data
+        else:
+            value = [ord(byte) for byte in data]
+        return (value, offset + Length)
+
+    def __iter__(self):
+        return iter(self.Nodes)
+
+def eJIP_GetNetworkSnapshot(context, DeviceIdFilter=JIP_DEVICEID_ALL, MibIdFilter=JIP_MIBID_ALL, SinceGeneration=0):
+    """ Copy the network contents in one call, returning a JIP_Snapshot or None """
+    Buffer = POINTER(c_uint8)()
+    Length = c_uint32(0)
+
+    result = JIP_Result(libJIP.eJIP_GetNetworkSnapshot(byref(context), c_uint32(DeviceIdFilter), c_uint32(MibIdFilter),
+                         c_uint32(SinceGeneration), byref(Buffer), byref(Length)))
+    if result == E_JIP_OK:
+        buf = string_at(Buffer, Length.value)
+        libc.free(Buffer)
+        return JIP_Snapshot(buf)
+    else:
+        return None
+
+
 def psJIP_LookupNode(context, Address):
     _psJIP_LookupNode = libJIP.psJIP_LookupNode
     _psJIP_LookupNode.restype = POINTER(JIP_Node)
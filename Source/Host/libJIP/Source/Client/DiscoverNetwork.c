@@ -54,36 +54,239 @@
 
 #define QUERY_MAX_ATTEMPTS 5
 
+/** Number of entries asked for in each query when \ref iQueryPageSize is 0, which every node answers */
+#define QUERY_FIXED_PAGE_ENTRIES 4
+
+/** Size of a MiB or variable query entry assumed until a node has returned some */
+#define QUERY_ENTRY_SIZE_ESTIMATE 16
+
+/** Attempts at an exchange with a page that is known to be answered, and with one that is not */
+#define QUERY_ATTEMPTS_ANSWERED 3
+#define QUERY_ATTEMPTS_PROBE    1
+
+/** A page that has not been answered yet is given this many of the longest round trips seen to arrive */
+#define QUERY_PROBE_TIMEOUT_RTTS    2
+
+/** Shortest time in ms that a page that has not been answered yet is given to arrive */
+#define QUERY_PROBE_TIMEOUT_MIN     20
+
+
+/** State of the paging of one MiB or variable query */
+typedef struct
+{
+    tsQueryPageCacheEntry   *psPage;        /**< Page size learned for the device ID, or NULL for fixed pages */
+    uint16_t                u16MaxPageSize; /**< Largest page to ask for */
+    uint32_t                u32HeaderSize;  /**< Size of the response header */
+    uint32_t                u32EntryBytes;  /**< Bytes of entries returned so far */
+    uint32_t                u32Entries;     /**< Number of entries returned so far */
+    uint32_t                u32RoundTrip;   /**< Longest time in ms that an exchange took to be answered */
+    uint64_t                u64SendTime;    /**< Time in us that the current exchange was started */
+    uint8_t                 u8Requested;    /**< Number of entries asked for in the current exchange */
+} tsQueryPager;
+
+
+static void vQueryPagerInit(tsJIP_Private *psJIP_Private, tsNode *psNode, tsQueryPager *psPager, uint32_t u32HeaderSize)
+{
+    tsJIP_Context *psJIP_Context = psJIP_Private->sCache.psParent_JIP_Context;
+    int iPageSize = psJIP_Context->iQueryPageSize;
+    
+    memset(psPager, 0, sizeof(tsQueryPager));
+    psPager->u32HeaderSize = u32HeaderSize;
+    
+    if (iPageSize > 0)
+    {
+        if (iPageSize > JIP_PACKET_MAX_SIZE)
+        {
+            iPageSize = JIP_PACKET_MAX_SIZE;
+        }
+        psPager->u16MaxPageSize = iPageSize;
+        
+        /* Nodes of the same type answer the same page sizes. The first
+         * type of a node starts with the fixed page that every node answers */
+        psPager->psPage = Cache_Query_Page(&psJIP_Private->sCache, psNode->u32DeviceId, 0);
+    }
+}
+
+
+/* Average size of the entries returned so far */
+static uint32_t u32QueryPagerEntrySize(tsQueryPager *psPager)
+{
+    if (psPager->u32Entries)
+    {
+        return (psPager->u32EntryBytes + psPager->u32Entries - 1) / psPager->u32Entries;
+    }
+    return QUERY_ENTRY_SIZE_ESTIMATE;
+}
+
+
+/* Number of entries to ask for, so that the response is expected to fill the page.
+ * Called as each exchange starts */
+static uint8_t u8QueryPagerEntries(tsQueryPager *psPager)
+{
+    uint32_t u32EntrySize = u32QueryPagerEntrySize(psPager);
+    uint32_t u32Entries = 1;
+    
+    psPager->u64SendTime = u64Utils_LatencyNow();
+    
+    if (!psPager->psPage || (psPager->psPage->u16PageSize == 0))
+    {
+        psPager->u8Requested = QUERY_FIXED_PAGE_ENTRIES;
+        return psPager->u8Requested;
+    }
+    
+    if (psPager->psPage->u16PageSize > (psPager->u32HeaderSize + u32EntrySize))
+    {
+        u32Entries = (psPager->psPage->u16PageSize - psPager->u32HeaderSize) / u32EntrySize;
+    }
+    psPager->u8Requested = (u32Entries > 255) ? 255 : u32Entries;
+    return psPager->u8Requested;
+}
+
+
+/* True if the page about to be asked for has not been answered yet */
+static bool_t bQueryPagerProbing(tsQueryPager *psPager)
+{
+    return (psPager->psPage && (psPager->psPage->u16PageSize > psPager->psPage->u16Answered));
+}
+
+
+/* Number of attempts at the current exchange. A page that has not been answered
+ * yet is only tried once, as a node that can't send it will never answer */
+static uint32_t u32QueryPagerAttempts(tsQueryPager *psPager)
+{
+    return bQueryPagerProbing(psPager) ? QUERY_ATTEMPTS_PROBE : QUERY_ATTEMPTS_ANSWERED;
+}
+
+
+/* Time in ms to wait for the response to the current exchange, or 0 for the default.
+ * A page that has not been answered yet is given a few of the round trips seen so far,
+ * so that finding out a node can't send it costs little more than asking */
+static uint32_t u32QueryPagerTimeout(tsQueryPager *psPager)
+{
+    uint32_t u32Timeout;
+    
+    if (!bQueryPagerProbing(psPager) || (psPager->u32RoundTrip == 0))
+    {
+        return 0;
+    }
+    
+    u32Timeout = psPager->u32RoundTrip * QUERY_PROBE_TIMEOUT_RTTS;
+    return (u32Timeout < QUERY_PROBE_TIMEOUT_MIN) ? QUERY_PROBE_TIMEOUT_MIN : u32Timeout;
+}
+
+
+/* Record a response that was answered, and try a larger page next if this one was filled.
+ * Pages stop growing once one has not been answered */
+static void vQueryPagerAnswered(tsQueryPager *psPager, uint32_t u32ResponseLen, uint8_t u8NumReturned, uint8_t u8NumOutstanding)
+{
+    tsQueryPageCacheEntry *psPage = psPager->psPage;
+    uint32_t u32RoundTrip;
+    uint32_t u32PageSize;
+    
+    psPager->u32EntryBytes += u32ResponseLen - psPager->u32HeaderSize;
+    psPager->u32Entries += u8NumReturned;
+    
+    u32RoundTrip = (uint32_t)((u64Utils_LatencyNow() - psPager->u64SendTime + 999) / 1000);
+    if (u32RoundTrip > psPager->u32RoundTrip)
+    {
+        psPager->u32RoundTrip = u32RoundTrip;
+    }
+    
+    if (!psPage)
+    {
+        return;
+    }
+    
+    if (psPage->u16PageSize > psPage->u16Answered)
+    {
+        psPage->u16Answered = psPage->u16PageSize;
+    }
+    
+    if ((u8NumOutstanding > 0) && (psPage->u16Failed == 0) && (psPage->u16PageSize < psPager->u16MaxPageSize))
+    {
+        /* Double the page, starting from the size of the fixed page's response */
+        u32PageSize = (psPage->u16PageSize ? psPage->u16PageSize : u32ResponseLen) * 2;
+        if (u32PageSize > psPager->u16MaxPageSize)
+        {
+            u32PageSize = psPager->u16MaxPageSize;
+        }
+        DBG_vPrintf(DBG_DISCOVERY, "Device ID 0x%08x query page increased from %d to %d bytes\n", 
+                    psPage->u32DeviceId, psPage->u16PageSize, u32PageSize);
+        psPage->u16PageSize = u32PageSize;
+    }
+}
+
+
+/* Ask for a smaller page after an exchange failed. The device ID stays with the
+ * largest page answered, or with the fixed page if the failed page had been answered.
+ * \return False if a smaller page can not be asked for */
+static bool_t bQueryPagerShrink(tsQueryPager *psPager)
+{
+    tsQueryPageCacheEntry *psPage = psPager->psPage;
+    uint32_t u32PageSize = 0;
+    
+    if (!psPage || (psPage->u16PageSize == 0))
+    {
+        return False;
+    }
+    
+    if ((psPage->u16Failed == 0) || (psPage->u16PageSize < psPage->u16Failed))
+    {
+        psPage->u16Failed = psPage->u16PageSize;
+    }
+    
+    if (psPage->u16Answered < psPage->u16PageSize)
+    {
+        u32PageSize = psPage->u16Answered;
+    }
+    
+    DBG_vPrintf(DBG_DISCOVERY, "Device ID 0x%08x query page reduced from %d to %d bytes\n", 
+                psPage->u32DeviceId, psPage->u16PageSize, u32PageSize);
+    psPage->u16PageSize = u32PageSize;
+    psPage->u16Answered = u32PageSize;
+    return True;
+}
+
 
 static teJIP_Status eGet_Node_Mibs(tsJIP_Private *psJIP_Private, tsNode *psNode)
 {
     tsJIP_Msg_QueryMibResponseHeader *QueryMibResponseHeader;
     tsJIP_Msg_QueryMibResponseListEntryHeader *QueryMibResponseListEntryHeader;
+    tsQueryPager sPager;
     uint8_t u8StartMib = 0;
     uint8_t u8NumMibsOutstanding = 0;
-    const uint8_t u8NumMibs = 4;
     uint8_t u8Attempts = 0;
+    bool_t bComplete = False;
                         
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);  
+    
+    vQueryPagerInit(psJIP_Private, psNode, &sPager, sizeof(tsJIP_Msg_QueryMibResponseHeader));
 
-    do
+    /* Exchanges that are tried again continue the loop without completing it */
+    while (!bComplete)
     {
-        char buffer[255];
+        char buffer[JIP_PACKET_MAX_SIZE];
         tsJIP_Msg_QueryMibRequest *psJIP_Msg_QueryMibRequest = (tsJIP_Msg_QueryMibRequest *)buffer;
-        uint32_t u32ResponseLen = 255;
+        uint32_t u32ResponseLen = sizeof(buffer);
         
-        memset(buffer, 0, 255);
+        memset(buffer, 0, sizeof(tsJIP_Msg_QueryMibRequest));
         psJIP_Msg_QueryMibRequest->u8MibStartIndex  = u8StartMib;
-        psJIP_Msg_QueryMibRequest->u8NumMibs        = u8NumMibs;
+        psJIP_Msg_QueryMibRequest->u8NumMibs        = u8QueryPagerEntries(&sPager);
         
         
-        DBG_vPrintf(DBG_DISCOVERY, "%s: Requesting Mibs starting %d, max %d\n", __FUNCTION__, u8StartMib, u8NumMibs);
+        DBG_vPrintf(DBG_DISCOVERY, "%s: Requesting Mibs starting %d, max %d\n", __FUNCTION__, u8StartMib, sPager.u8Requested);
         
-        if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, E_JIP_FLAG_STAY_AWAKE,
+        if (Network_ExchangeJIPTimeout(&psJIP_Private->sNetworkContext, psNode, u32QueryPagerAttempts(&sPager), E_JIP_FLAG_STAY_AWAKE,
+                                       u32QueryPagerTimeout(&sPager),
                                 E_JIP_COMMAND_QUERY_MIB_REQUEST, buffer, sizeof(tsJIP_Msg_QueryMibRequest), 
                                 E_JIP_COMMAND_QUERY_MIB_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
         {
             DBG_vPrintf(DBG_DISCOVERY, "Error communicating with node\n");
+            if (bQueryPagerShrink(&sPager))
+            {
+                /* The node may not be able to send a page that large */
+                continue;
+            }
             return E_JIP_ERROR_FAILED;
         }
         
@@ -93,7 +296,8 @@ static teJIP_Status eGet_Node_Mibs(tsJIP_Private *psJIP_Private, tsNode *psNode)
         {
             if (++u8Attempts < QUERY_MAX_ATTEMPTS)
             {
-                /* Try again until we get a successful response */
+                /* Try again with a smaller page until we get a successful response */
+                (void)bQueryPagerShrink(&sPager);
                 continue;
             }
             // Or fail the discovery
@@ -102,14 +306,17 @@ static teJIP_Status eGet_Node_Mibs(tsJIP_Private *psJIP_Private, tsNode *psNode)
         u8Attempts = 0;
 
         {
-            uint8_t i, j;
+            uint32_t j;
+            uint8_t i;
             uint8_t u8NumMibsReturned = QueryMibResponseHeader->u8NumMibsReturned;
             
             u8NumMibsOutstanding = QueryMibResponseHeader->u8NumMibsOutstanding;
             u8StartMib += u8NumMibsReturned;
+            bComplete = (u8NumMibsOutstanding == 0);
+            vQueryPagerAnswered(&sPager, u32ResponseLen, u8NumMibsReturned, u8NumMibsOutstanding);
             
             DBG_vPrintf(DBG_DISCOVERY, "%s: %d Mibs returned, %d outstanding\n", __FUNCTION__, u8NumMibsReturned, u8NumMibsOutstanding);
-            j = 6;
+            j = sizeof(tsJIP_Msg_QueryMibResponseHeader);
             for (i = 0; i < u8NumMibsReturned; i++)
             {
                 QueryMibResponseListEntryHeader = (tsJIP_Msg_QueryMibResponseListEntryHeader *)&buffer[j];
@@ -129,7 +336,7 @@ static teJIP_Status eGet_Node_Mibs(tsJIP_Private *psJIP_Private, tsNode *psNode)
             }
             
         }
-    } while (u8NumMibsOutstanding > 0);
+    }
     return E_JIP_OK;
 }
 
@@ -138,28 +345,39 @@ static teJIP_Status eGet_Node_Mib_Variable_Descriptions(tsJIP_Private *psJIP_Pri
 {
     tsJIP_Msg_QueryVarResponseHeader *QueryVarResponseHeader;
     tsJIP_Msg_QueryVarResponseListEntryHeader *QueryVarResponseListEntryHeader;
+    tsQueryPager sPager;
     uint8_t u8StartVar = 0, u8NumVarsOutstanding = 0;
     uint8_t u8Attempts = 0;
+    bool_t bComplete = False;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);   
     
-    do
+    vQueryPagerInit(psJIP_Private, psNode, &sPager, sizeof(tsJIP_Msg_QueryVarResponseHeader));
+    
+    /* Exchanges that are tried again continue the loop without completing it */
+    while (!bComplete)
     {
-        char buffer[255];
+        char buffer[JIP_PACKET_MAX_SIZE];
         tsJIP_Msg_QueryVarRequest *psJIP_Msg_QueryVarRequest = (tsJIP_Msg_QueryVarRequest *)buffer;
-        uint32_t u32ResponseLen = 255;
+        uint32_t u32ResponseLen = sizeof(buffer);
         
         psJIP_Msg_QueryVarRequest->u8MibIndex       = psMib->u8Index;
         psJIP_Msg_QueryVarRequest->u8VarStartIndex  = u8StartVar;
-        psJIP_Msg_QueryVarRequest->u8NumVars        = 4;
+        psJIP_Msg_QueryVarRequest->u8NumVars        = u8QueryPagerEntries(&sPager);
 
-        DBG_vPrintf(DBG_DISCOVERY, "Get variables starting index %d\n", u8StartVar);
+        DBG_vPrintf(DBG_DISCOVERY, "Get variables starting index %d, max %d\n", u8StartVar, sPager.u8Requested);
                
-        if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, E_JIP_FLAG_STAY_AWAKE,
+        if (Network_ExchangeJIPTimeout(&psJIP_Private->sNetworkContext, psNode, u32QueryPagerAttempts(&sPager), E_JIP_FLAG_STAY_AWAKE,
+                                       u32QueryPagerTimeout(&sPager),
                                 E_JIP_COMMAND_QUERY_VAR_REQUEST, buffer, sizeof(tsJIP_Msg_QueryVarRequest), 
                                 E_JIP_COMMAND_QUERY_VAR_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
         {
             DBG_vPrintf(DBG_DISCOVERY, "Error\n");
+            if (bQueryPagerShrink(&sPager))
+            {
+                /* The node may not be able to send a page that large */
+                continue;
+            }
             return E_JIP_ERROR_FAILED;
         }
         
@@ -169,7 +387,8 @@ static teJIP_Status eGet_Node_Mib_Variable_Descriptions(tsJIP_Private *psJIP_Pri
         {
             if (++u8Attempts < QUERY_MAX_ATTEMPTS)
             {
-                /* Try again until we get a successful response */
+                /* Try again with a smaller page until we get a successful response */
+                (void)bQueryPagerShrink(&sPager);
                 continue;
             }
             // Or fail the discovery
@@ -180,13 +399,16 @@ static teJIP_Status eGet_Node_Mib_Variable_Descriptions(tsJIP_Private *psJIP_Pri
         {
             uint8_t u8MibIndex = QueryVarResponseHeader->u8MibIndex;
             uint8_t u8NumVarsReturned = QueryVarResponseHeader->u8NumVarsReturned;
-            uint8_t i, j;
+            uint32_t j;
+            uint8_t i;
             u8NumVarsOutstanding = QueryVarResponseHeader->u8NumVarsOutstanding;
             
             u8StartVar += u8NumVarsReturned;
+            bComplete = (u8NumVarsOutstanding == 0);
+            vQueryPagerAnswered(&sPager, u32ResponseLen, u8NumVarsReturned, u8NumVarsOutstanding);
             
             DBG_vPrintf(DBG_DISCOVERY, "%s: Mib %d: %d Vars returned, %d outstanding\n", __FUNCTION__, u8MibIndex, u8NumVarsReturned, u8NumVarsOutstanding);
-            j = 7;
+            j = sizeof(tsJIP_Msg_QueryVarResponseHeader);
             for (i = 0; i < u8NumVarsReturned; i++)
             {
                 QueryVarResponseListEntryHeader = (tsJIP_Msg_QueryVarResponseListEntryHeader *)&buffer[j];
@@ -214,7 +436,7 @@ static teJIP_Status eGet_Node_Mib_Variable_Descriptions(tsJIP_Private *psJIP_Pri
             }
             
         }
-    } while (u8NumVarsOutstanding > 0);
+    }
  
     return E_JIP_OK;
 }
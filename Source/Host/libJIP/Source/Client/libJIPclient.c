@@ -46,6 +46,12 @@ static void *pvNetworkChangeMonitorThread(tsUtilsThread *psThreadInfo);
 
 static teJIP_Status eJIP_SetVarFromPacket(tsVar *psVar, uint8_t *buffer);
 
+/** Append the data to set a variable with to a set request in buffer, of u32BufferSize bytes.
+ *  \param pu32Size         Size of the data. A string's is increased to include the NULL terminator of the local copy.
+ *  \param pu32CommandLen   Length of the request, updated to include the data
+ *  \return E_JIP_OK on success, E_JIP_ERROR_BAD_BUFFER_SIZE if the data does not fit */
+static teJIP_Status eJIP_PackSetData(tsVar *psVar, void *pvData, uint32_t *pu32Size, char *buffer, uint32_t *pu32CommandLen, uint32_t u32BufferSize);
+
 
 teJIP_Status eJIP_Connect(tsJIP_Context *psJIP_Context, const char *pcAddress, const int iPort)
 {
@@ -149,6 +155,7 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
     tsJIP_Msg_SetMibRequest *psSetRequest;
     tsNode *psNode;
     tsMib *psMib;
+    teJIP_Status eStatus;
      
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);   
     
@@ -163,8 +170,8 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
     eJIP_LockNode(psNode, True);
     
     {
-        char buffer[255];
-        uint32_t u32ResponseLen = 255, u32CommandLen;
+        char buffer[512];
+        uint32_t u32ResponseLen = sizeof(buffer), u32CommandLen;
         
         psSetRequest = (tsJIP_Msg_SetMibRequest *)buffer;
         
@@ -177,74 +184,11 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
         
         u32CommandLen = sizeof(tsJIP_Msg_SetMibRequest);
 
-        switch (psVar->eVarType)
+        eStatus = eJIP_PackSetData(psVar, pvData, &u32Size, buffer, &u32CommandLen, sizeof(buffer));
+        if (eStatus != E_JIP_OK)
         {
-            case (E_JIP_VAR_TYPE_INT8):
-            case (E_JIP_VAR_TYPE_UINT8):
-                u32Size = sizeof(uint8_t);
-                buffer[u32CommandLen] = *((uint8_t *)pvData);
-                u32CommandLen += sizeof(uint8_t);
-                break;
-
-            case (E_JIP_VAR_TYPE_INT16):
-            case (E_JIP_VAR_TYPE_UINT16):
-            {
-                uint16_t u16Var = htons(*((uint16_t *)pvData));
-                u32Size = sizeof(uint16_t);
-                memcpy(&buffer[u32CommandLen], &u16Var, sizeof(uint16_t));
-                u32CommandLen += sizeof(uint16_t);
-                break;
-            }
-                
-            case (E_JIP_VAR_TYPE_INT32):
-            case (E_JIP_VAR_TYPE_UINT32):
-            case (E_JIP_VAR_TYPE_FLT):
-            {
-                uint32_t u32Var = htonl(*((uint32_t *)pvData));
-                u32Size = sizeof(uint32_t);
-                memcpy(&buffer[u32CommandLen], &u32Var, sizeof(uint32_t));
-                u32CommandLen += sizeof(uint32_t);
-                break;
-            }
-            
-            case (E_JIP_VAR_TYPE_INT64):
-            case (E_JIP_VAR_TYPE_UINT64):
-            case (E_JIP_VAR_TYPE_DBL):
-            {
-                uint64_t u64Var = htobe64(*((uint64_t *)pvData));
-                u32Size = sizeof(uint64_t);
-                memcpy(&buffer[u32CommandLen], &u64Var, sizeof(uint64_t));
-                u32CommandLen += sizeof(uint64_t);
-                break;
-            }
-
-            case(E_JIP_VAR_TYPE_STR):
-            {
-                if (u32Size > 255)
-                {
-                    eJIP_Unlock(psJIP_Context);
-                    return E_JIP_ERROR_BAD_BUFFER_SIZE;
-                }
-                buffer[u32CommandLen++] = u32Size;
-                memcpy(&buffer[u32CommandLen], (uint8_t *)pvData, u32Size);
-                u32CommandLen += u32Size;
-                /* Increment size to include NULL terminator when local copy is updated */
-                u32Size++;
-                break;
-            }
-            
-            case(E_JIP_VAR_TYPE_BLOB):
-            {
-                buffer[u32CommandLen++] = u32Size;
-                memcpy(&buffer[u32CommandLen], (uint8_t *)pvData, u32Size);
-                u32CommandLen += u32Size;
-                break;
-            }
-            
-            default:
-                DBG_vPrintf(DBG_JIP_CLIENT, "Set not supported for this type\n");
-                eJIP_UnlockNode(psNode);
-                return E_JIP_ERROR_FAILED;
+            eJIP_UnlockNode(psNode);
+            return eStatus;
         }
 
         if (!psAddress)
@@ -284,6 +228,7 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
                     {
                         DBG_vPrintf(DBG_JIP_CLIENT, "Variable is disabled\n");
                         psVar->eEnable = E_JIP_VAR_DISABLED;
+                        vJIP_VarGenerationStamp(psVar);
                     }                    
                     eJIP_UnlockNode(psNode);
                     return psJIP_Msg_VarStatus->eStatus;
@@ -292,11 +237,9 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
             }
   
             // Update local copy 
-            {
-                teJIP_Status eStatus = eJIP_SetVarValue(psVar, pvData, u32Size);
-                eJIP_UnlockNode(psNode);
-                return eStatus;
-            }
+            eStatus = eJIP_SetVarValue(psVar, pvData, u32Size);
+            eJIP_UnlockNode(psNode);
+            return eStatus;
         }
         else
         {
@@ -415,6 +358,140 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
 }
 
 
+teJIP_Status eJIP_SetVars(tsJIP_Context *psJIP_Context, tsJIP_SetVarsEntry *asVars, uint32_t u32NumVars, uint32_t u32Flags, uint32_t *pu32FailedVar)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsJIP_Msg_SetVarsRequest *psSetVarsRequest;
+    tsJIP_Msg_VarStatus *psJIP_Msg_VarStatus;
+    uint32_t au32Size[JIP_SET_VARS_MAX];
+    teNetworkStatus eNetStatus;
+    teJIP_Status eStatus = E_JIP_OK;
+    tsNode *psNode;
+    char buffer[1024];
+    uint32_t u32ResponseLen = sizeof(buffer), u32CommandLen;
+    uint32_t i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%d variables)\n", __FUNCTION__, u32NumVars);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    if ((u32NumVars == 0) || (u32NumVars > JIP_SET_VARS_MAX))
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+    
+    psNode = asVars[0].psVar->psOwnerMib->psOwnerNode;
+    for (i = 1; i < u32NumVars; i++)
+    {
+        if (asVars[i].psVar->psOwnerMib->psOwnerNode != psNode)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Variables are not all of the same node\n");
+            return E_JIP_ERROR_FAILED;
+        }
+    }
+    
+    eJIP_LockNode(psNode, True);
+    
+    psSetVarsRequest = (tsJIP_Msg_SetVarsRequest *)buffer;
+    psSetVarsRequest->u8NumVars = u32NumVars;
+    u32CommandLen = sizeof(tsJIP_Msg_SetVarsRequest);
+    
+    for (i = 0; i < u32NumVars; i++)
+    {
+        tsVar *psVar = asVars[i].psVar;
+        tsJIP_Msg_SetVarsEntry *psEntry = (tsJIP_Msg_SetVarsEntry *)&buffer[u32CommandLen];
+        
+        if ((u32CommandLen + sizeof(tsJIP_Msg_SetVarsEntry)) > sizeof(buffer))
+        {
+            eJIP_UnlockNode(psNode);
+            return E_JIP_ERROR_BAD_BUFFER_SIZE;
+        }
+        
+        DBG_vPrintf(DBG_JIP_CLIENT, "Setting Mib 0x%08x, variable %d, type %d\n", 
+                    psVar->psOwnerMib->u32MibId, psVar->u8Index, psVar->eVarType);
+        
+        psEntry->u32MibId                   = htonl(psVar->psOwnerMib->u32MibId);
+        psEntry->sRequest.u8VarIndex        = psVar->u8Index;
+        psEntry->sRequest.sVar.eStatus      = E_JIP_OK;
+        psEntry->sRequest.sVar.eVarType     = psVar->eVarType;
+        u32CommandLen += sizeof(tsJIP_Msg_SetVarsEntry);
+        
+        au32Size[i] = asVars[i].u32Size;
+        eStatus = eJIP_PackSetData(psVar, asVars[i].pvData, &au32Size[i], buffer, &u32CommandLen, sizeof(buffer));
+        if (eStatus != E_JIP_OK)
+        {
+            if (pu32FailedVar)
+            {
+                *pu32FailedVar = i;
+            }
+            eJIP_UnlockNode(psNode);
+            return eStatus;
+        }
+    }
+    
+    eNetStatus = Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, u32Flags,
+                                     E_JIP_COMMAND_SET_VARS_REQUEST, buffer, u32CommandLen, 
+                                     E_JIP_COMMAND_SET_RESPONSE, buffer, &u32ResponseLen);
+    if (eNetStatus != E_NETWORK_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error setting variables\n");
+        eJIP_UnlockNode(psNode);
+        
+        if (eNetStatus == E_NETWORK_ERROR_TIMEOUT)
+        {
+            return E_JIP_ERROR_TIMEOUT;
+        }
+        else if (eNetStatus == E_NETWORK_ERROR_NO_MEM)
+        {
+            return E_JIP_ERROR_NO_MEM;
+        }
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    psJIP_Msg_VarStatus = (tsJIP_Msg_VarStatus *)buffer;
+    if (psJIP_Msg_VarStatus->eStatus != E_JIP_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Node reported error setting MiB %d variable %d (%d)\n", 
+                    psJIP_Msg_VarStatus->u8MibIndex, psJIP_Msg_VarStatus->u8VarIndex, psJIP_Msg_VarStatus->eStatus);
+        
+        for (i = 0; i < u32NumVars; i++)
+        {
+            tsVar *psVar = asVars[i].psVar;
+            
+            if ((psVar->psOwnerMib->u8Index == psJIP_Msg_VarStatus->u8MibIndex) &&
+                (psVar->u8Index == psJIP_Msg_VarStatus->u8VarIndex))
+            {
+                if (pu32FailedVar)
+                {
+                    *pu32FailedVar = i;
+                }
+                if (psJIP_Msg_VarStatus->eStatus == E_JIP_ERROR_DISABLED)
+                {
+                    DBG_vPrintf(DBG_JIP_CLIENT, "Variable is disabled\n");
+                    psVar->eEnable = E_JIP_VAR_DISABLED;
+                    vJIP_VarGenerationStamp(psVar);
+                }
+                break;
+            }
+        }
+        eJIP_UnlockNode(psNode);
+        return psJIP_Msg_VarStatus->eStatus;
+    }
+    
+    // Update local copies
+    for (i = 0; (i < u32NumVars) && (eStatus == E_JIP_OK); i++)
+    {
+        asVars[i].psVar->eEnable = E_JIP_VAR_ENABLED;
+        eStatus = eJIP_SetVarValue(asVars[i].psVar, asVars[i].pvData, au32Size[i]);
+    }
+    eJIP_UnlockNode(psNode);
+    return eStatus;
+}
+
+
 teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint32_t u32Flags)
 {
     PRIVATE_CONTEXT(psJIP_Context);
@@ -493,6 +570,7 @@ teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint32_t u3
         {
             DBG_vPrintf(DBG_JIP_CLIENT, "Variable is disabled\n");
             psVar->eEnable = E_JIP_VAR_DISABLED;
+            vJIP_VarGenerationStamp(psVar);
         }
         
         eJIP_UnlockNode(psNode);
@@ -507,7 +585,11 @@ teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint32_t u3
     }
     
     // Set the variable as enabled
-    psVar->eEnable = E_JIP_VAR_ENABLED;
+    if (psVar->eEnable != E_JIP_VAR_ENABLED)
+    {
+        psVar->eEnable = E_JIP_VAR_ENABLED;
+        vJIP_VarGenerationStamp(psVar);
+    }
     
     {
         teJIP_Status eStatus = eJIP_SetVarFromPacket(psVar, (uint8_t *)buffer);
@@ -766,6 +848,7 @@ static teJIP_Status eJIP_SetVarFromPacket(tsVar *psVar, uint8_t *buffer)
             memcpy(psVar->pcData, VarDescription_Str->acString, VarDescription_Str->u8StringLen);
             psVar->pcData[VarDescription_Str->u8StringLen] = '\0';
             psVar->u8Size = VarDescription_Str->u8StringLen + 1;
+            vJIP_VarGenerationStamp(psVar);
             break;
         }
         
@@ -779,6 +862,108 @@ static teJIP_Status eJIP_SetVarFromPacket(tsVar *psVar, uint8_t *buffer)
     }
     return E_JIP_OK;
 }
+
+static teJIP_Status eJIP_PackSetData(tsVar *psVar, void *pvData, uint32_t *pu32Size, char *buffer, uint32_t *pu32CommandLen, uint32_t u32BufferSize)
+{
+    uint32_t u32CommandLen = *pu32CommandLen;
+    uint32_t u32DataLen;
+    
+    switch (psVar->eVarType)
+    {
+        case (E_JIP_VAR_TYPE_INT8):
+        case (E_JIP_VAR_TYPE_UINT8):
+            *pu32Size = u32DataLen = sizeof(uint8_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT16):
+        case (E_JIP_VAR_TYPE_UINT16):
+            *pu32Size = u32DataLen = sizeof(uint16_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT32):
+        case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
+            *pu32Size = u32DataLen = sizeof(uint32_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT64):
+        case (E_JIP_VAR_TYPE_UINT64):
+        case (E_JIP_VAR_TYPE_DBL):
+            *pu32Size = u32DataLen = sizeof(uint64_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_STR):
+        case (E_JIP_VAR_TYPE_BLOB):
+            if (*pu32Size > 255)
+            {
+                return E_JIP_ERROR_BAD_BUFFER_SIZE;
+            }
+            /* Length prefixed */
+            u32DataLen = sizeof(uint8_t) + *pu32Size;
+            break;
+            
+        default:
+            DBG_vPrintf(DBG_JIP_CLIENT, "Set not supported for this type\n");
+            return E_JIP_ERROR_FAILED;
+    }
+    
+    if ((u32CommandLen + u32DataLen) > u32BufferSize)
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+    
+    switch (psVar->eVarType)
+    {
+        case (E_JIP_VAR_TYPE_INT8):
+        case (E_JIP_VAR_TYPE_UINT8):
+            buffer[u32CommandLen] = *((uint8_t *)pvData);
+            break;
+
+        case (E_JIP_VAR_TYPE_INT16):
+        case (E_JIP_VAR_TYPE_UINT16):
+        {
+            uint16_t u16Var = htons(*((uint16_t *)pvData));
+            memcpy(&buffer[u32CommandLen], &u16Var, sizeof(uint16_t));
+            break;
+        }
+            
+        case (E_JIP_VAR_TYPE_INT32):
+        case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
+        {
+            uint32_t u32Var = htonl(*((uint32_t *)pvData));
+            memcpy(&buffer[u32CommandLen], &u32Var, sizeof(uint32_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_INT64):
+        case (E_JIP_VAR_TYPE_UINT64):
+        case (E_JIP_VAR_TYPE_DBL):
+        {
+            uint64_t u64Var = htobe64(*((uint64_t *)pvData));
+            memcpy(&buffer[u32CommandLen], &u64Var, sizeof(uint64_t));
+            break;
+        }
+
+        case (E_JIP_VAR_TYPE_STR):
+            buffer[u32CommandLen] = *pu32Size;
+            memcpy(&buffer[u32CommandLen + 1], (uint8_t *)pvData, *pu32Size);
+            /* Increment size to include NULL terminator when local copy is updated */
+            (*pu32Size)++;
+            break;
+        
+        case (E_JIP_VAR_TYPE_BLOB):
+            buffer[u32CommandLen] = *pu32Size;
+            memcpy(&buffer[u32CommandLen + 1], (uint8_t *)pvData, *pu32Size);
+            break;
+        
+        default:
+            break;
+    }
+    
+    *pu32CommandLen = u32CommandLen + u32DataLen;
+    return E_JIP_OK;
+}
     
 
 teJIP_Status eJIPService_MonitorNetwork(tsJIP_Context *psJIP_Context, tprCbNetworkChange prCbNetworkChange)
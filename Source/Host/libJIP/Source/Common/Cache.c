@@ -56,6 +56,7 @@ teJIP_Status Cache_Init(tsJIP_Context *psJIP_Context, tsCache *psCache)
     psCache->psParent_JIP_Context = psJIP_Context;
     psCache->psDeviceCacheHead = NULL;
     psCache->psMibCacheHead = NULL;
+    psCache->psQueryPageCacheHead = NULL;
     
     return E_JIP_OK;
 }
@@ -65,6 +66,7 @@ teJIP_Status Cache_Destroy(tsCache *psCache)
 {
     tsDeviceIDCacheEntry    *psDeviceCacheEntry, *psDeviceCacheNext;
     tsMibIDCacheEntry       *psMibCacheEntry, *psMibCacheNext;
+    tsQueryPageCacheEntry   *psQueryPageCacheEntry, *psQueryPageCacheNext;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
     
@@ -91,6 +93,16 @@ teJIP_Status Cache_Destroy(tsCache *psCache)
         psMibCacheEntry = psMibCacheNext;
     }
     
+    /* Then the query page sizes */
+    psQueryPageCacheEntry = psCache->psQueryPageCacheHead;
+    while (psQueryPageCacheEntry)
+    {
+        psQueryPageCacheNext = psQueryPageCacheEntry->psNext;
+        free(psQueryPageCacheEntry);
+        psQueryPageCacheEntry = psQueryPageCacheNext;
+    }
+    psCache->psQueryPageCacheHead = NULL;
+    
     return E_JIP_OK;
 }
 
@@ -124,7 +136,7 @@ static teJIP_Status Cache_Add_Node_Impl(tsDeviceIDCacheEntry **psNewEntry, tsNod
 
     NewNode->u32DeviceId    = psNode->u32DeviceId;
     
-    eUtils_LockCreate(&NewNode->sLock);
+    eUtils_LockCreateHere(&NewNode->sLock);
     
     (*psNewEntry)->psNode = NewNode;
     
@@ -147,7 +159,8 @@ static teJIP_Status Cache_Add_Node_Impl(tsDeviceIDCacheEntry **psNewEntry, tsNod
                     DBG_vPrintf(DBG_CACHE, "    Adding Var \"%s\" to cache\n", psVar->pcName);
                     psNewVar = psJIP_MibAddVar(psNewMib, psVar->u8Index, psVar->pcName, psVar->eVarType, psVar->eAccessType, psVar->eSecurity);
                     
-                    if (psVar->pvData)
+                    /* Tables are not a single value that can be copied, and are read again anyway */
+                    if (psVar->pvData && (psVar->eVarType != E_JIP_VAR_TYPE_TABLE_BLOB))
                     {
                         /* If we are caching a variable that contains data, store it for restoration */
                         DBG_vPrintf(DBG_CACHE, "      Storing value of MIB 0x%08X, var %d in cache\n", psMib->u32MibId, psVar->u8Index);
@@ -309,7 +322,7 @@ teJIP_Status Cache_Populate_Node(tsCache *psCache, tsNode *psNode)
                             DBG_vPrintf(DBG_CACHE, "    Adding Var \"%s\" from cache\n", psVar->pcName);
                             psNewVar = psJIP_MibAddVar(psNewMib, psVar->u8Index, psVar->pcName, psVar->eVarType, psVar->eAccessType, psVar->eSecurity);
                             
-                            if (psVar->pvData)
+                            if (psVar->pvData && (psVar->eVarType != E_JIP_VAR_TYPE_TABLE_BLOB))
                             {
                                 DBG_vPrintf(DBG_CACHE, "      Restoring value of MIB 0x%08X, var %d from cache\n", psMib->u32MibId, psVar->u8Index);
                                 eJIP_SetVarValue(psNewVar, psVar->pvData, psVar->u8Size);
@@ -372,3 +385,34 @@ teJIP_Status Cache_Populate_Mib(tsCache *psCache, tsMib *psMib)
 }
 
 
+tsQueryPageCacheEntry *Cache_Query_Page(tsCache *psCache, uint32_t u32DeviceId, uint16_t u16PageSize)
+{
+    tsQueryPageCacheEntry *psEntry;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    for (psEntry = psCache->psQueryPageCacheHead; psEntry; psEntry = psEntry->psNext)
+    {
+        if (psEntry->u32DeviceId == u32DeviceId)
+        {
+            return psEntry;
+        }
+    }
+    
+    psEntry = malloc(sizeof(tsQueryPageCacheEntry));
+    if (!psEntry)
+    {
+        DBG_vPrintf(DBG_CACHE, "Error allocating space for Entry\n");
+        return NULL;
+    }
+    
+    DBG_vPrintf(DBG_CACHE, "Device ID 0x%08x query page starts at %d bytes\n", u32DeviceId, u16PageSize);
+    psEntry->u32DeviceId    = u32DeviceId;
+    psEntry->u16PageSize    = u16PageSize;
+    psEntry->u16Answered    = 0;
+    psEntry->u16Failed      = 0;
+    psEntry->psNext         = psCache->psQueryPageCacheHead;
+    psCache->psQueryPageCacheHead = psEntry;
+    return psEntry;
+}
+
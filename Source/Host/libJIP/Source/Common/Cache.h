@@ -59,12 +59,24 @@ typedef struct _tsMibIDCacheEntry
 } tsMibIDCacheEntry;
 
 
+/** Linked list structure of the query page sizes learned for device IDs */
+typedef struct _tsQueryPageCacheEntry
+{
+    uint32_t    u32DeviceId;                    /**< Device ID that the page size applies to */
+    uint16_t    u16PageSize;                    /**< Size in bytes of the query responses to ask for, 0 for the fixed page */
+    uint16_t    u16Answered;                    /**< Largest page in bytes that has been answered */
+    uint16_t    u16Failed;                      /**< Smallest page in bytes that has not been answered, or 0 */
+    struct _tsQueryPageCacheEntry *psNext;      /**< pointer to next element in list */
+} tsQueryPageCacheEntry;
+
+
 /** Cache structure */
 typedef struct
 {
     tsJIP_Context        *psParent_JIP_Context; /**< pointer to the parent JIP context */
     tsDeviceIDCacheEntry *psDeviceCacheHead;    /**< List head of known device IDs */
     tsMibIDCacheEntry    *psMibCacheHead;       /**< List head of known Mib IDs */
+    tsQueryPageCacheEntry *psQueryPageCacheHead;/**< List head of query page sizes by device ID */
 } tsCache;
 
 
@@ -110,6 +122,15 @@ teJIP_Status Cache_Populate_Node(tsCache *psCache, tsNode *psNode);
 teJIP_Status Cache_Populate_Mib(tsCache *psCache, tsMib *psMib);
 
 
+/** Get the query page size learned for a device ID, adding it to the cache if it is not known
+ *  \param psCache        Pointer to cache structure
+ *  \param u32DeviceId    Device ID of the node being queried
+ *  \param u16PageSize    Page size in bytes to start from for a device ID that is not known, 0 for the fixed page
+ *  \return Pointer to the entry, which may be updated, or NULL if out of memory
+ */
+tsQueryPageCacheEntry *Cache_Query_Page(tsCache *psCache, uint32_t u32DeviceId, uint16_t u16PageSize);
+
+
 
 #endif /* __CACHE_H__ */
 
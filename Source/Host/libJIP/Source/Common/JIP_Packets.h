@@ -85,6 +85,8 @@ typedef enum _eJIP_Command
     E_JIP_COMMAND_GET_MIB_REQUEST,         /* Request to get the value of a variable using MiB Id */
     E_JIP_COMMAND_SET_MIB_REQUEST,         /* Request to set the value of a variable using MiB Id */
 
+    E_JIP_COMMAND_SET_VARS_REQUEST,        /* Request to set the values of several variables of a node together, using MiB Ids */
+
     E_JIP_COMMAND_LAST
 
 } PACK teJIP_Command;
@@ -297,6 +299,21 @@ typedef struct
     tsJIP_Msg_GetRequest                sRequest;
 } PACK tsJIP_Msg_GetMibRequest;
 
+/* An E_JIP_COMMAND_GET_MIB_REQUEST for a table variable may be followed by this, to ask for
+ * the change stamp of the table, and for only the rows that have changed since a stamp.
+ * Nodes that do not keep change stamps ignore it */
+typedef struct
+{
+    uint16_t                            u16Epoch;       /* Epoch of the stamp */
+    uint32_t                            u32Stamp;       /* Stamp to read the rows changed since, or 0 to read all rows */
+} PACK tsJIP_Msg_TableChangesSince;
+
+/* Entry index of the change stamp, which is sent first in the response to a request for the
+ * first page with a tsJIP_Msg_TableChangesSince, as a tsJIP_Msg_TableChangesSince. If the request's epoch
+ * matches, the rows that follow are those changed since its stamp, and a row of length 0
+ * has been removed. Otherwise the response is as if no stamp had been asked for. */
+#define JIP_TABLE_CHANGE_STAMP_ENTRY    0xFFFF
+
 typedef struct
 {
     uint8_t                             u8VarIndex;
@@ -324,6 +341,26 @@ typedef struct
     tsJIP_Msg_SetRequest                sRequest;
 } PACK tsJIP_Msg_SetMibRequest;
 
+/* One variable of an E_JIP_COMMAND_SET_VARS_REQUEST, followed by its data */
+typedef struct
+{
+    uint32_t                            u32MibId;
+
+    tsJIP_Msg_SetRequest                sRequest;
+} PACK tsJIP_Msg_SetVarsEntry;
+
+/* E_JIP_COMMAND_SET_VARS_REQUEST. The response is an E_JIP_COMMAND_SET_RESPONSE,
+ * with the status of the first variable that failed, or of the last variable */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint8_t                             u8NumVars;
+#ifndef WIN32
+    uint8_t                             au8Vars[0];     /* u8NumVars tsJIP_Msg_SetVarsEntry */
+#endif
+} PACK tsJIP_Msg_SetVarsRequest;
+
 /* E_JIP_COMMAND_QUERY_MIB_REQUEST */
 typedef struct
 {
@@ -41,9 +41,42 @@
 
 #include <Network.h>
 #include <Cache.h>
+#include <JIP_Packets.h>
 
 #define JIP_DEVICE_MAX_GROUPS 16
 
+/** Largest JIP packet sent or received, the size of the network buffers */
+#define JIP_PACKET_MAX_SIZE 1024
+
+/** Maximum number of trap subscriptions held by a server context.
+ *  When the table is full the least recently requested trap is replaced */
+#define JIP_SERVER_MAX_TRAPS 64
+
+/** Default minimum time between trap notifications to one subscriber.
+ *  Changes within this time are coalesced into one notification of the latest value */
+#define JIP_SERVER_TRAP_MIN_INTERVAL_MS 100
+
+/** Largest trap notification - a header plus a length prefixed 255 byte string or blob */
+#define JIP_SERVER_TRAP_PACKET_SIZE (sizeof(tsJIP_Msg_VarDescriptionHeader) + sizeof(uint8_t) + 255)
+
+/** Number of different variables a multicast request may set group wide.
+ *  Members of a group may hold different MiBs at the same index */
+#define JIP_SERVER_MULTICAST_MAX_SETS 8
+
+/** Time within which an identical multicast request to a group is taken to be a retransmission.
+ *  Clients send each multicast more than once (\ref iMulticastSendCount), 200ms apart */
+#define JIP_SERVER_MULTICAST_REPEAT_MS 500
+
+/** Maximum number of nodes that a server context keeps request latencies for.
+ *  Requests to further nodes are only recorded against their command */
+#define JIP_SERVER_LATENCY_MAX_NODES 1024
+
+/** Number of buckets in the hash of nodes that request latencies are kept for */
+#define JIP_SERVER_LATENCY_NODE_BUCKETS 256
+
+/** Number of JIP commands that request latencies are kept for */
+#define JIP_SERVER_LATENCY_NUM_COMMANDS (E_JIP_COMMAND_LAST - E_JIP_COMMAND_GET_REQUEST)
+
 
 #define PRIVATE_CONTEXT(context) tsJIP_Private *psJIP_Private = (tsJIP_Private*)context->pvPriv;
 
@@ -75,6 +108,57 @@ uint64_t bswap_64(uint64_t x);
 
 #endif /* __UCLIBC__ */
 
+/** A client's subscription to changes of a variable on a server node */
+typedef struct
+{
+    int                 iInUse;             /**< Slot holds a subscription */
+    int                 iPending;           /**< A change is waiting to be sent */
+    tsVar               *psVar;             /**< Trapped variable. Only compared - never dereferenced by the notifier */
+    tsNode              *psNode;            /**< Node that owns the variable */
+    struct in6_addr     sNodeAddress;       /**< Address notifications are sent from */
+    tsJIPAddress        sSubscriber;        /**< Address and port notifications are sent to */
+    uint8_t             u8NotificationHandle;
+    uint64_t            u64Requested;       /**< Time the trap was last requested (ms) */
+    uint64_t            u64LastSent;        /**< Time the last notification was sent (ms) */
+    uint32_t            u32PacketLength;
+    uint8_t             au8Packet[JIP_SERVER_TRAP_PACKET_SIZE]; /**< Notification of the latest value, ready to send */
+} tsTrap;
+
+
+/** Trap subscriptions of a server context */
+typedef struct
+{
+    tsUtilsLock         sLock;              /**< Protects the table. Never held while taking a node lock */
+    tsUtilsThread       sNotifyThread;      /**< Thread sending pending notifications */
+    tsUtilsQueue        sWakeQueue;         /**< Wakes the notify thread when a notification is due */
+    uint32_t            u32MinIntervalMs;   /**< Minimum time between notifications to one subscriber */
+    volatile uint32_t   u32NumTraps;        /**< Number of slots in use, checked without the lock */
+    tsTrap              asTraps[JIP_SERVER_MAX_TRAPS];
+} tsTraps;
+
+
+/** Latencies of requests to one node of a server context */
+typedef struct _tsLatencyNode
+{
+    struct in6_addr     sAddress;           /**< Address of the node */
+    struct _tsLatencyNode *psNextHash;      /**< Next node in the same hash bucket */
+    tsUtilsHistogram    asStages[E_UTILS_LATENCY_NUM_STAGES];
+} tsLatencyNode;
+
+
+/** Request latencies of a server context.
+ *  Histograms are recorded into without the lock. Nodes are never removed
+ *  until the context is destroyed, so they may be read without the lock too */
+typedef struct
+{
+    tsUtilsLock         sLock;              /**< Protects adding nodes. Never held while taking another lock */
+    tsUtilsHistogram    aasCommands[JIP_SERVER_LATENCY_NUM_COMMANDS][E_UTILS_LATENCY_NUM_STAGES];
+    volatile uint32_t   u32NumNodes;        /**< Number of nodes in apsNodes */
+    tsLatencyNode       *apsNodes[JIP_SERVER_LATENCY_MAX_NODES];        /**< Nodes in the order they were first seen */
+    tsLatencyNode       *apsNodeHash[JIP_SERVER_LATENCY_NODE_BUCKETS];  /**< Nodes hashed by address */
+} tsLatency;
+
+
 /** Private structure used by the library */
 typedef struct
 {
@@ -89,6 +173,12 @@ typedef struct
     tsUtilsThread       sNetworkChangeMonitor;
     tprCbNetworkChange  prCbNetworkChange;
     
+    /* Trap subscriptions held by a server context */
+    tsTraps             sTraps;
+    
+    /* Request latencies recorded by a server context */
+    tsLatency           *psLatency;
+    
     /* Lock for all library structures */
     tsUtilsLock         sLock;
 } tsJIP_Private;
@@ -101,13 +191,43 @@ typedef struct
 } tsNode_Private;
 
 
+/** Record of the group wide sets made while handing one multicast request to the members of a group.
+ *  The group and value are fixed by the request, so a set is identified by its MiB and variable */
+typedef struct
+{
+    int                 iRepeat;            /**< The request is a retransmission, the group sets have already been made */
+    int                 iTimedOut;          /**< A group set timed out, so a retransmission should be tried */
+    uint32_t            u32NumSets;
+    struct
+    {
+        uint32_t        u32MibId;
+        uint8_t         u8VarIndex;
+        teJIP_Status    eStatus;            /**< Result of the group set callback */
+    } asSets[JIP_SERVER_MULTICAST_MAX_SETS];
+} tsMulticastRequest;
+
+
+/** Give a variable the next generation number, when it is added or its data has changed */
+void vJIP_VarGenerationStamp(tsVar *psVar);
+
+/** Latest generation number given to a variable */
+uint32_t u32JIP_VarGeneration(void);
+
+
 teJIP_Status eJIP_TrapEvent(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, char *pcPacket);
 
 
 teJIP_Status eJIP_GetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar);
 
+/** Free the rows and table of a \ref E_JIP_VAR_TYPE_TABLE_BLOB variable */
+void vJIP_Table_Free(tsVar *psVar);
+
+/** Fill in the response to a request for rows of a table variable that is served.
+ *  \param psSince     Change stamp sent with the request, or NULL if there was none
+ */
 teJIP_Status eJIPserver_HandleGetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar, 
                                           uint16_t u16FirstEntry, uint8_t u8EntryCount,
+                                          const tsJIP_Msg_TableChangesSince *psSince,
                                           uint8_t *pcSendData, unsigned int *piSendDataLength);
 
 
@@ -193,11 +313,19 @@ tsNode *psJIP_NodeListRemove(tsNode **ppsNodeListHead, tsNode *psNode);
 
 
 
+/** Handle a request to a node.
+ *  psMulticastRequest is NULL for unicast requests. For multicast requests it is shared by all of the
+ *  members of the group, so that group wide sets are only made once.
+ */
 teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                     tsMulticastRequest *psMulticastRequest,
                                      teJIP_Command eReceiveCommand, uint8_t *pcReceiveData, unsigned int iReceiveDataLength,
                                      teJIP_Command *peSendCommand,  uint8_t *pcSendData, unsigned int *piSendDataLength);
 
 
+uint32_t u32JIPserver_EncodeVarData(tsVar *psVar, uint8_t *pu8Data);
+
+
 teJIP_Status eGroups_Init(tsNode *psNode);
 
 teJIP_Status eGroups_GroupsGet(tsVar *psVar);
@@ -206,4 +334,40 @@ teJIP_Status eGroups_GroupRemoveSet(tsVar *psVar, tsJIPAddress *psDstAddress);
 teJIP_Status eGroups_GroupClearSet(tsVar *psVar, tsJIPAddress *psDstAddress);
 
 
+/** Set up the trap table of a server context */
+teJIP_Status eTraps_Init(tsJIP_Context *psJIP_Context);
+
+/** Start sending notifications. Called once the server socket is listening */
+teJIP_Status eTraps_Start(tsJIP_Context *psJIP_Context);
+
+/** Stop sending notifications and free the trap table */
+teJIP_Status eTraps_Destroy(tsJIP_Context *psJIP_Context);
+
+/** Add or refresh a subscriber's trap on a variable */
+teJIP_Status eTraps_Add(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psSubscriber, uint8_t u8NotificationHandle);
+
+/** Remove a subscriber's trap on a variable */
+teJIP_Status eTraps_Remove(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psSubscriber);
+
+/** Remove all traps on a node's variables before it is free'd */
+void vTraps_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode);
+
+/** Queue a notification to every subscriber of a variable whose value has changed */
+void vTraps_VarChanged(tsVar *psVar);
+
+
+/** Set up recording of request latencies for a server context */
+teJIP_Status eLatency_Init(tsJIP_Context *psJIP_Context);
+
+/** Free the request latencies of a server context */
+teJIP_Status eLatency_Destroy(tsJIP_Context *psJIP_Context);
+
+/** Finish tracing the request handled by the calling thread, and record its latencies.
+ *  \param psJIP_Context    Server context that handled the request
+ *  \param u8Command        Command of the request
+ *  \param psNodeAddress    Address of the node that the request was to, or NULL for multicast requests
+ */
+void vLatency_RequestEnd(tsJIP_Context *psJIP_Context, uint8_t u8Command, struct in6_addr *psNodeAddress);
+
+
 #endif /* __JIPPRIVATE_H__ */
\ No newline at end of file
@@ -48,6 +48,8 @@
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 
 #include <JIP.h>
 #include <JIP_Private.h>
@@ -81,9 +83,16 @@ static void *pvTrapHandlerThread(tsUtilsThread *psThreadInfo);
 
 
 static teNetworkStatus Network_ServerExchange(tsJIP_Context* psJIP_Context, tsNode *psNode, tsJIPAddress *psAddress, tsJIPAddress *psDstAddress,
+                                        tsMulticastRequest *psMulticastRequest,
                                         char *pcReceiveData, unsigned int iReceiveDataLength,
                                         const char *pcSendData, unsigned int *piSendDataLength);
 
+static tsServerGroups *Network_ServerGroupFind(tsNetworkContext *psNetworkContext, struct in6_addr *psMulticastAddress);
+
+static void Network_ServerMulticastExchange(tsJIP_Context* psJIP_Context, tsNetworkContext *psNetworkContext,
+                                            tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                            char *pcReceiveData, unsigned int iReceiveDataLength, char *pcSendData);
+
 
 tsJIPAddress   Network_MAC_to_IPv6(tsNetworkContext *psNetworkContext, uint64_t u64MAC_Address)
 {
@@ -139,9 +148,16 @@ teNetworkStatus Network_Init(tsNetworkContext *psNetworkContext, tsJIP_Context *
 
 teNetworkStatus Network_Destroy(tsNetworkContext *psNetworkContext)
 {  
+    int i;
+    
     eUtils_ThreadStop(&psNetworkContext->sSocketListener);
     eUtils_QueueDestroy(&psNetworkContext->sSocketQueue);
     
+    for (i = 0; i < psNetworkContext->u32NumGroups; i++)
+    {
+        free(psNetworkContext->pasServerGroups[i].apsMembers);
+        free(psNetworkContext->pasServerGroups[i].pu8LastPayload);
+    }
     free(psNetworkContext->pasServerGroups);
     
     while (u32AtomicGet(&psNetworkContext->u32NumTrapThreads) > 0)
@@ -168,6 +184,14 @@ teNetworkStatus Network_ServerGroupJoin(tsNetworkContext *psNetworkContext, tsNo
     {
         if (memcmp(&psNetworkContext->pasServerGroups[i].sMulticastAddress, psMulticastAddress, sizeof(struct in6_addr)) == 0)
         {
+            tsNode **apsNewMembers = realloc(psNetworkContext->pasServerGroups[i].apsMembers, 
+                                             sizeof(tsNode *) * (psNetworkContext->pasServerGroups[i].u32NumMembers + 1));
+            if (!apsNewMembers)
+            {
+                return E_NETWORK_ERROR_NO_MEM;
+            }
+            apsNewMembers[psNetworkContext->pasServerGroups[i].u32NumMembers] = psNode;
+            psNetworkContext->pasServerGroups[i].apsMembers = apsNewMembers;
             psNetworkContext->pasServerGroups[i].u32NumMembers++;
             DBG_vPrintf(DBG_NETWORK, "Server is already in group - now %d members.\n", psNetworkContext->pasServerGroups[i].u32NumMembers);
             return E_NETWORK_OK;
@@ -223,10 +247,19 @@ teNetworkStatus Network_ServerGroupJoin(tsNetworkContext *psNetworkContext, tsNo
     }
 
     psNewGroups = &psNetworkContext->pasServerGroups[psNetworkContext->u32NumGroups];
+    psNewGroups->apsMembers = malloc(sizeof(tsNode *));
+    if (!psNewGroups->apsMembers)
+    {
+        return E_NETWORK_ERROR_NO_MEM;
+    }
     psNetworkContext->u32NumGroups++;
     
     psNewGroups->sMulticastAddress = *psMulticastAddress;
     psNewGroups->u32NumMembers = 1;
+    psNewGroups->apsMembers[0] = psNode;
+    psNewGroups->pu8LastPayload = NULL;
+    psNewGroups->iLastPayloadLength = 0;
+    psNewGroups->u64LastRequestTime = 0;
     
     return E_NETWORK_OK;
 }
@@ -241,7 +274,27 @@ teNetworkStatus Network_ServerGroupLeave(tsNetworkContext *psNetworkContext, tsN
     {
         if (memcmp(&psNetworkContext->pasServerGroups[i].sMulticastAddress, psMulticastAddress, sizeof(struct in6_addr)) == 0)
         {
-            psNetworkContext->pasServerGroups[i].u32NumMembers--;
+            tsServerGroups *psGroup = &psNetworkContext->pasServerGroups[i];
+            int iMember;
+            
+            for (iMember = 0; iMember < psGroup->u32NumMembers; iMember++)
+            {
+                if (psGroup->apsMembers[iMember] == psNode)
+                {
+                    break;
+                }
+            }
+            
+            if (iMember == psGroup->u32NumMembers)
+            {
+                DBG_vPrintf(DBG_NETWORK, "Node is not a member of the group\n");
+                return E_NETWORK_ERROR_FAILED;
+            }
+            
+            /* Shuffle remaining members down the table */
+            psGroup->u32NumMembers--;
+            memmove(&psGroup->apsMembers[iMember], &psGroup->apsMembers[iMember + 1],
+                    sizeof(tsNode *) * (psGroup->u32NumMembers - iMember));
             DBG_vPrintf(DBG_NETWORK, "Server is in group - now %d members.\n", psNetworkContext->pasServerGroups[i].u32NumMembers);
             
             if (psNetworkContext->pasServerGroups[i].u32NumMembers == 0)
@@ -301,6 +354,8 @@ teNetworkStatus Network_ServerGroupLeave(tsNetworkContext *psNetworkContext, tsN
     }
 
     // Now remove the entry from the server groups table.
+    free(psNetworkContext->pasServerGroups[iGroupAddressSlot].apsMembers);
+    free(psNetworkContext->pasServerGroups[iGroupAddressSlot].pu8LastPayload);
     psNetworkContext->u32NumGroups--;
     DBG_vPrintf(DBG_NETWORK, "Remove server from group - now %d groups.\n", psNetworkContext->u32NumGroups);
     
@@ -723,7 +778,7 @@ typedef struct
 {
     ssize_t             iBytesRecieved;
     struct sockaddr_in6 sRecv_addr;
-#define PACKET_BUFFER_SIZE 1024
+#define PACKET_BUFFER_SIZE JIP_PACKET_MAX_SIZE
     char                acBuffer[PACKET_BUFFER_SIZE];
 } tsReceivedPacket;
 
@@ -939,6 +994,8 @@ static void *pvServerSocketListenerThread(tsUtilsThread *psThreadInfo)
     while (psThreadInfo->eState == E_THREAD_RUNNING)
     {
         uint32_t u32Attempts = 0;
+        uint64_t u64LockStart;
+        uint8_t u8Command;
         int iInLen = 0;
         unsigned int iOutLen = 0;
         struct msghdr           sMsgInfo;
@@ -953,6 +1010,7 @@ static void *pvServerSocketListenerThread(tsUtilsThread *psThreadInfo)
         char acOutBuf[PACKET_BUFFER_SIZE];
         
         bool_t bIsMulticast = False;
+        bool_t bNodeFound = False;
         
         memset(&sMsgInfo, 0, sizeof(struct msghdr));
         memset(&sIO, 0, sizeof(struct iovec));
@@ -975,6 +1033,10 @@ static void *pvServerSocketListenerThread(tsUtilsThread *psThreadInfo)
             DBG_vPrintf(DBG_NETWORK, "%s: Error in recvmsg (%s)\n", __FUNCTION__, strerror(errno));
             continue;
         }   
+        
+        /* Time the request from here until the response has been sent */
+        vUtils_LatencyBegin();
+        u8Command = (iInLen >= sizeof(tsJIP_MsgHeader)) ? ((tsJIP_MsgHeader *)acInBuf)->eCommand : 0;
             
         DBG_vPrintf(DBG_NETWORK, "%s: Got %d bytes from: ", __FUNCTION__, iInLen);
         DBG_vPrintf_IPv6Address(DBG_NETWORK, sSrcAddress.sin6_addr);
@@ -1004,7 +1066,21 @@ static void *pvServerSocketListenerThread(tsUtilsThread *psThreadInfo)
             bIsMulticast = True;
         }
 
-        // Look up which node(s) have that unicast address / are members of the multicast group
+        if (bIsMulticast)
+        {
+            tsJIPAddress sDstAddress;
+            
+            memset(&sDstAddress, 0, sizeof(tsJIPAddress));
+            memcpy(&sDstAddress.sin6_addr, &psInPacketInfo->ipi6_addr, sizeof(struct in6_addr));
+            
+            Network_ServerMulticastExchange(psJIP_Context, psNetworkContext, &sSrcAddress, &sDstAddress, acInBuf, iInLen, acOutBuf);
+            vLatency_RequestEnd(psJIP_Context, u8Command, NULL);
+            
+            // We don't reply to multicasts.
+            continue;
+        }
+
+        // Look up which node has that unicast address
 start_lock:
         eJIP_Lock(psJIP_Context);
         {
@@ -1017,102 +1093,52 @@ start_lock:
             
             while (psNode)
             {
-                if (bIsMulticast)
+                if (memcmp(&psInPacketInfo->ipi6_addr, &psNode->sNode_Address.sin6_addr, sizeof(struct in6_addr)) == 0)
                 {
-                    /* This was a multicast packet so look through each nodes goup membership */
-                    int iGroupAddressSlot;
-                    tsNode_Private *psNode_Private;
+                    DBG_vPrintf(DBG_NETWORK, "Found node ");
+                    DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
+                    bNodeFound = True;
                     
                     if (eJIP_LockNode(psNode, False) == E_JIP_ERROR_WOULD_BLOCK)
                     {
                         DBG_vPrintf(DBG_NETWORK, "Locking node %p would block\n", psNode);
                         eJIP_Unlock(psJIP_Context);
+                        u64LockStart = u64Utils_LatencyStart();
                         if (++u32Attempts > 10)
                         {
                             DBG_vPrintf(DBG_NETWORK, "Error locking node:");
                             DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
-                            
-                            /* Give up on this node */
+                            sleep(1);
                             u32Attempts = 0;
-                            continue;
                         }
                         eUtils_ThreadYield();
+                        vUtils_LatencyStage(E_UTILS_LATENCY_LOCK, u64LockStart);
                         goto start_lock;
                     }
-
-                    // We've got a lock on the node at this point
-                    psNode_Private = (tsNode_Private *)psNode->pvPriv;
                     
-                    /* Check if the node is already in the group */
-                    for (iGroupAddressSlot = 0; 
-                        iGroupAddressSlot < JIP_DEVICE_MAX_GROUPS; 
-                        iGroupAddressSlot++)
-                    {
-                        if (memcmp(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &psInPacketInfo->ipi6_addr, sizeof(struct in6_addr)) == 0)
-                        {
-                            DBG_vPrintf(DBG_NETWORK, "%s: Node is in the multicast group\n", __FUNCTION__);
-                            
-                            if (Network_ServerExchange(psJIP_Context, psNode, &sSrcAddress, &sDstAddress,
+                    if (Network_ServerExchange(psJIP_Context, psNode, &sSrcAddress, &sDstAddress, NULL,
                                     acInBuf, iInLen,
                                     acOutBuf, &iOutLen) == E_NETWORK_OK)
-                            {
-                                /* Command handled */
-                            }
-                            
-                            // Discard the response - we don't reply to multicasts.
-                            iOutLen = 0;
-                        }
+                    {
+                        /* Send response */
+                        DBG_vPrintf(DBG_NETWORK, "%s: send %d bytes to ", __FUNCTION__, iOutLen);
+                        DBG_vPrintf_IPv6Address(DBG_NETWORK, (sSrcAddress.sin6_addr));
                     }
-                    
-                    // Unlock the node again
-                    eJIP_UnlockNode(psNode);
-                }
-                else
-                {
-                    if (memcmp(&psInPacketInfo->ipi6_addr, &psNode->sNode_Address.sin6_addr, sizeof(struct in6_addr)) == 0)
+                    else
                     {
-                        DBG_vPrintf(DBG_NETWORK, "Found node ");
-                        DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
-                        
-                        if (eJIP_LockNode(psNode, False) == E_JIP_ERROR_WOULD_BLOCK)
-                        {
-                            DBG_vPrintf(DBG_NETWORK, "Locking node %p would block\n", psNode);
-                            eJIP_Unlock(psJIP_Context);
-                            if (++u32Attempts > 10)
-                            {
-                                DBG_vPrintf(DBG_NETWORK, "Error locking node:");
-                                DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
-                                sleep(1);
-                                u32Attempts = 0;
-                            }
-                            eUtils_ThreadYield();
-                            goto start_lock;
-                        }
-                        
-                        if (Network_ServerExchange(psJIP_Context, psNode, &sSrcAddress, &sDstAddress,
-                                        acInBuf, iInLen,
-                                        acOutBuf, &iOutLen) == E_NETWORK_OK)
-                        {
-                            /* Send response */
-                            DBG_vPrintf(DBG_NETWORK, "%s: send %d bytes to ", __FUNCTION__, iOutLen);
-                            DBG_vPrintf_IPv6Address(DBG_NETWORK, (sSrcAddress.sin6_addr));
-                        }
-                        else
-                        {
-                            iOutLen = 0;
-                        }
-                        // Unlock the node again
-                        eJIP_UnlockNode(psNode);
+                        iOutLen = 0;
                     }
+                    // Unlock the node again
+                    eJIP_UnlockNode(psNode);
                 }
                 psNode = psNode->psNext;
             }
         }
         eJIP_Unlock(psJIP_Context);
         
-        if (iOutLen && !bIsMulticast)
+        if (iOutLen)
         {
-            // Send the response packet (but not if this was a multicast
+            // Send the response packet
             memset(&sMsgInfo, 0, sizeof(struct msghdr));
             memset(&sIO, 0, sizeof(struct iovec));
             memset(acOutMsgControl, 0, sizeof(acOutMsgControl));
@@ -1140,6 +1166,8 @@ start_lock:
                 DBG_vPrintf(DBG_NETWORK, "%s: Could not send response message (%s) ", __FUNCTION__, strerror(errno));
             }
         }
+        /* Only keep latencies for addresses that belong to a node */
+        vLatency_RequestEnd(psJIP_Context, u8Command, bNodeFound ? &psInPacketInfo->ipi6_addr : NULL);
     }
     
     DBG_vPrintf(DBG_NETWORK, "%s: exit\n", __FUNCTION__);
@@ -1150,7 +1178,152 @@ start_lock:
 }
 
 
+static tsServerGroups *Network_ServerGroupFind(tsNetworkContext *psNetworkContext, struct in6_addr *psMulticastAddress)
+{
+    int i;
+    
+    for (i = 0; i < psNetworkContext->u32NumGroups; i++)
+    {
+        if (memcmp(&psNetworkContext->pasServerGroups[i].sMulticastAddress, psMulticastAddress, sizeof(struct in6_addr)) == 0)
+        {
+            return &psNetworkContext->pasServerGroups[i];
+        }
+    }
+    return NULL;
+}
+
+
+/** Hand a multicast request to each member of the group it was sent to.
+ *  The members are found from the server's group index, so only they need to be locked. 
+ *  Variables that are set group wide are set once for the request, and not again for
+ *  retransmissions of it.
+ */
+static void Network_ServerMulticastExchange(tsJIP_Context* psJIP_Context, tsNetworkContext *psNetworkContext,
+                                            tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                            char *pcReceiveData, unsigned int iReceiveDataLength, char *pcSendData)
+{
+    tsJIP_MsgHeader *psReceiveHeader = (tsJIP_MsgHeader *)pcReceiveData;
+    uint8_t *pu8Payload = (uint8_t *)pcReceiveData + sizeof(tsJIP_MsgHeader);
+    unsigned int iPayloadLength;
+    tsMulticastRequest sMulticastRequest;
+    tsServerGroups *psGroup;
+    struct timespec sNow;
+    uint64_t u64Now;
+    int iMember = INT_MAX;
+    uint32_t u32Attempts = 0;
+    
+    if (iReceiveDataLength < sizeof(tsJIP_MsgHeader))
+    {
+        return;
+    }
+    iPayloadLength = iReceiveDataLength - sizeof(tsJIP_MsgHeader);
+    
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    u64Now = ((uint64_t)sNow.tv_sec * 1000) + (sNow.tv_nsec / 1000000);
+    
+    memset(&sMulticastRequest, 0, sizeof(tsMulticastRequest));
+    
+    eJIP_Lock(psJIP_Context);
+    
+    psGroup = Network_ServerGroupFind(psNetworkContext, &psDstAddress->sin6_addr);
+    if (psGroup && psGroup->pu8LastPayload &&
+        ((u64Now - psGroup->u64LastRequestTime) < JIP_SERVER_MULTICAST_REPEAT_MS) &&
+        (psGroup->u8LastCommand == psReceiveHeader->eCommand) &&
+        (psGroup->iLastPayloadLength == iPayloadLength) &&
+        (memcmp(psGroup->pu8LastPayload, pu8Payload, iPayloadLength) == 0))
+    {
+        DBG_vPrintf(DBG_NETWORK, "%s: Retransmission of the last request to the group\n", __FUNCTION__);
+        sMulticastRequest.iRepeat = 1;
+    }
+    
+    while (1)
+    {
+        tsNode *psNode;
+        unsigned int iOutLen = 0;
+        
+        /* Look the group up each time round, as it may change while the context is unlocked */
+        psGroup = Network_ServerGroupFind(psNetworkContext, &psDstAddress->sin6_addr);
+        if (!psGroup)
+        {
+            break;
+        }
+        
+        /* Work down the table, so members that leave the group while handling the request
+         * (e.g. a multicast to clear groups) don't move the ones still to do */
+        if (iMember >= (int)psGroup->u32NumMembers)
+        {
+            iMember = psGroup->u32NumMembers - 1;
+        }
+        if (iMember < 0)
+        {
+            break;
+        }
+        
+        psNode = psGroup->apsMembers[iMember];
+        
+        if (eJIP_LockNode(psNode, False) == E_JIP_ERROR_WOULD_BLOCK)
+        {
+            DBG_vPrintf(DBG_NETWORK, "Locking node %p would block\n", psNode);
+            eJIP_Unlock(psJIP_Context);
+            if (++u32Attempts > 10)
+            {
+                DBG_vPrintf(DBG_NETWORK, "Error locking node:");
+                DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
+                
+                /* Give up on this node */
+                u32Attempts = 0;
+                iMember--;
+            }
+            eUtils_ThreadYield();
+            eJIP_Lock(psJIP_Context);
+            continue;
+        }
+        
+        // We've got a lock on the node at this point
+        DBG_vPrintf(DBG_NETWORK, "%s: Node is in the multicast group\n", __FUNCTION__);
+        
+        (void)Network_ServerExchange(psJIP_Context, psNode, psSrcAddress, psDstAddress, &sMulticastRequest,
+                                     pcReceiveData, iReceiveDataLength,
+                                     pcSendData, &iOutLen);
+        
+        // Unlock the node again
+        eJIP_UnlockNode(psNode);
+        
+        u32Attempts = 0;
+        iMember--;
+    }
+    
+    if (psGroup && !sMulticastRequest.iRepeat)
+    {
+        /* Remember the request so that retransmissions of it are recognised.
+         * If a group set timed out, let a retransmission try again. */
+        uint8_t *pu8LastPayload = psGroup->pu8LastPayload;
+        
+        if (!sMulticastRequest.iTimedOut && (iPayloadLength > psGroup->iLastPayloadLength))
+        {
+            pu8LastPayload = realloc(psGroup->pu8LastPayload, iPayloadLength);
+        }
+        
+        if (sMulticastRequest.iTimedOut || !pu8LastPayload)
+        {
+            psGroup->iLastPayloadLength = 0;
+            psGroup->u64LastRequestTime = 0;
+        }
+        else
+        {
+            psGroup->pu8LastPayload     = pu8LastPayload;
+            psGroup->u8LastCommand      = psReceiveHeader->eCommand;
+            psGroup->iLastPayloadLength = iPayloadLength;
+            psGroup->u64LastRequestTime = u64Now;
+            memcpy(psGroup->pu8LastPayload, pu8Payload, iPayloadLength);
+        }
+    }
+    eJIP_Unlock(psJIP_Context);
+}
+
+
 static teNetworkStatus Network_ServerExchange(tsJIP_Context* psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                        tsMulticastRequest *psMulticastRequest,
                                         char *pcReceiveData, unsigned int iReceiveDataLength,
                                         const char *pcSendData, unsigned int *piSendDataLength)
 {
@@ -1174,7 +1347,7 @@ static teNetworkStatus Network_ServerExchange(tsJIP_Context* psJIP_Context, tsNo
     DBG_vPrintf(DBG_NETWORK, "Packet OK\n");
     
     
-    eStatus = eJIPserver_HandlePacket(psJIP_Context, psNode, psSrcAddress, psDstAddress,
+    eStatus = eJIPserver_HandlePacket(psJIP_Context, psNode, psSrcAddress, psDstAddress, psMulticastRequest,
                                      psReceiveHeader->eCommand, (uint8_t *)pcReceiveData, iReceiveDataLength,
                                      &psSendHeader->eCommand,  (uint8_t *)pcSendData, piSendDataLength);
     
@@ -1197,6 +1370,50 @@ static teNetworkStatus Network_ServerExchange(tsJIP_Context* psJIP_Context, tsNo
 
 
 
+teNetworkStatus Network_ServerSend(tsNetworkContext *psNetworkContext, struct in6_addr *psSrcAddress, tsJIPAddress *psDstAddress,
+                                   const char *pcData, unsigned int iDataLength)
+{
+    struct msghdr           sMsgInfo;
+    struct iovec            sIO;
+    struct cmsghdr*         psControlMessage;
+    struct in6_pktinfo      sPacketInfo;
+    char acMsgControl[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    memset(&sMsgInfo, 0, sizeof(struct msghdr));
+    memset(&sIO, 0, sizeof(struct iovec));
+    memset(acMsgControl, 0, sizeof(acMsgControl));
+    memset(&sPacketInfo, 0, sizeof(struct in6_pktinfo));
+    
+    sIO.iov_base = (void *)pcData;
+    sIO.iov_len  = iDataLength;
+
+    sMsgInfo.msg_name = psDstAddress;
+    sMsgInfo.msg_namelen = sizeof(tsJIPAddress);
+    sMsgInfo.msg_iov = &sIO;
+    sMsgInfo.msg_iovlen = 1;
+    sMsgInfo.msg_control = acMsgControl;
+    sMsgInfo.msg_controllen = sizeof(acMsgControl);
+
+    /* Send from the node's address, as the responses from the listener thread are */
+    memcpy(&sPacketInfo.ipi6_addr, psSrcAddress, sizeof(struct in6_addr));
+    
+    psControlMessage = CMSG_FIRSTHDR(&sMsgInfo);
+    psControlMessage->cmsg_level = IPPROTO_IPV6;
+    psControlMessage->cmsg_type = IPV6_PKTINFO;
+    psControlMessage->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+    memcpy(CMSG_DATA(psControlMessage), &sPacketInfo, sizeof(struct in6_pktinfo));
+
+    if (sendmsg(psNetworkContext->iSocket, &sMsgInfo, 0) != iDataLength)
+    {
+        DBG_vPrintf(DBG_NETWORK, "%s: Could not send message (%s) ", __FUNCTION__, strerror(errno));
+        return E_NETWORK_ERROR_FAILED;
+    }
+    return E_NETWORK_OK;
+}
+
+
 teNetworkStatus Network_Recieve(tsNetworkContext *psNetworkContext, uint32_t u32Timeout, tsJIPAddress *psAddress, char *pcData, unsigned int *iDataLength)
 {
     tsReceivedPacket *psReceivedPacket;
@@ -1252,14 +1469,23 @@ teNetworkStatus Network_Recieve(tsNetworkContext *psNetworkContext, uint32_t u32
 teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *psNode, uint32_t u32Retries, uint32_t u32Flags,
                                      teJIP_Command eSendCommand, const char *pcSendData, int iSendDataLength, 
                                      teJIP_Command eReceiveCommand, char *pcReceiveData, unsigned int *piReceiveDataLength)
+{
+    return Network_ExchangeJIPTimeout(psNetworkContext, psNode, u32Retries, u32Flags, 0,
+                                      eSendCommand, pcSendData, iSendDataLength,
+                                      eReceiveCommand, pcReceiveData, piReceiveDataLength);
+}
+
+
+teNetworkStatus Network_ExchangeJIPTimeout(tsNetworkContext *psNetworkContext, tsNode *psNode, uint32_t u32Retries, uint32_t u32Flags,
+                                            uint32_t u32Timeout,
+                                            teJIP_Command eSendCommand, const char *pcSendData, int iSendDataLength, 
+                                            teJIP_Command eReceiveCommand, char *pcReceiveData, unsigned int *piReceiveDataLength)
 {
     teNetworkStatus eStatus;
     uint32_t i;
     tsJIP_MsgHeader *psSendHeader;
     tsJIP_MsgHeader *psReceiveHeader;
     uint8_t u8MatchHandle = 0;
-    
-    uint32_t u32Timeout;
         
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
 
@@ -1280,14 +1506,17 @@ teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *
     /* Get a copy of the handle to match responses against */
     u8MatchHandle = psSendHeader->u8Handle;
     
-    // Most significant bit of device ID marks a node as a sleeping device
-    if (psNode->u32DeviceId & 0x80000000)
+    if (u32Timeout == 0)
     {
-        u32Timeout = JIP_CLIENT_TIMEOUT_SLEEPING;
-    }
-    else
-    {
-        u32Timeout = JIP_CLIENT_TIMEOUT_POWERED;
+        // Most significant bit of device ID marks a node as a sleeping device
+        if (psNode->u32DeviceId & 0x80000000)
+        {
+            u32Timeout = JIP_CLIENT_TIMEOUT_SLEEPING;
+        }
+        else
+        {
+            u32Timeout = JIP_CLIENT_TIMEOUT_POWERED;
+        }
     }
     DBG_vPrintf(DBG_NETWORK, "Timeout set to %d\n", u32Timeout);
     
@@ -72,6 +72,12 @@ typedef struct
 {
     struct in6_addr     sMulticastAddress;      /**< Multicast group address */
     uint32_t            u32NumMembers;          /**< How many nodes are a member of the group */
+    tsNode              **apsMembers;           /**< The nodes that are members of the group */
+    
+    uint8_t             u8LastCommand;          /**< Last request handled for the group, so that retransmissions of it are recognised */
+    uint8_t             *pu8LastPayload;
+    unsigned int        iLastPayloadLength;
+    uint64_t            u64LastRequestTime;     /**< When the last request was handled, in ms */
 } tsServerGroups;
 
 typedef struct
@@ -129,7 +135,17 @@ teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *
                                     teJIP_Command eSendCommand, const char *pcSendData, int iSendDataLength, 
                                     teJIP_Command eReceiveCommand, char *pcReceiveData, unsigned int *piReceiveDataLength);
 
+/** As \ref Network_ExchangeJIP, but waiting u32Timeout ms for each response instead of the default for the type of node.
+ *  0 waits for the default. */
+teNetworkStatus Network_ExchangeJIPTimeout(tsNetworkContext *psNetworkContext, tsNode *psNode, uint32_t u32Retries, uint32_t u32Flags,
+                                           uint32_t u32Timeout,
+                                           teJIP_Command eSendCommand, const char *pcSendData, int iSendDataLength, 
+                                           teJIP_Command eReceiveCommand, char *pcReceiveData, unsigned int *piReceiveDataLength);
+
 teNetworkStatus Network_SendJIP(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress,
                                 teJIP_Command eCommand, const char *pcData, int iDataLength);
+
+teNetworkStatus Network_ServerSend(tsNetworkContext *psNetworkContext, struct in6_addr *psSrcAddress, tsJIPAddress *psDstAddress,
+                                   const char *pcData, unsigned int iDataLength);
 #endif /* __NETWORK_H__ */
                             
\ No newline at end of file
@@ -143,7 +143,7 @@ tsNode *psJIP_NetAllocateNode(tsNetwork *psNet, tsJIPAddress *psAddress, uint32_
     }
     psNewNode->u32DeviceId = u32DeviceId;
     
-    eUtils_LockCreate(&psNewNode->sLock);
+    eUtils_LockCreateHere(&psNewNode->sLock);
     eUtils_LockLock(&psNewNode->sLock);
 
     DBG_vPrintf(DBG_NODES, "New Node allocated at %p\n", psNewNode);
@@ -307,25 +307,8 @@ teJIP_Status eJIP_FreeMib(tsJIP_Context *psJIP_Context, tsMib *psMib)
         switch (psVar->eVarType)
         {
             case(E_JIP_VAR_TYPE_TABLE_BLOB):
-            {
-                tsTable *psTable;
-                uint32_t i;
-                
-                if (psVar->pvData)
-                {
-                    psTable = (tsTable *)psVar->pvData;
-                    for (i = 0; i < psTable->u32NumRows; i++)
-                    {
-                        if (psTable->psRows[i].pvData)
-                        {
-                            free(psTable->psRows[i].pvData);
-                        }
-                    }
-                    free(psTable->psRows);
-                    free(psVar->pvData);
-                }
+                vJIP_Table_Free(psVar);
                 break;
-            }
             default:
                 if (psVar->pvData)
                 {
@@ -471,6 +454,7 @@ tsNode *psJIP_LookupNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress)
     tsNode *psNode;
     tsNetwork *psNet;
     uint32_t u32Attempts = 0;
+    uint64_t u64LockStart;
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
  
     DBG_vPrintf(DBG_NODES, "Looking for ");
@@ -492,6 +476,7 @@ start:
             {
                 DBG_vPrintf(DBG_NODES, "Locking node %p would block\n", psNode);
                 eJIP_Unlock(psJIP_Context);
+                u64LockStart = u64Utils_LatencyStart();
                 if (++u32Attempts > 10)
                 {
                     DBG_vPrintf(DBG_NODES, "Error locking node:");
@@ -500,6 +485,7 @@ start:
                     u32Attempts = 0;
                 }
                 eUtils_ThreadYield();
+                vUtils_LatencyStage(E_UTILS_LATENCY_LOCK, u64LockStart);
                 goto start;
             }
             eJIP_Unlock(psJIP_Context);
@@ -644,6 +630,7 @@ tsVar *psJIP_MibAddVar(tsMib *psMib, uint8_t u8Index, const char *pcName, teJIP_
     NewVar->eSecurity = eSecurity;
     NewVar->psOwnerMib = psMib;
     NewVar->eEnable = E_JIP_VAR_ENABLED; /* All vars enabled by default */
+    vJIP_VarGenerationStamp(NewVar);
 
     psMib->u32NumVars++;
     
@@ -866,7 +866,7 @@ processNode(xmlTextReaderPtr reader) {
                     psNode->u32DeviceId    = u32DeviceId;
                     psNode->u32NumMibs     = 0;
                     
-                    eUtils_LockCreate(&psNode->sLock);
+                    eUtils_LockCreateHere(&psNode->sLock);
                 }
             }
             else if (strcmp(NodeName, "Mib") == 0)
@@ -0,0 +1,317 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#define DBG_FUNCTION_CALLS 0
+#define DBG_SNAPSHOT 0
+
+/** Initial size of a snapshot buffer for each node in the network */
+#define SNAPSHOT_NODE_SIZE 512
+
+
+/** A snapshot being written */
+typedef struct
+{
+    uint8_t             *pu8Data;
+    uint32_t            u32Size;            /**< Size of the allocation */
+    uint32_t            u32Used;            /**< Bytes written so far */
+} tsSnapshotBuffer;
+
+
+/** Make room for a record at the end of the snapshot.
+ *  Records are found again by their offset, as the buffer may move.
+ *  \return Offset of the record, or -1 if the buffer could not be grown
+ */
+static int64_t i64Snapshot_Reserve(tsSnapshotBuffer *psBuffer, uint32_t u32Length)
+{
+    uint32_t u32Offset = psBuffer->u32Used;
+    
+    if ((psBuffer->u32Used + u32Length) > psBuffer->u32Size)
+    {
+        uint32_t u32Size = psBuffer->u32Size * 2;
+        uint8_t *pu8Data;
+        
+        while (u32Size < (psBuffer->u32Used + u32Length))
+        {
+            u32Size *= 2;
+        }
+        pu8Data = realloc(psBuffer->pu8Data, u32Size);
+        if (!pu8Data)
+        {
+            return -1;
+        }
+        psBuffer->pu8Data = pu8Data;
+        psBuffer->u32Size = u32Size;
+    }
+    psBuffer->u32Used += u32Length;
+    return u32Offset;
+}
+
+
+/** Length of a name in a snapshot, which is not NULL terminated */
+static uint8_t u8Snapshot_NameLength(const char *pcName)
+{
+    size_t iLength = pcName ? strlen(pcName) : 0;
+    
+    return (iLength > 255) ? 255 : (uint8_t)iLength;
+}
+
+
+static teJIP_Status eSnapshot_Var(tsSnapshotBuffer *psBuffer, tsVar *psVar)
+{
+    tsJIP_SnapshotVar *psRecord;
+    uint8_t u8NameLength = u8Snapshot_NameLength(psVar->pcName);
+    int64_t i64Offset;
+    
+    if ((i64Offset = i64Snapshot_Reserve(psBuffer, sizeof(tsJIP_SnapshotVar) + u8NameLength)) < 0)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    psRecord = (tsJIP_SnapshotVar *)&psBuffer->pu8Data[i64Offset];
+    psRecord->u8Index       = psVar->u8Index;
+    psRecord->u8VarType     = psVar->eVarType;
+    psRecord->u8AccessType  = psVar->eAccessType;
+    psRecord->u8Security    = psVar->eSecurity;
+    psRecord->u8Flags       = (psVar->eEnable == E_JIP_VAR_ENABLED) ? JIP_SNAPSHOT_VAR_ENABLED : 0;
+    psRecord->u8NameLength  = u8NameLength;
+    memcpy(psRecord->acName, psVar->pcName, u8NameLength);
+    
+    if (!psVar->pvData)
+    {
+        return E_JIP_OK;
+    }
+    psRecord->u8Flags |= JIP_SNAPSHOT_VAR_VALUE;
+    
+    if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        tsTable *psTable = psVar->ptData;
+        int64_t i64NumRowsOffset;
+        uint16_t u16NumRows = 0;
+        uint32_t i;
+        
+        if ((i64NumRowsOffset = i64Snapshot_Reserve(psBuffer, sizeof(uint16_t))) < 0)
+        {
+            return E_JIP_ERROR_NO_MEM;
+        }
+        
+        /* Row indices are 16 bits on the network too */
+        for (i = 0; (i < psTable->u32NumRows) && (i <= 0xFFFF); i++)
+        {
+            tsTableRow *psTableRow = &psTable->psRows[i];
+            tsJIP_SnapshotRow *psRow;
+            uint16_t u16Length;
+            
+            if (!psTableRow->pvData || (psTableRow->u32Length == 0))
+            {
+                continue;
+            }
+            u16Length = (psTableRow->u32Length > 0xFFFF) ? 0xFFFF : psTableRow->u32Length;
+            
+            if ((i64Offset = i64Snapshot_Reserve(psBuffer, sizeof(tsJIP_SnapshotRow) + u16Length)) < 0)
+            {
+                return E_JIP_ERROR_NO_MEM;
+            }
+            psRow = (tsJIP_SnapshotRow *)&psBuffer->pu8Data[i64Offset];
+            psRow->u16Index  = i;
+            psRow->u16Length = u16Length;
+            memcpy(&psBuffer->pu8Data[i64Offset + sizeof(tsJIP_SnapshotRow)], psTableRow->pvData, u16Length);
+            u16NumRows++;
+        }
+        memcpy(&psBuffer->pu8Data[i64NumRowsOffset], &u16NumRows, sizeof(uint16_t));
+    }
+    else
+    {
+        uint8_t u8Length = psVar->u8Size;
+        
+        if (psVar->eVarType == E_JIP_VAR_TYPE_STR)
+        {
+            /* Leave out the terminator */
+            u8Length = strnlen(psVar->pcData, psVar->u8Size);
+        }
+        
+        if ((i64Offset = i64Snapshot_Reserve(psBuffer, sizeof(uint8_t) + u8Length)) < 0)
+        {
+            return E_JIP_ERROR_NO_MEM;
+        }
+        psBuffer->pu8Data[i64Offset] = u8Length;
+        memcpy(&psBuffer->pu8Data[i64Offset + sizeof(uint8_t)], psVar->pvData, u8Length);
+    }
+    return E_JIP_OK;
+}
+
+
+/** Append a node, its MiBs and its variables to the snapshot.
+ *  Nodes and MiBs that have no records once filtered are left out, apart from nodes with no MiBs at all in a
+ *  snapshot of the whole network, which have yet to be discovered.
+ *  \return E_JIP_OK on success, even if nothing was appended
+ */
+static teJIP_Status eSnapshot_Node(tsSnapshotBuffer *psBuffer, tsNode *psNode, uint32_t u32MibIdFilter,
+                                   uint32_t u32SinceGeneration, uint32_t *pu32NumNodes)
+{
+    tsJIP_SnapshotNode *psNodeRecord;
+    tsMib *psMib;
+    uint16_t u16NumMibs = 0;
+    int64_t i64NodeOffset;
+    
+    if ((i64NodeOffset = i64Snapshot_Reserve(psBuffer, sizeof(tsJIP_SnapshotNode))) < 0)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    psNodeRecord = (tsJIP_SnapshotNode *)&psBuffer->pu8Data[i64NodeOffset];
+    memcpy(psNodeRecord->au8Address, &psNode->sNode_Address.sin6_addr, sizeof(psNodeRecord->au8Address));
+    psNodeRecord->u16Port       = psNode->sNode_Address.sin6_port;
+    psNodeRecord->u32DeviceId   = psNode->u32DeviceId;
+    
+    for (psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+    {
+        tsJIP_SnapshotMib *psMibRecord;
+        uint8_t u8NameLength = u8Snapshot_NameLength(psMib->pcName);
+        uint16_t u16NumVars = 0;
+        int64_t i64MibOffset;
+        tsVar *psVar;
+        
+        if ((u32MibIdFilter != E_JIP_MIBID_ALL) && (psMib->u32MibId != u32MibIdFilter))
+        {
+            continue;
+        }
+        
+        if ((i64MibOffset = i64Snapshot_Reserve(psBuffer, sizeof(tsJIP_SnapshotMib) + u8NameLength)) < 0)
+        {
+            return E_JIP_ERROR_NO_MEM;
+        }
+        psMibRecord = (tsJIP_SnapshotMib *)&psBuffer->pu8Data[i64MibOffset];
+        psMibRecord->u32MibId       = psMib->u32MibId;
+        psMibRecord->u8Index        = psMib->u8Index;
+        psMibRecord->u8NameLength   = u8NameLength;
+        memcpy(psMibRecord->acName, psMib->pcName, u8NameLength);
+        
+        for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+        {
+            if (u32SinceGeneration && ((int32_t)(psVar->u32Generation - u32SinceGeneration) <= 0))
+            {
+                /* Unchanged since the earlier snapshot */
+                continue;
+            }
+            if (eSnapshot_Var(psBuffer, psVar) != E_JIP_OK)
+            {
+                return E_JIP_ERROR_NO_MEM;
+            }
+            u16NumVars++;
+        }
+        
+        if (u32SinceGeneration && (u16NumVars == 0))
+        {
+            /* Nothing changed in this MiB */
+            psBuffer->u32Used = i64MibOffset;
+            continue;
+        }
+        /* The buffer may have moved */
+        psMibRecord = (tsJIP_SnapshotMib *)&psBuffer->pu8Data[i64MibOffset];
+        psMibRecord->u16NumVars = u16NumVars;
+        u16NumMibs++;
+    }
+    
+    if ((u16NumMibs == 0) && (u32SinceGeneration || (u32MibIdFilter != E_JIP_MIBID_ALL)))
+    {
+        psBuffer->u32Used = i64NodeOffset;
+        return E_JIP_OK;
+    }
+    psNodeRecord = (tsJIP_SnapshotNode *)&psBuffer->pu8Data[i64NodeOffset];
+    psNodeRecord->u16NumMibs = u16NumMibs;
+    (*pu32NumNodes)++;
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_GetNetworkSnapshot(tsJIP_Context *psJIP_Context, const uint32_t u32DeviceIdFilter, const uint32_t u32MibIdFilter,
+                                     const uint32_t u32SinceGeneration, uint8_t **ppu8Buffer, uint32_t *pu32Length)
+{
+    tsSnapshotBuffer sBuffer;
+    tsJIP_SnapshotHeader *psHeader;
+    tsJIPAddress *psAddresses = NULL;
+    uint32_t u32NumAddresses = 0;
+    uint32_t u32Generation;
+    uint32_t u32NumNodes = 0;
+    teJIP_Status eStatus;
+    uint32_t i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    /* Changes made while the snapshot is taken are given later generations, so they appear in the next one */
+    u32Generation = u32JIP_VarGeneration();
+    
+    if ((eStatus = eJIP_GetNodeAddressList(psJIP_Context, u32DeviceIdFilter, &psAddresses, &u32NumAddresses)) != E_JIP_OK)
+    {
+        return eStatus;
+    }
+    
+    sBuffer.u32Size = sizeof(tsJIP_SnapshotHeader) + (u32NumAddresses * SNAPSHOT_NODE_SIZE);
+    sBuffer.u32Used = sizeof(tsJIP_SnapshotHeader);
+    sBuffer.pu8Data = malloc(sBuffer.u32Size);
+    if (!sBuffer.pu8Data)
+    {
+        free(psAddresses);
+        return E_JIP_ERROR_NO_MEM;
+    }
+    
+    for (i = 0; (i < u32NumAddresses) && (eStatus == E_JIP_OK); i++)
+    {
+        /* Returns the node locked, as long as it is still in the network */
+        tsNode *psNode = psJIP_LookupNode(psJIP_Context, &psAddresses[i]);
+        
+        if (!psNode)
+        {
+            DBG_vPrintf(DBG_SNAPSHOT, "Node has been removed\n");
+            continue;
+        }
+        eStatus = eSnapshot_Node(&sBuffer, psNode, u32MibIdFilter, u32SinceGeneration, &u32NumNodes);
+        eJIP_UnlockNode(psNode);
+    }
+    free(psAddresses);
+    
+    if (eStatus != E_JIP_OK)
+    {
+        free(sBuffer.pu8Data);
+        return eStatus;
+    }
+    
+    psHeader = (tsJIP_SnapshotHeader *)sBuffer.pu8Data;
+    psHeader->u32Length     = sBuffer.u32Used;
+    psHeader->u32Generation = u32Generation;
+    psHeader->u32NumNodes   = u32NumNodes;
+    
+    DBG_vPrintf(DBG_SNAPSHOT, "Snapshot of %d nodes since generation %d is %d bytes, at generation %d\n",
+                u32NumNodes, u32SinceGeneration, sBuffer.u32Used, u32Generation);
+    
+    *ppu8Buffer = sBuffer.pu8Data;
+    *pu32Length = sBuffer.u32Used;
+    return E_JIP_OK;
+}
@@ -39,6 +39,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <endian.h>
+#include <time.h>
+#include <unistd.h>
 
 
 #include <JIP.h>
@@ -49,6 +51,55 @@
 #define DBG_FUNCTION_CALLS 0
 #define DBG_TABLES 0
 
+/** Number of times a table is read again from the start when it changes part way through being read */
+#define TABLE_READ_ATTEMPTS         3
+
+/** Smallest arena allocated for the rows of a table */
+#define TABLE_ARENA_MIN_SIZE        1024
+
+/** Rows are aligned in the arena as malloc would align them */
+#define TABLE_ARENA_ALIGN(x)        (((x) + 7) & ~7)
+
+
+/** Private state of a table variable, pointed to by its pvTablePriv.
+ *
+ *  A table read from the network keeps its rows in one arena rather than a block each,
+ *  and the row vector grows by doubling. Rows that are replaced by longer ones leave a
+ *  hole, until the arena is next grown, when the rows are packed into the new arena.
+ *
+ *  A table that is served stamps each row as it changes, from a counter that starts
+ *  again in a new epoch when the table is created, so that clients can ask for the
+ *  rows that have changed since they last read it.
+ */
+typedef struct
+{
+    int                 bArena;             /**< Set for a table read from the network */
+    
+    /* Tables read from the network */
+    uint8_t            *pu8Data;            /**< Row data */
+    uint32_t            u32Size;            /**< Allocated size of the arena */
+    uint32_t            u32Used;            /**< Bytes used, including holes */
+    uint32_t            u32RowsAllocated;   /**< Number of entries allocated in the table's row vector */
+    uint16_t            u16Version;         /**< Version of the table when it was last read */
+    int                 bVersionValid;      /**< Set when u16Version is the version of the rows held */
+    uint32_t            u32Unchanged;       /**< Number of reads since the table was last read in full */
+    uint16_t            u16Epoch;           /**< Epoch of the node's change stamp when the table was last read */
+    uint32_t            u32Stamp;           /**< Node's change stamp when the table was last read */
+    int                 bStampValid;        /**< Set when the rows held are those at u32Stamp */
+    int                 bStampSeen;         /**< Set once the node has sent a change stamp */
+    int                 bStampUnsupported;  /**< Set when the node refused a request for its change stamp */
+    
+    /* Tables served */
+    uint32_t           *pu32RowStamps;      /**< Stamp of each row when it last changed */
+    uint32_t            u32RowStampsAllocated;/**< Number of entries allocated in pu32RowStamps */
+    uint32_t            u32ServedStamp;     /**< Stamp of the last change */
+    uint16_t            u16ServedEpoch;     /**< Epoch of the stamps */
+} tsTablePriv;
+
+
+/** Epoch given to the last table served */
+static uint16_t u16TableEpoch = 0;
+
 
 static teJIP_Status JIP_Table_Check_Storage(tsVar *psVar, uint32_t u32LastRow)
 {
@@ -109,6 +160,247 @@ static teJIP_Status JIP_Table_Check_Storage(tsVar *psVar, uint32_t u32LastRow)
 }
 
 
+/** Make sure a table variable has arena storage, replacing any rows it had */
+static teJIP_Status JIP_Table_Arena_Init(tsVar *psVar)
+{
+    tsTablePriv *psTablePriv = (tsTablePriv *)psVar->pvTablePriv;
+    tsTable *psTable;
+    
+    if (psTablePriv && psTablePriv->bArena)
+    {
+        return E_JIP_OK;
+    }
+    
+    DBG_vPrintf(DBG_TABLES, "Allocating table arena\n");
+    if (psTablePriv)
+    {
+        /* Rows were stored locally */
+        free(psTablePriv->pu32RowStamps);
+    }
+    else
+    {
+        psVar->pvTablePriv = malloc(sizeof(tsTablePriv));
+        if (!psVar->pvTablePriv)
+        {
+            return E_JIP_ERROR_NO_MEM;
+        }
+    }
+    psTablePriv = (tsTablePriv *)psVar->pvTablePriv;
+    memset(psTablePriv, 0, sizeof(tsTablePriv));
+    psTablePriv->bArena = 1;
+    
+    if (psVar->pvData)
+    {
+        uint32_t i;
+        
+        /* Rows allocated individually */
+        psTable = (tsTable *)psVar->pvData;
+        for (i = 0; i < psTable->u32NumRows; i++)
+        {
+            free(psTable->psRows[i].pvData);
+        }
+        free(psTable->psRows);
+    }
+    else
+    {
+        psVar->pvData = malloc(sizeof(tsTable));
+        if (!psVar->pvData)
+        {
+            free(psVar->pvTablePriv);
+            psVar->pvTablePriv = NULL;
+            return E_JIP_ERROR_NO_MEM;
+        }
+    }
+    psTable = (tsTable *)psVar->pvData;
+    psTable->u32NumRows = 0;
+    psTable->psRows     = NULL;
+    return E_JIP_OK;
+}
+
+
+/** Make sure the row vector of a table with arena storage has a row at an index */
+static teJIP_Status JIP_Table_Arena_Check_Rows(tsVar *psVar, uint32_t u32Index)
+{
+    tsTablePriv *psArena = (tsTablePriv *)psVar->pvTablePriv;
+    tsTable *psTable = (tsTable *)psVar->pvData;
+    
+    if (u32Index >= psArena->u32RowsAllocated)
+    {
+        uint32_t u32RowsAllocated = psArena->u32RowsAllocated ? psArena->u32RowsAllocated : 16;
+        tsTableRow *psNewRows;
+        
+        while (u32Index >= u32RowsAllocated)
+        {
+            u32RowsAllocated *= 2;
+        }
+        DBG_vPrintf(DBG_TABLES, "Allocating storage for %d rows (old %d)\n", u32RowsAllocated, psArena->u32RowsAllocated);
+        psNewRows = realloc(psTable->psRows, sizeof(tsTableRow) * u32RowsAllocated);
+        if (!psNewRows)
+        {
+            return E_JIP_ERROR_NO_MEM;
+        }
+        memset(&psNewRows[psArena->u32RowsAllocated], 0, sizeof(tsTableRow) * (u32RowsAllocated - psArena->u32RowsAllocated));
+        psTable->psRows = psNewRows;
+        psArena->u32RowsAllocated = u32RowsAllocated;
+    }
+    if (u32Index >= psTable->u32NumRows)
+    {
+        psTable->u32NumRows = u32Index + 1;
+    }
+    return E_JIP_OK;
+}
+
+
+/** Store a row of a table with arena storage */
+static teJIP_Status JIP_Table_Arena_UpdateRow(tsVar *psVar, uint32_t u32Index, void *pvData, uint32_t u32Length)
+{
+    tsTablePriv *psArena = (tsTablePriv *)psVar->pvTablePriv;
+    tsTable *psTable;
+    tsTableRow *psTableRow;
+    teJIP_Status eStatus;
+    
+    if (u32Length == 0)
+    {
+        psTable = (tsTable *)psVar->pvData;
+        if (u32Index < psTable->u32NumRows)
+        {
+            psTable->psRows[u32Index].pvData    = NULL;
+            psTable->psRows[u32Index].u32Length = 0;
+        }
+        DBG_vPrintf(DBG_TABLES, "Table entry %d : Emptied\n", u32Index);
+        return E_JIP_OK;
+    }
+    
+    if ((eStatus = JIP_Table_Arena_Check_Rows(psVar, u32Index)) != E_JIP_OK)
+    {
+        return eStatus;
+    }
+    psTable = (tsTable *)psVar->pvData;
+    psTableRow = &psTable->psRows[u32Index];
+    
+    if (psTableRow->pvData && (u32Length <= psTableRow->u32Length))
+    {
+        /* Fits where the row was */
+        memmove(psTableRow->pvData, pvData, u32Length);
+        psTableRow->u32Length = u32Length;
+        return E_JIP_OK;
+    }
+    
+    if ((psArena->u32Used + TABLE_ARENA_ALIGN(u32Length)) > psArena->u32Size)
+    {
+        /* Pack the rows into a new arena, with room for as many again */
+        uint32_t u32Live = TABLE_ARENA_ALIGN(u32Length);
+        uint32_t u32Size, i;
+        uint8_t *pu8Data;
+        
+        for (i = 0; i < psTable->u32NumRows; i++)
+        {
+            if (psTable->psRows[i].pvData && (i != u32Index))
+            {
+                u32Live += TABLE_ARENA_ALIGN(psTable->psRows[i].u32Length);
+            }
+        }
+        u32Size = u32Live * 2;
+        if (u32Size < TABLE_ARENA_MIN_SIZE)
+        {
+            u32Size = TABLE_ARENA_MIN_SIZE;
+        }
+        
+        DBG_vPrintf(DBG_TABLES, "Packing %d bytes of rows into arena of %d bytes (old %d)\n", u32Live, u32Size, psArena->u32Size);
+        pu8Data = malloc(u32Size);
+        if (!pu8Data)
+        {
+            return E_JIP_ERROR_NO_MEM;
+        }
+        
+        psArena->u32Used = 0;
+        for (i = 0; i < psTable->u32NumRows; i++)
+        {
+            tsTableRow *psRow = &psTable->psRows[i];
+            if (psRow->pvData && (i != u32Index))
+            {
+                memcpy(&pu8Data[psArena->u32Used], psRow->pvData, psRow->u32Length);
+                psRow->pvData = &pu8Data[psArena->u32Used];
+                psArena->u32Used += TABLE_ARENA_ALIGN(psRow->u32Length);
+            }
+        }
+        /* The new row may have come from the old arena */
+        memcpy(&pu8Data[psArena->u32Used], pvData, u32Length);
+        
+        free(psArena->pu8Data);
+        psArena->pu8Data = pu8Data;
+        psArena->u32Size = u32Size;
+    }
+    else
+    {
+        memmove(&psArena->pu8Data[psArena->u32Used], pvData, u32Length);
+    }
+    
+    psTableRow->pvData    = &psArena->pu8Data[psArena->u32Used];
+    psTableRow->u32Length = u32Length;
+    psArena->u32Used += TABLE_ARENA_ALIGN(u32Length);
+    return E_JIP_OK;
+}
+
+
+/** Stamp a row of a served table as changed. If the stamp can not be stored, the table
+ *  starts a new epoch, so that clients read it in full */
+static void JIP_Table_StampRow(tsVar *psVar, uint32_t u32Index)
+{
+    tsTablePriv *psTablePriv = (tsTablePriv *)psVar->pvTablePriv;
+    
+    if (!psTablePriv)
+    {
+        psTablePriv = malloc(sizeof(tsTablePriv));
+        if (!psTablePriv)
+        {
+            /* Without stamps the table is always sent in full */
+            return;
+        }
+        memset(psTablePriv, 0, sizeof(tsTablePriv));
+        
+        if (u16TableEpoch == 0)
+        {
+            /* Epochs differ from those of an earlier run */
+            u16TableEpoch = (uint16_t)(time(NULL) ^ getpid());
+        }
+        if (++u16TableEpoch == 0)
+        {
+            u16TableEpoch++;
+        }
+        psTablePriv->u16ServedEpoch = u16TableEpoch;
+        psVar->pvTablePriv = psTablePriv;
+    }
+    
+    if (u32Index >= psTablePriv->u32RowStampsAllocated)
+    {
+        uint32_t u32RowStampsAllocated = psTablePriv->u32RowStampsAllocated ? psTablePriv->u32RowStampsAllocated : 16;
+        uint32_t *pu32RowStamps;
+        
+        while (u32Index >= u32RowStampsAllocated)
+        {
+            u32RowStampsAllocated *= 2;
+        }
+        pu32RowStamps = realloc(psTablePriv->pu32RowStamps, sizeof(uint32_t) * u32RowStampsAllocated);
+        if (!pu32RowStamps)
+        {
+            DBG_vPrintf(DBG_TABLES, "Could not allocate row stamps, starting new epoch\n");
+            if (++psTablePriv->u16ServedEpoch == 0)
+            {
+                psTablePriv->u16ServedEpoch++;
+            }
+            return;
+        }
+        memset(&pu32RowStamps[psTablePriv->u32RowStampsAllocated], 0, 
+               sizeof(uint32_t) * (u32RowStampsAllocated - psTablePriv->u32RowStampsAllocated));
+        psTablePriv->pu32RowStamps          = pu32RowStamps;
+        psTablePriv->u32RowStampsAllocated  = u32RowStampsAllocated;
+    }
+    
+    psTablePriv->pu32RowStamps[u32Index] = ++psTablePriv->u32ServedStamp;
+}
+
+
 teJIP_Status eJIP_Table_UpdateRow(tsVar *psVar, uint32_t u32Index, void *pvData, uint32_t u32Length)
 {
     teJIP_Status eStatus;
@@ -118,6 +410,15 @@ teJIP_Status eJIP_Table_UpdateRow(tsVar *psVar, uint32_t u32Index, void *pvData,
     void *pvNewData;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psVar->pvTablePriv && ((tsTablePriv *)psVar->pvTablePriv)->bArena)
+    {
+        if ((eStatus = JIP_Table_Arena_UpdateRow(psVar, u32Index, pvData, u32Length)) == E_JIP_OK)
+        {
+            vJIP_VarGenerationStamp(psVar);
+        }
+        return eStatus;
+    }
 
     if ((eStatus = JIP_Table_Check_Storage(psVar, u32Index)) != E_JIP_OK)
     {
@@ -127,6 +428,14 @@ teJIP_Status eJIP_Table_UpdateRow(tsVar *psVar, uint32_t u32Index, void *pvData,
     psTable = (tsTable *)psVar->pvData;
     psTableRow = &psTable->psRows[u32Index];
     
+    if ((u32Length == psTableRow->u32Length) &&
+        ((u32Length == 0) ? !psTableRow->pvData : (memcmp(psTableRow->pvData, pvData, u32Length) == 0)))
+    {
+        /* Unchanged */
+        return E_JIP_OK;
+    }
+    JIP_Table_StampRow(psVar, u32Index);
+    
     if (u32Length == 0)
     {
         /* New length is 0 - free the old data and set the pointer to NULL */
@@ -158,20 +467,90 @@ teJIP_Status eJIP_Table_UpdateRow(tsVar *psVar, uint32_t u32Index, void *pvData,
         }
         DBG_vPrintf(DBG_TABLES, "\n");
     }
+    vJIP_VarGenerationStamp(psVar);
     return E_JIP_OK;
 }
 
 
+void vJIP_Table_Free(tsVar *psVar)
+{
+    tsTablePriv *psTablePriv = (tsTablePriv *)psVar->pvTablePriv;
+    tsTable *psTable = (tsTable *)psVar->pvData;
+    uint32_t i;
+    
+    if (psTablePriv && psTablePriv->bArena)
+    {
+        /* Rows are in the arena */
+        free(psTablePriv->pu8Data);
+    }
+    else if (psTable)
+    {
+        for (i = 0; i < psTable->u32NumRows; i++)
+        {
+            free(psTable->psRows[i].pvData);
+        }
+    }
+    
+    if (psTablePriv)
+    {
+        free(psTablePriv->pu32RowStamps);
+        free(psTablePriv);
+        psVar->pvTablePriv = NULL;
+    }
+    
+    if (psTable)
+    {
+        free(psTable->psRows);
+        free(psTable);
+    }
+    psVar->pvData = NULL;
+}
+
+
+/** Empty the rows of a table from one index up to, but not including, another */
+static void JIP_Table_EmptyRows(tsVar *psVar, uint32_t u32From, uint32_t u32To)
+{
+    tsTable *psTable = (tsTable *)psVar->pvData;
+    
+    for (; (u32From < u32To) && (u32From < psTable->u32NumRows); u32From++)
+    {
+        if (psTable->psRows[u32From].pvData)
+        {
+            eJIP_Table_UpdateRow(psVar, u32From, NULL, 0);
+        }
+    }
+}
+
+
+/** Empty the rows at the end of a table, after rows have been removed */
+static void JIP_Table_TrimRows(tsVar *psVar)
+{
+    tsTable *psTable = (tsTable *)psVar->pvData;
+    
+    while ((psTable->u32NumRows > 0) && !psTable->psRows[psTable->u32NumRows - 1].pvData)
+    {
+        psTable->u32NumRows--;
+    }
+}
+
+
 teJIP_Status eJIP_GetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar)
 {
     PRIVATE_CONTEXT(psJIP_Context);
-    uint16_t u16TableEntriesRemainaing = 255;
+    uint16_t u16TableEntriesRemainaing;
     uint16_t u16StartIndex = 0;
     uint16_t u16TableVersion = 0;
     uint32_t u32FirstTime = 1;
-    uint32_t u32TotalEntries = 0;
+    uint32_t u32NextRow = 0;
+    uint32_t u32Changed = 0;
+    int iAttempt = 0;
+    int bComplete = 0;
+    int bAskStamp;
+    int bChanges = 0;
+    tsJIP_Msg_TableChangesSince sStamp;
     tsMib *psMib = psVar->psOwnerMib;
     tsNode *psNode = psMib->psOwnerNode;
+    tsTablePriv *psArena;
     teJIP_Status eStatus = E_JIP_OK;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
@@ -182,37 +561,69 @@ teJIP_Status eJIP_GetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar)
     
     eJIP_LockNode(psNode, True);
     
-    if (psVar->pvData)
+    /* Existing rows are kept, and compared with those read, so that unchanged rows are not copied again */
+    if ((eStatus = JIP_Table_Arena_Init(psVar)) != E_JIP_OK)
     {
-        /* Remove all existing entries before we start reading the new content */
-        uint32_t i;
-        tsTable *psTable = (tsTable *)psVar->pvData;
-        for (i = 0; i < psTable->u32NumRows; i++)
-        {
-            eJIP_Table_UpdateRow(psVar, i, NULL, 0);
-        }
+        eJIP_UnlockNode(psNode);
+        return eStatus;
     }
+    psArena = (tsTablePriv *)psVar->pvTablePriv;
+    
+    memset(&sStamp, 0, sizeof(sStamp));
 
-    do
+    while (!bComplete)
     {
-        char buffer[1024];
+        char buffer[JIP_PACKET_MAX_SIZE];
         tsJIP_Msg_GetMibRequest *psJIP_Msg_GetMibRequest = (tsJIP_Msg_GetMibRequest *)buffer;
+        tsJIP_Msg_TableChangesSince *psSince = (tsJIP_Msg_TableChangesSince *)&buffer[sizeof(tsJIP_Msg_GetMibRequest)];
         uint32_t u32ResponseLen = sizeof(buffer);
+        uint32_t u32RequestLen = sizeof(tsJIP_Msg_GetMibRequest);
         tsJIP_Msg_VarDescriptionHeader *psVarDescriptionHeader;
         tsJIP_Msg_VarDescription_Table *psVarDescriptionTable;
         teNetworkStatus eNetStatus;
+        uint32_t u32PageEntries = 0;
+        
+        /* Ask the node for its change stamp, and for the rows changed since the rows held,
+         * unless tables are read in full every time or the node refused the request */
+        bAskStamp = (psJIP_Context->iTableRereadInterval > 0) && !psArena->bStampUnsupported;
+        if (u32FirstTime)
+        {
+            bChanges = bAskStamp && psArena->bStampValid &&
+                       (psArena->u32Unchanged < (uint32_t)psJIP_Context->iTableRereadInterval);
+        }
         
         psJIP_Msg_GetMibRequest->u32MibId               = htonl(psVar->psOwnerMib->u32MibId);
         psJIP_Msg_GetMibRequest->sRequest.u8VarIndex    = psVar->u8Index;
         psJIP_Msg_GetMibRequest->sRequest.u16FirstEntry = htons(u16StartIndex);
         psJIP_Msg_GetMibRequest->sRequest.u8EntryCount  = 0xff;
+        if (bAskStamp)
+        {
+            psSince->u16Epoch = htons(bChanges ? psArena->u16Epoch : 0);
+            psSince->u32Stamp = htonl(bChanges ? psArena->u32Stamp : 0);
+            u32RequestLen += sizeof(tsJIP_Msg_TableChangesSince);
+        }
     
         eNetStatus = Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psVar->psOwnerMib->psOwnerNode, 3, E_JIP_FLAG_STAY_AWAKE,
-                                         E_JIP_COMMAND_GET_MIB_REQUEST, buffer, sizeof(tsJIP_Msg_GetMibRequest), 
+                                         E_JIP_COMMAND_GET_MIB_REQUEST, buffer, u32RequestLen, 
                                          E_JIP_COMMAND_GET_RESPONSE, buffer, &u32ResponseLen);
+        
+        psVarDescriptionHeader = (tsJIP_Msg_VarDescriptionHeader *)buffer;
+        psVarDescriptionTable  = (tsJIP_Msg_VarDescription_Table *)buffer;
+        
+        if (u32FirstTime && bAskStamp && !psArena->bStampSeen && (eNetStatus == E_NETWORK_OK) &&
+            (psVarDescriptionHeader->eStatus != E_JIP_OK) && (psVarDescriptionHeader->eStatus != E_JIP_ERROR_DISABLED))
+        {
+            /* The node does not accept the change stamp. Ask again without it, and don't ask it again.
+             * A request that was not answered at all fails as any other would. */
+            DBG_vPrintf(DBG_TABLES, "Request for change stamp refused (status 0x%02x)\n", psVarDescriptionHeader->eStatus);
+            psArena->bStampUnsupported = 1;
+            continue;
+        }
+        
         if (eNetStatus!= E_NETWORK_OK)
         {
             DBG_vPrintf(DBG_TABLES, "Error getting table variable\n");
+            psArena->bVersionValid = 0;
             eJIP_UnlockNode(psNode);
             
             if (eNetStatus == E_NETWORK_ERROR_TIMEOUT)
@@ -229,19 +640,18 @@ teJIP_Status eJIP_GetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar)
             }
         }
         
-        psVarDescriptionHeader = (tsJIP_Msg_VarDescriptionHeader *)buffer;
-        psVarDescriptionTable  = (tsJIP_Msg_VarDescription_Table *)buffer;
-        
         if (psVarDescriptionHeader->eStatus == E_JIP_ERROR_DISABLED)
         {
             DBG_vPrintf(DBG_TABLES, "Variable disabled\n");
             psVar->eEnable = E_JIP_VAR_DISABLED;
+            psArena->bVersionValid = 0;
             eJIP_UnlockNode(psNode);
             return E_JIP_ERROR_DISABLED;
         }
         else if (psVarDescriptionHeader->eStatus != E_JIP_OK)
         {
             DBG_vPrintf(DBG_TABLES, "Error reading (status 0x%02x)\n", psVarDescriptionHeader->eStatus);
+            psArena->bVersionValid = 0;
             eJIP_UnlockNode(psNode);
             return psVarDescriptionHeader->eStatus;
         }
@@ -249,121 +659,277 @@ teJIP_Status eJIP_GetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar)
         if (psVarDescriptionHeader->eVarType != psVar->eVarType)
         {
             DBG_vPrintf(DBG_TABLES, "Type mismatch (got %d, expected %d)\n", psVarDescriptionHeader->eVarType, psVar->eVarType);
+            psArena->bVersionValid = 0;
             eJIP_UnlockNode(psNode);
             return E_JIP_ERROR_WRONG_TYPE;
         }
         
+        if (u32ResponseLen < sizeof(tsJIP_Msg_VarDescription_Table))
+        {
+            DBG_vPrintf(DBG_TABLES, "Short response (%d bytes)\n", u32ResponseLen);
+            psArena->bVersionValid = 0;
+            eJIP_UnlockNode(psNode);
+            return E_JIP_ERROR_FAILED;
+        }
+        
         u16TableEntriesRemainaing = ntohs(psVarDescriptionTable->u16Remaining);
         
         if (u32FirstTime)
         {
+            tsJIP_Msg_VarDescription_Table_Entry *Table_Entry = (tsJIP_Msg_VarDescription_Table_Entry *)psVarDescriptionTable->au8Table;
+            
             u16TableVersion = ntohs(psVarDescriptionTable->u16TableVersion);
+            u32FirstTime = 0;
+            
+            /* The change stamp comes first, if the node keeps them */
+            if (bAskStamp &&
+                (u32ResponseLen >= (sizeof(tsJIP_Msg_VarDescription_Table) + sizeof(tsJIP_Msg_VarDescription_Table_Entry) + sizeof(tsJIP_Msg_TableChangesSince))) &&
+                (ntohs(Table_Entry->u16Entry) == JIP_TABLE_CHANGE_STAMP_ENTRY) && (Table_Entry->u8Len == sizeof(tsJIP_Msg_TableChangesSince)))
+            {
+                memcpy(&sStamp, Table_Entry->au8Blob, sizeof(tsJIP_Msg_TableChangesSince));
+                psArena->bStampSeen = 1;
+            }
+            else
+            {
+                sStamp.u16Epoch = 0;
+            }
+            
+            /* Changes are only sent since a stamp of the same epoch */
+            bChanges = bChanges && sStamp.u16Epoch && (ntohs(sStamp.u16Epoch) == psArena->u16Epoch);
+            
+            if (!bChanges)
+            {
+                if (psArena->bVersionValid && (psArena->u16Version == u16TableVersion) &&
+                    (psArena->u32Unchanged < (uint32_t)psJIP_Context->iTableRereadInterval))
+                {
+                    /* The rows held are those of this version */
+                    DBG_vPrintf(DBG_TABLES, "Table version 0x%04x unchanged\n", u16TableVersion);
+                    psArena->u32Unchanged++;
+                    psVar->eEnable = E_JIP_VAR_ENABLED;
+                    eJIP_UnlockNode(psNode);
+                    return E_JIP_OK;
+                }
+                /* The rows are read in full */
+                psArena->bStampValid = 0;
+            }
+            /* Rows changed since the stamp held are still those read if this read fails part way */
+            psArena->bVersionValid = 0;
         }
         else
         {
             if (u16TableVersion != ntohs(psVarDescriptionTable->u16TableVersion))
             {
-                u16StartIndex = 0;
+                DBG_vPrintf(DBG_TABLES, "Table version changed while reading\n");
+                if (++iAttempt < TABLE_READ_ATTEMPTS)
+                {
+                    /* Read it again from the start */
+                    u16StartIndex = 0;
+                    u32NextRow = 0;
+                    u32FirstTime = 1;
+                    continue;
+                }
+                /* Keep what has been read, but read it in full next time */
+                DBG_vPrintf(DBG_TABLES, "Table changing too often to read\n");
                 break;
             }
         }
         
-        DBG_vPrintf(DBG_TABLES, "Table version: 0x%04x, remaining: %d\n", ntohs(psVarDescriptionTable->u16TableVersion), ntohs(psVarDescriptionTable->u16Remaining));
+        DBG_vPrintf(DBG_TABLES, "Table version: 0x%04x, remaining: %d%s\n", ntohs(psVarDescriptionTable->u16TableVersion), 
+                    ntohs(psVarDescriptionTable->u16Remaining), bChanges ? ", changed rows" : "");
         {
             uint32_t u32Packet_Offset = 0;
+            uint32_t u32TableLength = u32ResponseLen - sizeof(tsJIP_Msg_VarDescription_Table);
+            tsTable *psTable = (tsTable *)psVar->pvData;
             
-            while (u32Packet_Offset < (u32ResponseLen - sizeof(tsJIP_Msg_VarDescription_Table)))
+            while ((u32Packet_Offset + sizeof(tsJIP_Msg_VarDescription_Table_Entry)) <= u32TableLength)
             {
-                u32TotalEntries++;
-                switch (psVarDescriptionHeader->eVarType)
+                tsJIP_Msg_VarDescription_Table_Entry *Table_Entry = (tsJIP_Msg_VarDescription_Table_Entry *)((uint8_t *)psVarDescriptionTable->au8Table + u32Packet_Offset);
+                uint32_t u32Index = ntohs(Table_Entry->u16Entry);
+                
+                DBG_vPrintf(DBG_TABLES, "Got table entry at offset %d (%p): index %d, length %d\n", u32Packet_Offset, Table_Entry, u32Index, Table_Entry->u8Len);
+                
+                if ((u32Packet_Offset + sizeof(tsJIP_Msg_VarDescription_Table_Entry) + Table_Entry->u8Len) > u32TableLength)
+                {
+                    DBG_vPrintf(DBG_TABLES, "Table entry runs past the end of the response\n");
+                    break;
+                }
+                u32Packet_Offset += sizeof(tsJIP_Msg_VarDescription_Table_Entry) + Table_Entry->u8Len;
+                
+                if (bAskStamp && (u32Index == JIP_TABLE_CHANGE_STAMP_ENTRY))
+                {
+                    /* Read with the first page */
+                    continue;
+                }
+                
+                if (u32Index < u32NextRow)
+                {
+                    /* Rows are sent in order */
+                    continue;
+                }
+                
+                if (!bChanges)
+                {
+                    /* Rows skipped over are now empty */
+                    JIP_Table_EmptyRows(psVar, u32NextRow, u32Index);
+                }
+                
+                psTable = (tsTable *)psVar->pvData;
+                if (Table_Entry->u8Len == 0)
+                {
+                    /* A changed row that has been removed */
+                    if ((u32Index < psTable->u32NumRows) && psTable->psRows[u32Index].pvData)
+                    {
+                        JIP_Table_EmptyRows(psVar, u32Index, u32Index + 1);
+                        u32Changed++;
+                    }
+                }
+                else if ((u32Index >= psTable->u32NumRows) ||
+                    (psTable->psRows[u32Index].u32Length != Table_Entry->u8Len) ||
+                    (memcmp(psTable->psRows[u32Index].pvData, Table_Entry->au8Blob, Table_Entry->u8Len) != 0))
                 {
-                    case(E_JIP_VAR_TYPE_TABLE_BLOB):
+                    if ((eStatus = eJIP_Table_UpdateRow(psVar, u32Index, Table_Entry->au8Blob, Table_Entry->u8Len)) != E_JIP_OK)
                     {
-                        tsJIP_Msg_VarDescription_Table_Entry *Table_Entry = (tsJIP_Msg_VarDescription_Table_Entry *)((uint8_t *)psVarDescriptionTable->au8Table + u32Packet_Offset);
-                        
-                        DBG_vPrintf(DBG_TABLES, "Got table entry at offset %d (%p): index %d, length %d\n", u32Packet_Offset, Table_Entry, ntohs(Table_Entry->u16Entry), Table_Entry->u8Len);
-                        
-                        {
-                            uint32_t u32Index = ntohs(Table_Entry->u16Entry);
-                            eJIP_Table_UpdateRow(psVar, u32Index, Table_Entry->au8Blob, Table_Entry->u8Len);
-                            u32Packet_Offset += (3 + Table_Entry->u8Len);
-                            u16StartIndex = u32Index + 1;
-                        }
-                        break;
+                        eJIP_UnlockNode(psNode);
+                        return eStatus;
                     }
-                    default:
-                        DBG_vPrintf(DBG_TABLES, "Not a table variable\n");
-                        break;
+                    u32Changed++;
                 }
+                
+                u32NextRow = u32Index + 1;
+                u16StartIndex = u32Index + 1;
+                u32PageEntries++;
             }
         }
-    } while (u16TableEntriesRemainaing > 0);
+        
+        if ((u16TableEntriesRemainaing > 0) && (u32PageEntries == 0))
+        {
+            /* The node is not making progress through the table */
+            DBG_vPrintf(DBG_TABLES, "No entries read with %d remaining\n", u16TableEntriesRemainaing);
+            eJIP_UnlockNode(psNode);
+            return E_JIP_ERROR_FAILED;
+        }
+        bComplete = (u16TableEntriesRemainaing == 0);
+    }
     
-    if (u32TotalEntries == 0)
+    if (bComplete)
     {
-        eStatus = JIP_Table_Check_Storage(psVar, -1);
+        tsTable *psTable = (tsTable *)psVar->pvData;
+        
+        if (bChanges)
+        {
+            /* Only changed rows were read */
+            JIP_Table_TrimRows(psVar);
+            psArena->u32Unchanged++;
+        }
+        else
+        {
+            /* Rows after the last one read are gone */
+            JIP_Table_EmptyRows(psVar, u32NextRow, psTable->u32NumRows);
+            psTable->u32NumRows = u32NextRow;
+            psArena->u32Unchanged = 0;
+        }
+        
+        psArena->u16Version     = u16TableVersion;
+        psArena->bVersionValid  = 1;
+        
+        if (sStamp.u16Epoch)
+        {
+            psArena->u16Epoch       = ntohs(sStamp.u16Epoch);
+            psArena->u32Stamp       = ntohl(sStamp.u32Stamp);
+            psArena->bStampValid    = 1;
+        }
     }
+    DBG_vPrintf(DBG_TABLES, "Table read, %d rows changed\n", u32Changed);
     
     // Set the variable as enabled
     psVar->eEnable = E_JIP_VAR_ENABLED;
     
     eJIP_UnlockNode(psNode);
-    return eStatus;
+    return E_JIP_OK;
 }
 
 
 
 teJIP_Status eJIPserver_HandleGetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar, 
                                           uint16_t u16FirstEntry, uint8_t u8EntryCount,
+                                          const tsJIP_Msg_TableChangesSince *psSince,
                                           uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
     tsJIP_Msg_VarDescription_Table *psVarDescriptionTable  = (tsJIP_Msg_VarDescription_Table *)pcSendData;
     tsTable *psTable = (tsTable *)psVar->pvData;
+    tsTablePriv *psTablePriv = (tsTablePriv *)psVar->pvTablePriv;
     tsTableRow *psTableRow;
     int i, j;
     uint32_t u32Packet_Offset, u32Hash = 0;
+    uint32_t u32Since = 0;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s: Get table rows start %d, num %d\n", 
                 __FUNCTION__, u16FirstEntry, u8EntryCount);
     
     DBG_vPrintf(DBG_TABLES, "%s: Table has %d rows\n", __FUNCTION__, psTable->u32NumRows);
+    
+    /* The version is a hash of every row, which clients compare with the version of the rows
+     * they already have to decide whether to read the table again. An FNV-1a hash of the index,
+     * length and data of each row changes with any byte of the table, wherever it is.
+     */
+    u32Hash = 2166136261u;
     for (i = 0; i < psTable->u32NumRows; i++)
     {
         psTableRow = &psTable->psRows[i];
-        DBG_vPrintf(DBG_TABLES, "%s: Hash row %d (length %d, data: %p\n", __FUNCTION__, i, psTableRow->u32Length, psTableRow->pvData);
         
         if (psTableRow->pvData)
         {
-            /* XOR 32 bit words from the row */
-            for (j = 0; j < (psTableRow->u32Length / sizeof(uint32_t)); j++)
-            {
-                u32Hash ^= ((uint32_t *)psTableRow->pvData)[j];
-            }
-            /* Now any remaining bytes */
-            for (; j < psTableRow->u32Length; j++)
+            DBG_vPrintf(DBG_TABLES, "%s: Hash row %d (length %d, data: %p\n", __FUNCTION__, i, psTableRow->u32Length, psTableRow->pvData);
+            
+            u32Hash = (u32Hash ^ (i & 0xFF))                            * 16777619u;
+            u32Hash = (u32Hash ^ (i >> 8))                              * 16777619u;
+            u32Hash = (u32Hash ^ psTableRow->u32Length)                 * 16777619u;
+            for (j = 0; j < psTableRow->u32Length; j++)
             {
-                u32Hash ^= ((uint8_t *)psTableRow->pvData)[j];
+                u32Hash = (u32Hash ^ ((uint8_t *)psTableRow->pvData)[j])  * 16777619u;
             }
         }
-        // Rotate hash
-        u32Hash = u32Hash >> 1 | (u32Hash << (sizeof(uint32_t) * 8 - 1));
     }
+    /* Fold into the 16 bits of the version */
+    u32Hash ^= u32Hash >> 16;
     
     DBG_vPrintf(DBG_TABLES, "%s: Table Version: 0x%04x\n", __FUNCTION__, u32Hash & 0xFFFF);
     
     u32Packet_Offset = sizeof(tsJIP_Msg_VarDescription_Table);
     
+    if (psSince && psTablePriv && !psTablePriv->bArena && psTablePriv->u32ServedStamp)
+    {
+        if (u16FirstEntry == 0)
+        {
+            /* Send the change stamp first, in the first page */
+            tsJIP_Msg_VarDescription_Table_Entry *psEntry = (tsJIP_Msg_VarDescription_Table_Entry *)&pcSendData[u32Packet_Offset];
+            tsJIP_Msg_TableChangesSince *psStamp = (tsJIP_Msg_TableChangesSince *)psEntry->au8Blob;
+            
+            psEntry->u16Entry   = htons(JIP_TABLE_CHANGE_STAMP_ENTRY);
+            psEntry->u8Len      = sizeof(tsJIP_Msg_TableChangesSince);
+            psStamp->u16Epoch   = htons(psTablePriv->u16ServedEpoch);
+            psStamp->u32Stamp   = htonl(psTablePriv->u32ServedStamp);
+            u32Packet_Offset += sizeof(tsJIP_Msg_VarDescription_Table_Entry) + sizeof(tsJIP_Msg_TableChangesSince);
+        }
+        
+        if (ntohs(psSince->u16Epoch) == psTablePriv->u16ServedEpoch)
+        {
+            u32Since = ntohl(psSince->u32Stamp);
+        }
+        DBG_vPrintf(DBG_TABLES, "%s: Change stamp %d, sending changes since %d\n", __FUNCTION__, psTablePriv->u32ServedStamp, u32Since);
+    }
+    
     for (i = u16FirstEntry, j = 0;
         (i < psTable->u32NumRows) && (j < u8EntryCount);
         i++)
     {
         DBG_vPrintf(DBG_TABLES, "%s: Examine table row %d\n", __FUNCTION__, i);
         psTableRow = &psTable->psRows[i];
-        if (psTableRow->pvData)
+        if (u32Since ? ((i < psTablePriv->u32RowStampsAllocated) && (psTablePriv->pu32RowStamps[i] > u32Since)) : (psTableRow->pvData != NULL))
         {
             tsJIP_Msg_VarDescription_Table_Entry *psEntry = (tsJIP_Msg_VarDescription_Table_Entry *)&pcSendData[u32Packet_Offset];
 
-            if ((u32Packet_Offset + sizeof(tsJIP_Msg_VarDescription_Table_Entry) + psTableRow->u32Length) > 1024)
+            if ((u32Packet_Offset + sizeof(tsJIP_Msg_VarDescription_Table_Entry) + psTableRow->u32Length) > JIP_PACKET_MAX_SIZE)
             {
                 // Stop when the packet gets close to Ethernet MTU.
                 break;
@@ -371,11 +937,12 @@ teJIP_Status eJIPserver_HandleGetTableVar(tsJIP_Context *psJIP_Context, tsVar *p
             
             DBG_vPrintf(DBG_TABLES, "%s: Add row %d (length %d) to packet\n", __FUNCTION__, i, psTableRow->u32Length);
             
+            /* A row that has changed since the stamp and is empty has been removed */
             psEntry->u16Entry   = htons(i);
-            psEntry->u8Len      = psTableRow->u32Length;
-            memcpy(psEntry->au8Blob, psTableRow->pvData, psTableRow->u32Length);
+            psEntry->u8Len      = psTableRow->pvData ? psTableRow->u32Length : 0;
+            memcpy(psEntry->au8Blob, psTableRow->pvData, psEntry->u8Len);
             
-            u32Packet_Offset += sizeof(tsJIP_Msg_VarDescription_Table_Entry) + psTableRow->u32Length;
+            u32Packet_Offset += sizeof(tsJIP_Msg_VarDescription_Table_Entry) + psEntry->u8Len;
             j++;
         }    
     }
@@ -385,7 +952,7 @@ teJIP_Status eJIPserver_HandleGetTableVar(tsJIP_Context *psJIP_Context, tsVar *p
          i++)
     {
         psTableRow = &psTable->psRows[i];
-        if (psTableRow->pvData)
+        if (u32Since ? ((i < psTablePriv->u32RowStampsAllocated) && (psTablePriv->pu32RowStamps[i] > u32Since)) : (psTableRow->pvData != NULL))
         {
             j++;
         }
@@ -395,10 +962,9 @@ teJIP_Status eJIPserver_HandleGetTableVar(tsJIP_Context *psJIP_Context, tsVar *p
     
     psVarDescriptionTable->sHeader.eStatus  = E_JIP_OK;
     psVarDescriptionTable->u16Remaining     = htons(j);
-    psVarDescriptionTable->u16TableVersion  = (uint16_t)u32Hash;
+    psVarDescriptionTable->u16TableVersion  = htons((uint16_t)u32Hash);
     
     *piSendDataLength                       = u32Packet_Offset;
     
     return E_JIP_OK;
 }
-
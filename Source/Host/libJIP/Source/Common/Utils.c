@@ -48,8 +48,15 @@
 #include <sys/time.h>
 #include <pthread.h>
 #include <sched.h>
+#include <unistd.h>
+#include <semaphore.h>
 #endif /* WIN32 */
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif /* __linux__ */
+
 #include <Utils.h>
 
 #ifndef DBG_THREADS
@@ -60,6 +67,12 @@
 #define DBG_QUEUE   0
 #endif /* DBG_QUEUE */
 
+#ifndef DBG_LOCK_PROFILE
+#define DBG_LOCK_PROFILE 0
+#endif /* DBG_LOCK_PROFILE */
+
+/** Signal sent to a thread to interrupt its system calls. When sent to the process
+ *  from outside it requests a lock profile report instead. */
 #define THREAD_SIGNAL SIGUSR1
 
 
@@ -118,6 +131,13 @@ SleepConditionVariableSRW (
 #endif /* WIN32 */
 
 
+/** Set when requests should be traced */
+static volatile int iLatencyEnabled = 1;
+
+/** Trace of the request being handled by each thread */
+static __thread tsUtilsLatencyTrace sLatencyTrace;
+
+
 /************************** Threads Functionality ****************************/
 
 /** Structure representing an OS independant thread */
@@ -134,12 +154,50 @@ typedef struct
 
 
 #ifndef WIN32
+static void vLockProfileReportSignal(void);
+
 /** Signal handler to receive THREAD_SIGNAL.
- *  This is just used to interrupt system calls such as recv() and sleep().
+ *  Sent to a thread, this is just used to interrupt system calls such as recv() and sleep().
+ *  Sent to the process, by kill(), it wakes the lock profile report thread.
  */
-static void thread_signal_handler(int sig)
+static void thread_signal_handler(int sig, siginfo_t *psInfo, void *pvContext)
 {
     DBG_vPrintf(DBG_THREADS, "Signal %d received\n", sig);
+    
+    if (psInfo && ((psInfo->si_code == SI_USER) || (psInfo->si_code == SI_QUEUE)))
+    {
+        vLockProfileReportSignal();
+    }
+}
+
+
+/** Install the handler for THREAD_SIGNAL, if that has not been done already */
+static teUtilsStatus eThreadSignalInstall(void)
+{
+    static int iInstalled = 0;
+    struct sigaction sa;
+    
+    if (iInstalled)
+    {
+        return E_UTILS_OK;
+    }
+    
+    /* Set up sigmask to receive configured signal in the main thread. 
+     * All created threads also get this signal mask, so all threads
+     * get the signal. But we can use pthread_signal to direct it at one.
+     */
+    sa.sa_sigaction = thread_signal_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(THREAD_SIGNAL, &sa, NULL) == -1) 
+    {
+        perror("sigaction");
+        return E_UTILS_ERROR_FAILED;
+    }
+    DBG_vPrintf(DBG_THREADS, "Signal action registered\n\r");
+    iInstalled = 1;
+    return E_UTILS_OK;
 }
 #endif /* WIN32 */
 
@@ -197,32 +255,7 @@ teUtilsStatus eUtils_ThreadStart(tprThreadFunction prThreadFunction, tsUtilsThre
     psThreadPrivate->prThreadFunction = prThreadFunction;
     
 #ifndef WIN32
-    {
-        static int iFirstTime = 1;
-        
-        if (iFirstTime)
-        {
-            /* Set up sigmask to receive configured signal in the main thread. 
-             * All created threads also get this signal mask, so all threads
-             * get the signal. But we can use pthread_signal to direct it at one.
-             */
-            struct sigaction sa;
-
-            sa.sa_handler = thread_signal_handler;
-            sa.sa_flags = 0;
-            sigemptyset(&sa.sa_mask);
-
-            if (sigaction(THREAD_SIGNAL, &sa, NULL) == -1) 
-            {
-                perror("sigaction");
-            }
-            else
-            {
-                DBG_vPrintf(DBG_THREADS, "Signal action registered\n\r");
-                iFirstTime = 0;
-            }
-        }
-    }
+    (void)eThreadSignalInstall();
     
     if (pthread_create(&psThreadPrivate->thread, NULL,
         pvThreadFunction, psThreadInfo))
@@ -363,8 +396,92 @@ teUtilsStatus eUtils_ThreadYield(void)
 
 /************************** Lock Functionality *******************************/
 
+#ifndef WIN32
+
+/** Number of kinds of lock, by the line creating them, that can be profiled */
+#define LOCK_PROFILE_CLASSES        256
+
+/** Number of lines acquiring locks that can be profiled. Each kind of lock acquired at a line is counted separately */
+#define LOCK_PROFILE_SITES          2048
+
+/** Number of different pairs of kinds of lock that can be recorded as taken one within the other */
+#define LOCK_PROFILE_EDGES          1024
+
+/** Number of locks a thread may hold at once for the order they are taken in to be recorded */
+#define LOCK_PROFILE_MAX_HELD       16
+
+/** Hold times are timed for one in this many acquisitions of each lock, as reading the clock
+ *  costs more than the rest of the profiling. Contended waits are always timed */
+#define LOCK_PROFILE_HOLD_SAMPLE    8
+
+/** Location recorded for locks acquired with \ref eUtils_LockTryLock */
+static const char *pcLockTryLockLocation = "eUtils_LockTryLock";
+
+/** Location recorded for locks created without one */
+static const char *pcLockCreateLocation = "eUtils_LockCreate";
 
+/** A kind of lock - all of the locks created by one line */
 typedef struct
+{
+    const char * volatile pcLocation;       /**< Line that creates the locks, or NULL for an unused entry */
+    volatile uint32_t   u32Locks;           /**< Number of the locks that have been profiled */
+} tsLockClass;
+
+/** A line acquiring a kind of lock */
+typedef struct
+{
+    tsLockClass        *psClass;            /**< Kind of lock acquired */
+    const char * volatile pcLocation;       /**< Line acquiring the lock, or NULL for an unused entry */
+    volatile uint64_t   u64Acquisitions;    /**< Number of times the lock was acquired, not counting recursion */
+    volatile uint64_t   u64Contended;       /**< Number of acquisitions that had to wait for another thread */
+    volatile uint64_t   u64Timeouts;        /**< Number of timed acquisitions that gave up */
+    volatile uint64_t   u64WaitTotal;       /**< Total time spent waiting (ns) */
+    volatile uint64_t   u64WaitMax;         /**< Longest wait (ns) */
+    volatile uint64_t   u64HoldSamples;     /**< Number of acquisitions that the hold time was timed for */
+    volatile uint64_t   u64HoldTotal;       /**< Total of the hold times timed from here (ns) */
+    volatile uint64_t   u64HoldMax;         /**< Longest hold time timed from here (ns) */
+} tsLockSite;
+
+/** A kind of lock acquired while another was held */
+typedef struct
+{
+    tsLockClass        *psHeld;             /**< Kind of lock that was held */
+    tsLockClass * volatile psAcquired;      /**< Kind of lock that was acquired, or NULL for an unused entry */
+    const char         *pcHeldAt;           /**< Line the held lock was first seen acquired at */
+    const char         *pcAcquiredAt;       /**< Line the lock was first seen acquired at */
+    volatile uint64_t   u64Count;           /**< Number of times the lock was acquired within the other */
+} tsLockEdge;
+
+/** Set while locks are being profiled */
+static volatile int iLockProfileEnabled = 0;
+
+/** Time that profiling started (ns) */
+static uint64_t u64LockProfileStart = 0;
+
+/** Protects adding entries to the profile tables. Entries are found without it */
+static pthread_mutex_t mLockProfile = PTHREAD_MUTEX_INITIALIZER;
+
+static tsLockClass asLockClasses[LOCK_PROFILE_CLASSES];
+static tsLockSite asLockSites[LOCK_PROFILE_SITES];
+static tsLockEdge asLockEdges[LOCK_PROFILE_EDGES];
+
+/** Number of acquisitions that could not be recorded because a table was full */
+static volatile uint32_t u32LockProfileDropped = 0;
+
+/** File the report is written to on THREAD_SIGNAL, or NULL */
+static const char *pcLockProfileReportFile = NULL;
+static tsUtilsThread sLockProfileReportThread;
+static sem_t sLockProfileReportSem;
+static volatile int iLockProfileReporting = 0;
+
+/** Locks held by each thread that were acquired while profiling, in the order they were acquired */
+static __thread struct _tsLockPrivate *apsLockHeld[LOCK_PROFILE_MAX_HELD];
+static __thread int iLockHeld = 0;
+
+#endif /* WIN32 */
+
+
+typedef struct _tsLockPrivate
 {
 #if DBG_LOCKS
     const char         *pcLastLockLocation;
@@ -372,13 +489,351 @@ typedef struct
     
 #ifndef WIN32
      pthread_mutex_t    mMutex;
+     
+     const char        *pcCreateLocation;   /**< Line that created the lock */
+     tsLockClass       *psClass;            /**< Kind of lock in the profile, found when the lock is first profiled */
+     tsLockSite        *psSite;             /**< Line the profiled owner acquired the lock at, or last acquired it at */
+     uint32_t           u32Depth;           /**< Number of times the profiled owner holds the lock, or 0 */
+     uint32_t           u32Acquisitions;    /**< Number of profiled acquisitions, to sample hold times */
+     uint64_t           u64Acquired;        /**< Time the profiled owner acquired the lock (ns), or 0 if not timed */
 #else
      HANDLE             hMutex;
 #endif /* WIN32 */
 } tsLockPrivate;
 
 
+#ifndef WIN32
+
+/** Get a monotonic time stamp in nanoseconds */
+static uint64_t u64LockProfileNow(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000000) + sNow.tv_nsec;
+}
+
+
+/** Raise a maximum to a value, if it is larger */
+static void vLockProfileMax(volatile uint64_t *pu64Max, uint64_t u64Value)
+{
+    uint64_t u64Max = *pu64Max;
+    
+    while (u64Value > u64Max)
+    {
+        uint64_t u64Was = __sync_val_compare_and_swap(pu64Max, u64Max, u64Value);
+        if (u64Was == u64Max)
+        {
+            break;
+        }
+        u64Max = u64Was;
+    }
+}
+
+
+static uint32_t u32LockProfileHash(const void *pvA, const void *pvB)
+{
+    uintptr_t uHash = ((uintptr_t)pvA * 2654435761u) ^ ((uintptr_t)pvB * 40503u);
+    
+    return (uint32_t)(uHash ^ (uHash >> 16));
+}
+
+
+/** Find the kind of lock created at a line, adding it to the profile if it is new */
+static tsLockClass *psLockProfileClass(const char *pcLocation)
+{
+    uint32_t u32Start = u32LockProfileHash(pcLocation, NULL) % LOCK_PROFILE_CLASSES;
+    uint32_t i;
+    
+    for (i = 0; i < LOCK_PROFILE_CLASSES; i++)
+    {
+        tsLockClass *psClass = &asLockClasses[(u32Start + i) % LOCK_PROFILE_CLASSES];
+        
+        if (psClass->pcLocation == pcLocation)
+        {
+            return psClass;
+        }
+        if (!psClass->pcLocation)
+        {
+            pthread_mutex_lock(&mLockProfile);
+            if (!psClass->pcLocation)
+            {
+                psClass->pcLocation = pcLocation;
+                pthread_mutex_unlock(&mLockProfile);
+                return psClass;
+            }
+            pthread_mutex_unlock(&mLockProfile);
+            if (psClass->pcLocation == pcLocation)
+            {
+                return psClass;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/** Find a line acquiring a kind of lock, adding it to the profile if it is new */
+static tsLockSite *psLockProfileSite(tsLockClass *psClass, const char *pcLocation)
+{
+    uint32_t u32Start = u32LockProfileHash(pcLocation, psClass) % LOCK_PROFILE_SITES;
+    uint32_t i;
+    
+    for (i = 0; i < LOCK_PROFILE_SITES; i++)
+    {
+        tsLockSite *psSite = &asLockSites[(u32Start + i) % LOCK_PROFILE_SITES];
+        
+        if ((psSite->pcLocation == pcLocation) && (psSite->psClass == psClass))
+        {
+            return psSite;
+        }
+        if (!psSite->pcLocation)
+        {
+            pthread_mutex_lock(&mLockProfile);
+            if (!psSite->pcLocation)
+            {
+                /* The key is published last, so that the entry is complete when it is found */
+                psSite->psClass = psClass;
+                __sync_synchronize();
+                psSite->pcLocation = pcLocation;
+                pthread_mutex_unlock(&mLockProfile);
+                return psSite;
+            }
+            pthread_mutex_unlock(&mLockProfile);
+            if ((psSite->pcLocation == pcLocation) && (psSite->psClass == psClass))
+            {
+                return psSite;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+/** Count a kind of lock being acquired while another is held */
+static void vLockProfileEdge(tsLockPrivate *psHeld, tsLockClass *psAcquired, const char *pcAcquiredAt)
+{
+    uint32_t u32Start = u32LockProfileHash(psHeld->psClass, psAcquired) % LOCK_PROFILE_EDGES;
+    uint32_t i;
+    
+    for (i = 0; i < LOCK_PROFILE_EDGES; i++)
+    {
+        tsLockEdge *psEdge = &asLockEdges[(u32Start + i) % LOCK_PROFILE_EDGES];
+        
+        if ((psEdge->psAcquired == psAcquired) && (psEdge->psHeld == psHeld->psClass))
+        {
+            __sync_add_and_fetch(&psEdge->u64Count, 1);
+            return;
+        }
+        if (!psEdge->psAcquired)
+        {
+            pthread_mutex_lock(&mLockProfile);
+            if (!psEdge->psAcquired)
+            {
+                psEdge->psHeld          = psHeld->psClass;
+                psEdge->pcHeldAt        = psHeld->psSite ? psHeld->psSite->pcLocation : NULL;
+                psEdge->pcAcquiredAt    = pcAcquiredAt;
+                psEdge->u64Count        = 1;
+                __sync_synchronize();
+                psEdge->psAcquired      = psAcquired;
+                pthread_mutex_unlock(&mLockProfile);
+                DBG_vPrintf(DBG_LOCK_PROFILE, "Lock order %s -> %s\n", psHeld->psClass->pcLocation, psAcquired->pcLocation);
+                return;
+            }
+            pthread_mutex_unlock(&mLockProfile);
+            i--;    /* Look at this entry again */
+        }
+    }
+    __sync_add_and_fetch(&u32LockProfileDropped, 1);
+}
+
+
+/** Record a lock being acquired by a thread that did not already hold it */
+static void vLockProfileAcquired(tsLockPrivate *psLockPrivate, const char *pcLocation, int bContended, uint64_t u64WaitNs)
+{
+    tsLockSite *psSite;
+    int i;
+    
+    if (!psLockPrivate->psClass)
+    {
+        psLockPrivate->psClass = psLockProfileClass(psLockPrivate->pcCreateLocation);
+        if (!psLockPrivate->psClass)
+        {
+            __sync_add_and_fetch(&u32LockProfileDropped, 1);
+            return;
+        }
+        __sync_add_and_fetch(&psLockPrivate->psClass->u32Locks, 1);
+    }
+    
+    /* Most locks are usually acquired at the same line as last time */
+    psSite = psLockPrivate->psSite;
+    if (!psSite || (psSite->pcLocation != pcLocation))
+    {
+        psSite = psLockProfileSite(psLockPrivate->psClass, pcLocation);
+        if (!psSite)
+        {
+            __sync_add_and_fetch(&u32LockProfileDropped, 1);
+            return;
+        }
+    }
+    
+    __sync_add_and_fetch(&psSite->u64Acquisitions, 1);
+    if (bContended)
+    {
+        __sync_add_and_fetch(&psSite->u64Contended, 1);
+        __sync_add_and_fetch(&psSite->u64WaitTotal, u64WaitNs);
+        vLockProfileMax(&psSite->u64WaitMax, u64WaitNs);
+    }
+    
+    /* Record the order of this lock against those the thread already holds */
+    for (i = 0; i < iLockHeld; i++)
+    {
+        vLockProfileEdge(apsLockHeld[i], psLockPrivate->psClass, pcLocation);
+    }
+    if (iLockHeld < LOCK_PROFILE_MAX_HELD)
+    {
+        apsLockHeld[iLockHeld++] = psLockPrivate;
+    }
+    
+    psLockPrivate->psSite       = psSite;
+    psLockPrivate->u32Depth     = 1;
+    psLockPrivate->u64Acquired  = (psLockPrivate->u32Acquisitions++ % LOCK_PROFILE_HOLD_SAMPLE) ? 0 : u64LockProfileNow();
+}
+
+
+/** Record a lock acquired by \ref vLockProfileAcquired being released by its owner */
+static void vLockProfileReleased(tsLockPrivate *psLockPrivate)
+{
+    tsLockSite *psSite = psLockPrivate->psSite;
+    int i;
+    
+    if (psLockPrivate->u64Acquired)
+    {
+        uint64_t u64HoldNs = u64LockProfileNow() - psLockPrivate->u64Acquired;
+        
+        __sync_add_and_fetch(&psSite->u64HoldSamples, 1);
+        __sync_add_and_fetch(&psSite->u64HoldTotal, u64HoldNs);
+        vLockProfileMax(&psSite->u64HoldMax, u64HoldNs);
+    }
+    
+    /* Locks aren't always released in the reverse order */
+    for (i = iLockHeld - 1; i >= 0; i--)
+    {
+        if (apsLockHeld[i] == psLockPrivate)
+        {
+            memmove(&apsLockHeld[i], &apsLockHeld[i + 1], (iLockHeld - i - 1) * sizeof(tsLockPrivate *));
+            iLockHeld--;
+            break;
+        }
+    }
+}
+
+
+/** Count a timed acquisition that gave up */
+static void vLockProfileTimeout(tsLockPrivate *psLockPrivate, const char *pcLocation, uint64_t u64WaitNs)
+{
+    tsLockSite *psSite;
+    
+    if (!psLockPrivate->psClass)
+    {
+        return;
+    }
+    psSite = psLockProfileSite(psLockPrivate->psClass, pcLocation);
+    if (psSite)
+    {
+        __sync_add_and_fetch(&psSite->u64Timeouts, 1);
+        __sync_add_and_fetch(&psSite->u64WaitTotal, u64WaitNs);
+        vLockProfileMax(&psSite->u64WaitMax, u64WaitNs);
+    }
+}
+
+
+/** Called from the signal handler to have the report written */
+static void vLockProfileReportSignal(void)
+{
+    if (iLockProfileReporting)
+    {
+        /* Async signal safe */
+        sem_post(&sLockProfileReportSem);
+    }
+}
+
+
+static void *pvLockProfileReportThread(tsUtilsThread *psThreadInfo)
+{
+    psThreadInfo->eState = E_THREAD_RUNNING;
+    
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        FILE *psFile;
+        
+        if (sem_wait(&sLockProfileReportSem) != 0)
+        {
+            /* Interrupted */
+            continue;
+        }
+        if (psThreadInfo->eState != E_THREAD_RUNNING)
+        {
+            break;
+        }
+        
+        psFile = fopen(pcLockProfileReportFile, "w");
+        if (!psFile)
+        {
+            fprintf(stderr, "Could not open lock profile report %s (%s)\n", pcLockProfileReportFile, strerror(errno));
+            continue;
+        }
+        vUtils_LockProfileDump(psFile);
+        fclose(psFile);
+    }
+    return NULL;
+}
+
+
+static const char *pcLockProfileBaseName(const char *pcLocation)
+{
+    const char *pcBase;
+    
+    if (!pcLocation)
+    {
+        return "(unknown)";
+    }
+    pcBase = strrchr(pcLocation, '/');
+    return pcBase ? pcBase + 1 : pcLocation;
+}
+
+
+/** Order sites by time spent waiting, then by contended acquisitions */
+static int iLockProfileCompareSites(const void *pvA, const void *pvB)
+{
+    const tsLockSite *psA = *(const tsLockSite **)pvA;
+    const tsLockSite *psB = *(const tsLockSite **)pvB;
+    
+    if (psA->u64WaitTotal != psB->u64WaitTotal)
+    {
+        return (psA->u64WaitTotal < psB->u64WaitTotal) ? 1 : -1;
+    }
+    if (psA->u64Contended != psB->u64Contended)
+    {
+        return (psA->u64Contended < psB->u64Contended) ? 1 : -1;
+    }
+    if (psA->u64Acquisitions != psB->u64Acquisitions)
+    {
+        return (psA->u64Acquisitions < psB->u64Acquisitions) ? 1 : -1;
+    }
+    return 0;
+}
+
+#endif /* WIN32 */
+
+
 teUtilsStatus eUtils_LockCreate(tsUtilsLock *psLock)
+{
+    return eUtils_LockCreateImpl(psLock, NULL);
+}
+
+
+teUtilsStatus eUtils_LockCreateImpl(tsUtilsLock *psLock, const char *pcLocation)
 {
     tsLockPrivate *psLockPrivate;
     
@@ -395,6 +850,12 @@ teUtilsStatus eUtils_LockCreate(tsUtilsLock *psLock)
 #endif /* DBG_LOCKS */
     
 #ifndef WIN32
+    psLockPrivate->pcCreateLocation = pcLocation ? pcLocation : pcLockCreateLocation;
+    psLockPrivate->psClass          = NULL;
+    psLockPrivate->psSite           = NULL;
+    psLockPrivate->u32Depth         = 0;
+    psLockPrivate->u32Acquisitions  = 0;
+    psLockPrivate->u64Acquired      = 0;
     {
         pthread_mutexattr_t     attr;
         /* Create a recursive mutex, as we need to allow the same thread to lock mutexes a number of times */
@@ -415,7 +876,7 @@ teUtilsStatus eUtils_LockCreate(tsUtilsLock *psLock)
         return E_UTILS_ERROR_FAILED;
     }
 #endif /* WIN32 */
-    DBG_vPrintf(DBG_LOCKS, "Lock Create: %p\n", psLock);
+    DBG_vPrintf(DBG_LOCKS, "Lock Create: %p at %s\n", psLock, pcLocation);
     return E_UTILS_OK;
 }
 
@@ -444,9 +905,33 @@ teUtilsStatus eUtils_LockLockImpl(tsUtilsLock *psLock, const char *pcLocation)
     tsLockPrivate *psLockPrivate = (tsLockPrivate *)psLock->pvPriv;
 #ifndef WIN32
     int err;
+    int bContended = 0;
+    uint64_t u64WaitNs = 0;
     DBG_vPrintf(DBG_LOCKS, "Thread 0x%lx locking: %p at %s\n", pthread_self(), psLock, pcLocation);
 
-    if ((err = pthread_mutex_lock(&psLockPrivate->mMutex)))
+    if (sLatencyTrace.iActive || iLockProfileEnabled)
+    {
+        /* Only time the lock if another thread holds it */
+        err = pthread_mutex_trylock(&psLockPrivate->mMutex);
+        if (err == EBUSY)
+        {
+            uint64_t u64Start = u64Utils_LatencyNow();
+            uint64_t u64StartNs = u64LockProfileNow();
+            err = pthread_mutex_lock(&psLockPrivate->mMutex);
+            u64WaitNs = u64LockProfileNow() - u64StartNs;
+            bContended = 1;
+            if (sLatencyTrace.iActive)
+            {
+                vUtils_LatencyStage(E_UTILS_LATENCY_LOCK, u64Start);
+            }
+        }
+    }
+    else
+    {
+        err = pthread_mutex_lock(&psLockPrivate->mMutex);
+    }
+
+    if (err)
     {
         DBG_vPrintf(DBG_LOCKS, "Could not lock mutex (%s)\n", strerror(err));
     }
@@ -456,6 +941,14 @@ teUtilsStatus eUtils_LockLockImpl(tsUtilsLock *psLock, const char *pcLocation)
 #if DBG_LOCKS
         psLockPrivate->pcLastLockLocation = pcLocation;
 #endif /* DBG_LOCKS */
+        if (psLockPrivate->u32Depth)
+        {
+            psLockPrivate->u32Depth++;
+        }
+        else if (iLockProfileEnabled)
+        {
+            vLockProfileAcquired(psLockPrivate, pcLocation, bContended, u64WaitNs);
+        }
     }
 #else
     DBG_vPrintf(DBG_LOCKS, "Locking %p at %s\n", psLock, pcLocation);
@@ -473,24 +966,48 @@ teUtilsStatus eUtils_LockLockTimedImpl(tsUtilsLock *psLock, uint32_t u32WaitTime
 #ifndef WIN32
     struct timeval sNow;
     struct timespec sTimeout;
-    
-    gettimeofday(&sNow, NULL);
-    sTimeout.tv_sec = sNow.tv_sec + u32WaitTimeout;
-    sTimeout.tv_nsec = sNow.tv_usec * 1000;
+    uint64_t u64StartNs = 0;
+    int err;
     
     DBG_vPrintf(DBG_LOCKS, "Thread 0x%lx time locking: %p\n", pthread_self(), psLock);
 
-    switch (pthread_mutex_timedlock(&psLockPrivate->mMutex, &sTimeout))
+    err = pthread_mutex_trylock(&psLockPrivate->mMutex);
+    if (err == EBUSY)
+    {
+        gettimeofday(&sNow, NULL);
+        sTimeout.tv_sec = sNow.tv_sec + u32WaitTimeout;
+        sTimeout.tv_nsec = sNow.tv_usec * 1000;
+        
+        if (iLockProfileEnabled)
+        {
+            u64StartNs = u64LockProfileNow();
+        }
+        err = pthread_mutex_timedlock(&psLockPrivate->mMutex, &sTimeout);
+    }
+
+    switch (err)
     {
         case (0):
             DBG_vPrintf(DBG_LOCKS, "Thread 0x%lx: time locked: %p\n", pthread_self(), psLock);
 #if DBG_LOCKS
             psLockPrivate->pcLastLockLocation = pcLocation;
 #endif /* DBG_LOCKS */                
+            if (psLockPrivate->u32Depth)
+            {
+                psLockPrivate->u32Depth++;
+            }
+            else if (iLockProfileEnabled)
+            {
+                vLockProfileAcquired(psLockPrivate, pcLocation, u64StartNs != 0, u64StartNs ? u64LockProfileNow() - u64StartNs : 0);
+            }
             return E_UTILS_OK;
             
         case (ETIMEDOUT):
             DBG_vPrintf(DBG_LOCKS, "Thread 0x%lx: time out locking: %p\n", pthread_self(), psLock);
+            if (u64StartNs)
+            {
+                vLockProfileTimeout(psLockPrivate, pcLocation, u64LockProfileNow() - u64StartNs);
+            }
             return E_UTILS_ERROR_TIMEOUT;
 
         case (EDEADLK):
@@ -530,6 +1047,15 @@ teUtilsStatus eUtils_LockTryLock(tsUtilsLock *psLock)
         return E_UTILS_ERROR_FAILED;
     }
     DBG_vPrintf(DBG_LOCKS, "Thread 0x%lx locked: %p\n", pthread_self(), psLock);
+    if (psLockPrivate->u32Depth)
+    {
+        psLockPrivate->u32Depth++;
+    }
+    else if (iLockProfileEnabled)
+    {
+        /* There's no caller's location to attribute the lock to */
+        vLockProfileAcquired(psLockPrivate, pcLockTryLockLocation, 0, 0);
+    }
 #else
     // Wait with 0mS timeout
    switch(WaitForSingleObject(psLockPrivate->hMutex, 0))
@@ -556,6 +1082,11 @@ teUtilsStatus eUtils_LockUnlock(tsUtilsLock *psLock)
     
 #ifndef WIN32
     DBG_vPrintf(DBG_LOCKS, "Thread 0x%lx unlocking: %p\n", pthread_self(), psLock);
+    /* The profile is updated while the lock is still held by this thread */
+    if (psLockPrivate->u32Depth && (--psLockPrivate->u32Depth == 0))
+    {
+        vLockProfileReleased(psLockPrivate);
+    }
     pthread_mutex_unlock(&psLockPrivate->mMutex);
     DBG_vPrintf(DBG_LOCKS, "Thread 0x%lx unlocked: %p\n", pthread_self(), psLock);
 #else
@@ -566,8 +1097,228 @@ teUtilsStatus eUtils_LockUnlock(tsUtilsLock *psLock)
 }
 
 
-/************************** Queue Functionality ******************************/
-
+#ifndef WIN32
+
+teUtilsStatus eUtils_LockProfileStart(const char *pcReportFile)
+{
+    if (iLockProfileEnabled)
+    {
+        return E_UTILS_ERROR_BUSY;
+    }
+    
+    u64LockProfileStart = u64LockProfileNow();
+    __sync_synchronize();
+    iLockProfileEnabled = 1;
+    
+    if (pcReportFile)
+    {
+        if (eThreadSignalInstall() != E_UTILS_OK)
+        {
+            iLockProfileEnabled = 0;
+            return E_UTILS_ERROR_FAILED;
+        }
+        if (sem_init(&sLockProfileReportSem, 0, 0) != 0)
+        {
+            iLockProfileEnabled = 0;
+            return E_UTILS_ERROR_FAILED;
+        }
+        pcLockProfileReportFile = pcReportFile;
+        if (eUtils_ThreadStart(pvLockProfileReportThread, &sLockProfileReportThread, E_THREAD_JOINABLE) != E_UTILS_OK)
+        {
+            sem_destroy(&sLockProfileReportSem);
+            iLockProfileEnabled = 0;
+            return E_UTILS_ERROR_FAILED;
+        }
+        iLockProfileReporting = 1;
+    }
+    DBG_vPrintf(DBG_LOCK_PROFILE, "Lock profiling started, report to %s\n", pcReportFile ? pcReportFile : "(none)");
+    return E_UTILS_OK;
+}
+
+
+void vUtils_LockProfileStop(void)
+{
+    iLockProfileEnabled = 0;
+    
+    if (iLockProfileReporting)
+    {
+        iLockProfileReporting = 0;
+        sem_post(&sLockProfileReportSem);
+        eUtils_ThreadStop(&sLockProfileReportThread);
+        sem_destroy(&sLockProfileReportSem);
+    }
+}
+
+
+void vUtils_LockProfileDump(FILE *psStream)
+{
+    tsLockSite *apsSites[LOCK_PROFILE_SITES];
+    uint64_t u64Acquisitions = 0, u64Contended = 0, u64WaitTotal = 0;
+    uint32_t u32NumSites = 0, u32NumClasses = 0;
+    uint32_t i, j;
+    int iInversions = 0;
+    
+    if (!u64LockProfileStart)
+    {
+        fprintf(psStream, "Lock profile: not started\n");
+        return;
+    }
+    
+    for (i = 0; i < LOCK_PROFILE_CLASSES; i++)
+    {
+        if (asLockClasses[i].pcLocation)
+        {
+            u32NumClasses++;
+        }
+    }
+    for (i = 0; i < LOCK_PROFILE_SITES; i++)
+    {
+        if (asLockSites[i].pcLocation)
+        {
+            apsSites[u32NumSites++] = &asLockSites[i];
+            u64Acquisitions += asLockSites[i].u64Acquisitions;
+            u64Contended    += asLockSites[i].u64Contended;
+            u64WaitTotal    += asLockSites[i].u64WaitTotal;
+        }
+    }
+    qsort(apsSites, u32NumSites, sizeof(tsLockSite *), iLockProfileCompareSites);
+    
+    fprintf(psStream, "Lock profile: %.1fs%s, %u kinds of lock, %u sites, %llu acquisitions, %llu contended, %.3fms waiting",
+            (double)(u64LockProfileNow() - u64LockProfileStart) / 1e9, iLockProfileEnabled ? "" : " (stopped)",
+            u32NumClasses, u32NumSites, (unsigned long long)u64Acquisitions, (unsigned long long)u64Contended,
+            (double)u64WaitTotal / 1e6);
+    if (u32LockProfileDropped)
+    {
+        fprintf(psStream, ", %u not recorded", u32LockProfileDropped);
+    }
+    fprintf(psStream, "\n");
+    fprintf(psStream, "Sites ranked by time waiting. Hold times are the mean and longest of 1 in %d acquisitions\n", LOCK_PROFILE_HOLD_SAMPLE);
+    
+    fprintf(psStream, "%-28s %-28s %10s %10s %6s %10s %10s %10s %10s %8s\n",
+            "lock created at", "acquired at", "acquired", "contended", "%", "wait ms", "max us", "hold us", "max us", "timeouts");
+    for (i = 0; i < u32NumSites; i++)
+    {
+        tsLockSite *psSite = apsSites[i];
+        
+        fprintf(psStream, "%-28s %-28s %10llu %10llu %6.2f %10.3f %10.1f %10.3f %10.1f %8llu\n",
+                pcLockProfileBaseName(psSite->psClass->pcLocation),
+                pcLockProfileBaseName(psSite->pcLocation),
+                (unsigned long long)psSite->u64Acquisitions,
+                (unsigned long long)psSite->u64Contended,
+                psSite->u64Acquisitions ? (double)psSite->u64Contended * 100 / psSite->u64Acquisitions : 0.0,
+                (double)psSite->u64WaitTotal / 1e6,
+                (double)psSite->u64WaitMax / 1e3,
+                psSite->u64HoldSamples ? (double)psSite->u64HoldTotal / psSite->u64HoldSamples / 1e3 : 0.0,
+                (double)psSite->u64HoldMax / 1e3,
+                (unsigned long long)psSite->u64Timeouts);
+    }
+    
+    fprintf(psStream, "Lock order (held -> acquired):\n");
+    for (i = 0; i < LOCK_PROFILE_EDGES; i++)
+    {
+        tsLockEdge *psEdge = &asLockEdges[i];
+        
+        if (!psEdge->psAcquired)
+        {
+            continue;
+        }
+        fprintf(psStream, "  %-28s -> %-28s %10llu  (%s then %s)\n",
+                pcLockProfileBaseName(psEdge->psHeld->pcLocation),
+                pcLockProfileBaseName(psEdge->psAcquired->pcLocation),
+                (unsigned long long)psEdge->u64Count,
+                pcLockProfileBaseName(psEdge->pcHeldAt),
+                pcLockProfileBaseName(psEdge->pcAcquiredAt));
+    }
+    
+    for (i = 0; i < LOCK_PROFILE_EDGES; i++)
+    {
+        tsLockEdge *psEdge = &asLockEdges[i];
+        
+        if (!psEdge->psAcquired)
+        {
+            continue;
+        }
+        if (psEdge->psAcquired == psEdge->psHeld)
+        {
+            /* Nesting different locks created by the same line has no order between them */
+            fprintf(psStream, "NESTED: two locks created at %s held at once (%s then %s)\n",
+                    pcLockProfileBaseName(psEdge->psHeld->pcLocation),
+                    pcLockProfileBaseName(psEdge->pcHeldAt),
+                    pcLockProfileBaseName(psEdge->pcAcquiredAt));
+            iInversions++;
+            continue;
+        }
+        for (j = i + 1; j < LOCK_PROFILE_EDGES; j++)
+        {
+            tsLockEdge *psReverse = &asLockEdges[j];
+            
+            if ((psReverse->psAcquired == psEdge->psHeld) && (psReverse->psHeld == psEdge->psAcquired))
+            {
+                fprintf(psStream, "INVERSION: %s -> %s (%s then %s) and %s -> %s (%s then %s)\n",
+                        pcLockProfileBaseName(psEdge->psHeld->pcLocation),
+                        pcLockProfileBaseName(psEdge->psAcquired->pcLocation),
+                        pcLockProfileBaseName(psEdge->pcHeldAt),
+                        pcLockProfileBaseName(psEdge->pcAcquiredAt),
+                        pcLockProfileBaseName(psReverse->psHeld->pcLocation),
+                        pcLockProfileBaseName(psReverse->psAcquired->pcLocation),
+                        pcLockProfileBaseName(psReverse->pcHeldAt),
+                        pcLockProfileBaseName(psReverse->pcAcquiredAt));
+                iInversions++;
+            }
+        }
+    }
+    fprintf(psStream, "%d lock order problems\n", iInversions);
+}
+
+#else
+
+teUtilsStatus eUtils_LockProfileStart(const char *pcReportFile)
+{
+    return E_UTILS_ERROR_FAILED;
+}
+
+
+void vUtils_LockProfileStop(void)
+{
+}
+
+
+void vUtils_LockProfileDump(FILE *psStream)
+{
+    fprintf(psStream, "Lock profile: not supported\n");
+}
+
+#endif /* WIN32 */
+
+
+/************************** Queue Functionality ******************************/
+
+#if defined(__linux__)
+/* Single consumer queues are lock free rings, with threads sleeping on futexes */
+#define UTILS_QUEUE_LOCK_FREE
+#endif /* __linux__ */
+
+#ifdef UTILS_QUEUE_LOCK_FREE
+
+/** Fewest and most times a consumer checks for an item before sleeping */
+#define QUEUE_SPIN_MIN          16
+#define QUEUE_SPIN_MAX          4096
+
+/** Pad to keep the producers' and the consumer's fields in separate cache lines */
+#define QUEUE_CACHE_LINE        64
+
+/** Slot of a lock free ring.
+ *  The sequence number is the position that may be written to the slot next,
+ *  or one more than that once an item has been written.
+ */
+typedef struct
+{
+    volatile uint32_t   u32Sequence;
+    void               *pvData;
+} tsQueueSlot;
+
+#endif /* UTILS_QUEUE_LOCK_FREE */
+
 
 typedef struct
 {
@@ -588,9 +1339,301 @@ typedef struct
     CONDITION_VARIABLE  hSpaceAvailable;
     CONDITION_VARIABLE  hDataAvailable;
 #endif /* WIN32 */
+
+#ifdef UTILS_QUEUE_LOCK_FREE
+    tsQueueSlot        *pasSlots;               /**< Slots of the ring, or NULL if the queue is locked */
+    uint32_t            u32Mask;                /**< Number of slots - 1 */
+
+    char                acPad1[QUEUE_CACHE_LINE];
+    volatile uint32_t   u32Tail;                /**< Next position to queue to. Shared by the producers */
+    volatile uint32_t   u32SpaceFutex;          /**< Bumped when space is freed, for blocked producers */
+    volatile uint32_t   u32ProducersWaiting;    /**< Number of producers waiting for space */
+
+    char                acPad2[QUEUE_CACHE_LINE];
+    uint32_t            u32Head;                /**< Next position to dequeue from. Only the consumer uses it */
+    uint32_t            u32SpinLimit;           /**< Times the consumer checks for an item before sleeping */
+    volatile uint32_t   u32DataFutex;           /**< Bumped when an item is queued, if the consumer is waiting */
+    volatile uint32_t   u32ConsumerWaiting;     /**< True while the consumer is waiting */
+#endif /* UTILS_QUEUE_LOCK_FREE */
 } tsQueuePrivate;
 
 
+#ifdef UTILS_QUEUE_LOCK_FREE
+
+static int iQueueFutexWait(volatile uint32_t *pu32Futex, uint32_t u32Value, const struct timespec *psTimeout)
+{
+    return syscall(SYS_futex, pu32Futex, FUTEX_WAIT_PRIVATE, u32Value, psTimeout, NULL, 0);
+}
+
+
+static void vQueueFutexWake(volatile uint32_t *pu32Futex, int iCount)
+{
+    (void)syscall(SYS_futex, pu32Futex, FUTEX_WAKE_PRIVATE, iCount, NULL, NULL, 0);
+}
+
+
+static inline void vQueueCpuRelax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__ ("pause" ::: "memory");
+#elif defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__ ("yield" ::: "memory");
+#else
+    __sync_synchronize();
+#endif
+}
+
+
+static teUtilsStatus eQueueRingCreate(tsQueuePrivate *psQueuePrivate, uint32_t u32MaxCapacity)
+{
+    uint32_t u32Slots = 1;
+    uint32_t i;
+
+    while (u32Slots < u32MaxCapacity)
+    {
+        u32Slots <<= 1;
+    }
+
+    psQueuePrivate->pasSlots = malloc(sizeof(tsQueueSlot) * u32Slots);
+    if (!psQueuePrivate->pasSlots)
+    {
+        return E_UTILS_ERROR_NO_MEM;
+    }
+    for (i = 0; i < u32Slots; i++)
+    {
+        psQueuePrivate->pasSlots[i].u32Sequence = i;
+        psQueuePrivate->pasSlots[i].pvData      = NULL;
+    }
+    psQueuePrivate->u32Mask             = u32Slots - 1;
+    psQueuePrivate->u32Capacity         = u32Slots;
+    psQueuePrivate->u32Tail             = 0;
+    psQueuePrivate->u32SpaceFutex       = 0;
+    psQueuePrivate->u32ProducersWaiting = 0;
+    psQueuePrivate->u32Head             = 0;
+    psQueuePrivate->u32DataFutex        = 0;
+    psQueuePrivate->u32ConsumerWaiting  = 0;
+
+    /* Spinning can't help if the producer can't run at the same time */
+    psQueuePrivate->u32SpinLimit = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? QUEUE_SPIN_MIN : 0;
+    return E_UTILS_OK;
+}
+
+
+/** Wait for the consumer to free a slot that was full */
+static void vQueueRingWaitSpace(tsQueuePrivate *psQueuePrivate, tsQueueSlot *psSlot, uint32_t u32Pos)
+{
+    uint32_t u32Value = psQueuePrivate->u32SpaceFutex;
+
+    __sync_add_and_fetch(&psQueuePrivate->u32ProducersWaiting, 1);
+    if ((int32_t)(psSlot->u32Sequence - u32Pos) < 0)
+    {
+        (void)iQueueFutexWait(&psQueuePrivate->u32SpaceFutex, u32Value, NULL);
+    }
+    __sync_sub_and_fetch(&psQueuePrivate->u32ProducersWaiting, 1);
+}
+
+
+static teUtilsStatus eQueueRingQueue(tsQueuePrivate *psQueuePrivate, void *pvData)
+{
+    uint32_t u32Pos = psQueuePrivate->u32Tail;
+    tsQueueSlot *psSlot;
+
+    /* Claim a position by moving the tail past it */
+    for (;;)
+    {
+        int32_t i32Diff;
+
+        psSlot = &psQueuePrivate->pasSlots[u32Pos & psQueuePrivate->u32Mask];
+        i32Diff = (int32_t)(psSlot->u32Sequence - u32Pos);
+
+        if (i32Diff == 0)
+        {
+            uint32_t u32Was = __sync_val_compare_and_swap(&psQueuePrivate->u32Tail, u32Pos, u32Pos + 1);
+            if (u32Was == u32Pos)
+            {
+                break;
+            }
+            u32Pos = u32Was;
+        }
+        else if (i32Diff < 0)
+        {
+            /* The consumer hasn't yet taken the item queued to this slot last time round */
+            if (psQueuePrivate->iFlags & UTILS_QUEUE_NONBLOCK_INPUT)
+            {
+                DBG_vPrintf(DBG_QUEUE, "Queue full, could not enqueue entry\n");
+                return E_UTILS_ERROR_BLOCK;
+            }
+            vQueueRingWaitSpace(psQueuePrivate, psSlot, u32Pos);
+            u32Pos = psQueuePrivate->u32Tail;
+        }
+        else
+        {
+            /* Another producer claimed this position */
+            u32Pos = psQueuePrivate->u32Tail;
+        }
+    }
+
+    psSlot->pvData = pvData;
+    __sync_synchronize();
+    psSlot->u32Sequence = u32Pos + 1;
+
+    /* Publishing the item before checking for a waiting consumer pairs with
+     * the consumer flagging that it's waiting before checking for an item */
+    __sync_synchronize();
+    if (psQueuePrivate->u32ConsumerWaiting)
+    {
+        __sync_add_and_fetch(&psQueuePrivate->u32DataFutex, 1);
+        vQueueFutexWake(&psQueuePrivate->u32DataFutex, 1);
+    }
+    return E_UTILS_OK;
+}
+
+
+static inline int iQueueRingReady(tsQueuePrivate *psQueuePrivate)
+{
+    return psQueuePrivate->pasSlots[psQueuePrivate->u32Head & psQueuePrivate->u32Mask].u32Sequence == (psQueuePrivate->u32Head + 1);
+}
+
+
+/** Take the item at the head of the ring, if there is one */
+static int iQueueRingTake(tsQueuePrivate *psQueuePrivate, void **ppvData)
+{
+    tsQueueSlot *psSlot = &psQueuePrivate->pasSlots[psQueuePrivate->u32Head & psQueuePrivate->u32Mask];
+
+    if (psSlot->u32Sequence != (psQueuePrivate->u32Head + 1))
+    {
+        return 0;
+    }
+    __sync_synchronize();
+    *ppvData = psSlot->pvData;
+    __sync_synchronize();
+
+    /* Free the slot for the position one time round the ring from here */
+    psSlot->u32Sequence = psQueuePrivate->u32Head + psQueuePrivate->u32Mask + 1;
+    psQueuePrivate->u32Head++;
+    return 1;
+}
+
+
+/** Wake producers waiting for space, after taking items.
+ *  Producers are only woken once half the ring is free, so that a full queue
+ *  doesn't cost a wakeup for every item taken.
+ */
+static void vQueueRingSpaceFreed(tsQueuePrivate *psQueuePrivate)
+{
+    uint32_t u32Free;
+    uint32_t u32Slots = psQueuePrivate->u32Mask + 1;
+
+    __sync_synchronize();
+    if (psQueuePrivate->u32ProducersWaiting)
+    {
+        u32Free = u32Slots - (psQueuePrivate->u32Tail - psQueuePrivate->u32Head);
+        if ((u32Free * 2) < u32Slots)
+        {
+            return;
+        }
+        __sync_add_and_fetch(&psQueuePrivate->u32SpaceFutex, 1);
+        vQueueFutexWake(&psQueuePrivate->u32SpaceFutex, INT32_MAX);
+    }
+}
+
+
+/** Wait for an item to be queued.
+ *  The consumer spins for a while first, as an item may be moments away and
+ *  sleeping and waking costs a couple of system calls and a context switch.
+ *  The time spun adapts, growing while items arrive during the spin and
+ *  shrinking while they don't.
+ *  \param bForever         True to wait with no time limit
+ *  \param u64Deadline      Time to wait until (us), otherwise
+ */
+static teUtilsStatus eQueueRingWaitData(tsQueuePrivate *psQueuePrivate, int bForever, uint64_t u64Deadline)
+{
+    uint32_t i;
+
+    for (i = 0; i < psQueuePrivate->u32SpinLimit; i++)
+    {
+        if (iQueueRingReady(psQueuePrivate))
+        {
+            psQueuePrivate->u32SpinLimit = ((i * 2) > QUEUE_SPIN_MAX) ? QUEUE_SPIN_MAX :
+                                           ((i * 2) < QUEUE_SPIN_MIN) ? QUEUE_SPIN_MIN : (i * 2);
+            return E_UTILS_OK;
+        }
+        vQueueCpuRelax();
+    }
+    if (psQueuePrivate->u32SpinLimit > QUEUE_SPIN_MIN)
+    {
+        psQueuePrivate->u32SpinLimit /= 2;
+    }
+
+    for (;;)
+    {
+        uint32_t u32Value = psQueuePrivate->u32DataFutex;
+        struct timespec sTimeout;
+        uint64_t u64Now;
+
+        psQueuePrivate->u32ConsumerWaiting = 1;
+        __sync_synchronize();
+
+        if (iQueueRingReady(psQueuePrivate))
+        {
+            psQueuePrivate->u32ConsumerWaiting = 0;
+            return E_UTILS_OK;
+        }
+
+        if (bForever)
+        {
+            (void)iQueueFutexWait(&psQueuePrivate->u32DataFutex, u32Value, NULL);
+        }
+        else
+        {
+            u64Now = u64Utils_LatencyNow();
+            if (u64Now >= u64Deadline)
+            {
+                psQueuePrivate->u32ConsumerWaiting = 0;
+                return E_UTILS_ERROR_TIMEOUT;
+            }
+            sTimeout.tv_sec  = (u64Deadline - u64Now) / 1000000;
+            sTimeout.tv_nsec = ((u64Deadline - u64Now) % 1000000) * 1000;
+            (void)iQueueFutexWait(&psQueuePrivate->u32DataFutex, u32Value, &sTimeout);
+        }
+        psQueuePrivate->u32ConsumerWaiting = 0;
+    }
+}
+
+
+static teUtilsStatus eQueueRingDequeueBatch(tsQueuePrivate *psQueuePrivate, int bForever, uint32_t u32WaitMs,
+                                            void **apvData, uint32_t u32MaxItems, uint32_t *pu32NumItems)
+{
+    uint32_t u32NumItems = 0;
+    teUtilsStatus eStatus;
+
+    *pu32NumItems = 0;
+    if (!iQueueRingReady(psQueuePrivate))
+    {
+        if (!bForever && (u32WaitMs == 0))
+        {
+            return E_UTILS_ERROR_TIMEOUT;
+        }
+        eStatus = eQueueRingWaitData(psQueuePrivate, bForever, u64Utils_LatencyNow() + ((uint64_t)u32WaitMs * 1000));
+        if (eStatus != E_UTILS_OK)
+        {
+            return eStatus;
+        }
+    }
+
+    while ((u32NumItems < u32MaxItems) && iQueueRingTake(psQueuePrivate, &apvData[u32NumItems]))
+    {
+        u32NumItems++;
+    }
+    vQueueRingSpaceFreed(psQueuePrivate);
+
+    *pu32NumItems = u32NumItems;
+    return E_UTILS_OK;
+}
+
+#endif /* UTILS_QUEUE_LOCK_FREE */
+
+
 teUtilsStatus eUtils_QueueCreate(tsUtilsQueue *psQueue, uint32_t u32MaxCapacity, int iFlags)
 {
     tsQueuePrivate *psQueuePrivate;
@@ -603,6 +1646,21 @@ teUtilsStatus eUtils_QueueCreate(tsUtilsQueue *psQueue, uint32_t u32MaxCapacity,
     
     psQueue->pvPriv = psQueuePrivate;
     
+#ifdef UTILS_QUEUE_LOCK_FREE
+    psQueuePrivate->pasSlots    = NULL;
+    psQueuePrivate->iFlags      = iFlags;
+    if (iFlags & UTILS_QUEUE_SINGLE_CONSUMER)
+    {
+        if (eQueueRingCreate(psQueuePrivate, u32MaxCapacity) != E_UTILS_OK)
+        {
+            free(psQueue->pvPriv);
+            return E_UTILS_ERROR_NO_MEM;
+        }
+        DBG_vPrintf(DBG_QUEUE, "Queue %p created lock free (capacity %d)\n", psQueue, psQueuePrivate->u32Capacity);
+        return E_UTILS_OK;
+    }
+#endif /* UTILS_QUEUE_LOCK_FREE */
+
     psQueuePrivate->apvBuffer = malloc(sizeof(void *) * u32MaxCapacity);
     
     if (!psQueuePrivate->apvBuffer)
@@ -639,6 +1697,15 @@ teUtilsStatus eUtils_QueueDestroy(tsUtilsQueue *psQueue)
     {
         return E_UTILS_ERROR_FAILED;
     }
+#ifdef UTILS_QUEUE_LOCK_FREE
+    if (psQueuePrivate->pasSlots)
+    {
+        free(psQueuePrivate->pasSlots);
+        free(psQueuePrivate);
+        DBG_vPrintf(DBG_QUEUE, "Queue %p destroyed\n", psQueue);
+        return E_UTILS_OK;
+    }
+#endif /* UTILS_QUEUE_LOCK_FREE */
     free(psQueuePrivate->apvBuffer);
     
 #ifndef WIN32
@@ -661,6 +1728,13 @@ teUtilsStatus eUtils_QueueQueue(tsUtilsQueue *psQueue, void *pvData)
     
     DBG_vPrintf(DBG_QUEUE, "Queue %p: Queue %p\n", psQueue, pvData);
     
+#ifdef UTILS_QUEUE_LOCK_FREE
+    if (psQueuePrivate->pasSlots)
+    {
+        return eQueueRingQueue(psQueuePrivate, pvData);
+    }
+#endif /* UTILS_QUEUE_LOCK_FREE */
+
 #ifndef WIN32
     pthread_mutex_lock      (&psQueuePrivate->mMutex);
 #else
@@ -715,6 +1789,21 @@ teUtilsStatus eUtils_QueueDequeue(tsUtilsQueue *psQueue, void **ppvData)
     tsQueuePrivate *psQueuePrivate = (tsQueuePrivate*)psQueue->pvPriv;
     DBG_vPrintf(DBG_QUEUE, "Queue %p: Dequeue\n", psQueue);
     
+#ifdef UTILS_QUEUE_LOCK_FREE
+    if (psQueuePrivate->pasSlots)
+    {
+        uint32_t u32NumItems;
+
+        if (eQueueRingDequeueBatch(psQueuePrivate, !(psQueuePrivate->iFlags & UTILS_QUEUE_NONBLOCK_OUTPUT), 0,
+                                   ppvData, 1, &u32NumItems) != E_UTILS_OK)
+        {
+            DBG_vPrintf(DBG_QUEUE, "Queue empty\n");
+            return E_UTILS_ERROR_BLOCK;
+        }
+        return E_UTILS_OK;
+    }
+#endif /* UTILS_QUEUE_LOCK_FREE */
+
 #ifndef WIN32
     pthread_mutex_lock      (&psQueuePrivate->mMutex);
 #else
@@ -765,8 +1854,27 @@ teUtilsStatus eUtils_QueueDequeue(tsUtilsQueue *psQueue, void **ppvData)
 
 
 teUtilsStatus eUtils_QueueDequeueTimed(tsUtilsQueue *psQueue, uint32_t u32WaitMs, void **ppvData)
+{
+    uint32_t u32NumItems;
+
+    return eUtils_QueueDequeueBatch(psQueue, u32WaitMs, ppvData, 1, &u32NumItems);
+}
+
+
+teUtilsStatus eUtils_QueueDequeueBatch(tsUtilsQueue *psQueue, uint32_t u32WaitMs, void **apvData, uint32_t u32MaxItems, uint32_t *pu32NumItems)
 {
     tsQueuePrivate *psQueuePrivate = (tsQueuePrivate*)psQueue->pvPriv;
+    uint32_t u32NumItems = 0;
+
+    *pu32NumItems = 0;
+
+#ifdef UTILS_QUEUE_LOCK_FREE
+    if (psQueuePrivate->pasSlots)
+    {
+        return eQueueRingDequeueBatch(psQueuePrivate, 0, u32WaitMs, apvData, u32MaxItems, pu32NumItems);
+    }
+#endif /* UTILS_QUEUE_LOCK_FREE */
+
 #ifndef WIN32
     pthread_mutex_lock      (&psQueuePrivate->mMutex);
 #else
@@ -824,11 +1932,15 @@ teUtilsStatus eUtils_QueueDequeueTimed(tsUtilsQueue *psQueue, uint32_t u32WaitMs
         }
     }
     
-    *ppvData = psQueuePrivate->apvBuffer[psQueuePrivate->u32Out];
-    --psQueuePrivate->u32Size;
+    while ((u32NumItems < u32MaxItems) && (psQueuePrivate->u32Size > 0))
+    {
+        apvData[u32NumItems++] = psQueuePrivate->apvBuffer[psQueuePrivate->u32Out];
+        --psQueuePrivate->u32Size;
+        psQueuePrivate->u32Out = (psQueuePrivate->u32Out + 1) % psQueuePrivate->u32Capacity;
+    }
+    *pu32NumItems = u32NumItems;
     DBG_vPrintf(DBG_QUEUE, "Queue %p (size=%d)\n", psQueue, psQueuePrivate->u32Size);
     
-    psQueuePrivate->u32Out = (psQueuePrivate->u32Out + 1) % psQueuePrivate->u32Capacity;
 #ifndef WIN32
     pthread_mutex_unlock    (&psQueuePrivate->mMutex);
     pthread_cond_broadcast  (&psQueuePrivate->cond_space_available);
@@ -848,3 +1960,197 @@ uint32_t u32AtomicAdd(volatile uint32_t *pu32Value, uint32_t u32Operand)
 #endif
 }
 
+
+
+/************************** Latency Functionality ****************************/
+
+
+/** Find the histogram bucket for a value.
+ *  Values below \ref UTILS_HISTOGRAM_SUB_BUCKETS have a bucket each, above that
+ *  each power of 2 is split into \ref UTILS_HISTOGRAM_SUB_BUCKETS buckets.
+ */
+static uint32_t u32HistogramBucket(uint32_t u32Value)
+{
+    uint32_t u32Msb;
+    uint32_t u32Bucket;
+
+    if (u32Value < UTILS_HISTOGRAM_SUB_BUCKETS)
+    {
+        return u32Value;
+    }
+
+    u32Msb = 31 - __builtin_clz(u32Value);
+    u32Bucket = (UTILS_HISTOGRAM_SUB_BUCKETS * (u32Msb - 2)) + ((u32Value >> (u32Msb - 3)) & (UTILS_HISTOGRAM_SUB_BUCKETS - 1));
+
+    if (u32Bucket >= UTILS_HISTOGRAM_BUCKETS)
+    {
+        u32Bucket = UTILS_HISTOGRAM_BUCKETS - 1;
+    }
+    return u32Bucket;
+}
+
+
+/** Largest value that is recorded in a histogram bucket */
+static uint32_t u32HistogramBucketLimit(uint32_t u32Bucket)
+{
+    uint32_t u32Shift;
+
+    if (u32Bucket < UTILS_HISTOGRAM_SUB_BUCKETS)
+    {
+        return u32Bucket;
+    }
+
+    u32Shift = (u32Bucket / UTILS_HISTOGRAM_SUB_BUCKETS) - 1;
+    return ((UTILS_HISTOGRAM_SUB_BUCKETS + (u32Bucket % UTILS_HISTOGRAM_SUB_BUCKETS) + 1) << u32Shift) - 1;
+}
+
+
+void vUtils_HistogramRecord(tsUtilsHistogram *psHistogram, uint32_t u32Value)
+{
+    uint32_t u32Max;
+
+    u32AtomicAdd(&psHistogram->au32Buckets[u32HistogramBucket(u32Value)], 1);
+    u32AtomicAdd(&psHistogram->u32Count, 1);
+#if defined(_MSC_VER)
+    InterlockedExchangeAdd64((volatile LONG64 *)&psHistogram->u64Total, u32Value);
+#else
+    __sync_add_and_fetch(&psHistogram->u64Total, u32Value);
+#endif
+
+    u32Max = psHistogram->u32Max;
+    while (u32Value > u32Max)
+    {
+#if defined(_MSC_VER)
+        uint32_t u32Was = InterlockedCompareExchange((volatile LONG *)&psHistogram->u32Max, u32Value, u32Max);
+#else
+        uint32_t u32Was = __sync_val_compare_and_swap(&psHistogram->u32Max, u32Max, u32Value);
+#endif
+        if (u32Was == u32Max)
+        {
+            break;
+        }
+        u32Max = u32Was;
+    }
+}
+
+
+void vUtils_HistogramSummarise(tsUtilsHistogram *psHistogram, tsUtilsHistogramSummary *psSummary)
+{
+    const uint32_t au32Percentiles[] = { 50, 90, 95, 99 };
+    uint32_t *apu32Results[] = { &psSummary->u32P50, &psSummary->u32P90, &psSummary->u32P95, &psSummary->u32P99 };
+    const uint32_t u32NumPercentiles = sizeof(au32Percentiles) / sizeof(au32Percentiles[0]);
+    uint32_t u32Percentile = 0;
+    uint32_t u32Bucket;
+    uint64_t u64Seen = 0;
+    uint64_t u64Total;
+
+    memset(psSummary, 0, sizeof(tsUtilsHistogramSummary));
+
+    /* Take the count from the buckets so that the percentiles are consistent with them */
+    for (u32Bucket = 0; u32Bucket < UTILS_HISTOGRAM_BUCKETS; u32Bucket++)
+    {
+        psSummary->u32Count += psHistogram->au32Buckets[u32Bucket];
+    }
+    if (psSummary->u32Count == 0)
+    {
+        return;
+    }
+
+    psSummary->u32Max = psHistogram->u32Max;
+    u64Total = psHistogram->u64Total;
+    psSummary->u32Mean = (uint32_t)(u64Total / psSummary->u32Count);
+
+    for (u32Bucket = 0; (u32Bucket < UTILS_HISTOGRAM_BUCKETS) && (u32Percentile < u32NumPercentiles); u32Bucket++)
+    {
+        u64Seen += psHistogram->au32Buckets[u32Bucket];
+
+        while ((u32Percentile < u32NumPercentiles) && ((u64Seen * 100) >= ((uint64_t)psSummary->u32Count * au32Percentiles[u32Percentile])))
+        {
+            uint32_t u32Limit = u32HistogramBucketLimit(u32Bucket);
+
+            /* The true value can't be more than the largest recorded */
+            *apu32Results[u32Percentile] = (u32Limit < psSummary->u32Max) ? u32Limit : psSummary->u32Max;
+            u32Percentile++;
+        }
+    }
+}
+
+
+void vUtils_LatencyEnable(int bEnable)
+{
+    iLatencyEnabled = bEnable;
+}
+
+
+uint64_t u64Utils_LatencyNow(void)
+{
+#ifndef WIN32
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000) + (sNow.tv_nsec / 1000);
+#else
+    return (uint64_t)GetTickCount() * 1000;
+#endif /* WIN32 */
+}
+
+
+void vUtils_LatencyBegin(void)
+{
+    if (!iLatencyEnabled)
+    {
+        sLatencyTrace.iActive = 0;
+        return;
+    }
+
+    memset(sLatencyTrace.au32Stages, 0, sizeof(sLatencyTrace.au32Stages));
+    sLatencyTrace.u64Start = u64Utils_LatencyNow();
+    sLatencyTrace.iActive = 1;
+}
+
+
+uint64_t u64Utils_LatencyStart(void)
+{
+    if (!sLatencyTrace.iActive)
+    {
+        return 0;
+    }
+    return u64Utils_LatencyNow();
+}
+
+
+void vUtils_LatencyStage(teUtilsLatencyStage eStage, uint64_t u64Start)
+{
+    if ((u64Start == 0) || (!sLatencyTrace.iActive))
+    {
+        return;
+    }
+    sLatencyTrace.au32Stages[eStage] += (uint32_t)(u64Utils_LatencyNow() - u64Start);
+}
+
+
+tsUtilsLatencyTrace *psUtils_LatencyEnd(void)
+{
+    uint32_t u32Accounted = 0;
+    int i;
+
+    if (!sLatencyTrace.iActive)
+    {
+        return NULL;
+    }
+    sLatencyTrace.iActive = 0;
+
+    sLatencyTrace.au32Stages[E_UTILS_LATENCY_TOTAL] = (uint32_t)(u64Utils_LatencyNow() - sLatencyTrace.u64Start);
+
+    for (i = E_UTILS_LATENCY_TOTAL + 1; i < E_UTILS_LATENCY_OTHER; i++)
+    {
+        u32Accounted += sLatencyTrace.au32Stages[i];
+    }
+
+    if (u32Accounted < sLatencyTrace.au32Stages[E_UTILS_LATENCY_TOTAL])
+    {
+        sLatencyTrace.au32Stages[E_UTILS_LATENCY_OTHER] = sLatencyTrace.au32Stages[E_UTILS_LATENCY_TOTAL] - u32Accounted;
+    }
+    return &sLatencyTrace;
+}
+
@@ -50,6 +50,9 @@
 #define DBG_FUNCTION_CALLS 0
 #define DBG_JIP 0
 
+/** Generation counter of changes to variables, shared by all contexts */
+static volatile uint32_t u32VarGeneration = 0;
+
 #ifndef LIBJIP_VERSION
 #error Version is not defined!
 #else
@@ -81,7 +84,7 @@ teJIP_Status eJIP_Init(tsJIP_Context *psJIP_Context, teJIP_ContextType eJIP_Cont
     
     psJIP_Private->eJIP_ContextType = eJIP_ContextType;
     
-    eUtils_LockCreate(&psJIP_Private->sLock);
+    eUtils_LockCreateHere(&psJIP_Private->sLock);
     eUtils_LockLock(&psJIP_Private->sLock);
     
     /* Seed the random number generator */
@@ -103,12 +106,28 @@ teJIP_Status eJIP_Init(tsJIP_Context *psJIP_Context, teJIP_ContextType eJIP_Cont
         return E_JIP_ERROR_FAILED;
     }
     
-    /* No registered network change handler */
-    psJIP_Private->prCbNetworkChange = NULL;
-    
     /* Save private context into public */
     psJIP_Context->pvPriv = psJIP_Private;
     
+    if (eJIP_ContextType == E_JIP_CONTEXT_SERVER)
+    {
+        if (eTraps_Init(psJIP_Context) != E_JIP_OK)
+        {
+            free(psJIP_Private);
+            return E_JIP_ERROR_FAILED;
+        }
+        
+        if (eLatency_Init(psJIP_Context) != E_JIP_OK)
+        {
+            eTraps_Destroy(psJIP_Context);
+            free(psJIP_Private);
+            return E_JIP_ERROR_FAILED;
+        }
+    }
+    
+    /* No registered network change handler */
+    psJIP_Private->prCbNetworkChange = NULL;
+    
     /* No nodes in the network */
     memset(&psJIP_Context->sNetwork, 0, sizeof(tsNetwork));
     
@@ -121,6 +140,10 @@ teJIP_Status eJIP_Init(tsJIP_Context *psJIP_Context, teJIP_ContextType eJIP_Cont
     /* Set up the multicast attempts to the default */
     psJIP_Context->iMulticastSendCount = 2;
     
+    /* Fill the packet with each discovery query by default */
+    psJIP_Context->iQueryPageSize = JIP_QUERY_PAGE_SIZE;
+    psJIP_Context->iTableRereadInterval = JIP_TABLE_REREAD_INTERVAL;
+    
     eUtils_LockUnlock(&psJIP_Private->sLock);
     
     return E_JIP_OK;
@@ -167,6 +190,12 @@ teJIP_Status eJIP_Destroy(tsJIP_Context *psJIP_Context)
         }
     }
     eJIP_Unlock(psJIP_Context);
+    
+    if (psJIP_Private->eJIP_ContextType == E_JIP_CONTEXT_SERVER)
+    {
+        /* Stop sending trap notifications before the socket goes */
+        eTraps_Destroy(psJIP_Context);
+    }
 
     /* We should now be done with the network connection, so we can now tear it down and stop receiving any trap notifications */
     Network_Destroy(&psJIP_Private->sNetworkContext);
@@ -193,6 +222,9 @@ teJIP_Status eJIP_Destroy(tsJIP_Context *psJIP_Context)
     
     Cache_Destroy(&psJIP_Private->sCache);
     
+    /* No more requests can be recorded now the network is gone */
+    eLatency_Destroy(psJIP_Context);
+    
     eUtils_LockDestroy(&psJIP_Private->sLock);
     
     free(psJIP_Private);
@@ -414,6 +446,12 @@ teJIP_Status eJIP_SetVarValue(tsVar *psVar, void *pvData, uint32_t u32Size)
 {
     void *pvNewData;
     
+    if (psVar->pvData && (psVar->u8Size == u32Size) && (memcmp(psVar->pvData, pvData, u32Size) == 0))
+    {
+        /* Unchanged - attribute reports and polls often repeat the value, don't notify traps of it */
+        return E_JIP_OK;
+    }
+    
     pvNewData = realloc(psVar->pvData, u32Size);
     if (!pvNewData && u32Size > 0) 
     {
@@ -422,11 +460,34 @@ teJIP_Status eJIP_SetVarValue(tsVar *psVar, void *pvData, uint32_t u32Size)
     psVar->pvData = pvNewData;
     memcpy(psVar->pvData, pvData, u32Size);
     psVar->u8Size = u32Size;
+    vJIP_VarGenerationStamp(psVar);
+    
+    /* Let anybody that has trapped the variable know */
+    vTraps_VarChanged(psVar);
         
     return E_JIP_OK;
 }
 
 
+void vJIP_VarGenerationStamp(tsVar *psVar)
+{
+    uint32_t u32Generation = __sync_add_and_fetch(&u32VarGeneration, 1);
+    
+    if (u32Generation == 0)
+    {
+        /* Wrapped - 0 asks a snapshot for every variable */
+        u32Generation = __sync_add_and_fetch(&u32VarGeneration, 1);
+    }
+    psVar->u32Generation = u32Generation;
+}
+
+
+uint32_t u32JIP_VarGeneration(void)
+{
+    return u32VarGeneration;
+}
+
+
 /* Lock mutex on JIP context */
 teJIP_Status eJIP_Lock(tsJIP_Context *psJIP_Context)
 {
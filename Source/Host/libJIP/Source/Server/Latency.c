@@ -0,0 +1,307 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2013. All rights reserved
+ *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#define DBG_FUNCTION_CALLS 0
+#define DBG_LATENCY 0
+
+
+/** Names of the JIP commands, for the latency table */
+static const char *apcLatencyCommandNames[JIP_SERVER_LATENCY_NUM_COMMANDS] =
+{
+    "Get",
+    "GetResponse",
+    "Set",
+    "SetResponse",
+    "QueryMib",
+    "QueryMibResponse",
+    "QueryVar",
+    "QueryVarResponse",
+    "Trap",
+    "Untrap",
+    "TrapResponse",
+    "TrapNotify",
+    "GetMib",
+    "SetMib",
+    "SetVars",
+};
+
+/** Names of the latency stages, for the latency table */
+static const char *apcLatencyStageNames[E_UTILS_LATENCY_NUM_STAGES] =
+{
+    "Total",
+    "Lock",
+    "Tx",
+    "TxStatus",
+    "Response",
+    "Other",
+};
+
+
+static uint32_t u32Latency_NodeHash(struct in6_addr *psAddress)
+{
+    uint32_t u32Hash;
+
+    /* The interface identifier differs between nodes, the prefix doesn't */
+    memcpy(&u32Hash, &psAddress->s6_addr[12], sizeof(uint32_t));
+    u32Hash ^= u32Hash >> 16;
+    u32Hash ^= u32Hash >> 8;
+    return u32Hash % JIP_SERVER_LATENCY_NODE_BUCKETS;
+}
+
+
+/** Find the latencies of a node, adding it if it hasn't been seen before.
+ *  \return Pointer to the node's latencies, or NULL if no more nodes can be recorded.
+ */
+static tsLatencyNode *psLatency_Node(tsLatency *psLatency, struct in6_addr *psAddress)
+{
+    uint32_t u32Hash = u32Latency_NodeHash(psAddress);
+    tsLatencyNode *psNode;
+
+    eUtils_LockLock(&psLatency->sLock);
+
+    for (psNode = psLatency->apsNodeHash[u32Hash]; psNode; psNode = psNode->psNextHash)
+    {
+        if (memcmp(&psNode->sAddress, psAddress, sizeof(struct in6_addr)) == 0)
+        {
+            break;
+        }
+    }
+
+    if ((!psNode) && (psLatency->u32NumNodes < JIP_SERVER_LATENCY_MAX_NODES))
+    {
+        psNode = calloc(1, sizeof(tsLatencyNode));
+        if (psNode)
+        {
+            DBG_vPrintf(DBG_LATENCY, "Recording latencies of node %d\n", psLatency->u32NumNodes);
+            memcpy(&psNode->sAddress, psAddress, sizeof(struct in6_addr));
+            psNode->psNextHash = psLatency->apsNodeHash[u32Hash];
+            psLatency->apsNodeHash[u32Hash] = psNode;
+            psLatency->apsNodes[psLatency->u32NumNodes] = psNode;
+
+            /* Readers of the node list don't take the lock, so make sure they see a complete node */
+            __sync_synchronize();
+            psLatency->u32NumNodes++;
+        }
+    }
+
+    eUtils_LockUnlock(&psLatency->sLock);
+    return psNode;
+}
+
+
+teJIP_Status eLatency_Init(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsLatency *psLatency;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+
+    psLatency = calloc(1, sizeof(tsLatency));
+    if (!psLatency)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+
+    if (eUtils_LockCreateHere(&psLatency->sLock) != E_UTILS_OK)
+    {
+        free(psLatency);
+        return E_JIP_ERROR_FAILED;
+    }
+
+    psJIP_Private->psLatency = psLatency;
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eLatency_Destroy(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsLatency *psLatency = psJIP_Private->psLatency;
+    uint32_t u32Node;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+
+    if (!psLatency)
+    {
+        return E_JIP_OK;
+    }
+
+    for (u32Node = 0; u32Node < psLatency->u32NumNodes; u32Node++)
+    {
+        free(psLatency->apsNodes[u32Node]);
+    }
+    eUtils_LockDestroy(&psLatency->sLock);
+    free(psLatency);
+    psJIP_Private->psLatency = NULL;
+    return E_JIP_OK;
+}
+
+
+void vLatency_RequestEnd(tsJIP_Context *psJIP_Context, uint8_t u8Command, struct in6_addr *psNodeAddress)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsLatency *psLatency = psJIP_Private->psLatency;
+    tsUtilsLatencyTrace *psTrace;
+    tsLatencyNode *psNode = NULL;
+    int iStage;
+
+    psTrace = psUtils_LatencyEnd();
+    if ((!psTrace) || (!psLatency) ||
+        (u8Command < E_JIP_COMMAND_GET_REQUEST) || (u8Command >= E_JIP_COMMAND_LAST))
+    {
+        return;
+    }
+
+    if (psNodeAddress)
+    {
+        psNode = psLatency_Node(psLatency, psNodeAddress);
+    }
+
+    for (iStage = 0; iStage < E_UTILS_LATENCY_NUM_STAGES; iStage++)
+    {
+        /* Only the total is recorded for stages a request didn't go through,
+         * so that their percentiles are of the requests that did */
+        if ((iStage != E_UTILS_LATENCY_TOTAL) && (psTrace->au32Stages[iStage] == 0))
+        {
+            continue;
+        }
+        vUtils_HistogramRecord(&psLatency->aasCommands[u8Command - E_JIP_COMMAND_GET_REQUEST][iStage], psTrace->au32Stages[iStage]);
+        if (psNode)
+        {
+            vUtils_HistogramRecord(&psNode->asStages[iStage], psTrace->au32Stages[iStage]);
+        }
+    }
+}
+
+
+teJIP_Status eJIPserver_LatencyCommand(tsJIP_Context *psJIP_Context, uint8_t u8Command,
+                                       teUtilsLatencyStage eStage, tsUtilsHistogramSummary *psSummary)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsLatency *psLatency = psJIP_Private->psLatency;
+
+    if (!psLatency)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+
+    if ((u8Command < E_JIP_COMMAND_GET_REQUEST) || (u8Command >= E_JIP_COMMAND_LAST) ||
+        (eStage >= E_UTILS_LATENCY_NUM_STAGES))
+    {
+        return E_JIP_ERROR_BAD_VALUE;
+    }
+
+    vUtils_HistogramSummarise(&psLatency->aasCommands[u8Command - E_JIP_COMMAND_GET_REQUEST][eStage], psSummary);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIPserver_LatencyNode(tsJIP_Context *psJIP_Context, uint32_t u32Index, struct in6_addr *psAddress,
+                                    teUtilsLatencyStage eStage, tsUtilsHistogramSummary *psSummary)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsLatency *psLatency = psJIP_Private->psLatency;
+    tsLatencyNode *psNode;
+
+    if (!psLatency)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+
+    if ((u32Index >= psLatency->u32NumNodes) || (eStage >= E_UTILS_LATENCY_NUM_STAGES))
+    {
+        return E_JIP_ERROR_BAD_VALUE;
+    }
+
+    psNode = psLatency->apsNodes[u32Index];
+    memcpy(psAddress, &psNode->sAddress, sizeof(struct in6_addr));
+    vUtils_HistogramSummarise(&psNode->asStages[eStage], psSummary);
+    return E_JIP_OK;
+}
+
+
+/** Write one row of the latency table */
+static void vLatency_DumpRow(FILE *psStream, const char *pcName, const char *pcStage, tsUtilsHistogramSummary *psSummary)
+{
+    fprintf(psStream, "%-40s %-9s %10u %10u %10u %10u %10u %10u\n", pcName, pcStage,
+            psSummary->u32Count, psSummary->u32Mean,
+            psSummary->u32P50, psSummary->u32P90, psSummary->u32P99, psSummary->u32Max);
+}
+
+
+teJIP_Status eJIPserver_LatencyDump(tsJIP_Context *psJIP_Context, FILE *psStream)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsLatency *psLatency = psJIP_Private->psLatency;
+    tsUtilsHistogramSummary sSummary;
+    uint32_t u32NumNodes;
+    uint32_t u32Index;
+    int iStage;
+
+    if (!psLatency)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+
+    fprintf(psStream, "# Request latencies (us)\n");
+    fprintf(psStream, "%-40s %-9s %10s %10s %10s %10s %10s %10s\n",
+            "Command / Node", "Stage", "Count", "Mean", "P50", "P90", "P99", "Max");
+
+    for (u32Index = 0; u32Index < JIP_SERVER_LATENCY_NUM_COMMANDS; u32Index++)
+    {
+        for (iStage = 0; iStage < E_UTILS_LATENCY_NUM_STAGES; iStage++)
+        {
+            vUtils_HistogramSummarise(&psLatency->aasCommands[u32Index][iStage], &sSummary);
+            if (sSummary.u32Count)
+            {
+                vLatency_DumpRow(psStream, apcLatencyCommandNames[u32Index], apcLatencyStageNames[iStage], &sSummary);
+            }
+        }
+    }
+
+    u32NumNodes = psLatency->u32NumNodes;
+    for (u32Index = 0; u32Index < u32NumNodes; u32Index++)
+    {
+        tsLatencyNode *psNode = psLatency->apsNodes[u32Index];
+        char acAddress[INET6_ADDRSTRLEN] = "?";
+
+        inet_ntop(AF_INET6, &psNode->sAddress, acAddress, sizeof(acAddress));
+        for (iStage = 0; iStage < E_UTILS_LATENCY_NUM_STAGES; iStage++)
+        {
+            vUtils_HistogramSummarise(&psNode->asStages[iStage], &sSummary);
+            if (sSummary.u32Count)
+            {
+                vLatency_DumpRow(psStream, acAddress, apcLatencyStageNames[iStage], &sSummary);
+            }
+        }
+    }
+    return E_JIP_OK;
+}
+
@@ -0,0 +1,420 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2013. All rights reserved
+ *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#define DBG_FUNCTION_CALLS 0
+#define DBG_TRAPS 0
+
+/** Longest time the notify thread sleeps without being woken */
+#define TRAPS_IDLE_WAIT_MS 1000
+
+
+static void *pvTraps_NotifyThread(tsUtilsThread *psThreadInfo);
+
+
+/* Read the monotonic clock in milliseconds */
+static uint64_t u64Traps_TimeNow(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000) + (sNow.tv_nsec / 1000000);
+}
+
+
+/* Get the trap table of the server context that owns a variable, if it has any traps */
+static tsTraps *psTraps_VarTraps(tsVar *psVar)
+{
+    tsJIP_Context *psJIP_Context;
+    tsJIP_Private *psJIP_Private;
+    
+    /* Variables outside of a network, such as cached definitions, can't be trapped */
+    if (!psVar->psOwnerMib || !psVar->psOwnerMib->psOwnerNode || !psVar->psOwnerMib->psOwnerNode->psOwnerNetwork)
+    {
+        return NULL;
+    }
+    
+    psJIP_Context = psVar->psOwnerMib->psOwnerNode->psOwnerNetwork->psOwnerContext;
+    if (!psJIP_Context || !psJIP_Context->pvPriv)
+    {
+        return NULL;
+    }
+    
+    psJIP_Private = (tsJIP_Private *)psJIP_Context->pvPriv;
+    if ((psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_SERVER) || (psJIP_Private->sTraps.u32NumTraps == 0))
+    {
+        return NULL;
+    }
+    return &psJIP_Private->sTraps;
+}
+
+
+/* Write a notification of the current value of a variable. Returns the length, or 0 if it has no value to send */
+static uint32_t u32Traps_BuildNotify(tsVar *psVar, uint8_t *pu8Packet)
+{
+    tsJIP_Msg_VarDescriptionHeader *psNotify = (tsJIP_Msg_VarDescriptionHeader *)pu8Packet;
+    
+    if ((psVar->eEnable != E_JIP_VAR_ENABLED) || !psVar->pvData)
+    {
+        return 0;
+    }
+    
+    psNotify->sHeader.u8Version = JIP_VERSION;
+    psNotify->sHeader.eCommand  = E_JIP_COMMAND_TRAP_NOTIFY;
+    psNotify->sHeader.u8Handle  = 0;
+    psNotify->u8MibIndex        = psVar->psOwnerMib->u8Index;
+    psNotify->u8VarIndex        = psVar->u8Index;
+    psNotify->eStatus           = E_JIP_OK;
+    psNotify->eVarType          = psVar->eVarType;
+    
+    return sizeof(tsJIP_Msg_VarDescriptionHeader) + u32JIPserver_EncodeVarData(psVar, psNotify->au8Payload);
+}
+
+
+teJIP_Status eTraps_Init(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsTraps *psTraps = &psJIP_Private->sTraps;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    memset(psTraps, 0, sizeof(tsTraps));
+    psTraps->u32MinIntervalMs = JIP_SERVER_TRAP_MIN_INTERVAL_MS;
+    
+    if (eUtils_LockCreateHere(&psTraps->sLock) != E_UTILS_OK)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    /* A single slot is enough to wake the thread - further wakeups are dropped until it runs */
+    if (eUtils_QueueCreate(&psTraps->sWakeQueue, 1, UTILS_QUEUE_NONBLOCK_INPUT | UTILS_QUEUE_SINGLE_CONSUMER) != E_UTILS_OK)
+    {
+        eUtils_LockDestroy(&psTraps->sLock);
+        return E_JIP_ERROR_FAILED;
+    }
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eTraps_Start(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsTraps *psTraps = &psJIP_Private->sTraps;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psTraps->sNotifyThread.pvPriv)
+    {
+        /* Already running */
+        return E_JIP_OK;
+    }
+    
+    psTraps->sNotifyThread.pvThreadData = psJIP_Context;
+    if (eUtils_ThreadStart(pvTraps_NotifyThread, &psTraps->sNotifyThread, E_THREAD_JOINABLE) != E_UTILS_OK)
+    {
+        DBG_vPrintf(DBG_TRAPS, "Failed to start trap notify thread\n");
+        psTraps->sNotifyThread.pvPriv = NULL;
+        return E_JIP_ERROR_FAILED;
+    }
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eTraps_Destroy(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsTraps *psTraps = &psJIP_Private->sTraps;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psTraps->sNotifyThread.pvPriv)
+    {
+        /* Mark the thread stopping before waking it, so it can't go back to sleep */
+        psTraps->sNotifyThread.eState = E_THREAD_STOPPING;
+        (void)eUtils_QueueQueue(&psTraps->sWakeQueue, NULL);
+        eUtils_ThreadStop(&psTraps->sNotifyThread);
+        psTraps->sNotifyThread.pvPriv = NULL;
+    }
+    
+    eUtils_QueueDestroy(&psTraps->sWakeQueue);
+    eUtils_LockDestroy(&psTraps->sLock);
+    psTraps->u32NumTraps = 0;
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eTraps_Add(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psSubscriber, uint8_t u8NotificationHandle)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsTraps *psTraps = &psJIP_Private->sTraps;
+    tsTrap *psTrap = NULL;
+    tsTrap *psOldest = NULL;
+    int i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eUtils_LockLock(&psTraps->sLock);
+    
+    for (i = 0; i < JIP_SERVER_MAX_TRAPS; i++)
+    {
+        tsTrap *psSlot = &psTraps->asTraps[i];
+        
+        if (!psSlot->iInUse)
+        {
+            if (!psTrap)
+            {
+                psTrap = psSlot;
+            }
+            continue;
+        }
+        
+        if ((psSlot->psVar == psVar) && (memcmp(&psSlot->sSubscriber, psSubscriber, sizeof(tsJIPAddress)) == 0))
+        {
+            /* Subscriber is renewing its trap */
+            psTrap = psSlot;
+            break;
+        }
+        
+        if (!psOldest || (psSlot->u64Requested < psOldest->u64Requested))
+        {
+            psOldest = psSlot;
+        }
+    }
+    
+    if (!psTrap)
+    {
+        /* Table is full. Subscribers don't always untrap when they go away, so make room by
+         * dropping the trap that was requested longest ago. */
+        DBG_vPrintf(DBG_TRAPS, "Trap table full - replacing oldest trap\n");
+        psTrap = psOldest;
+        psTrap->iInUse = 0;
+        psTraps->u32NumTraps--;
+    }
+    
+    if (!psTrap->iInUse)
+    {
+        memset(psTrap, 0, sizeof(tsTrap));
+        psTrap->iInUse      = 1;
+        psTrap->psVar       = psVar;
+        psTrap->psNode      = psVar->psOwnerMib->psOwnerNode;
+        psTrap->sSubscriber = *psSubscriber;
+        memcpy(&psTrap->sNodeAddress, &psTrap->psNode->sNode_Address.sin6_addr, sizeof(struct in6_addr));
+        psTraps->u32NumTraps++;
+    }
+    
+    psTrap->u8NotificationHandle = u8NotificationHandle;
+    psTrap->u64Requested = u64Traps_TimeNow();
+    
+    DBG_vPrintf(DBG_TRAPS, "Trap on Mib %d, variable %d, handle %d (%d traps)\n",
+                psVar->psOwnerMib->u8Index, psVar->u8Index, u8NotificationHandle, psTraps->u32NumTraps);
+    
+    eUtils_LockUnlock(&psTraps->sLock);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eTraps_Remove(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psSubscriber)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsTraps *psTraps = &psJIP_Private->sTraps;
+    int i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eUtils_LockLock(&psTraps->sLock);
+    
+    for (i = 0; i < JIP_SERVER_MAX_TRAPS; i++)
+    {
+        tsTrap *psTrap = &psTraps->asTraps[i];
+        
+        if (psTrap->iInUse && (psTrap->psVar == psVar) &&
+            (memcmp(&psTrap->sSubscriber, psSubscriber, sizeof(tsJIPAddress)) == 0))
+        {
+            DBG_vPrintf(DBG_TRAPS, "Untrap on Mib %d, variable %d\n", psVar->psOwnerMib->u8Index, psVar->u8Index);
+            psTrap->iInUse = 0;
+            psTraps->u32NumTraps--;
+        }
+    }
+    
+    eUtils_LockUnlock(&psTraps->sLock);
+    
+    /* Removing a trap that doesn't exist is not an error - the client gets what it asked for */
+    return E_JIP_OK;
+}
+
+
+void vTraps_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsTraps *psTraps = &psJIP_Private->sTraps;
+    int i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psTraps->u32NumTraps == 0)
+    {
+        return;
+    }
+    
+    eUtils_LockLock(&psTraps->sLock);
+    
+    for (i = 0; i < JIP_SERVER_MAX_TRAPS; i++)
+    {
+        tsTrap *psTrap = &psTraps->asTraps[i];
+        
+        if (psTrap->iInUse && (psTrap->psNode == psNode))
+        {
+            psTrap->iInUse = 0;
+            psTraps->u32NumTraps--;
+        }
+    }
+    
+    eUtils_LockUnlock(&psTraps->sLock);
+}
+
+
+void vTraps_VarChanged(tsVar *psVar)
+{
+    tsTraps *psTraps;
+    uint8_t au8Packet[JIP_SERVER_TRAP_PACKET_SIZE];
+    uint32_t u32PacketLength = 0;
+    int iWake = 0;
+    int i;
+    
+    psTraps = psTraps_VarTraps(psVar);
+    if (!psTraps)
+    {
+        return;
+    }
+    
+    eUtils_LockLock(&psTraps->sLock);
+    
+    for (i = 0; i < JIP_SERVER_MAX_TRAPS; i++)
+    {
+        tsTrap *psTrap = &psTraps->asTraps[i];
+        
+        if (!psTrap->iInUse || (psTrap->psVar != psVar))
+        {
+            continue;
+        }
+        
+        if (!u32PacketLength)
+        {
+            /* Build the notification once, and only if somebody wants it. The caller owns the
+             * variable, so its value is read here rather than by the notify thread. */
+            u32PacketLength = u32Traps_BuildNotify(psVar, au8Packet);
+            if (!u32PacketLength)
+            {
+                break;
+            }
+        }
+        
+        /* A pending notification is replaced by the latest value */
+        memcpy(psTrap->au8Packet, au8Packet, u32PacketLength);
+        ((tsJIP_MsgHeader *)psTrap->au8Packet)->u8Handle = psTrap->u8NotificationHandle;
+        psTrap->u32PacketLength = u32PacketLength;
+        
+        if (!psTrap->iPending)
+        {
+            /* The thread works out when it is due. Once pending, later changes don't need to wake it */
+            psTrap->iPending = 1;
+            iWake = 1;
+        }
+    }
+    
+    eUtils_LockUnlock(&psTraps->sLock);
+    
+    if (iWake)
+    {
+        /* If the queue is full the thread has already been woken */
+        (void)eUtils_QueueQueue(&psTraps->sWakeQueue, NULL);
+    }
+}
+
+
+static void *pvTraps_NotifyThread(tsUtilsThread *psThreadInfo)
+{
+    tsJIP_Context *psJIP_Context = (tsJIP_Context *)psThreadInfo->pvThreadData;
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsTraps *psTraps = &psJIP_Private->sTraps;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    /* Don't mark the thread running here - eTraps_Destroy may already have asked it to stop */
+    while (psThreadInfo->eState != E_THREAD_STOPPING)
+    {
+        uint32_t u32WaitMs = TRAPS_IDLE_WAIT_MS;
+        uint64_t u64Now = u64Traps_TimeNow();
+        void *pvWake;
+        int i;
+        
+        eUtils_LockLock(&psTraps->sLock);
+        
+        for (i = 0; i < JIP_SERVER_MAX_TRAPS; i++)
+        {
+            tsTrap *psTrap = &psTraps->asTraps[i];
+            uint64_t u64Due;
+            
+            if (!psTrap->iInUse || !psTrap->iPending)
+            {
+                continue;
+            }
+            
+            u64Due = psTrap->u64LastSent + psTraps->u32MinIntervalMs;
+            if (u64Due > u64Now)
+            {
+                /* Rate limited - changes until then are coalesced */
+                if ((u64Due - u64Now) < u32WaitMs)
+                {
+                    u32WaitMs = u64Due - u64Now;
+                }
+                continue;
+            }
+            
+            if (Network_ServerSend(&psJIP_Private->sNetworkContext, &psTrap->sNodeAddress, &psTrap->sSubscriber,
+                                   (char *)psTrap->au8Packet, psTrap->u32PacketLength) != E_NETWORK_OK)
+            {
+                DBG_vPrintf(DBG_TRAPS, "Failed to send trap notification\n");
+            }
+            
+            psTrap->iPending = 0;
+            psTrap->u64LastSent = u64Now;
+        }
+        
+        eUtils_LockUnlock(&psTraps->sLock);
+        
+        (void)eUtils_QueueDequeueTimed(&psTraps->sWakeQueue, u32WaitMs, &pvWake);
+    }
+    
+    DBG_vPrintf(DBG_TRAPS, "%s: exit\n", __FUNCTION__);
+    
+    /* Return from thread clearing resources */
+    eUtils_ThreadFinish(psThreadInfo);
+    return NULL;
+}
@@ -42,7 +42,8 @@
 static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetIndexRequest *psGetVar,
                                          uint8_t *pcSendData, unsigned int *piSendDataLength);
 
-static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetIndexRequest *psSetVar,
+static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress,
+                                         tsMulticastRequest *psMulticastRequest, tsJIP_Msg_SetIndexRequest *psSetVar,
                                          unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
 
 static teJIP_Status eJIPserver_HandleQueryMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_QueryMibRequest *psQueryMib,
@@ -61,11 +62,30 @@ static teJIP_Status eJIPserver_HandleUntrap(tsJIP_Context *psJIP_Context, tsNode
 
 
 static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetMibRequest *psGetVar,
-                                            uint8_t *pcSendData, unsigned int *piSendDataLength);
+                                            unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
 
-static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetMibRequest *psSetVar,
+static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress,
+                                            tsMulticastRequest *psMulticastRequest, tsJIP_Msg_SetMibRequest *psSetVar,
                                             unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
 
+static teJIP_Status eJIPserver_HandleSetVars(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress,
+                                             tsMulticastRequest *psMulticastRequest, tsJIP_Msg_SetVarsRequest *psSetVars,
+                                             unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
+
+/** Check that a variable may be set by a client with a value of type eVarType */
+static teJIP_Status eJIPserver_SetVarCheck(tsVar *psVar, teJIP_VarType eVarType);
+
+/** Length of the data of a variable in a set request, or -1 if it is longer than the iDataLength bytes there are */
+static int iJIPserver_SetVarDataLength(tsVar *psVar, uint8_t *pu8Data, unsigned int iDataLength);
+
+/** Set a variable from the iDataLength bytes of data for it in a set request */
+static teJIP_Status eJIPserver_SetVarData(tsJIP_Context *psJIP_Context, tsVar *psVar, uint8_t *pu8Data, unsigned int iDataLength);
+
+/** Call the setter of a variable that has been set by a request */
+static teJIP_Status eJIPserver_SetVarCallback(tsMulticastRequest *psMulticastRequest, tsVar *psVar, tsJIPAddress *psDstAddress);
+
+static teJIP_Status eJIPserver_GroupSet(tsMulticastRequest *psMulticastRequest, tsVar *psVar, tsJIPAddress *psDstAddress);
+
 
 
 teJIP_Status eJIPserver_Listen(tsJIP_Context *psJIP_Context, const int iPort)
@@ -83,7 +103,8 @@ teJIP_Status eJIPserver_Listen(tsJIP_Context *psJIP_Context, const int iPort)
     
     if (Network_Listen(&psJIP_Private->sNetworkContext, iPort) == E_NETWORK_OK)
     {
-        eStatus = E_JIP_OK;
+        /* Trap notifications are sent from the listening socket */
+        eStatus = eTraps_Start(psJIP_Context);
     }
     
     eJIP_Unlock(psJIP_Context);
@@ -92,6 +113,24 @@ teJIP_Status eJIPserver_Listen(tsJIP_Context *psJIP_Context, const int iPort)
 }
 
 
+teJIP_Status eJIPserver_TrapMinInterval(tsJIP_Context *psJIP_Context, uint32_t u32MinIntervalMs)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%dms)\n", __FUNCTION__, u32MinIntervalMs);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_SERVER)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    eUtils_LockLock(&psJIP_Private->sTraps.sLock);
+    psJIP_Private->sTraps.u32MinIntervalMs = u32MinIntervalMs;
+    eUtils_LockUnlock(&psJIP_Private->sTraps.sLock);
+    
+    return E_JIP_OK;
+}
+
+
 teJIP_Status eJIPserver_NodeAdd(tsJIP_Context *psJIP_Context, const char *pcAddress, uint32_t u32DeviceId,
                                 char *pcName, const char *pcVersion, 
                                 tsNode **ppsNode)
@@ -241,6 +280,31 @@ teJIP_Status eJIPserver_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode)
         
     /* Node found to remove from the network */
     
+    /* Nobody can trap its variables any more */
+    vTraps_NodeRemove(psJIP_Context, psRemovedNode);
+    
+    {
+        /* Take it out of its multicast groups, so that multicasts are no longer handed to it */
+        tsNode_Private *psNode_Private = (tsNode_Private *)psRemovedNode->pvPriv;
+        struct in6_addr sBlankAddress;
+        int iGroupAddressSlot;
+        
+        memset(&sBlankAddress, 0, sizeof(struct in6_addr));
+        
+        eJIP_Lock(psJIP_Context);
+        for (iGroupAddressSlot = 0; 
+             psNode_Private && (iGroupAddressSlot < JIP_DEVICE_MAX_GROUPS); 
+             iGroupAddressSlot++)
+        {
+            if (memcmp(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &sBlankAddress, sizeof(struct in6_addr)))
+            {
+                (void)Network_ServerGroupLeave(&psJIP_Private->sNetworkContext, psRemovedNode, &psNode_Private->asGroupAddresses[iGroupAddressSlot]);
+                memcpy(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &sBlankAddress, sizeof(struct in6_addr));
+            }
+        }
+        eJIP_Unlock(psJIP_Context);
+    }
+    
     /* If the network change callback has been registered, call it here */
     if (psJIP_Private->prCbNetworkChange)
     {
@@ -258,6 +322,7 @@ teJIP_Status eJIPserver_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode)
 
 
 teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                     tsMulticastRequest *psMulticastRequest,
                                      teJIP_Command eReceiveCommand, uint8_t *pcReceiveData, unsigned int iReceiveDataLength,
                                      teJIP_Command *peSendCommand,  uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
@@ -279,7 +344,7 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
             tsJIP_Msg_SetIndexRequest *psSetVar = (tsJIP_Msg_SetIndexRequest *)pcReceiveData;
             *peSendCommand = E_JIP_COMMAND_SET_RESPONSE;
             
-            return eJIPserver_HandleSet(psJIP_Context, psNode, psDstAddress, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
+            return eJIPserver_HandleSet(psJIP_Context, psNode, psDstAddress, psMulticastRequest, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
         }
             
         case (E_JIP_COMMAND_QUERY_MIB_REQUEST):
@@ -299,10 +364,12 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
         }
             
         case (E_JIP_COMMAND_TRAP_REQUEST):
-            break;
+            return eJIPserver_HandleTrap(psJIP_Context, psNode, psSrcAddress, eReceiveCommand, pcReceiveData, iReceiveDataLength,
+                                         peSendCommand, pcSendData, piSendDataLength);
             
         case (E_JIP_COMMAND_UNTRAP_REQUEST):
-            break;
+            return eJIPserver_HandleUntrap(psJIP_Context, psNode, psSrcAddress, eReceiveCommand, pcReceiveData, iReceiveDataLength,
+                                           peSendCommand, pcSendData, piSendDataLength);
             
         case (E_JIP_COMMAND_GET_MIB_REQUEST):
         {
@@ -315,7 +382,7 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
                 psGetVar->sRequest.u8VarCount = 1;
             }
             
-            return eJIPserver_HandleGetMib(psJIP_Context, psNode, psGetVar, pcSendData, piSendDataLength);
+            return eJIPserver_HandleGetMib(psJIP_Context, psNode, psGetVar, iReceiveDataLength, pcSendData, piSendDataLength);
         }
         
         case (E_JIP_COMMAND_SET_MIB_REQUEST):
@@ -323,7 +390,15 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
             tsJIP_Msg_SetMibRequest *psSetVar = (tsJIP_Msg_SetMibRequest *)pcReceiveData;
             *peSendCommand = E_JIP_COMMAND_SET_RESPONSE;
             
-            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psDstAddress, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
+            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psDstAddress, psMulticastRequest, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
+        }
+        
+        case (E_JIP_COMMAND_SET_VARS_REQUEST):
+        {
+            tsJIP_Msg_SetVarsRequest *psSetVars = (tsJIP_Msg_SetVarsRequest *)pcReceiveData;
+            *peSendCommand = E_JIP_COMMAND_SET_RESPONSE;
+            
+            return eJIPserver_HandleSetVars(psJIP_Context, psNode, psDstAddress, psMulticastRequest, psSetVars, iReceiveDataLength, pcSendData, piSendDataLength);
         }
             
         default:
@@ -354,7 +429,7 @@ static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *p
             psGetVarByMib.u32MibId = psMib->u32MibId;
             psGetVarByMib.sRequest = psGetVar->sRequest;
             
-            return eJIPserver_HandleGetMib(psJIP_Context, psNode, &psGetVarByMib, pcSendData, piSendDataLength);
+            return eJIPserver_HandleGetMib(psJIP_Context, psNode, &psGetVarByMib, sizeof(tsJIP_Msg_GetMibRequest), pcSendData, piSendDataLength);
         }
     }
     
@@ -369,7 +444,8 @@ static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *p
 }
 
 
-static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetIndexRequest *psSetVar,
+static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress,
+                                         tsMulticastRequest *psMulticastRequest, tsJIP_Msg_SetIndexRequest *psSetVar,
                                          unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
     tsMib *psMib;
@@ -388,7 +464,7 @@ static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *p
             psSetVarByMib.u32MibId = psMib->u32MibId;
             psSetVarByMib.sRequest = psSetVar->sRequest;
             
-            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psDstAddress, &psSetVarByMib, iReceiveDataLength, pcSendData, piSendDataLength);
+            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psDstAddress, psMulticastRequest, &psSetVarByMib, iReceiveDataLength, pcSendData, piSendDataLength);
         }
     }
     
@@ -435,6 +511,12 @@ static teJIP_Status eJIPserver_HandleQueryMib(tsJIP_Context *psJIP_Context, tsNo
     {
         tsJIP_Msg_QueryMibResponseListEntryHeader* psMibResposeEntry = (tsJIP_Msg_QueryMibResponseListEntryHeader*)&pcSendData[iPacketOffset];
         
+        if ((iPacketOffset + sizeof(tsJIP_Msg_QueryMibResponseListEntryHeader) + strlen(psMib->pcName)) > JIP_PACKET_MAX_SIZE)
+        {
+            /* Packet is full - the rest are outstanding */
+            break;
+        }
+        
         DBG_vPrintf(DBG_JIP_SERVER, "Adding MIB %d(0x%08x): %s\n", psMib->u8Index, psMib->u32MibId, psMib->pcName);
 
         psMibResposeEntry->u8MibIndex   = psMib->u8Index;
@@ -507,6 +589,13 @@ static teJIP_Status eJIPserver_HandleQueryVar(tsJIP_Context *psJIP_Context, tsNo
         tsJIP_Msg_QueryVarResponseListEntryHeader* psVarResposeEntry = (tsJIP_Msg_QueryVarResponseListEntryHeader*)&pcSendData[iPacketOffset];
         tsJIP_Msg_QueryVarResponseListEntryFooter* psVarResposeEntryFooter;
         
+        if ((iPacketOffset + sizeof(tsJIP_Msg_QueryVarResponseListEntryHeader) + sizeof(tsJIP_Msg_QueryVarResponseListEntryFooter) +
+             strlen(psVar->pcName)) > JIP_PACKET_MAX_SIZE)
+        {
+            /* Packet is full - the rest are outstanding */
+            break;
+        }
+        
         DBG_vPrintf(DBG_JIP_SERVER, "Adding Var %d: %s\n", psVar->u8Index, psVar->pcName);
 
         psVarResposeEntry->u8VarIndex           = psVar->u8Index;
@@ -532,11 +621,73 @@ static teJIP_Status eJIPserver_HandleQueryVar(tsJIP_Context *psJIP_Context, tsNo
 }
 
 
+/* Find the variable that a trap or untrap request refers to */
+static teJIP_Status eJIPserver_LookupTrapVar(tsNode *psNode, tsJIP_Msg_TrapRequest *psTrapRequest, tsVar **ppsVar)
+{
+    tsMib *psMib;
+    tsVar *psVar;
+    
+    for(psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+    {
+        if (psMib->u8Index == psTrapRequest->u8MibIndex)
+        {
+            break;
+        }
+    }
+    
+    if (!psMib)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB %d not found\n", __FUNCTION__, psTrapRequest->u8MibIndex);
+        return E_JIP_ERROR_BAD_MIB_INDEX;
+    }
+    
+    psVar = psJIP_LookupVarIndex(psMib, psTrapRequest->u8VarIndex);
+    if (!psVar)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable %d in MIB %d not found\n", __FUNCTION__, psTrapRequest->u8VarIndex, psTrapRequest->u8MibIndex);
+        return E_JIP_ERROR_BAD_VAR_INDEX;
+    }
+    
+    if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        /* Table rows change individually - there is no single value to notify */
+        return E_JIP_ERROR_WRONG_TYPE;
+    }
+    
+    *ppsVar = psVar;
+    return E_JIP_OK;
+}
+
+
 static teJIP_Status eJIPserver_HandleTrap(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress,
                                      teJIP_Command eReceiveCommand, uint8_t *pcReceiveData, unsigned int iReceiveDataLength,
                                      teJIP_Command *peSendCommand,  uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
-    return E_JIP_ERROR_FAILED;
+    tsJIP_Msg_TrapRequest *psTrapRequest = (tsJIP_Msg_TrapRequest *)pcReceiveData;
+    tsJIP_Msg_VarStatus *psTrapResponse = (tsJIP_Msg_VarStatus *)pcSendData;
+    tsVar *psVar;
+    teJIP_Status eStatus;
+    
+    if (iReceiveDataLength < sizeof(tsJIP_Msg_TrapRequest))
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib Index %d, Var %d, Handle %d)\n", __FUNCTION__, 
+                psTrapRequest->u8MibIndex, psTrapRequest->u8VarIndex, psTrapRequest->u8NotificationHandle);
+    
+    eStatus = eJIPserver_LookupTrapVar(psNode, psTrapRequest, &psVar);
+    if (eStatus == E_JIP_OK)
+    {
+        eStatus = eTraps_Add(psJIP_Context, psVar, psSrcAddress, psTrapRequest->u8NotificationHandle);
+    }
+    
+    *peSendCommand = E_JIP_COMMAND_TRAP_RESPONSE;
+    psTrapResponse->u8MibIndex  = psTrapRequest->u8MibIndex;
+    psTrapResponse->u8VarIndex  = psTrapRequest->u8VarIndex;
+    psTrapResponse->eStatus     = eStatus;
+    *piSendDataLength = sizeof(tsJIP_Msg_VarStatus);
+    return E_JIP_OK;
 }
 
 
@@ -544,16 +695,109 @@ static teJIP_Status eJIPserver_HandleUntrap(tsJIP_Context *psJIP_Context, tsNode
                                      teJIP_Command eReceiveCommand, uint8_t *pcReceiveData, unsigned int iReceiveDataLength,
                                      teJIP_Command *peSendCommand,  uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
-    return E_JIP_ERROR_FAILED;
+    tsJIP_Msg_TrapRequest *psTrapRequest = (tsJIP_Msg_TrapRequest *)pcReceiveData;
+    tsJIP_Msg_VarStatus *psTrapResponse = (tsJIP_Msg_VarStatus *)pcSendData;
+    tsVar *psVar;
+    teJIP_Status eStatus;
+    
+    if (iReceiveDataLength < sizeof(tsJIP_Msg_TrapRequest))
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib Index %d, Var %d, Handle %d)\n", __FUNCTION__, 
+                psTrapRequest->u8MibIndex, psTrapRequest->u8VarIndex, psTrapRequest->u8NotificationHandle);
+    
+    eStatus = eJIPserver_LookupTrapVar(psNode, psTrapRequest, &psVar);
+    if (eStatus == E_JIP_OK)
+    {
+        eStatus = eTraps_Remove(psJIP_Context, psVar, psSrcAddress);
+    }
+    
+    *peSendCommand = E_JIP_COMMAND_TRAP_RESPONSE;
+    psTrapResponse->u8MibIndex  = psTrapRequest->u8MibIndex;
+    psTrapResponse->u8VarIndex  = psTrapRequest->u8VarIndex;
+    psTrapResponse->eStatus     = eStatus;
+    *piSendDataLength = sizeof(tsJIP_Msg_VarStatus);
+    return E_JIP_OK;
+}
+
+
+/* Write the value of a variable into a get response or trap notification. Returns the number of bytes written */
+uint32_t u32JIPserver_EncodeVarData(tsVar *psVar, uint8_t *pu8Data)
+{
+    uint32_t u32Size = 0;
+    
+    switch(psVar->eVarType)
+    {
+        case (E_JIP_VAR_TYPE_INT8):
+        case (E_JIP_VAR_TYPE_UINT8):
+            u32Size = sizeof(uint8_t);
+            pu8Data[0] = *psVar->pu8Data;
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT16):
+        case (E_JIP_VAR_TYPE_UINT16):
+        {
+            uint16_t u16Var = htons(*psVar->pu16Data);
+            u32Size = sizeof(uint16_t);
+            memcpy(pu8Data, &u16Var, sizeof(uint16_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_INT32):
+        case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
+        {
+            uint32_t u32Var = htonl(*psVar->pu32Data);
+            u32Size = sizeof(uint32_t);
+            memcpy(pu8Data, &u32Var, sizeof(uint32_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_INT64):
+        case (E_JIP_VAR_TYPE_UINT64):
+        case (E_JIP_VAR_TYPE_DBL):
+        {
+            uint64_t u64Var = htobe64(*psVar->pu64Data);
+            u32Size = sizeof(uint64_t);
+            memcpy(pu8Data, &u64Var, sizeof(uint64_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_STR):
+            u32Size = strlen(psVar->pcData);
+            if (u32Size > 255)
+            {
+                /* Can't be described by the length byte */
+                u32Size = 255;
+            }
+            pu8Data[0] = (uint8_t)u32Size;
+            memcpy(&pu8Data[1], psVar->pcData, u32Size);
+            u32Size += sizeof(uint8_t); /* Size of length component */
+            break;
+            
+        case (E_JIP_VAR_TYPE_BLOB):
+            u32Size = psVar->u8Size;
+            pu8Data[0] = (uint8_t)u32Size;
+            memcpy(&pu8Data[1], psVar->pbData, u32Size);
+            u32Size += sizeof(uint8_t); /* Size of length component */
+            break;
+            
+        default:
+            break;
+    }
+    return u32Size;
 }
 
 
 static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetMibRequest *psGetVar,
-                                              uint8_t *pcSendData, unsigned int *piSendDataLength)
+                                            unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
     tsMib *psMib;
     tsVar *psVar;
     tsJIP_Msg_VarDescriptionHeader *psGetMibResponseHeader = (tsJIP_Msg_VarDescriptionHeader *)pcSendData;
+    tsJIP_Msg_TableChangesSince *psSince = NULL;
     teJIP_Status eStatus = E_JIP_OK;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib ID 0x%08x, Var %d)\n", __FUNCTION__, 
@@ -628,9 +872,15 @@ static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode
             return E_JIP_OK;
         }
 
+        /* The request may be followed by a change stamp */
+        if (iReceiveDataLength >= (sizeof(tsJIP_Msg_GetMibRequest) + sizeof(tsJIP_Msg_TableChangesSince)))
+        {
+            psSince = (tsJIP_Msg_TableChangesSince *)&((uint8_t *)psGetVar)[sizeof(tsJIP_Msg_GetMibRequest)];
+        }
+        
         return eJIPserver_HandleGetTableVar(psJIP_Context, psVar, 
                                             psGetVar->sRequest.u16FirstEntry, psGetVar->sRequest.u8EntryCount,
-                                            pcSendData, piSendDataLength);
+                                            psSince, pcSendData, piSendDataLength);
     }
     else
     {
@@ -685,60 +935,7 @@ static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode
                 continue;
             }
 
-            switch(psVar->eVarType)
-            {
-                case (E_JIP_VAR_TYPE_INT8):
-                case (E_JIP_VAR_TYPE_UINT8):
-                    u32Size = sizeof(uint8_t);
-                    *(uint8_t *)psEntry->au8Data = *psVar->pu8Data;
-                    break;
-                    
-                case (E_JIP_VAR_TYPE_INT16):
-                case (E_JIP_VAR_TYPE_UINT16):
-                {
-                    uint16_t u16Var = htons(*psVar->pu16Data);
-                    u32Size = sizeof(uint16_t);
-                    memcpy(psEntry->au8Data, &u16Var, sizeof(uint16_t));
-                    break;
-                }
-                
-                case (E_JIP_VAR_TYPE_INT32):
-                case (E_JIP_VAR_TYPE_UINT32):
-                case (E_JIP_VAR_TYPE_FLT):
-                {
-                    uint32_t u32Var = htonl(*psVar->pu32Data);
-                    u32Size = sizeof(uint32_t);
-                    memcpy(psEntry->au8Data, &u32Var, sizeof(uint32_t));
-                    break;
-                }
-                
-                case (E_JIP_VAR_TYPE_INT64):
-                case (E_JIP_VAR_TYPE_UINT64):
-                case (E_JIP_VAR_TYPE_DBL):
-                {
-                    uint64_t u64Var = htobe64(*psVar->pu64Data);
-                    u32Size = sizeof(uint64_t);
-                    memcpy(psEntry->au8Data, &u64Var, sizeof(uint64_t));
-                    break;
-                }
-                
-                case (E_JIP_VAR_TYPE_STR):
-                    u32Size = strlen(psVar->pcData);
-                    *(uint8_t *)psEntry->au8Data = (uint8_t)u32Size;
-                    memcpy(&psEntry->au8Data[1], psVar->pcData, u32Size);
-                    u32Size += sizeof(uint8_t); /* Size of length component */
-                    break;
-                    
-                case (E_JIP_VAR_TYPE_BLOB):
-                    u32Size = psVar->u8Size;
-                    *(uint8_t *)psEntry->au8Data = (uint8_t)u32Size;
-                    memcpy(&psEntry->au8Data[1], psVar->pbData, u32Size);
-                    u32Size += sizeof(uint8_t); /* Size of length component */
-                    break;
-                    
-                default:
-                    break;
-            }    
+            u32Size = u32JIPserver_EncodeVarData(psVar, psEntry->au8Data);
             
             psEntry->eStatus     = E_JIP_OK;
             iPacketOffset += sizeof(tsJIP_Msg_VarDescriptionEntry) + u32Size;
@@ -751,7 +948,8 @@ static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode
 }
 
 
-static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetMibRequest *psSetVar,
+static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress,
+                                            tsMulticastRequest *psMulticastRequest, tsJIP_Msg_SetMibRequest *psSetVar,
                                             unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
     tsMib *psMib;
@@ -792,49 +990,263 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
     psSetMibResponse->u8MibIndex  = psMib->u8Index;
     psSetMibResponse->u8VarIndex  = psVar->u8Index;
     
-    if (psSetVar->sRequest.sVar.eVarType != psVar->eVarType)
+    eStatus = eJIPserver_SetVarCheck(psVar, psSetVar->sRequest.sVar.eVarType);
+    if (eStatus != E_JIP_OK)
     {
-        /* Wrong type specified in set message */
-        psSetMibResponse->eStatus = E_JIP_ERROR_WRONG_TYPE;
+        psSetMibResponse->eStatus = eStatus;
         return E_JIP_OK;
     }
     
+    iReceiveDataLength -= sizeof(tsJIP_Msg_SetMibRequest);
+    DBG_vPrintf(DBG_JIP_SERVER, "%s: Data buffer length: %d\n", __FUNCTION__, iReceiveDataLength);
+ 
+    eStatus = eJIPserver_SetVarData(psJIP_Context, psVar, psSetVar->sRequest.sVar.au8Data, iReceiveDataLength);
+    if (eStatus == E_JIP_OK)
+    {
+        /* Only call the set callback if the data has been set ok */
+        eStatus = eJIPserver_SetVarCallback(psMulticastRequest, psVar, psDstAddress);
+        if ((eStatus == E_JIP_ERROR_TIMEOUT) && (psDstAddress->sin6_addr.s6_addr[0] != 0xFF))
+        {
+            /* In case of a timeout, don't return a response */
+            return eStatus;
+        }
+    }
+    
+    DBG_vPrintf(DBG_JIP_SERVER, "%s: Set Variable %d in MIB 0x%08x status: %d\n", __FUNCTION__, psSetVar->sRequest.u8VarIndex, ntohl(psSetVar->u32MibId), eStatus);
+    psSetMibResponse->eStatus     = eStatus;
+
+    return E_JIP_OK;
+}
+
+
+static teJIP_Status eJIPserver_HandleSetVars(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress,
+                                             tsMulticastRequest *psMulticastRequest, tsJIP_Msg_SetVarsRequest *psSetVars,
+                                             unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
+{
+    tsVar *apsVars[JIP_SET_VARS_MAX];
+    uint8_t *apu8Data[JIP_SET_VARS_MAX];
+    int aiDataLength[JIP_SET_VARS_MAX];
+    tsJIP_Msg_VarStatus *psSetVarsResponse = (tsJIP_Msg_VarStatus *)pcSendData;
+    uint8_t *pu8Entry;
+    unsigned int iRemaining;
+    teJIP_Status eStatus = E_JIP_OK;
+    int iMulticast = (psDstAddress->sin6_addr.s6_addr[0] == 0xFF);
+    int i;
+    
+    /* Set response length */
+    *piSendDataLength = sizeof(tsJIP_Msg_VarStatus);
+    psSetVarsResponse->u8MibIndex  = 0;
+    psSetVarsResponse->u8VarIndex  = 0;
+    
+    if ((iReceiveDataLength < sizeof(tsJIP_Msg_SetVarsRequest)) ||
+        (psSetVars->u8NumVars == 0) || (psSetVars->u8NumVars > JIP_SET_VARS_MAX))
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Bad request\n", __FUNCTION__);
+        psSetVarsResponse->eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+        return E_JIP_OK;
+    }
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%d variables)\n", __FUNCTION__, psSetVars->u8NumVars);
+    
+    /* Find and check every variable before setting any, so that a request that can't be made changes nothing */
+    pu8Entry    = psSetVars->au8Vars;
+    iRemaining  = iReceiveDataLength - sizeof(tsJIP_Msg_SetVarsRequest);
+    
+    for (i = 0; i < psSetVars->u8NumVars; i++)
+    {
+        tsJIP_Msg_SetVarsEntry *psEntry = (tsJIP_Msg_SetVarsEntry *)pu8Entry;
+        tsMib *psMib;
+        
+        if (iRemaining < sizeof(tsJIP_Msg_SetVarsEntry))
+        {
+            psSetVarsResponse->eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+            return E_JIP_OK;
+        }
+        
+        psMib = psJIP_LookupMibId(psNode, NULL, ntohl(psEntry->u32MibId));
+        if (!psMib)
+        {
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB 0x%08x not found\n", __FUNCTION__, ntohl(psEntry->u32MibId));
+            psSetVarsResponse->u8MibIndex  = 0;
+            psSetVarsResponse->u8VarIndex  = 0;
+            psSetVarsResponse->eStatus     = E_JIP_ERROR_BAD_MIB_INDEX;
+            return E_JIP_OK;
+        }
+        
+        apsVars[i] = psJIP_LookupVarIndex(psMib, psEntry->sRequest.u8VarIndex);
+        if (!apsVars[i])
+        {
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable %d in MIB 0x%08x not found\n", __FUNCTION__, psEntry->sRequest.u8VarIndex, ntohl(psEntry->u32MibId));
+            psSetVarsResponse->u8MibIndex  = psMib->u8Index;
+            psSetVarsResponse->u8VarIndex  = 0;
+            psSetVarsResponse->eStatus     = E_JIP_ERROR_BAD_VAR_INDEX;
+            return E_JIP_OK;
+        }
+        
+        psSetVarsResponse->u8MibIndex  = psMib->u8Index;
+        psSetVarsResponse->u8VarIndex  = apsVars[i]->u8Index;
+        
+        eStatus = eJIPserver_SetVarCheck(apsVars[i], psEntry->sRequest.sVar.eVarType);
+        if (eStatus != E_JIP_OK)
+        {
+            psSetVarsResponse->eStatus = eStatus;
+            return E_JIP_OK;
+        }
+        
+        apu8Data[i]     = psEntry->sRequest.sVar.au8Data;
+        aiDataLength[i] = iJIPserver_SetVarDataLength(apsVars[i], apu8Data[i], iRemaining - sizeof(tsJIP_Msg_SetVarsEntry));
+        if (aiDataLength[i] < 0)
+        {
+            psSetVarsResponse->eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+            return E_JIP_OK;
+        }
+        
+        pu8Entry   += sizeof(tsJIP_Msg_SetVarsEntry) + aiDataLength[i];
+        iRemaining -= sizeof(tsJIP_Msg_SetVarsEntry) + aiDataLength[i];
+    }
+    
+    if (iRemaining != 0)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: %d bytes left over\n", __FUNCTION__, iRemaining);
+        psSetVarsResponse->eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+        return E_JIP_OK;
+    }
+    
+    for (i = 0; i < psSetVars->u8NumVars; i++)
+    {
+        eStatus = eJIPserver_SetVarData(psJIP_Context, apsVars[i], apu8Data[i], aiDataLength[i]);
+        if (eStatus != E_JIP_OK)
+        {
+            psSetVarsResponse->u8MibIndex  = apsVars[i]->psOwnerMib->u8Index;
+            psSetVarsResponse->u8VarIndex  = apsVars[i]->u8Index;
+            psSetVarsResponse->eStatus     = eStatus;
+            return E_JIP_OK;
+        }
+    }
+    
+    if (!iMulticast && psNode->prCbNodeSet)
+    {
+        /* The node acts on all of the variables at once */
+        eStatus = psNode->prCbNodeSet(psNode, apsVars, psSetVars->u8NumVars);
+    }
+    else
+    {
+        /* Call the set callback of each variable in turn, stopping at the first that fails */
+        for (i = 0; (i < psSetVars->u8NumVars) && (eStatus == E_JIP_OK); i++)
+        {
+            psSetVarsResponse->u8MibIndex  = apsVars[i]->psOwnerMib->u8Index;
+            psSetVarsResponse->u8VarIndex  = apsVars[i]->u8Index;
+            eStatus = eJIPserver_SetVarCallback(psMulticastRequest, apsVars[i], psDstAddress);
+        }
+    }
+    
+    if ((eStatus == E_JIP_ERROR_TIMEOUT) && !iMulticast)
+    {
+        /* In case of a timeout, don't return a response */
+        return eStatus;
+    }
+    
+    DBG_vPrintf(DBG_JIP_SERVER, "%s: Set %d variables status: %d\n", __FUNCTION__, psSetVars->u8NumVars, eStatus);
+    psSetVarsResponse->eStatus = eStatus;
+    
+    return E_JIP_OK;
+}
+
+
+static teJIP_Status eJIPserver_SetVarCheck(tsVar *psVar, teJIP_VarType eVarType)
+{
+    if (eVarType != psVar->eVarType)
+    {
+        /* Wrong type specified in set message */
+        return E_JIP_ERROR_WRONG_TYPE;
+    }
+    
     if ((psVar->eAccessType == E_JIP_ACCESS_TYPE_CONST) || (psVar->eAccessType == E_JIP_ACCESS_TYPE_READ_ONLY))
     {
         /* Can't set const or read only variables */
-        psSetMibResponse->eStatus = E_JIP_ERROR_NO_ACCESS;
-        return E_JIP_OK;
+        return E_JIP_ERROR_NO_ACCESS;
     }
     
     if (psVar->eEnable != E_JIP_VAR_ENABLED)
     {
         /* Variable is disabled */
-        psSetMibResponse->eStatus = E_JIP_ERROR_DISABLED;
-        return E_JIP_OK;
+        return E_JIP_ERROR_DISABLED;
     }
+    return E_JIP_OK;
+}
+
+
+static int iJIPserver_SetVarDataLength(tsVar *psVar, uint8_t *pu8Data, unsigned int iDataLength)
+{
+    unsigned int iLength;
     
+    switch (psVar->eVarType)
+    {
+        case (E_JIP_VAR_TYPE_INT8):
+        case (E_JIP_VAR_TYPE_UINT8):
+            iLength = sizeof(uint8_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT16):
+        case (E_JIP_VAR_TYPE_UINT16):
+            iLength = sizeof(uint16_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT32):
+        case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
+            iLength = sizeof(uint32_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT64):
+        case (E_JIP_VAR_TYPE_UINT64):
+        case (E_JIP_VAR_TYPE_DBL):
+            iLength = sizeof(uint64_t);
+            break;
+            
+        case (E_JIP_VAR_TYPE_STR):
+        case (E_JIP_VAR_TYPE_BLOB):
+            if (iDataLength < sizeof(uint8_t))
+            {
+                return -1;
+            }
+            /* Length prefixed */
+            iLength = sizeof(uint8_t) + pu8Data[0];
+            break;
+            
+        default:
+            return -1;
+    }
+    
+    if (iLength > iDataLength)
+    {
+        return -1;
+    }
+    return iLength;
+}
+
+
+static teJIP_Status eJIPserver_SetVarData(tsJIP_Context *psJIP_Context, tsVar *psVar, uint8_t *pu8Data, unsigned int iDataLength)
+{
     /* Assume that the buffer size is going to be wrong */
-    eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+    teJIP_Status eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
     
-    iReceiveDataLength -= sizeof(tsJIP_Msg_SetMibRequest);
-    DBG_vPrintf(DBG_JIP_SERVER, "%s: Data buffer length: %d\n", __FUNCTION__, iReceiveDataLength);
- 
     switch (psVar->eVarType)
     {
         case (E_JIP_VAR_TYPE_INT8):
         case (E_JIP_VAR_TYPE_UINT8):
-            if (iReceiveDataLength == sizeof(uint8_t))
+            if (iDataLength == sizeof(uint8_t))
             {
-                eStatus = eJIP_SetVar(psJIP_Context, psVar, psSetVar->sRequest.sVar.au8Data, sizeof(uint8_t), E_JIP_FLAG_NONE);
+                eStatus = eJIP_SetVar(psJIP_Context, psVar, pu8Data, sizeof(uint8_t), E_JIP_FLAG_NONE);
             }
             break;
          
         case (E_JIP_VAR_TYPE_INT16):
         case (E_JIP_VAR_TYPE_UINT16):
-            if (iReceiveDataLength == sizeof(uint16_t))
+            if (iDataLength == sizeof(uint16_t))
             {
                 uint16_t u16Var;
-                memcpy(&u16Var, psSetVar->sRequest.sVar.au8Data, sizeof(uint16_t));
+                memcpy(&u16Var, pu8Data, sizeof(uint16_t));
                 u16Var = ntohs(u16Var);
                 eStatus = eJIP_SetVar(psJIP_Context, psVar, &u16Var, sizeof(uint16_t), E_JIP_FLAG_NONE);
             }
@@ -843,10 +1255,10 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
         case (E_JIP_VAR_TYPE_INT32):
         case (E_JIP_VAR_TYPE_UINT32):
         case (E_JIP_VAR_TYPE_FLT):
-            if (iReceiveDataLength == sizeof(uint32_t))
+            if (iDataLength == sizeof(uint32_t))
             {
                 uint32_t u32Var;
-                memcpy(&u32Var, psSetVar->sRequest.sVar.au8Data, sizeof(uint32_t));
+                memcpy(&u32Var, pu8Data, sizeof(uint32_t));
                 u32Var = ntohl(u32Var);
                 eStatus = eJIP_SetVar(psJIP_Context, psVar, &u32Var, sizeof(uint32_t), E_JIP_FLAG_NONE);
             }
@@ -855,23 +1267,23 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
         case (E_JIP_VAR_TYPE_INT64):
         case (E_JIP_VAR_TYPE_UINT64):
         case (E_JIP_VAR_TYPE_DBL):
-            if (iReceiveDataLength == sizeof(uint64_t))
+            if (iDataLength == sizeof(uint64_t))
             {
                 uint64_t u64Var;
-                memcpy(&u64Var, psSetVar->sRequest.sVar.au8Data, sizeof(uint64_t));
+                memcpy(&u64Var, pu8Data, sizeof(uint64_t));
                 u64Var = be64toh(u64Var);                
                 eStatus = eJIP_SetVar(psJIP_Context, psVar, &u64Var, sizeof(uint64_t), E_JIP_FLAG_NONE);
             }
             break;
         
         case (E_JIP_VAR_TYPE_STR):
-            if (iReceiveDataLength >= sizeof(uint8_t))
+            if (iDataLength >= sizeof(uint8_t))
             {
-                uint8_t u8StringLen = *((uint8_t *)psSetVar->sRequest.sVar.au8Data);
+                uint8_t u8StringLen = *pu8Data;
                 
                 DBG_vPrintf(DBG_JIP_SERVER, "%s: Received length: %d\n", __FUNCTION__, u8StringLen);
                 
-                if (u8StringLen == (iReceiveDataLength - 1))
+                if (u8StringLen == (iDataLength - 1))
                 {
                     /* Special case for string due to incoming packet missing the NULL terminator */
                     void *pvNewData;
@@ -884,7 +1296,7 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
                     else
                     {
                         psVar->pvData = pvNewData;
-                        memcpy(psVar->pvData, ((uint8_t *)psSetVar->sRequest.sVar.au8Data)+1, u8StringLen);
+                        memcpy(psVar->pvData, pu8Data + 1, u8StringLen);
                         ((char *)psVar->pvData)[u8StringLen] = '\0';
                         psVar->u8Size = u8StringLen + 1;
                         eStatus = E_JIP_OK;
@@ -894,15 +1306,15 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
             break;
             
         case (E_JIP_VAR_TYPE_BLOB):
-            if (iReceiveDataLength >= sizeof(uint8_t))
+            if (iDataLength >= sizeof(uint8_t))
             {
-                uint8_t u8BlobLen = *((uint8_t *)psSetVar->sRequest.sVar.au8Data);
+                uint8_t u8BlobLen = *pu8Data;
                 
                 DBG_vPrintf(DBG_JIP_SERVER, "%s: Received length: %d\n", __FUNCTION__, u8BlobLen);
                 
-                if (u8BlobLen == (iReceiveDataLength - 1))
+                if (u8BlobLen == (iDataLength - 1))
                 {
-                    eStatus = eJIP_SetVar(psJIP_Context, psVar, ((uint8_t *)psSetVar->sRequest.sVar.au8Data)+1, u8BlobLen, E_JIP_FLAG_NONE);
+                    eStatus = eJIP_SetVar(psJIP_Context, psVar, pu8Data + 1, u8BlobLen, E_JIP_FLAG_NONE);
                 }
             }
             break;
@@ -912,39 +1324,82 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
             break;
         
     }
+    return eStatus;
+}
+
+
+static teJIP_Status eJIPserver_SetVarCallback(tsMulticastRequest *psMulticastRequest, tsVar *psVar, tsJIPAddress *psDstAddress)
+{
+    teJIP_Status eStatus = E_JIP_OK;
     
-    if (eStatus == E_JIP_OK)
+    if (psMulticastRequest && psVar->prCbVarGroupSet)
     {
-        /* Only call the set callback if the data has been set ok */
-        if (psVar->prCbVarSet)
+        /* Multicast to a variable that is set for the whole group at once.
+         * No responses to multicast sets */
+        eStatus = eJIPserver_GroupSet(psMulticastRequest, psVar, psDstAddress);
+    }
+    else if (psVar->prCbVarSet)
+    {
+        /* Variable has set callback - call it */
+        
+        if (psDstAddress->sin6_addr.s6_addr[0] == 0xFF)
         {
-            /* Variable has set callback - call it */
+            /* Multicast */
+            DBG_vPrintf(DBG_JIP_SERVER, "Multicast set request to ");
+            DBG_vPrintf_IPv6Address(DBG_JIP_SERVER, psDstAddress->sin6_addr);
             
-            if (psDstAddress->sin6_addr.s6_addr[0] == 0xFF)
-            {
-                /* Multicast */
-                DBG_vPrintf(DBG_JIP_SERVER, "Multicast set request to ");
-                DBG_vPrintf_IPv6Address(DBG_JIP_SERVER, psDstAddress->sin6_addr);
-                
-                eStatus = psVar->prCbVarSet(psVar, psDstAddress);
-                /* No responses to multicast sets */
-            }
-            else
-            {
-                eStatus = psVar->prCbVarSet(psVar, NULL);
-                if (eStatus == E_JIP_ERROR_TIMEOUT)
-                {
-                    /* In case of a timeout, don't return a response */
-                    return eStatus;
-                }
-            }
+            eStatus = psVar->prCbVarSet(psVar, psDstAddress);
+            /* No responses to multicast sets */
+        }
+        else
+        {
+            eStatus = psVar->prCbVarSet(psVar, NULL);
         }
     }
-    
-    DBG_vPrintf(DBG_JIP_SERVER, "%s: Set Variable %d in MIB 0x%08x status: %d\n", __FUNCTION__, psSetVar->sRequest.u8VarIndex, ntohl(psSetVar->u32MibId), eStatus);
-    psSetMibResponse->eStatus     = eStatus;
+    return eStatus;
+}
 
-    return E_JIP_OK;
+
+static teJIP_Status eJIPserver_GroupSet(tsMulticastRequest *psMulticastRequest, tsVar *psVar, tsJIPAddress *psDstAddress)
+{
+    uint32_t u32MibId = psVar->psOwnerMib->u32MibId;
+    teJIP_Status eStatus;
+    int i;
+    
+    if (psMulticastRequest->iRepeat)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Retransmitted request, MIB 0x%08x, var %d already set for group\n", __FUNCTION__, u32MibId, psVar->u8Index);
+        return E_JIP_OK;
+    }
+    
+    for (i = 0; i < psMulticastRequest->u32NumSets; i++)
+    {
+        if ((psMulticastRequest->asSets[i].u32MibId == u32MibId) &&
+            (psMulticastRequest->asSets[i].u8VarIndex == psVar->u8Index))
+        {
+            /* Already set for the group by an earlier member */
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB 0x%08x, var %d already set for group\n", __FUNCTION__, u32MibId, psVar->u8Index);
+            return psMulticastRequest->asSets[i].eStatus;
+        }
+    }
+    
+    DBG_vPrintf(DBG_JIP_SERVER, "Group set request to ");
+    DBG_vPrintf_IPv6Address(DBG_JIP_SERVER, psDstAddress->sin6_addr);
+    
+    eStatus = psVar->prCbVarGroupSet(psVar, psDstAddress);
+    if (eStatus == E_JIP_ERROR_TIMEOUT)
+    {
+        psMulticastRequest->iTimedOut = 1;
+    }
+    
+    if (psMulticastRequest->u32NumSets < JIP_SERVER_MULTICAST_MAX_SETS)
+    {
+        psMulticastRequest->asSets[psMulticastRequest->u32NumSets].u32MibId    = u32MibId;
+        psMulticastRequest->asSets[psMulticastRequest->u32NumSets].u8VarIndex  = psVar->u8Index;
+        psMulticastRequest->asSets[psMulticastRequest->u32NumSets].eStatus     = eStatus;
+        psMulticastRequest->u32NumSets++;
+    }
+    return eStatus;
 }
 
 
@@ -998,11 +1453,14 @@ teJIP_Status eJIPserver_NodeGroupJoin(tsNode *psNode, const char *pcMulticastAdd
         return E_JIP_ERROR_FAILED;
     }
 
-    // Now we join the group
+    // Now we join the group. The group index is read by the socket listener with the context locked.
+    eJIP_Lock(psJIP_Context);
     if (Network_ServerGroupJoin(&psJIP_Private->sNetworkContext, psNode, &sMulticastAddress) != E_NETWORK_OK)
     {
+        eJIP_Unlock(psJIP_Context);
         return E_JIP_ERROR_FAILED;
     }
+    eJIP_Unlock(psJIP_Context);
 
     // And add it into the groups table.
     memcpy(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &sMulticastAddress, sizeof(struct in6_addr));
@@ -1054,10 +1512,13 @@ teJIP_Status eJIPserver_NodeGroupLeave(tsNode *psNode, const char *pcMulticastAd
     }
 
     // Now we leave the group
+    eJIP_Lock(psJIP_Context);
     if (Network_ServerGroupLeave(&psJIP_Private->sNetworkContext, psNode, &sMulticastAddress) != E_NETWORK_OK)
     {
+        eJIP_Unlock(psJIP_Context);
         return E_JIP_ERROR_FAILED;
     }
+    eJIP_Unlock(psJIP_Context);
 
     // And remove it from the groups table.
     memcpy(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &sBlankAddress, sizeof(struct in6_addr));
@@ -0,0 +1,125 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Bench.h"
+
+
+uint64_t u64Bench_TimeNow(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000) + (sNow.tv_nsec / 1000);
+}
+
+
+uint64_t u64Bench_TimeNowNs(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000000) + sNow.tv_nsec;
+}
+
+
+void vBench_SleepUs(uint64_t u64Us)
+{
+    struct timespec sDelay;
+
+    sDelay.tv_sec  = u64Us / 1000000;
+    sDelay.tv_nsec = (u64Us % 1000000) * 1000;
+    nanosleep(&sDelay, NULL);
+}
+
+
+int iBench_ServerStart(tsJIP_Context *psServer, int iPort, uint32_t u32DeviceID, const tsBenchMib *pasMibs, int iNumMibs)
+{
+    tsJIP_Private *psJIP_Private;
+    tsJIPAddress sAddress;
+    tsNode *psTemplate;
+    int i, j;
+
+    if (eJIP_Init(psServer, E_JIP_CONTEXT_SERVER) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error initialising server\n");
+        return -1;
+    }
+    psJIP_Private = (tsJIP_Private *)psServer->pvPriv;
+
+    /* Define the device without needing a definitions file */
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    psTemplate = psJIP_NetAllocateNode(NULL, &sAddress, u32DeviceID);
+    for (i = 0; psTemplate && (i < iNumMibs); i++)
+    {
+        tsMib *psMib = psJIP_NodeAddMib(psTemplate, pasMibs[i].u32MibId, i, (char *)pasMibs[i].pcName);
+
+        for (j = 0; psMib && pasMibs[i].asVars[j].pcName; j++)
+        {
+            if (!psJIP_MibAddVar(psMib, j, (char *)pasMibs[i].asVars[j].pcName, pasMibs[i].asVars[j].eVarType,
+                                 pasMibs[i].eAccessType, E_JIP_SECURITY_NONE))
+            {
+                psMib = NULL;
+            }
+        }
+        if (!psMib)
+        {
+            psTemplate = NULL;
+        }
+    }
+    if (!psTemplate || (Cache_Add_Node(&psJIP_Private->sCache, psTemplate) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error defining device\n");
+        return -1;
+    }
+
+    if (iPort && (eJIPserver_Listen(psServer, iPort) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error starting server\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+tsNode *psBench_ServerAddNode(tsJIP_Context *psServer, const char *pcAddress, uint32_t u32DeviceID, const char *pcName)
+{
+    tsNode *psNode;
+
+    if (eJIPserver_NodeAdd(psServer, pcAddress, u32DeviceID, (char *)pcName, Version, &psNode) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error adding node %s\n", pcAddress);
+        return NULL;
+    }
+    return psNode;
+}
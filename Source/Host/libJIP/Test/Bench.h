@@ -0,0 +1,80 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** Fixtures shared by the libJIP benches: the clock, and a server context
+ *  serving a device defined without needing a definitions file.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+
+#include <JIP.h>
+
+/** Most variables in a MiB of a served device */
+#define BENCH_MAX_VARS              12
+
+/** A variable of a served device */
+typedef struct
+{
+    const char         *pcName;
+    teJIP_VarType       eVarType;
+} tsBenchVar;
+
+/** A MiB of a served device */
+typedef struct
+{
+    uint32_t            u32MibId;
+    const char         *pcName;
+    teJIP_AccessType    eAccessType;        /**< Access to each of its variables */
+    tsBenchVar          asVars[BENCH_MAX_VARS]; /**< Variables, terminated by a NULL name */
+} tsBenchMib;
+
+/** Version of the bench, given to the nodes it serves */
+extern const char *Version;
+
+/** Read the monotonic clock in microseconds */
+uint64_t u64Bench_TimeNow(void);
+
+/** Read the monotonic clock in nanoseconds */
+uint64_t u64Bench_TimeNowNs(void);
+
+/** Sleep for u64Us microseconds */
+void vBench_SleepUs(uint64_t u64Us);
+
+/** Initialise a server context, define a device with the iNumMibs MiBs in pasMibs,
+ *  and listen for requests on iPort, unless it is 0.
+ *  \return 0 on success, -1 on failure
+ */
+int iBench_ServerStart(tsJIP_Context *psServer, int iPort, uint32_t u32DeviceID, const tsBenchMib *pasMibs, int iNumMibs);
+
+/** Serve a node of a device defined by iBench_ServerStart at pcAddress.
+ *  \return The locked node, or NULL on failure
+ */
+tsNode *psBench_ServerAddNode(tsJIP_Context *psServer, const char *pcAddress, uint32_t u32DeviceID, const char *pcName);
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,396 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** DiscoverBench measures the round trips and time taken to discover a node.
+ *  A server context in this process serves a lamp, as TestServer does, but
+ *  without needing its XML definitions. A client context discovers the lamp
+ *  through a relay, which stands in for the radio: it delays each response
+ *  by a round trip time, and may drop responses larger than a node could
+ *  send. The lamp is discovered with the fixed pages of 4 entries that
+ *  earlier versions asked for and then with pages filling the query page
+ *  size, over a link that carries any response and over one that drops
+ *  large responses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define BENCH_DEVICE_ID             0x08010010
+#define BENCH_ADDRESS               "::1"
+
+#define DEFAULT_PORT                11876
+#define DEFAULT_RELAY_PORT          11877
+#define DEFAULT_RUNS                5
+#define DEFAULT_RTT_US              20000
+#define DEFAULT_LIMIT               96
+
+/** The MiBs of the served lamp. Variables are uint16 unless the discovery reads them as another type */
+static const tsBenchMib asMibs[] =
+{
+    { E_JIP_MIBID_NODE,    "Node",        E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "MacAddress", E_JIP_VAR_TYPE_UINT16 }, { "DescriptiveName", E_JIP_VAR_TYPE_STR },
+        { "Version", E_JIP_VAR_TYPE_STR }, { "TxPowerOffset", E_JIP_VAR_TYPE_UINT16 },
+        { "ChannelMask", E_JIP_VAR_TYPE_UINT16 }, { NULL } } },
+    { 0xFFFFFE80,          "NodeStatus",  E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "SystemStatus", E_JIP_VAR_TYPE_UINT16 }, { "ColdStartCount", E_JIP_VAR_TYPE_UINT16 },
+        { "ResetCount", E_JIP_VAR_TYPE_UINT16 }, { "WatchdogCount", E_JIP_VAR_TYPE_UINT16 },
+        { "BrownoutCount", E_JIP_VAR_TYPE_UINT16 }, { "SecurityFailures", E_JIP_VAR_TYPE_UINT16 },
+        { NULL } } },
+    { 0xFFFFFE81,          "NodeControl", E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "Reset", E_JIP_VAR_TYPE_UINT16 }, { "FactoryReset", E_JIP_VAR_TYPE_UINT16 },
+        { NULL } } },
+    { E_JIP_MIBID_JENNET,  "JenNet",      E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "ParentAddress", E_JIP_VAR_TYPE_UINT16 }, { "NetworkTable", E_JIP_VAR_TYPE_UINT16 },
+        { "RejoinCount", E_JIP_VAR_TYPE_UINT16 }, { "PanId", E_JIP_VAR_TYPE_UINT16 },
+        { "NetworkId", E_JIP_VAR_TYPE_UINT16 }, { "FrameCounter", E_JIP_VAR_TYPE_UINT16 },
+        { "ParentLqi", E_JIP_VAR_TYPE_UINT16 }, { "Children", E_JIP_VAR_TYPE_UINT16 },
+        { NULL } } },
+    { E_JIP_MIBID_GROUPS,  "Groups",      E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "Groups", E_JIP_VAR_TYPE_UINT16 }, { "AddGroup", E_JIP_VAR_TYPE_UINT16 },
+        { "RemoveGroup", E_JIP_VAR_TYPE_UINT16 }, { "ClearGroups", E_JIP_VAR_TYPE_UINT16 },
+        { "AddBroadcastGroup", E_JIP_VAR_TYPE_UINT16 }, { NULL } } },
+    { E_JIP_MIBID_OND,     "OND",         E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "DownloadStatus", E_JIP_VAR_TYPE_UINT16 }, { "DownloadedBlocks", E_JIP_VAR_TYPE_UINT16 },
+        { "SoftwareVersion", E_JIP_VAR_TYPE_UINT16 }, { "BlockSize", E_JIP_VAR_TYPE_UINT16 },
+        { "ImageSize", E_JIP_VAR_TYPE_UINT16 }, { "DeviceId", E_JIP_VAR_TYPE_UINT16 },
+        { "ResetTime", E_JIP_VAR_TYPE_UINT16 }, { NULL } } },
+    { E_JIP_MIBID_DEVICEID, "DeviceID",    E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "DeviceID", E_JIP_VAR_TYPE_UINT32 }, { "DeviceTypes", E_JIP_VAR_TYPE_BLOB },
+        { NULL } } },
+    { 0xFFFFFE88,          "NwkSecurity", E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "Key", E_JIP_VAR_TYPE_UINT16 }, { "KeySequence", E_JIP_VAR_TYPE_UINT16 },
+        { "Commission", E_JIP_VAR_TYPE_UINT16 }, { "Decommission", E_JIP_VAR_TYPE_UINT16 },
+        { NULL } } },
+    { 0xFFFFFE10,          "BulbControl", E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "Mode", E_JIP_VAR_TYPE_UINT16 }, { "ModeStatus", E_JIP_VAR_TYPE_UINT16 },
+        { "LumTarget", E_JIP_VAR_TYPE_UINT16 }, { "LumCurrent", E_JIP_VAR_TYPE_UINT16 },
+        { "LumChange", E_JIP_VAR_TYPE_UINT16 }, { "LumCast", E_JIP_VAR_TYPE_UINT16 },
+        { "SceneId", E_JIP_VAR_TYPE_UINT16 }, { NULL } } },
+    { 0xFFFFFE11,          "BulbStatus",  E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "OnCount", E_JIP_VAR_TYPE_UINT16 }, { "OnTime", E_JIP_VAR_TYPE_UINT16 },
+        { "DownTime", E_JIP_VAR_TYPE_UINT16 }, { "LumCurrent", E_JIP_VAR_TYPE_UINT16 },
+        { "SupplyVoltage", E_JIP_VAR_TYPE_UINT16 }, { "Temperature", E_JIP_VAR_TYPE_UINT16 },
+        { NULL } } },
+    { 0xFFFFFE12,          "BulbConfig",  E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "LumDefault", E_JIP_VAR_TYPE_UINT16 }, { "LumRate", E_JIP_VAR_TYPE_UINT16 },
+        { "InitMode", E_JIP_VAR_TYPE_UINT16 }, { "InitLumTarget", E_JIP_VAR_TYPE_UINT16 },
+        { NULL } } },
+    { 0xFFFFFE13,          "BulbScene",   E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "AddSceneId", E_JIP_VAR_TYPE_UINT16 }, { "DelSceneId", E_JIP_VAR_TYPE_UINT16 },
+        { "SceneId", E_JIP_VAR_TYPE_UINT16 }, { "SceneMode", E_JIP_VAR_TYPE_UINT16 },
+        { "SceneLumTarget", E_JIP_VAR_TYPE_UINT16 }, { "SceneList", E_JIP_VAR_TYPE_UINT16 },
+        { NULL } } },
+};
+
+#define BENCH_NUM_MIBS              (sizeof(asMibs) / sizeof(asMibs[0]))
+
+static tsJIP_Context sServer;
+
+static int iPort            = DEFAULT_PORT;
+static int iRelayPort       = DEFAULT_RELAY_PORT;
+static int iRuns            = DEFAULT_RUNS;
+static int iRttUs           = DEFAULT_RTT_US;
+static int iLimit           = DEFAULT_LIMIT;
+static int iPageSize        = JIP_QUERY_PAGE_SIZE;
+
+/** Relay between the client and the server */
+static int iRelayClientSocket;
+static int iRelayServerSocket;
+static volatile int iRelayRunning;
+static volatile int iRelayLimit;            /**< Largest response passed on, or 0 for any */
+static volatile uint32_t u32Requests;       /**< Requests passed on to the server */
+static volatile uint32_t u32Dropped;        /**< Responses dropped by the relay */
+
+
+/* Pass requests on to the server and its responses back to the client */
+static void *pvRelayThread(void *pvArg)
+{
+    struct sockaddr_in6 sClientAddress;
+    struct sockaddr_in6 sServerAddress;
+    struct pollfd asFds[2];
+    char acBuffer[JIP_PACKET_MAX_SIZE];
+
+    memset(&sClientAddress, 0, sizeof(sClientAddress));
+    memset(&sServerAddress, 0, sizeof(sServerAddress));
+    sServerAddress.sin6_family = AF_INET6;
+    sServerAddress.sin6_port   = htons(iPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sServerAddress.sin6_addr);
+
+    asFds[0].fd     = iRelayClientSocket;
+    asFds[0].events = POLLIN;
+    asFds[1].fd     = iRelayServerSocket;
+    asFds[1].events = POLLIN;
+
+    while (iRelayRunning)
+    {
+        socklen_t iAddressLen = sizeof(sClientAddress);
+        ssize_t iLen;
+
+        if (poll(asFds, 2, 100) <= 0)
+        {
+            continue;
+        }
+
+        if (asFds[0].revents & POLLIN)
+        {
+            iLen = recvfrom(iRelayClientSocket, acBuffer, sizeof(acBuffer), 0, (struct sockaddr *)&sClientAddress, &iAddressLen);
+            if (iLen > 0)
+            {
+                u32Requests++;
+                sendto(iRelayServerSocket, acBuffer, iLen, 0, (struct sockaddr *)&sServerAddress, sizeof(sServerAddress));
+            }
+        }
+
+        if (asFds[1].revents & POLLIN)
+        {
+            iLen = recv(iRelayServerSocket, acBuffer, sizeof(acBuffer), 0);
+            if ((iLen > 0) && iRelayLimit && (iLen > iRelayLimit))
+            {
+                /* Too large for the node to send */
+                u32Dropped++;
+            }
+            else if (iLen > 0)
+            {
+                vBench_SleepUs(iRttUs);
+                sendto(iRelayClientSocket, acBuffer, iLen, 0, (struct sockaddr *)&sClientAddress, sizeof(sClientAddress));
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static int iRelayStart(pthread_t *psThread)
+{
+    struct sockaddr_in6 sAddress;
+
+    iRelayClientSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+    iRelayServerSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+    if ((iRelayClientSocket < 0) || (iRelayServerSocket < 0))
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sAddress, 0, sizeof(sAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iRelayPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sAddress.sin6_addr);
+    if (bind(iRelayClientSocket, (struct sockaddr *)&sAddress, sizeof(sAddress)) < 0)
+    {
+        perror("bind");
+        return -1;
+    }
+
+    iRelayRunning = 1;
+    pthread_create(psThread, NULL, pvRelayThread, NULL);
+    return 0;
+}
+
+
+/* Set up the server, with the node */
+static int iServerStart(void)
+{
+    tsNode *psNode;
+    tsVar *psVar;
+    uint16_t au16DeviceTypes[] = { htons(0x0010), htons(0x00F0) };
+
+    if ((iBench_ServerStart(&sServer, iPort, BENCH_DEVICE_ID, asMibs, BENCH_NUM_MIBS) != 0) ||
+        !(psNode = psBench_ServerAddNode(&sServer, BENCH_ADDRESS, BENCH_DEVICE_ID, "Lamp")))
+    {
+        return -1;
+    }
+
+    /* Clients read the device types while discovering the node */
+    psVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, E_JIP_MIBID_DEVICEID), 1);
+    eJIP_SetVarValue(psVar, au16DeviceTypes, sizeof(au16DeviceTypes));
+    psVar->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_UnlockNode(psNode);
+    return 0;
+}
+
+
+/* Discover the node iRuns times, each with a new client, and report the mean round trips and time
+ * \return 0 if every discovery succeeded */
+static int iRunCase(int iCasePageSize, int iCaseLimit)
+{
+    tsJIPAddress sAddress;
+    uint64_t u64Total = 0;
+    uint32_t u32Requests0 = u32Requests;
+    uint32_t u32Dropped0 = u32Dropped;
+    uint32_t u32Failed = 0;
+    char acPage[16];
+    char acLimit[16];
+    int i;
+
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iRelayPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sAddress.sin6_addr);
+
+    iRelayLimit = iCaseLimit;
+
+    for (i = 0; i < iRuns; i++)
+    {
+        tsJIP_Context sClient;
+        tsNode *psNode;
+        uint64_t u64Start;
+
+        /* A new client has nothing cached */
+        if ((eJIP_Init(&sClient, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+            (eJIP_Connect(&sClient, BENCH_ADDRESS, iRelayPort) != E_JIP_OK))
+        {
+            fprintf(stderr, "Error connecting client\n");
+            return -1;
+        }
+        sClient.iQueryPageSize = iCasePageSize;
+
+        u64Start = u64Bench_TimeNow();
+        if (eJIP_NetAddNode(&sClient, &sAddress, BENCH_DEVICE_ID, &psNode) != E_JIP_OK)
+        {
+            u32Failed++;
+        }
+        else
+        {
+            if (psNode->u32NumMibs != BENCH_NUM_MIBS)
+            {
+                fprintf(stderr, "Discovered %u MiBs, expected %u\n", psNode->u32NumMibs, (uint32_t)BENCH_NUM_MIBS);
+                u32Failed++;
+            }
+            eJIP_UnlockNode(psNode);
+        }
+        u64Total += u64Bench_TimeNow() - u64Start;
+        eJIP_Destroy(&sClient);
+    }
+
+    snprintf(acPage, sizeof(acPage), iCasePageSize ? "%d bytes" : "4 entries", iCasePageSize);
+    snprintf(acLimit, sizeof(acLimit), iCaseLimit ? "%d bytes" : "any", iCaseLimit);
+    printf("%-10s %-10s %9d %9u %12.1f %9.1f %10.1f\n", acPage, acLimit, iRuns, u32Failed,
+           (double)(u32Requests - u32Requests0) / iRuns, (double)(u32Dropped - u32Dropped0) / iRuns,
+           (double)u64Total / iRuns / 1000);
+    return u32Failed ? -1 : 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "DiscoverBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -n --runs      <count>     Number of discoveries in each case [%d]\n", DEFAULT_RUNS);
+    fprintf(stderr, "    -d --rtt       <us>        Round trip time added to each response [%d]\n", DEFAULT_RTT_US);
+    fprintf(stderr, "    -c --limit     <bytes>     Largest response the lossy link carries [%d]\n", DEFAULT_LIMIT);
+    fprintf(stderr, "    -q --page      <bytes>     Query page size [%d]\n", JIP_QUERY_PAGE_SIZE);
+    fprintf(stderr, "    -P --port      <port>      Port to serve JIP on [%d]\n", DEFAULT_PORT);
+    fprintf(stderr, "    -R --relay     <port>      Port of the relay [%d]\n", DEFAULT_RELAY_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_t sRelayThread;
+    int iResult;
+
+    {
+        static struct option long_options[] =
+        {
+            {"help",        no_argument,        NULL, 'h'},
+            {"runs",        required_argument,  NULL, 'n'},
+            {"rtt",         required_argument,  NULL, 'd'},
+            {"limit",       required_argument,  NULL, 'c'},
+            {"page",        required_argument,  NULL, 'q'},
+            {"port",        required_argument,  NULL, 'P'},
+            {"relay",       required_argument,  NULL, 'R'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "hn:d:c:q:P:R:", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'n': iRuns             = atoi(optarg); break;
+                case 'd': iRttUs            = atoi(optarg); break;
+                case 'c': iLimit            = atoi(optarg); break;
+                case 'q': iPageSize         = atoi(optarg); break;
+                case 'P': iPort             = atoi(optarg); break;
+                case 'R': iRelayPort        = atoi(optarg); break;
+                case 'h':
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iRuns <= 0) || (iRttUs < 0) || (iLimit <= 0) || (iPageSize <= 0))
+    {
+        print_usage_exit(argv);
+    }
+
+    if ((iServerStart() != 0) || (iRelayStart(&sRelayThread) != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("Lamp with %u MiBs, %dus round trip, lossy link drops responses over %d bytes\n",
+           (uint32_t)BENCH_NUM_MIBS, iRttUs, iLimit);
+    printf("%-10s %-10s %9s %9s %12s %9s %10s\n", "page", "link", "runs", "failed", "round trips", "dropped", "time ms");
+
+    iResult  = iRunCase(0, 0);
+    iResult |= iRunCase(iPageSize, 0);
+    iResult |= iRunCase(0, iLimit);
+    iResult |= iRunCase(iPageSize, iLimit);
+
+    iRelayRunning = 0;
+    pthread_join(sRelayThread, NULL);
+    close(iRelayClientSocket);
+    close(iRelayServerSocket);
+
+    eJIP_Destroy(&sServer);
+    return iResult ? EXIT_FAILURE : EXIT_SUCCESS;
+}
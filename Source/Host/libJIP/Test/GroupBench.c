@@ -0,0 +1,485 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** GroupBench counts the serial frames a gateway sends for multicast sets
+ *  to a group of lamps. A server context serves the lamps from this process.
+ *  Their level setter stands in for zigbee-jip-daemon's: a set by multicast
+ *  is sent on to the Zigbee group as one groupcast (one serial frame). A
+ *  client context multicasts level sets to the group, retransmitting each
+ *  as clients do, while a second client makes unicast sets to one lamp.
+ *
+ *  The setter is run three ways:
+ *    member       - called for each member of the group, no filtering
+ *    last-request - called for each member, skipping requests that match a
+ *                   single global last request, as the daemon used to do
+ *    group        - registered as a group setter, so libJIP calls it once
+ *                   per multicast request
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define BENCH_DEVICE_ID             0x0B3C0002
+#define BENCH_MIB_ID                0xFFFFFE04
+#define BENCH_GROUP                 "ff15::f00f"
+#define BENCH_LAMP_ADDRESS          "::1"
+#define BENCH_LAMP_PREFIX           "fd04:bd3:80e8:10::"
+
+#define DEFAULT_PORT                11874
+#define DEFAULT_LAMPS               50
+#define DEFAULT_OTHERS              50
+#define DEFAULT_SETS                20
+#define DEFAULT_SEND_COUNT          2
+#define DEFAULT_UNICAST_MS          50
+#define DEFAULT_INTERFACE           "eth0"
+
+/** The daemon's duplicate request window */
+#define LAST_REQUEST_WINDOW_MS      2000
+
+typedef enum
+{
+    E_SETTER_MEMBER,
+    E_SETTER_LAST_REQUEST,
+    E_SETTER_GROUP,
+} teSetter;
+
+static const char *apcSetterNames[] = { "member", "last-request", "group" };
+
+/** The lamps' MiB */
+static const tsBenchMib sBulbControlMib =
+{
+    BENCH_MIB_ID, "BulbControl", E_JIP_ACCESS_TYPE_READ_WRITE, { { "LumTarget", E_JIP_VAR_TYPE_UINT8 }, { NULL } }
+};
+
+static tsJIP_Context sServer;
+static tsNode **apsLamps;
+
+static int iNumLamps        = DEFAULT_LAMPS;
+static int iNumOthers       = DEFAULT_OTHERS;
+static int iNumSets         = DEFAULT_SETS;
+static int iSendCount       = DEFAULT_SEND_COUNT;
+static int iUnicastMs       = DEFAULT_UNICAST_MS;
+static int iLockMs          = 0;
+static int iPort            = DEFAULT_PORT;
+static const char *pcInterface = DEFAULT_INTERFACE;
+
+static teSetter eSetter;
+static volatile int iRunning;
+
+static volatile uint32_t u32GroupFrames;
+static volatile uint32_t u32UnicastFrames;
+static volatile uint32_t u32MulticastCalls;
+
+/** The single global last request, as kept by the daemon */
+static struct
+{
+    uint32_t        u32MibId;
+    uint8_t         u8VarIndex;
+    uint8_t         u8Value;
+    struct in6_addr sAddress;
+    uint64_t        u64Time;
+    int             iValid;
+} sLastRequest;
+
+
+static void vSleepMs(int iMs)
+{
+    struct timespec sDelay;
+
+    sDelay.tv_sec  = iMs / 1000;
+    sDelay.tv_nsec = (iMs % 1000) * 1000000;
+    nanosleep(&sDelay, NULL);
+}
+
+
+static int iLastRequestDuplicate(tsVar *psVar, struct in6_addr *psAddress)
+{
+    return sLastRequest.iValid &&
+           (sLastRequest.u32MibId   == psVar->psOwnerMib->u32MibId) &&
+           (sLastRequest.u8VarIndex == psVar->u8Index) &&
+           (sLastRequest.u8Value    == *psVar->pu8Data) &&
+           (memcmp(&sLastRequest.sAddress, psAddress, sizeof(struct in6_addr)) == 0) &&
+           (((u64Bench_TimeNow() / 1000) - sLastRequest.u64Time) <= LAST_REQUEST_WINDOW_MS);
+}
+
+
+static void vLastRequestUpdate(tsVar *psVar, struct in6_addr *psAddress)
+{
+    sLastRequest.u32MibId   = psVar->psOwnerMib->u32MibId;
+    sLastRequest.u8VarIndex = psVar->u8Index;
+    sLastRequest.u8Value    = *psVar->pu8Data;
+    sLastRequest.sAddress   = *psAddress;
+    sLastRequest.u64Time    = (u64Bench_TimeNow() / 1000);
+    sLastRequest.iValid     = 1;
+}
+
+
+/* Level setter of the lamps. Called by the server listener thread */
+static teJIP_Status eSetLevel(tsVar *psVar, tsJIPAddress *psMulticastAddress)
+{
+    struct in6_addr *psAddress = psMulticastAddress ? &psMulticastAddress->sin6_addr :
+                                                      &psVar->psOwnerMib->psOwnerNode->sNode_Address.sin6_addr;
+
+    if (psMulticastAddress)
+    {
+        u32MulticastCalls++;
+    }
+
+    if ((eSetter == E_SETTER_LAST_REQUEST) && iLastRequestDuplicate(psVar, psAddress))
+    {
+        return E_JIP_OK;
+    }
+
+    /* Wait for the Zigbee node */
+    if (iLockMs)
+    {
+        vSleepMs(iLockMs);
+    }
+
+    /* Groupcast or unicast to the lamp */
+    if (psMulticastAddress)
+    {
+        u32GroupFrames++;
+    }
+    else
+    {
+        u32UnicastFrames++;
+    }
+
+    if (eSetter == E_SETTER_LAST_REQUEST)
+    {
+        vLastRequestUpdate(psVar, psAddress);
+    }
+    return E_JIP_OK;
+}
+
+
+/* Set up the server, with the lamps in the group and other nodes that aren't */
+static int iServerStart(void)
+{
+    char acAddress[INET6_ADDRSTRLEN];
+    int i;
+
+    if (iBench_ServerStart(&sServer, iPort, BENCH_DEVICE_ID, &sBulbControlMib, 1) != 0)
+    {
+        return -1;
+    }
+
+    apsLamps = calloc(iNumLamps, sizeof(tsNode *));
+    if (!apsLamps)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < (iNumLamps + iNumOthers); i++)
+    {
+        uint8_t u8Zero = 0;
+        tsNode *psNode;
+        tsVar *psVar;
+
+        /* The first lamp is reachable by the unicast client */
+        if (i == 0)
+        {
+            strcpy(acAddress, BENCH_LAMP_ADDRESS);
+        }
+        else
+        {
+            snprintf(acAddress, sizeof(acAddress), BENCH_LAMP_PREFIX "%x", i);
+        }
+
+        if (!(psNode = psBench_ServerAddNode(&sServer, acAddress, BENCH_DEVICE_ID, "Lamp")))
+        {
+            return -1;
+        }
+
+        psVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, BENCH_MIB_ID), 0);
+        psVar->prCbVarSet = eSetLevel;
+        eJIP_SetVarValue(psVar, &u8Zero, sizeof(uint8_t));
+
+        if (i < iNumLamps)
+        {
+            apsLamps[i] = psNode;
+            if (eJIPserver_NodeGroupJoin(psNode, BENCH_GROUP) != E_JIP_OK)
+            {
+                fprintf(stderr, "Error joining group\n");
+                return -1;
+            }
+        }
+        eJIP_UnlockNode(psNode);
+    }
+    return 0;
+}
+
+
+/* Connect a client and find the level variable of the first lamp */
+static int iClientStart(tsJIP_Context *psContext, tsVar **ppsVar)
+{
+    tsJIPAddress sAddress;
+    tsNode *psNode;
+
+    if ((eJIP_Init(psContext, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+        (eJIP_Connect(psContext, BENCH_LAMP_ADDRESS, iPort) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error connecting client\n");
+        return -1;
+    }
+
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iPort);
+    inet_pton(AF_INET6, BENCH_LAMP_ADDRESS, &sAddress.sin6_addr);
+
+    if (eJIP_NetAddNode(psContext, &sAddress, BENCH_DEVICE_ID, &psNode) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error discovering node\n");
+        return -1;
+    }
+    *ppsVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, BENCH_MIB_ID), 0);
+    eJIP_UnlockNode(psNode);
+
+    if (!*ppsVar)
+    {
+        fprintf(stderr, "Level variable not found\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Unicast client thread - other traffic through the gateway */
+static void *pvUnicastThread(void *pvArg)
+{
+    tsJIP_Context sContext;
+    tsVar *psVar;
+    uint8_t u8Value = 0;
+
+    if (iClientStart(&sContext, &psVar) != 0)
+    {
+        return NULL;
+    }
+
+    while (iRunning)
+    {
+        u8Value++;
+        (void)eJIP_SetVar(&sContext, psVar, &u8Value, sizeof(uint8_t), E_JIP_FLAG_NONE);
+        vSleepMs(iUnicastMs);
+    }
+    eJIP_Destroy(&sContext);
+    return NULL;
+}
+
+
+/* Multicast level sets to the group with one way of setting */
+static int iRunPhase(teSetter eNewSetter, tsJIP_Context *psClient, tsVar *psClientVar)
+{
+    tsJIPAddress sGroupAddress;
+    pthread_t sUnicastThread;
+    uint32_t u32StartFrames, u32StartCalls;
+    uint32_t u32Frames, u32Calls;
+    uint8_t u8Value = 0;
+    int iUpdated = 0;
+    int i;
+
+    /* Register the setter with the lamps */
+    eJIP_Lock(&sServer);
+    eSetter = eNewSetter;
+    memset(&sLastRequest, 0, sizeof(sLastRequest));
+    for (i = 0; i < iNumLamps; i++)
+    {
+        tsVar *psVar = psJIP_LookupVarIndex(psJIP_LookupMibId(apsLamps[i], NULL, BENCH_MIB_ID), 0);
+        psVar->prCbVarGroupSet = (eSetter == E_SETTER_GROUP) ? eSetLevel : NULL;
+    }
+    eJIP_Unlock(&sServer);
+
+    memset(&sGroupAddress, 0, sizeof(tsJIPAddress));
+    sGroupAddress.sin6_family = AF_INET6;
+    sGroupAddress.sin6_port   = htons(iPort);
+    inet_pton(AF_INET6, BENCH_GROUP, &sGroupAddress.sin6_addr);
+
+    iRunning = 1;
+    if (iUnicastMs)
+    {
+        pthread_create(&sUnicastThread, NULL, pvUnicastThread, NULL);
+    }
+
+    u32StartFrames  = u32GroupFrames;
+    u32StartCalls   = u32MulticastCalls;
+
+    for (i = 0; i < iNumSets; i++)
+    {
+        /* Each set is a new level, so none are repeats of the last */
+        u8Value = 100 + i;
+
+        /* Hop limit 0 keeps the multicast on this host */
+        if (eJIP_MulticastSetVar(psClient, psClientVar, &u8Value, sizeof(uint8_t), &sGroupAddress, 0, E_JIP_FLAG_NONE) != E_JIP_OK)
+        {
+            fprintf(stderr, "Error sending multicast\n");
+            break;
+        }
+        if (iSendCount == 0)
+        {
+            vSleepMs(200);
+        }
+    }
+
+    /* Let the listener finish */
+    vSleepMs(200);
+
+    iRunning = 0;
+    if (iUnicastMs)
+    {
+        pthread_join(sUnicastThread, NULL);
+    }
+
+    u32Frames = u32GroupFrames - u32StartFrames;
+    u32Calls  = u32MulticastCalls - u32StartCalls;
+
+    /* Every member should hold the last level, apart from the lamp the unicast client sets */
+    eJIP_Lock(&sServer);
+    for (i = 1; i < iNumLamps; i++)
+    {
+        tsVar *psVar = psJIP_LookupVarIndex(psJIP_LookupMibId(apsLamps[i], NULL, BENCH_MIB_ID), 0);
+        if (psVar->pu8Data && (*psVar->pu8Data == u8Value))
+        {
+            iUpdated++;
+        }
+    }
+    eJIP_Unlock(&sServer);
+
+    printf("%-13s %6d %6d %10u %12.2f %14.1f %10.1f\n",
+           apcSetterNames[eNewSetter], iNumLamps, iNumSets, u32Frames, (double)u32Frames / iNumSets,
+           (double)u32Calls / iNumSets, iNumLamps > 1 ? (double)iUpdated * 100 / (iNumLamps - 1) : 100.0);
+    return 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "GroupBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -n --lamps     <count>     Number of lamps in the group [%d]\n", DEFAULT_LAMPS);
+    fprintf(stderr, "    -o --others    <count>     Number of other nodes, not in the group [%d]\n", DEFAULT_OTHERS);
+    fprintf(stderr, "    -s --sets      <count>     Number of multicast sets in each phase [%d]\n", DEFAULT_SETS);
+    fprintf(stderr, "    -r --repeat    <count>     Times the client sends each multicast [%d]\n", DEFAULT_SEND_COUNT);
+    fprintf(stderr, "    -u --unicast   <ms>        Interval between unicast sets by another client, 0 for none [%d]\n", DEFAULT_UNICAST_MS);
+    fprintf(stderr, "    -l --lock      <ms>        Time the setter waits for the Zigbee node [0]\n");
+    fprintf(stderr, "    -I --interface <name>      Interface to multicast on [%s]\n", DEFAULT_INTERFACE);
+    fprintf(stderr, "    -P --port      <port>      Port to serve JIP on [%d]\n", DEFAULT_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    tsJIP_Context sClient;
+    tsVar *psClientVar;
+
+    {
+        static struct option long_options[] =
+        {
+            {"lamps",                   required_argument,  NULL, 'n'},
+            {"others",                  required_argument,  NULL, 'o'},
+            {"sets",                    required_argument,  NULL, 's'},
+            {"repeat",                  required_argument,  NULL, 'r'},
+            {"unicast",                 required_argument,  NULL, 'u'},
+            {"lock",                    required_argument,  NULL, 'l'},
+            {"interface",               required_argument,  NULL, 'I'},
+            {"port",                    required_argument,  NULL, 'P'},
+            {"help",                    no_argument,        NULL, 'h'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "n:o:s:r:u:l:I:P:h", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'n': iNumLamps     = atoi(optarg); break;
+                case 'o': iNumOthers    = atoi(optarg); break;
+                case 's': iNumSets      = atoi(optarg); break;
+                case 'r': iSendCount    = atoi(optarg); break;
+                case 'u': iUnicastMs    = atoi(optarg); break;
+                case 'l': iLockMs       = atoi(optarg); break;
+                case 'I': pcInterface   = optarg;       break;
+                case 'P': iPort         = atoi(optarg); break;
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iNumLamps < 1) || (iNumSets < 1))
+    {
+        print_usage_exit(argv);
+    }
+
+    if ((iServerStart() != 0) || (iClientStart(&sClient, &psClientVar) != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    sClient.iMulticastInterface = if_nametoindex(pcInterface);
+    sClient.iMulticastSendCount = iSendCount;
+    if (sClient.iMulticastInterface == 0)
+    {
+        fprintf(stderr, "Unknown interface %s\n", pcInterface);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d lamps in group %s, %d other nodes, each multicast sent %d times, unicast set every %dms, lock wait %dms\n",
+           iNumLamps, BENCH_GROUP, iNumOthers, iSendCount, iUnicastMs, iLockMs);
+    printf("%-13s %6s %6s %10s %12s %14s %10s\n",
+           "setter", "lamps", "sets", "frames", "frames/set", "setter calls", "updated %");
+
+    iRunPhase(E_SETTER_MEMBER,          &sClient, psClientVar);
+    iRunPhase(E_SETTER_LAST_REQUEST,    &sClient, psClientVar);
+    iRunPhase(E_SETTER_GROUP,           &sClient, psClientVar);
+
+    eJIP_Destroy(&sClient);
+    eJIP_Destroy(&sServer);
+    return EXIT_SUCCESS;
+}
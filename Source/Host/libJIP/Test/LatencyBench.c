@@ -0,0 +1,367 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** LatencyBench measures what it costs to trace the latency of requests
+ *  served by a JIP server. A server context serves a single node from this
+ *  process. Its get callback stands in for zigbee-jip-daemon's: it takes a
+ *  lock that a device thread holds from time to time, writes the request to
+ *  the serial link, waits for the status and then for the response, marking
+ *  those stages as the daemon's serial link does. A client context in the
+ *  same process gets the value repeatedly, first with tracing disabled and
+ *  then enabled, and the round trip times are compared. The cost of tracing
+ *  a request on its own is then measured in a tight loop, and the latency
+ *  table the server recorded is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define BENCH_DEVICE_ID             0x0B3C0003
+#define BENCH_MIB_ID                0xFFFFFE51
+#define BENCH_ADDRESS               "::1"
+
+#define DEFAULT_PORT                11875
+#define DEFAULT_REQUESTS            2000
+#define DEFAULT_TX_US               200
+#define DEFAULT_STATUS_US           500
+#define DEFAULT_RESPONSE_US         2000
+#define DEFAULT_HOLD_US             1000
+#define DEFAULT_TRACE_LOOPS         1000000
+
+/** The node's MiB */
+static const tsBenchMib sDeviceMib =
+{
+    BENCH_MIB_ID, "Device", E_JIP_ACCESS_TYPE_READ_ONLY, { { "Value", E_JIP_VAR_TYPE_UINT16 }, { NULL } }
+};
+
+static tsJIP_Context sServer;
+static tsJIP_Context sClient;
+static tsVar *psServerVar;
+static tsVar *psClientVar;
+
+static int iPort            = DEFAULT_PORT;
+static int iRequests        = DEFAULT_REQUESTS;
+static int iTxUs            = DEFAULT_TX_US;
+static int iStatusUs        = DEFAULT_STATUS_US;
+static int iResponseUs      = DEFAULT_RESPONSE_US;
+static int iHoldUs          = DEFAULT_HOLD_US;
+
+/** Lock shared with the device thread, standing in for the daemon's Zigbee node locks */
+static tsUtilsLock sDeviceLock;
+static volatile int iRunning;
+static uint16_t u16DeviceValue;
+
+
+/* Get callback of the server variable - read the attribute from the device */
+static teJIP_Status eReadAttribute(tsVar *psVar)
+{
+    uint64_t u64Start;
+    uint64_t u64Until;
+    teJIP_Status eStatus;
+    
+    eUtils_LockLock(&sDeviceLock);
+    
+    /* Writing the request to the serial link keeps the CPU busy */
+    u64Start = u64Utils_LatencyStart();
+    u64Until = u64Bench_TimeNow() + iTxUs;
+    while (u64Bench_TimeNow() < u64Until);
+    vUtils_LatencyStage(E_UTILS_LATENCY_TX, u64Start);
+    
+    u64Start = u64Utils_LatencyStart();
+    vBench_SleepUs(iStatusUs);
+    vUtils_LatencyStage(E_UTILS_LATENCY_TX_STATUS, u64Start);
+    
+    u64Start = u64Utils_LatencyStart();
+    vBench_SleepUs(iResponseUs);
+    vUtils_LatencyStage(E_UTILS_LATENCY_RESPONSE, u64Start);
+    
+    eStatus = eJIP_SetVarValue(psVar, &u16DeviceValue, sizeof(uint16_t));
+    eUtils_LockUnlock(&sDeviceLock);
+    return eStatus;
+}
+
+
+/* Device thread - hold the device lock now and again, as attribute reports do */
+static void *pvDeviceThread(void *pvArg)
+{
+    while (iRunning)
+    {
+        eUtils_LockLock(&sDeviceLock);
+        u16DeviceValue++;
+        vBench_SleepUs(iHoldUs);
+        eUtils_LockUnlock(&sDeviceLock);
+        vBench_SleepUs(iHoldUs * 10);
+    }
+    return NULL;
+}
+
+
+/* Set up the server, with the node */
+static int iServerStart(void)
+{
+    tsNode *psNode;
+    
+    if ((iBench_ServerStart(&sServer, iPort, BENCH_DEVICE_ID, &sDeviceMib, 1) != 0) ||
+        !(psNode = psBench_ServerAddNode(&sServer, BENCH_ADDRESS, BENCH_DEVICE_ID, "Device")))
+    {
+        return -1;
+    }
+    
+    psServerVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, BENCH_MIB_ID), 0);
+    psServerVar->prCbVarGet = eReadAttribute;
+    psServerVar->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_SetVarValue(psServerVar, &u16DeviceValue, sizeof(uint16_t));
+    eJIP_UnlockNode(psNode);
+    return 0;
+}
+
+
+/* Connect the client and find the variable */
+static int iClientStart(void)
+{
+    tsJIPAddress sAddress;
+    tsNode *psNode;
+    
+    if ((eJIP_Init(&sClient, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+        (eJIP_Connect(&sClient, BENCH_ADDRESS, iPort) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error connecting client\n");
+        return -1;
+    }
+    
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sAddress.sin6_addr);
+    
+    /* Discovers the node's MIBs from the server */
+    if (eJIP_NetAddNode(&sClient, &sAddress, BENCH_DEVICE_ID, &psNode) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error discovering node\n");
+        return -1;
+    }
+    psClientVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, BENCH_MIB_ID), 0);
+    eJIP_UnlockNode(psNode);
+    
+    if (!psClientVar)
+    {
+        fprintf(stderr, "Variable not found\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Number of get requests the server has recorded. Clients get variables by MiB ID */
+static uint32_t u32GetsRecorded(void)
+{
+    tsUtilsHistogramSummary sSummary;
+    
+    eJIPserver_LatencyCommand(&sServer, E_JIP_COMMAND_GET_MIB_REQUEST, E_UTILS_LATENCY_TOTAL, &sSummary);
+    return sSummary.u32Count;
+}
+
+
+/* Get the value iRequests times and report the round trip times.
+ * \return 0 if the server recorded the expected number of requests */
+static int iRunPhase(int bTrace)
+{
+    uint32_t u32Before = u32GetsRecorded();
+    uint32_t u32Expected = bTrace ? iRequests : 0;
+    uint32_t u32Failed = 0;
+    uint32_t u32Recorded;
+    uint64_t u64Total = 0;
+    uint64_t u64Max = 0;
+    int i;
+    
+    vUtils_LatencyEnable(bTrace);
+    
+    for (i = 0; i < iRequests; i++)
+    {
+        uint64_t u64Start = u64Bench_TimeNow();
+        uint64_t u64Time;
+        
+        if (eJIP_GetVar(&sClient, psClientVar, E_JIP_FLAG_NONE) != E_JIP_OK)
+        {
+            u32Failed++;
+            u32Expected -= bTrace ? 1 : 0;
+            continue;
+        }
+        u64Time = u64Bench_TimeNow() - u64Start;
+        u64Total += u64Time;
+        u64Max = (u64Time > u64Max) ? u64Time : u64Max;
+    }
+    
+    /* The server records a request just after sending its response */
+    vBench_SleepUs(10000);
+    u32Recorded = u32GetsRecorded() - u32Before;
+    
+    printf("%-9s %9d %9u %14.1f %10.1f %9u\n", bTrace ? "enabled" : "disabled", iRequests, u32Failed,
+           (iRequests > u32Failed) ? (double)u64Total / (iRequests - u32Failed) : 0.0, u64Max / 1.0, u32Recorded);
+    
+    if (u32Recorded != u32Expected)
+    {
+        fprintf(stderr, "Server recorded %u requests, expected %u\n", u32Recorded, u32Expected);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Measure the cost of tracing a request, without the request */
+static void vTraceCost(int bTrace, int iLoops)
+{
+    struct in6_addr sAddress;
+    uint64_t u64Start;
+    uint64_t u64Stage;
+    int i;
+    
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sAddress);
+    vUtils_LatencyEnable(bTrace);
+    
+    u64Start = u64Bench_TimeNow();
+    for (i = 0; i < iLoops; i++)
+    {
+        vUtils_LatencyBegin();
+        u64Stage = u64Utils_LatencyStart();
+        vUtils_LatencyStage(E_UTILS_LATENCY_TX, u64Stage);
+        u64Stage = u64Utils_LatencyStart();
+        vUtils_LatencyStage(E_UTILS_LATENCY_TX_STATUS, u64Stage);
+        u64Stage = u64Utils_LatencyStart();
+        vUtils_LatencyStage(E_UTILS_LATENCY_RESPONSE, u64Stage);
+        vLatency_RequestEnd(&sServer, E_JIP_COMMAND_SET_REQUEST, &sAddress);
+    }
+    printf("Tracing %-9s %8.1f ns per request\n", bTrace ? "enabled" : "disabled",
+           ((u64Bench_TimeNow() - u64Start) * 1000.0) / iLoops);
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "LatencyBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -n --requests  <count>     Number of gets in each phase [%d]\n", DEFAULT_REQUESTS);
+    fprintf(stderr, "    -x --tx        <us>        Time taken to write a request to the serial link [%d]\n", DEFAULT_TX_US);
+    fprintf(stderr, "    -s --status    <us>        Time taken for the status of a request [%d]\n", DEFAULT_STATUS_US);
+    fprintf(stderr, "    -r --response  <us>        Time taken for the response to a request [%d]\n", DEFAULT_RESPONSE_US);
+    fprintf(stderr, "    -l --hold      <us>        Time the device thread holds the device lock [%d]\n", DEFAULT_HOLD_US);
+    fprintf(stderr, "    -P --port      <port>      Port to serve JIP on [%d]\n", DEFAULT_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_t sDeviceThread;
+    int iResult;
+    
+    {
+        static struct option long_options[] =
+        {
+            {"help",        no_argument,        NULL, 'h'},
+            {"requests",    required_argument,  NULL, 'n'},
+            {"tx",          required_argument,  NULL, 'x'},
+            {"status",      required_argument,  NULL, 's'},
+            {"response",    required_argument,  NULL, 'r'},
+            {"hold",        required_argument,  NULL, 'l'},
+            {"port",        required_argument,  NULL, 'P'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+        
+        while ((opt = getopt_long(argc, argv, "hn:x:s:r:l:P:", long_options, &option_index)) != -1) 
+        {
+            switch (opt) 
+            {
+                case 'n': iRequests         = atoi(optarg); break;
+                case 'x': iTxUs             = atoi(optarg); break;
+                case 's': iStatusUs         = atoi(optarg); break;
+                case 'r': iResponseUs       = atoi(optarg); break;
+                case 'l': iHoldUs           = atoi(optarg); break;
+                case 'P': iPort             = atoi(optarg); break;
+                case 'h':
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+    
+    if ((iRequests <= 0) || (iTxUs < 0) || (iStatusUs < 0) || (iResponseUs < 0) || (iHoldUs <= 0))
+    {
+        print_usage_exit(argv);
+    }
+    
+    if ((eUtils_LockCreateHere(&sDeviceLock) != E_UTILS_OK) || (iServerStart() != 0) || (iClientStart() != 0))
+    {
+        return EXIT_FAILURE;
+    }
+    
+    iRunning = 1;
+    pthread_create(&sDeviceThread, NULL, pvDeviceThread, NULL);
+    
+    printf("%d gets per phase: tx %dus, status %dus, response %dus, device lock held %dus in every %dus\n",
+           iRequests, iTxUs, iStatusUs, iResponseUs, iHoldUs, iHoldUs * 11);
+    printf("%-9s %9s %9s %14s %10s %9s\n", "tracing", "gets", "failed", "mean rtt us", "max us", "recorded");
+    
+    iResult = iRunPhase(0);
+    iResult |= iRunPhase(1);
+    
+    iRunning = 0;
+    pthread_join(sDeviceThread, NULL);
+    
+    printf("\n");
+    eJIPserver_LatencyDump(&sServer, stdout);
+    
+    printf("\n");
+    vTraceCost(0, DEFAULT_TRACE_LOOPS);
+    vTraceCost(1, DEFAULT_TRACE_LOOPS);
+    
+    eJIP_Destroy(&sClient);
+    eJIP_Destroy(&sServer);
+    eUtils_LockDestroy(&sDeviceLock);
+    return iResult ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
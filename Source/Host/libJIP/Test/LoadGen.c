@@ -0,0 +1,805 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** LoadGen offers a JIP server a repeatable load, so that runs against
+ *  TestServer, zigbee-jip-daemon or JIPd can be compared. The network is
+ *  discovered once, then each worker thread gets its own client context,
+ *  seeded with the device definitions that were discovered so that it adds
+ *  the nodes without any further traffic. The workers make a weighted mix of
+ *  gets, sets, MIB queries and multicast sets to nodes picked at random.
+ *
+ *  With a target rate, requests are scheduled at fixed intervals whether or
+ *  not earlier ones have completed, and latency is measured from the time a
+ *  request was due rather than the time it was sent. A server that falls
+ *  behind is then charged for the requests queued up behind a slow one.
+ *  Without a target rate each worker sends its next request as soon as the
+ *  last completes.
+ *
+ *  Multicast sets have no response, so only the time to send them is timed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+#include <JIP_Packets.h>
+#include <Network.h>
+#include <Cache.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define DEFAULT_ADDRESS             "::1"
+#define DEFAULT_WORKERS             4
+#define DEFAULT_DURATION_S          10
+#define DEFAULT_WARMUP_S            2
+#define DEFAULT_MIX                 "1,0,0,0"
+#define DEFAULT_HOPS                2
+#define DEFAULT_LABEL               "run"
+
+/** Number of MIBs to ask for in a query, as discovery does */
+#define QUERY_NUM_MIBS              4
+
+/** Largest value that may be set */
+#define MAX_VALUE_LEN               64
+
+typedef enum
+{
+    E_OP_GET,
+    E_OP_SET,
+    E_OP_QUERY,
+    E_OP_MCAST,
+    E_OP_NUM,
+} teOp;
+
+static const char *apcOpNames[E_OP_NUM] = { "get", "set", "query", "mcast" };
+
+/** A node that requests may be sent to, in one worker's context */
+typedef struct
+{
+    tsNode             *psNode;             /**< The node */
+    tsVar              *psGetVar;           /**< Variable to get, or NULL if the node doesn't have it */
+    tsVar              *psSetVar;           /**< Variable to set, or NULL if the node doesn't have it */
+} tsTarget;
+
+/** Counts of the requests made by one worker */
+typedef struct
+{
+    uint32_t            u32Ok;              /**< Requests that succeeded */
+    uint32_t            u32Errors;          /**< Requests that failed, other than by timing out */
+    uint32_t            u32Timeouts;        /**< Requests that timed out */
+} tsOpCounts;
+
+typedef struct
+{
+    int                 iIndex;             /**< Number of the worker */
+    pthread_t           sThread;            /**< Thread the worker runs in */
+    tsJIP_Context       sContext;           /**< Client context of the worker */
+    tsTarget           *pasTargets;         /**< Nodes known to the worker */
+    uint32_t            u32NumTargets;      /**< Number of nodes */
+    tsTarget          **apasOpTargets[E_OP_NUM];    /**< Nodes each kind of request may go to */
+    uint32_t            au32NumOpTargets[E_OP_NUM]; /**< Number of nodes each kind of request may go to */
+    unsigned int        uSeed;              /**< Random state of the worker */
+    tsOpCounts          asCounts[E_OP_NUM]; /**< Results of the requests made after the warm up */
+    uint32_t            u32Behind;          /**< Requests that were sent more than an interval late */
+    uint64_t            u64LastDone;        /**< Time the last counted request completed */
+} tsWorker;
+
+static const char *pcAddress    = DEFAULT_ADDRESS;
+static int iPort                = JIP_DEFAULT_PORT;
+static int iNumWorkers          = DEFAULT_WORKERS;
+static int iRate                = 0;
+static int iDurationS           = DEFAULT_DURATION_S;
+static int iWarmupS             = DEFAULT_WARMUP_S;
+static const char *pcMix        = DEFAULT_MIX;
+static const char *pcGetVar     = NULL;
+static const char *pcSetVar     = NULL;
+static const char *pcValues     = NULL;
+static const char *pcGroup      = NULL;
+static const char *pcInterface  = NULL;
+static int iHops                = DEFAULT_HOPS;
+static uint32_t u32DeviceId     = E_JIP_DEVICEID_ALL;
+static const char *pcLabel      = DEFAULT_LABEL;
+static const char *pcCsvFile    = NULL;
+
+static uint32_t au32Weights[E_OP_NUM];
+static uint32_t u32TotalWeight;
+
+static char **apcValues;
+static int iNumValues;
+
+static tsJIPAddress sGroupAddress;
+static tsJIPAddress *pasAddresses;
+static uint32_t u32NumAddresses;
+
+static tsUtilsHistogram asLatency[E_OP_NUM];
+
+static uint64_t u64StartTime;
+static uint64_t u64MeasureTime;
+static uint64_t u64EndTime;
+
+
+static void vSleepUntil(uint64_t u64Time)
+{
+    struct timespec sDelay;
+    uint64_t u64Now = u64Bench_TimeNow();
+
+    if (u64Time <= u64Now)
+    {
+        return;
+    }
+    sDelay.tv_sec  = (u64Time - u64Now) / 1000000;
+    sDelay.tv_nsec = ((u64Time - u64Now) % 1000000) * 1000;
+    nanosleep(&sDelay, NULL);
+}
+
+
+/* Split "Mib.Var" and find the variable in a node, if it has it */
+static tsVar *psLookupVar(tsNode *psNode, const char *pcName)
+{
+    char acMib[64];
+    const char *pcVar;
+    tsMib *psMib;
+
+    if (!pcName || !(pcVar = strchr(pcName, '.')) || ((pcVar - pcName) >= (int)sizeof(acMib)))
+    {
+        return NULL;
+    }
+    memcpy(acMib, pcName, pcVar - pcName);
+    acMib[pcVar - pcName] = '\0';
+
+    psMib = psJIP_LookupMib(psNode, NULL, acMib);
+    return psMib ? psJIP_LookupVar(psMib, NULL, pcVar + 1) : NULL;
+}
+
+
+/* Convert a value from the command line to the type of a variable */
+static int iEncodeValue(tsVar *psVar, const char *pcValue, uint8_t *pu8Buffer, uint32_t *pu32Size)
+{
+    switch (psVar->eVarType)
+    {
+#define ENCODE_INTEGER(TYPE, CONVERT)               \
+        {                                           \
+            TYPE tValue = (TYPE)CONVERT(pcValue, NULL, 0); \
+            memcpy(pu8Buffer, &tValue, sizeof(TYPE)); \
+            *pu32Size = sizeof(TYPE);               \
+            return 0;                               \
+        }
+        case (E_JIP_VAR_TYPE_INT8):     ENCODE_INTEGER(int8_t,   strtoll)
+        case (E_JIP_VAR_TYPE_INT16):    ENCODE_INTEGER(int16_t,  strtoll)
+        case (E_JIP_VAR_TYPE_INT32):    ENCODE_INTEGER(int32_t,  strtoll)
+        case (E_JIP_VAR_TYPE_INT64):    ENCODE_INTEGER(int64_t,  strtoll)
+        case (E_JIP_VAR_TYPE_UINT8):    ENCODE_INTEGER(uint8_t,  strtoull)
+        case (E_JIP_VAR_TYPE_UINT16):   ENCODE_INTEGER(uint16_t, strtoull)
+        case (E_JIP_VAR_TYPE_UINT32):   ENCODE_INTEGER(uint32_t, strtoull)
+        case (E_JIP_VAR_TYPE_UINT64):   ENCODE_INTEGER(uint64_t, strtoull)
+#undef ENCODE_INTEGER
+
+        case (E_JIP_VAR_TYPE_FLT):
+        {
+            float fValue = strtof(pcValue, NULL);
+            memcpy(pu8Buffer, &fValue, sizeof(float));
+            *pu32Size = sizeof(float);
+            return 0;
+        }
+
+        case (E_JIP_VAR_TYPE_DBL):
+        {
+            double dValue = strtod(pcValue, NULL);
+            memcpy(pu8Buffer, &dValue, sizeof(double));
+            *pu32Size = sizeof(double);
+            return 0;
+        }
+
+        case (E_JIP_VAR_TYPE_STR):
+            *pu32Size = strlen(pcValue);
+            if (*pu32Size > MAX_VALUE_LEN)
+            {
+                return -1;
+            }
+            memcpy(pu8Buffer, pcValue, *pu32Size);
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+
+/* Split a comma separated list. The list is modified */
+static int iSplitList(char *pcList, char ***papcItems)
+{
+    char *pcSavePtr = NULL;
+    char *pcItem;
+    int iNumItems = 0;
+
+    *papcItems = NULL;
+    for (pcItem = strtok_r(pcList, ",", &pcSavePtr); pcItem; pcItem = strtok_r(NULL, ",", &pcSavePtr))
+    {
+        char **apcItems = realloc(*papcItems, (iNumItems + 1) * sizeof(char *));
+        if (!apcItems)
+        {
+            return -1;
+        }
+        apcItems[iNumItems++] = pcItem;
+        *papcItems = apcItems;
+    }
+    return iNumItems;
+}
+
+
+/* Discover the network once, and keep the addresses and device definitions of the nodes */
+static int iDiscover(tsJIP_Context *psDiscovery)
+{
+    teJIP_Status eStatus;
+    uint64_t u64Start = u64Bench_TimeNow();
+
+    if ((eJIP_Init(psDiscovery, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+        (eJIP_Connect(psDiscovery, pcAddress, iPort) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error connecting to %s\n", pcAddress);
+        return -1;
+    }
+
+    if ((eStatus = eJIPService_DiscoverNetwork(psDiscovery)) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error discovering network (%s)\n", pcJIP_strerror(eStatus));
+        return -1;
+    }
+
+    if ((eJIP_GetNodeAddressList(psDiscovery, u32DeviceId, &pasAddresses, &u32NumAddresses) != E_JIP_OK) ||
+        (u32NumAddresses == 0))
+    {
+        fprintf(stderr, "No nodes found\n");
+        return -1;
+    }
+
+    printf("Discovered %u nodes in %.1fms\n", u32NumAddresses, (double)(u64Bench_TimeNow() - u64Start) / 1000);
+    return 0;
+}
+
+
+/* Give a worker its own context, with the nodes added from the discovered definitions */
+static int iWorkerStart(tsWorker *psWorker, tsJIP_Context *psDiscovery)
+{
+    tsJIP_Private *psJIP_Private;
+    uint32_t i;
+    int iOp;
+
+    if ((eJIP_Init(&psWorker->sContext, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+        (eJIP_Connect(&psWorker->sContext, pcAddress, iPort) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error connecting worker %d\n", psWorker->iIndex);
+        return -1;
+    }
+    psJIP_Private = (tsJIP_Private *)psWorker->sContext.pvPriv;
+
+    if (pcInterface)
+    {
+        psWorker->sContext.iMulticastInterface = if_nametoindex(pcInterface);
+    }
+
+    psWorker->pasTargets = calloc(u32NumAddresses, sizeof(tsTarget));
+    for (iOp = 0; iOp < E_OP_NUM; iOp++)
+    {
+        psWorker->apasOpTargets[iOp] = calloc(u32NumAddresses, sizeof(tsTarget *));
+        if (!psWorker->apasOpTargets[iOp])
+        {
+            return -1;
+        }
+    }
+    if (!psWorker->pasTargets)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < u32NumAddresses; i++)
+    {
+        tsTarget *psTarget = &psWorker->pasTargets[psWorker->u32NumTargets];
+        uint32_t u32NodeDeviceId;
+        tsNode *psNode;
+
+        /* The device is already cached if another node shares its ID */
+        psNode = psJIP_LookupNode(psDiscovery, &pasAddresses[i]);
+        if (!psNode)
+        {
+            continue;
+        }
+        (void)Cache_Add_Node(&psJIP_Private->sCache, psNode);
+        u32NodeDeviceId = psNode->u32DeviceId;
+        eJIP_UnlockNode(psNode);
+
+        if (eJIP_NetAddNode(&psWorker->sContext, &pasAddresses[i], u32NodeDeviceId, &psTarget->psNode) != E_JIP_OK)
+        {
+            continue;
+        }
+        psTarget->psGetVar = psLookupVar(psTarget->psNode, pcGetVar);
+        psTarget->psSetVar = psLookupVar(psTarget->psNode, pcSetVar);
+        eJIP_UnlockNode(psTarget->psNode);
+
+        psWorker->apasOpTargets[E_OP_QUERY][psWorker->au32NumOpTargets[E_OP_QUERY]++] = psTarget;
+        if (psTarget->psGetVar)
+        {
+            psWorker->apasOpTargets[E_OP_GET][psWorker->au32NumOpTargets[E_OP_GET]++] = psTarget;
+        }
+        if (psTarget->psSetVar)
+        {
+            psWorker->apasOpTargets[E_OP_SET][psWorker->au32NumOpTargets[E_OP_SET]++] = psTarget;
+            psWorker->apasOpTargets[E_OP_MCAST][psWorker->au32NumOpTargets[E_OP_MCAST]++] = psTarget;
+        }
+        psWorker->u32NumTargets++;
+    }
+
+    for (iOp = 0; iOp < E_OP_NUM; iOp++)
+    {
+        if (au32Weights[iOp] && (psWorker->au32NumOpTargets[iOp] == 0))
+        {
+            fprintf(stderr, "No nodes to send %s requests to\n", apcOpNames[iOp]);
+            return -1;
+        }
+    }
+    psWorker->uSeed = (unsigned int)(u64Bench_TimeNow() ^ (psWorker->iIndex * 7919));
+    return 0;
+}
+
+
+/* Ask a node for the first of its MIBs */
+static teJIP_Status eQueryMib(tsWorker *psWorker, tsNode *psNode)
+{
+    tsJIP_Private *psJIP_Private = (tsJIP_Private *)psWorker->sContext.pvPriv;
+    char buffer[255];
+    tsJIP_Msg_QueryMibRequest *psRequest = (tsJIP_Msg_QueryMibRequest *)buffer;
+    tsJIP_Msg_QueryMibResponseHeader *psResponse = (tsJIP_Msg_QueryMibResponseHeader *)buffer;
+    uint32_t u32ResponseLen = sizeof(buffer);
+    teNetworkStatus eNetStatus;
+
+    memset(buffer, 0, sizeof(buffer));
+    psRequest->u8MibStartIndex  = 0;
+    psRequest->u8NumMibs        = QUERY_NUM_MIBS;
+
+    eJIP_LockNode(psNode, True);
+    eNetStatus = Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, E_JIP_FLAG_NONE,
+                                     E_JIP_COMMAND_QUERY_MIB_REQUEST, buffer, sizeof(tsJIP_Msg_QueryMibRequest),
+                                     E_JIP_COMMAND_QUERY_MIB_RESPONSE, buffer, &u32ResponseLen);
+    eJIP_UnlockNode(psNode);
+
+    if (eNetStatus == E_NETWORK_ERROR_TIMEOUT)
+    {
+        return E_JIP_ERROR_TIMEOUT;
+    }
+    else if (eNetStatus != E_NETWORK_OK)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    return psResponse->eStatus;
+}
+
+
+/* Make one request of the given kind */
+static teJIP_Status eRequest(tsWorker *psWorker, teOp eOp, uint32_t u32Sequence)
+{
+    tsTarget *psTarget;
+    uint8_t au8Value[MAX_VALUE_LEN];
+    uint32_t u32Size;
+
+    psTarget = psWorker->apasOpTargets[eOp][rand_r(&psWorker->uSeed) % psWorker->au32NumOpTargets[eOp]];
+
+    switch (eOp)
+    {
+        case (E_OP_GET):
+            return eJIP_GetVar(&psWorker->sContext, psTarget->psGetVar, E_JIP_FLAG_NONE);
+
+        case (E_OP_SET):
+        case (E_OP_MCAST):
+            if (iEncodeValue(psTarget->psSetVar, apcValues[u32Sequence % iNumValues], au8Value, &u32Size) != 0)
+            {
+                return E_JIP_ERROR_WRONG_TYPE;
+            }
+            if (eOp == E_OP_SET)
+            {
+                return eJIP_SetVar(&psWorker->sContext, psTarget->psSetVar, au8Value, u32Size, E_JIP_FLAG_NONE);
+            }
+            return eJIP_MulticastSetVar(&psWorker->sContext, psTarget->psSetVar, au8Value, u32Size,
+                                        &sGroupAddress, iHops, E_JIP_FLAG_NONE);
+
+        case (E_OP_QUERY):
+            return eQueryMib(psWorker, psTarget->psNode);
+
+        default:
+            return E_JIP_ERROR_FAILED;
+    }
+}
+
+
+/* Pick the kind of the next request by its weight in the mix */
+static teOp eChooseOp(tsWorker *psWorker)
+{
+    uint32_t u32Choice = rand_r(&psWorker->uSeed) % u32TotalWeight;
+    int iOp;
+
+    for (iOp = 0; iOp < E_OP_NUM - 1; iOp++)
+    {
+        if (u32Choice < au32Weights[iOp])
+        {
+            break;
+        }
+        u32Choice -= au32Weights[iOp];
+    }
+    return (teOp)iOp;
+}
+
+
+static void *pvWorkerThread(void *pvArg)
+{
+    tsWorker *psWorker = (tsWorker *)pvArg;
+    uint64_t u64Interval = 0;
+    uint64_t u64Due;
+    uint32_t u32Sequence;
+
+    /* Spread the workers' schedules evenly through the interval */
+    if (iRate)
+    {
+        u64Interval = ((uint64_t)iNumWorkers * 1000000) / iRate;
+        u64Due = u64StartTime + ((u64Interval * psWorker->iIndex) / iNumWorkers);
+    }
+    else
+    {
+        u64Due = u64StartTime;
+    }
+    vSleepUntil(u64StartTime);
+
+    for (u32Sequence = 0; ; u32Sequence++)
+    {
+        teJIP_Status eStatus;
+        uint64_t u64Now;
+        teOp eOp;
+
+        if (iRate)
+        {
+            vSleepUntil(u64Due);
+            u64Now = u64Bench_TimeNow();
+            if ((u64Now - u64Due) > u64Interval)
+            {
+                psWorker->u32Behind += (u64Due >= u64MeasureTime);
+            }
+        }
+        else
+        {
+            u64Now = u64Due = u64Bench_TimeNow();
+        }
+        if (u64Due >= u64EndTime)
+        {
+            break;
+        }
+
+        eOp = eChooseOp(psWorker);
+        eStatus = eRequest(psWorker, eOp, (u32Sequence * iNumWorkers) + psWorker->iIndex);
+        u64Now = u64Bench_TimeNow();
+
+        /* Requests due in the warm up aren't counted */
+        if (u64Due >= u64MeasureTime)
+        {
+            tsOpCounts *psCounts = &psWorker->asCounts[eOp];
+
+            psWorker->u64LastDone = u64Now;
+            if (eStatus == E_JIP_OK)
+            {
+                psCounts->u32Ok++;
+                vUtils_HistogramRecord(&asLatency[eOp], (uint32_t)(u64Now - u64Due));
+            }
+            else if (eStatus == E_JIP_ERROR_TIMEOUT)
+            {
+                psCounts->u32Timeouts++;
+            }
+            else
+            {
+                psCounts->u32Errors++;
+            }
+        }
+        u64Due += u64Interval;
+    }
+    return NULL;
+}
+
+
+static void vReport(tsWorker *pasWorkers)
+{
+    uint64_t u64LastDone = u64EndTime;
+    double dSeconds;
+    uint32_t u32Behind = 0;
+    FILE *psCsv = NULL;
+    int iOp;
+    int i;
+
+    if (pcCsvFile)
+    {
+        psCsv = fopen(pcCsvFile, "a");
+        if (!psCsv)
+        {
+            fprintf(stderr, "Error opening %s\n", pcCsvFile);
+        }
+        else if (ftell(psCsv) == 0)
+        {
+            fprintf(psCsv, "label,address,workers,rate,nodes,op,requests,ok,errors,timeouts,behind,"
+                           "per_second,mean_us,p50_us,p95_us,p99_us,max_us\n");
+        }
+    }
+
+    for (i = 0; i < iNumWorkers; i++)
+    {
+        u32Behind += pasWorkers[i].u32Behind;
+        if (pasWorkers[i].u64LastDone > u64LastDone)
+        {
+            u64LastDone = pasWorkers[i].u64LastDone;
+        }
+    }
+
+    /* A server that falls behind takes longer than the run to answer the requests due in it */
+    dSeconds = (double)(u64LastDone - u64MeasureTime) / 1000000;
+    printf("Requests due in %ds were answered in %.1fs\n", iDurationS, dSeconds);
+
+    printf("%-6s %9s %9s %8s %8s %10s %9s %9s %9s %9s %9s\n",
+           "op", "requests", "ok", "errors", "timeouts", "ok/s", "mean us", "p50 us", "p95 us", "p99 us", "max us");
+
+    for (iOp = 0; iOp < E_OP_NUM; iOp++)
+    {
+        tsUtilsHistogramSummary sSummary;
+        tsOpCounts sTotal;
+        uint32_t u32Requests;
+
+        memset(&sTotal, 0, sizeof(tsOpCounts));
+        for (i = 0; i < iNumWorkers; i++)
+        {
+            sTotal.u32Ok       += pasWorkers[i].asCounts[iOp].u32Ok;
+            sTotal.u32Errors   += pasWorkers[i].asCounts[iOp].u32Errors;
+            sTotal.u32Timeouts += pasWorkers[i].asCounts[iOp].u32Timeouts;
+        }
+        u32Requests = sTotal.u32Ok + sTotal.u32Errors + sTotal.u32Timeouts;
+        if (au32Weights[iOp] == 0)
+        {
+            continue;
+        }
+
+        vUtils_HistogramSummarise(&asLatency[iOp], &sSummary);
+        printf("%-6s %9u %9u %8u %8u %10.1f %9u %9u %9u %9u %9u\n",
+               apcOpNames[iOp], u32Requests, sTotal.u32Ok, sTotal.u32Errors, sTotal.u32Timeouts,
+               sTotal.u32Ok / dSeconds, sSummary.u32Mean, sSummary.u32P50, sSummary.u32P95,
+               sSummary.u32P99, sSummary.u32Max);
+
+        if (psCsv)
+        {
+            fprintf(psCsv, "%s,%s,%d,%d,%u,%s,%u,%u,%u,%u,%u,%.1f,%u,%u,%u,%u,%u\n",
+                    pcLabel, pcAddress, iNumWorkers, iRate, u32NumAddresses, apcOpNames[iOp],
+                    u32Requests, sTotal.u32Ok, sTotal.u32Errors, sTotal.u32Timeouts, u32Behind,
+                    sTotal.u32Ok / dSeconds, sSummary.u32Mean, sSummary.u32P50, sSummary.u32P95,
+                    sSummary.u32P99, sSummary.u32Max);
+        }
+    }
+
+    if (iRate)
+    {
+        printf("%u requests were sent more than an interval late\n", u32Behind);
+    }
+
+    if (psCsv)
+    {
+        fclose(psCsv);
+    }
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "LoadGen Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -A --address   <address>   Address of the JIP server [%s]\n", DEFAULT_ADDRESS);
+    fprintf(stderr, "    -P --port      <port>      Port of the JIP server [%d]\n", JIP_DEFAULT_PORT);
+    fprintf(stderr, "    -w --workers   <count>     Number of worker threads, each with its own context [%d]\n", DEFAULT_WORKERS);
+    fprintf(stderr, "    -r --rate      <per sec>   Total requests per second, 0 to send as fast as replies come [0]\n");
+    fprintf(stderr, "    -d --duration  <seconds>   Time to measure for [%d]\n", DEFAULT_DURATION_S);
+    fprintf(stderr, "    -W --warmup    <seconds>   Time to run for before measuring [%d]\n", DEFAULT_WARMUP_S);
+    fprintf(stderr, "    -m --mix       <g,s,q,m>   Weights of gets, sets, MIB queries and multicast sets [%s]\n", DEFAULT_MIX);
+    fprintf(stderr, "    -g --get       <Mib.Var>   Variable to get\n");
+    fprintf(stderr, "    -s --set       <Mib.Var>   Variable to set, by unicast or multicast\n");
+    fprintf(stderr, "    -v --values    <v1,v2..>   Values to set, in turn\n");
+    fprintf(stderr, "    -G --group     <address>   Multicast group to set\n");
+    fprintf(stderr, "    -I --interface <name>      Interface to multicast on\n");
+    fprintf(stderr, "    -H --hops      <count>     Hop limit of multicasts [%d]\n", DEFAULT_HOPS);
+    fprintf(stderr, "    -D --device    <id>        Only send to nodes with this device ID\n");
+    fprintf(stderr, "    -l --label     <name>      Label of the run in the results [%s]\n", DEFAULT_LABEL);
+    fprintf(stderr, "    -o --output    <file>      Append the results to a CSV file\n");
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    tsJIP_Context sDiscovery;
+    tsWorker *pasWorkers;
+    char **apcWeights;
+    int iOp;
+    int i;
+
+    {
+        static struct option long_options[] =
+        {
+            {"address",                 required_argument,  NULL, 'A'},
+            {"port",                    required_argument,  NULL, 'P'},
+            {"workers",                 required_argument,  NULL, 'w'},
+            {"rate",                    required_argument,  NULL, 'r'},
+            {"duration",                required_argument,  NULL, 'd'},
+            {"warmup",                  required_argument,  NULL, 'W'},
+            {"mix",                     required_argument,  NULL, 'm'},
+            {"get",                     required_argument,  NULL, 'g'},
+            {"set",                     required_argument,  NULL, 's'},
+            {"values",                  required_argument,  NULL, 'v'},
+            {"group",                   required_argument,  NULL, 'G'},
+            {"interface",               required_argument,  NULL, 'I'},
+            {"hops",                    required_argument,  NULL, 'H'},
+            {"device",                  required_argument,  NULL, 'D'},
+            {"label",                   required_argument,  NULL, 'l'},
+            {"output",                  required_argument,  NULL, 'o'},
+            {"help",                    no_argument,        NULL, 'h'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "A:P:w:r:d:W:m:g:s:v:G:I:H:D:l:o:h", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'A': pcAddress     = optarg;       break;
+                case 'P': iPort         = atoi(optarg); break;
+                case 'w': iNumWorkers   = atoi(optarg); break;
+                case 'r': iRate         = atoi(optarg); break;
+                case 'd': iDurationS    = atoi(optarg); break;
+                case 'W': iWarmupS      = atoi(optarg); break;
+                case 'm': pcMix         = optarg;       break;
+                case 'g': pcGetVar      = optarg;       break;
+                case 's': pcSetVar      = optarg;       break;
+                case 'v': pcValues      = optarg;       break;
+                case 'G': pcGroup       = optarg;       break;
+                case 'I': pcInterface   = optarg;       break;
+                case 'H': iHops         = atoi(optarg); break;
+                case 'D': u32DeviceId   = strtoul(optarg, NULL, 0); break;
+                case 'l': pcLabel       = optarg;       break;
+                case 'o': pcCsvFile     = optarg;       break;
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iNumWorkers < 1) || (iDurationS < 1) || (iWarmupS < 0) || (iRate < 0))
+    {
+        print_usage_exit(argv);
+    }
+
+    if (iSplitList(strdup(pcMix), &apcWeights) != E_OP_NUM)
+    {
+        fprintf(stderr, "The mix needs a weight for each of get, set, query and mcast\n");
+        print_usage_exit(argv);
+    }
+    for (iOp = 0; iOp < E_OP_NUM; iOp++)
+    {
+        au32Weights[iOp] = strtoul(apcWeights[iOp], NULL, 0);
+        u32TotalWeight += au32Weights[iOp];
+    }
+    if (u32TotalWeight == 0)
+    {
+        print_usage_exit(argv);
+    }
+
+    if ((au32Weights[E_OP_GET] && !pcGetVar) ||
+        ((au32Weights[E_OP_SET] || au32Weights[E_OP_MCAST]) &&
+         (!pcSetVar || !pcValues || ((iNumValues = iSplitList(strdup(pcValues), &apcValues)) < 1))))
+    {
+        fprintf(stderr, "Gets need a variable, and sets need a variable and values\n");
+        print_usage_exit(argv);
+    }
+
+    if (au32Weights[E_OP_MCAST])
+    {
+        memset(&sGroupAddress, 0, sizeof(tsJIPAddress));
+        sGroupAddress.sin6_family = AF_INET6;
+        sGroupAddress.sin6_port   = htons(iPort);
+        if (!pcGroup || (inet_pton(AF_INET6, pcGroup, &sGroupAddress.sin6_addr) != 1))
+        {
+            fprintf(stderr, "Multicast sets need a group address\n");
+            print_usage_exit(argv);
+        }
+    }
+
+    if (iDiscover(&sDiscovery) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    pasWorkers = calloc(iNumWorkers, sizeof(tsWorker));
+    if (!pasWorkers)
+    {
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < iNumWorkers; i++)
+    {
+        pasWorkers[i].iIndex = i;
+        if (iWorkerStart(&pasWorkers[i], &sDiscovery) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%s: %d workers to %s port %d, %u nodes, mix get %u set %u query %u mcast %u, ",
+           pcLabel, iNumWorkers, pcAddress, iPort, pasWorkers[0].u32NumTargets,
+           au32Weights[E_OP_GET], au32Weights[E_OP_SET], au32Weights[E_OP_QUERY], au32Weights[E_OP_MCAST]);
+    if (iRate)
+    {
+        printf("%d requests per second", iRate);
+    }
+    else
+    {
+        printf("unpaced");
+    }
+    printf(", %ds warm up, %ds measured\n", iWarmupS, iDurationS);
+
+    u64StartTime    = u64Bench_TimeNow() + 10000;
+    u64MeasureTime  = u64StartTime + ((uint64_t)iWarmupS * 1000000);
+    u64EndTime      = u64MeasureTime + ((uint64_t)iDurationS * 1000000);
+
+    for (i = 0; i < iNumWorkers; i++)
+    {
+        pthread_create(&pasWorkers[i].sThread, NULL, pvWorkerThread, &pasWorkers[i]);
+    }
+    for (i = 0; i < iNumWorkers; i++)
+    {
+        pthread_join(pasWorkers[i].sThread, NULL);
+    }
+
+    vReport(pasWorkers);
+
+    for (i = 0; i < iNumWorkers; i++)
+    {
+        eJIP_Destroy(&pasWorkers[i].sContext);
+    }
+    eJIP_Destroy(&sDiscovery);
+    return EXIT_SUCCESS;
+}
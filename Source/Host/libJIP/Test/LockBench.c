@@ -0,0 +1,288 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** LockBench measures the cost of the lock contention profiler, and checks
+ *  that its report finds what it should.
+ *
+ *  Locking and unlocking is timed with profiling off and then on, by one
+ *  thread and by several threads contending for the same lock. Then, with
+ *  profiling on, two locks are taken in both orders, a timed lock gives up,
+ *  and SIGUSR1 is sent to have the report written to a file, which is shown.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <Utils.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define DEFAULT_THREADS             4
+#define DEFAULT_ITERATIONS          1000000
+#define DEFAULT_REPORT_FILE         "/tmp/LockBench.lockprofile"
+
+/** Longest to wait for the report to be written */
+#define REPORT_TIMEOUT_MS           2000
+
+static int iThreads             = DEFAULT_THREADS;
+static int iIterations          = DEFAULT_ITERATIONS;
+static char *pcReportFile       = DEFAULT_REPORT_FILE;
+
+static tsUtilsLock sLock;
+static tsUtilsLock sLockA;
+static tsUtilsLock sLockB;
+
+/** Counter protected by sLock, so the critical section isn't empty */
+static volatile uint32_t u32Counter;
+static int iThreadIterations;
+
+
+static void vSleepMs(int iMs)
+{
+    struct timespec sDelay;
+
+    sDelay.tv_sec  = iMs / 1000;
+    sDelay.tv_nsec = (iMs % 1000) * 1000000;
+    nanosleep(&sDelay, NULL);
+}
+
+
+static void *pvLockThread(void *pvArg)
+{
+    int i;
+
+    (void)pvArg;
+    for (i = 0; i < iThreadIterations; i++)
+    {
+        eUtils_LockLock(&sLock);
+        u32Counter++;
+        eUtils_LockUnlock(&sLock);
+    }
+    return NULL;
+}
+
+
+/* Lock and unlock from a number of threads, returning the mean ns per lock and unlock */
+static double dRunCase(int iNumThreads)
+{
+    pthread_t *pasThreads;
+    uint64_t u64Start, u64Elapsed;
+    int i;
+
+    pasThreads = calloc(iNumThreads, sizeof(pthread_t));
+    if (!pasThreads)
+    {
+        return 0;
+    }
+
+    u32Counter = 0;
+    iThreadIterations = iIterations / iNumThreads;
+
+    u64Start = u64Bench_TimeNowNs();
+    for (i = 0; i < iNumThreads; i++)
+    {
+        pthread_create(&pasThreads[i], NULL, pvLockThread, NULL);
+    }
+    for (i = 0; i < iNumThreads; i++)
+    {
+        pthread_join(pasThreads[i], NULL);
+    }
+    u64Elapsed = u64Bench_TimeNowNs() - u64Start;
+
+    free(pasThreads);
+    return (double)u64Elapsed / (iThreadIterations * iNumThreads);
+}
+
+
+static void *pvHoldThread(void *pvArg)
+{
+    (void)pvArg;
+    eUtils_LockLock(&sLockB);
+    vSleepMs(1500);
+    eUtils_LockUnlock(&sLockB);
+    return NULL;
+}
+
+
+/* Take locks in ways the report should show */
+static void vLockOrders(void)
+{
+    pthread_t sThread;
+
+    /* A then B, then B then A - an inversion, although it can't deadlock run like this */
+    eUtils_LockLock(&sLockA);
+    eUtils_LockLock(&sLockB);
+    eUtils_LockUnlock(&sLockB);
+    eUtils_LockUnlock(&sLockA);
+
+    eUtils_LockLock(&sLockB);
+    eUtils_LockLock(&sLockA);
+    /* Recursion is not another acquisition */
+    eUtils_LockLock(&sLockA);
+    eUtils_LockUnlock(&sLockA);
+    eUtils_LockUnlock(&sLockA);
+    eUtils_LockUnlock(&sLockB);
+
+    /* A timed lock that gives up while another thread holds the lock */
+    pthread_create(&sThread, NULL, pvHoldThread, NULL);
+    vSleepMs(100);
+    if (eUtils_LockLockTimed(&sLockB, 1) == E_UTILS_OK)
+    {
+        fprintf(stderr, "Timed lock did not time out\n");
+        eUtils_LockUnlock(&sLockB);
+    }
+    pthread_join(sThread, NULL);
+}
+
+
+/* Have the report written by signalling the process, as an operator would */
+static int iSignalReport(void)
+{
+    uint64_t u64Start;
+    FILE *psFile;
+    char acLine[256];
+
+    unlink(pcReportFile);
+    kill(getpid(), SIGUSR1);
+
+    u64Start = u64Bench_TimeNowNs();
+    while ((psFile = fopen(pcReportFile, "r")) == NULL)
+    {
+        if (u64Bench_TimeNowNs() - u64Start > (uint64_t)REPORT_TIMEOUT_MS * 1000000)
+        {
+            fprintf(stderr, "Report %s was not written\n", pcReportFile);
+            return -1;
+        }
+        vSleepMs(10);
+    }
+    /* Let the report thread finish writing */
+    vSleepMs(100);
+
+    printf("Report written to %s on SIGUSR1:\n", pcReportFile);
+    while (fgets(acLine, sizeof(acLine), psFile))
+    {
+        fputs(acLine, stdout);
+    }
+    fclose(psFile);
+    return 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "LockBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -t --threads    <count>    Threads contending for the lock [%d]\n", DEFAULT_THREADS);
+    fprintf(stderr, "    -n --iterations <count>    Locks and unlocks per case [%d]\n", DEFAULT_ITERATIONS);
+    fprintf(stderr, "    -f --file       <File>     File the report is written to [%s]\n", DEFAULT_REPORT_FILE);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    double adOff[2], adOn[2];
+    int iResult;
+
+    {
+        static struct option long_options[] =
+        {
+            {"threads",                 required_argument,  NULL, 't'},
+            {"iterations",              required_argument,  NULL, 'n'},
+            {"file",                    required_argument,  NULL, 'f'},
+            {"help",                    no_argument,        NULL, 'h'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "t:n:f:h", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 't': iThreads      = atoi(optarg); break;
+                case 'n': iIterations   = atoi(optarg); break;
+                case 'f': pcReportFile  = optarg;       break;
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iThreads < 1) || (iIterations < iThreads))
+    {
+        print_usage_exit(argv);
+    }
+
+    if ((eUtils_LockCreateHere(&sLock) != E_UTILS_OK) ||
+        (eUtils_LockCreateHere(&sLockA) != E_UTILS_OK) ||
+        (eUtils_LockCreateHere(&sLockB) != E_UTILS_OK))
+    {
+        fprintf(stderr, "Error creating locks\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Request latency tracing also times locks - leave it out of the comparison */
+    vUtils_LatencyEnable(0);
+
+    adOff[0] = dRunCase(1);
+    adOff[1] = dRunCase(iThreads);
+
+    if (eUtils_LockProfileStart(pcReportFile) != E_UTILS_OK)
+    {
+        fprintf(stderr, "Error starting lock profiling\n");
+        return EXIT_FAILURE;
+    }
+
+    adOn[0] = dRunCase(1);
+    adOn[1] = dRunCase(iThreads);
+
+    printf("%d locks and unlocks per case, %ld CPUs\n", iIterations, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %9s %14s %14s %10s\n", "case", "threads", "off ns/lock", "on ns/lock", "overhead");
+    printf("%-10s %9d %14.1f %14.1f %9.1f%%\n", "alone", 1, adOff[0], adOn[0], (adOn[0] - adOff[0]) * 100 / adOff[0]);
+    printf("%-10s %9d %14.1f %14.1f %9.1f%%\n", "contended", iThreads, adOff[1], adOn[1], (adOn[1] - adOff[1]) * 100 / adOff[1]);
+
+    vLockOrders();
+
+    iResult = iSignalReport();
+    vUtils_LockProfileStop();
+
+    return iResult == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
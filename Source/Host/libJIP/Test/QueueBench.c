@@ -0,0 +1,282 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** QueueBench compares the locked queue with the lock free single consumer
+ *  queue, as used by the daemon's event and serial callback queues. From 1 up
+ *  to the given number of producer threads queue items to one consumer
+ *  thread, which takes them one at a time or in batches.
+ *
+ *  Each case is run twice:
+ *    flat out - producers queue as fast as they can, measuring throughput
+ *               when the queue is contended
+ *    paced    - producers queue an item at intervals, so the consumer is
+ *               often waiting, measuring the time to hand over an item
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <Utils.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define DEFAULT_PRODUCERS           8
+#define DEFAULT_ITEMS               100000
+#define DEFAULT_PACED_ITEMS         2000
+#define DEFAULT_INTERVAL_US         100
+#define DEFAULT_CAPACITY            100
+
+/** Most items the consumer takes at once in batch mode */
+#define BATCH_SIZE                  32
+
+typedef enum
+{
+    E_QUEUE_LOCKED,
+    E_QUEUE_LOCK_FREE,
+    E_QUEUE_LOCK_FREE_BATCH,
+    E_QUEUE_NUM,
+} teQueueKind;
+
+static const char *apcQueueNames[E_QUEUE_NUM] = { "locked", "lock free", "lock free batch" };
+
+/** An item handed from a producer to the consumer */
+typedef struct
+{
+    uint64_t            u64Queued;          /**< Time the item was queued */
+} tsItem;
+
+typedef struct
+{
+    pthread_t           sThread;
+    tsItem             *pasItems;           /**< Items this producer queues */
+} tsProducer;
+
+static int iMaxProducers    = DEFAULT_PRODUCERS;
+static int iItems           = DEFAULT_ITEMS;
+static int iPacedItems      = DEFAULT_PACED_ITEMS;
+static int iIntervalUs      = DEFAULT_INTERVAL_US;
+static int iCapacity        = DEFAULT_CAPACITY;
+
+static tsUtilsQueue sQueue;
+static int iProducerItems;
+static int iProducerIntervalUs;
+
+
+static void *pvProducerThread(void *pvArg)
+{
+    tsProducer *psProducer = (tsProducer *)pvArg;
+    int i;
+
+    for (i = 0; i < iProducerItems; i++)
+    {
+        if (iProducerIntervalUs)
+        {
+            vBench_SleepUs(iProducerIntervalUs);
+        }
+        psProducer->pasItems[i].u64Queued = u64Bench_TimeNow();
+        /* The queue blocks while it's full */
+        (void)eUtils_QueueQueue(&sQueue, &psProducer->pasItems[i]);
+    }
+    return NULL;
+}
+
+
+/* Hand items from the producers to the consumer, which is this thread */
+static int iRunCase(teQueueKind eKind, int iProducers, int iNumItems, int iInterval)
+{
+    tsProducer *pasProducers;
+    tsUtilsHistogram *psHandover;
+    tsUtilsHistogramSummary sSummary;
+    uint32_t u32Expected = iProducers * iNumItems;
+    uint32_t u32Received = 0;
+    uint64_t u64Start, u64Elapsed;
+    int i;
+
+    pasProducers = calloc(iProducers, sizeof(tsProducer));
+    psHandover = calloc(1, sizeof(tsUtilsHistogram));
+    if (!pasProducers || !psHandover)
+    {
+        return -1;
+    }
+    for (i = 0; i < iProducers; i++)
+    {
+        pasProducers[i].pasItems = calloc(iNumItems, sizeof(tsItem));
+        if (!pasProducers[i].pasItems)
+        {
+            return -1;
+        }
+    }
+
+    if (eUtils_QueueCreate(&sQueue, iCapacity, (eKind == E_QUEUE_LOCKED) ? 0 : UTILS_QUEUE_SINGLE_CONSUMER) != E_UTILS_OK)
+    {
+        fprintf(stderr, "Error creating queue\n");
+        return -1;
+    }
+    iProducerItems      = iNumItems;
+    iProducerIntervalUs = iInterval;
+
+    u64Start = u64Bench_TimeNow();
+    for (i = 0; i < iProducers; i++)
+    {
+        pthread_create(&pasProducers[i].sThread, NULL, pvProducerThread, &pasProducers[i]);
+    }
+
+    while (u32Received < u32Expected)
+    {
+        void *apvItems[BATCH_SIZE];
+        uint32_t u32NumItems = 0;
+        uint32_t j;
+
+        if (eKind == E_QUEUE_LOCK_FREE_BATCH)
+        {
+            teUtilsStatus eStatus = eUtils_QueueDequeueBatch(&sQueue, 1000, apvItems, BATCH_SIZE, &u32NumItems);
+            (void)eStatus;
+        }
+        else if (eUtils_QueueDequeueTimed(&sQueue, 1000, &apvItems[0]) == E_UTILS_OK)
+        {
+            u32NumItems = 1;
+        }
+
+        if (u32NumItems == 0)
+        {
+            fprintf(stderr, "Timed out with %u of %u items\n", u32Received, u32Expected);
+            break;
+        }
+
+        for (j = 0; j < u32NumItems; j++)
+        {
+            tsItem *psItem = (tsItem *)apvItems[j];
+            vUtils_HistogramRecord(psHandover, (uint32_t)(u64Bench_TimeNow() - psItem->u64Queued));
+        }
+        u32Received += u32NumItems;
+    }
+    u64Elapsed = u64Bench_TimeNow() - u64Start;
+
+    for (i = 0; i < iProducers; i++)
+    {
+        pthread_join(pasProducers[i].sThread, NULL);
+        free(pasProducers[i].pasItems);
+    }
+    eUtils_QueueDestroy(&sQueue);
+
+    vUtils_HistogramSummarise(psHandover, &sSummary);
+    printf("%-8s %-16s %9d %12.0f %9u %9u %9u %9u\n",
+           iInterval ? "paced" : "flat out", apcQueueNames[eKind], iProducers,
+           (double)u32Received * 1000000 / (u64Elapsed ? u64Elapsed : 1),
+           sSummary.u32Mean, sSummary.u32P50, sSummary.u32P99, sSummary.u32Max);
+
+    free(psHandover);
+    free(pasProducers);
+    return 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "QueueBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -p --producers <count>     Most producer threads to run [%d]\n", DEFAULT_PRODUCERS);
+    fprintf(stderr, "    -n --items     <count>     Items each producer queues flat out [%d]\n", DEFAULT_ITEMS);
+    fprintf(stderr, "    -N --paced     <count>     Items each producer queues at intervals [%d]\n", DEFAULT_PACED_ITEMS);
+    fprintf(stderr, "    -i --interval  <us>        Interval between the paced items of each producer [%d]\n", DEFAULT_INTERVAL_US);
+    fprintf(stderr, "    -c --capacity  <count>     Capacity of the queue [%d]\n", DEFAULT_CAPACITY);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int iProducers;
+    int iKind;
+
+    {
+        static struct option long_options[] =
+        {
+            {"producers",               required_argument,  NULL, 'p'},
+            {"items",                   required_argument,  NULL, 'n'},
+            {"paced",                   required_argument,  NULL, 'N'},
+            {"interval",                required_argument,  NULL, 'i'},
+            {"capacity",                required_argument,  NULL, 'c'},
+            {"help",                    no_argument,        NULL, 'h'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "p:n:N:i:c:h", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'p': iMaxProducers = atoi(optarg); break;
+                case 'n': iItems        = atoi(optarg); break;
+                case 'N': iPacedItems   = atoi(optarg); break;
+                case 'i': iIntervalUs   = atoi(optarg); break;
+                case 'c': iCapacity     = atoi(optarg); break;
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iMaxProducers < 1) || (iItems < 1) || (iPacedItems < 1) || (iIntervalUs < 1) || (iCapacity < 1))
+    {
+        print_usage_exit(argv);
+    }
+
+    printf("Queue capacity %d, %d items per producer flat out, %d paced at %dus, %ld CPUs\n",
+           iCapacity, iItems, iPacedItems, iIntervalUs, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %-16s %9s %12s %9s %9s %9s %9s\n",
+           "load", "queue", "producers", "items/s", "mean us", "p50 us", "p99 us", "max us");
+
+    for (iProducers = 1; iProducers <= iMaxProducers; iProducers++)
+    {
+        for (iKind = 0; iKind < E_QUEUE_NUM; iKind++)
+        {
+            iRunCase((teQueueKind)iKind, iProducers, iItems, 0);
+        }
+    }
+    for (iProducers = 1; iProducers <= iMaxProducers; iProducers++)
+    {
+        for (iKind = 0; iKind < E_QUEUE_NUM; iKind++)
+        {
+            iRunCase((teQueueKind)iKind, iProducers, iPacedItems, iIntervalUs);
+        }
+    }
+    return EXIT_SUCCESS;
+}
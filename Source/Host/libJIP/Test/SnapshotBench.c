@@ -0,0 +1,483 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** SnapshotBench compares the ways a front end may read the whole of a
+ *  network held by libJIP. A server context in this process holds a network
+ *  of lamps, every variable of which has a value. Each pass reads every
+ *  value, either:
+ *    walk      - by looking up and locking each node from the address list
+ *                and following the MiB and variable lists, as the CLI and
+ *                Python binding did
+ *    snapshot  - from one network snapshot, decoded record by record
+ *    changes   - from a snapshot of the variables changed since the previous
+ *                pass, after a few variables have changed
+ *    unchanged - from a snapshot of changes, with nothing changed
+ *  The values read each way are checked against each other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define BENCH_DEVICE_ID             0x08010001
+
+#define DEFAULT_NODES               200
+#define DEFAULT_RUNS                50
+#define DEFAULT_CHANGES             10
+
+/** Rows of the network table of each lamp */
+#define BENCH_TABLE_ROWS            8
+
+/** The MiBs of the lamps */
+static const tsBenchMib asMibs[] =
+{
+    { E_JIP_MIBID_NODE,     "Node",         E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "MacAddress", E_JIP_VAR_TYPE_UINT64 }, { "DescriptiveName", E_JIP_VAR_TYPE_STR },
+        { "Version", E_JIP_VAR_TYPE_STR }, { "TxPowerOffset", E_JIP_VAR_TYPE_INT8 }, { NULL } } },
+    { E_JIP_MIBID_JENNET,   "JenNet",       E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "ParentAddress", E_JIP_VAR_TYPE_UINT64 }, { "NetworkTable", E_JIP_VAR_TYPE_TABLE_BLOB },
+        { "PanId", E_JIP_VAR_TYPE_UINT16 }, { "ParentLqi", E_JIP_VAR_TYPE_UINT8 }, { NULL } } },
+    { E_JIP_MIBID_DEVICEID, "DeviceID",     E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "DeviceID", E_JIP_VAR_TYPE_UINT32 }, { "DeviceTypes", E_JIP_VAR_TYPE_BLOB }, { NULL } } },
+    { 0xFFFFFE10,           "BulbControl",  E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "Mode", E_JIP_VAR_TYPE_UINT8 }, { "LumTarget", E_JIP_VAR_TYPE_UINT8 },
+        { "LumCurrent", E_JIP_VAR_TYPE_UINT8 }, { "LumChange", E_JIP_VAR_TYPE_INT8 }, { NULL } } },
+    { 0xFFFFFE11,           "BulbStatus",   E_JIP_ACCESS_TYPE_READ_WRITE,
+      { { "OnCount", E_JIP_VAR_TYPE_UINT32 }, { "OnTime", E_JIP_VAR_TYPE_UINT32 },
+        { "SupplyVoltage", E_JIP_VAR_TYPE_FLT }, { "Temperature", E_JIP_VAR_TYPE_INT16 }, { NULL } } },
+};
+
+#define BENCH_NUM_MIBS              (sizeof(asMibs) / sizeof(asMibs[0]))
+
+/** What was read in a pass */
+typedef struct
+{
+    uint32_t            u32NumVars;         /**< Variables read */
+    uint32_t            u32Hash;            /**< Hash of the values read */
+    uint32_t            u32Length;          /**< Length of the snapshot */
+} tsRead;
+
+static tsJIP_Context sServer;
+
+static int iNodes           = DEFAULT_NODES;
+static int iRuns            = DEFAULT_RUNS;
+static int iChanges         = DEFAULT_CHANGES;
+
+
+/** Add bytes to an FNV-1a hash */
+static uint32_t u32Hash(uint32_t u32Hash, const uint8_t *pu8Data, uint32_t u32Length)
+{
+    uint32_t i;
+
+    for (i = 0; i < u32Length; i++)
+    {
+        u32Hash = (u32Hash ^ pu8Data[i]) * 16777619;
+    }
+    return u32Hash;
+}
+
+
+static void vAddress(tsJIPAddress *psAddress, int iNode)
+{
+    char acAddress[INET6_ADDRSTRLEN];
+
+    memset(psAddress, 0, sizeof(tsJIPAddress));
+    psAddress->sin6_family = AF_INET6;
+    snprintf(acAddress, sizeof(acAddress), "fd04:bd3:80e8:10::%x", iNode + 1);
+    inet_pton(AF_INET6, acAddress, &psAddress->sin6_addr);
+}
+
+
+/* Set up the server, with a network of lamps whose variables all have values */
+static int iServerStart(void)
+{
+    tsJIPAddress sAddress;
+    unsigned int j;
+    int iNode;
+
+    /* Read in this process, so it doesn't listen */
+    if (iBench_ServerStart(&sServer, 0, BENCH_DEVICE_ID, asMibs, BENCH_NUM_MIBS) != 0)
+    {
+        return -1;
+    }
+
+    for (iNode = 0; iNode < iNodes; iNode++)
+    {
+        char acAddress[INET6_ADDRSTRLEN];
+        tsNode *psNode;
+        tsMib *psMib;
+        tsVar *psVar;
+
+        vAddress(&sAddress, iNode);
+        inet_ntop(AF_INET6, &sAddress.sin6_addr, acAddress, sizeof(acAddress));
+        if (!(psNode = psBench_ServerAddNode(&sServer, acAddress, BENCH_DEVICE_ID, "Lamp")))
+        {
+            return -1;
+        }
+
+        /* Give every variable a value */
+        for (psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+        {
+            for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+            {
+                uint8_t au8Value[16];
+
+                memset(au8Value, 0, sizeof(au8Value));
+                au8Value[0] = iNode;
+                au8Value[1] = psVar->u8Index;
+                switch (psVar->eVarType)
+                {
+                    case E_JIP_VAR_TYPE_INT8:
+                    case E_JIP_VAR_TYPE_UINT8:      eJIP_SetVarValue(psVar, au8Value, 1); break;
+                    case E_JIP_VAR_TYPE_INT16:
+                    case E_JIP_VAR_TYPE_UINT16:     eJIP_SetVarValue(psVar, au8Value, 2); break;
+                    case E_JIP_VAR_TYPE_UINT32:
+                    case E_JIP_VAR_TYPE_FLT:        eJIP_SetVarValue(psVar, au8Value, 4); break;
+                    case E_JIP_VAR_TYPE_UINT64:     eJIP_SetVarValue(psVar, au8Value, 8); break;
+                    case E_JIP_VAR_TYPE_BLOB:       eJIP_SetVarValue(psVar, au8Value, 4); break;
+                    case E_JIP_VAR_TYPE_STR:
+                    {
+                        char acValue[32];
+                        snprintf(acValue, sizeof(acValue), "%s %d", psVar->pcName, iNode);
+                        eJIP_SetVarValue(psVar, acValue, strlen(acValue) + 1);
+                        break;
+                    }
+                    case E_JIP_VAR_TYPE_TABLE_BLOB:
+                        for (j = 0; j < BENCH_TABLE_ROWS; j++)
+                        {
+                            au8Value[2] = j;
+                            eJIP_Table_UpdateRow(psVar, j, au8Value, 8);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        eJIP_UnlockNode(psNode);
+    }
+    return 0;
+}
+
+
+/* Read every value as the front ends did, by locking each node in turn */
+static int iReadWalk(tsRead *psRead)
+{
+    tsJIPAddress *psAddresses;
+    uint32_t u32NumAddresses;
+    uint32_t i;
+
+    if (eJIP_GetNodeAddressList(&sServer, E_JIP_DEVICEID_ALL, &psAddresses, &u32NumAddresses) != E_JIP_OK)
+    {
+        return -1;
+    }
+    for (i = 0; i < u32NumAddresses; i++)
+    {
+        tsNode *psNode = psJIP_LookupNode(&sServer, &psAddresses[i]);
+        tsMib *psMib;
+        tsVar *psVar;
+
+        if (!psNode)
+        {
+            continue;
+        }
+        for (psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+        {
+            for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+            {
+                psRead->u32NumVars++;
+                if (!psVar->pvData)
+                {
+                    continue;
+                }
+                if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+                {
+                    uint32_t j;
+
+                    for (j = 0; j < psVar->ptData->u32NumRows; j++)
+                    {
+                        psRead->u32Hash = u32Hash(psRead->u32Hash, psVar->ptData->psRows[j].pbData, psVar->ptData->psRows[j].u32Length);
+                    }
+                }
+                else if (psVar->eVarType == E_JIP_VAR_TYPE_STR)
+                {
+                    psRead->u32Hash = u32Hash(psRead->u32Hash, psVar->pu8Data, strnlen(psVar->pcData, psVar->u8Size));
+                }
+                else
+                {
+                    psRead->u32Hash = u32Hash(psRead->u32Hash, psVar->pu8Data, psVar->u8Size);
+                }
+            }
+        }
+        eJIP_UnlockNode(psNode);
+    }
+    free(psAddresses);
+    return 0;
+}
+
+
+/* Read every value from a snapshot
+ * \param u32SinceGeneration    Generation to read the changes since, updated to the generation of the snapshot */
+static int iReadSnapshot(tsRead *psRead, uint32_t *pu32SinceGeneration)
+{
+    tsJIP_SnapshotHeader *psHeader;
+    uint8_t *pu8Snapshot, *pu8Record;
+    uint32_t u32Length;
+    uint32_t i, j, k;
+
+    if (eJIP_GetNetworkSnapshot(&sServer, E_JIP_DEVICEID_ALL, E_JIP_MIBID_ALL, *pu32SinceGeneration, &pu8Snapshot, &u32Length) != E_JIP_OK)
+    {
+        return -1;
+    }
+    psHeader = (tsJIP_SnapshotHeader *)pu8Snapshot;
+    psRead->u32Length = u32Length;
+    *pu32SinceGeneration = psHeader->u32Generation;
+
+    pu8Record = pu8Snapshot + sizeof(tsJIP_SnapshotHeader);
+    for (i = 0; i < psHeader->u32NumNodes; i++)
+    {
+        tsJIP_SnapshotNode *psNode = (tsJIP_SnapshotNode *)pu8Record;
+
+        pu8Record += sizeof(tsJIP_SnapshotNode);
+        for (j = 0; j < psNode->u16NumMibs; j++)
+        {
+            tsJIP_SnapshotMib *psMib = (tsJIP_SnapshotMib *)pu8Record;
+
+            pu8Record = (uint8_t *)&psMib->acName[psMib->u8NameLength];
+            for (k = 0; k < psMib->u16NumVars; k++)
+            {
+                tsJIP_SnapshotVar *psVar = (tsJIP_SnapshotVar *)pu8Record;
+
+                pu8Record = (uint8_t *)&psVar->acName[psVar->u8NameLength];
+                psRead->u32NumVars++;
+                if (!(psVar->u8Flags & JIP_SNAPSHOT_VAR_VALUE))
+                {
+                    continue;
+                }
+                if (psVar->u8VarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+                {
+                    uint16_t u16NumRows;
+
+                    memcpy(&u16NumRows, pu8Record, sizeof(uint16_t));
+                    pu8Record += sizeof(uint16_t);
+                    while (u16NumRows--)
+                    {
+                        tsJIP_SnapshotRow *psRow = (tsJIP_SnapshotRow *)pu8Record;
+
+                        pu8Record += sizeof(tsJIP_SnapshotRow);
+                        psRead->u32Hash = u32Hash(psRead->u32Hash, pu8Record, psRow->u16Length);
+                        pu8Record += psRow->u16Length;
+                    }
+                }
+                else
+                {
+                    psRead->u32Hash = u32Hash(psRead->u32Hash, pu8Record + 1, pu8Record[0]);
+                    pu8Record += 1 + pu8Record[0];
+                }
+            }
+        }
+    }
+    if (pu8Record != pu8Snapshot + u32Length)
+    {
+        fprintf(stderr, "Snapshot decoded to %d bytes of %u\n", (int)(pu8Record - pu8Snapshot), u32Length);
+        free(pu8Snapshot);
+        return -1;
+    }
+    free(pu8Snapshot);
+    return 0;
+}
+
+
+/* Change the LumCurrent of iChanges lamps, spread through the network */
+static void vChangeLamps(int iRun)
+{
+    int i;
+
+    for (i = 0; i < iChanges; i++)
+    {
+        tsJIPAddress sAddress;
+        tsNode *psNode;
+        uint8_t u8Value = iRun + 1;
+
+        vAddress(&sAddress, (i * iNodes) / iChanges);
+        if ((psNode = psJIP_LookupNode(&sServer, &sAddress)))
+        {
+            eJIP_SetVarValue(psJIP_LookupVar(psJIP_LookupMibId(psNode, NULL, 0xFFFFFE10), NULL, "LumCurrent"), &u8Value, sizeof(uint8_t));
+            eJIP_UnlockNode(psNode);
+        }
+    }
+}
+
+
+static void vPrintCase(const char *pcCase, tsRead *psRead, uint64_t u64Total)
+{
+    printf("%-10s %9d %9u %9u %12.1f\n", pcCase, iRuns, psRead->u32NumVars, psRead->u32Length, (double)u64Total / iRuns / 1000);
+}
+
+
+int iRunCases(void)
+{
+    tsRead sWalk, sSnapshot, sChanges, sUnchanged;
+    uint64_t u64Walk = 0, u64Snapshot = 0, u64Changes = 0, u64Unchanged = 0;
+    uint32_t u32Generation = 0;
+    int iResult = 0;
+    int i;
+
+    for (i = 0; i < iRuns; i++)
+    {
+        uint32_t u32Since = 0;
+        uint64_t u64Start;
+
+        memset(&sWalk, 0, sizeof(tsRead));
+        memset(&sSnapshot, 0, sizeof(tsRead));
+        memset(&sChanges, 0, sizeof(tsRead));
+        memset(&sUnchanged, 0, sizeof(tsRead));
+
+        u64Start = u64Bench_TimeNowNs();
+        iResult |= iReadWalk(&sWalk);
+        u64Walk += u64Bench_TimeNowNs() - u64Start;
+
+        u64Start = u64Bench_TimeNowNs();
+        iResult |= iReadSnapshot(&sSnapshot, &u32Since);
+        u64Snapshot += u64Bench_TimeNowNs() - u64Start;
+
+        if ((sWalk.u32NumVars != sSnapshot.u32NumVars) || (sWalk.u32Hash != sSnapshot.u32Hash))
+        {
+            fprintf(stderr, "Snapshot read %u variables, walk read %u, values %s\n", sSnapshot.u32NumVars, sWalk.u32NumVars,
+                    (sWalk.u32Hash == sSnapshot.u32Hash) ? "match" : "differ");
+            iResult = -1;
+        }
+
+        if (u32Generation == 0)
+        {
+            u32Generation = u32Since;
+        }
+        vChangeLamps(i);
+        u64Start = u64Bench_TimeNowNs();
+        iResult |= iReadSnapshot(&sChanges, &u32Generation);
+        u64Changes += u64Bench_TimeNowNs() - u64Start;
+
+        if (sChanges.u32NumVars != iChanges)
+        {
+            fprintf(stderr, "Snapshot of changes read %u variables, %d changed\n", sChanges.u32NumVars, iChanges);
+            iResult = -1;
+        }
+
+        u64Start = u64Bench_TimeNowNs();
+        iResult |= iReadSnapshot(&sUnchanged, &u32Generation);
+        u64Unchanged += u64Bench_TimeNowNs() - u64Start;
+
+        if (sUnchanged.u32NumVars != 0)
+        {
+            fprintf(stderr, "Snapshot of no changes read %u variables\n", sUnchanged.u32NumVars);
+            iResult = -1;
+        }
+    }
+
+    vPrintCase("walk", &sWalk, u64Walk);
+    vPrintCase("snapshot", &sSnapshot, u64Snapshot);
+    vPrintCase("changes", &sChanges, u64Changes);
+    vPrintCase("unchanged", &sUnchanged, u64Unchanged);
+    return iResult;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "SnapshotBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -n --nodes     <count>     Number of lamps in the network [%d]\n", DEFAULT_NODES);
+    fprintf(stderr, "    -r --runs      <count>     Number of passes of each case [%d]\n", DEFAULT_RUNS);
+    fprintf(stderr, "    -c --changes   <count>     Variables changed before each snapshot of changes [%d]\n", DEFAULT_CHANGES);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int iResult;
+
+    {
+        static struct option long_options[] =
+        {
+            {"help",        no_argument,        NULL, 'h'},
+            {"nodes",       required_argument,  NULL, 'n'},
+            {"runs",        required_argument,  NULL, 'r'},
+            {"changes",     required_argument,  NULL, 'c'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "hn:r:c:", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'n': iNodes            = atoi(optarg); break;
+                case 'r': iRuns             = atoi(optarg); break;
+                case 'c': iChanges          = atoi(optarg); break;
+                case 'h':
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iNodes <= 0) || (iNodes > 0xFFFF) || (iRuns <= 0) || (iChanges <= 0) || (iChanges > iNodes))
+    {
+        print_usage_exit(argv);
+    }
+
+    if (iServerStart() != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("%d lamps with %u MiBs, %d variables changed between snapshots of changes\n", iNodes, (uint32_t)BENCH_NUM_MIBS, iChanges);
+    printf("%-10s %9s %9s %9s %12s\n", "read", "runs", "vars", "bytes", "time us");
+
+    iResult = iRunCases();
+
+    eJIP_Destroy(&sServer);
+    return iResult ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+############################################################################
+#
+# This software is owned by NXP B.V. and/or its supplier and is protected
+# under applicable copyright laws. All rights are reserved. We grant You,
+# and any third parties, a license to use this software solely and
+# exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+# You, and any third parties must reproduce the copyright and warranty notice
+# and any other legend of ownership on each copy or partial copy of the 
+# software.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+# Copyright NXP B.V. 2014. All rights reserved
+#
+
+"""SnapshotBench.py compares the ways a Python front end may read the whole of
+a network held by libJIP, through the libJIP binding, as SnapshotBench does
+in C. A server context holds a network of lamps defined by the daemon's
+device definitions. Each pass reads every value, either:
+  walk      - by following the node, MiB and variable lists of the binding,
+              reading each value with a call into libJIP
+  snapshot  - from one network snapshot, decoded by the binding
+  changes   - from a snapshot of the variables changed since the previous
+              pass, after a few variables have changed
+  unchanged - from a snapshot of changes, with nothing changed
+The values read by walking and from the snapshot are checked against each
+other, and the time per variable read is reported.
+"""
+
+import sys
+import time
+import getopt
+
+from libJIP import *
+
+DEFAULT_NODES       = 200
+DEFAULT_RUNS        = 10
+DEFAULT_CHANGES     = 10
+DEFAULT_DEFINITIONS = "../../zigbee-jip-daemon/JIP/Build/jip_cache_definitions.xml"
+
+BENCH_DEVICE_ID     = 0x08010001
+BENCH_MIB_ID        = 0xffffff00    # Node MiB
+BENCH_VAR_INDEX     = 3             # TxPowerOffset, changed between snapshots of changes
+
+
+def usage():
+    sys.stderr.write("Usage: %s\n" % sys.argv[0])
+    sys.stderr.write("  Arguments:\n")
+    sys.stderr.write("    -N --nodes       <count>     Number of lamps [%d]\n" % DEFAULT_NODES)
+    sys.stderr.write("    -n --runs        <count>     Number of passes each way [%d]\n" % DEFAULT_RUNS)
+    sys.stderr.write("    -c --changes     <count>     Variables changed between snapshots of changes [%d]\n" % DEFAULT_CHANGES)
+    sys.stderr.write("    -d --definitions <file>      Device definitions [%s]\n" % DEFAULT_DEFINITIONS)
+    sys.exit(1)
+
+
+def walk(context):
+    """Read every value by following the lists of the binding"""
+    values = []
+    for node in context.Network:
+        for mib in node:
+            for var in mib:
+                data = var.Data
+                if var.Type == E_JIP_VAR_TYPE_STR and data:
+                    # The snapshot does not include the terminator
+                    data = data.rstrip("\x00")
+                values.append((node.Address, mib.Name, var.Name, var.Type, data))
+    return values
+
+
+def snapshot(context, since=0):
+    """Read every value, or the values changed since a generation, from one snapshot"""
+    snap = context.Snapshot(SinceGeneration=since)
+    values = []
+    for node in snap:
+        for mib in node:
+            for var in mib:
+                values.append((node.Address, mib.Name, var.Name, var.Type, var.Data))
+    return values, snap
+
+
+def change(context, addresses, count, value):
+    """Change a variable of count lamps"""
+    for address in addresses[:count]:
+        node = psJIP_LookupNode(context, sockaddr_in6(address, 0))
+        var = psJIP_LookupVarIndex(psJIP_LookupMibId(node, BENCH_MIB_ID), BENCH_VAR_INDEX)
+        eJIP_SetVarValue(var, value)
+        node.Unlock()
+
+
+def main():
+    nodes, runs, changes, definitions = DEFAULT_NODES, DEFAULT_RUNS, DEFAULT_CHANGES, DEFAULT_DEFINITIONS
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "hN:n:c:d:", ["help", "nodes=", "runs=", "changes=", "definitions="])
+    except getopt.GetoptError:
+        usage()
+    for opt, arg in opts:
+        if opt in ("-N", "--nodes"):            nodes = int(arg)
+        elif opt in ("-n", "--runs"):           runs = int(arg)
+        elif opt in ("-c", "--changes"):        changes = int(arg)
+        elif opt in ("-d", "--definitions"):    definitions = arg
+        else:                                   usage()
+    if nodes <= 0 or runs <= 0 or changes < 0 or changes > nodes:
+        usage()
+
+    context = JIP_Context(E_JIP_CONTEXT_SERVER)
+    if eJIPService_PersistXMLLoadDefinitions(context, definitions) != E_JIP_OK:
+        sys.stderr.write("Error loading device definitions from %s\n" % definitions)
+        return 1
+    addresses = ["fd04::%x" % (i + 1) for i in range(nodes)]
+    for address in addresses:
+        if eJIPserver_NodeAdd(context, address, BENCH_DEVICE_ID, "Lamp", "1") != E_JIP_OK:
+            sys.stderr.write("Error adding lamp %s\n" % address)
+            return 1
+
+    results = {}
+    def record(name, elapsed, values, length):
+        (total, count, size) = results.get(name, (0.0, 0, 0))
+        results[name] = (total + elapsed, count + len(values), size + length)
+
+    failed = 0
+    generation = 0
+    for run in range(runs):
+        start = time.time()
+        walked = walk(context)
+        record("walk", time.time() - start, walked, 0)
+
+        start = time.time()
+        read, snap = snapshot(context)
+        record("snapshot", time.time() - start, read, snap.Length)
+        if read != walked:
+            sys.stderr.write("Snapshot differs from walk\n")
+            failed += 1
+        generation = snap.Generation
+
+        change(context, addresses, changes, run + 1)
+        start = time.time()
+        read, snap = snapshot(context, generation)
+        record("changes", time.time() - start, read, snap.Length)
+        if len(read) != changes:
+            sys.stderr.write("%d changes read, expected %d\n" % (len(read), changes))
+            failed += 1
+
+        start = time.time()
+        read, unchanged = snapshot(context, snap.Generation)
+        record("unchanged", time.time() - start, read, unchanged.Length)
+        if len(read) != 0:
+            sys.stderr.write("%d changes read, expected none\n" % len(read))
+            failed += 1
+
+    print "%d lamps, %d variables changed between snapshots of changes, through the Python binding" % (nodes, changes)
+    print "%-12s %6s %9s %9s %10s %12s" % ("read", "runs", "vars", "bytes", "time ms", "us per var")
+    for name in ("walk", "snapshot", "changes", "unchanged"):
+        (total, count, size) = results[name]
+        print "%-12s %6d %9d %9s %10.2f %12s" % (name, runs, count / runs, (size / runs) if size else "-",
+                                                 total * 1000 / runs,
+                                                 ("%.2f" % (total * 1000000 / count)) if count else "-")
+    if failed:
+        print "%d passes failed" % failed
+    context.Destroy()
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,498 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** TableBench measures reading a large table variable, such as the
+ *  JenNet/NetworkTable of a big network, again and again as discovery does.
+ *  A server context in this process serves a node with a table of 1000 rows,
+ *  and a client context reads it through a relay that delays each response
+ *  by a round trip time.
+ *
+ *  The table is read with tables read in full every time, as earlier
+ *  versions did, and then reading only the rows that have changed since the
+ *  table was last read. Each way, the table is read:
+ *    cold      - by a client that has not read it before
+ *    unchanged - again, with nothing changed
+ *    one row   - after one row has changed
+ *    shrunk    - after the last rows have been removed
+ *    racing    - after every tenth row has changed, with another changed
+ *                while the table is being read
+ *  After every read the client's rows are checked against the server's.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define BENCH_DEVICE_ID             0x08010011
+#define BENCH_ADDRESS               "::1"
+#define BENCH_MIB_ID                E_JIP_MIBID_JENNET
+
+#define DEFAULT_PORT                11878
+#define DEFAULT_RELAY_PORT          11879
+#define DEFAULT_ROWS                1000
+#define DEFAULT_ROW_LENGTH          16
+#define DEFAULT_RUNS                5
+#define DEFAULT_RTT_US              20000
+
+/** Rows removed from the end of the table in the shrunk case */
+#define BENCH_SHRINK_ROWS           10
+
+/** Every this many rows are changed in the racing case, so that the changed rows fill more than one page */
+#define BENCH_RACING_STEP           10
+
+/** The router's MiB, with its table */
+static const tsBenchMib sJenNetMib =
+{
+    BENCH_MIB_ID, "JenNet", E_JIP_ACCESS_TYPE_READ_ONLY,
+    { { "ParentAddress", E_JIP_VAR_TYPE_UINT64 }, { "NetworkTable", E_JIP_VAR_TYPE_TABLE_BLOB }, { NULL } }
+};
+
+static tsJIP_Context sServer;
+static tsNode *psServerNode;
+static tsVar *psServerTable;
+
+static int iPort            = DEFAULT_PORT;
+static int iRelayPort       = DEFAULT_RELAY_PORT;
+static int iRows            = DEFAULT_ROWS;
+static int iRowLength       = DEFAULT_ROW_LENGTH;
+static int iRuns            = DEFAULT_RUNS;
+static int iRttUs           = DEFAULT_RTT_US;
+
+/** Relay between the client and the server */
+static int iRelayClientSocket;
+static int iRelayServerSocket;
+static volatile int iRelayRunning;
+static volatile uint32_t u32Requests;       /**< Requests passed on to the server */
+static volatile uint32_t u32ChangeAt;       /**< Request count at which to change a row, or 0 */
+
+/** Counts the changes made to the table, so that each changes a row's data */
+static uint32_t u32Generation;
+
+
+/* Set a row of the served table, with its index and a generation in the data */
+static void vServerSetRow(uint32_t u32Index)
+{
+    uint8_t au8Row[255];
+    uint32_t u32Value;
+    int i;
+
+    for (i = 0; i < iRowLength; i++)
+    {
+        au8Row[i] = (uint8_t)(u32Index + i);
+    }
+    u32Value = htonl(u32Index);
+    memcpy(au8Row, &u32Value, sizeof(uint32_t));
+    u32Value = htonl(u32Generation);
+    memcpy(&au8Row[sizeof(uint32_t)], &u32Value, sizeof(uint32_t));
+
+    eJIP_LockNode(psServerNode, True);
+    eJIP_Table_UpdateRow(psServerTable, u32Index, au8Row, iRowLength);
+    eJIP_UnlockNode(psServerNode);
+}
+
+
+static void vServerRemoveRow(uint32_t u32Index)
+{
+    eJIP_LockNode(psServerNode, True);
+    eJIP_Table_UpdateRow(psServerTable, u32Index, NULL, 0);
+    eJIP_UnlockNode(psServerNode);
+}
+
+
+/* Pass requests on to the server and its responses back to the client */
+static void *pvRelayThread(void *pvArg)
+{
+    struct sockaddr_in6 sClientAddress;
+    struct sockaddr_in6 sServerAddress;
+    struct pollfd asFds[2];
+    char acBuffer[JIP_PACKET_MAX_SIZE];
+
+    memset(&sClientAddress, 0, sizeof(sClientAddress));
+    memset(&sServerAddress, 0, sizeof(sServerAddress));
+    sServerAddress.sin6_family = AF_INET6;
+    sServerAddress.sin6_port   = htons(iPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sServerAddress.sin6_addr);
+
+    asFds[0].fd     = iRelayClientSocket;
+    asFds[0].events = POLLIN;
+    asFds[1].fd     = iRelayServerSocket;
+    asFds[1].events = POLLIN;
+
+    while (iRelayRunning)
+    {
+        socklen_t iAddressLen = sizeof(sClientAddress);
+        ssize_t iLen;
+
+        if (poll(asFds, 2, 100) <= 0)
+        {
+            continue;
+        }
+
+        if (asFds[0].revents & POLLIN)
+        {
+            iLen = recvfrom(iRelayClientSocket, acBuffer, sizeof(acBuffer), 0, (struct sockaddr *)&sClientAddress, &iAddressLen);
+            if (iLen > 0)
+            {
+                if (++u32Requests == u32ChangeAt)
+                {
+                    /* Change a row between the pages of a read */
+                    u32Generation++;
+                    vServerSetRow(0);
+                    u32ChangeAt = 0;
+                }
+                sendto(iRelayServerSocket, acBuffer, iLen, 0, (struct sockaddr *)&sServerAddress, sizeof(sServerAddress));
+            }
+        }
+
+        if (asFds[1].revents & POLLIN)
+        {
+            iLen = recv(iRelayServerSocket, acBuffer, sizeof(acBuffer), 0);
+            if (iLen > 0)
+            {
+                vBench_SleepUs(iRttUs);
+                sendto(iRelayClientSocket, acBuffer, iLen, 0, (struct sockaddr *)&sClientAddress, sizeof(sClientAddress));
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static int iRelayStart(pthread_t *psThread)
+{
+    struct sockaddr_in6 sAddress;
+
+    iRelayClientSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+    iRelayServerSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+    if ((iRelayClientSocket < 0) || (iRelayServerSocket < 0))
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&sAddress, 0, sizeof(sAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iRelayPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sAddress.sin6_addr);
+    if (bind(iRelayClientSocket, (struct sockaddr *)&sAddress, sizeof(sAddress)) < 0)
+    {
+        perror("bind");
+        return -1;
+    }
+
+    iRelayRunning = 1;
+    pthread_create(psThread, NULL, pvRelayThread, NULL);
+    return 0;
+}
+
+
+/* Set up the server, with the node and its table */
+static int iServerStart(void)
+{
+    tsTable *psTable;
+    int i;
+
+    if ((iBench_ServerStart(&sServer, iPort, BENCH_DEVICE_ID, &sJenNetMib, 1) != 0) ||
+        !(psServerNode = psBench_ServerAddNode(&sServer, BENCH_ADDRESS, BENCH_DEVICE_ID, "Router")))
+    {
+        return -1;
+    }
+
+    psServerTable = psJIP_LookupVarIndex(psJIP_LookupMibId(psServerNode, NULL, BENCH_MIB_ID), 1);
+    psTable = malloc(sizeof(tsTable));
+    if (!psServerTable || !psTable)
+    {
+        return -1;
+    }
+    psTable->u32NumRows = 0;
+    psTable->psRows     = NULL;
+    psServerTable->ptData  = psTable;
+    psServerTable->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_UnlockNode(psServerNode);
+
+    for (i = 0; i < iRows; i++)
+    {
+        vServerSetRow(i);
+    }
+    return 0;
+}
+
+
+/* Check the rows the client read against those served
+ * \return 0 if they match */
+static int iCheckTable(tsVar *psVar)
+{
+    tsTable *psServed = psServerTable->ptData;
+    tsTable *psRead = psVar->ptData;
+    uint32_t i;
+
+    if (!psRead)
+    {
+        fprintf(stderr, "No table read\n");
+        return -1;
+    }
+
+    eJIP_LockNode(psServerNode, True);
+    for (i = 0; (i < psServed->u32NumRows) || (i < psRead->u32NumRows); i++)
+    {
+        tsTableRow *psServedRow = (i < psServed->u32NumRows) ? &psServed->psRows[i] : NULL;
+        tsTableRow *psReadRow = (i < psRead->u32NumRows) ? &psRead->psRows[i] : NULL;
+        uint32_t u32ServedLength = (psServedRow && psServedRow->pvData) ? psServedRow->u32Length : 0;
+        uint32_t u32ReadLength = (psReadRow && psReadRow->pvData) ? psReadRow->u32Length : 0;
+
+        if ((u32ServedLength != u32ReadLength) ||
+            (u32ServedLength && memcmp(psServedRow->pvData, psReadRow->pvData, u32ServedLength)))
+        {
+            eJIP_UnlockNode(psServerNode);
+            fprintf(stderr, "Row %u differs\n", i);
+            return -1;
+        }
+    }
+    eJIP_UnlockNode(psServerNode);
+    return 0;
+}
+
+
+typedef enum
+{
+    E_READ_COLD,
+    E_READ_UNCHANGED,
+    E_READ_ONE_ROW,
+    E_READ_SHRUNK,
+    E_READ_RACING,
+    E_READ_NUM,
+} teRead;
+
+static const char *apcReadNames[E_READ_NUM] = { "cold", "unchanged", "one row", "shrunk", "racing" };
+
+
+/* Read the table in each way iRuns times, each with a new client, and report the mean round trips and time
+ * \return 0 if every read succeeded and matched the server */
+static int iRunCase(int iRereadInterval)
+{
+    uint32_t au32Requests[E_READ_NUM];
+    uint64_t au64Time[E_READ_NUM];
+    uint32_t u32Failed = 0;
+    tsJIPAddress sAddress;
+    int i, iRead;
+
+    memset(au32Requests, 0, sizeof(au32Requests));
+    memset(au64Time, 0, sizeof(au64Time));
+
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iRelayPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sAddress.sin6_addr);
+
+    for (i = 0; i < iRuns; i++)
+    {
+        tsJIP_Context sClient;
+        tsNode *psNode;
+        tsVar *psVar;
+
+        /* Put back the rows removed by the last run */
+        for (iRead = iRows - BENCH_SHRINK_ROWS; iRead < iRows; iRead++)
+        {
+            vServerSetRow(iRead);
+        }
+
+        if ((eJIP_Init(&sClient, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+            (eJIP_Connect(&sClient, BENCH_ADDRESS, iRelayPort) != E_JIP_OK) ||
+            (eJIP_NetAddNode(&sClient, &sAddress, BENCH_DEVICE_ID, &psNode) != E_JIP_OK))
+        {
+            fprintf(stderr, "Error connecting client\n");
+            return -1;
+        }
+        sClient.iTableRereadInterval = iRereadInterval;
+        psVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, BENCH_MIB_ID), 1);
+        eJIP_UnlockNode(psNode);
+        if (!psVar)
+        {
+            fprintf(stderr, "Table not discovered\n");
+            return -1;
+        }
+
+        for (iRead = 0; iRead < E_READ_NUM; iRead++)
+        {
+            uint32_t u32Requests0;
+            uint64_t u64Start;
+
+            switch (iRead)
+            {
+                case (E_READ_ONE_ROW):
+                    u32Generation++;
+                    vServerSetRow(iRows / 2);
+                    break;
+
+                case (E_READ_SHRUNK):
+                {
+                    int j;
+                    for (j = iRows - BENCH_SHRINK_ROWS; j < iRows; j++)
+                    {
+                        vServerRemoveRow(j);
+                    }
+                    break;
+                }
+
+                case (E_READ_RACING):
+                {
+                    /* Change rows across the table, and another before the second page is served */
+                    int j;
+                    u32Generation++;
+                    for (j = 0; j < iRows; j += BENCH_RACING_STEP)
+                    {
+                        vServerSetRow(j);
+                    }
+                    u32ChangeAt = u32Requests + 2;
+                    break;
+                }
+
+                default:
+                    break;
+            }
+
+            u32Requests0 = u32Requests;
+            u64Start = u64Bench_TimeNow();
+            if ((eJIP_GetVar(&sClient, psVar, E_JIP_FLAG_NONE) != E_JIP_OK) || (iCheckTable(psVar) != 0))
+            {
+                fprintf(stderr, "%s read failed\n", apcReadNames[iRead]);
+                u32Failed++;
+            }
+            au64Time[iRead]     += u64Bench_TimeNow() - u64Start;
+            au32Requests[iRead] += u32Requests - u32Requests0;
+            u32ChangeAt = 0;
+        }
+        eJIP_Destroy(&sClient);
+    }
+
+    for (iRead = 0; iRead < E_READ_NUM; iRead++)
+    {
+        printf("%-12s %-10s %12.1f %10.1f\n", iRereadInterval ? "if changed" : "in full", apcReadNames[iRead],
+               (double)au32Requests[iRead] / iRuns, (double)au64Time[iRead] / iRuns / 1000);
+    }
+    if (u32Failed)
+    {
+        printf("%u reads failed\n", u32Failed);
+    }
+    return u32Failed ? -1 : 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "TableBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -r --rows      <count>     Rows in the table [%d]\n", DEFAULT_ROWS);
+    fprintf(stderr, "    -l --length    <bytes>     Length of each row [%d]\n", DEFAULT_ROW_LENGTH);
+    fprintf(stderr, "    -n --runs      <count>     Number of clients reading the table in each case [%d]\n", DEFAULT_RUNS);
+    fprintf(stderr, "    -d --rtt       <us>        Round trip time added to each response [%d]\n", DEFAULT_RTT_US);
+    fprintf(stderr, "    -P --port      <port>      Port to serve JIP on [%d]\n", DEFAULT_PORT);
+    fprintf(stderr, "    -R --relay     <port>      Port of the relay [%d]\n", DEFAULT_RELAY_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_t sRelayThread;
+    int iResult;
+
+    {
+        static struct option long_options[] =
+        {
+            {"help",        no_argument,        NULL, 'h'},
+            {"rows",        required_argument,  NULL, 'r'},
+            {"length",      required_argument,  NULL, 'l'},
+            {"runs",        required_argument,  NULL, 'n'},
+            {"rtt",         required_argument,  NULL, 'd'},
+            {"port",        required_argument,  NULL, 'P'},
+            {"relay",       required_argument,  NULL, 'R'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "hr:l:n:d:P:R:", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'r': iRows             = atoi(optarg); break;
+                case 'l': iRowLength        = atoi(optarg); break;
+                case 'n': iRuns             = atoi(optarg); break;
+                case 'd': iRttUs            = atoi(optarg); break;
+                case 'P': iPort             = atoi(optarg); break;
+                case 'R': iRelayPort        = atoi(optarg); break;
+                case 'h':
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iRows <= BENCH_SHRINK_ROWS) || (iRows > 65535) || (iRowLength < 8) || (iRowLength > 255) || (iRuns <= 0) || (iRttUs < 0))
+    {
+        print_usage_exit(argv);
+    }
+
+    if ((iServerStart() != 0) || (iRelayStart(&sRelayThread) != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("Table of %d rows of %d bytes, %dus round trip\n", iRows, iRowLength, iRttUs);
+    printf("%-12s %-10s %12s %10s\n", "read", "table", "round trips", "time ms");
+
+    iResult  = iRunCase(0);
+    iResult |= iRunCase(JIP_TABLE_REREAD_INTERVAL);
+
+    iRelayRunning = 0;
+    pthread_join(sRelayThread, NULL);
+    close(iRelayClientSocket);
+    close(iRelayServerSocket);
+
+    eJIP_Destroy(&sServer);
+    return iResult ? EXIT_FAILURE : EXIT_SUCCESS;
+}
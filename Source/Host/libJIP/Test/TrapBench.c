@@ -0,0 +1,455 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** TrapBench compares the radio traffic caused by clients that poll a
+ *  variable with that caused by clients that trap it. A server context
+ *  serves a single sensor node from this process. Its value stands in for
+ *  a Zigbee attribute: the device changes it periodically and reports the
+ *  change (one radio frame), and every get is served by reading the
+ *  attribute from the device (a request and a response frame), as
+ *  zigbee-jip-daemon does. N client contexts in the same process then
+ *  either poll the value with gets, or trap it and wait for notifications.
+ *  For each, the radio frames, JIP packets and how long clients take to see
+ *  a change are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define BENCH_DEVICE_ID             0x0B3C0001
+#define BENCH_MIB_ID                0xFFFFFE50
+#define BENCH_ADDRESS               "::1"
+#define BENCH_TRAP_HANDLE           0x42
+
+#define DEFAULT_PORT                11873
+#define DEFAULT_CLIENTS             10
+#define DEFAULT_DURATION_S          10
+#define DEFAULT_POLL_MS             1000
+#define DEFAULT_CHANGE_MS           200
+
+/** State of one client */
+typedef struct
+{
+    tsJIP_Context       sContext;
+    tsVar               *psVar;
+    pthread_t           sThread;
+    uint32_t            u32LastSeen;        /**< Last change number seen */
+    uint32_t            u32ChangesSeen;
+    uint32_t            u32Packets;         /**< JIP packets sent and received */
+    uint64_t            u64LatencyTotal;    /**< Time from change to seeing it (us) */
+    uint64_t            u64LatencyMax;
+} tsClient;
+
+/** The sensor node's MiB */
+static const tsBenchMib sSensorMib =
+{
+    BENCH_MIB_ID, "Sensor", E_JIP_ACCESS_TYPE_READ_ONLY, { { "Value", E_JIP_VAR_TYPE_UINT16 }, { NULL } }
+};
+
+static tsJIP_Context sServer;
+static tsVar *psServerVar;
+
+static tsClient *pasClients;
+static int iNumClients      = DEFAULT_CLIENTS;
+static int iPort            = DEFAULT_PORT;
+static int iDuration        = DEFAULT_DURATION_S;
+static int iPollMs          = DEFAULT_POLL_MS;
+static int iChangeMs        = DEFAULT_CHANGE_MS;
+static int iReadLatencyMs   = 0;
+
+static pthread_mutex_t mStats = PTHREAD_MUTEX_INITIALIZER;
+static volatile int iRunning;
+
+/** The value held by the device. Protected by the server node lock */
+static uint16_t u16DeviceValue;
+/** Time each value was set on the device (us) */
+static uint64_t au64ChangeTime[65536];
+static uint32_t u32Changes;
+static volatile uint32_t u32RadioFrames;
+
+
+static void vSleepMs(int iMs)
+{
+    struct timespec sDelay;
+
+    sDelay.tv_sec  = iMs / 1000;
+    sDelay.tv_nsec = (iMs % 1000) * 1000000;
+    nanosleep(&sDelay, NULL);
+}
+
+
+/* Get callback of the server variable - read the attribute from the device */
+static teJIP_Status eReadAttribute(tsVar *psVar)
+{
+    /* Read attribute request and response */
+    u32AtomicAdd(&u32RadioFrames, 2);
+    
+    if (iReadLatencyMs)
+    {
+        vSleepMs(iReadLatencyMs);
+    }
+    return eJIP_SetVarValue(psVar, &u16DeviceValue, sizeof(uint16_t));
+}
+
+
+/* Device thread - change the value periodically and report it */
+static void *pvDeviceThread(void *pvArg)
+{
+    tsNode *psNode = psServerVar->psOwnerMib->psOwnerNode;
+    
+    while (iRunning)
+    {
+        vSleepMs(iChangeMs);
+        
+        eJIP_LockNode(psNode, True);
+        u16DeviceValue++;
+        au64ChangeTime[u16DeviceValue] = u64Bench_TimeNow();
+        u32Changes++;
+        
+        /* Attribute report */
+        u32AtomicAdd(&u32RadioFrames, 1);
+        eJIP_SetVarValue(psServerVar, &u16DeviceValue, sizeof(uint16_t));
+        eJIP_UnlockNode(psNode);
+    }
+    return NULL;
+}
+
+
+/* Record a client seeing a value */
+static void vClientSaw(tsClient *psClient, uint16_t u16Value)
+{
+    uint64_t u64Latency;
+    
+    pthread_mutex_lock(&mStats);
+    if (u16Value != (uint16_t)psClient->u32LastSeen)
+    {
+        u64Latency = u64Bench_TimeNow() - au64ChangeTime[u16Value];
+        psClient->u32LastSeen = u16Value;
+        psClient->u32ChangesSeen++;
+        psClient->u64LatencyTotal += u64Latency;
+        if (u64Latency > psClient->u64LatencyMax)
+        {
+            psClient->u64LatencyMax = u64Latency;
+        }
+    }
+    pthread_mutex_unlock(&mStats);
+}
+
+
+/* Polling client thread */
+static void *pvPollThread(void *pvArg)
+{
+    tsClient *psClient = (tsClient *)pvArg;
+    
+    /* Spread the clients' polls over the interval */
+    vSleepMs(rand() % iPollMs);
+    
+    while (iRunning)
+    {
+        if (eJIP_GetVar(&psClient->sContext, psClient->psVar, E_JIP_FLAG_NONE) == E_JIP_OK)
+        {
+            psClient->u32Packets += 2;
+            vClientSaw(psClient, *psClient->psVar->pu16Data);
+        }
+        else
+        {
+            psClient->u32Packets++;
+        }
+        vSleepMs(iPollMs);
+    }
+    return NULL;
+}
+
+
+/* Trap callback - called with the client's node locked */
+static void vTrapCallback(tsVar *psVar)
+{
+    tsJIP_Context *psContext = psVar->psOwnerMib->psOwnerNode->psOwnerNetwork->psOwnerContext;
+    tsClient *psClient = (tsClient *)((char *)psContext - offsetof(tsClient, sContext));
+    
+    if (psVar->pvData)
+    {
+        pthread_mutex_lock(&mStats);
+        psClient->u32Packets++;
+        pthread_mutex_unlock(&mStats);
+        vClientSaw(psClient, *psVar->pu16Data);
+    }
+}
+
+
+/* Set up the server, with the sensor node */
+static int iServerStart(void)
+{
+    tsNode *psNode;
+    
+    if ((iBench_ServerStart(&sServer, iPort, BENCH_DEVICE_ID, &sSensorMib, 1) != 0) ||
+        !(psNode = psBench_ServerAddNode(&sServer, BENCH_ADDRESS, BENCH_DEVICE_ID, "Sensor")))
+    {
+        return -1;
+    }
+    
+    psServerVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, BENCH_MIB_ID), 0);
+    psServerVar->prCbVarGet = eReadAttribute;
+    psServerVar->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_SetVarValue(psServerVar, &u16DeviceValue, sizeof(uint16_t));
+    eJIP_UnlockNode(psNode);
+    return 0;
+}
+
+
+/* Connect a client and find the sensor variable */
+static int iClientStart(tsClient *psClient)
+{
+    tsJIPAddress sAddress;
+    tsNode *psNode;
+    
+    memset(psClient, 0, sizeof(tsClient));
+    
+    if ((eJIP_Init(&psClient->sContext, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+        (eJIP_Connect(&psClient->sContext, BENCH_ADDRESS, iPort) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error connecting client\n");
+        return -1;
+    }
+    
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iPort);
+    inet_pton(AF_INET6, BENCH_ADDRESS, &sAddress.sin6_addr);
+    
+    /* Discovers the node's MIBs from the server */
+    if (eJIP_NetAddNode(&psClient->sContext, &sAddress, BENCH_DEVICE_ID, &psNode) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error discovering node\n");
+        return -1;
+    }
+    psClient->psVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, BENCH_MIB_ID), 0);
+    eJIP_UnlockNode(psNode);
+    
+    if (!psClient->psVar)
+    {
+        fprintf(stderr, "Sensor variable not found\n");
+        return -1;
+    }
+    psClient->u32LastSeen = u16DeviceValue;
+    return 0;
+}
+
+
+/* Run one phase with all clients polling or all trapping */
+static int iRunPhase(int iTrap)
+{
+    pthread_t sDeviceThread;
+    uint32_t u32StartFrames;
+    uint32_t u32StartChanges;
+    uint32_t u32PhaseFrames;
+    uint32_t u32PhaseChanges;
+    uint32_t u32Packets = 0;
+    uint32_t u32Seen = 0;
+    uint64_t u64LatencyTotal = 0;
+    uint64_t u64LatencyMax = 0;
+    int i;
+    
+    for (i = 0; i < iNumClients; i++)
+    {
+        if (iClientStart(&pasClients[i]) != 0)
+        {
+            return -1;
+        }
+        if (iTrap)
+        {
+            if (eJIP_TrapVar(&pasClients[i].sContext, pasClients[i].psVar, BENCH_TRAP_HANDLE, vTrapCallback) != E_JIP_OK)
+            {
+                fprintf(stderr, "Error trapping variable\n");
+                return -1;
+            }
+            pasClients[i].u32Packets += 2;
+        }
+    }
+    
+    u32StartFrames  = u32RadioFrames;
+    u32StartChanges = u32Changes;
+    iRunning = 1;
+    
+    pthread_create(&sDeviceThread, NULL, pvDeviceThread, NULL);
+    if (!iTrap)
+    {
+        for (i = 0; i < iNumClients; i++)
+        {
+            pthread_create(&pasClients[i].sThread, NULL, pvPollThread, &pasClients[i]);
+        }
+    }
+    
+    vSleepMs(iDuration * 1000);
+    
+    iRunning = 0;
+    pthread_join(sDeviceThread, NULL);
+    if (!iTrap)
+    {
+        for (i = 0; i < iNumClients; i++)
+        {
+            pthread_join(pasClients[i].sThread, NULL);
+        }
+    }
+    
+    /* Let the last notifications arrive */
+    vSleepMs(iChangeMs);
+    
+    u32PhaseFrames  = u32RadioFrames - u32StartFrames;
+    u32PhaseChanges = u32Changes - u32StartChanges;
+    
+    for (i = 0; i < iNumClients; i++)
+    {
+        if (iTrap)
+        {
+            eJIP_UntrapVar(&pasClients[i].sContext, pasClients[i].psVar, BENCH_TRAP_HANDLE);
+            pasClients[i].u32Packets += 2;
+        }
+        pthread_mutex_lock(&mStats);
+        u32Packets      += pasClients[i].u32Packets;
+        u32Seen         += pasClients[i].u32ChangesSeen;
+        u64LatencyTotal += pasClients[i].u64LatencyTotal;
+        if (pasClients[i].u64LatencyMax > u64LatencyMax)
+        {
+            u64LatencyMax = pasClients[i].u64LatencyMax;
+        }
+        pthread_mutex_unlock(&mStats);
+        eJIP_Destroy(&pasClients[i].sContext);
+    }
+    
+    printf("%-6s %8d %12u %10.1f %12u %10.1f %14.1f %10.1f\n",
+           iTrap ? "trap" : "poll", iNumClients, u32PhaseFrames, (double)u32PhaseFrames / iDuration, u32Packets,
+           (double)u32Seen * 100 / ((double)u32PhaseChanges * iNumClients),
+           u32Seen ? (double)u64LatencyTotal / u32Seen / 1000 : 0.0, (double)u64LatencyMax / 1000);
+    return 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "TrapBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -n --clients   <count>     Number of clients [%d]\n", DEFAULT_CLIENTS);
+    fprintf(stderr, "    -t --time      <seconds>   Duration of each phase [%d]\n", DEFAULT_DURATION_S);
+    fprintf(stderr, "    -p --poll      <ms>        Interval between polls of each client [%d]\n", DEFAULT_POLL_MS);
+    fprintf(stderr, "    -c --change    <ms>        Interval between changes of the value [%d]\n", DEFAULT_CHANGE_MS);
+    fprintf(stderr, "    -i --interval  <ms>        Minimum interval between notifications [%d]\n", JIP_SERVER_TRAP_MIN_INTERVAL_MS);
+    fprintf(stderr, "    -l --latency   <ms>        Time taken to read the attribute from the device [0]\n");
+    fprintf(stderr, "    -P --port      <port>      Port to serve JIP on [%d]\n", DEFAULT_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint32_t u32MinIntervalMs = JIP_SERVER_TRAP_MIN_INTERVAL_MS;
+    
+    {
+        static struct option long_options[] =
+        {
+            {"help",        no_argument,        NULL, 'h'},
+            {"clients",     required_argument,  NULL, 'n'},
+            {"time",        required_argument,  NULL, 't'},
+            {"poll",        required_argument,  NULL, 'p'},
+            {"change",      required_argument,  NULL, 'c'},
+            {"interval",    required_argument,  NULL, 'i'},
+            {"latency",     required_argument,  NULL, 'l'},
+            {"port",        required_argument,  NULL, 'P'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+        
+        while ((opt = getopt_long(argc, argv, "hn:t:p:c:i:l:P:", long_options, &option_index)) != -1) 
+        {
+            switch (opt) 
+            {
+                case 'n': iNumClients       = atoi(optarg); break;
+                case 't': iDuration         = atoi(optarg); break;
+                case 'p': iPollMs           = atoi(optarg); break;
+                case 'c': iChangeMs         = atoi(optarg); break;
+                case 'i': u32MinIntervalMs  = atoi(optarg); break;
+                case 'l': iReadLatencyMs    = atoi(optarg); break;
+                case 'P': iPort             = atoi(optarg); break;
+                case 'h':
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+    
+    if ((iNumClients <= 0) || (iDuration <= 0) || (iPollMs <= 0) || (iChangeMs <= 0))
+    {
+        print_usage_exit(argv);
+    }
+    
+    pasClients = calloc(iNumClients, sizeof(tsClient));
+    if (!pasClients)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    
+    if (iServerStart() != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    eJIPserver_TrapMinInterval(&sServer, u32MinIntervalMs);
+    
+    printf("%d clients, value changes every %dms, polls every %dms, notifications at most every %dms, %ds per mode\n",
+           iNumClients, iChangeMs, iPollMs, u32MinIntervalMs, iDuration);
+    printf("%-6s %8s %12s %10s %12s %10s %14s %10s\n",
+           "mode", "clients", "radio frames", "frames/s", "JIP packets", "seen %", "mean delay ms", "max ms");
+    
+    if ((iRunPhase(0) != 0) || (iRunPhase(1) != 0))
+    {
+        return EXIT_FAILURE;
+    }
+    
+    eJIP_Destroy(&sServer);
+    free(pasClients);
+    return EXIT_SUCCESS;
+}
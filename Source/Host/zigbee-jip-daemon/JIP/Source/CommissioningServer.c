@@ -63,7 +63,9 @@
 
 #define DBG_COMMISSIONING 0
 
-#define PORT "1880"
+/** Port the commissioning server of the first control bridge listens on. Each
+ *  control bridge after it listens on the next port */
+#define COMMISSIONING_PORT 1880
 
 #define BACKLOG 10
 
@@ -133,9 +135,9 @@ typedef struct
 /***        Local Function Prototypes                                     ***/
 /****************************************************************************/
 
-static int iServerSetup(int *piServerSocket);
+static int iServerSetup(int *piServerSocket, const char *pcPort);
 static void *psGetSockAddr(struct sockaddr *psSockAddr);
-static void vHandleClient(int iClientSocket);
+static void vHandleClient(tsZCB_Shard *psShard, int iClientSocket);
 
 /****************************************************************************/
 /***        Exported Variables                                            ***/
@@ -152,19 +154,26 @@ static void vHandleClient(int iClientSocket);
 
 void *pvCommissioningServer(tsUtilsThread *psThreadInfo)
 {
+    tsZCB_Shard             *psShard = (tsZCB_Shard *)psThreadInfo->pvThreadData;
+    int                     iShard = psShard - asZCB_Shards;
     int                     iServerSocket = 0;
+    char                    acPort[NI_MAXSERV];
     
-    DBG_vPrintf(DBG_COMMISSIONING, "Commissioning server starting\n");
+    DBG_vPrintf(DBG_COMMISSIONING, "Commissioning server %d starting\n", iShard);
     
     psThreadInfo->eState = E_THREAD_RUNNING;
     
-    if (iServerSetup(&iServerSocket) < 0)
+    /* Devices are commissioned onto the network of the control bridge this server is for */
+    vZCB_ShardSelect(iShard);
+    snprintf(acPort, sizeof(acPort), "%d", COMMISSIONING_PORT + iShard);
+    
+    if (iServerSetup(&iServerSocket, acPort) < 0)
     {
-        daemon_log(LOG_ERR, "Failed to set up commissioning server on port %s", PORT);
+        daemon_log(LOG_ERR, "Failed to set up commissioning server on port %s", acPort);
         return NULL;
     }
     
-    daemon_log(LOG_INFO, "Commissioning server listening on port %s", PORT);
+    daemon_log(LOG_INFO, "Commissioning server for %s listening on port %s", psShard->pcSerialDevice, acPort);
     
     while (psThreadInfo->eState == E_THREAD_RUNNING)
     {
@@ -183,7 +192,7 @@ void *pvCommissioningServer(tsUtilsThread *psThreadInfo)
         inet_ntop(sClientAddress.ss_family, psGetSockAddr((struct sockaddr *)&sClientAddress), sClientAddressStr, INET6_ADDRSTRLEN);
         daemon_log(LOG_DEBUG, "Commissioning server: new connection from %s", sClientAddressStr);
         
-        vHandleClient(iClientSocket);
+        vHandleClient(psShard, iClientSocket);
     }
     
     DBG_vPrintf(DBG_COMMISSIONING, "Commissioning server exiting\n");
@@ -198,7 +207,7 @@ void *pvCommissioningServer(tsUtilsThread *psThreadInfo)
 /***        Local Functions                                               ***/
 /****************************************************************************/
 
-static int iServerSetup(int *piServerSocket)
+static int iServerSetup(int *piServerSocket, const char *pcPort)
 {
     struct addrinfo         sHints;
     struct addrinfo         *psServerInfo;
@@ -211,7 +220,7 @@ static int iServerSetup(int *piServerSocket)
     sHints.ai_socktype = SOCK_STREAM;
     sHints.ai_flags = AI_PASSIVE;
 
-    if ((iResult = getaddrinfo("localhost", PORT, &sHints, &psServerInfo)) != 0)
+    if ((iResult = getaddrinfo("localhost", pcPort, &sHints, &psServerInfo)) != 0)
     {
         daemon_log(LOG_ERR, "getaddrinfo: %s", gai_strerror(iResult));
         return 1;
@@ -267,7 +276,7 @@ static void *psGetSockAddr(struct sockaddr *psSockAddr)
 }
 
 
-static void vHandleClient(int iClientSocket)
+static void vHandleClient(tsZCB_Shard *psShard, int iClientSocket)
 {
     tsCommMsg sIncoming;
     int iClientConnected = 1;
@@ -306,9 +315,9 @@ static void vHandleClient(int iClientSocket)
                 sOutgoing.sHeader.u8Length  = sizeof(tsUnsecuredParams);
                 sOutgoing.sHeader.u8Command = E_COMM_UNSECURED_PARAMS;
                 
-                sOutgoing.uPayload.sUnsecuredParams.u64PanID    = htobe64(u64PanIDInUse);
-                sOutgoing.uPayload.sUnsecuredParams.u16PanID    = htons(u16PanIDInUse);
-                sOutgoing.uPayload.sUnsecuredParams.u8Channel   = eChannelInUse;
+                sOutgoing.uPayload.sUnsecuredParams.u64PanID    = htobe64(psShard->u64PanIDInUse);
+                sOutgoing.uPayload.sUnsecuredParams.u16PanID    = htons(psShard->u16PanIDInUse);
+                sOutgoing.uPayload.sUnsecuredParams.u8Channel   = psShard->eChannelInUse;
                 
                 iResult = write(iClientSocket, &sOutgoing, sizeof(tsCommMsgHeader) + sizeof(tsUnsecuredParams));
                 if ((iResult <= 0) || (iResult != (sizeof(tsCommMsgHeader) + sizeof(tsUnsecuredParams))))
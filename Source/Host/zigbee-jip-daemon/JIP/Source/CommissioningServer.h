@@ -72,6 +72,10 @@ extern "C" {
 /****************************************************************************/
 
 
+/** Serve requests to commission devices onto the network of one control bridge.
+ *  The control bridge at index i of asZCB_Shards is served on TCP port 1880 + i.
+ *  \param psThreadInfo     Thread, whose pvThreadData is the control bridge in asZCB_Shards
+ */
 void *pvCommissioningServer(tsUtilsThread *psThreadInfo);
 
 
@@ -0,0 +1,221 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee - JIP Daemon
+ *
+ * COMPONENT:          Unix socket dump server
+ *
+ * REVISION:           $Revision: 37346 $
+ *
+ * DATED:              $Date: 2011-11-18 12:16:43 +0000 (Fri, 18 Nov 2011) $
+ *
+ * AUTHOR:             Matt Redfearn
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <libdaemon/daemon.h>
+
+#include <Utils.h>
+
+#include "DumpServer.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+#define DBG_DUMP_SERVER 0
+
+#define BACKLOG 4
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static int iServerSetup(tsDumpServer *psServer, int *piServerSocket);
+static void vHandleClient(tsDumpServer *psServer, int iClientSocket);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+
+void *pvDumpServer(tsUtilsThread *psThreadInfo)
+{
+    tsDumpServer *psServer = (tsDumpServer *)psThreadInfo->pvThreadData;
+    int         iServerSocket = 0;
+    
+    DBG_vPrintf(DBG_DUMP_SERVER, "%s server starting\n", psServer->pcName);
+    
+    psThreadInfo->eState = E_THREAD_RUNNING;
+    
+    if (iServerSetup(psServer, &iServerSocket) < 0)
+    {
+        daemon_log(LOG_ERR, "Failed to set up %s server on %s", psServer->pcName, psServer->pcPath);
+        return NULL;
+    }
+    
+    daemon_log(LOG_INFO, "%s server listening on %s", psServer->pcName, psServer->pcPath);
+    
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        int iClientSocket;
+
+        /* Stopping the thread interrupts the accept */
+        iClientSocket = accept(iServerSocket, NULL, NULL);
+        if (iClientSocket == -1)
+        {
+            daemon_log(LOG_DEBUG, "%s server: %s failed(%s)", psServer->pcName, "accept", strerror(errno));
+            continue;
+        }
+
+        vHandleClient(psServer, iClientSocket);
+    }
+    
+    DBG_vPrintf(DBG_DUMP_SERVER, "%s server exiting\n", psServer->pcName);
+    
+    close(iServerSocket);
+    unlink(psServer->pcPath);
+    
+    return NULL;
+}
+
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+static int iServerSetup(tsDumpServer *psServer, int *piServerSocket)
+{
+    const char *pcPath = psServer->pcPath;
+    struct sockaddr_un sAddress;
+    
+    if (strlen(pcPath) >= sizeof(sAddress.sun_path))
+    {
+        daemon_log(LOG_ERR, "%s server: socket path too long", psServer->pcName);
+        return -1;
+    }
+    
+    memset(&sAddress, 0, sizeof(struct sockaddr_un));
+    sAddress.sun_family = AF_UNIX;
+    strcpy(sAddress.sun_path, pcPath);
+    
+    if ((*piServerSocket = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+        daemon_log(LOG_DEBUG, "%s server: %s failed(%s)", psServer->pcName, "socket", strerror(errno));
+        return -1;
+    }
+    
+    /* Remove the socket left by a previous run */
+    unlink(pcPath);
+    
+    if (bind(*piServerSocket, (struct sockaddr *)&sAddress, sizeof(struct sockaddr_un)) == -1)
+    {
+        daemon_log(LOG_DEBUG, "%s server: %s failed(%s)", psServer->pcName, "bind", strerror(errno));
+        close(*piServerSocket);
+        return -1;
+    }
+    
+    if (listen(*piServerSocket, BACKLOG) == -1)
+    {
+        daemon_log(LOG_DEBUG, "%s server: %s failed(%s)", psServer->pcName, "listen", strerror(errno));
+        close(*piServerSocket);
+        return -2;
+    }
+    
+    return 0;
+}
+
+
+static void vHandleClient(tsDumpServer *psServer, int iClientSocket)
+{
+    char       *pcDump = NULL;
+    size_t      stDumpLength = 0;
+    size_t      stSent = 0;
+    FILE       *psStream;
+    
+    /* Build the dump first, so a slow client doesn't hold up what is being dumped */
+    psStream = open_memstream(&pcDump, &stDumpLength);
+    if (!psStream)
+    {
+        daemon_log(LOG_ERR, "%s server: %s failed(%s)", psServer->pcName, "open_memstream", strerror(errno));
+        close(iClientSocket);
+        return;
+    }
+    
+    psServer->prDump(psStream);
+    fclose(psStream);
+    
+    while (stSent < stDumpLength)
+    {
+        /* Don't let a client that has gone away raise SIGPIPE */
+        ssize_t iSent = send(iClientSocket, pcDump + stSent, stDumpLength - stSent, MSG_NOSIGNAL);
+        if (iSent <= 0)
+        {
+            if ((iSent < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            daemon_log(LOG_DEBUG, "%s server: %s failed(%s)", psServer->pcName, "send", strerror(errno));
+            break;
+        }
+        stSent += iSent;
+    }
+    
+    free(pcDump);
+    close(iClientSocket);
+}
+
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
+
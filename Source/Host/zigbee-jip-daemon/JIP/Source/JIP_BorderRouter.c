@@ -83,6 +83,8 @@ static uint64_t u64BR_IPv6AddressToIEEE(tsJIPAddress sNode_Address);
 /** JIP context structure */
 tsJIP_Context sJIP_Context;
 
+/** Minimum time between trap notifications to each subscriber */
+uint32_t u32BR_TrapMinIntervalMs = 100;
 
 extern const char *Version;
 
@@ -115,6 +117,8 @@ teBrStatus eBR_Init(const char *pcIPv6Address)
         return E_BR_JIP_ERROR;
     }
     
+    eJIPserver_TrapMinInterval(&sJIP_Context, u32BR_TrapMinIntervalMs);
+    
     if ((eStatus = eJIPserver_Listen(&sJIP_Context, JIP_DEFAULT_PORT)) != E_JIP_OK)
     {
         daemon_log(LOG_ERR, "Error starting JIP server (0x%02x)", eStatus);
@@ -211,13 +215,15 @@ teBrStatus eBR_Destory(void)
 tsZCB_Node *psBR_FindZigbeeNode(tsNode *psJIPNode)
 {
     uint64_t u64IEEEAddress;
+    tsZCB_Node *psZCBNode;
 
     DBG_vPrintf(DBG_BORDERROUTER, "Find Zigbee node matching IPv6 Address ");
     DBG_vPrintf_IPv6Address(DBG_BORDERROUTER, psJIPNode->sNode_Address.sin6_addr);
 
     u64IEEEAddress = u64BR_IPv6AddressToIEEE(psJIPNode->sNode_Address);
 
-    return psZCB_FindNodeIEEEAddress(u64IEEEAddress);
+    psZCBNode = psZCB_FindNodeIEEEAddress(u64IEEEAddress);
+    return psZCBNode;
 }
 
 
@@ -319,6 +325,10 @@ teBrStatus eBR_NodeJoined(tsZCB_Node *psZCBNode)
                         daemon_log(LOG_ERR, "Error initialising node");
                     }
                     
+                    /* Bind the nodes so that attribute reports go straight to the JIP node */
+                    psZCBNode->sBinding.pvNode      = psJIPNode;
+                    psZCBNode->sBinding.pvContext   = psDeviceIDMap;
+                    
                     eJIP_UnlockNode(psJIPNode);
 
                     if (eJIP_Table_UpdateRow(psVar, psZCBNode->u16ShortAddress, &sNetworkTableRow, sizeof(struct _sNetworkTableRow)) != E_JIP_OK)
@@ -393,6 +403,10 @@ teBrStatus eBR_NodeLeft(tsZCB_Node *psZCBNode)
                     
                     eTD_RemoveIPAddress(acIPv6Address);
                     
+                    /* The JIP node is about to go - stop reports being passed to it */
+                    psZCBNode->sBinding.pvNode      = NULL;
+                    psZCBNode->sBinding.pvContext   = NULL;
+                    
                     /* Call the device type's removal routine */
 //                     if (psDeviceIDMap->prInitaliseRoutine(psZCBNode, psJIPNode) != E_JIP_OK)
 //                     {
@@ -489,7 +503,8 @@ teBrStatus eBR_CheckDeviceComms(void)
             
         }
 
-        /* Just temporarily grab a pointer to the control bridge. It won't be removed from under us so we can unlock it safely. */
+        /* Just temporarily grab a pointer to the control bridge of the node's network, which the request above selected.
+         * It won't be removed from under us so we can unlock it safely. */
         psZcbNodeControlBridge = psZCB_FindNodeControlBridge();
         eUtils_LockUnlock(&psZcbNodeControlBridge->sLock);
         
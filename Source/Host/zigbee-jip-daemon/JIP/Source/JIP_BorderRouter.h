@@ -76,7 +76,8 @@ typedef enum
 typedef teJIP_Status (*tpreDeviceInitialise)(tsZCB_Node *psZCBNode, tsNode *psJIPNode);
 
 
-/** Function that will handle asynchronous attribute reports from a Zigbee device
+/** Function that will handle asynchronous attribute reports from a Zigbee device.
+ *  Called with the JIP node locked. The Zigbee node is not locked.
  *  \param psZCBNode        Pointer to the Zigbee node definition
  *  \param psJIPNode        Pointer to the JIP node definition
  *  \param u16ClusterID     The cluster that is being updated
@@ -113,6 +114,9 @@ typedef struct
 /** JIP context structure */
 extern tsJIP_Context sJIP_Context;
 
+/** Minimum time between trap notifications to each subscriber */
+extern uint32_t u32BR_TrapMinIntervalMs;
+
 /** Map of Zigbee Device IDs to JIP Device IDs. The fianl entry must be 0,0,NULL */
 extern tsDeviceIDMap asDeviceIDMap[];
 
@@ -141,6 +145,12 @@ teBrStatus eBR_CheckDeviceComms(void);
 
 int iBR_DeviceTimedOut(tsZCB_Node *psZCBNode);
 
+/** Find the Zigbee node of a JIP node, in the network of whichever control bridge it is in.
+ *  The control bridge the calling thread has selected is left as it is; requests sent
+ *  to the node go through the node's own.
+ *  \param psJIPNode        JIP node to find the Zigbee node of
+ *  \return Pointer to the locked Zigbee node, or NULL if not found
+ */
 tsZCB_Node *psBR_FindZigbeeNode(tsNode *psJIPNode);
 
 tsNode *psBR_FindJIPNode(tsZCB_Node *psZCBNode);
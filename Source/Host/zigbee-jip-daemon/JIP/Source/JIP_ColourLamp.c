@@ -56,6 +56,7 @@
 #include "JIP_BorderRouter.h"
 #include "ZigbeeConstant.h"
 #include "ZigbeeZLL.h"
+#include "ZigbeeCommandQueue.h"
 #include "Utils.h"
 
 /****************************************************************************/
@@ -107,6 +108,9 @@ static teJIP_Status ColourLampSetScene(tsVar *psVar, tsJIPAddress *psMulticastAd
 static teJIP_Status ColourLampGetScene(tsVar *psVar);
 static teJIP_Status ColourLampGetSceneIDs(tsVar *psVar);
 
+static teJIP_Status ColourLampSetVars(tsNode *psJIPNode, tsVar **apsVars, uint32_t u32NumVars);
+static teJIP_Status ColourLampSendCommands(tsNode *psJIPNode, tsZcbCommand *asCommands, int iNumCommands);
+
 /****************************************************************************/
 /***        Exported Variables                                            ***/
 /****************************************************************************/
@@ -133,6 +137,9 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
     int         iHasColour = 0;
     
     DBG_vPrintf(DBG_COLOURLAMP, "Set up device\n");
+    
+    /* Setters that send a multicast on to the Zigbee group are also the group setters,
+     * so libJIP calls them once per multicast rather than once per lamp in the group. */
 
     psMib = psJIP_LookupMibId(psJIPNode, NULL, 0xfffffe03);
     if (psMib)
@@ -144,6 +151,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
             /* AddSceneId */
             eJIP_SetVar(&sJIP_Context, psVar, (void*)&u16Zero, sizeof(u16Zero), E_JIP_FLAG_NONE);
             psVar->prCbVarSet = ColourLampSetAddScene;
+            psVar->prCbVarGroupSet = ColourLampSetAddScene;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
         }
@@ -154,6 +162,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
             /* DelSceneId */
             eJIP_SetVar(&sJIP_Context, psVar, (void*)&u16Zero, sizeof(u16Zero), E_JIP_FLAG_NONE);
             psVar->prCbVarSet = ColourLampSetRemoveScene;
+            psVar->prCbVarGroupSet = ColourLampSetRemoveScene;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
         }
@@ -178,6 +187,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Mode */
             psVar->prCbVarSet = ColourLampSetMode;
+            psVar->prCbVarGroupSet = ColourLampSetMode;
             psVar->prCbVarGet = ColourLampGetMode;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -188,6 +198,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Scene ID */
             psVar->prCbVarSet = ColourLampSetScene;
+            psVar->prCbVarGroupSet = ColourLampSetScene;
             psVar->prCbVarGet = ColourLampGetScene;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -198,6 +209,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* LumTarget */
             psVar->prCbVarSet = ColourLampSetLevel;
+            psVar->prCbVarGroupSet = ColourLampSetLevel;
             psVar->prCbVarGet = ColourLampGetLevel;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -208,6 +220,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* LumCurrent */
             psVar->prCbVarSet = ColourLampSetLevel;
+            psVar->prCbVarGroupSet = ColourLampSetLevel;
             psVar->prCbVarGet = ColourLampGetLevel;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -245,6 +258,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         if (psVar)
         {
             psVar->prCbVarSet = ColourLampSetMode;
+            psVar->prCbVarGroupSet = ColourLampSetMode;
             psVar->prCbVarGet = ColourLampGetMode;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -255,6 +269,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Scene ID */
             psVar->prCbVarSet = ColourLampSetScene;
+            psVar->prCbVarGroupSet = ColourLampSetScene;
             psVar->prCbVarGet = ColourLampGetScene;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -274,6 +289,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Colour Mode */
             psVar->prCbVarSet = ColourLampSetColourMode;
+            psVar->prCbVarGroupSet = ColourLampSetColourMode;
             psVar->prCbVarGet = ColourLampGetColourMode;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -284,6 +300,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* XY Target */
             psVar->prCbVarSet = ColourLampSetXYTarget;
+            psVar->prCbVarGroupSet = ColourLampSetXYTarget;
             psVar->prCbVarGet = ColourLampGetXYTarget;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -294,6 +311,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Hue Target */
             psVar->prCbVarSet = ColourLampSetHueTarget;
+            psVar->prCbVarGroupSet = ColourLampSetHueTarget;
             psVar->prCbVarGet = ColourLampGetHue;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -304,6 +322,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Sat Target */
             psVar->prCbVarSet = ColourLampSetSatTarget;
+            psVar->prCbVarGroupSet = ColourLampSetSatTarget;
             psVar->prCbVarGet = ColourLampGetSat;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -314,6 +333,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Hue Sat Target */
             psVar->prCbVarSet = ColourLampSetHueSatTarget;
+            psVar->prCbVarGroupSet = ColourLampSetHueSatTarget;
             psVar->prCbVarGet = ColourLampGetHueSatTarget;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -324,6 +344,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         {
             /* Colour Temperature Target */
             psVar->prCbVarSet = ColourLampSetColourTempTarget;
+            psVar->prCbVarGroupSet = ColourLampSetColourTempTarget;
             psVar->prCbVarGet = ColourLampGetColourTempTarget;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -335,6 +356,7 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
             /* Colour Temperature Change */
             eJIP_SetVar(&sJIP_Context, psVar, (void*)&u16Zero, sizeof(u16Zero), E_JIP_FLAG_NONE);
             psVar->prCbVarSet = ColourLampSetColourTempChange;
+            psVar->prCbVarGroupSet = ColourLampSetColourTempChange;
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
         }
@@ -378,6 +400,9 @@ teJIP_Status eColourLampInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         }
     }
 
+    /* Level and colour set together are sent in as few commands as possible */
+    psJIPNode->prCbNodeSet = ColourLampSetVars;
+
     if (iHasColour)
     {
         return eJIPCommon_InitialiseDevice(psJIPNode, psZCBNode, "Colour Lamp");
@@ -397,6 +422,7 @@ static teJIP_Status ColourLampSetMode(tsVar *psVar, tsJIPAddress *psMulticastAdd
 {
     uint8_t *pu8Data = (uint8_t*)psVar->pvData;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -419,7 +445,9 @@ static teJIP_Status ColourLampSetMode(tsVar *psVar, tsJIPAddress *psMulticastAdd
     }
     else
     {
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_OnOff(psZCBNode, 0, *pu8Data));
+        sCommand.eCommand = E_ZCB_COMMAND_ONOFF;
+        sCommand.uArgs.sOnOff.u8Mode = *pu8Data;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -461,6 +489,7 @@ static teJIP_Status ColourLampSetLevel(tsVar *psVar, tsJIPAddress *psMulticastAd
     uint8_t *pu8Data = (uint8_t*)psVar->pvData;
     uint16_t u16TransitionTime = 5;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -483,7 +512,11 @@ static teJIP_Status ColourLampSetLevel(tsVar *psVar, tsJIPAddress *psMulticastAd
     }
     else
     {
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_MoveToLevel(psZCBNode, 0, 1, *pu8Data, u16TransitionTime));
+        sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_LEVEL;
+        sCommand.uArgs.sMoveToLevel.u8OnOff = 1;
+        sCommand.uArgs.sMoveToLevel.u8Level = *pu8Data;
+        sCommand.uArgs.sMoveToLevel.u16TransitionTime = u16TransitionTime;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -573,6 +606,7 @@ static teJIP_Status ColourLampSetColourMode(tsVar *psVar, tsJIPAddress *psMultic
 {
     uint8_t *pu8Data = (uint8_t*)psVar->pvData;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -599,7 +633,13 @@ static teJIP_Status ColourLampSetColourMode(tsVar *psVar, tsJIPAddress *psMultic
             }
             else
             {
-                eStatus = eJIP_Status_from_ZCB(eZBZLL_ColourLoopSet(psZCBNode, 0, 0x7, 0 /* Stop */, 0 /* Down */, 5, 0));
+                sCommand.eCommand = E_ZCB_COMMAND_COLOUR_LOOP_SET;
+                sCommand.uArgs.sColourLoopSet.u8UpdateFlags = 0x7;
+                sCommand.uArgs.sColourLoopSet.u8Action = 0; /* Stop */
+                sCommand.uArgs.sColourLoopSet.u8Direction = 0; /* Down */
+                sCommand.uArgs.sColourLoopSet.u16Time = 5;
+                sCommand.uArgs.sColourLoopSet.u16StartHue = 0;
+                eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
             }
             break;
         case (1):
@@ -610,7 +650,13 @@ static teJIP_Status ColourLampSetColourMode(tsVar *psVar, tsJIPAddress *psMultic
             }
             else
             {
-                eStatus = eJIP_Status_from_ZCB(eZBZLL_ColourLoopSet(psZCBNode, 0, 0x7, 1 /* Start */, 0 /* Down */, 5, 0));
+                sCommand.eCommand = E_ZCB_COMMAND_COLOUR_LOOP_SET;
+                sCommand.uArgs.sColourLoopSet.u8UpdateFlags = 0x7;
+                sCommand.uArgs.sColourLoopSet.u8Action = 1; /* Start */
+                sCommand.uArgs.sColourLoopSet.u8Direction = 0; /* Down */
+                sCommand.uArgs.sColourLoopSet.u16Time = 5;
+                sCommand.uArgs.sColourLoopSet.u16StartHue = 0;
+                eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
             }
             break;
         case (2):
@@ -621,7 +667,13 @@ static teJIP_Status ColourLampSetColourMode(tsVar *psVar, tsJIPAddress *psMultic
             }
             else
             {
-                eStatus = eJIP_Status_from_ZCB(eZBZLL_ColourLoopSet(psZCBNode, 0, 0x7, 1 /* Start */, 1 /* Up */, 5, 0));
+                sCommand.eCommand = E_ZCB_COMMAND_COLOUR_LOOP_SET;
+                sCommand.uArgs.sColourLoopSet.u8UpdateFlags = 0x7;
+                sCommand.uArgs.sColourLoopSet.u8Action = 1; /* Start */
+                sCommand.uArgs.sColourLoopSet.u8Direction = 1; /* Up */
+                sCommand.uArgs.sColourLoopSet.u16Time = 5;
+                sCommand.uArgs.sColourLoopSet.u16StartHue = 0;
+                eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
             }
             break;
         default:
@@ -654,6 +706,7 @@ static teJIP_Status ColourLampSetXYTarget(tsVar *psVar, tsJIPAddress *psMulticas
 
     uint16_t u16TransitionTime = 5;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -679,7 +732,11 @@ static teJIP_Status ColourLampSetXYTarget(tsVar *psVar, tsJIPAddress *psMulticas
     }
     else
     {
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_MoveToColour(psZCBNode, 1, u16TargetX, u16TargetY, u16TransitionTime));
+        sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_COLOUR;
+        sCommand.uArgs.sMoveToColour.u16X = u16TargetX;
+        sCommand.uArgs.sMoveToColour.u16Y = u16TargetY;
+        sCommand.uArgs.sMoveToColour.u16TransitionTime = u16TransitionTime;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -760,6 +817,7 @@ static teJIP_Status ColourLampSetHueTarget(tsVar *psVar, tsJIPAddress *psMultica
     uint16_t    u16TargetHue, *pu16TargetHue = (uint16_t *)psVar->pvData;
     uint16_t u16TransitionTime = 5;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -791,7 +849,10 @@ static teJIP_Status ColourLampSetHueTarget(tsVar *psVar, tsJIPAddress *psMultica
     }
     else
     {
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_MoveToHue(psZCBNode, 1, u16TargetHue >> 8, u16TransitionTime));
+        sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_HUE;
+        sCommand.uArgs.sMoveToHue.u8Hue = u16TargetHue >> 8;
+        sCommand.uArgs.sMoveToHue.u16TransitionTime = u16TransitionTime;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -834,6 +895,7 @@ static teJIP_Status ColourLampSetSatTarget(tsVar *psVar, tsJIPAddress *psMultica
     uint8_t    u8TargetSaturation, *pu8TargetSaturation = (uint8_t *)psVar->pvData;
     uint16_t u16TransitionTime = 5;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -859,7 +921,10 @@ static teJIP_Status ColourLampSetSatTarget(tsVar *psVar, tsJIPAddress *psMultica
     }
     else
     {
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_MoveToSaturation(psZCBNode, 1, u8TargetSaturation, u16TransitionTime));
+        sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_SATURATION;
+        sCommand.uArgs.sMoveToSaturation.u8Saturation = u8TargetSaturation;
+        sCommand.uArgs.sMoveToSaturation.u16TransitionTime = u16TransitionTime;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -880,6 +945,7 @@ static teJIP_Status ColourLampSetHueSatTarget(tsVar *psVar, tsJIPAddress *psMult
     uint8_t     u8TargetSaturation;
     uint16_t u16TransitionTime = 5;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -915,7 +981,11 @@ static teJIP_Status ColourLampSetHueSatTarget(tsVar *psVar, tsJIPAddress *psMult
     }
     else
     {
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_MoveToHueSaturation(psZCBNode, 1, u16TargetHue >> 8, u8TargetSaturation, u16TransitionTime));
+        sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_HUE_SATURATION;
+        sCommand.uArgs.sMoveToHueSaturation.u8Hue = u16TargetHue >> 8;
+        sCommand.uArgs.sMoveToHueSaturation.u8Saturation = u8TargetSaturation;
+        sCommand.uArgs.sMoveToHueSaturation.u16TransitionTime = u16TransitionTime;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -973,6 +1043,7 @@ static teJIP_Status ColourLampSetColourTempTarget(tsVar *psVar, tsJIPAddress *ps
     uint16_t u16ColourTemperature;
     uint16_t u16TransitionTime = 5;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -996,7 +1067,10 @@ static teJIP_Status ColourLampSetColourTempTarget(tsVar *psVar, tsJIPAddress *ps
     }
     else
     {
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_MoveToColourTemperature(psZCBNode, 1, u16ColourTemperature, u16TransitionTime));
+        sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_COLOUR_TEMPERATURE;
+        sCommand.uArgs.sMoveToColourTemperature.u16ColourTemperature = u16ColourTemperature;
+        sCommand.uArgs.sMoveToColourTemperature.u16TransitionTime = u16TransitionTime;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -1018,6 +1092,7 @@ static teJIP_Status ColourLampSetColourTempChange(tsVar *psVar, tsJIPAddress *ps
     uint16_t u16ColourTemperatureMax = 0;
     
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -1054,7 +1129,12 @@ static teJIP_Status ColourLampSetColourTempChange(tsVar *psVar, tsJIPAddress *ps
     else
     {
         DBG_PrintNode(psZCBNode);
-        eStatus = eJIP_Status_from_ZCB(eZBZLL_MoveColourTemperature(psZCBNode, 1, u8Mode, u16Rate, u16ColourTemperatureMin, u16ColourTemperatureMax));
+        sCommand.eCommand = E_ZCB_COMMAND_MOVE_COLOUR_TEMPERATURE;
+        sCommand.uArgs.sMoveColourTemperature.u8Mode = u8Mode;
+        sCommand.uArgs.sMoveColourTemperature.u16Rate = u16Rate;
+        sCommand.uArgs.sMoveColourTemperature.u16ColourTemperatureMin = u16ColourTemperatureMin;
+        sCommand.uArgs.sMoveColourTemperature.u16ColourTemperatureMax = u16ColourTemperatureMax;
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     }
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
@@ -1570,6 +1650,178 @@ static teJIP_Status ColourLampGetSceneIDs(tsVar *psVar)
 }
 
 
+/* Variables of a lamp set together by one request. Mode on or off and a level
+ * are sent as one move to level with on/off, or off and then the level for
+ * when the lamp next comes on. A hue and a saturation are sent as one move to
+ * hue and saturation. Of several colour targets only the last is sent, as each
+ * replaces those before it. The colour is sent before the lamp is turned on,
+ * and after it is turned off, so that it never shows the old colour at the new
+ * level. Requests that set any other variable are handed to the setter of each
+ * variable in turn. Every command has an absolute target, so a retransmitted
+ * request is simply sent again. */
+static teJIP_Status ColourLampSetVars(tsNode *psJIPNode, tsVar **apsVars, uint32_t u32NumVars)
+{
+    tsZcbCommand asCommands[3];
+    tsZcbCommand sColour;
+    int iNumCommands = 0;
+    int iMode = -1, iLevel = -1;
+    int iHue = -1, iSaturation = -1;
+    uint16_t u16TransitionTime = 5;
+    teJIP_Status eStatus = E_JIP_OK;
+    uint32_t i;
+    
+    sColour.eCommand = E_ZCB_COMMAND_NUM;
+    
+    for (i = 0; i < u32NumVars; i++)
+    {
+        tsVar *psVar = apsVars[i];
+        uint32_t u32MibId = psVar->psOwnerMib->u32MibId;
+        
+        if ((u32MibId == 0xfffffe04) && (psVar->u8Index == 0) && (*psVar->pu8Data <= 1))
+        {
+            /* Mode, on or off */
+            iMode = *psVar->pu8Data;
+        }
+        else if ((u32MibId == 0xfffffe04) && ((psVar->u8Index == 2) || (psVar->u8Index == 3)))
+        {
+            /* LumTarget or LumCurrent */
+            iLevel = *psVar->pu8Data;
+        }
+        else if ((u32MibId == 0xfffffe0c) && (psVar->u8Index == 2))
+        {
+            /* XY Target */
+            sColour.eCommand = E_ZCB_COMMAND_MOVE_TO_COLOUR;
+            sColour.uArgs.sMoveToColour.u16X = ((*psVar->pu32Data) >> 16) & 0xFFFF;
+            sColour.uArgs.sMoveToColour.u16Y = ((*psVar->pu32Data) >>  0) & 0xFFFF;
+            sColour.uArgs.sMoveToColour.u16TransitionTime = u16TransitionTime;
+            iHue = iSaturation = -1;
+        }
+        else if ((u32MibId == 0xfffffe0c) && (psVar->u8Index == 6))
+        {
+            /* Hue Target */
+            if (*psVar->pu16Data >= 3600)
+            {
+                return E_JIP_ERROR_BAD_VALUE;
+            }
+            sColour.eCommand = E_ZCB_COMMAND_NUM;
+            iHue = (((int)*psVar->pu16Data * 0xFEFF) / 3600) >> 8;
+        }
+        else if ((u32MibId == 0xfffffe0c) && (psVar->u8Index == 7))
+        {
+            /* Sat Target */
+            sColour.eCommand = E_ZCB_COMMAND_NUM;
+            iSaturation = (*psVar->pu8Data * 254) / 255;
+        }
+        else if ((u32MibId == 0xfffffe0c) && (psVar->u8Index == 10))
+        {
+            /* Hue Sat Target */
+            uint16_t u16TargetHue = ((*psVar->pu32Data) >> 8) & 0xFFFF;
+            
+            if (u16TargetHue >= 3600)
+            {
+                return E_JIP_ERROR_BAD_VALUE;
+            }
+            sColour.eCommand = E_ZCB_COMMAND_NUM;
+            iHue        = (((int)u16TargetHue * 0xFEFF) / 3600) >> 8;
+            iSaturation = ((((*psVar->pu32Data) >> 0) & 0xFF) * 254) / 255;
+        }
+        else if ((u32MibId == 0xfffffe0c) && (psVar->u8Index == 12))
+        {
+            /* Colour Temperature Target */
+            sColour.eCommand = E_ZCB_COMMAND_MOVE_TO_COLOUR_TEMPERATURE;
+            sColour.uArgs.sMoveToColourTemperature.u16ColourTemperature = *psVar->pu16Data;
+            sColour.uArgs.sMoveToColourTemperature.u16TransitionTime = u16TransitionTime;
+            iHue = iSaturation = -1;
+        }
+        else
+        {
+            DBG_vPrintf(DBG_COLOURLAMP, "Set MIB 0x%08x variable %d in turn\n", u32MibId, psVar->u8Index);
+            
+            for (i = 0; (i < u32NumVars) && (eStatus == E_JIP_OK); i++)
+            {
+                if (apsVars[i]->prCbVarSet)
+                {
+                    eStatus = apsVars[i]->prCbVarSet(apsVars[i], NULL);
+                }
+            }
+            return eStatus;
+        }
+    }
+    
+    if ((iHue >= 0) && (iSaturation >= 0))
+    {
+        sColour.eCommand = E_ZCB_COMMAND_MOVE_TO_HUE_SATURATION;
+        sColour.uArgs.sMoveToHueSaturation.u8Hue = iHue;
+        sColour.uArgs.sMoveToHueSaturation.u8Saturation = iSaturation;
+        sColour.uArgs.sMoveToHueSaturation.u16TransitionTime = u16TransitionTime;
+    }
+    else if (iHue >= 0)
+    {
+        sColour.eCommand = E_ZCB_COMMAND_MOVE_TO_HUE;
+        sColour.uArgs.sMoveToHue.u8Hue = iHue;
+        sColour.uArgs.sMoveToHue.u16TransitionTime = u16TransitionTime;
+    }
+    else if (iSaturation >= 0)
+    {
+        sColour.eCommand = E_ZCB_COMMAND_MOVE_TO_SATURATION;
+        sColour.uArgs.sMoveToSaturation.u8Saturation = iSaturation;
+        sColour.uArgs.sMoveToSaturation.u16TransitionTime = u16TransitionTime;
+    }
+    
+    if ((sColour.eCommand != E_ZCB_COMMAND_NUM) && (iMode != 0))
+    {
+        asCommands[iNumCommands++] = sColour;
+    }
+    
+    if ((iMode == 0) || ((iMode == 1) && (iLevel < 0)))
+    {
+        asCommands[iNumCommands].eCommand = E_ZCB_COMMAND_ONOFF;
+        asCommands[iNumCommands].uArgs.sOnOff.u8Mode = iMode;
+        iNumCommands++;
+    }
+    
+    if (iLevel >= 0)
+    {
+        /* With on/off, unless the lamp is being turned off */
+        asCommands[iNumCommands].eCommand = E_ZCB_COMMAND_MOVE_TO_LEVEL;
+        asCommands[iNumCommands].uArgs.sMoveToLevel.u8OnOff = (iMode != 0);
+        asCommands[iNumCommands].uArgs.sMoveToLevel.u8Level = iLevel;
+        asCommands[iNumCommands].uArgs.sMoveToLevel.u16TransitionTime = u16TransitionTime;
+        iNumCommands++;
+    }
+    
+    if ((sColour.eCommand != E_ZCB_COMMAND_NUM) && (iMode == 0))
+    {
+        asCommands[iNumCommands++] = sColour;
+    }
+    
+    DBG_vPrintf(DBG_COLOURLAMP, "Set %d variables with %d commands\n", u32NumVars, iNumCommands);
+    
+    return ColourLampSendCommands(psJIPNode, asCommands, iNumCommands);
+}
+
+
+static teJIP_Status ColourLampSendCommands(tsNode *psJIPNode, tsZcbCommand *asCommands, int iNumCommands)
+{
+    teJIP_Status eStatus = E_JIP_OK;
+    int i;
+    
+    for (i = 0; (i < iNumCommands) && (eStatus == E_JIP_OK); i++)
+    {
+        /* Sending a command directly unlocks the node, so find it again for each */
+        tsZCB_Node *psZCBNode = psBR_FindZigbeeNode(psJIPNode);
+        if (!psZCBNode)
+        {
+            daemon_log(LOG_ERR, "Could not find Zigbee node");
+            return E_JIP_ERROR_FAILED;
+        }
+        
+        eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &asCommands[i]));
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    return eStatus;
+}
+
 /****************************************************************************/
 /***        END OF FILE                                                   ***/
 /****************************************************************************/
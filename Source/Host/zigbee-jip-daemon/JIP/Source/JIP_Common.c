@@ -166,6 +166,12 @@ teJIP_Status eJIPCommon_InitialiseDevice(tsNode *psJIPNode, tsZCB_Node *psZCBNod
 
 int iJIPCommon_DuplicateRequest(tsVar *psVar, tsJIPAddress *psMulticastAddress)
 {
+    if (psMulticastAddress)
+    {
+        /* Multicasts are handed to each member of the group by libJIP, which calls group setters once per request */
+        return 0;
+    }
+    
     if (sLastAccessedVar.pvData)
     {
         struct timeval sNow;
@@ -186,23 +192,10 @@ int iJIPCommon_DuplicateRequest(tsVar *psVar, tsJIPAddress *psMulticastAddress)
             DBG_vPrintf(DBG_COMMON, "Data differs\n");
             return 0;
         }
-        if (psMulticastAddress)
+        if (memcmp(&sLastAccessedAddress, &psVar->psOwnerMib->psOwnerNode->sNode_Address.sin6_addr, sizeof(struct in6_addr)))
         {
-            /* Request is multicast */
-            if (memcmp(&sLastAccessedAddress, &psMulticastAddress->sin6_addr, sizeof(struct in6_addr)))
-            {
-                DBG_vPrintf(DBG_COMMON, "IPv6 address differs\n");
-                return 0;
-            }
-        }
-        else
-        {
-            /* Request is unicast */
-            if (memcmp(&sLastAccessedAddress, &psVar->psOwnerMib->psOwnerNode->sNode_Address.sin6_addr, sizeof(struct in6_addr)))
-            {
-                DBG_vPrintf(DBG_COMMON, "IPv6 address differs\n");
-                return 0;
-            }
+            DBG_vPrintf(DBG_COMMON, "IPv6 address differs\n");
+            return 0;
         }
         if (u64TimevalDiff(&sLastAccessTime, &sNow) > DUPLICATE_IGNORE_MSEC)
         {
@@ -222,23 +215,20 @@ int iJIPCommon_DuplicateRequest(tsVar *psVar, tsJIPAddress *psMulticastAddress)
 
 void vJIPCommon_DuplicateRequestUpdate(tsVar *psVar, tsJIPAddress *psMulticastAddress, teJIP_Status eStatus)
 {
+    if (psMulticastAddress)
+    {
+        /* Only unicast requests are retried by clients */
+        return;
+    }
+    
     /* Set up saved last request so that we can detect dumplicates */
     sLastAccessedMib.u32MibId = psVar->psOwnerMib->u32MibId;
     sLastAccessedVar.u8Index  = psVar->u8Index;
     gettimeofday(&sLastAccessTime, NULL);
     
     eLastStatus = eStatus;
-
-    if (psMulticastAddress)
-    {
-        /* Request is multicast */
-        sLastAccessedAddress = psMulticastAddress->sin6_addr;
-    }
-    else
-    {
-        /* Request is unicast */
-        sLastAccessedAddress = psVar->psOwnerMib->psOwnerNode->sNode_Address.sin6_addr;
-    }
+    
+    sLastAccessedAddress = psVar->psOwnerMib->psOwnerNode->sNode_Address.sin6_addr;
     
     eJIP_SetVarValue(&sLastAccessedVar, psVar->pvData, psVar->u8Size);
 }
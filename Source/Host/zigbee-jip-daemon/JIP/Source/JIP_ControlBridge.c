@@ -61,6 +61,10 @@
 
 #define DBG_CONTROLBRIDGE 0
 
+/** Size of a row of the latency tables. Rows are a key, the stage, then
+ *  the count, mean, 50th, 90th and 99th percentiles and maximum in us */
+#define CONTROLBRIDGE_LATENCY_ROW_SIZE  (sizeof(uint64_t) + sizeof(uint8_t) + (6 * sizeof(uint32_t)))
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -74,6 +78,9 @@ static teJIP_Status ControlBridge_FactoryResetSet(tsVar *psVar, tsJIPAddress *ps
 static teJIP_Status ControlBridge_PermitJoiningSet(tsVar *psVar, tsJIPAddress *psMulticastAddress);
 static teJIP_Status ControlBridge_PermitJoiningGet(tsVar *psVar);
 static teJIP_Status ControlBridge_TouchLinkSet(tsVar *psVar, tsJIPAddress *psMulticastAddress);
+static teJIP_Status ControlBridge_CommandLatencyGet(tsVar *psVar);
+static teJIP_Status ControlBridge_NodeLatencyGet(tsVar *psVar);
+static teJIP_Status ControlBridge_SelectShard(tsVar *psVar);
 
 /****************************************************************************/
 /***        Exported Variables                                            ***/
@@ -162,6 +169,27 @@ teJIP_Status eControlBridgeInitalise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
         }
     }
     
+    /* Request latencies, rebuilt from the server's histograms when read */
+    psMib = psJIP_LookupMibId(psJIPNode, NULL, 0xfffffd02);
+    if (psMib)
+    {
+        psVar = psJIP_LookupVarIndex(psMib, 0);
+        if (psVar)
+        {
+            psVar->prCbVarGet = ControlBridge_CommandLatencyGet;
+            // Enable variable
+            psVar->eEnable = E_JIP_VAR_ENABLED;
+        }
+        
+        psVar = psJIP_LookupVarIndex(psMib, 1);
+        if (psVar)
+        {
+            psVar->prCbVarGet = ControlBridge_NodeLatencyGet;
+            // Enable variable
+            psVar->eEnable = E_JIP_VAR_ENABLED;
+        }
+    }
+    
     return E_JIP_OK;
 }
 
@@ -177,6 +205,11 @@ static teJIP_Status ControlBridge_FactoryResetSet(tsVar *psVar, tsJIPAddress *ps
 
     DBG_vPrintf(DBG_CONTROLBRIDGE, "Factory reset (%d)\n", *pu8Data);
     
+    if (ControlBridge_SelectShard(psVar) != E_JIP_OK)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
     eZCB_FactoryNew();
     
     /* Set back to 0 */
@@ -193,6 +226,11 @@ static teJIP_Status ControlBridge_PermitJoiningSet(tsVar *psVar, tsJIPAddress *p
 
     DBG_vPrintf(DBG_CONTROLBRIDGE, "Permit joining (%d)\n", *pu8Data);
     
+    if (ControlBridge_SelectShard(psVar) != E_JIP_OK)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
     if (eZCB_SetPermitJoining(*pu8Data) != E_ZCB_OK)
     {
         eStatus = E_JIP_ERROR_FAILED;
@@ -207,6 +245,11 @@ static teJIP_Status ControlBridge_PermitJoiningGet(tsVar *psVar)
     teJIP_Status eStatus = E_JIP_OK;
     uint8_t *pu8Data = (uint8_t*)psVar->pvData;
 
+    if (ControlBridge_SelectShard(psVar) != E_JIP_OK)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+
     if (eZCB_GetPermitJoining(pu8Data) != E_ZCB_OK)
     {
         eStatus = E_JIP_ERROR_FAILED;
@@ -224,6 +267,11 @@ static teJIP_Status ControlBridge_TouchLinkSet(tsVar *psVar, tsJIPAddress *psMul
 
     DBG_vPrintf(DBG_CONTROLBRIDGE, "Initiate touchlink (%d)\n", *pu8Data);
     
+    if (ControlBridge_SelectShard(psVar) != E_JIP_OK)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
     eZCB_ZLL_Touchlink();
     
     /* Set back to 0 */
@@ -233,6 +281,115 @@ static teJIP_Status ControlBridge_TouchLinkSet(tsVar *psVar, tsJIPAddress *psMul
 }
 
 
+
+/** Store a row of a latency table. Rows with no requests are removed.
+ *  \param psVar            Table variable
+ *  \param u32Index         Row index
+ *  \param u64Key           Command or node interface identifier that the row is for
+ *  \param u8Stage          Stage of the requests
+ *  \param psSummary        Latencies of the requests
+ */
+static void ControlBridge_LatencyRowUpdate(tsVar *psVar, uint32_t u32Index, uint64_t u64Key, uint8_t u8Stage,
+                                           tsUtilsHistogramSummary *psSummary)
+{
+    uint8_t au8Row[CONTROLBRIDGE_LATENCY_ROW_SIZE];
+    uint32_t au32Values[6];
+    uint8_t *pu8Row = au8Row;
+    int i;
+    
+    if (psSummary->u32Count == 0)
+    {
+        eJIP_Table_UpdateRow(psVar, u32Index, NULL, 0);
+        return;
+    }
+    
+    au32Values[0] = psSummary->u32Count;
+    au32Values[1] = psSummary->u32Mean;
+    au32Values[2] = psSummary->u32P50;
+    au32Values[3] = psSummary->u32P90;
+    au32Values[4] = psSummary->u32P99;
+    au32Values[5] = psSummary->u32Max;
+    
+    u64Key = htobe64(u64Key);
+    memcpy(pu8Row, &u64Key, sizeof(uint64_t));
+    pu8Row += sizeof(uint64_t);
+    *pu8Row++ = u8Stage;
+    for (i = 0; i < 6; i++)
+    {
+        uint32_t u32Value = htonl(au32Values[i]);
+        memcpy(pu8Row, &u32Value, sizeof(uint32_t));
+        pu8Row += sizeof(uint32_t);
+    }
+    
+    eJIP_Table_UpdateRow(psVar, u32Index, au8Row, sizeof(au8Row));
+}
+
+
+static teJIP_Status ControlBridge_CommandLatencyGet(tsVar *psVar)
+{
+    tsUtilsHistogramSummary sSummary;
+    uint32_t u32Index = 0;
+    uint8_t u8Command;
+    int iStage;
+    
+    /* Commands are numbered from 0x10, the server rejects the first one past the end */
+    for (u8Command = 0x10; ; u8Command++)
+    {
+        for (iStage = 0; iStage < E_UTILS_LATENCY_NUM_STAGES; iStage++, u32Index++)
+        {
+            if (eJIPserver_LatencyCommand(&sJIP_Context, u8Command, iStage, &sSummary) != E_JIP_OK)
+            {
+                return E_JIP_OK;
+            }
+            ControlBridge_LatencyRowUpdate(psVar, u32Index, u8Command, iStage, &sSummary);
+        }
+    }
+}
+
+
+static teJIP_Status ControlBridge_NodeLatencyGet(tsVar *psVar)
+{
+    tsUtilsHistogramSummary sSummary;
+    struct in6_addr sAddress;
+    uint32_t u32Node;
+    uint32_t u32Index = 0;
+    uint64_t u64InterfaceId;
+    int iStage;
+    
+    for (u32Node = 0; ; u32Node++)
+    {
+        for (iStage = 0; iStage < E_UTILS_LATENCY_NUM_STAGES; iStage++, u32Index++)
+        {
+            if (eJIPserver_LatencyNode(&sJIP_Context, u32Node, &sAddress, iStage, &sSummary) != E_JIP_OK)
+            {
+                return E_JIP_OK;
+            }
+            
+            /* Nodes share the prefix, so the interface identifier is enough to tell them apart */
+            memcpy(&u64InterfaceId, &sAddress.s6_addr[8], sizeof(uint64_t));
+            ControlBridge_LatencyRowUpdate(psVar, u32Index, be64toh(u64InterfaceId), iStage, &sSummary);
+        }
+    }
+}
+
+
+/** Select the shard of the control bridge that owns this variable, so that
+ *  the request goes out through that bridge rather than whichever was used last.
+ */
+static teJIP_Status ControlBridge_SelectShard(tsVar *psVar)
+{
+    tsZCB_Node *psZCBNode = psBR_FindZigbeeNode(psVar->psOwnerMib->psOwnerNode);
+    if (!psZCBNode)
+    {
+        daemon_log(LOG_ERR, "Could not find control bridge node");
+        return E_JIP_ERROR_FAILED;
+    }
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    eUtils_LockUnlock(&psZCBNode->sLock);
+    return E_JIP_OK;
+}
+
+
 /****************************************************************************/
 /***        END OF FILE                                                   ***/
 /****************************************************************************/
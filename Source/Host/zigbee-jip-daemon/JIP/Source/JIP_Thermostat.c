@@ -55,6 +55,7 @@
 #include "JIP_Common.h"
 #include "JIP_BorderRouter.h"
 #include "ZigbeeConstant.h"
+#include "ZigbeeCommandQueue.h"
 //#include "ZigbeeThermostat.h"
 #include "Utils.h"
 
@@ -369,6 +370,7 @@ static teJIP_Status ThermostatSetMode(tsVar *psVar, tsJIPAddress *psMulticastAdd
 {
     uint8_t *pu8Data = (uint8_t*)psVar->pvData;
     teJIP_Status eStatus = E_JIP_OK;
+    tsZcbCommand sCommand;
     
     if (iJIPCommon_DuplicateRequest(psVar, psMulticastAddress))
     {
@@ -385,8 +387,14 @@ static teJIP_Status ThermostatSetMode(tsVar *psVar, tsJIPAddress *psMulticastAdd
 
     DBG_vPrintf(DBG_THERMOSTAT, "Set Mode: %d\n", *pu8Data);
     
-    eStatus = eJIP_Status_from_ZCB(eZCB_WriteAttributeRequest(psZCBNode, E_ZB_CLUSTERID_THERMOSTAT, 0, 0, 0,
-                                      E_ZB_ATTRIBUTEID_TSTAT_SYSTEMMODE, E_ZCL_ENUM8, psVar->pvData));
+    /* Queued, so a thermostat that sleeps is sent the mode when it is next heard from */
+    memset(&sCommand, 0, sizeof(sCommand));
+    sCommand.eCommand                               = E_ZCB_COMMAND_WRITE_ATTRIBUTE;
+    sCommand.uArgs.sWriteAttribute.u16ClusterID     = E_ZB_CLUSTERID_THERMOSTAT;
+    sCommand.uArgs.sWriteAttribute.u16AttributeID   = E_ZB_ATTRIBUTEID_TSTAT_SYSTEMMODE;
+    sCommand.uArgs.sWriteAttribute.eType            = E_ZCL_ENUM8;
+    sCommand.uArgs.sWriteAttribute.au8Data[0]       = *pu8Data;
+    eStatus = eJIP_Status_from_ZCB(eZCB_CommandQueue(psZCBNode, &sCommand));
     
     if (eStatus != E_JIP_ERROR_TIMEOUT)
     {
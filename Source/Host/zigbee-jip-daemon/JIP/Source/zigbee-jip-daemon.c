@@ -48,6 +48,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
 
 #include <libdaemon/daemon.h>
 
@@ -55,8 +56,11 @@
 #include "TunDevice.h"
 #include "ZigbeeControlBridge.h"
 #include "ZigbeeConstant.h"
+#include "ZigbeeInterview.h"
+#include "ZigbeeCommandQueue.h"
 
 #include "CommissioningServer.h"
+#include "DumpServer.h"
 
 #include "JIP_Common.h"
 
@@ -73,6 +77,9 @@
 
 #define DBG_MAIN 0
 
+/** Interval between checks of device communications (ms) */
+#define DEVICE_COMMS_CHECK_MS 1000
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -83,8 +90,22 @@
 
 static void vQuitSignalHandler (int sig);
 
+static void vTraceSignalHandler (int sig);
+
+static void vTraceDump(void);
+
+static void vLatencyDump(FILE *psStream);
+
+static void vTraceWrite(FILE *psStream);
+
 static void print_usage_exit(char *argv[]);
 
+static void vInterviewNode(uint16_t u16ShortAddress);
+
+static void vJoinNode(uint16_t u16ShortAddress);
+
+static uint64_t u64TimeNow(void);
+
 /****************************************************************************/
 /***        Exported Variables                                            ***/
 /****************************************************************************/
@@ -133,7 +154,40 @@ static uint32_t         u32FactoryNew       = 0;
 /** Main loop running flag */
 volatile sig_atomic_t   bRunning            = 1;
 
-static tsUtilsThread    sCommissioningThread;
+/** Commissioning server of each control bridge */
+static tsUtilsThread    asCommissioningThreads[ZCB_MAX_SHARDS];
+
+/** Path of the Unix socket serving request latencies, or NULL for none */
+static char            *pcLatencySocket     = NULL;
+
+/** Set to turn off request latency tracing */
+static int              iDisableLatency     = 0;
+
+static tsUtilsThread    sLatencyThread;
+
+static tsDumpServer     sLatencyServer      = { "Latency", NULL, vLatencyDump };
+
+/** Path of the Unix socket serving the serial trace, or NULL for none */
+static char            *pcTraceSocket       = NULL;
+
+/** File the serial trace is written to on SIGUSR2 */
+static char            *pcTraceFile         = "/tmp/zigbee-jip-daemon.sltrace";
+
+/** Set by SIGUSR2 to have the main loop write the serial trace */
+static volatile sig_atomic_t bTraceDump     = 0;
+
+static tsUtilsThread    sTraceThread;
+
+/** File the lock contention report is written to on SIGUSR1, or NULL to not profile locks */
+static char            *pcLockProfileFile   = NULL;
+
+static tsDumpServer     sTraceServer        = { "Serial trace", NULL, vTraceWrite };
+
+/** File to capture serial frames to, or NULL for none */
+static char            *pcCaptureFile       = NULL;
+
+/** Time of the next check of device communications */
+static uint64_t         u64CommsCheckTime   = 0;
 
 
 
@@ -145,7 +199,10 @@ static tsUtilsThread    sCommissioningThread;
 int main(int argc, char *argv[])
 {
     pid_t pid;
-    char *cpSerialDevice = NULL;
+    int iNumSerialDevices = 0;
+    int iNumChannels = 0;
+    int iNumPanIDs = 0;
+    int iShard = 0;
     const char *pcBorderRouterAddress = "fd04:bd3:80e8:10::1";
     char *pcPDMStore = "disabled";
     uint8_t u8EnableWhiteListing = 0;
@@ -168,6 +225,7 @@ int main(int argc, char *argv[])
             {"baud",                    required_argument,  NULL, 'B'},
             {"interface",               required_argument,  NULL, 'I'},
             {"pdmstore",                required_argument,  NULL, 'P'},
+            {"pdmdebounce",             required_argument,  NULL, 'D'},
             
             /* Zigbee network options */
             {"mode",                    required_argument,  NULL, 'm'},
@@ -175,17 +233,40 @@ int main(int argc, char *argv[])
             {"channel",                 required_argument,  NULL, 'c'},
             {"pan",                     required_argument,  NULL, 'p'},
             {"borderrouter",            required_argument,  NULL, '6'},
+            {"trapinterval",            required_argument,  NULL, 'T'},
             {"whitelisting",            no_argument,        NULL, 'w'},
+            {"interviews",              required_argument,  NULL, 'N'},
+            {"interviewinterval",       required_argument,  NULL, 'i'},
+            {"latencysocket",           required_argument,  NULL, 'L'},
+            {"tracefile",               required_argument,  NULL, 't'},
+            {"tracesocket",             required_argument,  NULL, 'S'},
+            {"capture",                 required_argument,  NULL, 'C'},
+            {"lockprofile",             required_argument,  NULL, 'K'},
+            
+            /* Argument to turn off request latency tracing */
+            {"disable-latency",         no_argument,        &iDisableLatency, 1},
             
             /* Argument to turn APS acks back on */
             {"enable-apsack",           no_argument,        &bZCB_EnableAPSAck, 1},
             
+            /* Argument to interview every device again after a restart */
+            {"disable-interviewcache",  no_argument,        &bPDM_InterviewCache, 0},
+            
+            /* Argument to send each command to a node before acknowledging the request */
+            {"disable-commandqueue",    no_argument,        &bZCB_CommandQueue, 0},
+            
+            /* Argument to send commands to sleeping devices as they are requested, rather than when next heard from */
+            {"disable-mailbox",         no_argument,        &bZCB_CommandMailbox, 0},
+            
+            /* Argument to send every request the same way, rather than by how reliably each device responds */
+            {"disable-adaptive-delivery", no_argument,      &bZCB_AdaptiveDelivery, 0},
+            
             { NULL, 0, NULL, 0}
         };
         signed char opt;
         int option_index;
 
-        while ((opt = getopt_long(argc, argv, "s:hfv:B:I:P:m:nc:p:6:", long_options, &option_index)) != -1) 
+        while ((opt = getopt_long(argc, argv, "s:hfv:B:I:P:D:m:nc:p:6:T:N:i:L:t:S:C:K:", long_options, &option_index)) != -1) 
         {
             switch (opt) 
             {
@@ -216,7 +297,12 @@ int main(int argc, char *argv[])
                     break;
                 }
                 case 's':
-                    cpSerialDevice = optarg;
+                    if (iNumSerialDevices >= ZCB_MAX_SHARDS)
+                    {
+                        printf("No more than %d control bridges are supported\n", ZCB_MAX_SHARDS);
+                        print_usage_exit(argv);
+                    }
+                    asZCB_Shards[iNumSerialDevices++].pcSerialDevice = optarg;
                     break;
                     
                 case 'm':
@@ -259,7 +345,17 @@ int main(int argc, char *argv[])
                         printf("Channel '%s' contains invalid characters\n", optarg);
                         print_usage_exit(argv);
                     }
-                    eChannel = u32Channel;
+                    if (iNumChannels >= ZCB_MAX_SHARDS)
+                    {
+                        printf("No more than %d channels may be given\n", ZCB_MAX_SHARDS);
+                        print_usage_exit(argv);
+                    }
+                    /* Channels are given to the control bridges in the order of their serial devices */
+                    if (iNumChannels == 0)
+                    {
+                        eChannel = u32Channel;
+                    }
+                    asZCB_Shards[iNumChannels++].eChannel = u32Channel;
                     break;
                 }
                 case 'p':
@@ -277,6 +373,12 @@ int main(int argc, char *argv[])
                         printf("PAN ID '%s' contains invalid characters\n", optarg);
                         print_usage_exit(argv);
                     }
+                    if (iNumPanIDs >= ZCB_MAX_SHARDS)
+                    {
+                        printf("No more than %d PAN IDs may be given\n", ZCB_MAX_SHARDS);
+                        print_usage_exit(argv);
+                    }
+                    asZCB_Shards[iNumPanIDs++].u64PanID = u64PanID;
                     break;
                 }
                 case '6':
@@ -307,9 +409,41 @@ int main(int argc, char *argv[])
                 case 'P':
                     pcPDMStore = optarg;
                     break;
+                case 'D':
+                    u32PDM_DebounceMs = strtoul(optarg, NULL, 10);
+                    break;
+                case 'T':
+                    u32BR_TrapMinIntervalMs = strtoul(optarg, NULL, 10);
+                    break;
                 case 'w':
                     u8EnableWhiteListing = 1;
                     break;
+                case 'N':
+                    iZCB_InterviewMaxActive = atoi(optarg);
+                    if (iZCB_InterviewMaxActive < 1)
+                    {
+                        printf("Number of interviews must be at least 1\n");
+                        print_usage_exit(argv);
+                    }
+                    break;
+                case 'i':
+                    u32ZCB_InterviewIntervalMs = strtoul(optarg, NULL, 10);
+                    break;
+                case 'L':
+                    pcLatencySocket = optarg;
+                    break;
+                case 't':
+                    pcTraceFile = optarg;
+                    break;
+                case 'S':
+                    pcTraceSocket = optarg;
+                    break;
+                case 'C':
+                    pcCaptureFile = optarg;
+                    break;
+                case 'K':
+                    pcLockProfileFile = optarg;
+                    break;
                     
                 case 0:
                     break;
@@ -322,10 +456,13 @@ int main(int argc, char *argv[])
     /* Log everything into syslog */
     daemon_log_ident = daemon_ident_from_argv0(argv[0]);
     
-    if (!cpSerialDevice)
+    vUtils_LatencyEnable(!iDisableLatency);
+    
+    if (iNumSerialDevices == 0)
     {
         print_usage_exit(argv);
     }
+    iZCB_NumShards = iNumSerialDevices;
     
     if (daemonize)
     {
@@ -404,11 +541,27 @@ int main(int argc, char *argv[])
     /* Install signal handlers */
     signal(SIGTERM, vQuitSignalHandler);
     signal(SIGINT, vQuitSignalHandler);
+    signal(SIGUSR2, vTraceSignalHandler);
+    
+    /* Start capturing before the serial link is opened, so the capture has every frame */
+    if (pcCaptureFile && (eZCB_CaptureStart(pcCaptureFile) != E_ZCB_OK))
+    {
+        daemon_log(LOG_ERR, "Failed to open capture file %s (%s)", pcCaptureFile, strerror(errno));
+        goto finish;
+    }
     
-    if ((eZCB_Init(cpSerialDevice, u32BaudRate, pcPDMStore) != E_ZCB_OK) || 
+    /* Profile locks from the start, so the report covers the threads started next */
+    if (pcLockProfileFile && (eUtils_LockProfileStart(pcLockProfileFile) != E_UTILS_OK))
+    {
+        daemon_log(LOG_ERR, "Failed to start lock profiling");
+        goto finish;
+    }
+    
+    if ((eZCB_Init(u32BaudRate, pcPDMStore) != E_ZCB_OK) || 
         (eTD_Init() != E_TD_OK) ||
         (eJIPCommon_Initialise() != E_JIP_OK) ||
-        (eBR_Init(pcBorderRouterAddress) != E_BR_OK)        
+        (eBR_Init(pcBorderRouterAddress) != E_BR_OK) ||
+        (eZCB_CommandQueueStart() != E_ZCB_OK)
     )
     {
         goto finish;
@@ -416,7 +569,8 @@ int main(int argc, char *argv[])
     
     while (bRunning)
     {
-        /* Keep attempting to connect to the control bridge */
+        /* Keep attempting to connect to each control bridge in turn */
+        vZCB_ShardSelect(iShard);
         if (eZCB_EstablishComms() == E_ZCB_OK)
         {
             // Wait for initial messages from control bridge
@@ -436,12 +590,6 @@ int main(int argc, char *argv[])
                 }
             }
             
-            /* Start commissioning server thread */
-            if (eUtils_ThreadStart(pvCommissioningServer, &sCommissioningThread, E_THREAD_JOINABLE) != E_UTILS_OK)
-            {
-                daemon_log(LOG_ERR, "Failed to start commissioning server thread");
-            }
-            
             if (u8EnableWhiteListing)
             {
                 daemon_log(LOG_INFO, "Enabling whitelisting");
@@ -451,6 +599,45 @@ int main(int argc, char *argv[])
                     daemon_log(LOG_ERR, "Failed to enable whitelisting");
                 }
             }
+            
+            if (++iShard < iZCB_NumShards)
+            {
+                continue;
+            }
+            vZCB_ShardSelect(0);
+            
+            /* Start a commissioning server thread for each control bridge */
+            for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+            {
+                asCommissioningThreads[iShard].pvThreadData = &asZCB_Shards[iShard];
+                if (eUtils_ThreadStart(pvCommissioningServer, &asCommissioningThreads[iShard], E_THREAD_JOINABLE) != E_UTILS_OK)
+                {
+                    daemon_log(LOG_ERR, "Failed to start commissioning server thread");
+                }
+            }
+            
+            if (pcLatencySocket)
+            {
+                /* Start request latency server thread */
+                sLatencyServer.pcPath = pcLatencySocket;
+                sLatencyThread.pvThreadData = &sLatencyServer;
+                if (eUtils_ThreadStart(pvDumpServer, &sLatencyThread, E_THREAD_JOINABLE) != E_UTILS_OK)
+                {
+                    daemon_log(LOG_ERR, "Failed to start latency server thread");
+                }
+            }
+            
+            if (pcTraceSocket)
+            {
+                /* Start serial trace server thread */
+                sTraceServer.pcPath = pcTraceSocket;
+                sTraceThread.pvThreadData = &sTraceServer;
+                if (eUtils_ThreadStart(pvDumpServer, &sTraceThread, E_THREAD_JOINABLE) != E_UTILS_OK)
+                {
+                    daemon_log(LOG_ERR, "Failed to start serial trace server thread");
+                }
+            }
+            
             break;
         }
     }
@@ -458,14 +645,29 @@ int main(int argc, char *argv[])
     while (bRunning)
     {
         tsZcbEvent *psEvent;
+        uint32_t u32Timeout;
+        
+        /* Send any interview requests that are due, and wait no longer than the next one */
+        u32Timeout = u32ZCB_InterviewProcess();
+        if (u32Timeout > DEVICE_COMMS_CHECK_MS)
+        {
+            u32Timeout = DEVICE_COMMS_CHECK_MS;
+        }
+        
+        if (bTraceDump)
+        {
+            bTraceDump = 0;
+            vTraceDump();
+        }
         
-        switch (eUtils_QueueDequeueTimed(&sZcbEventQueue, 1000, (void**)&psEvent))
+        switch (eUtils_QueueDequeueTimed(&sZcbEventQueue, u32Timeout, (void**)&psEvent))
         {
             case (E_UTILS_OK):
                 if (!psEvent)
                 {
                     break;
                 }
+                vZCB_EventDequeued(psEvent);
                 
                 DBG_vPrintf(DBG_MAIN, "Got event %d\n", psEvent->eEvent);
                 
@@ -504,53 +706,33 @@ int main(int argc, char *argv[])
                     case (E_ZCB_EVENT_DEVICE_ANNOUNCE):
                     {
                         tsZCB_Node *psZcbNode = psZCB_FindNodeShortAddress(psEvent->uData.sDeviceAnnounce.u16ShortAddress);
-                        int i;
+                        uint32_t u32NumEndpoints;
                         
                         if (!psZcbNode)
                         {
                             DBG_vPrintf(DBG_MAIN, "Could not find new node!\n");
                             break;
                         }
+                        u32NumEndpoints = psZcbNode->u32NumEndpoints;
+                        eUtils_LockUnlock(&psZcbNode->sLock);
                         
-                        if (psZcbNode->u32NumEndpoints > 0)
+                        if (u32NumEndpoints > 0)
                         {
-                            DBG_vPrintf(DBG_MAIN, "Endpoints of device 0x%04X already known\n", psZcbNode->u16ShortAddress);
-                            
-                            /* Re-raise event as a device match if we already have the endpoints, 
+                            /* Treat as a device match if we already have the endpoints, 
                              * so we can make sure that a JIP device exists for it.
                              */
-                            psEvent->eEvent = E_ZCB_EVENT_DEVICE_MATCH;
-                            psEvent->uData.sDeviceMatch.u16ShortAddress = psEvent->uData.sDeviceAnnounce.u16ShortAddress;
-                            
-                            if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) == E_UTILS_OK)
-                            {
-                                psEvent = NULL; /* Prevent event being free'd */
-                            }
-                            eUtils_LockUnlock(&psZcbNode->sLock);
+                            DBG_vPrintf(DBG_MAIN, "Endpoints of device 0x%04X already known\n", psEvent->uData.sDeviceAnnounce.u16ShortAddress);
+                            vInterviewNode(psEvent->uData.sDeviceAnnounce.u16ShortAddress);
                             break;
                         }
                         
-                        DBG_vPrintf(DBG_MAIN, "New device 0x%04X\n", psZcbNode->u16ShortAddress);
+                        DBG_vPrintf(DBG_MAIN, "New device 0x%04X\n", psEvent->uData.sDeviceAnnounce.u16ShortAddress);
                         
-                        /* Initiate discovery of device */
-                        
-                        uint16_t au16Profile[] = { E_ZB_PROFILEID_HA, E_ZB_PROFILEID_ZLL };
-                        uint16_t au16Cluster[] = { E_ZB_CLUSTERID_ONOFF, E_ZB_CLUSTERID_THERMOSTAT  };
-                        
-                        for (i = 0 ; i < (sizeof(au16Profile)/sizeof(uint16_t)); i++)
+                        /* Initiate discovery of device. Requests are sent as the interview limits allow. */
+                        if (eZCB_InterviewStart(psEvent->uData.sDeviceAnnounce.u16ShortAddress, 1) != E_ZCB_OK)
                         {
-                            /* Send match descriptor request */
-                            if (eZCB_MatchDescriptorRequest(psZcbNode->u16ShortAddress, au16Profile[i],
-                                    sizeof(au16Cluster) / sizeof(uint16_t), au16Cluster, 
-                                    0, NULL, NULL) != E_ZCB_OK)
-                            {
-                                DBG_vPrintf(DBG_MAIN, "Error sending match descriptor request\n");
-                            }
+                            DBG_vPrintf(DBG_MAIN, "Error starting interview\n");
                         }
-                        eUtils_LockUnlock(&psZcbNode->sLock);
-                        
-                        /* Slow down match descriptor requests */
-                        sleep(1);
                         break;
                     }
                     
@@ -566,6 +748,8 @@ int main(int argc, char *argv[])
                         
                         if (!psEvent->uData.sDeviceLeft.bRejoin)
                         {
+                            vZCB_InterviewCancel(psZcbNode->u16ShortAddress);
+                            
                             // Device is not going to rejoin so remove it immediately.
                             // If it fails to rejoin it will be aged out via the usual mechanism.
                             if (eBR_NodeLeft(psZcbNode) != E_BR_OK)
@@ -582,155 +766,40 @@ int main(int argc, char *argv[])
                     }
                     
                     case (E_ZCB_EVENT_DEVICE_MATCH):
-                    {       
-                        int i;
-                        teZcbStatus eStatus;
-                        tsZCB_Node *psZcbNode = psZCB_FindNodeShortAddress(psEvent->uData.sDeviceMatch.u16ShortAddress);
-                        tsNode *psJIPNode;
-                        
-                        if (!psZcbNode)
-                        {
-                            DBG_vPrintf(DBG_MAIN, "Could not find new node!\n");
-                            break;
-                        }
-                        
-                        psJIPNode = psBR_FindJIPNode(psZcbNode);
-                        if (psJIPNode)
-                        {
-                            DBG_vPrintf(DBG_MAIN, "Node 0x%04X is already in the JIP network\n", psZcbNode->u16ShortAddress);
-                            eJIP_UnlockNode(psJIPNode);
-                        }
-                        else
-                        {
-                            if (!psZcbNode->u64IEEEAddress)
-                            {
-                                DBG_vPrintf(DBG_MAIN, "New node 0x%04X, requesting IEEE address\n", psZcbNode->u16ShortAddress);
-                                if ((eZCB_NodeDescriptorRequest(psZcbNode) != E_ZCB_OK) || (eZCB_IEEEAddressRequest(psZcbNode) != E_ZCB_OK))
-                                {
-                                    if (iBR_DeviceTimedOut(psZcbNode))
-                                    {
-                                        daemon_log(LOG_INFO, "Zigbee node 0x%04X removed from network (no response to IEEE Address).\n", psZcbNode->u16ShortAddress);
-                                        if (eZCB_RemoveNode(psZcbNode) != E_ZCB_OK)
-                                        {
-                                            DBG_vPrintf(DBG_MAIN, "Error removing node from ZCB\n");
-                                        }
-                                    }
-                                    else
-                                    {
-                                        DBG_vPrintf(DBG_MAIN, "Error retrieving IEEE Address of node 0x%04X - requeue\n", psZcbNode->u16ShortAddress);
-                                        if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) == E_UTILS_OK)
-                                        {
-                                            eUtils_LockUnlock(&psZcbNode->sLock);
-                                            psEvent = NULL; /* Prevent event being free'd */
-                                        }
-                                        else
-                                        {
-                                            /* Failed to re-queue the event - discard node. */
-                                            DBG_vPrintf(DBG_MAIN, "Event queue is full - removing node\n");
-                                            if (eZCB_RemoveNode(psZcbNode) != E_ZCB_OK)
-                                            {
-                                                DBG_vPrintf(DBG_MAIN, "Error removing node from ZCB\n");
-                                            }
-                                        }
-                                    }
-                                    break;
-                                }
-                            }
-
-                            DBG_vPrintf(DBG_MAIN, "New device, short address 0x%04X, matching requested clusters\n", psZcbNode->u16ShortAddress);
-                            
-                            for (i = 0; i < psZcbNode->u32NumEndpoints; i++)
-                            {
-                                if (psZcbNode->pasEndpoints[i].u16ProfileID == 0)
-                                {
-                                    DBG_vPrintf(DBG_MAIN, "Requesting new endpoint simple descriptor\n");
-                                    if (eZCB_SimpleDescriptorRequest(psZcbNode, psZcbNode->pasEndpoints[i].u8Endpoint) != E_ZCB_OK)
-                                    {
-                                        if (iBR_DeviceTimedOut(psZcbNode))
-                                        {
-                                            daemon_log(LOG_INFO, "Zigbee node 0x%04X removed from network (No response to simple descriptor request).\n", psZcbNode->u16ShortAddress);
-                                            if (eZCB_RemoveNode(psZcbNode) != E_ZCB_OK)
-                                            {
-                                                DBG_vPrintf(DBG_MAIN, "Error removing node from ZCB\n");
-                                            }
-                                        }
-                                        else
-                                        {
-                                            DBG_vPrintf(DBG_MAIN, "Failed to read endpoint simple descriptor - requeue\n");
-                                            if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) == E_UTILS_OK)
-                                            {
-                                                eUtils_LockUnlock(&psZcbNode->sLock);
-                                                psEvent = NULL; /* Prevent event being free'd */
-                                            }
-                                            else
-                                            {
-                                                /* Failed to re-queue the event - discard node. */
-                                                DBG_vPrintf(DBG_MAIN, "Event queue is full - removing node\n");
-                                                if (eZCB_RemoveNode(psZcbNode) != E_ZCB_OK)
-                                                {
-                                                    DBG_vPrintf(DBG_MAIN, "Error removing node from ZCB\n");
-                                                }
-                                            }
-                                        }
-                                        /* Get out of the loop and case without adding groups or joining to BR */
-                                        goto E_ZCB_EVENT_DEVICE_MATCH_done;
-                                    }
-                                }
-                            }
-                            
-                            
-                            /* Set up bulb groups */
-                            eStatus = eZCB_AddGroupMembership(psZcbNode, 0xf00f);
-                            if ((eStatus != E_ZCB_OK) && 
-                                (eStatus != E_ZCB_DUPLICATE_EXISTS) &&
-                                (eStatus != E_ZCB_UNKNOWN_CLUSTER))
-                            {
-                                if (iBR_DeviceTimedOut(psZcbNode))
-                                {
-                                    daemon_log(LOG_INFO, "Zigbee node 0x%04X removed from network (No response to add group request).\n", psZcbNode->u16ShortAddress);
-                                    if (eZCB_RemoveNode(psZcbNode) != E_ZCB_OK)
-                                    {
-                                        DBG_vPrintf(DBG_MAIN, "Error removing node from ZCB\n");
-                                    }
-                                }
-                                else
-                                {
-                                    DBG_vPrintf(DBG_MAIN, "Failed to add group - requeue\n");
-                                    /* requeue event */
-                                    if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) == E_UTILS_OK)
-                                    {
-                                        eUtils_LockUnlock(&psZcbNode->sLock);
-                                        psEvent = NULL; /* Prevent event being free'd */
-                                    }
-                                    else
-                                    {
-                                        /* Failed to re-queue the event - discard node. */
-                                        DBG_vPrintf(DBG_MAIN, "Event queue is full - removing node\n");
-                                        if (eZCB_RemoveNode(psZcbNode) != E_ZCB_OK)
-                                        {
-                                            DBG_vPrintf(DBG_MAIN, "Error removing node from ZCB\n");
-                                        }
-                                    }
-                                }
-                                /* Get out of the loop and case without adding groups or joining to BR */
-                                goto E_ZCB_EVENT_DEVICE_MATCH_done;
-                            }
-                        }
+                        vInterviewNode(psEvent->uData.sDeviceMatch.u16ShortAddress);
+                        break;
+                    
+                    case (E_ZCB_EVENT_INTERVIEW_RESPONSE):
+                        vZCB_InterviewResponse(psEvent);
+                        break;
+                    
+                    case (E_ZCB_EVENT_DEVICE_INTERVIEWED):
+                        vJoinNode(psEvent->uData.sDeviceInterviewed.u16ShortAddress);
+                        break;
+                    
+                    case (E_ZCB_EVENT_NODES_RESTORED):
+                    {
+                        uint32_t i;
                         
-                        // Node joined event.
-                        if (!psJIPNode)
+                        DBG_vPrintf(DBG_MAIN, "%d nodes restored from the interview cache\n", psEvent->uData.sNodesRestored.u32NumNodes);
+                        for (i = 0; i < psEvent->uData.sNodesRestored.u32NumNodes; i++)
                         {
-                            DBG_vPrintf(DBG_MAIN, "Adding node 0x%04X to border router\n", psZcbNode->u16ShortAddress);
-                            eBR_NodeJoined(psZcbNode);
+                            vJoinNode(psEvent->uData.sNodesRestored.pau16ShortAddresses[i]);
                         }
-                        eUtils_LockUnlock(&psZcbNode->sLock);
-E_ZCB_EVENT_DEVICE_MATCH_done:
+                        free(psEvent->uData.sNodesRestored.pau16ShortAddresses);
                         break;
                     }
                     
                     case (E_ZCB_EVENT_ATTRIBUTE_REPORT):
-                    {       
+                    {
+                        /* The node's binding, set when it joined, gives its device type, so the
+                         * device ID map isn't searched. The bound JIP node is removed when the node
+                         * leaves, so it is only used once it has been found again by address, which
+                         * also locks it. psBR_FindJIPNode releases the Zigbee node while it does that,
+                         * so the binding is checked again afterwards.
+                         */
                         tsZCB_Node *psZcbNode = psZCB_FindNodeShortAddress(psEvent->uData.sAttributeReport.u16ShortAddress);
+                        tsDeviceIDMap *psDeviceIDMap;
                         tsNode *psJIPNode;
                         
                         if (!psZcbNode)
@@ -739,37 +808,31 @@ E_ZCB_EVENT_DEVICE_MATCH_done:
                             break;
                         }
                         
-                        psJIPNode = psBR_FindJIPNode(psZcbNode);
-                        if (!psJIPNode)
+                        psDeviceIDMap = psZcbNode->sBinding.pvContext;
+                        if (!psZcbNode->sBinding.pvNode)
                         {
                             DBG_vPrintf(DBG_MAIN, "No JIP device for Zigbee node 0x%04X\n", psZcbNode->u16ShortAddress);
                         }
-                        else
+                        else if (psDeviceIDMap->prAttributeUpdateRoutine)
                         {
-                            tsDeviceIDMap *psDeviceIDMap = asDeviceIDMap;
-                            while (((psDeviceIDMap->u16ZigbeeDeviceID != 0) &&
-                                    (psDeviceIDMap->u32JIPDeviceID != 0) &&
-                                    (psDeviceIDMap->prInitaliseRoutine != NULL)))
+                            psJIPNode = psBR_FindJIPNode(psZcbNode);
+                            if (psJIPNode && (psJIPNode == psZcbNode->sBinding.pvNode))
                             {
-                                if (psDeviceIDMap->u16ZigbeeDeviceID == psZcbNode->u16DeviceID)
-                                {
-                                    DBG_vPrintf(DBG_MAIN, "Found JIP device type 0x%08X for ZB Device type 0x%04X\n",
-                                                psDeviceIDMap->u32JIPDeviceID, psDeviceIDMap->u16ZigbeeDeviceID);
-                                    if (psDeviceIDMap->prAttributeUpdateRoutine)
-                                    {
-                                        DBG_vPrintf(DBG_MAIN, "Calling JIP attribute update routine\n");
-                                        psDeviceIDMap->prAttributeUpdateRoutine(psZcbNode, psJIPNode, 
-                                            psEvent->uData.sAttributeReport.u16ClusterID,
-                                            psEvent->uData.sAttributeReport.u16AttributeID,
-                                            psEvent->uData.sAttributeReport.eType,
-                                            psEvent->uData.sAttributeReport.uData);
-                                    }
-                                }
-                                
-                                /* Next device map */
-                                psDeviceIDMap++;
+                                DBG_vPrintf(DBG_MAIN, "Calling JIP attribute update routine for JIP device type 0x%08X\n", psDeviceIDMap->u32JIPDeviceID);
+                                psDeviceIDMap->prAttributeUpdateRoutine(psZcbNode, psJIPNode, 
+                                    psEvent->uData.sAttributeReport.u16ClusterID,
+                                    psEvent->uData.sAttributeReport.u16AttributeID,
+                                    psEvent->uData.sAttributeReport.eType,
+                                    psEvent->uData.sAttributeReport.uData);
+                            }
+                            else
+                            {
+                                DBG_vPrintf(DBG_MAIN, "JIP device for Zigbee node 0x%04X has gone\n", psZcbNode->u16ShortAddress);
+                            }
+                            if (psJIPNode)
+                            {
+                                eJIP_UnlockNode(psJIPNode);
                             }
-                            eJIP_UnlockNode(psJIPNode);
                         }
                         eUtils_LockUnlock(&psZcbNode->sLock);
                         break;
@@ -784,7 +847,12 @@ E_ZCB_EVENT_DEVICE_MATCH_done:
                 
             case (E_UTILS_ERROR_TIMEOUT):
             {
-                eBR_CheckDeviceComms();
+                /* Check one device's comms when idle, no more than once each interval */
+                if (u64CommsCheckTime <= u64TimeNow())
+                {
+                    eBR_CheckDeviceComms();
+                    u64CommsCheckTime = u64TimeNow() + DEVICE_COMMS_CHECK_MS;
+                }
                 break;
             }
 
@@ -800,12 +868,27 @@ E_ZCB_EVENT_DEVICE_MATCH_done:
     }
     
     /* Clean up */
-    eUtils_ThreadStop(&sCommissioningThread);
+    vZCB_InterviewFinish();
+    for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+    {
+        eUtils_ThreadStop(&asCommissioningThreads[iShard]);
+    }
+    if (pcLatencySocket)
+    {
+        eUtils_ThreadStop(&sLatencyThread);
+    }
+    if (pcTraceSocket)
+    {
+        eUtils_ThreadStop(&sTraceThread);
+    }
     eBR_Destory();
+    vZCB_CommandQueueFinish();
     eZCB_Finish();
     eTD_Destory();
     
 finish:
+    vUtils_LockProfileStop();
+    eZCB_CaptureStop();
     if (daemonize)
     {
         daemon_log(LOG_INFO, "Daemon process exiting");  
@@ -840,12 +923,133 @@ static void vQuitSignalHandler (int sig)
 }
 
 
+/** Flag the main loop to write the serial trace, and wake it up */
+static void vTraceSignalHandler (int sig)
+{
+    bTraceDump = 1;
+    
+    /* Queue a null event to break the main loop's wait */
+    eUtils_QueueQueue(&sZcbEventQueue, NULL);
+    
+    /* Re-enable signal handler */
+    signal (sig, vTraceSignalHandler);
+    return;
+}
+
+
+/** Write the serial trace to the trace file */
+static void vTraceDump(void)
+{
+    FILE *psFile = fopen(pcTraceFile, "w");
+    
+    if (!psFile)
+    {
+        daemon_log(LOG_ERR, "Failed to open serial trace file %s (%s)", pcTraceFile, strerror(errno));
+        return;
+    }
+    
+    if ((eZCB_TraceWrite(psFile) != E_ZCB_OK) | (fclose(psFile) != 0))
+    {
+        daemon_log(LOG_ERR, "Failed to write serial trace file %s", pcTraceFile);
+        return;
+    }
+    daemon_log(LOG_INFO, "Wrote serial trace to %s", pcTraceFile);
+}
+
+
+static void vLatencyDump(FILE *psStream)
+{
+    eJIPserver_LatencyDump(&sJIP_Context, psStream);
+    eZCB_StatsDump(psStream);
+    vZCB_CommandQueueStatsDump(psStream);
+    if (pcLockProfileFile)
+    {
+        vUtils_LockProfileDump(psStream);
+    }
+}
+
+
+static void vTraceWrite(FILE *psStream)
+{
+    eZCB_TraceWrite(psStream);
+}
+
+
+/** Interview a device that has matching endpoints, unless it is already in the JIP network */
+static void vInterviewNode(uint16_t u16ShortAddress)
+{
+    tsZCB_Node *psZcbNode = psZCB_FindNodeShortAddress(u16ShortAddress);
+    tsNode *psJIPNode;
+    
+    if (!psZcbNode)
+    {
+        DBG_vPrintf(DBG_MAIN, "Could not find new node!\n");
+        return;
+    }
+    
+    psJIPNode = psBR_FindJIPNode(psZcbNode);
+    eUtils_LockUnlock(&psZcbNode->sLock);
+    
+    if (psJIPNode)
+    {
+        DBG_vPrintf(DBG_MAIN, "Node 0x%04X is already in the JIP network\n", u16ShortAddress);
+        eJIP_UnlockNode(psJIPNode);
+        return;
+    }
+    
+    DBG_vPrintf(DBG_MAIN, "New device, short address 0x%04X, matching requested clusters\n", u16ShortAddress);
+    if (eZCB_InterviewStart(u16ShortAddress, 0) != E_ZCB_OK)
+    {
+        DBG_vPrintf(DBG_MAIN, "Error starting interview\n");
+    }
+}
+
+
+/** Add a device whose endpoints are known to the JIP network, unless it is already in it */
+static void vJoinNode(uint16_t u16ShortAddress)
+{
+    tsZCB_Node *psZcbNode = psZCB_FindNodeShortAddress(u16ShortAddress);
+    tsNode *psJIPNode;
+    
+    if (!psZcbNode)
+    {
+        DBG_vPrintf(DBG_MAIN, "Could not find interviewed node!\n");
+        return;
+    }
+    
+    psJIPNode = psBR_FindJIPNode(psZcbNode);
+    if (psJIPNode)
+    {
+        DBG_vPrintf(DBG_MAIN, "Node 0x%04X is already in the JIP network\n", psZcbNode->u16ShortAddress);
+        eJIP_UnlockNode(psJIPNode);
+    }
+    else
+    {
+        DBG_vPrintf(DBG_MAIN, "Adding node 0x%04X to border router\n", psZcbNode->u16ShortAddress);
+        eBR_NodeJoined(psZcbNode);
+    }
+    eUtils_LockUnlock(&psZcbNode->sLock);
+}
+
+
+/** Get the monotonic time in milliseconds */
+static uint64_t u64TimeNow(void)
+{
+    struct timespec sNow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000) + (sNow.tv_nsec / 1000000);
+}
+
+
 static void print_usage_exit(char *argv[])
 {
     fprintf(stderr, "zigbee-jip-daemon Version: %s\n", Version);
     fprintf(stderr, "Usage: %s\n", argv[0]);
     fprintf(stderr, "  Arguments:\n");
     fprintf(stderr, "    -s --serial        <serial device>     Serial device for 15.4 module, e.g. /dev/tts/1\n");
+    fprintf(stderr, "                                           Repeat for up to %d control bridges, each running its own network.\n", ZCB_MAX_SHARDS);
+    fprintf(stderr, "                                           Devices are commissioned onto the network of the nth on port 1880 + n.\n");
     fprintf(stderr, "  Options:\n");
     fprintf(stderr, "    -h --help                              Print this help.\n");
     fprintf(stderr, "    -f --foreground                        Do not detatch daemon process, run in foreground.\n");
@@ -853,15 +1057,31 @@ static void print_usage_exit(char *argv[])
     fprintf(stderr, "    -B --baud          <baud rate>         Baud rate to communicate with border router node at. Default %d\n",     u32BaudRate);
     fprintf(stderr, "    -I --interface     <Interface>         Interface name to create. Default %s.\n",                               pcTD_DevName);
     fprintf(stderr, "    -P --pdmstore      <File>              Location to store PDM data. Default 'disabled'.\n");
+    fprintf(stderr, "    -D --pdmdebounce   <ms>                Time to hold off writing saved PDM records, so rapid rewrites are written once. Default 0.\n");
+    fprintf(stderr, "       --disable-interviewcache            Do not keep interview results in the PDM store. Every device is interviewed again after a restart.\n");
     fprintf(stderr, "    -n --factorynew                        Supply this option to factory new the control bridge on bootup.\n");
 
     fprintf(stderr, "  Zigbee Network options:\n");
     fprintf(stderr, "    -m --mode          <mode>              802.15.4 stack mode (coordinator, router). Default coordinator.\n");
     fprintf(stderr, "    -c --channel       <channel>           802.15.4 channel to run on. Default %d.\n",                             CONFIG_DEFAULT_CHANNEL);
+    fprintf(stderr, "                                           Repeat to give each control bridge its own, in the order of -s.\n");
     fprintf(stderr, "    -p --pan           <PAN ID>            802.15.4 extended Pan ID to use. Default 0x%llx.\n",                    CONFIG_DEFAULT_PANID);
+    fprintf(stderr, "                                           Repeat to give each control bridge its own, in the order of -s.\n");
+    fprintf(stderr, "    -N --interviews    <count>             Maximum number of joining devices to interview at once. Default %d.\n", iZCB_InterviewMaxActive);
+    fprintf(stderr, "    -i --interviewinterval <ms>            Minimum time between interview requests. Default %d.\n",          u32ZCB_InterviewIntervalMs);
+    fprintf(stderr, "       --disable-commandqueue              Send each command to a lamp before acknowledging the request, rather than queueing it and replacing waiting commands with newer ones.\n");
+    fprintf(stderr, "       --disable-mailbox                   Send queued commands to devices that sleep as they are requested, rather than holding them until the device is next heard from.\n");
+    fprintf(stderr, "       --disable-adaptive-delivery         Send every request without APS ack (with it if --enable-apsack) and without retries, rather than choosing by how reliably each device responds.\n");
     
     fprintf(stderr, "  JIP Network options:\n");
     fprintf(stderr, "    -6 --borderrouter  <IPv6 Address>      IPv6 Address to use for the virtual border router. Default fd04:bd3:80e8:10::1\n");
+    fprintf(stderr, "    -T --trapinterval  <ms>                Minimum time between trap notifications to each subscriber. Default %d.\n", u32BR_TrapMinIntervalMs);
+    fprintf(stderr, "    -L --latencysocket <File>              Unix socket to serve tables of request latencies and serial link statistics on. Default 'disabled'.\n");
+    fprintf(stderr, "    -t --tracefile     <File>              File the recent serial frames are written to on SIGUSR2. Default %s.\n", pcTraceFile);
+    fprintf(stderr, "    -S --tracesocket   <File>              Unix socket to serve the recent serial frames on. Default 'disabled'.\n");
+    fprintf(stderr, "    -C --capture       <File>              File to capture every serial frame to, for playing back with zcb-replay. Default 'disabled'.\n");
+    fprintf(stderr, "    -K --lockprofile   <File>              Profile lock contention and write the report to File on SIGUSR1. Default 'disabled'.\n");
+    fprintf(stderr, "       --disable-latency                   Do not time requests. Latencies are also read from the ControlBridge node's Latency MiB.\n");
     exit(EXIT_FAILURE);
 }
 
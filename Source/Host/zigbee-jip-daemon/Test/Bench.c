@@ -0,0 +1,113 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <libdaemon/daemon.h>
+
+#include "Utils.h"
+#include "SerialLink.h"
+#include "ZigbeeConstant.h"
+#include "ZigbeeNetwork.h"
+
+#include "Bench.h"
+
+int verbosity = LOG_ERR;
+
+int bZCB_EnableAPSAck = 0;
+
+static const uint16_t au16LampClusters[] = { E_ZB_CLUSTERID_ONOFF, E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_CLUSTERID_COLOR_CONTROL };
+
+
+/* Stand in for the serial link selection. The benches drive a single control bridge. */
+int iSL_SelectedLink(void)
+{
+    return 0;
+}
+
+
+void vSL_SelectLink(int iLink)
+{
+}
+
+
+uint64_t u64Bench_TimeNow(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000) + (sNow.tv_nsec / 1000);
+}
+
+
+void vBench_SleepUs(uint64_t u64Us)
+{
+    struct timespec sDelay;
+
+    sDelay.tv_sec  = u64Us / 1000000;
+    sDelay.tv_nsec = (u64Us % 1000000) * 1000;
+    nanosleep(&sDelay, NULL);
+}
+
+
+void vBench_CreateControlBridge(void)
+{
+    tsZCB_Node *psZCBNode = &sZCB_Network.sNodes;
+    int j;
+
+    eUtils_LockCreateHere(&sZCB_Network.sLock);
+    eUtils_LockCreateHere(&sZCB_Network.sNodes.sLock);
+    sZCB_Network.sNodes.u16ShortAddress = 0x0000;
+    sZCB_Network.sNodes.u16DeviceID     = 0x0840;
+
+    (void)eZCB_NodeAddEndpoint(psZCBNode, 1, 0xC05E, NULL);
+    for (j = 0; j < sizeof(au16LampClusters) / sizeof(au16LampClusters[0]); j++)
+    {
+        (void)eZCB_NodeAddCluster(psZCBNode, 1, au16LampClusters[j]);
+    }
+}
+
+
+int iBench_AddLamp(uint16_t u16ShortAddress, uint64_t u64IEEEAddress, uint16_t u16DeviceID)
+{
+    tsZCB_Node *psZCBNode;
+    int j;
+
+    if (eZCB_AddNode(u16ShortAddress, u64IEEEAddress, u16DeviceID, 0x8E, &psZCBNode) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Error adding lamp\n");
+        return -1;
+    }
+    (void)eZCB_NodeAddEndpoint(psZCBNode, BENCH_LAMP_ENDPOINT, 0xC05E, NULL);
+    for (j = 0; j < sizeof(au16LampClusters) / sizeof(au16LampClusters[0]); j++)
+    {
+        (void)eZCB_NodeAddCluster(psZCBNode, BENCH_LAMP_ENDPOINT, au16LampClusters[j]);
+    }
+    eUtils_LockUnlock(&psZCBNode->sLock);
+    return 0;
+}
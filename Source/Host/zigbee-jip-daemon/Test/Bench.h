@@ -0,0 +1,59 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** Fixtures shared by the daemon benches: the clock, a control bridge with
+ *  ZLL lamps, and stand ins for the parts of the daemon that the benches
+ *  don't link.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+
+#include "ZigbeeNetwork.h"
+
+/** Endpoint of each lamp added by iBench_AddLamp */
+#define BENCH_LAMP_ENDPOINT         11
+
+/** Read the monotonic clock in microseconds */
+uint64_t u64Bench_TimeNow(void);
+
+/** Sleep for u64Us microseconds */
+void vBench_SleepUs(uint64_t u64Us);
+
+/** Set up the network with the control bridge as its first node, with the
+ *  clusters the ZLL commands look for.
+ */
+void vBench_CreateControlBridge(void);
+
+/** Add a lamp with the clusters the ZLL commands look for, on endpoint
+ *  BENCH_LAMP_ENDPOINT.
+ *  \return 0 on success, -1 if the node could not be added.
+ */
+int iBench_AddLamp(uint16_t u16ShortAddress, uint64_t u64IEEEAddress, uint16_t u16DeviceID);
+
+#endif /* __BENCH_H__ */
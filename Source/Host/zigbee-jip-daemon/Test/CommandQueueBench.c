@@ -0,0 +1,744 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** CommandQueueBench drags a level slider on each of a number of lamps and
+ *  measures how far behind the slider the lamps fall. The control bridge is
+ *  replaced by stand ins for the serial link that take a fixed round trip
+ *  time to acknowledge each command, and apply it to a simulated lamp.
+ *  Slider requests wait in a FIFO, as in the JIP server's socket, for a
+ *  server thread that passes them one at a time to eZCB_CommandQueue, as the
+ *  lamp's SET handler does. Each case is run twice:
+ *    direct - the command queue is not started, so each request waits for
+ *             its command to be acknowledged, as before the queue
+ *    queued - requests are queued, and waiting commands replaced by newer
+ *  For each case the bench reports requests per command sent, the time from
+ *  the slider reaching a value to the lamp taking it, and the time for the
+ *  lamps to settle on the last value after the slider stops.
+ *  Alongside the lamps are thermostats that sleep, waking every so often to
+ *  report and then poll for a while. A mode write sent while a thermostat
+ *  sleeps waits out the response timeout. Every few slider updates each
+ *  thermostat is sent a new mode, which with the queue is either sent as it
+ *  comes (queued) or held until the thermostat is next heard from (mailbox).
+ *  First, the order of on/off and level commands queued behind a slow
+ *  command is checked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <libdaemon/daemon.h>
+
+#include "Utils.h"
+#include "SerialLink.h"
+#include "ZigbeeConstant.h"
+#include "ZigbeeNetwork.h"
+#include "ZigbeeCommandQueue.h"
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define DEFAULT_LAMPS               1
+#define DEFAULT_UPDATES             200
+#define DEFAULT_INTERVAL_MS         20
+#define DEFAULT_RTT_MS              50
+
+#define DEFAULT_SLEEPERS            1
+#define DEFAULT_WAKE_MS             2000
+
+#define LAMP_SHORT_ADDRESS_BASE     0x1000
+#define LAMP_IEEE_ADDRESS_BASE      0x00158D0000000000ULL
+
+#define SLEEPER_SHORT_ADDRESS_BASE  0x2000
+#define SLEEPER_IEEE_ADDRESS_BASE   0x00158D0100000000ULL
+
+/** Time a thermostat polls for after waking to report (ms) */
+#define SLEEPER_AWAKE_MS            1000
+
+/** Time a write waits for the response of a thermostat that is asleep, as eZCB_WriteAttributeRequest (ms) */
+#define SLEEPER_TIMEOUT_MS          1000
+
+/** Slider updates between each new mode sent to the thermostats */
+#define SLEEPER_REQUEST_EVERY       25
+
+/** Commands recorded by each lamp for the order check */
+#define LAMP_LOG_SIZE               32
+
+/** Time to wait for the lamps to settle before giving up (ms) */
+#define SETTLE_TIMEOUT_MS           60000
+
+/** Shortest round trip for the order check, so commands queue behind the first (ms) */
+#define ORDER_CHECK_RTT_MS          20
+
+/** A simulated lamp */
+typedef struct
+{
+    uint8_t             u8Level;            /**< Level the lamp has taken */
+    uint8_t             u8OnOff;
+    uint32_t            u32Commands;        /**< Commands the lamp has taken */
+    uint64_t            au64Requested[256]; /**< Last time the slider reached each level */
+    uint32_t            u32LogLength;
+    char                acLog[LAMP_LOG_SIZE][8];
+} tsLamp;
+
+/** A simulated thermostat that sleeps when idle */
+typedef struct
+{
+    uint8_t             u8Mode;             /**< Mode the thermostat has taken */
+    uint8_t             u8Requested;        /**< Last mode requested */
+    uint64_t            u64NextWake;
+    uint64_t            u64AwakeUntil;
+    uint32_t            u32Taken;           /**< Writes the thermostat has taken */
+    uint32_t            u32Failed;          /**< Writes sent while it was asleep */
+} tsSleeper;
+
+/** A slider or thermostat mode request waiting for the server */
+typedef struct
+{
+    uint16_t            u16ShortAddress;
+    uint8_t             u8Level;
+    uint64_t            u64Time;
+} tsRequest;
+
+static int iLamps           = DEFAULT_LAMPS;
+static int iUpdates         = DEFAULT_UPDATES;
+static int iIntervalMs      = DEFAULT_INTERVAL_MS;
+static int iRttMs           = DEFAULT_RTT_MS;
+static int iSleepers        = DEFAULT_SLEEPERS;
+static int iWakeMs          = DEFAULT_WAKE_MS;
+
+static tsLamp *pasLamps;
+static tsSleeper *pasSleepers;
+static volatile int bWaking;
+
+/** Command sent and waiting for its default response. Commands are sent one at a time. */
+static struct
+{
+    uint16_t            u16Type;
+    uint16_t            u16ShortAddress;
+    uint8_t             au8Args[2];
+} sInFlight;
+
+static pthread_mutex_t sLampMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static tsUtilsHistogram sLatency;
+static tsUtilsHistogram sAck;
+
+static tsUtilsQueue sSocket;
+static tsRequest *pasRequests;
+static tsRequest sStopRequest;
+
+
+teZcbStatus eZCB_ReadAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16ClusterID,
+                                      uint8_t u8Direction, uint8_t u8ManufacturerSpecific, uint16_t u16ManufacturerID,
+                                      uint16_t u16AttributeID, void *pvData)
+{
+    return E_ZCB_ERROR;
+}
+
+
+/* Stand in for writing an attribute, which is only sent to the thermostats */
+teZcbStatus eZCB_WriteAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16ClusterID,
+                                       uint8_t u8Direction, uint8_t u8ManufacturerSpecific, uint16_t u16ManufacturerID,
+                                       uint16_t u16AttributeID, teZCL_ZCLAttributeType eType, void *pvData)
+{
+    tsSleeper *psSleeper;
+    int bAwake;
+
+    if ((psZCBNode->u16ShortAddress < SLEEPER_SHORT_ADDRESS_BASE) ||
+        (psZCBNode->u16ShortAddress >= SLEEPER_SHORT_ADDRESS_BASE + iSleepers))
+    {
+        return E_ZCB_ERROR;
+    }
+    psSleeper = &pasSleepers[psZCBNode->u16ShortAddress - SLEEPER_SHORT_ADDRESS_BASE];
+
+    pthread_mutex_lock(&sLampMutex);
+    bAwake = u64Bench_TimeNow() < psSleeper->u64AwakeUntil;
+    pthread_mutex_unlock(&sLampMutex);
+
+    vBench_SleepUs((uint64_t)(bAwake ? iRttMs : SLEEPER_TIMEOUT_MS) * 1000);
+
+    pthread_mutex_lock(&sLampMutex);
+    if (bAwake)
+    {
+        psSleeper->u8Mode = *(uint8_t *)pvData;
+        psSleeper->u32Taken++;
+    }
+    else
+    {
+        psSleeper->u32Failed++;
+    }
+    pthread_mutex_unlock(&sLampMutex);
+    return bAwake ? E_ZCB_OK : E_ZCB_COMMS_FAILED;
+}
+
+
+/* Stand in for the serial link. The target address and arguments are at
+ * the same place in each ZLL command message. */
+teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
+{
+    uint8_t *pu8Message = (uint8_t *)pvMessage;
+
+    sInFlight.u16Type         = u16Type;
+    sInFlight.u16ShortAddress = (pu8Message[1] << 8) | pu8Message[2];
+    sInFlight.au8Args[0]      = (u16Length > 5) ? pu8Message[5] : 0;
+    sInFlight.au8Args[1]      = (u16Length > 6) ? pu8Message[6] : 0;
+    *pu8SequenceNo = 0;
+    return E_SL_OK;
+}
+
+
+/* The lamp takes the command when it is acknowledged, a round trip after it was sent */
+teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo, uint32_t u32TimeoutMs)
+{
+    tsLamp *psLamp;
+    uint64_t u64Now;
+
+    vBench_SleepUs((uint64_t)iRttMs * 1000);
+    u64Now = u64Bench_TimeNow();
+
+    if ((sInFlight.u16ShortAddress < LAMP_SHORT_ADDRESS_BASE) ||
+        (sInFlight.u16ShortAddress >= LAMP_SHORT_ADDRESS_BASE + iLamps))
+    {
+        return E_ZCB_COMMS_FAILED;
+    }
+    psLamp = &pasLamps[sInFlight.u16ShortAddress - LAMP_SHORT_ADDRESS_BASE];
+
+    pthread_mutex_lock(&sLampMutex);
+    psLamp->u32Commands++;
+    if (sInFlight.u16Type == E_SL_MSG_MOVE_TO_LEVEL_ONOFF)
+    {
+        psLamp->u8OnOff = sInFlight.au8Args[0];
+        psLamp->u8Level = sInFlight.au8Args[1];
+        if (psLamp->au64Requested[psLamp->u8Level])
+        {
+            vUtils_HistogramRecord(&sLatency, (uint32_t)(u64Now - psLamp->au64Requested[psLamp->u8Level]));
+        }
+    }
+    else if (sInFlight.u16Type == E_SL_MSG_ONOFF)
+    {
+        psLamp->u8OnOff = sInFlight.au8Args[0];
+    }
+
+    if (psLamp->u32LogLength < LAMP_LOG_SIZE)
+    {
+        char *pcEntry = psLamp->acLog[psLamp->u32LogLength++];
+
+        switch (sInFlight.u16Type)
+        {
+            case (E_SL_MSG_MOVE_TO_LEVEL_ONOFF):    sprintf(pcEntry, "L%d", sInFlight.au8Args[1]); break;
+            case (E_SL_MSG_ONOFF):                  sprintf(pcEntry, "%s", (const char *[]){ "Off", "On", "T" }[sInFlight.au8Args[0] % 3]); break;
+            case (E_SL_MSG_MOVE_TO_HUE):            sprintf(pcEntry, "H%d", sInFlight.au8Args[0]); break;
+            default:                                sprintf(pcEntry, "?"); break;
+        }
+    }
+    pthread_mutex_unlock(&sLampMutex);
+    return E_ZCB_OK;
+}
+
+
+/* Control bridge and lamps, with the clusters the ZLL commands look for */
+static int iCreateNetwork(void)
+{
+    tsZCB_Node *psZCBNode;
+    int i;
+
+    vBench_CreateControlBridge();
+
+    for (i = 0; i < iLamps; i++)
+    {
+        if (iBench_AddLamp(LAMP_SHORT_ADDRESS_BASE + i, LAMP_IEEE_ADDRESS_BASE + i, 0x0102) != 0)
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < iSleepers; i++)
+    {
+        /* Allocate address, without receiver on when idle */
+        if (eZCB_AddNode(SLEEPER_SHORT_ADDRESS_BASE + i, SLEEPER_IEEE_ADDRESS_BASE + i, 0x0301, 0x80, &psZCBNode) != E_ZCB_OK)
+        {
+            fprintf(stderr, "Error adding thermostat\n");
+            return -1;
+        }
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    return 0;
+}
+
+
+/* Queue a command to a lamp, as the lamp's SET handlers do */
+static teZcbStatus eSend(uint16_t u16ShortAddress, tsZcbCommand *psCommand)
+{
+    tsZCB_Node *psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress);
+    teZcbStatus eStatus;
+
+    if (!psZCBNode)
+    {
+        return E_ZCB_UNKNOWN_NODE;
+    }
+    eStatus = eZCB_CommandQueue(psZCBNode, psCommand);
+    eUtils_LockUnlock(&psZCBNode->sLock);
+    return eStatus;
+}
+
+
+static teZcbStatus eSendLevel(uint16_t u16ShortAddress, uint8_t u8Level)
+{
+    tsZcbCommand sCommand;
+
+    sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_LEVEL;
+    sCommand.uArgs.sMoveToLevel.u8OnOff = 1;
+    sCommand.uArgs.sMoveToLevel.u8Level = u8Level;
+    sCommand.uArgs.sMoveToLevel.u16TransitionTime = 5;
+    return eSend(u16ShortAddress, &sCommand);
+}
+
+
+static teZcbStatus eSendMode(uint16_t u16ShortAddress, uint8_t u8Mode)
+{
+    tsZcbCommand sCommand;
+
+    memset(&sCommand, 0, sizeof(sCommand));
+    sCommand.eCommand = E_ZCB_COMMAND_WRITE_ATTRIBUTE;
+    sCommand.uArgs.sWriteAttribute.u16ClusterID   = E_ZB_CLUSTERID_THERMOSTAT;
+    sCommand.uArgs.sWriteAttribute.u16AttributeID = E_ZB_ATTRIBUTEID_TSTAT_SYSTEMMODE;
+    sCommand.uArgs.sWriteAttribute.eType          = E_ZCL_ENUM8;
+    sCommand.uArgs.sWriteAttribute.au8Data[0]     = u8Mode;
+    return eSend(u16ShortAddress, &sCommand);
+}
+
+
+static teZcbStatus eSendOnOff(uint16_t u16ShortAddress, uint8_t u8Mode)
+{
+    tsZcbCommand sCommand;
+
+    sCommand.eCommand = E_ZCB_COMMAND_ONOFF;
+    sCommand.uArgs.sOnOff.u8Mode = u8Mode;
+    return eSend(u16ShortAddress, &sCommand);
+}
+
+
+static teZcbStatus eSendHue(uint16_t u16ShortAddress, uint8_t u8Hue)
+{
+    tsZcbCommand sCommand;
+
+    sCommand.eCommand = E_ZCB_COMMAND_MOVE_TO_HUE;
+    sCommand.uArgs.sMoveToHue.u8Hue = u8Hue;
+    sCommand.uArgs.sMoveToHue.u16TransitionTime = 5;
+    return eSend(u16ShortAddress, &sCommand);
+}
+
+
+static void vResetLamps(void)
+{
+    memset(pasLamps, 0, iLamps * sizeof(tsLamp));
+    memset(pasSleepers, 0, iSleepers * sizeof(tsSleeper));
+    memset(&sLatency, 0, sizeof(sLatency));
+    memset(&sAck, 0, sizeof(sAck));
+}
+
+
+/* Queue commands to the first lamp while it is busy with the first of them,
+ * and check that the lamp takes the latest of each run of the same command,
+ * in the order they were requested. Hue is in the other group, so it may be
+ * taken at any point. */
+static int iOrderCheck(void)
+{
+    static const char *apcExpected[] = { "L10", "On", "L30", "Off", "L50", "T", "T" };
+    uint16_t u16ShortAddress = LAMP_SHORT_ADDRESS_BASE;
+    uint32_t u32Expected = sizeof(apcExpected) / sizeof(apcExpected[0]);
+    uint32_t i, j = 0;
+    uint64_t u64Start;
+    int iErrors = 0;
+    int iSavedRttMs = iRttMs;
+
+    if (iRttMs < ORDER_CHECK_RTT_MS)
+    {
+        iRttMs = ORDER_CHECK_RTT_MS;
+    }
+    vResetLamps();
+    if (eZCB_CommandQueueStart() != E_ZCB_OK)
+    {
+        return -1;
+    }
+
+    eSendLevel(u16ShortAddress, 10);
+    eSendOnOff(u16ShortAddress, 1);
+    eSendLevel(u16ShortAddress, 20);
+    eSendHue(u16ShortAddress, 1);
+    eSendLevel(u16ShortAddress, 30);
+    eSendOnOff(u16ShortAddress, 0);
+    eSendLevel(u16ShortAddress, 40);
+    eSendHue(u16ShortAddress, 2);
+    eSendLevel(u16ShortAddress, 50);
+    eSendOnOff(u16ShortAddress, 2);
+    eSendOnOff(u16ShortAddress, 2);
+
+    /* Seven commands in the on/off and level group, and one hue */
+    u64Start = u64Bench_TimeNow();
+    while ((pasLamps[0].u32Commands < u32Expected + 1) && (u64Bench_TimeNow() - u64Start < SETTLE_TIMEOUT_MS * 1000ULL))
+    {
+        vBench_SleepUs(1000);
+    }
+    vBench_SleepUs((uint64_t)iRttMs * 2000);
+    vZCB_CommandQueueFinish();
+    iRttMs = iSavedRttMs;
+
+    printf("Order check:");
+    for (i = 0; i < pasLamps[0].u32LogLength; i++)
+    {
+        const char *pcEntry = pasLamps[0].acLog[i];
+
+        printf(" %s", pcEntry);
+        if (pcEntry[0] == 'H')
+        {
+            if (strcmp(pcEntry, "H2") != 0)
+            {
+                iErrors++;
+            }
+            continue;
+        }
+        if ((j >= u32Expected) || (strcmp(pcEntry, apcExpected[j]) != 0))
+        {
+            iErrors++;
+        }
+        j++;
+    }
+    if ((j != u32Expected) || (pasLamps[0].u32LogLength != u32Expected + 1))
+    {
+        iErrors++;
+    }
+    printf(" - %s\n", iErrors ? "FAILED" : "ok");
+    return iErrors ? -1 : 0;
+}
+
+
+/* Wake each thermostat in turn to report, after which it polls for a while */
+static void *pvWakeThread(void *pvArg)
+{
+    int i;
+
+    for (i = 0; i < iSleepers; i++)
+    {
+        pasSleepers[i].u64NextWake = u64Bench_TimeNow() + ((uint64_t)iWakeMs * 1000 * (i + 1) / iSleepers);
+    }
+
+    while (bWaking)
+    {
+        for (i = 0; i < iSleepers; i++)
+        {
+            uint64_t u64Now = u64Bench_TimeNow();
+
+            if (u64Now >= pasSleepers[i].u64NextWake)
+            {
+                pthread_mutex_lock(&sLampMutex);
+                pasSleepers[i].u64AwakeUntil = u64Now + (SLEEPER_AWAKE_MS * 1000ULL);
+                pasSleepers[i].u64NextWake   = u64Now + ((uint64_t)iWakeMs * 1000);
+                pthread_mutex_unlock(&sLampMutex);
+
+                /* As the attribute report handler does */
+                vZCB_CommandQueueNodeHeard(SLEEPER_SHORT_ADDRESS_BASE + i);
+            }
+        }
+        vBench_SleepUs(1000);
+    }
+    return NULL;
+}
+
+
+/* Drag a slider on each lamp, sending a request for each lamp every interval,
+ * and every so often a new mode to each thermostat */
+static void *pvSliderThread(void *pvArg)
+{
+    uint64_t u64Next = u64Bench_TimeNow();
+    tsRequest *psRequest = pasRequests;
+    int i, iLamp;
+
+    for (i = 0; i < iUpdates; i++)
+    {
+        /* Sweep up and down, so the slider keeps moving */
+        uint8_t u8Level = (i / 254) % 2 ? 254 - (i % 254) : 1 + (i % 254);
+
+        for (iLamp = 0; iLamp < iLamps; iLamp++, psRequest++)
+        {
+            psRequest->u16ShortAddress = LAMP_SHORT_ADDRESS_BASE + iLamp;
+            psRequest->u8Level         = u8Level;
+            psRequest->u64Time         = u64Bench_TimeNow();
+
+            pthread_mutex_lock(&sLampMutex);
+            pasLamps[iLamp].au64Requested[u8Level] = psRequest->u64Time;
+            pthread_mutex_unlock(&sLampMutex);
+
+            (void)eUtils_QueueQueue(&sSocket, psRequest);
+        }
+
+        if ((i % SLEEPER_REQUEST_EVERY) == 0)
+        {
+            int iSleeper;
+
+            for (iSleeper = 0; iSleeper < iSleepers; iSleeper++, psRequest++)
+            {
+                /* Alternate heat and cool */
+                psRequest->u16ShortAddress = SLEEPER_SHORT_ADDRESS_BASE + iSleeper;
+                psRequest->u8Level         = ((i / SLEEPER_REQUEST_EVERY) % 2) ? 3 : 4;
+                psRequest->u64Time         = u64Bench_TimeNow();
+
+                pthread_mutex_lock(&sLampMutex);
+                pasSleepers[iSleeper].u8Requested = psRequest->u8Level;
+                pthread_mutex_unlock(&sLampMutex);
+
+                (void)eUtils_QueueQueue(&sSocket, psRequest);
+            }
+        }
+
+        u64Next += (uint64_t)iIntervalMs * 1000;
+        if ((i + 1 < iUpdates) && (u64Next > u64Bench_TimeNow()))
+        {
+            vBench_SleepUs(u64Next - u64Bench_TimeNow());
+        }
+    }
+    (void)eUtils_QueueQueue(&sSocket, &sStopRequest);
+    return NULL;
+}
+
+
+static int iRunCase(int bQueued, int bMailbox)
+{
+    tsUtilsHistogramSummary sLatencySummary, sAckSummary;
+    pthread_t sSliderThread, sWakeThread;
+    uint32_t u32Requests = 0, u32Commands = 0;
+    uint32_t u32SleeperTaken = 0, u32SleeperFailed = 0, u32SleeperLatest = 0;
+    uint64_t u64LastRequest = 0, u64Settled, u64Start;
+    uint8_t u8Final = 0;
+    int i;
+
+    vResetLamps();
+    if (eUtils_QueueCreate(&sSocket, (iUpdates * (iLamps + iSleepers)) + 1, 0) != E_UTILS_OK)
+    {
+        return -1;
+    }
+    bZCB_CommandMailbox = bMailbox;
+    if (bQueued && (eZCB_CommandQueueStart() != E_ZCB_OK))
+    {
+        return -1;
+    }
+
+    bWaking = 1;
+    pthread_create(&sWakeThread, NULL, pvWakeThread, NULL);
+    pthread_create(&sSliderThread, NULL, pvSliderThread, NULL);
+
+    /* Serve requests one at a time, as the JIP server does */
+    while (1)
+    {
+        tsRequest *psRequest;
+
+        if (eUtils_QueueDequeue(&sSocket, (void **)&psRequest) != E_UTILS_OK)
+        {
+            continue;
+        }
+        if (psRequest == &sStopRequest)
+        {
+            break;
+        }
+        if (psRequest->u16ShortAddress >= SLEEPER_SHORT_ADDRESS_BASE)
+        {
+            (void)eSendMode(psRequest->u16ShortAddress, psRequest->u8Level);
+        }
+        else
+        {
+            (void)eSendLevel(psRequest->u16ShortAddress, psRequest->u8Level);
+            u32Requests++;
+            u64LastRequest = psRequest->u64Time;
+            u8Final = psRequest->u8Level;
+        }
+        vUtils_HistogramRecord(&sAck, (uint32_t)(u64Bench_TimeNow() - psRequest->u64Time));
+    }
+    pthread_join(sSliderThread, NULL);
+
+    /* Wait for every lamp to take the slider's last value */
+    while (1)
+    {
+        int iSettled = 1;
+
+        pthread_mutex_lock(&sLampMutex);
+        for (i = 0; i < iLamps; i++)
+        {
+            if (pasLamps[i].u8Level != u8Final)
+            {
+                iSettled = 0;
+            }
+        }
+        pthread_mutex_unlock(&sLampMutex);
+        if (iSettled || (u64Bench_TimeNow() - u64LastRequest > SETTLE_TIMEOUT_MS * 1000ULL))
+        {
+            break;
+        }
+        vBench_SleepUs(1000);
+    }
+    u64Settled = u64Bench_TimeNow() - u64LastRequest;
+
+    /* Give the thermostats a chance to wake and take their last mode */
+    u64Start = u64Bench_TimeNow();
+    while (u64Bench_TimeNow() - u64Start < ((uint64_t)iWakeMs + SLEEPER_AWAKE_MS) * 1000)
+    {
+        int iTaken = 1;
+
+        pthread_mutex_lock(&sLampMutex);
+        for (i = 0; i < iSleepers; i++)
+        {
+            if (pasSleepers[i].u8Mode != pasSleepers[i].u8Requested)
+            {
+                iTaken = 0;
+            }
+        }
+        pthread_mutex_unlock(&sLampMutex);
+        if (iTaken)
+        {
+            break;
+        }
+        vBench_SleepUs(1000);
+    }
+
+    if (bQueued)
+    {
+        vZCB_CommandQueueFinish();
+    }
+    bWaking = 0;
+    pthread_join(sWakeThread, NULL);
+    eUtils_QueueDestroy(&sSocket);
+
+    for (i = 0; i < iLamps; i++)
+    {
+        u32Commands += pasLamps[i].u32Commands;
+    }
+    for (i = 0; i < iSleepers; i++)
+    {
+        u32SleeperTaken  += pasSleepers[i].u32Taken;
+        u32SleeperFailed += pasSleepers[i].u32Failed;
+        u32SleeperLatest += (pasSleepers[i].u8Mode == pasSleepers[i].u8Requested);
+    }
+
+    vUtils_HistogramSummarise(&sLatency, &sLatencySummary);
+    vUtils_HistogramSummarise(&sAck, &sAckSummary);
+    printf("%-8s %9u %9u %9.2f %9u %9u %9u %9u %9u %11.1f %9u %9u %9u\n",
+           bQueued ? (bMailbox ? "mailbox" : "queued") : "direct", u32Requests, u32Commands,
+           (double)u32Requests / (u32Commands ? u32Commands : 1),
+           sAckSummary.u32P50 / 1000, sAckSummary.u32Max / 1000,
+           sLatencySummary.u32P50 / 1000, sLatencySummary.u32P99 / 1000, sLatencySummary.u32Max / 1000,
+           (double)u64Settled / 1000, u32SleeperTaken, u32SleeperFailed, u32SleeperLatest);
+    return 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "CommandQueueBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -l --lamps     <count>     Number of lamps, each with a slider [%d]\n", DEFAULT_LAMPS);
+    fprintf(stderr, "    -n --updates   <count>     Slider updates per lamp [%d]\n", DEFAULT_UPDATES);
+    fprintf(stderr, "    -i --interval  <ms>        Interval between slider updates [%d]\n", DEFAULT_INTERVAL_MS);
+    fprintf(stderr, "    -r --rtt       <ms>        Time to acknowledge each command [%d]\n", DEFAULT_RTT_MS);
+    fprintf(stderr, "    -s --sleepers  <count>     Number of thermostats that sleep [%d]\n", DEFAULT_SLEEPERS);
+    fprintf(stderr, "    -w --wake      <ms>        Interval between each thermostat waking [%d]\n", DEFAULT_WAKE_MS);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    {
+        static struct option long_options[] =
+        {
+            {"lamps",                   required_argument,  NULL, 'l'},
+            {"updates",                 required_argument,  NULL, 'n'},
+            {"interval",                required_argument,  NULL, 'i'},
+            {"rtt",                     required_argument,  NULL, 'r'},
+            {"sleepers",                required_argument,  NULL, 's'},
+            {"wake",                    required_argument,  NULL, 'w'},
+            {"help",                    no_argument,        NULL, 'h'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "l:n:i:r:s:w:h", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'l': iLamps        = atoi(optarg); break;
+                case 'n': iUpdates      = atoi(optarg); break;
+                case 'i': iIntervalMs   = atoi(optarg); break;
+                case 'r': iRttMs        = atoi(optarg); break;
+                case 's': iSleepers     = atoi(optarg); break;
+                case 'w': iWakeMs       = atoi(optarg); break;
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iLamps < 1) || (iUpdates < 1) || (iIntervalMs < 1) || (iRttMs < 0) || (iSleepers < 0) || (iWakeMs < 1))
+    {
+        print_usage_exit(argv);
+    }
+
+    pasLamps    = calloc(iLamps, sizeof(tsLamp));
+    pasSleepers = calloc(iSleepers ? iSleepers : 1, sizeof(tsSleeper));
+    pasRequests = calloc(iUpdates * (iLamps + iSleepers), sizeof(tsRequest));
+    if (!pasLamps || !pasSleepers || !pasRequests || (iCreateNetwork() != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (iOrderCheck() != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("%d lamps, %d slider updates each every %dms, %dms round trip per command, times in ms\n",
+           iLamps, iUpdates, iIntervalMs, iRttMs);
+    printf("%d thermostats waking every %dms, sent a mode every %d updates\n",
+           iSleepers, iWakeMs, SLEEPER_REQUEST_EVERY);
+    printf("%-8s %9s %9s %9s %9s %9s %9s %9s %9s %11s %9s %9s %9s\n",
+           "mode", "requests", "commands", "req/cmd", "ack p50", "ack max", "lag p50", "lag p99", "lag max", "settle ms",
+           "tstat ok", "tstat to", "tstat last");
+    iRunCase(0, 0);
+    iRunCase(1, 0);
+    iRunCase(1, 1);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,438 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** DeliveryBench sends level commands to lamps over links that lose frames,
+ *  and compares how many are delivered, and at what cost, when every command
+ *  is sent without APS ack (as the daemon did by default), when every command
+ *  is sent with APS ack (--enable-apsack), and when each lamp is sent by the
+ *  delivery policy it has earned (adaptive).
+ *  The control bridge is replaced by stand ins for the serial link that play
+ *  out each command on a simulated radio, in simulated time so that a run
+ *  of timeouts takes no time. Each frame is lost with the probability of the
+ *  lamp's link: good, flaky, or gone (every frame lost). A command sent with
+ *  APS ack is sent again by the stack until it is acked, up to
+ *  APS_MAX_RETRIES times, APS_ACK_WAIT_MS apart. The lamp takes the command
+ *  the first time it arrives and sends its default response, which may be
+ *  lost too. The result of each command is counted against the lamp, as the
+ *  command queue's sender does, so the adaptive run learns which lamps are
+ *  flaky from the start.
+ *  For each run and kind of lamp the bench reports the commands the lamps
+ *  took, the commands answered, radio frames per command and the time to
+ *  send each command.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <libdaemon/daemon.h>
+
+#include "Utils.h"
+#include "SerialLink.h"
+#include "ZigbeeConstant.h"
+#include "ZigbeeNetwork.h"
+#include "ZigbeeZLL.h"
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define DEFAULT_GOOD_LAMPS          8
+#define DEFAULT_FLAKY_LAMPS         2
+#define DEFAULT_GONE_LAMPS          1
+#define DEFAULT_GOOD_LOSS           1
+#define DEFAULT_FLAKY_LOSS          20
+#define DEFAULT_COMMANDS            500
+#define DEFAULT_RTT_MS              50
+#define DEFAULT_SEED                1
+
+#define LAMP_SHORT_ADDRESS_BASE     0x1000
+#define LAMP_IEEE_ADDRESS_BASE      0x00158D0000000000ULL
+
+/** Times the stack sends a frame again while waiting for its APS ack */
+#define APS_MAX_RETRIES             3
+
+/** Time the stack waits for an APS ack before sending again (ms) */
+#define APS_ACK_WAIT_MS             1600
+
+/** Kinds of lamp, by the quality of their link */
+typedef enum
+{
+    E_LINK_GOOD,
+    E_LINK_FLAKY,
+    E_LINK_GONE,
+    E_LINK_NUM,
+} teLink;
+
+/** A simulated lamp */
+typedef struct
+{
+    teLink              eLink;
+    uint32_t            u32Loss;            /**< Chance of losing each frame, of RAND_MAX */
+    uint8_t             u8Level;            /**< Level the lamp has taken */
+} tsLamp;
+
+/** Results of one run for one kind of lamp */
+typedef struct
+{
+    uint32_t            u32Commands;        /**< Commands sent */
+    uint32_t            u32Taken;           /**< Commands the lamp took */
+    uint32_t            u32Answered;        /**< Commands whose default response arrived in time */
+    uint32_t            u32Frames;          /**< Radio frames, including APS acks and responses */
+    tsUtilsHistogram    sSend;              /**< Simulated time to send each command */
+} tsResult;
+
+static int iGoodLamps       = DEFAULT_GOOD_LAMPS;
+static int iFlakyLamps      = DEFAULT_FLAKY_LAMPS;
+static int iGoneLamps       = DEFAULT_GONE_LAMPS;
+static int iGoodLoss        = DEFAULT_GOOD_LOSS;
+static int iFlakyLoss       = DEFAULT_FLAKY_LOSS;
+static int iCommands        = DEFAULT_COMMANDS;
+static int iRttMs           = DEFAULT_RTT_MS;
+static unsigned int uSeed   = DEFAULT_SEED;
+
+static int iLamps;
+static tsLamp *pasLamps;
+
+static const char *apcLinkNames[E_LINK_NUM] = { "good", "flaky", "gone" };
+
+/** Command sent and waiting for its default response. Commands are sent one at a time. */
+static struct
+{
+    uint16_t            u16ShortAddress;
+    uint8_t             u8AddressMode;
+    uint8_t             u8Level;
+} sInFlight;
+
+/** Simulated time (ms) */
+static uint64_t u64Now;
+
+/** Set when the lamp takes the command being sent, by any attempt */
+static int bTaken;
+
+static unsigned int uRandom;
+
+static tsResult asResults[E_LINK_NUM];
+
+
+teZcbStatus eZCB_ReadAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16ClusterID,
+                                      uint8_t u8Direction, uint8_t u8ManufacturerSpecific, uint16_t u16ManufacturerID,
+                                      uint16_t u16AttributeID, void *pvData)
+{
+    return E_ZCB_ERROR;
+}
+
+
+/* Stand in for the serial link. The address mode, target address and level
+ * are at the same place in each move to level message. */
+teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
+{
+    uint8_t *pu8Message = (uint8_t *)pvMessage;
+
+    sInFlight.u8AddressMode   = pu8Message[0];
+    sInFlight.u16ShortAddress = (pu8Message[1] << 8) | pu8Message[2];
+    sInFlight.u8Level         = (u16Length > 6) ? pu8Message[6] : 0;
+    *pu8SequenceNo = 0;
+    return E_SL_OK;
+}
+
+
+static int bLost(tsLamp *psLamp)
+{
+    return (uint32_t)rand_r(&uRandom) < psLamp->u32Loss;
+}
+
+
+/* Play out the command in flight on the lamp's link, and wait for the lamp's response */
+teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo, uint32_t u32TimeoutMs)
+{
+    tsLamp *psLamp;
+    tsResult *psResult;
+    uint32_t u32AnsweredAt = 0;
+    int bDelivered = 0, bAnswered = 0;
+    int i;
+
+    if ((sInFlight.u16ShortAddress < LAMP_SHORT_ADDRESS_BASE) ||
+        (sInFlight.u16ShortAddress >= LAMP_SHORT_ADDRESS_BASE + iLamps))
+    {
+        return E_ZCB_COMMS_FAILED;
+    }
+    psLamp = &pasLamps[sInFlight.u16ShortAddress - LAMP_SHORT_ADDRESS_BASE];
+    psResult = &asResults[psLamp->eLink];
+
+    for (i = 0; i <= ((sInFlight.u8AddressMode == E_ZB_ADDRESS_MODE_SHORT) ? APS_MAX_RETRIES : 0); i++)
+    {
+        psResult->u32Frames++;
+        if (bLost(psLamp))
+        {
+            continue;
+        }
+
+        if (!bDelivered)
+        {
+            /* The lamp takes the command and responds */
+            bDelivered = 1;
+            psResult->u32Frames++;
+            bAnswered = !bLost(psLamp);
+            u32AnsweredAt = (i * APS_ACK_WAIT_MS) + iRttMs;
+        }
+
+        if (sInFlight.u8AddressMode != E_ZB_ADDRESS_MODE_SHORT)
+        {
+            break;
+        }
+
+        /* The lamp acks each copy it gets */
+        psResult->u32Frames++;
+        if (!bLost(psLamp))
+        {
+            break;
+        }
+    }
+
+    if (bDelivered)
+    {
+        psLamp->u8Level = sInFlight.u8Level;
+        bTaken = 1;
+    }
+
+    if (bAnswered && (u32AnsweredAt <= u32TimeoutMs))
+    {
+        u64Now += u32AnsweredAt;
+        return E_ZCB_OK;
+    }
+    u64Now += u32TimeoutMs;
+    return E_ZCB_COMMS_FAILED;
+}
+
+
+/* Control bridge and lamps, with the clusters the ZLL commands look for */
+static int iCreateNetwork(void)
+{
+    int i;
+
+    vBench_CreateControlBridge();
+
+    for (i = 0; i < iLamps; i++)
+    {
+        if (iBench_AddLamp(LAMP_SHORT_ADDRESS_BASE + i, LAMP_IEEE_ADDRESS_BASE + i, 0x0102) != 0)
+        {
+            return -1;
+        }
+
+        if (i < iGoodLamps)
+        {
+            pasLamps[i].eLink   = E_LINK_GOOD;
+            pasLamps[i].u32Loss = (uint32_t)((double)RAND_MAX * iGoodLoss / 100);
+        }
+        else if (i < iGoodLamps + iFlakyLamps)
+        {
+            pasLamps[i].eLink   = E_LINK_FLAKY;
+            pasLamps[i].u32Loss = (uint32_t)((double)RAND_MAX * iFlakyLoss / 100);
+        }
+        else
+        {
+            pasLamps[i].eLink   = E_LINK_GONE;
+            pasLamps[i].u32Loss = RAND_MAX;
+        }
+    }
+    return 0;
+}
+
+
+/* Forget what was learnt about each lamp, as if it had just joined */
+static void vResetLamps(void)
+{
+    int i;
+
+    for (i = 0; i < iLamps; i++)
+    {
+        tsZCB_Node *psZCBNode = psZCB_FindNodeShortAddress(LAMP_SHORT_ADDRESS_BASE + i);
+
+        if (psZCBNode)
+        {
+            memset(&psZCBNode->sComms, 0, sizeof(psZCBNode->sComms));
+            psZCBNode->sComms.u16Reliability = 0xFFFF;
+            eUtils_LockUnlock(&psZCBNode->sLock);
+        }
+        pasLamps[i].u8Level = 0;
+    }
+    memset(asResults, 0, sizeof(asResults));
+    uRandom = uSeed;
+}
+
+
+/* Send each lamp a level in turn, as the command queue's sender does */
+static void vRunCase(const char *pcName, int bAdaptive, int bAck)
+{
+    int i, iLamp;
+    teLink eLink;
+
+    bZCB_AdaptiveDelivery   = bAdaptive;
+    bZCB_EnableAPSAck       = bAck;
+    vResetLamps();
+
+    for (i = 0; i < iCommands; i++)
+    {
+        uint8_t u8Level = 1 + (i % 254);
+
+        for (iLamp = 0; iLamp < iLamps; iLamp++)
+        {
+            uint16_t u16ShortAddress = LAMP_SHORT_ADDRESS_BASE + iLamp;
+            tsResult *psResult = &asResults[pasLamps[iLamp].eLink];
+            tsZCB_Node *psZCBNode;
+            teZcbStatus eStatus;
+            uint64_t u64Start = u64Now;
+
+            psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress);
+            if (!psZCBNode)
+            {
+                continue;
+            }
+            bTaken = 0;
+            eStatus = eZBZLL_MoveToLevel(psZCBNode, 0, 1, u8Level, 5);
+            eUtils_LockUnlock(&psZCBNode->sLock);
+
+            psResult->u32Commands++;
+            psResult->u32Taken    += bTaken;
+            psResult->u32Answered += (eStatus == E_ZCB_OK);
+            vUtils_HistogramRecord(&psResult->sSend, (uint32_t)(u64Now - u64Start));
+
+            if ((psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress)) != NULL)
+            {
+                vZCB_NodeUpdateComms(psZCBNode, eStatus);
+                eUtils_LockUnlock(&psZCBNode->sLock);
+            }
+        }
+    }
+
+    for (eLink = 0; eLink < E_LINK_NUM; eLink++)
+    {
+        tsResult *psResult = &asResults[eLink];
+        tsUtilsHistogramSummary sSummary;
+        uint32_t u32Commands = psResult->u32Commands ? psResult->u32Commands : 1;
+
+        if (!psResult->u32Commands)
+        {
+            continue;
+        }
+        vUtils_HistogramSummarise(&psResult->sSend, &sSummary);
+        printf("%-9s %-6s %9u %8.2f%% %8.2f%% %9.2f %9u %9u %9u\n",
+               pcName, apcLinkNames[eLink], psResult->u32Commands,
+               100.0 * psResult->u32Taken / u32Commands, 100.0 * psResult->u32Answered / u32Commands,
+               (double)psResult->u32Frames / u32Commands,
+               sSummary.u32Mean, sSummary.u32P50, sSummary.u32P99);
+    }
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "DeliveryBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -g --good      <count>     Number of lamps with a good link [%d]\n", DEFAULT_GOOD_LAMPS);
+    fprintf(stderr, "    -f --flaky     <count>     Number of lamps with a flaky link [%d]\n", DEFAULT_FLAKY_LAMPS);
+    fprintf(stderr, "    -x --gone      <count>     Number of lamps that have gone [%d]\n", DEFAULT_GONE_LAMPS);
+    fprintf(stderr, "    -G --goodloss  <percent>   Frames lost on a good link [%d]\n", DEFAULT_GOOD_LOSS);
+    fprintf(stderr, "    -F --flakyloss <percent>   Frames lost on a flaky link [%d]\n", DEFAULT_FLAKY_LOSS);
+    fprintf(stderr, "    -n --commands  <count>     Commands sent to each lamp [%d]\n", DEFAULT_COMMANDS);
+    fprintf(stderr, "    -r --rtt       <ms>        Time for a command's response to arrive [%d]\n", DEFAULT_RTT_MS);
+    fprintf(stderr, "    -S --seed      <seed>      Seed for losing frames, the same for each run [%d]\n", DEFAULT_SEED);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    {
+        static struct option long_options[] =
+        {
+            {"good",                    required_argument,  NULL, 'g'},
+            {"flaky",                   required_argument,  NULL, 'f'},
+            {"gone",                    required_argument,  NULL, 'x'},
+            {"goodloss",                required_argument,  NULL, 'G'},
+            {"flakyloss",               required_argument,  NULL, 'F'},
+            {"commands",                required_argument,  NULL, 'n'},
+            {"rtt",                     required_argument,  NULL, 'r'},
+            {"seed",                    required_argument,  NULL, 'S'},
+            {"help",                    no_argument,        NULL, 'h'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "g:f:x:G:F:n:r:S:h", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'g': iGoodLamps    = atoi(optarg); break;
+                case 'f': iFlakyLamps   = atoi(optarg); break;
+                case 'x': iGoneLamps    = atoi(optarg); break;
+                case 'G': iGoodLoss     = atoi(optarg); break;
+                case 'F': iFlakyLoss    = atoi(optarg); break;
+                case 'n': iCommands     = atoi(optarg); break;
+                case 'r': iRttMs        = atoi(optarg); break;
+                case 'S': uSeed         = strtoul(optarg, NULL, 0); break;
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    iLamps = iGoodLamps + iFlakyLamps + iGoneLamps;
+    if ((iGoodLamps < 0) || (iFlakyLamps < 0) || (iGoneLamps < 0) || (iLamps < 1) ||
+        (iGoodLoss < 0) || (iGoodLoss > 100) || (iFlakyLoss < 0) || (iFlakyLoss > 100) ||
+        (iCommands < 1) || (iRttMs < 0) || (iRttMs > ZCB_DELIVERY_TIMEOUT_MS))
+    {
+        print_usage_exit(argv);
+    }
+
+    pasLamps = calloc(iLamps, sizeof(tsLamp));
+    if (!pasLamps || (iCreateNetwork() != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("%d good lamps losing %d%% of frames, %d flaky losing %d%%, %d gone, %d commands each, %dms round trip, times in ms\n",
+           iGoodLamps, iGoodLoss, iFlakyLamps, iFlakyLoss, iGoneLamps, iCommands, iRttMs);
+    printf("%-9s %-6s %9s %9s %9s %9s %9s %9s %9s\n",
+           "mode", "link", "commands", "taken", "answered", "frames", "send mean", "send p50", "send p99");
+    vRunCase("no ack", 0, 0);
+    vRunCase("ack", 0, 1);
+    vRunCase("adaptive", 1, 0);
+
+    printf("\nDelivery statistics, over all runs\n");
+    vZCB_DeliveryStatsDump(stdout);
+    return EXIT_SUCCESS;
+}
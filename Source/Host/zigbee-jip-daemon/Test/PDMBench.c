@@ -0,0 +1,641 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee control bridge interface daemon
+ *
+ * COMPONENT:          PDM save latency benchmark
+ *
+ * REVISION:           $Revision$
+ *
+ * DATED:              $Date$
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** PDMBench measures how long the host PDM store takes to save records for
+ *  the control bridge. It stands in for the serial link, so that the PDM
+ *  module's own message handlers are driven exactly as they are by the
+ *  control bridge: each record is sent as a series of block save requests,
+ *  and the next block is only sent once the previous one is acknowledged.
+ *  The time from the first block of a record to the acknowledgement of the
+ *  last is reported. Afterwards every record is loaded back and checked.
+ *  A save that fails part way through a record is then checked to discard
+ *  only that record, and not one saved before it whose commit is debounced.
+ *
+ *  The interview cache is measured too: a network of lamps is described,
+ *  each node's description is saved, and the nodes are then restored from
+ *  the reopened database as they are when the daemon restarts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <sqlite3.h>
+#include <libdaemon/daemon.h>
+
+#include "Utils.h"
+#include "SerialLink.h"
+#include "ZigbeePDM.h"
+#include "ZigbeeNetwork.h"
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+/** Size of a PDM block, as PDM_BLOCK_SIZE in ZigbeePDM.c */
+#define BLOCK_SIZE                  128
+
+#define DEFAULT_RECORDS             200
+#define DEFAULT_BLOCKS              4
+#define DEFAULT_RECORD_IDS          16
+#define DEFAULT_NODES               200
+
+/** Addresses of the lamps described in the interview cache */
+#define NODE_SHORT_ADDRESS_BASE     0x1000
+#define NODE_IEEE_ADDRESS_BASE      0x00158D0000000000ULL
+
+/** Records saved by the failed save check. The second block of FAILED_RECORD_ID fails */
+#define KEPT_RECORD_ID              0xF000
+#define FAILED_RECORD_ID            0xF001
+
+/** Save request, as sent by the control bridge */
+typedef struct
+{
+    uint16_t    u16RecordID;
+    uint32_t    u32TotalSize;
+    uint32_t    u32NumBlocks;
+    uint32_t    u32CurrentBlock;
+    uint32_t    u32BlockSize;
+    uint8_t     au8Data[BLOCK_SIZE];
+} __attribute__((__packed__)) tsSaveRequest;
+
+/** Load response, as sent to the control bridge */
+typedef struct
+{
+    uint8_t     u8Status;
+    uint16_t    u16RecordID;
+    uint32_t    u32TotalSize;
+    uint32_t    u32NumBlocks;
+    uint32_t    u32CurrentBlock;
+    uint32_t    u32BlockSize;
+    uint8_t     au8Data[BLOCK_SIZE];
+} __attribute__((__packed__)) tsLoadResponse;
+
+/** Clusters of a colour lamp, with the attributes and commands the interview finds */
+static const struct
+{
+    uint16_t    u16ClusterID;
+    uint16_t    u16NumAttributes;
+    uint16_t    u16NumCommands;
+} asLampClusters[] =
+{
+    { 0x0000, 8,  0  },     /* Basic */
+    { 0x0003, 1,  2  },     /* Identify */
+    { 0x0004, 1,  6  },     /* Groups */
+    { 0x0005, 6,  10 },     /* Scenes */
+    { 0x0006, 4,  6  },     /* On/Off */
+    { 0x0008, 2,  8  },     /* Level control */
+    { 0x0300, 16, 19 },     /* Colour control */
+    { 0x1000, 0,  2  },     /* Touchlink commissioning */
+};
+
+/** Handlers the PDM module registers for control bridge messages, and the data they are given */
+static tprSL_MessageCallback prSaveHandler = NULL;
+static tprSL_MessageCallback prLoadHandler = NULL;
+static void *pvHandlerUser = NULL;
+
+/** Last save status sent back */
+static int iSaveStatus = -1;
+
+/** Blocks of the record being loaded */
+static uint32_t u32LoadedBlocks;
+static uint32_t u32LoadErrors;
+static uint8_t u8ExpectedFill;
+
+/** Number of the first block of the record being loaded, as it was saved */
+static uint32_t u32FirstBlock;
+
+
+/* Stand in for the serial link */
+teSL_Status eSL_AddListener(uint16_t u16Type, tprSL_MessageCallback prCallback, void *pvUser)
+{
+    if (u16Type == E_SL_MSG_PDM_SAVE_RECORD_REQUEST)
+    {
+        prSaveHandler = prCallback;
+    }
+    else if (u16Type == E_SL_MSG_PDM_LOAD_RECORD_REQUEST)
+    {
+        prLoadHandler = prCallback;
+    }
+    pvHandlerUser = pvUser;
+    return E_SL_OK;
+}
+
+
+teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
+{
+    if (u16Type == E_SL_MSG_PDM_SAVE_RECORD_RESPONSE)
+    {
+        iSaveStatus = ((uint8_t *)pvMessage)[0];
+    }
+    else if (u16Type == E_SL_MSG_PDM_LOAD_RECORD_RESPONSE)
+    {
+        tsLoadResponse *psResponse = (tsLoadResponse *)pvMessage;
+        uint32_t i;
+
+        if (psResponse->u8Status)
+        {
+            if ((ntohl(psResponse->u32CurrentBlock) != u32FirstBlock + u32LoadedBlocks) || (ntohl(psResponse->u32BlockSize) != BLOCK_SIZE))
+            {
+                u32LoadErrors++;
+            }
+            for (i = 0; i < BLOCK_SIZE; i++)
+            {
+                if (psResponse->au8Data[i] != u8ExpectedFill)
+                {
+                    u32LoadErrors++;
+                    break;
+                }
+            }
+            u32LoadedBlocks++;
+        }
+    }
+    return E_SL_OK;
+}
+
+
+/* Stand in for the control bridge table, which is in the control bridge module */
+tsZCB_Shard asZCB_Shards[ZCB_MAX_SHARDS] = { { "PDMBench" } };
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "PDM save benchmark Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s -f <database> [options]\n", argv[0]);
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -f <file>          PDM database file. It is deleted first.\n");
+    fprintf(stderr, "    -n <records>       Number of records to save. Default %d.\n", DEFAULT_RECORDS);
+    fprintf(stderr, "    -b <blocks>        Blocks of %d bytes in each record. Default %d.\n", BLOCK_SIZE, DEFAULT_BLOCKS);
+    fprintf(stderr, "    -i <ids>           Number of different record IDs to rewrite in turn. Default %d.\n", DEFAULT_RECORD_IDS);
+    fprintf(stderr, "    -D <ms>            PDM debounce time. Default 0.\n");
+    fprintf(stderr, "    -N <nodes>         Number of nodes to save to and restore from the interview cache. Default %d.\n", DEFAULT_NODES);
+    exit(EXIT_FAILURE);
+}
+
+
+/* Send each block of a record to the save handler, numbered from 1 as the control bridge does.
+ * Returns the number of blocks acknowledged */
+static uint32_t u32SaveRecord(uint16_t u16RecordID, uint32_t u32Blocks, uint8_t u8Fill)
+{
+    uint32_t j;
+
+    for (j = 1; j <= u32Blocks; j++)
+    {
+        tsSaveRequest sRequest;
+
+        sRequest.u16RecordID        = htons(u16RecordID);
+        sRequest.u32TotalSize       = htonl(u32Blocks * BLOCK_SIZE);
+        sRequest.u32NumBlocks       = htonl(u32Blocks);
+        sRequest.u32CurrentBlock    = htonl(j);
+        sRequest.u32BlockSize       = htonl(BLOCK_SIZE);
+        memset(sRequest.au8Data, u8Fill, BLOCK_SIZE);
+
+        iSaveStatus = -1;
+        prSaveHandler(pvHandlerUser, sizeof(tsSaveRequest), &sRequest);
+        if (iSaveStatus != 0)
+        {
+            break;
+        }
+    }
+    return j - 1;
+}
+
+
+/* Save a record and leave its commit debounced, then fail the save of another part way through,
+ * by a trigger that refuses its second block. Check that only the failed record is lost */
+static int iFailedSave(const char *pcDatabase, uint32_t u32Blocks)
+{
+    uint32_t u32DebounceMs = u32PDM_DebounceMs;
+    uint32_t u32Kept, u32Failed;
+    uint16_t u16RecordID;
+    sqlite3 *psDb;
+    char acSQL[256];
+    int iResult;
+
+    snprintf(acSQL, sizeof(acSQL),
+             "CREATE TRIGGER IF NOT EXISTS benchfail BEFORE INSERT ON pdm WHEN NEW.id=%d AND NEW.block=2 "
+             "BEGIN SELECT RAISE(ABORT, 'refused by PDMBench'); END", FAILED_RECORD_ID);
+    if (sqlite3_open(pcDatabase, &psDb) != SQLITE_OK)
+    {
+        fprintf(stderr, "Could not open \"%s\": %s\n", pcDatabase, sqlite3_errmsg(psDb));
+        return -1;
+    }
+    iResult = sqlite3_exec(psDb, acSQL, NULL, NULL, NULL);
+    sqlite3_close(psDb);
+    if (iResult != SQLITE_OK)
+    {
+        fprintf(stderr, "Could not add trigger to \"%s\"\n", pcDatabase);
+        return -1;
+    }
+
+    /* Hold the first record in the open transaction until the database is closed */
+    u32PDM_DebounceMs = 60000;
+    if (ePDM_Init((char *)pcDatabase) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Could not reopen PDM database \"%s\"\n", pcDatabase);
+        return -1;
+    }
+    u32Kept   = u32SaveRecord(KEPT_RECORD_ID, u32Blocks + 1, 0x5A);
+    u32Failed = u32SaveRecord(FAILED_RECORD_ID, u32Blocks + 1, 0xA5);
+    ePDM_Destory();
+    u32PDM_DebounceMs = u32DebounceMs;
+
+    if (ePDM_Init((char *)pcDatabase) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Could not reopen PDM database \"%s\"\n", pcDatabase);
+        return -1;
+    }
+    u32LoadErrors = 0;
+    u32LoadedBlocks = 0;
+    u32FirstBlock = 1;
+    u8ExpectedFill = 0x5A;
+    u16RecordID = htons(KEPT_RECORD_ID);
+    prLoadHandler(pvHandlerUser, sizeof(uint16_t), &u16RecordID);
+    u32Kept = (u32Kept == u32Blocks + 1) && (u32LoadedBlocks == u32Blocks + 1) && (u32LoadErrors == 0);
+
+    u32LoadedBlocks = 0;
+    u16RecordID = htons(FAILED_RECORD_ID);
+    prLoadHandler(pvHandlerUser, sizeof(uint16_t), &u16RecordID);
+    u32Failed = (u32Failed == 1) && (u32LoadedBlocks == 0);
+    u32FirstBlock = 0;
+    ePDM_Destory();
+
+    if (sqlite3_open(pcDatabase, &psDb) == SQLITE_OK)
+    {
+        (void)sqlite3_exec(psDb, "DROP TRIGGER IF EXISTS benchfail", NULL, NULL, NULL);
+    }
+    sqlite3_close(psDb);
+
+    if (!u32Kept || !u32Failed)
+    {
+        printf("Failed save verify: record saved before %s, failed record %s\n",
+               u32Kept ? "kept" : "lost", u32Failed ? "discarded" : "not discarded");
+        return -1;
+    }
+    printf("Failed save verify: failed record discarded, record saved before kept\n");
+    return 0;
+}
+
+
+/* Describe node i of the network as its interview would */
+static tsZCB_Node *psDescribeNode(uint32_t i)
+{
+    tsZCB_Node *psZCBNode;
+    uint32_t j, k;
+
+    if (eZCB_AddNode(NODE_SHORT_ADDRESS_BASE + i, NODE_IEEE_ADDRESS_BASE + i, 0x0102, 0x8E, &psZCBNode) != E_ZCB_OK)
+    {
+        return NULL;
+    }
+    (void)eZCB_NodeAddEndpoint(psZCBNode, 11, 0x0104, NULL);
+    for (j = 0; j < sizeof(asLampClusters) / sizeof(asLampClusters[0]); j++)
+    {
+        (void)eZCB_NodeAddCluster(psZCBNode, 11, asLampClusters[j].u16ClusterID);
+        for (k = 0; k < asLampClusters[j].u16NumAttributes; k++)
+        {
+            (void)eZCB_NodeAddAttribute(psZCBNode, 11, asLampClusters[j].u16ClusterID, k);
+        }
+        for (k = 0; k < asLampClusters[j].u16NumCommands; k++)
+        {
+            (void)eZCB_NodeAddCommand(psZCBNode, 11, asLampClusters[j].u16ClusterID, k);
+        }
+    }
+    (void)eZCB_NodeAddGroup(psZCBNode, 0xF00F);
+    (void)eZCB_NodeAddGroup(psZCBNode, 0x0001 + (i % 8));
+    return psZCBNode;
+}
+
+
+/* Check that a restored node is described as psDescribeNode described it.
+ * Returns the number of differences */
+static uint32_t u32CheckNode(tsZCB_Node *psZCBNode)
+{
+    uint32_t i = psZCBNode->u16ShortAddress - NODE_SHORT_ADDRESS_BASE;
+    uint32_t u32Errors = 0;
+    uint32_t j, k;
+
+    if ((psZCBNode->u64IEEEAddress != NODE_IEEE_ADDRESS_BASE + i) || (psZCBNode->u16DeviceID != 0x0102) ||
+        (psZCBNode->u8MacCapability != 0x8E) || !psZCBNode->bUnverified ||
+        (psZCBNode->u32NumEndpoints != 1) || (psZCBNode->pasEndpoints[0].u8Endpoint != 11) ||
+        (psZCBNode->pasEndpoints[0].u16ProfileID != 0x0104) ||
+        (psZCBNode->pasEndpoints[0].u32NumClusters != sizeof(asLampClusters) / sizeof(asLampClusters[0])))
+    {
+        return 1;
+    }
+    for (j = 0; j < psZCBNode->pasEndpoints[0].u32NumClusters; j++)
+    {
+        tsZCB_NodeCluster *psCluster = &psZCBNode->pasEndpoints[0].pasClusters[j];
+
+        if ((psCluster->u16ClusterID != asLampClusters[j].u16ClusterID) ||
+            (psCluster->u32NumAttributes != asLampClusters[j].u16NumAttributes) ||
+            (psCluster->u32NumCommands != asLampClusters[j].u16NumCommands))
+        {
+            u32Errors++;
+            continue;
+        }
+        for (k = 0; k < psCluster->u32NumAttributes; k++)
+        {
+            u32Errors += (psCluster->pau16Attributes[k] != k);
+        }
+        for (k = 0; k < psCluster->u32NumCommands; k++)
+        {
+            u32Errors += (psCluster->pau8Commands[k] != k);
+        }
+    }
+    if ((psZCBNode->u32NumGroups != 2) || (psZCBNode->pau16Groups[0] != 0xF00F) || (psZCBNode->pau16Groups[1] != 0x0001 + (i % 8)))
+    {
+        u32Errors++;
+    }
+    return u32Errors;
+}
+
+
+/* Remove every node but the control bridge from the network */
+static void vRemoveNodes(void)
+{
+    while (sZCB_Network.sNodes.psNext)
+    {
+        eUtils_LockLock(&sZCB_Network.sNodes.psNext->sLock);
+        eZCB_RemoveNode(sZCB_Network.sNodes.psNext);
+    }
+}
+
+
+/* Save the description of each node to the interview cache, then restore them all
+ * from the reopened database and check them */
+static int iInterviewCache(const char *pcDatabase, uint32_t u32Nodes)
+{
+    uint64_t u64Save = 0, u64Commit, u64Restore;
+    uint16_t *pau16ShortAddresses;
+    uint32_t u32Restored, u32Errors = 0;
+    uint32_t i;
+
+    memset(&sZCB_Network, 0, sizeof(sZCB_Network));
+    eUtils_LockCreateHere(&sZCB_Network.sLock);
+    eUtils_LockCreateHere(&sZCB_Network.sNodes.sLock);
+
+    if (ePDM_Init((char *)pcDatabase) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Could not reopen PDM database \"%s\"\n", pcDatabase);
+        return -1;
+    }
+    for (i = 0; i < u32Nodes; i++)
+    {
+        tsZCB_Node *psZCBNode = psDescribeNode(i);
+        uint64_t u64NodeStart;
+
+        if (!psZCBNode)
+        {
+            return -1;
+        }
+        u64NodeStart = u64Bench_TimeNow();
+        if (ePDM_InterviewSave(psZCBNode) != E_ZCB_OK)
+        {
+            fprintf(stderr, "Save of node %d failed\n", i);
+            return -1;
+        }
+        u64Save += u64Bench_TimeNow() - u64NodeStart;
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    u64Commit = u64Bench_TimeNow();
+    ePDM_Destory();
+    u64Commit = u64Bench_TimeNow() - u64Commit;
+
+    /* The database is closed, so this leaves the nodes in the cache, as at shutdown */
+    vRemoveNodes();
+
+    if (ePDM_Init((char *)pcDatabase) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Could not reopen PDM database \"%s\"\n", pcDatabase);
+        return -1;
+    }
+    u64Restore = u64Bench_TimeNow();
+    if (ePDM_InterviewRestore(&u32Restored, &pau16ShortAddresses) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Restore failed\n");
+        return -1;
+    }
+    u64Restore = u64Bench_TimeNow() - u64Restore;
+
+    for (i = 0; i < u32Restored; i++)
+    {
+        tsZCB_Node *psZCBNode = psZCB_FindNodeShortAddress(pau16ShortAddresses[i]);
+
+        if (!psZCBNode)
+        {
+            u32Errors++;
+            continue;
+        }
+        u32Errors += u32CheckNode(psZCBNode);
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    free(pau16ShortAddresses);
+
+    /* Nodes removed while the database is open are forgotten */
+    vRemoveNodes();
+    ePDM_Destory();
+    if (ePDM_Init((char *)pcDatabase) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Could not reopen PDM database \"%s\"\n", pcDatabase);
+        return -1;
+    }
+    if ((ePDM_InterviewRestore(&i, &pau16ShortAddresses) != E_ZCB_OK) || (i != 0))
+    {
+        u32Errors++;
+        free(pau16ShortAddresses);
+    }
+    ePDM_Destory();
+
+    printf("Interview cache: %d nodes, save mean %.0fus per node, commit %lluus, restore %lluus (%.1fus per node)\n",
+           u32Nodes, (double)u64Save / u32Nodes, (unsigned long long)u64Commit,
+           (unsigned long long)u64Restore, (double)u64Restore / u32Nodes);
+    if ((u32Restored != u32Nodes) || u32Errors)
+    {
+        printf("Interview cache verify: %d of %d nodes restored, %d errors\n", u32Restored, u32Nodes, u32Errors);
+        return -1;
+    }
+    printf("Interview cache verify: all nodes intact, removed nodes forgotten\n");
+    return 0;
+}
+
+
+static int iCompare(const void *pvA, const void *pvB)
+{
+    uint64_t u64A = *(const uint64_t *)pvA, u64B = *(const uint64_t *)pvB;
+
+    return (u64A > u64B) - (u64A < u64B);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *pcDatabase = NULL;
+    uint32_t u32Records = DEFAULT_RECORDS;
+    uint32_t u32Blocks = DEFAULT_BLOCKS;
+    uint32_t u32RecordIDs = DEFAULT_RECORD_IDS;
+    uint32_t u32Nodes = DEFAULT_NODES;
+    uint64_t *pu64Latency;
+    uint64_t u64Start, u64Total = 0;
+    char acPath[1024];
+    uint32_t i, j;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:n:b:i:D:N:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'f': pcDatabase = optarg; break;
+            case 'n': u32Records = strtoul(optarg, NULL, 0); break;
+            case 'b': u32Blocks = strtoul(optarg, NULL, 0); break;
+            case 'i': u32RecordIDs = strtoul(optarg, NULL, 0); break;
+            case 'D': u32PDM_DebounceMs = strtoul(optarg, NULL, 0); break;
+            case 'N': u32Nodes = strtoul(optarg, NULL, 0); break;
+            default: print_usage_exit(argv);
+        }
+    }
+
+    if (!pcDatabase || !u32Records || !u32Blocks || !u32RecordIDs)
+    {
+        print_usage_exit(argv);
+    }
+
+    unlink(pcDatabase);
+    snprintf(acPath, sizeof(acPath), "%s-wal", pcDatabase); unlink(acPath);
+    snprintf(acPath, sizeof(acPath), "%s-shm", pcDatabase); unlink(acPath);
+    snprintf(acPath, sizeof(acPath), "%s-journal", pcDatabase); unlink(acPath);
+
+    pu64Latency = malloc(u32Records * sizeof(uint64_t));
+    if (!pu64Latency || (ePDM_Init((char *)pcDatabase) != E_ZCB_OK) || !prSaveHandler || !prLoadHandler)
+    {
+        fprintf(stderr, "Could not open PDM database \"%s\"\n", pcDatabase);
+        return EXIT_FAILURE;
+    }
+
+    u64Start = u64Bench_TimeNow();
+    for (i = 0; i < u32Records; i++)
+    {
+        uint64_t u64RecordStart = u64Bench_TimeNow();
+
+        for (j = 0; j < u32Blocks; j++)
+        {
+            tsSaveRequest sRequest;
+
+            /* The handler converts the request in place, so build it afresh each time */
+            sRequest.u16RecordID        = htons(i % u32RecordIDs);
+            sRequest.u32TotalSize       = htonl(u32Blocks * BLOCK_SIZE);
+            sRequest.u32NumBlocks       = htonl(u32Blocks);
+            sRequest.u32CurrentBlock    = htonl(j);
+            sRequest.u32BlockSize       = htonl(BLOCK_SIZE);
+            memset(sRequest.au8Data, i & 0xFF, BLOCK_SIZE);
+
+            iSaveStatus = -1;
+            prSaveHandler(pvHandlerUser, sizeof(tsSaveRequest), &sRequest);
+            if (iSaveStatus != 0)
+            {
+                fprintf(stderr, "Save of record %d block %d failed\n", i % u32RecordIDs, j);
+                return EXIT_FAILURE;
+            }
+        }
+        pu64Latency[i] = u64Bench_TimeNow() - u64RecordStart;
+        u64Total += pu64Latency[i];
+    }
+
+    /* Closing the database commits anything held back by debouncing */
+    ePDM_Destory();
+    u64Start = u64Bench_TimeNow() - u64Start;
+
+    qsort(pu64Latency, u32Records, sizeof(uint64_t), iCompare);
+
+    printf("Database \"%s\": %d records of %d blocks, %d record IDs, debounce %dms\n",
+           pcDatabase, u32Records, u32Blocks, u32RecordIDs, u32PDM_DebounceMs);
+    printf("Save latency per record: mean %.0fus, median %lluus, 99%% %lluus, max %lluus\n",
+           (double)u64Total / u32Records,
+           (unsigned long long)pu64Latency[u32Records / 2],
+           (unsigned long long)pu64Latency[(u32Records * 99) / 100],
+           (unsigned long long)pu64Latency[u32Records - 1]);
+    printf("Total including final commit: %.3fs (%.0f records/s)\n",
+           u64Start / 1e6, u32Records / (u64Start / 1e6));
+
+    /* Load every record back and check it holds the last data saved */
+    if (ePDM_Init((char *)pcDatabase) != E_ZCB_OK)
+    {
+        fprintf(stderr, "Could not reopen PDM database \"%s\"\n", pcDatabase);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; (i < u32RecordIDs) && (i < u32Records); i++)
+    {
+        uint16_t u16RecordID = htons(i);
+        uint32_t u32LastWrite = (((u32Records - 1 - i) / u32RecordIDs) * u32RecordIDs) + i;
+
+        u32LoadedBlocks = 0;
+        u8ExpectedFill = u32LastWrite & 0xFF;
+        prLoadHandler(pvHandlerUser, sizeof(uint16_t), &u16RecordID);
+        if (u32LoadedBlocks != u32Blocks)
+        {
+            u32LoadErrors++;
+        }
+    }
+    ePDM_Destory();
+
+    if (u32LoadErrors)
+    {
+        printf("Verify: %d errors\n", u32LoadErrors);
+        return EXIT_FAILURE;
+    }
+    printf("Verify: all records intact\n");
+
+    if (iFailedSave(pcDatabase, u32Blocks) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (u32Nodes && (iInterviewCache(pcDatabase, u32Nodes) != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    free(pu64Latency);
+    return EXIT_SUCCESS;
+}
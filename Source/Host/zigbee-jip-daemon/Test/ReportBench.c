@@ -0,0 +1,541 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee control bridge interface daemon
+ *
+ * COMPONENT:          Attribute report throughput benchmark
+ *
+ * REVISION:           $Revision$
+ *
+ * DATED:              $Date$
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** ReportBench measures how many attribute reports per second the daemon's
+ *  main loop can pass from Zigbee nodes to their JIP nodes. It stands in for
+ *  the control bridge: a network of Zigbee nodes is built with the real node
+ *  list, each with a JIP node in a JIP server context, and reports are fed
+ *  in from randomly chosen nodes. Reports are passed on in three ways:
+ *    search  - as the main loop used to: walk the node list, unlock the node,
+ *              look up the JIP node by IPv6 address, relock, then walk the
+ *              device ID map for the update routine
+ *    indexed - as search, but finding the Zigbee node by short address hash
+ *    bound   - as the main loop does now: find the node by short address
+ *              hash, take the device type from its binding, and look up the
+ *              JIP node by IPv6 address to check it is still there
+ *  Afterwards every JIP node is checked to hold the last value reported to it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include <libdaemon/daemon.h>
+
+#include <JIP.h>
+#include <JIP_Private.h>
+
+#include "Utils.h"
+#include "ZigbeeNetwork.h"
+#include "SerialLink.h"
+#include "ZigbeePDM.h"
+#include "JIP_BorderRouter.h"
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define BENCH_DEVICE_ID             0x0B3C0003
+#define BENCH_MIB_ID                0xFFFFFE10
+#define BENCH_PREFIX                "fd04:bd3:80e8:10::"
+#define BENCH_IEEE_BASE             0x00158D0000000000ULL
+
+#define DEFAULT_NODES               500
+#define DEFAULT_REPORTS             200000
+
+typedef enum
+{
+    E_PATH_SEARCH,
+    E_PATH_INDEXED,
+    E_PATH_BOUND,
+} tePath;
+
+static const char *apcPathNames[] = { "search", "indexed", "bound" };
+
+static teJIP_Status eBenchInitialise(tsZCB_Node *psZCBNode, tsNode *psJIPNode);
+static void vBenchUpdate(tsZCB_Node *psZCBNode, tsNode *psJIPNode, uint16_t u16ClusterID, uint16_t u16AttributeID, teZCL_ZCLAttributeType eType, tuZcbAttributeData uData);
+
+/** As the daemon's map, with the reporting device type last */
+tsDeviceIDMap asDeviceIDMap[] =
+{
+    { 0x0840, 0x08010010, eBenchInitialise, NULL            },
+    { 0x0100, 0x08011175, eBenchInitialise, NULL            },
+    { 0x0101, 0x08011175, eBenchInitialise, NULL            },
+    { 0x0102, 0x0801175C, eBenchInitialise, NULL            },
+    { 0x01FF, 0x0801175B, eBenchInitialise, NULL            },
+    { 0x0200, 0x0801175C, eBenchInitialise, NULL            },
+    { 0x0210, 0x0801175C, eBenchInitialise, NULL            },
+    { 0x0220, 0x0801175B, eBenchInitialise, NULL            },
+    { 0x0301, BENCH_DEVICE_ID, eBenchInitialise, vBenchUpdate },
+    { 0x0000, 0x00000000, NULL },
+};
+
+static tsJIP_Context sServer;
+static struct in6_addr sPrefix;
+static int iPort = JIP_DEFAULT_PORT;
+
+static uint32_t u32NumNodes = DEFAULT_NODES;
+static uint32_t u32NumReports = DEFAULT_REPORTS;
+
+static uint16_t *pau16ShortAddresses;
+static uint16_t *pau16Expected;
+static uint32_t u32Updates;
+
+
+/* Stand in for the serial link, which the bench doesn't send anything over */
+teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
+{
+    return E_SL_OK;
+}
+
+
+static teJIP_Status eBenchInitialise(tsZCB_Node *psZCBNode, tsNode *psJIPNode)
+{
+    return E_JIP_OK;
+}
+
+
+/* Update routine, as the thermostat's */
+static void vBenchUpdate(tsZCB_Node *psZCBNode, tsNode *psJIPNode, uint16_t u16ClusterID, uint16_t u16AttributeID, teZCL_ZCLAttributeType eType, tuZcbAttributeData uData)
+{
+    tsMib *psMib;
+    tsVar *psVar;
+
+    psMib = psJIP_LookupMibId(psJIPNode, NULL, BENCH_MIB_ID);
+    if (psMib)
+    {
+        psVar = psJIP_LookupVarIndex(psMib, 0);
+        if (psVar)
+        {
+            eJIP_SetVarValue(psVar, (void*)&uData.u16Data, sizeof(uint16_t));
+            u32Updates++;
+        }
+    }
+}
+
+
+static tsJIPAddress sIEEEAddressToIPv6(uint64_t u64IEEEAddress)
+{
+    tsJIPAddress sNode_Address;
+
+    u64IEEEAddress = htobe64(u64IEEEAddress);
+
+    memset(&sNode_Address, 0, sizeof(tsJIPAddress));
+    sNode_Address.sin6_family  = AF_INET6;
+    sNode_Address.sin6_port    = htons(iPort);
+    memcpy(&sNode_Address.sin6_addr.s6_addr[0], &sPrefix, sizeof(uint64_t));
+    memcpy(&sNode_Address.sin6_addr.s6_addr[8], &u64IEEEAddress, sizeof(uint64_t));
+
+    return sNode_Address;
+}
+
+
+/* Find a node by walking the list, as psZCB_FindNodeShortAddress used to */
+static tsZCB_Node *psFindNodeListWalk(uint16_t u16ShortAddress)
+{
+    tsZCB_Node *psZCBNode = &sZCB_Network.sNodes;
+
+    eUtils_LockLock(&sZCB_Network.sLock);
+    while (psZCBNode)
+    {
+        if (psZCBNode->u16ShortAddress == u16ShortAddress)
+        {
+            eUtils_LockLock(&psZCBNode->sLock);
+            break;
+        }
+        psZCBNode = psZCBNode->psNext;
+    }
+    eUtils_LockUnlock(&sZCB_Network.sLock);
+    return psZCBNode;
+}
+
+
+/* Pass on a report as the main loop used to */
+static void vReportSearch(tePath ePath, uint16_t u16ShortAddress, tuZcbAttributeData uData)
+{
+    tsZCB_Node *psZcbNode;
+    tsJIPAddress sNode_Address;
+    tsNode *psJIPNode;
+    tsDeviceIDMap *psDeviceIDMap;
+
+    psZcbNode = (ePath == E_PATH_SEARCH) ? psFindNodeListWalk(u16ShortAddress) : psZCB_FindNodeShortAddress(u16ShortAddress);
+    if (!psZcbNode)
+    {
+        return;
+    }
+
+    /* As psBR_FindJIPNode */
+    eUtils_LockUnlock(&psZcbNode->sLock);
+    sNode_Address = sIEEEAddressToIPv6(psZcbNode->u64IEEEAddress);
+    psJIPNode = psJIP_LookupNode(&sServer, &sNode_Address);
+    eUtils_LockLock(&psZcbNode->sLock);
+
+    if (psJIPNode)
+    {
+        psDeviceIDMap = asDeviceIDMap;
+        while (((psDeviceIDMap->u16ZigbeeDeviceID != 0) &&
+                (psDeviceIDMap->u32JIPDeviceID != 0) &&
+                (psDeviceIDMap->prInitaliseRoutine != NULL)))
+        {
+            if ((psDeviceIDMap->u16ZigbeeDeviceID == psZcbNode->u16DeviceID) && psDeviceIDMap->prAttributeUpdateRoutine)
+            {
+                psDeviceIDMap->prAttributeUpdateRoutine(psZcbNode, psJIPNode, E_ZB_CLUSTERID_THERMOSTAT,
+                                                        E_ZB_ATTRIBUTEID_TSTAT_LOCALTEMPERATURE, E_ZCL_INT16, uData);
+            }
+            psDeviceIDMap++;
+        }
+        eJIP_UnlockNode(psJIPNode);
+    }
+    eUtils_LockUnlock(&psZcbNode->sLock);
+}
+
+
+/* Pass on a report as the main loop does now */
+static void vReportBound(uint16_t u16ShortAddress, tuZcbAttributeData uData)
+{
+    tsZCB_Node *psZcbNode = psZCB_FindNodeShortAddress(u16ShortAddress);
+    tsDeviceIDMap *psDeviceIDMap;
+    tsJIPAddress sNode_Address;
+    tsNode *psJIPNode;
+
+    if (!psZcbNode)
+    {
+        return;
+    }
+
+    psDeviceIDMap = psZcbNode->sBinding.pvContext;
+    if (psZcbNode->sBinding.pvNode && psDeviceIDMap->prAttributeUpdateRoutine)
+    {
+        /* As psBR_FindJIPNode */
+        eUtils_LockUnlock(&psZcbNode->sLock);
+        sNode_Address = sIEEEAddressToIPv6(psZcbNode->u64IEEEAddress);
+        psJIPNode = psJIP_LookupNode(&sServer, &sNode_Address);
+        eUtils_LockLock(&psZcbNode->sLock);
+
+        if (psJIPNode && (psJIPNode == psZcbNode->sBinding.pvNode))
+        {
+            psDeviceIDMap->prAttributeUpdateRoutine(psZcbNode, psJIPNode, E_ZB_CLUSTERID_THERMOSTAT,
+                                                    E_ZB_ATTRIBUTEID_TSTAT_LOCALTEMPERATURE, E_ZCL_INT16, uData);
+        }
+        if (psJIPNode)
+        {
+            eJIP_UnlockNode(psJIPNode);
+        }
+    }
+    eUtils_LockUnlock(&psZcbNode->sLock);
+}
+
+
+/* Get the JIP node a Zigbee node is bound to, NULL if the node isn't found or isn't bound */
+static void *pvBoundNode(uint16_t u16ShortAddress)
+{
+    tsZCB_Node *psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress);
+    void *pvNode = NULL;
+
+    if (psZCBNode)
+    {
+        pvNode = psZCBNode->sBinding.pvNode;
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    return pvNode;
+}
+
+
+/* Set up the Zigbee network and the JIP server, with each node bound to its JIP node */
+static int iNetworkStart(void)
+{
+    tsJIP_Private *psJIP_Private;
+    tsJIPAddress sAddress;
+    tsNode *psTemplate;
+    tsMib *psMib;
+    uint32_t i;
+
+    eUtils_LockCreateHere(&sZCB_Network.sLock);
+    eUtils_LockCreateHere(&sZCB_Network.sNodes.sLock);
+    sZCB_Network.sNodes.u16ShortAddress = 0x0000;
+    sZCB_Network.sNodes.u16DeviceID     = 0x0840;
+
+    if (eJIP_Init(&sServer, E_JIP_CONTEXT_SERVER) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error initialising server\n");
+        return -1;
+    }
+    psJIP_Private = (tsJIP_Private *)sServer.pvPriv;
+
+    /* Define the device without needing a definitions file */
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    psTemplate = psJIP_NetAllocateNode(NULL, &sAddress, BENCH_DEVICE_ID);
+    psMib = psTemplate ? psJIP_NodeAddMib(psTemplate, BENCH_MIB_ID, 0, "ThermostatStatus") : NULL;
+    if (!psMib || !psJIP_MibAddVar(psMib, 0, "LocalTemperature", E_JIP_VAR_TYPE_INT16, E_JIP_ACCESS_TYPE_READ_ONLY, E_JIP_SECURITY_NONE) ||
+        (Cache_Add_Node(&psJIP_Private->sCache, psTemplate) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error defining device\n");
+        return -1;
+    }
+
+    if (eJIPserver_Listen(&sServer, iPort) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error starting server\n");
+        return -1;
+    }
+    inet_pton(AF_INET6, BENCH_PREFIX, &sPrefix);
+
+    pau16ShortAddresses = calloc(u32NumNodes, sizeof(uint16_t));
+    pau16Expected       = calloc(u32NumNodes, sizeof(uint16_t));
+    if (!pau16ShortAddresses || !pau16Expected)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < u32NumNodes; i++)
+    {
+        char acAddress[INET6_ADDRSTRLEN];
+        uint64_t u64IEEEAddress = BENCH_IEEE_BASE + i + 1;
+        tsZCB_Node *psZCBNode;
+        tsNode *psJIPNode;
+        uint32_t j;
+
+        /* Short addresses are allocated at random by the stack */
+        do
+        {
+            pau16ShortAddresses[i] = (rand() % 0xFFF6) + 1;
+            for (j = 0; j < i; j++)
+            {
+                if (pau16ShortAddresses[j] == pau16ShortAddresses[i])
+                {
+                    break;
+                }
+            }
+        } while (j != i);
+
+        if (eZCB_AddNode(pau16ShortAddresses[i], u64IEEEAddress, 0x0301, 0x8E, &psZCBNode) != E_ZCB_OK)
+        {
+            fprintf(stderr, "Error adding Zigbee node\n");
+            return -1;
+        }
+
+        sAddress = sIEEEAddressToIPv6(u64IEEEAddress);
+        inet_ntop(AF_INET6, &sAddress.sin6_addr, acAddress, sizeof(acAddress));
+        if (eJIPserver_NodeAdd(&sServer, acAddress, BENCH_DEVICE_ID, NULL, Version, &psJIPNode) != E_JIP_OK)
+        {
+            fprintf(stderr, "Error adding JIP node %s\n", acAddress);
+            return -1;
+        }
+
+        /* As eBR_NodeJoined */
+        psZCBNode->sBinding.pvNode      = psJIPNode;
+        psZCBNode->sBinding.pvContext   = &asDeviceIDMap[8];
+
+        eJIP_UnlockNode(psJIPNode);
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    return 0;
+}
+
+
+/* Check that every JIP node holds the last value reported to it */
+static uint32_t u32Verify(void)
+{
+    uint32_t u32Errors = 0;
+    uint32_t i;
+
+    for (i = 0; i < u32NumNodes; i++)
+    {
+        tsJIPAddress sAddress = sIEEEAddressToIPv6(BENCH_IEEE_BASE + i + 1);
+        tsNode *psJIPNode = psJIP_LookupNode(&sServer, &sAddress);
+        tsVar *psVar = psJIPNode ? psJIP_LookupVarIndex(psJIP_LookupMibId(psJIPNode, NULL, BENCH_MIB_ID), 0) : NULL;
+
+        if (!psVar || !psVar->pvData || (*(uint16_t *)psVar->pvData != pau16Expected[i]))
+        {
+            u32Errors++;
+        }
+        if (psJIPNode)
+        {
+            eJIP_UnlockNode(psJIPNode);
+        }
+    }
+    return u32Errors;
+}
+
+
+/* Feed reports in from random nodes, passing them on one way */
+static int iRunPhase(tePath ePath, uint32_t *pu32Sources)
+{
+    uint64_t u64Start;
+    uint32_t u32Errors;
+    uint32_t i;
+
+    u32Updates = 0;
+    u64Start = u64Bench_TimeNow();
+    for (i = 0; i < u32NumReports; i++)
+    {
+        tuZcbAttributeData uData;
+        uint32_t u32Node = pu32Sources[i];
+
+        uData.u16Data = (uint16_t)(i + ePath);
+        pau16Expected[u32Node] = uData.u16Data;
+
+        if (ePath == E_PATH_BOUND)
+        {
+            vReportBound(pau16ShortAddresses[u32Node], uData);
+        }
+        else
+        {
+            vReportSearch(ePath, pau16ShortAddresses[u32Node], uData);
+        }
+    }
+    u64Start = u64Bench_TimeNow() - u64Start;
+
+    u32Errors = u32Verify();
+    printf("%-8s %10.0f reports/s  %8.2fus per report  updates %u  verify %s\n",
+           apcPathNames[ePath], u32NumReports / (u64Start / 1e6), (double)u64Start / u32NumReports,
+           u32Updates, u32Errors ? "FAILED" : "ok");
+    return ((u32Updates == u32NumReports) && !u32Errors) ? 0 : -1;
+}
+
+
+/* Check that the binding follows the node through a short address change and goes when it leaves */
+static int iCheckBinding(void)
+{
+    tsZCB_Node *psZCBNode;
+    uint16_t u16NewAddress = 0xFFF8;
+    void *pvNode;
+
+    pvNode = pvBoundNode(pau16ShortAddresses[0]);
+    if (!pvNode)
+    {
+        return -1;
+    }
+
+    /* Device announce with a new short address */
+    if ((eZCB_AddNode(u16NewAddress, BENCH_IEEE_BASE + 1, 0, 0, NULL) != E_ZCB_OK) ||
+        psZCB_FindNodeShortAddress(pau16ShortAddresses[0]) ||
+        (pvBoundNode(u16NewAddress) != pvNode))
+    {
+        return -1;
+    }
+
+    /* Leave */
+    psZCBNode = psZCB_FindNodeShortAddress(u16NewAddress);
+    if (!psZCBNode || (eZCB_RemoveNode(psZCBNode) != E_ZCB_OK) ||
+        pvBoundNode(u16NewAddress))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "Attribute report benchmark Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -n <nodes>         Number of Zigbee nodes. Default %d.\n", DEFAULT_NODES);
+    fprintf(stderr, "    -r <reports>       Number of reports for each way. Default %d.\n", DEFAULT_REPORTS);
+    fprintf(stderr, "    -p <port>          JIP port. Default %d.\n", JIP_DEFAULT_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint32_t *pu32Sources;
+    uint32_t i;
+    int iResult = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:p:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'n': u32NumNodes = strtoul(optarg, NULL, 0); break;
+            case 'r': u32NumReports = strtoul(optarg, NULL, 0); break;
+            case 'p': iPort = atoi(optarg); break;
+            default: print_usage_exit(argv);
+        }
+    }
+
+    if (!u32NumNodes || (u32NumNodes > 0xF000) || !u32NumReports)
+    {
+        print_usage_exit(argv);
+    }
+
+    srand(1);
+    if (iNetworkStart() != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    pu32Sources = malloc(u32NumReports * sizeof(uint32_t));
+    if (!pu32Sources)
+    {
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < u32NumReports; i++)
+    {
+        pu32Sources[i] = rand() % u32NumNodes;
+    }
+
+    printf("%d nodes, %d reports from random nodes for each way\n", u32NumNodes, u32NumReports);
+    iResult |= iRunPhase(E_PATH_SEARCH, pu32Sources);
+    iResult |= iRunPhase(E_PATH_INDEXED, pu32Sources);
+    iResult |= iRunPhase(E_PATH_BOUND, pu32Sources);
+
+    if (iCheckBinding() != 0)
+    {
+        printf("Binding checks: FAILED\n");
+        iResult = -1;
+    }
+    else
+    {
+        printf("Binding checks: ok\n");
+    }
+
+    free(pu32Sources);
+    eJIP_Destroy(&sServer);
+    return iResult ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,736 @@
+/****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** SetVarsBench makes changes to a colour lamp that each set several
+ *  variables, e.g. on with a new level and colour, and counts the commands
+ *  sent to the lamp and the time for it to complete each change. The lamp is
+ *  served by the daemon's colour lamp handlers behind a JIP server, and a
+ *  client on the same host makes the changes. The control bridge is replaced
+ *  by stand ins for the serial link that take a fixed round trip time to
+ *  acknowledge each command, and apply it to a simulated lamp.
+ *  Each change is made in two ways:
+ *    separate - a set request per variable, as before
+ *    combined - one request setting all of the variables, with eJIP_SetVars
+ *  and each with and without the command queue. For each the bench reports
+ *  the commands sent per change, how many times the lamp showed a state that
+ *  was neither the one it started in nor the one asked for, and the time from
+ *  the first request to the lamp taking the last command.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <libdaemon/daemon.h>
+
+#include "JIP.h"
+#include "JIP_Private.h"
+
+#include "Utils.h"
+#include "SerialLink.h"
+#include "ZigbeeConstant.h"
+#include "ZigbeeNetwork.h"
+#include "ZigbeeCommandQueue.h"
+#include "JIP_BorderRouter.h"
+#include "JIP_ColourLamp.h"
+
+#include "Bench.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define DEFAULT_CHANGES             50
+#define DEFAULT_RTT_MS              50
+#define DEFAULT_PORT                11875
+
+#define LAMP_ADDRESS                "::1"
+#define LAMP_DEVICE_ID              0x08010010
+#define LAMP_SHORT_ADDRESS          0x1000
+#define LAMP_IEEE_ADDRESS           0x00158D0000000000ULL
+
+#define MIB_BULB_CONTROL            0xfffffe04
+#define MIB_COLOUR_CONTROL          0xfffffe0c
+
+/** Longest wait for the lamp to complete a change */
+#define COMPLETE_TIMEOUT_MS         10000
+
+tsJIP_Context sJIP_Context;
+
+/** Variables of the lamp that the changes set */
+typedef enum
+{
+    E_VAR_MODE,
+    E_VAR_LEVEL,
+    E_VAR_HUE,
+    E_VAR_SAT,
+    E_VAR_COLOUR_TEMPERATURE,
+    E_VAR_NUM,
+} teVar;
+
+/** MiB and index of each variable */
+static const struct
+{
+    uint32_t            u32MibId;
+    uint8_t             u8Index;
+    const char          *pcName;
+    teJIP_VarType       eVarType;
+} asVarDefs[E_VAR_NUM] =
+{
+    { MIB_BULB_CONTROL,     0,  "Mode",                 E_JIP_VAR_TYPE_UINT8  },
+    { MIB_BULB_CONTROL,     2,  "LumTarget",            E_JIP_VAR_TYPE_UINT8  },
+    { MIB_COLOUR_CONTROL,   6,  "HueTarget",            E_JIP_VAR_TYPE_UINT16 },
+    { MIB_COLOUR_CONTROL,   7,  "SatTarget",            E_JIP_VAR_TYPE_UINT8  },
+    { MIB_COLOUR_CONTROL,   12, "ColourTempTarget",     E_JIP_VAR_TYPE_UINT16 },
+};
+
+/** State of the simulated lamp, as its user would see it */
+typedef struct
+{
+    uint8_t             u8OnOff;
+    uint8_t             u8Level;
+    uint8_t             u8ColourMode;       /**< 0 hue and saturation, 1 XY, 2 colour temperature */
+    uint8_t             u8Hue;
+    uint8_t             u8Saturation;
+    uint16_t            u16X;
+    uint16_t            u16Y;
+    uint16_t            u16ColourTemperature;
+} tsLampState;
+
+/** A change to the lamp - the variables set and the state it starts from */
+typedef struct
+{
+    const char          *pcName;
+    int                 iNumVars;
+    teVar               aeVars[E_VAR_NUM];
+    int                 bStartOn;
+} tsChange;
+
+static const tsChange asChanges[] =
+{
+    { "on+level",           2, { E_VAR_MODE, E_VAR_LEVEL },                         0 },
+    { "hue+sat",            2, { E_VAR_HUE, E_VAR_SAT },                            1 },
+    { "level+ct",           2, { E_VAR_LEVEL, E_VAR_COLOUR_TEMPERATURE },           1 },
+    { "on+level+hue+sat",   4, { E_VAR_MODE, E_VAR_LEVEL, E_VAR_HUE, E_VAR_SAT },   0 },
+};
+
+static int iChanges         = DEFAULT_CHANGES;
+static int iRttMs           = DEFAULT_RTT_MS;
+static int iPort            = DEFAULT_PORT;
+
+/** Command sent and waiting for its default response. Commands are sent one at a time. */
+static struct
+{
+    uint16_t            u16Type;
+    uint8_t             au8Message[16];
+} sInFlight;
+
+static pthread_mutex_t sLampMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** The simulated lamp, and what it has shown during the current change */
+static struct
+{
+    tsLampState         sState;
+    tsLampState         sStart;
+    tsLampState         sTarget;
+    uint32_t            u32Commands;
+    uint32_t            u32Intermediate;
+    uint64_t            u64Complete;        /**< Time the lamp reached the target */
+} sLamp;
+
+static tsVar *apsClientVars[E_VAR_NUM];
+
+
+/* Stand ins for the border router, which the bench doesn't have */
+tsZCB_Node *psBR_FindZigbeeNode(tsNode *psJIPNode)
+{
+    return psZCB_FindNodeShortAddress(LAMP_SHORT_ADDRESS);
+}
+
+
+uint16_t u16BR_IPv6MulticastToBroadcast(tsJIPAddress *psMulticastAddress)
+{
+    return 0xFFFF;
+}
+
+
+teJIP_Status eJIP_Status_from_ZCB(teZcbStatus eZCB_Status)
+{
+    switch (eZCB_Status)
+    {
+        case (E_ZCB_OK):
+            return E_JIP_OK;
+
+        case (E_ZCB_TIMEOUT):
+        case (E_ZCB_COMMS_FAILED):
+            return E_JIP_ERROR_TIMEOUT;
+
+        default:
+            return E_JIP_ERROR_FAILED;
+    }
+}
+
+
+teZcbStatus eZCB_ReadAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16ClusterID,
+                                      uint8_t u8Direction, uint8_t u8ManufacturerSpecific, uint16_t u16ManufacturerID,
+                                      uint16_t u16AttributeID, void *pvData)
+{
+    return E_ZCB_ERROR;
+}
+
+
+/* Stand ins for the control bridge requests of the lamp handlers that the bench doesn't use */
+teZcbStatus eZCB_LeaveRequest(tsZCB_Node *psZCBNode)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_WriteAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16ClusterID,
+                                       uint8_t u8Direction, uint8_t u8ManufacturerSpecific, uint16_t u16ManufacturerID,
+                                       uint16_t u16AttributeID, teZCL_ZCLAttributeType eType, void *pvData)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_AddGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_RemoveGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_GetGroupMembership(tsZCB_Node *psZCBNode)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_ClearGroupMembership(tsZCB_Node *psZCBNode)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_RemoveScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t u8SceneID)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_StoreScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t u8SceneID)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_RecallScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t u8SceneID)
+{
+    return E_ZCB_ERROR;
+}
+
+
+teZcbStatus eZCB_GetSceneMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t *pu8NumScenes, uint8_t **pau8Scenes)
+{
+    return E_ZCB_ERROR;
+}
+
+
+/* Stand in for the serial link */
+teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
+{
+    sInFlight.u16Type = u16Type;
+    memset(sInFlight.au8Message, 0, sizeof(sInFlight.au8Message));
+    memcpy(sInFlight.au8Message, pvMessage, (u16Length < sizeof(sInFlight.au8Message)) ? u16Length : sizeof(sInFlight.au8Message));
+    *pu8SequenceNo = 0;
+    return E_SL_OK;
+}
+
+
+/* State of the lamp as seen - nothing but off when it is off */
+static int iLampStateEqual(tsLampState *psA, tsLampState *psB)
+{
+    if (!psA->u8OnOff || !psB->u8OnOff)
+    {
+        return psA->u8OnOff == psB->u8OnOff;
+    }
+    if ((psA->u8Level != psB->u8Level) || (psA->u8ColourMode != psB->u8ColourMode))
+    {
+        return 0;
+    }
+    switch (psA->u8ColourMode)
+    {
+        case (0):   return (psA->u8Hue == psB->u8Hue) && (psA->u8Saturation == psB->u8Saturation);
+        case (1):   return (psA->u16X == psB->u16X) && (psA->u16Y == psB->u16Y);
+        default:    return psA->u16ColourTemperature == psB->u16ColourTemperature;
+    }
+}
+
+
+/* The lamp takes the command when it is acknowledged, a round trip after it was sent.
+ * The arguments follow the address mode, address and endpoints. */
+teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo, uint32_t u32TimeoutMs)
+{
+    uint8_t *pu8Args = &sInFlight.au8Message[5];
+    tsLampState *psState = &sLamp.sState;
+
+    vBench_SleepUs((uint64_t)iRttMs * 1000);
+
+    pthread_mutex_lock(&sLampMutex);
+    sLamp.u32Commands++;
+    switch (sInFlight.u16Type)
+    {
+        case (E_SL_MSG_ONOFF):
+            psState->u8OnOff = (pu8Args[0] == 2) ? !psState->u8OnOff : pu8Args[0];
+            break;
+
+        case (E_SL_MSG_MOVE_TO_LEVEL_ONOFF):
+            if (pu8Args[0])
+            {
+                psState->u8OnOff = 1;
+            }
+            psState->u8Level = pu8Args[1];
+            break;
+
+        case (E_SL_MSG_MOVE_TO_HUE):
+            psState->u8ColourMode = 0;
+            psState->u8Hue = pu8Args[0];
+            break;
+
+        case (E_SL_MSG_MOVE_TO_SATURATION):
+            psState->u8ColourMode = 0;
+            psState->u8Saturation = pu8Args[0];
+            break;
+
+        case (E_SL_MSG_MOVE_TO_HUE_SATURATION):
+            psState->u8ColourMode = 0;
+            psState->u8Hue = pu8Args[0];
+            psState->u8Saturation = pu8Args[1];
+            break;
+
+        case (E_SL_MSG_MOVE_TO_COLOUR):
+            psState->u8ColourMode = 1;
+            psState->u16X = (pu8Args[0] << 8) | pu8Args[1];
+            psState->u16Y = (pu8Args[2] << 8) | pu8Args[3];
+            break;
+
+        case (E_SL_MSG_MOVE_TO_COLOUR_TEMPERATURE):
+            psState->u8ColourMode = 2;
+            psState->u16ColourTemperature = (pu8Args[0] << 8) | pu8Args[1];
+            break;
+
+        default:
+            break;
+    }
+
+    if (iLampStateEqual(psState, &sLamp.sTarget))
+    {
+        sLamp.u64Complete = u64Bench_TimeNow();
+    }
+    else if (!iLampStateEqual(psState, &sLamp.sStart))
+    {
+        sLamp.u32Intermediate++;
+    }
+    pthread_mutex_unlock(&sLampMutex);
+    return E_ZCB_OK;
+}
+
+
+/* Control bridge and lamp, with the clusters the ZLL commands look for */
+static int iCreateNetwork(void)
+{
+    vBench_CreateControlBridge();
+
+    return iBench_AddLamp(LAMP_SHORT_ADDRESS, LAMP_IEEE_ADDRESS, 0x0210);
+}
+
+
+/* Serve the lamp with the colour lamp handlers, defining its MiBs without needing a definitions file */
+static int iServerStart(void)
+{
+    tsJIP_Private *psJIP_Private;
+    tsJIPAddress sAddress;
+    tsNode *psTemplate, *psNode;
+    tsZCB_Node *psZCBNode;
+    tsMib *psBulbControl, *psColourControl;
+    teJIP_Status eStatus;
+    int i;
+
+    if (eJIP_Init(&sJIP_Context, E_JIP_CONTEXT_SERVER) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error initialising server\n");
+        return -1;
+    }
+    psJIP_Private = (tsJIP_Private *)sJIP_Context.pvPriv;
+
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    psTemplate = psJIP_NetAllocateNode(NULL, &sAddress, LAMP_DEVICE_ID);
+    psBulbControl   = psTemplate ? psJIP_NodeAddMib(psTemplate, MIB_BULB_CONTROL, 0, "BulbControl") : NULL;
+    psColourControl = psTemplate ? psJIP_NodeAddMib(psTemplate, MIB_COLOUR_CONTROL, 1, "ColourControl") : NULL;
+    if (!psBulbControl || !psColourControl)
+    {
+        fprintf(stderr, "Error defining device\n");
+        return -1;
+    }
+    for (i = 0; i < E_VAR_NUM; i++)
+    {
+        if (!psJIP_MibAddVar((asVarDefs[i].u32MibId == MIB_BULB_CONTROL) ? psBulbControl : psColourControl,
+                             asVarDefs[i].u8Index, asVarDefs[i].pcName, asVarDefs[i].eVarType,
+                             E_JIP_ACCESS_TYPE_READ_WRITE, E_JIP_SECURITY_NONE))
+        {
+            fprintf(stderr, "Error defining device\n");
+            return -1;
+        }
+    }
+    if (Cache_Add_Node(&psJIP_Private->sCache, psTemplate) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error defining device\n");
+        return -1;
+    }
+
+    if (eJIPserver_Listen(&sJIP_Context, iPort) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error starting server\n");
+        return -1;
+    }
+
+    if (eJIPserver_NodeAdd(&sJIP_Context, LAMP_ADDRESS, LAMP_DEVICE_ID, "Lamp", Version, &psNode) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error adding node\n");
+        return -1;
+    }
+
+    /* Give every variable a value, as a lamp's interview would */
+    for (i = 0; i < E_VAR_NUM; i++)
+    {
+        uint32_t u32Zero = 0;
+        tsVar *psVar = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, asVarDefs[i].u32MibId), asVarDefs[i].u8Index);
+
+        eJIP_SetVarValue(psVar, &u32Zero, (asVarDefs[i].eVarType == E_JIP_VAR_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint8_t));
+    }
+
+    psZCBNode = psZCB_FindNodeShortAddress(LAMP_SHORT_ADDRESS);
+    eStatus = eColourLampInitalise(psZCBNode, psNode);
+    eUtils_LockUnlock(&psZCBNode->sLock);
+    eJIP_UnlockNode(psNode);
+
+    if (eStatus != E_JIP_OK)
+    {
+        fprintf(stderr, "Error setting up lamp\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Connect a client and find the lamp's variables */
+static int iClientStart(tsJIP_Context *psContext)
+{
+    tsJIPAddress sAddress;
+    tsNode *psNode;
+    int i;
+
+    if ((eJIP_Init(psContext, E_JIP_CONTEXT_CLIENT) != E_JIP_OK) ||
+        (eJIP_Connect(psContext, LAMP_ADDRESS, iPort) != E_JIP_OK))
+    {
+        fprintf(stderr, "Error connecting client\n");
+        return -1;
+    }
+
+    memset(&sAddress, 0, sizeof(tsJIPAddress));
+    sAddress.sin6_family = AF_INET6;
+    sAddress.sin6_port   = htons(iPort);
+    inet_pton(AF_INET6, LAMP_ADDRESS, &sAddress.sin6_addr);
+
+    if (eJIP_NetAddNode(psContext, &sAddress, LAMP_DEVICE_ID, &psNode) != E_JIP_OK)
+    {
+        fprintf(stderr, "Error discovering node\n");
+        return -1;
+    }
+    for (i = 0; i < E_VAR_NUM; i++)
+    {
+        apsClientVars[i] = psJIP_LookupVarIndex(psJIP_LookupMibId(psNode, NULL, asVarDefs[i].u32MibId), asVarDefs[i].u8Index);
+        if (!apsClientVars[i])
+        {
+            fprintf(stderr, "Variable %s not found\n", asVarDefs[i].pcName);
+            eJIP_UnlockNode(psNode);
+            return -1;
+        }
+    }
+    eJIP_UnlockNode(psNode);
+    return 0;
+}
+
+
+/* Values for the n'th change, each different from the last so none are taken as retransmissions */
+static void vChangeValues(const tsChange *psChange, int iChange, uint32_t *pau32Values, tsLampState *psTarget)
+{
+    uint16_t u16Hue = (iChange * 730) % 3600;
+    uint8_t  u8Sat  = 50 + ((iChange * 53) % 200);
+    int i;
+
+    pau32Values[E_VAR_MODE]                 = 1;
+    pau32Values[E_VAR_LEVEL]                = 10 + ((iChange * 37) % 240);
+    pau32Values[E_VAR_HUE]                  = u16Hue;
+    pau32Values[E_VAR_SAT]                  = u8Sat;
+    pau32Values[E_VAR_COLOUR_TEMPERATURE]   = 153 + ((iChange * 29) % 300);
+
+    /* The target as the lamp handlers send it */
+    for (i = 0; i < psChange->iNumVars; i++)
+    {
+        switch (psChange->aeVars[i])
+        {
+            case (E_VAR_MODE):
+                psTarget->u8OnOff = pau32Values[E_VAR_MODE];
+                break;
+            case (E_VAR_LEVEL):
+                psTarget->u8OnOff = 1;
+                psTarget->u8Level = pau32Values[E_VAR_LEVEL];
+                break;
+            case (E_VAR_HUE):
+                psTarget->u8ColourMode = 0;
+                psTarget->u8Hue = (((int)u16Hue * 0xFEFF) / 3600) >> 8;
+                break;
+            case (E_VAR_SAT):
+                psTarget->u8ColourMode = 0;
+                psTarget->u8Saturation = (u8Sat * 254) / 255;
+                break;
+            case (E_VAR_COLOUR_TEMPERATURE):
+                psTarget->u8ColourMode = 2;
+                psTarget->u16ColourTemperature = pau32Values[E_VAR_COLOUR_TEMPERATURE];
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+
+static int iRunCase(tsJIP_Context *psClient, const tsChange *psChange, int bQueued, int bCombined)
+{
+    tsUtilsHistogram sComplete;
+    tsUtilsHistogramSummary sSummary;
+    uint32_t u32Commands = 0, u32Intermediate = 0, u32Requests = 0, u32Failed = 0;
+    int iChange, i;
+
+    memset(&sComplete, 0, sizeof(sComplete));
+    if (bQueued && (eZCB_CommandQueueStart() != E_ZCB_OK))
+    {
+        return -1;
+    }
+
+    for (iChange = 0; iChange < iChanges; iChange++)
+    {
+        uint32_t au32Values[E_VAR_NUM];
+        tsJIP_SetVarsEntry asEntries[E_VAR_NUM];
+        tsLampState sStart;
+        uint64_t u64Start;
+        teJIP_Status eStatus = E_JIP_OK;
+
+        /* Start from a lamp at a different level and colour */
+        memset(&sStart, 0, sizeof(sStart));
+        sStart.u8OnOff              = psChange->bStartOn;
+        sStart.u8Level              = 5;
+        sStart.u8ColourMode         = 1;
+        sStart.u16X                 = 0x5000;
+        sStart.u16Y                 = 0x5000;
+
+        pthread_mutex_lock(&sLampMutex);
+        sLamp.sState            = sStart;
+        sLamp.sStart            = sStart;
+        sLamp.sTarget           = sStart;
+        sLamp.u32Commands       = 0;
+        sLamp.u32Intermediate   = 0;
+        sLamp.u64Complete       = 0;
+        vChangeValues(psChange, iChange, au32Values, &sLamp.sTarget);
+        pthread_mutex_unlock(&sLampMutex);
+
+        u64Start = u64Bench_TimeNow();
+        for (i = 0; i < psChange->iNumVars; i++)
+        {
+            teVar eVar = psChange->aeVars[i];
+
+            asEntries[i].psVar   = apsClientVars[eVar];
+            asEntries[i].pvData  = &au32Values[eVar];
+            asEntries[i].u32Size = (asVarDefs[eVar].eVarType == E_JIP_VAR_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint8_t);
+
+            /* The values are host order uint32_t, so narrow them in place */
+            if (asEntries[i].u32Size == sizeof(uint16_t))
+            {
+                uint16_t u16Value = au32Values[eVar];
+                memcpy(&au32Values[eVar], &u16Value, sizeof(uint16_t));
+            }
+            else
+            {
+                uint8_t u8Value = au32Values[eVar];
+                memcpy(&au32Values[eVar], &u8Value, sizeof(uint8_t));
+            }
+
+            if (!bCombined && (eStatus == E_JIP_OK))
+            {
+                eStatus = eJIP_SetVar(psClient, asEntries[i].psVar, asEntries[i].pvData, asEntries[i].u32Size, E_JIP_FLAG_NONE);
+                u32Requests++;
+            }
+        }
+        if (bCombined)
+        {
+            eStatus = eJIP_SetVars(psClient, asEntries, psChange->iNumVars, E_JIP_FLAG_NONE, NULL);
+            u32Requests++;
+        }
+        if (eStatus != E_JIP_OK)
+        {
+            u32Failed++;
+        }
+
+        /* Wait for the lamp to take the last command */
+        while (1)
+        {
+            int bDone;
+
+            pthread_mutex_lock(&sLampMutex);
+            bDone = (sLamp.u64Complete != 0) && iLampStateEqual(&sLamp.sState, &sLamp.sTarget);
+            pthread_mutex_unlock(&sLampMutex);
+            if (bDone || (u64Bench_TimeNow() - u64Start > COMPLETE_TIMEOUT_MS * 1000ULL))
+            {
+                break;
+            }
+            vBench_SleepUs(1000);
+        }
+        if (bQueued)
+        {
+            /* Let any commands still queued go before the lamp is reset */
+            vBench_SleepUs((uint64_t)iRttMs * 1000 * 2);
+        }
+
+        pthread_mutex_lock(&sLampMutex);
+        if (sLamp.u64Complete)
+        {
+            vUtils_HistogramRecord(&sComplete, (uint32_t)(sLamp.u64Complete - u64Start));
+        }
+        else
+        {
+            u32Failed++;
+        }
+        u32Commands     += sLamp.u32Commands;
+        u32Intermediate += sLamp.u32Intermediate;
+        pthread_mutex_unlock(&sLampMutex);
+    }
+
+    if (bQueued)
+    {
+        vZCB_CommandQueueFinish();
+    }
+
+    vUtils_HistogramSummarise(&sComplete, &sSummary);
+    printf("%-18s %-7s %-9s %9.2f %9.2f %13.2f %9u %9u %9u %7u\n",
+           psChange->pcName, bQueued ? "queued" : "direct", bCombined ? "combined" : "separate",
+           (double)u32Requests / iChanges, (double)u32Commands / iChanges, (double)u32Intermediate / iChanges,
+           sSummary.u32P50 / 1000, sSummary.u32P99 / 1000, sSummary.u32Max / 1000, u32Failed);
+    return 0;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "SetVarsBench Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s\n", argv[0]);
+    fprintf(stderr, "  Arguments:\n");
+    fprintf(stderr, "    -n --changes   <count>     Changes made each way [%d]\n", DEFAULT_CHANGES);
+    fprintf(stderr, "    -r --rtt       <ms>        Time to acknowledge each command [%d]\n", DEFAULT_RTT_MS);
+    fprintf(stderr, "    -p --port      <port>      Port of the JIP server [%d]\n", DEFAULT_PORT);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    tsJIP_Context sClient;
+    int iCase, bQueued;
+
+    {
+        static struct option long_options[] =
+        {
+            {"changes",                 required_argument,  NULL, 'n'},
+            {"rtt",                     required_argument,  NULL, 'r'},
+            {"port",                    required_argument,  NULL, 'p'},
+            {"help",                    no_argument,        NULL, 'h'},
+            { NULL, 0, NULL, 0}
+        };
+        signed char opt;
+        int option_index;
+
+        while ((opt = getopt_long(argc, argv, "n:r:p:h", long_options, &option_index)) != -1)
+        {
+            switch (opt)
+            {
+                case 'n': iChanges      = atoi(optarg); break;
+                case 'r': iRttMs        = atoi(optarg); break;
+                case 'p': iPort         = atoi(optarg); break;
+                default:
+                    print_usage_exit(argv);
+            }
+        }
+    }
+
+    if ((iChanges < 1) || (iRttMs < 0))
+    {
+        print_usage_exit(argv);
+    }
+
+    if ((iCreateNetwork() != 0) || (iServerStart() != 0) || (iClientStart(&sClient) != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("%d changes each way, %dms round trip per command, times in ms\n", iChanges, iRttMs);
+    printf("%-18s %-7s %-9s %9s %9s %13s %9s %9s %9s %7s\n",
+           "change", "queue", "requests", "req/chg", "cmd/chg", "between/chg", "done p50", "done p99", "done max", "failed");
+    for (iCase = 0; iCase < sizeof(asChanges) / sizeof(asChanges[0]); iCase++)
+    {
+        for (bQueued = 0; bQueued <= 1; bQueued++)
+        {
+            iRunCase(&sClient, &asChanges[iCase], bQueued, 0);
+            iRunCase(&sClient, &asChanges[iCase], bQueued, 1);
+        }
+    }
+
+    eJIP_Destroy(&sClient);
+    return EXIT_SUCCESS;
+}
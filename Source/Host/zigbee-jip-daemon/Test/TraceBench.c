@@ -0,0 +1,281 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee control bridge interface daemon
+ *
+ * COMPONENT:          Serial trace benchmark
+ *
+ * REVISION:           $Revision$
+ *
+ * DATED:              $Date$
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/** TraceBench measures what tracing each serial frame costs the thread
+ *  sending or receiving it, for the hex dump the serial link used to format
+ *  at high verbosity and for the trace ring that replaces it. The dump is
+ *  timed formatting into a buffer only, without the log call that followed.
+ *  Then a writer thread fills the rings while the main thread dumps them
+ *  repeatedly, and every record read back is checked to be intact: the
+ *  payload of each frame is derived from its type, so a record copied while
+ *  it was being overwritten shows up as a mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "SerialTrace.h"
+
+#ifndef VERSION
+#error Version is not defined!
+#else
+const char *Version = "0.1 (r" VERSION ")";
+#endif
+
+#define DEFAULT_FRAMES              1000000
+#define DEFAULT_DUMPS               200
+
+/** Longest frame traced, longer than SL_TRACE_MAX_PAYLOAD to cover truncation */
+#define MAX_FRAME_LENGTH            80
+
+static uint32_t u32NumFrames = DEFAULT_FRAMES;
+static uint32_t u32NumDumps = DEFAULT_DUMPS;
+
+/** Cleared to stop the writer thread */
+static volatile int bWriting;
+
+/** Defeats the compiler dropping the hex dump */
+volatile int iSink;
+
+
+static uint64_t u64TimeNowNs(void)
+{
+    struct timespec sNow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000000) + sNow.tv_nsec;
+}
+
+
+/** Fill the payload of a frame of the given type, returning its length */
+static uint16_t u16MakeFrame(uint16_t u16Type, uint8_t *pu8Data)
+{
+    uint16_t u16Length = u16Type % (MAX_FRAME_LENGTH + 1);
+    int i;
+    
+    for (i = 0; i < u16Length; i++)
+    {
+        pu8Data[i] = (uint8_t)(u16Type + i);
+    }
+    return u16Length;
+}
+
+
+/** The serial link's old hex dump of a frame */
+static void vHexDump(const char *pcDirection, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data)
+{
+    char acBuffer[4096];
+    int iPosition = 0, i;
+    
+    iPosition = sprintf(&acBuffer[iPosition], "%s 0x%04X (Length % 4d)", pcDirection, u16Type, u16Length);
+    for (i = 0; i < u16Length; i++)
+    {
+        iPosition += sprintf(&acBuffer[iPosition], " 0x%02X", pu8Data[i]);
+    }
+    iSink += acBuffer[iPosition - 1];
+}
+
+
+static void *pvWriterThread(void *pvData)
+{
+    uint8_t au8Data[MAX_FRAME_LENGTH];
+    uint32_t u32Frame = 0;
+    
+    while (bWriting)
+    {
+        uint16_t u16Length = u16MakeFrame(u32Frame & 0xFFFF, au8Data);
+        
+        vSL_TraceFrame(u32Frame & 1, u32Frame & 0xFFFF, u16Length, au8Data);
+        u32Frame++;
+    }
+    return NULL;
+}
+
+
+/** Check the records of one dump */
+static int iCheckDump(char *pcDump, size_t stLength, uint32_t *pu32Records)
+{
+    FILE *psStream = fmemopen(pcDump, stLength, "r");
+    tsSL_TraceRecord sRecord;
+    teSL_Status eStatus;
+    uint64_t u64LastTime = 0;
+    int bFirst = 1;
+    int iErrors = 0;
+    int i;
+    
+    if (!psStream)
+    {
+        return 1;
+    }
+    
+    while ((eStatus = eSL_TraceRead(psStream, bFirst, &sRecord)) == E_SL_OK)
+    {
+        uint16_t u16Length = sRecord.u16Type % (MAX_FRAME_LENGTH + 1);
+        
+        bFirst = 0;
+        (*pu32Records)++;
+        
+        if ((sRecord.u8Direction != (sRecord.u16Type & 1)) ||
+            (sRecord.u16Length != u16Length) || (sRecord.u64Time < u64LastTime) ||
+            (sRecord.u8Captured != ((u16Length < SL_TRACE_MAX_PAYLOAD) ? u16Length : SL_TRACE_MAX_PAYLOAD)))
+        {
+            iErrors++;
+            continue;
+        }
+        u64LastTime = sRecord.u64Time;
+        
+        for (i = 0; i < sRecord.u8Captured; i++)
+        {
+            if (sRecord.au8Payload[i] != (uint8_t)(sRecord.u16Type + i))
+            {
+                iErrors++;
+                break;
+            }
+        }
+    }
+    
+    fclose(psStream);
+    return (eStatus == E_SL_NOMESSAGE) ? iErrors : iErrors + 1;
+}
+
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "Serial trace benchmark Version: %s\n", Version);
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -n <frames>        Number of frames to time each way. Default %d.\n", DEFAULT_FRAMES);
+    fprintf(stderr, "    -d <dumps>         Number of dumps to check while frames are written. Default %d.\n", DEFAULT_DUMPS);
+    exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+    uint8_t au8Data[MAX_FRAME_LENGTH];
+    pthread_t sWriter;
+    uint64_t u64Start, u64HexDump, u64Trace;
+    uint32_t u32Records = 0;
+    uint32_t i;
+    int iErrors = 0;
+    int c;
+    
+    while ((c = getopt(argc, argv, "n:d:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'n': u32NumFrames = strtoul(optarg, NULL, 0); break;
+            case 'd': u32NumDumps = strtoul(optarg, NULL, 0); break;
+            default: print_usage_exit(argv);
+        }
+    }
+    
+    if (!u32NumFrames)
+    {
+        print_usage_exit(argv);
+    }
+    
+    printf("%d frames of 0 to %d bytes each way\n", u32NumFrames, MAX_FRAME_LENGTH);
+    
+    u64Start = u64TimeNowNs();
+    for (i = 0; i < u32NumFrames; i++)
+    {
+        uint16_t u16Length = u16MakeFrame(i & 0xFFFF, au8Data);
+        
+        vHexDump("Host->Node", i & 0xFFFF, u16Length, au8Data);
+    }
+    u64HexDump = u64TimeNowNs() - u64Start;
+    
+    u64Start = u64TimeNowNs();
+    for (i = 0; i < u32NumFrames; i++)
+    {
+        uint16_t u16Length = u16MakeFrame(i & 0xFFFF, au8Data);
+        
+        /* Alternate directions as the writer thread does, so both rings hold checkable frames */
+        vSL_TraceFrame(i & 1, i & 0xFFFF, u16Length, au8Data);
+    }
+    u64Trace = u64TimeNowNs() - u64Start;
+    
+    printf("  hex dump: %8.1f ns/frame\n", (double)u64HexDump / u32NumFrames);
+    printf("  trace:    %8.1f ns/frame\n", (double)u64Trace / u32NumFrames);
+    
+    bWriting = 1;
+    if (pthread_create(&sWriter, NULL, pvWriterThread, NULL) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    
+    for (i = 0; i < u32NumDumps; i++)
+    {
+        char *pcDump = NULL;
+        size_t stLength = 0;
+        FILE *psStream = open_memstream(&pcDump, &stLength);
+        
+        if (!psStream)
+        {
+            iErrors++;
+            break;
+        }
+        if (eSL_TraceWrite(psStream) != E_SL_OK)
+        {
+            iErrors++;
+        }
+        fclose(psStream);
+        
+        iErrors += iCheckDump(pcDump, stLength, &u32Records);
+        free(pcDump);
+        
+        /* Let the writer run between dumps on a single CPU */
+        sched_yield();
+    }
+    
+    bWriting = 0;
+    pthread_join(sWriter, NULL);
+    
+    printf("%d dumps while writing, %d records: %s\n", u32NumDumps, u32Records, iErrors ? "FAILED" : "ok");
+    if (iErrors)
+    {
+        printf("  %d bad records\n", iErrors);
+    }
+    return iErrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
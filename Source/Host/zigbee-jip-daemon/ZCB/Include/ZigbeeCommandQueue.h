@@ -0,0 +1,233 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee - JIP daemon
+ *
+ * COMPONENT:          Queue of commands sent to each Zigbee node
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Matt Redfearn
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+#ifndef  ZIGBEECOMMANDQUEUE_H_INCLUDED
+#define  ZIGBEECOMMANDQUEUE_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "Utils.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include "ZigbeeControlBridge.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/** Most commands waiting to be sent to one node */
+#define ZCB_COMMAND_QUEUE_DEPTH         32
+
+/** Time after hearing from a node that sleeps when idle that commands held for it are sent (ms) */
+#define ZCB_COMMAND_MAILBOX_AWAKE_MS    1000
+
+/** Longest a command is held for a node that sleeps when idle before it is dropped (ms) */
+#define ZCB_COMMAND_MAILBOX_HOLD_MS     (10 * 60 * 1000)
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/** Commands that can be queued, each sent by the eZBZLL_ function of the same name,
+ *  or for E_ZCB_COMMAND_WRITE_ATTRIBUTE by eZCB_WriteAttributeRequest */
+typedef enum
+{
+    E_ZCB_COMMAND_ONOFF,
+    E_ZCB_COMMAND_MOVE_TO_LEVEL,
+    E_ZCB_COMMAND_MOVE_TO_HUE,
+    E_ZCB_COMMAND_MOVE_TO_SATURATION,
+    E_ZCB_COMMAND_MOVE_TO_HUE_SATURATION,
+    E_ZCB_COMMAND_MOVE_TO_COLOUR,
+    E_ZCB_COMMAND_MOVE_TO_COLOUR_TEMPERATURE,
+    E_ZCB_COMMAND_MOVE_COLOUR_TEMPERATURE,
+    E_ZCB_COMMAND_COLOUR_LOOP_SET,
+    E_ZCB_COMMAND_WRITE_ATTRIBUTE,
+    E_ZCB_COMMAND_NUM,
+} teZcbCommand;
+
+
+/** A command and its arguments */
+typedef struct
+{
+    teZcbCommand        eCommand;
+    union
+    {
+        struct
+        {
+            uint8_t     u8Mode;
+        } sOnOff;
+        struct
+        {
+            uint8_t     u8OnOff;
+            uint8_t     u8Level;
+            uint16_t    u16TransitionTime;
+        } sMoveToLevel;
+        struct
+        {
+            uint8_t     u8Hue;
+            uint16_t    u16TransitionTime;
+        } sMoveToHue;
+        struct
+        {
+            uint8_t     u8Saturation;
+            uint16_t    u16TransitionTime;
+        } sMoveToSaturation;
+        struct
+        {
+            uint8_t     u8Hue;
+            uint8_t     u8Saturation;
+            uint16_t    u16TransitionTime;
+        } sMoveToHueSaturation;
+        struct
+        {
+            uint16_t    u16X;
+            uint16_t    u16Y;
+            uint16_t    u16TransitionTime;
+        } sMoveToColour;
+        struct
+        {
+            uint16_t    u16ColourTemperature;
+            uint16_t    u16TransitionTime;
+        } sMoveToColourTemperature;
+        struct
+        {
+            uint8_t     u8Mode;
+            uint16_t    u16Rate;
+            uint16_t    u16ColourTemperatureMin;
+            uint16_t    u16ColourTemperatureMax;
+        } sMoveColourTemperature;
+        struct
+        {
+            uint8_t     u8UpdateFlags;
+            uint8_t     u8Action;
+            uint8_t     u8Direction;
+            uint16_t    u16Time;
+            uint16_t    u16StartHue;
+        } sColourLoopSet;
+        struct
+        {
+            uint16_t    u16ClusterID;
+            uint16_t    u16AttributeID;
+            teZCL_ZCLAttributeType eType;
+            uint8_t     au8Data[8];         /**< Value, in host order as eZCB_WriteAttributeRequest takes it */
+        } sWriteAttribute;
+    } uArgs;
+} tsZcbCommand;
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/** Flag to queue commands to nodes, rather than sending each before acknowledging the request */
+extern int              bZCB_CommandQueue;
+
+/** Flag to hold commands for nodes that sleep when idle until they are heard from */
+extern int              bZCB_CommandMailbox;
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+/** Commands to a node are queued and sent in turn by a sender thread, so
+ *  that a request does not wait for the serial round trip and the node's
+ *  default response. While a command waits, a newer command of the same kind
+ *  to the same node takes its place, so a lamp dragged through a stream of
+ *  levels is sent only the latest one. Commands are in two groups: on/off and
+ *  level, and colour. A command only replaces the last waiting command of its
+ *  group, so the order of different commands within a group is kept, e.g. on
+ *  followed by a level. Toggles are never replaced. Nodes with commands
+ *  waiting are served in turn, one command at a time.
+ *  A node that does not listen while idle can only take a command shortly
+ *  after it wakes, and sending at any other time waits out the full timeout
+ *  while every other node's commands wait behind it. Commands for such a
+ *  node are held in its mailbox and skipped over until the node is heard
+ *  from, e.g. by an attribute report, after which they are served in turn
+ *  with the rest for \ref ZCB_COMMAND_MAILBOX_AWAKE_MS.
+ *  Each control bridge has its own sender thread, serving the nodes in its
+ *  network.
+ */
+
+/** Start a sender thread for each control bridge.
+ *  \return E_ZCB_OK on success
+ */
+teZcbStatus eZCB_CommandQueueStart(void);
+
+/** Stop the sender threads and drop any commands still waiting */
+void vZCB_CommandQueueFinish(void);
+
+/** Queue a command to a node, or if \ref bZCB_CommandQueue is not set send it now.
+ *  \param psZCBNode        Locked node to send the command to
+ *  \param psCommand        Command to send
+ *  \return E_ZCB_OK if the command was queued or sent,
+ *          E_ZCB_INSUFFICIENT_SPACE if the node has too many commands waiting,
+ *          otherwise the status of sending it
+ */
+teZcbStatus eZCB_CommandQueue(tsZCB_Node *psZCBNode, tsZcbCommand *psCommand);
+
+/** Send a command to a node now, waiting for its default response.
+ *  \param psZCBNode        Locked node to send the command to. Unlocked as the eZBZLL_ functions do.
+ *  \param psCommand        Command to send
+ *  \return Status of the command
+ */
+teZcbStatus eZCB_CommandSend(tsZCB_Node *psZCBNode, tsZcbCommand *psCommand);
+
+/** Note that a node has been heard from, so send any commands held in its mailbox.
+ *  \param u16ShortAddress  Short address of the node in the selected control bridge's network
+ */
+void vZCB_CommandQueueNodeHeard(uint16_t u16ShortAddress);
+
+/** Write statistics of the command queue to a stream as text */
+void vZCB_CommandQueueStatsDump(FILE *psStream);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif  /* ZIGBEECOMMANDQUEUE_H_INCLUDED */
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
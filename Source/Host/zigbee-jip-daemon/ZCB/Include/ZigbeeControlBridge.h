@@ -40,6 +40,7 @@
 #define  MODULECONFIG_H_INCLUDED
 
 #include <stdint.h>
+#include <stdio.h>
 #include <netinet/in.h>
 #include <sys/time.h>
 
@@ -63,6 +64,10 @@ extern "C" {
 #define CONFIG_DEFAULT_CHANNEL          15
 #define CONFIG_DEFAULT_PANID            0x1234567812345678ll
 
+/** Number of control bridges that may be driven at once. Each is a shard of the
+ *  devices the daemon serves, on its own serial link */
+#define ZCB_MAX_SHARDS                  4
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -124,6 +129,10 @@ typedef enum
     E_ZCB_EVENT_DEVICE_MATCH,           /**< A device responded to a match descriptor request */
     E_ZCB_EVENT_ATTRIBUTE_REPORT,       /**< A device has sent us an attribute report */
     E_ZCB_EVENT_DEVICE_LEFT,            /**< A device has left the network (direct report or detected) */
+    E_ZCB_EVENT_INTERVIEW_RESPONSE,     /**< A device has responded to a request sent while interviewing it */
+    E_ZCB_EVENT_DEVICE_INTERVIEWED,     /**< The interview of a device is complete, and it is ready to join the JIP network */
+    E_ZCB_EVENT_NODES_RESTORED,         /**< Devices were restored from the interview cache, and are ready to join the JIP network.
+                                         *   The handler frees uData.sNodesRestored.pau16ShortAddresses */
 } teZcbEvent;
 
 
@@ -141,6 +150,8 @@ typedef union
 typedef struct
 {
     teZcbEvent                      eEvent;
+    uint64_t                        u64Queued;      /**< Time the event was queued, set by \ref eZCB_QueueEvent */
+    uint8_t                         u8Shard;        /**< Control bridge the event came from, set by \ref eZCB_QueueEvent */
     union {
         struct 
         {
@@ -170,6 +181,23 @@ typedef struct
             uint64_t                u64IEEEAddress;
             uint8_t                 bRejoin;
         } sDeviceLeft;
+        struct
+        {
+            uint16_t                u16MessageType;     /**< Serial link type of the response message */
+            uint16_t                u16ShortAddress;    /**< Responding device. Not known for add group responses */
+            uint16_t                u16GroupAddress;    /**< Group of add group responses */
+            uint8_t                 u8SequenceNo;
+            uint8_t                 u8Status;
+        } sInterviewResponse;
+        struct
+        {
+            uint16_t                u16ShortAddress;
+        } sDeviceInterviewed;
+        struct
+        {
+            uint32_t                u32NumNodes;
+            uint16_t                *pau16ShortAddresses;
+        } sNodesRestored;
     } uData;
 } tsZcbEvent;
 
@@ -245,10 +273,27 @@ typedef struct
 } tsZCB_NodeEndpoint;
 
 
+/** Binding of a node to the application's representation of it.
+ *  Set by the application once the node has joined it, and cleared when the
+ *  node leaves, so that reports from the node can be passed on without
+ *  searching for how to handle them. Read with the node locked. The
+ *  application's node may go away while the Zigbee node is unlocked, so it
+ *  must be found again before it is used.
+ *  Only set, cleared and used by the thread that handles ZCB events.
+ */
+typedef struct
+{
+    void                *pvNode;                /**< Application's node, NULL if not bound */
+    void                *pvContext;             /**< Application's data for the node, e.g. its device type */
+} tsZCB_NodeBinding;
+
+
 typedef struct _tsZCB_Node
 {
     struct _tsZCB_Node  *psNext;
     
+    struct _tsZCB_Node  *psNextShortAddress;    /**< Next node in the same short address hash bucket */
+    
     tsZCB_NodeEndpoint  *pasEndpoints;
     
     uint16_t            *pau16Groups;
@@ -259,6 +304,8 @@ typedef struct _tsZCB_Node
     {
         struct timeval  sLastSuccessful;        /**< Time of last successful communications */
         uint16_t        u16SequentialFailures;  /**< Number of sequential failures */
+        uint16_t        u16Reliability;         /**< Moving average of requests answered, 0xFFFF for all */
+        uint8_t         u8LQI;                  /**< Link quality reported for the node in a neighbour table, 0 if unknown */
     } sComms;                                   /**< Structure containing communications statistics */
     
     uint64_t            u64IEEEAddress;
@@ -271,9 +318,50 @@ typedef struct _tsZCB_Node
     uint8_t             u8MacCapability;
     
     uint8_t             u8LastNeighbourTableIndex;
+    
+    uint8_t             bUnverified;            /**< Described from the interview cache, and not heard from since */
+    
+    uint8_t             u8Shard;                /**< Control bridge whose network the node is in */
+    
+    tsZCB_NodeBinding   sBinding;               /**< Binding to the application's node */
 } tsZCB_Node;
 
 
+/** Classes of request sent to a node, each delivered by its own policy */
+typedef enum
+{
+    E_ZCB_DELIVERY_CONTROL,             /**< Commands that change what a device is doing, e.g. on / off, level, colour */
+    E_ZCB_DELIVERY_CONFIGURE,           /**< Requests that change a device's configuration, e.g. attributes, groups, scenes */
+    E_ZCB_DELIVERY_QUERY,               /**< Requests that read from a device, whose response shows they were delivered */
+    E_ZCB_DELIVERY_NUM,
+} teZcbDeliveryClass;
+
+
+/** How a request is delivered to a node, from \ref vZCB_NodeDeliveryPolicy */
+typedef struct
+{
+    uint16_t            u16ShortAddress;        /**< Node the request is sent to */
+    uint16_t            u16TimeoutMs;           /**< Time to wait for the node's response to each attempt */
+    uint8_t             u8AddressMode;          /**< Address mode to send with, with or without APS ack */
+    uint8_t             u8Retries;              /**< Number of times to send again if the node does not respond */
+    uint8_t             eClass;                 /**< \ref teZcbDeliveryClass of the request */
+} tsZcbDeliveryPolicy;
+
+
+/** A control bridge driven by the daemon, and the network it forms or joins */
+typedef struct
+{
+    char                *pcSerialDevice;        /**< Serial device the control bridge is connected to */
+    teChannel           eChannel;               /**< Channel to operate on, or 0 for \ref eChannel */
+    uint64_t            u64PanID;               /**< Extended PAN ID to use, or 0 for \ref u64PanID */
+    
+    teChannel           eChannelInUse;          /**< Channel in use */
+    uint64_t            u64PanIDInUse;          /**< IEEE802.15.4 extended PAN ID in use */
+    uint16_t            u16PanIDInUse;          /**< IEEE802.15.4 short PAN ID in use */
+    uint32_t            u32SoftwareVersion;     /**< Control bridge software version */
+} tsZCB_Shard;
+
+
 /****************************************************************************/
 /***        Local Function Prototypes                                     ***/
 /****************************************************************************/
@@ -286,35 +374,43 @@ typedef struct _tsZCB_Node
 extern teStartMode      eStartMode;
 
 
-/** Channel number to operate on */
+/** Channel number to operate on, unless a control bridge is given its own */
 extern teChannel        eChannel;
 
 
-/** IEEE802.15.4 extended PAN ID configured */
+/** IEEE802.15.4 extended PAN ID configured, unless a control bridge is given its own */
 extern uint64_t         u64PanID;
 
 
-/** Channel in use */
-extern teChannel        eChannelInUse;
+/** Control bridges driven by the daemon. Filled in before \ref eZCB_Init */
+extern tsZCB_Shard      asZCB_Shards[ZCB_MAX_SHARDS];
 
-/** IEEE802.15.4 extended PAN ID in use */
-extern uint64_t         u64PanIDInUse;
-
-/** IEEE802.15.4 short PAN ID in use */
-extern uint16_t         u16PanIDInUse;
+/** Number of control bridges in \ref asZCB_Shards */
+extern int              iZCB_NumShards;
 
 
 /** Event queue */
 extern tsUtilsQueue     sZcbEventQueue;
 
 
-/** Control bridge software version */
-extern uint32_t         u32ZCB_SoftwareVersion;
-
-
 /** Flag to enable / disable APS acks on packets sent from the control bridge. */
 extern int              bZCB_EnableAPSAck;
 
+/** Flag to choose APS acks, timeouts and retries for each node by how reliably it has responded.
+ *  When not set every request is sent with APS acks if \ref bZCB_EnableAPSAck is set and without
+ *  otherwise, waits 1 second for the response and is not retried. */
+extern int              bZCB_AdaptiveDelivery;
+
+
+/** Time to hold off writing a saved PDM record to the database (ms). A record saved again
+ *  within this time is written once. 0 writes each record before acknowledging it; otherwise
+ *  a record acknowledged within this time of a power failure may be lost. */
+extern uint32_t         u32PDM_DebounceMs;
+
+/** Flag to keep the results of interviews in the PDM store, so that the devices are restored
+ *  without being interviewed again when the daemon restarts. Only used with a PDM store. */
+extern int              bPDM_InterviewCache;
+
 /****************************************************************************/
 /***        Local Variables                                               ***/
 /****************************************************************************/
@@ -324,14 +420,68 @@ extern int              bZCB_EnableAPSAck;
 /****************************************************************************/
 
 
-/** Initialise control bridge connected to serial port */
-teZcbStatus eZCB_Init(char *cpSerialDevice, uint32_t u32BaudRate, char *pcPDMFile);
+/** Initialise the control bridges in \ref asZCB_Shards, each connected to its serial port */
+teZcbStatus eZCB_Init(uint32_t u32BaudRate, char *pcPDMFile);
+
+
+/** Select the control bridge that the calling thread acts on. Requests to the control
+ *  bridge itself are sent to it, and nodes found by short address are looked for in its network.
+ *  A request to a node selects the node's control bridge, so it goes out through it and
+ *  the calling thread is left with it selected.
+ *  Each thread starts with control bridge 0 selected, and the threads that handle
+ *  messages from a control bridge have it selected.
+ *  \param iShard           Index of the control bridge in \ref asZCB_Shards
+ */
+void vZCB_ShardSelect(int iShard);
+
+/** Get the control bridge selected by the calling thread
+ *  \return Index of the control bridge in \ref asZCB_Shards
+ */
+int iZCB_ShardSelected(void);
+
+/** Send a message addressed to a group through every control bridge, as the members
+ *  of the group may be in the network of any of them.
+ *  \param u16Type          Serial message type
+ *  \param u16Length        Length of the message
+ *  \param pvMessage        Message to send
+ *  \return E_ZCB_OK if every control bridge took the message, otherwise E_ZCB_COMMS_FAILED
+ */
+teZcbStatus eZCB_SendGroupMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage);
 
 
 /** Finished with control bridge - call this to tidy up */ 
 teZcbStatus eZCB_Finish(void);
 
-/** Attempt to establish comms with the control bridge.
+/** Write the most recent serial frames exchanged with the control bridge to a stream,
+ *  in the binary format read by zcb-trace-decode.
+ *  \return E_ZCB_OK on success, otherwise E_ZCB_ERROR
+ */
+teZcbStatus eZCB_TraceWrite(FILE *psStream);
+
+/** Start capturing the serial frames exchanged with the control bridge to a file,
+ *  for playing back with zcb-replay.
+ *  \return E_ZCB_OK on success, otherwise E_ZCB_ERROR
+ */
+teZcbStatus eZCB_CaptureStart(const char *pcPath);
+
+/** Stop capturing serial frames */
+teZcbStatus eZCB_CaptureStop(void);
+
+/** Write statistics of the serial links and the event queue to a stream as text.
+ *  \return E_ZCB_OK on success
+ */
+teZcbStatus eZCB_StatsDump(FILE *psStream);
+
+/** Add an event to \ref sZcbEventQueue.
+ *  \return E_ZCB_OK on success, otherwise E_ZCB_ERROR if the queue is full
+ */
+teZcbStatus eZCB_QueueEvent(tsZcbEvent *psEvent);
+
+/** Account for an event taken from \ref sZcbEventQueue, timing how long it waited,
+ *  and select the control bridge it came from */
+void vZCB_EventDequeued(tsZcbEvent *psEvent);
+
+/** Attempt to establish comms with the selected control bridge.
  *  \return E_ZCB_OK when comms established, otherwise E_ZCB_COMMS_FAILED
  */
 teZcbStatus eZCB_EstablishComms(void);
@@ -400,6 +550,25 @@ teZcbStatus eZCB_NodeDescriptorRequest(tsZCB_Node *psZCBNode);
 teZcbStatus eZCB_SimpleDescriptorRequest(tsZCB_Node *psZCBNode, uint8_t u8Endpoint);
 
 
+/** Send an IEEE address request without waiting for the response.
+ *  The response updates the node and raises an \ref E_ZCB_EVENT_INTERVIEW_RESPONSE event.
+ *  \param psZCBNode            Pointer to node to send the request to
+ *  \param pu8SequenceNo[out]   Pointer to location to store the sequence number of the request
+ *  \return E_ZCB_OK if the control bridge accepted the request
+ */
+teZcbStatus eZCB_SendIEEEAddressRequest(tsZCB_Node *psZCBNode, uint8_t *pu8SequenceNo);
+
+/** Send a node descriptor request without waiting for the response.
+ *  The response updates the node and raises an \ref E_ZCB_EVENT_INTERVIEW_RESPONSE event.
+ */
+teZcbStatus eZCB_SendNodeDescriptorRequest(tsZCB_Node *psZCBNode, uint8_t *pu8SequenceNo);
+
+/** Send a simple descriptor request without waiting for the response.
+ *  The response populates the node structure and raises an \ref E_ZCB_EVENT_INTERVIEW_RESPONSE event.
+ */
+teZcbStatus eZCB_SendSimpleDescriptorRequest(tsZCB_Node *psZCBNode, uint8_t u8Endpoint, uint8_t *pu8SequenceNo);
+
+
 /** Send a request for the neighbour table to a node */
 teZcbStatus eZCB_NeighbourTableRequest(tsZCB_Node *psZCBNode);
 
@@ -437,13 +606,20 @@ teZcbStatus eZCB_WriteAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16Cluste
 
 /** Wait for default response to a command with sequence number u8SequenceNo.
  *  \param u8SequenceNo         Sequence number of command to wait for resonse to
+ *  \param u32TimeoutMs         Time to wait for the response, e.g. from the node's \ref tsZcbDeliveryPolicy
  *  \return Status from default response.
  */
-teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo);
+teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo, uint32_t u32TimeoutMs);
 
 /** Add a node to a group */
 teZcbStatus eZCB_AddGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress);
 
+/** Send a request to add a node to a group without waiting for the response.
+ *  The response raises an \ref E_ZCB_EVENT_INTERVIEW_RESPONSE event.
+ *  \return E_ZCB_UNKNOWN_CLUSTER if the node has no groups cluster, E_ZCB_OK if the control bridge accepted the request
+ */
+teZcbStatus eZCB_SendAddGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t *pu8SequenceNo);
+
 /** Remove a node from a group */
 teZcbStatus eZCB_RemoveGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress);
 
@@ -470,6 +646,8 @@ teZcbStatus eZCB_GetSceneMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
  */
 tsZCB_Node *psZCB_FindNodeControlBridge(void);
 
+/** Find a locked node by IEEE address, in the network of the selected control bridge
+ *  and then in the others. The node's u8Shard is the control bridge it is in. */
 tsZCB_Node *psZCB_FindNodeIEEEAddress(uint64_t u64IEEEAddress);
 
 tsZCB_Node *psZCB_FindNodeShortAddress(uint16_t u16ShortAddress);
@@ -0,0 +1,129 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee - JIP daemon
+ *
+ * COMPONENT:          Interview of devices joining the Zigbee network
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Matt Redfearn
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+#ifndef  ZIGBEEINTERVIEW_H_INCLUDED
+#define  ZIGBEEINTERVIEW_H_INCLUDED
+
+#include <stdint.h>
+
+#include "Utils.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include "ZigbeeControlBridge.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/** Group that interviewed devices are added to */
+#define ZCB_INTERVIEW_GROUP_ADDRESS     0xf00f
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/** Maximum number of devices interviewed at once. Further devices wait their turn. */
+extern int              iZCB_InterviewMaxActive;
+
+/** Minimum time between interview requests sent to the network (ms) */
+extern uint32_t         u32ZCB_InterviewIntervalMs;
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+/** Interviews find out what a device is, without waiting for it to respond.
+ *  Each device's interview is a state machine, moved on by its responses,
+ *  which arrive as \ref E_ZCB_EVENT_DEVICE_MATCH and \ref E_ZCB_EVENT_INTERVIEW_RESPONSE
+ *  events, and by timers. Requests that are not answered are retried with
+ *  increasing delays. When a device's interview is complete an
+ *  \ref E_ZCB_EVENT_DEVICE_INTERVIEWED event is raised. If the device stops
+ *  responding part way through, it is removed from the network.
+ *
+ *  Each control bridge interviews the devices in its network, with its own limit
+ *  on active interviews and rate of requests. The functions for one device act
+ *  on the selected control bridge.
+ *
+ *  These functions must all be called from the thread that handles ZCB events.
+ */
+
+/** Start interviewing a device, or move its interview on if it is waiting for a match.
+ *  \param u16ShortAddress      Short address of the device
+ *  \param bMatchDescriptor     True to start by asking the device for endpoints that
+ *                              match the supported devices (on device announce).
+ *                              False if endpoints are already known (on device match).
+ *  \return E_ZCB_OK on success
+ */
+teZcbStatus eZCB_InterviewStart(uint16_t u16ShortAddress, int bMatchDescriptor);
+
+/** Pass an \ref E_ZCB_EVENT_INTERVIEW_RESPONSE event to the device's interview */
+void vZCB_InterviewResponse(tsZcbEvent *psEvent);
+
+/** Stop interviewing a device, e.g. because it has left the network */
+void vZCB_InterviewCancel(uint16_t u16ShortAddress);
+
+/** Send interview requests that are due, and deal with requests that have timed out,
+ *  for every control bridge.
+ *  \return Time until this should next be called (ms)
+ */
+uint32_t u32ZCB_InterviewProcess(void);
+
+/** Stop all interviews */
+void vZCB_InterviewFinish(void);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif  /* ZIGBEEINTERVIEW_H_INCLUDED */
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
+
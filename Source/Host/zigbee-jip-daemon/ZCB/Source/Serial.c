@@ -58,8 +58,6 @@ extern int verbosity;
 
 extern volatile sig_atomic_t bRunning;
 
-static int serial_fd = 0;
-
 static struct termios options;       //place for settings for serial port
 char buf[255];                       //buffer for where data is put
 
@@ -195,16 +193,16 @@ teSerial_Status eSerial_Init(char *name, uint32_t baud, int *piserial_fd)
         return E_SERIAL_ERROR;
     }
     
-    *piserial_fd = serial_fd = fd;
+    *piserial_fd = fd;
     return E_SERIAL_OK;
 }
 
 
-teSerial_Status eSerial_Read(unsigned char *data)
+teSerial_Status eSerial_Read(int iFd, unsigned char *data)
 {
     signed char res;
     
-    res = read(serial_fd,data,1);
+    res = read(iFd,data,1);
     if (res > 0)
     {
         DBG_vPrintf(DBG_SERIAL, "RX 0x%02x\n", *data);
@@ -222,13 +220,13 @@ teSerial_Status eSerial_Read(unsigned char *data)
     return E_SERIAL_OK;
 }
 
-teSerial_Status eSerial_Write(const unsigned char data)
+teSerial_Status eSerial_Write(int iFd, const unsigned char data)
 {
     int err, attempts = 0;
     
     DBG_vPrintf(DBG_SERIAL, "TX 0x%02x\n", data);
     
-    err = write(serial_fd,&data,1);
+    err = write(iFd,&data,1);
     if (err < 0)
     {
         if (errno == EAGAIN)
@@ -236,7 +234,7 @@ teSerial_Status eSerial_Write(const unsigned char data)
             for (attempts = 0; attempts <= 5; attempts++)
             {
                 usleep(1000);
-                err = write(serial_fd,&data,1);
+                err = write(iFd,&data,1);
                 if (err < 0) 
                 {
                     if ((errno == EAGAIN) && (attempts == 5))
@@ -261,11 +259,11 @@ teSerial_Status eSerial_Write(const unsigned char data)
 }
 
 
-teSerial_Status eSerial_ReadBuffer(unsigned char *data, uint32_t *count)
+teSerial_Status eSerial_ReadBuffer(int iFd, unsigned char *data, uint32_t *count)
 {
     int res;
     
-    res = read(serial_fd, data, *count);
+    res = read(iFd, data, *count);
     if (res > 0)
     {
         *count = res;
@@ -287,7 +285,7 @@ teSerial_Status eSerial_ReadBuffer(unsigned char *data, uint32_t *count)
 }
 
 
-teSerial_Status eSerial_WriteBuffer(unsigned char *data, uint32_t count)
+teSerial_Status eSerial_WriteBuffer(int iFd, unsigned char *data, uint32_t count)
 {
     int attempts = 0;
     //printf("send char %d\n", data);
@@ -295,7 +293,7 @@ teSerial_Status eSerial_WriteBuffer(unsigned char *data, uint32_t count)
     
     while (total_sent_bytes < count)
     {
-        sent_bytes = write(serial_fd, &data[total_sent_bytes], count - total_sent_bytes);
+        sent_bytes = write(iFd, &data[total_sent_bytes], count - total_sent_bytes);
         if (sent_bytes <= 0)
         {
             if (errno == EAGAIN)
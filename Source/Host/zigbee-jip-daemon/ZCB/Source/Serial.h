@@ -82,11 +82,11 @@ typedef enum
 /****************************************************************************/
 
 teSerial_Status eSerial_Init(char *name, uint32_t baud, int *piserial_fd);
-teSerial_Status eSerial_Read(unsigned char *data);
-teSerial_Status eSerial_Write(const unsigned char data);
+teSerial_Status eSerial_Read(int iFd, unsigned char *data);
+teSerial_Status eSerial_Write(int iFd, const unsigned char data);
 
-teSerial_Status eSerial_ReadBuffer(unsigned char *data, uint32_t *count);
-teSerial_Status eSerial_WriteBuffer(unsigned char *data, uint32_t count);
+teSerial_Status eSerial_ReadBuffer(int iFd, unsigned char *data, uint32_t *count);
+teSerial_Status eSerial_WriteBuffer(int iFd, unsigned char *data, uint32_t count);
 
 /****************************************************************************/
 /***        Local Functions                                               ***/
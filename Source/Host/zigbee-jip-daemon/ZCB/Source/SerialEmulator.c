@@ -0,0 +1,3490 @@
+/****************************************************************************
+ *
+ * MODULE:             SerialLink
+ *
+ * COMPONENT:          SerialEmulator.c
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Lee Mitchell
+ *
+ * DESCRIPTION:
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+/** zcb-emulator stands in for the control bridge on a pty, with a network of
+ *  virtual lamps and thermostats behind it, so that zigbee-jip-daemon can be
+ *  run and measured at scale without any hardware.
+ *
+ *  It speaks the serial protocol of the control bridge firmware
+ *  (app_Znc_cmds.c): every command is acknowledged with a status carrying a
+ *  sequence number, and commands to the network are answered by the nodes
+ *  they are addressed to, in the form the firmware passes their answers up -
+ *  descriptors, neighbour tables, attribute reads and writes, group and scene
+ *  responses and default responses. Its persistent data is kept in the
+ *  daemon's PDM through the same requests as pdm_host.c, so that either side
+ *  can be restarted and the network resumes.
+ *
+ *  The nodes are routers in a tree below the coordinator, up to the fanout
+ *  of them below each, and join in turn at a set rate once the network has
+ *  formed. Every frame over the air holds the channel for its airtime, so
+ *  traffic queues as it would on a real network, and takes the latency of a
+ *  hop, plus jitter, for each hop between the coordinator and the node.
+ *  Frames are lost with the given probability; those sent with APS acks are
+ *  retried up to 3 times. Thermostats report their temperature at an
+ *  interval, and lamps can report changes to their state.
+ *
+ *  Output to the daemon is paced to the baud rate through a transmit buffer
+ *  of the size of the control bridge's, and frames that don't fit are
+ *  dropped. Statistics are printed as it runs and when it exits.
+ */
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+#include "SerialLink.h"
+#include "SerialPty.h"
+#include "ZigbeeConstant.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/** Defaults for the options */
+#define DEFAULT_LAMPS           100
+#define DEFAULT_THERMOSTATS     0
+#define DEFAULT_JOIN_RATE       50
+#define DEFAULT_FANOUT          20
+#define DEFAULT_HOP_MS          10
+#define DEFAULT_JITTER_MS       5
+#define DEFAULT_AIRTIME_US      2000
+#define DEFAULT_BAUD            1000000
+#define DEFAULT_TX_BUFFER       4096
+#define DEFAULT_REPORT_S        60
+#define DEFAULT_STATS_S         10
+
+/** Firmware version given to the host */
+#define EMULATOR_VERSION        0x00030000
+
+/** Base of the nodes' addresses */
+#define NODE_SHORT_ADDRESS_BASE 0x1000
+#define NODE_IEEE_ADDRESS_BASE  0x00158D0000000000ULL
+
+/** No node */
+#define NO_NODE                 0xFFFFFFFF
+
+/** Groups and scenes each node has room for */
+#define NODE_MAX_GROUPS         16
+#define NODE_MAX_SCENES         16
+
+/** Retries of frames sent with APS acks, and how long each waits for its ack */
+#define APS_MAX_RETRIES         3
+#define APS_ACK_WAIT_US         1600000
+
+/** Time a node takes to act on a frame before it answers */
+#define NODE_PROCESSING_US      1000
+
+/** Time taken to form the network */
+#define FORMATION_US            200000
+
+/** Interval between PDM available requests until the host answers */
+#define PDM_AVAILABLE_RETRY_US  1000000
+
+/** Time to wait for the host to answer a PDM block before giving up on the record */
+#define PDM_TIMEOUT_US          2000000
+
+/** Size of PDM blocks, as pdm_host.c */
+#define PDM_BLOCK_SIZE          128
+
+/** Emulator records, kept clear of the firmware's own record IDs */
+#define PDM_ID_NETWORK          0xE001
+#define PDM_ID_JOINED           0xE002
+
+/** Version of the network record's layout */
+#define PDM_NETWORK_VERSION     1
+
+/** The joined nodes are saved this long after the last join, and never put off for longer than the maximum */
+#define PDM_SAVE_DEBOUNCE_US    1000000
+#define PDM_SAVE_MAX_US         5000000
+
+/** Bytes the serial line can take at once, as a UART FIFO */
+#define LINE_BURST_BYTES        16
+
+/** Lamp endpoints, and the thermostat's */
+#define HA_LAMP_ENDPOINT        1
+#define ZLL_LAMP_ENDPOINT       11
+#define THERMOSTAT_ENDPOINT     1
+
+/** Device IDs */
+#define DEVICE_ID_HA_COLOUR_LAMP    0x0102
+#define DEVICE_ID_ZLL_COLOUR_LAMP   0x0210
+#define DEVICE_ID_HA_THERMOSTAT     0x0301
+
+/** Status values of E_SL_MSG_STATUS */
+#define STATUS_OK                   0
+#define STATUS_INCORRECT_PARAMETERS 1
+#define STATUS_UNHANDLED_COMMAND    2
+#define STATUS_STACK_ALREADY_STARTED 4
+
+/** ZDP status values */
+#define ZDP_SUCCESS                 0x00
+#define ZDP_INVALID_EP              0x82
+#define ZDP_NOT_ACTIVE              0x83
+
+/** ZCL status values */
+#define ZCL_SUCCESS                 0x00
+#define ZCL_MALFORMED_COMMAND       0x80
+#define ZCL_INVALID_FIELD           0x85
+#define ZCL_UNSUPPORTED_ATTRIBUTE   0x86
+#define ZCL_READ_ONLY               0x88
+#define ZCL_INSUFFICIENT_SPACE      0x89
+#define ZCL_DUPLICATE_EXISTS        0x8A
+#define ZCL_NOT_FOUND               0x8B
+#define ZCL_INVALID_DATA_TYPE       0x8D
+#define ZCL_UNSUPPORTED_CLUSTER     0xC3
+
+/** ZCL global commands */
+#define ZCL_WRITE_ATTRIBUTES_RESPONSE 0x04
+
+/** Frame control of a ZCL response from a server, with no default response */
+#define ZCL_FC_SERVER_TO_CLIENT     0x18
+
+/** Bytes of addressing that start every ZCL command from the host */
+#define ZCL_ADDRESS_HEADER          5
+
+/** Bitmap of node types */
+#define TYPES_LAMPS             ((1 << E_NODE_HA_LAMP) | (1 << E_NODE_ZLL_LAMP))
+#define TYPES_THERMOSTAT        (1 << E_NODE_THERMOSTAT)
+#define TYPES_ALL               (TYPES_LAMPS | TYPES_THERMOSTAT)
+
+/** Attribute held in a node field, or a constant */
+#define NODE_FIELD(f)           offsetof(tsNode, f), 0
+#define CONSTANT(v)             -1, v
+
+/** Attributes whose changes a lamp can report */
+#define MAX_CHANGES             8
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+typedef enum
+{
+    E_NODE_HA_LAMP,
+    E_NODE_ZLL_LAMP,
+    E_NODE_THERMOSTAT,
+} teNodeType;
+
+
+/** What the control bridge is doing */
+typedef enum
+{
+    E_STATE_PDM_WAIT,                           /**< Waiting for the host's PDM to answer */
+    E_STATE_PDM_LOAD,                           /**< Loading records from the host's PDM */
+    E_STATE_FACTORY_NEW,                        /**< Waiting for the host to start the network */
+    E_STATE_FORMING,                            /**< Forming the network */
+    E_STATE_RUNNING,                            /**< Network is up */
+} teState;
+
+
+/** A scene, as stored by a lamp */
+typedef struct
+{
+    uint16_t            u16GroupID;
+    uint8_t             u8SceneID;
+    uint8_t             bOn;
+    uint8_t             u8Level;
+    uint8_t             u8ColourMode;
+    uint8_t             u8Hue;
+    uint8_t             u8Saturation;
+    uint16_t            u16X;
+    uint16_t            u16Y;
+    uint16_t            u16ColourTemperature;
+    uint16_t            u16TransitionTime;
+} tsScene;
+
+
+/** A virtual node, with the attributes it keeps */
+typedef struct
+{
+    uint8_t             eType;
+    uint8_t             bJoined;
+    uint8_t             bLeft;                  /**< Told to leave and not rejoin */
+    uint8_t             u8Depth;                /**< Hops from the coordinator */
+    uint8_t             u8NumGroups;
+    uint8_t             u8NumScenes;
+
+    uint16_t            u16IdentifyTime;
+    uint8_t             u8CurrentScene;
+    uint16_t            u16CurrentGroup;
+    uint8_t             bSceneValid;
+
+    uint8_t             bOn;
+    uint8_t             bGlobalSceneControl;
+    uint16_t            u16OnTime;
+    uint16_t            u16OffWaitTime;
+
+    uint8_t             u8Level;
+    uint16_t            u16OnOffTransitionTime;
+    uint8_t             u8OnLevel;
+
+    uint8_t             u8Hue;
+    uint8_t             u8Saturation;
+    uint16_t            u16X;
+    uint16_t            u16Y;
+    uint16_t            u16ColourTemperature;
+    uint8_t             u8ColourMode;
+    uint16_t            u16EnhancedHue;
+    uint8_t             u8EnhancedColourMode;
+
+    int16_t             i16LocalTemperature;
+    uint8_t             u8PICoolingDemand;
+    uint8_t             u8PIHeatingDemand;
+    int16_t             i16OccupiedCoolingSetpoint;
+    int16_t             i16OccupiedHeatingSetpoint;
+    uint8_t             u8SystemMode;
+
+    uint16_t            au16Groups[NODE_MAX_GROUPS];
+    tsScene             asScenes[NODE_MAX_SCENES];
+} tsNode;
+
+
+/** An attribute the nodes have */
+typedef struct
+{
+    uint16_t            u16ClusterID;
+    uint16_t            u16AttributeID;
+    uint8_t             u8Type;
+    uint8_t             u8Types;                /**< Bitmap of the node types that have it */
+    uint8_t             bWritable;
+    int                 iOffset;                /**< Offset of the node field holding it, or -1 for a constant */
+    uint32_t            u32Constant;
+} tsAttribute;
+
+
+/** The endpoint of a type of node */
+typedef struct
+{
+    uint8_t             u8Endpoint;
+    uint16_t            u16ProfileID;
+    uint16_t            u16DeviceID;
+    uint8_t             u8NumClusters;
+    const uint16_t     *pau16Clusters;          /**< Input clusters. The nodes have no output clusters */
+} tsEndpoint;
+
+
+/** A frame to send to the host */
+typedef struct
+{
+    uint16_t            u16Type;
+    uint16_t            u16Length;
+    uint8_t             au8Payload[SL_PTY_MAX_PAYLOAD];
+} tsFrame;
+
+
+/** Something to do at a time: send a frame that has come in over the air, or run a node's report timer */
+typedef struct
+{
+    uint64_t            u64Due;
+    uint32_t            u32Order;               /**< Breaks ties, so that events due together happen in the order they were made */
+    uint32_t            u32Node;                /**< Report timers: the node */
+    uint32_t            u32Boot;                /**< Frames: boot of the control bridge they are for */
+    tsFrame            *psFrame;                /**< Frame to send, or NULL for a report timer */
+} tsEvent;
+
+
+/** A command from the host being carried out by a node */
+typedef struct
+{
+    uint8_t             u8SequenceNo;
+    uint32_t            u32Node;
+    tsNode             *psNode;
+    uint8_t             u8Endpoint;             /**< Source endpoint of the node's answers */
+    uint64_t            u64Arrival;             /**< Time the command reached the node */
+    int                 bUnicast;
+    int                 bAck;                   /**< Sent with APS acks */
+    const uint8_t      *pu8Payload;             /**< Fields following the address header */
+    uint16_t            u16Length;
+    uint16_t            u16ClusterID;
+    uint8_t             u8CommandID;            /**< For the default response */
+    tsFrame             sResponse;              /**< Cluster specific response, if the command has one */
+    uint8_t             u8NumChanged;
+    uint16_t            au16Changed[MAX_CHANGES][2]; /**< Cluster and attribute IDs of attributes changed */
+} tsCommand;
+
+
+/** A ZCL cluster command the nodes understand */
+typedef struct
+{
+    uint16_t            u16MessageType;
+    uint16_t            u16ClusterID;
+    uint8_t             u8CommandID;
+    uint8_t             u8Length;               /**< Length of the command's fields */
+    uint8_t           (*prHandler)(tsCommand *psCommand);
+} tsZclCommand;
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static void vRun(void);
+static void vReport(void);
+static void vBoot(uint64_t u64Now);
+static void vHandleCommand(tsSL_PtyReceiver *psReceiver, uint64_t u64Now);
+
+static uint8_t eIdentify(tsCommand *psCommand);
+static uint8_t eAddGroup(tsCommand *psCommand);
+static uint8_t eViewGroup(tsCommand *psCommand);
+static uint8_t eGetGroupMembership(tsCommand *psCommand);
+static uint8_t eRemoveGroup(tsCommand *psCommand);
+static uint8_t eRemoveAllGroups(tsCommand *psCommand);
+static uint8_t eAddGroupIfIdentify(tsCommand *psCommand);
+static uint8_t eViewScene(tsCommand *psCommand);
+static uint8_t eAddScene(tsCommand *psCommand);
+static uint8_t eRemoveScene(tsCommand *psCommand);
+static uint8_t eRemoveAllScenes(tsCommand *psCommand);
+static uint8_t eStoreScene(tsCommand *psCommand);
+static uint8_t eRecallScene(tsCommand *psCommand);
+static uint8_t eSceneMembership(tsCommand *psCommand);
+static uint8_t eOnOff(tsCommand *psCommand);
+static uint8_t eOnOffTimed(tsCommand *psCommand);
+static uint8_t eOnOffEffect(tsCommand *psCommand);
+static uint8_t eLevelMove(tsCommand *psCommand);
+static uint8_t eLevelMoveToLevel(tsCommand *psCommand);
+static uint8_t eLevelStep(tsCommand *psCommand);
+static uint8_t eLevelStop(tsCommand *psCommand);
+static uint8_t eColourCommand(tsCommand *psCommand);
+static uint8_t eNoAction(tsCommand *psCommand);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+static const uint16_t au16LampClusters[] =
+{
+    E_ZB_CLUSTERID_BASIC, E_ZB_CLUSTERID_IDENTIFY, E_ZB_CLUSTERID_GROUPS, E_ZB_CLUSTERID_SCENES,
+    E_ZB_CLUSTERID_ONOFF, E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_CLUSTERID_COLOR_CONTROL,
+};
+
+static const uint16_t au16ZLLLampClusters[] =
+{
+    E_ZB_CLUSTERID_BASIC, E_ZB_CLUSTERID_IDENTIFY, E_ZB_CLUSTERID_GROUPS, E_ZB_CLUSTERID_SCENES,
+    E_ZB_CLUSTERID_ONOFF, E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_CLUSTERID_COLOR_CONTROL,
+    E_ZB_CLUSTERID_ZLL_COMMISIONING,
+};
+
+static const uint16_t au16ThermostatClusters[] =
+{
+    E_ZB_CLUSTERID_BASIC, E_ZB_CLUSTERID_IDENTIFY, E_ZB_CLUSTERID_GROUPS, E_ZB_CLUSTERID_THERMOSTAT,
+};
+
+static const tsEndpoint asEndpoints[] =
+{
+    [E_NODE_HA_LAMP]    = { HA_LAMP_ENDPOINT,    E_ZB_PROFILEID_HA,  DEVICE_ID_HA_COLOUR_LAMP,
+                            sizeof(au16LampClusters) / sizeof(uint16_t), au16LampClusters },
+    [E_NODE_ZLL_LAMP]   = { ZLL_LAMP_ENDPOINT,   E_ZB_PROFILEID_ZLL, DEVICE_ID_ZLL_COLOUR_LAMP,
+                            sizeof(au16ZLLLampClusters) / sizeof(uint16_t), au16ZLLLampClusters },
+    [E_NODE_THERMOSTAT] = { THERMOSTAT_ENDPOINT, E_ZB_PROFILEID_HA,  DEVICE_ID_HA_THERMOSTAT,
+                            sizeof(au16ThermostatClusters) / sizeof(uint16_t), au16ThermostatClusters },
+};
+
+static const tsAttribute asAttributes[] =
+{
+    { E_ZB_CLUSTERID_BASIC,         E_ZB_ATTRIBUTEID_BASIC_ZCL_VERSION,     E_ZCL_UINT8,  TYPES_ALL,        0, CONSTANT(1) },
+    { E_ZB_CLUSTERID_BASIC,         E_ZB_ATTRIBUTEID_BASIC_APP_VERSION,     E_ZCL_UINT8,  TYPES_ALL,        0, CONSTANT(1) },
+    { E_ZB_CLUSTERID_BASIC,         E_ZB_ATTRIBUTEID_BASIC_STACK_VERSION,   E_ZCL_UINT8,  TYPES_ALL,        0, CONSTANT(2) },
+    { E_ZB_CLUSTERID_BASIC,         E_ZB_ATTRIBUTEID_BASIC_HW_VERSION,      E_ZCL_UINT8,  TYPES_ALL,        0, CONSTANT(1) },
+    { E_ZB_CLUSTERID_BASIC,         E_ZB_ATTRIBUTEID_BASIC_POWER_SOURCE,    E_ZCL_ENUM8,  TYPES_ALL,        0, CONSTANT(1) },
+
+    { E_ZB_CLUSTERID_IDENTIFY,      0x0000,                                 E_ZCL_UINT16, TYPES_ALL,        1, NODE_FIELD(u16IdentifyTime) },
+
+    { E_ZB_CLUSTERID_GROUPS,        0x0000,                                 E_ZCL_BMAP8,  TYPES_ALL,        0, CONSTANT(0) },
+
+    { E_ZB_CLUSTERID_SCENES,        E_ZB_ATTRIBUTEID_SCENE_SCENECOUNT,      E_ZCL_UINT8,  TYPES_LAMPS,      0, NODE_FIELD(u8NumScenes) },
+    { E_ZB_CLUSTERID_SCENES,        E_ZB_ATTRIBUTEID_SCENE_CURRENTSCENE,    E_ZCL_UINT8,  TYPES_LAMPS,      0, NODE_FIELD(u8CurrentScene) },
+    { E_ZB_CLUSTERID_SCENES,        E_ZB_ATTRIBUTEID_SCENE_CURRENTGROUP,    E_ZCL_UINT16, TYPES_LAMPS,      0, NODE_FIELD(u16CurrentGroup) },
+    { E_ZB_CLUSTERID_SCENES,        E_ZB_ATTRIBUTEID_SCENE_SCENEVALID,      E_ZCL_BOOL,   TYPES_LAMPS,      0, NODE_FIELD(bSceneValid) },
+    { E_ZB_CLUSTERID_SCENES,        E_ZB_ATTRIBUTEID_SCENE_NAMESUPPORT,     E_ZCL_BMAP8,  TYPES_LAMPS,      0, CONSTANT(0) },
+
+    { E_ZB_CLUSTERID_ONOFF,         E_ZB_ATTRIBUTEID_ONOFF_ONOFF,           E_ZCL_BOOL,   TYPES_LAMPS,      0, NODE_FIELD(bOn) },
+    { E_ZB_CLUSTERID_ONOFF,         E_ZB_ATTRIBUTEID_ONOFF_GLOBALSCENE,     E_ZCL_BOOL,   TYPES_LAMPS,      0, NODE_FIELD(bGlobalSceneControl) },
+    { E_ZB_CLUSTERID_ONOFF,         E_ZB_ATTRIBUTEID_ONOFF_ONTIME,          E_ZCL_UINT16, TYPES_LAMPS,      1, NODE_FIELD(u16OnTime) },
+    { E_ZB_CLUSTERID_ONOFF,         E_ZB_ATTRIBUTEID_ONOFF_OFFWAITTIME,     E_ZCL_UINT16, TYPES_LAMPS,      1, NODE_FIELD(u16OffWaitTime) },
+
+    { E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_ATTRIBUTEID_LEVEL_CURRENTLEVEL,    E_ZCL_UINT8,  TYPES_LAMPS,      0, NODE_FIELD(u8Level) },
+    { E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_ATTRIBUTEID_LEVEL_REMAININGTIME,   E_ZCL_UINT16, TYPES_LAMPS,      0, CONSTANT(0) },
+    { E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_ATTRIBUTEID_LEVEL_ONOFFTRANSITION, E_ZCL_UINT16, TYPES_LAMPS,      1, NODE_FIELD(u16OnOffTransitionTime) },
+    { E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_ATTRIBUTEID_LEVEL_ONLEVEL,         E_ZCL_UINT8,  TYPES_LAMPS,      1, NODE_FIELD(u8OnLevel) },
+
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTHUE,     E_ZCL_UINT8,  TYPES_LAMPS,      0, NODE_FIELD(u8Hue) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTSAT,     E_ZCL_UINT8,  TYPES_LAMPS,      0, NODE_FIELD(u8Saturation) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_REMAININGTIME,  E_ZCL_UINT16, TYPES_LAMPS,      0, CONSTANT(0) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTX,       E_ZCL_UINT16, TYPES_LAMPS,      0, NODE_FIELD(u16X) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTY,       E_ZCL_UINT16, TYPES_LAMPS,      0, NODE_FIELD(u16Y) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_COLOURTEMPERATURE, E_ZCL_UINT16, TYPES_LAMPS,   0, NODE_FIELD(u16ColourTemperature) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_COLOURMODE,     E_ZCL_ENUM8,  TYPES_LAMPS,      0, NODE_FIELD(u8ColourMode) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, 0x4000, /* Enhanced hue */              E_ZCL_UINT16, TYPES_LAMPS,      0, NODE_FIELD(u16EnhancedHue) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, 0x4001, /* Enhanced colour mode */      E_ZCL_ENUM8,  TYPES_LAMPS,      0, NODE_FIELD(u8EnhancedColourMode) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, 0x4002, /* Colour loop active */        E_ZCL_UINT8,  TYPES_LAMPS,      0, CONSTANT(0) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, 0x400A, /* Colour capabilities */       E_ZCL_BMAP16, TYPES_LAMPS,      0, CONSTANT(0x001F) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_COLOURTEMP_PHYMIN, E_ZCL_UINT16, TYPES_LAMPS,   0, CONSTANT(153) },
+    { E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_COLOURTEMP_PHYMAX, E_ZCL_UINT16, TYPES_LAMPS,   0, CONSTANT(500) },
+
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_LOCALTEMPERATURE,        E_ZCL_INT16, TYPES_THERMOSTAT, 0, NODE_FIELD(i16LocalTemperature) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_ABSMINHEATSETPOINTLIMIT, E_ZCL_INT16, TYPES_THERMOSTAT, 0, CONSTANT(700) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_ABSMAXHEATSETPOINTLIMIT, E_ZCL_INT16, TYPES_THERMOSTAT, 0, CONSTANT(3000) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_PICOOLINGDEMAND,         E_ZCL_UINT8, TYPES_THERMOSTAT, 0, NODE_FIELD(u8PICoolingDemand) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_PIHEATINGDEMAND,         E_ZCL_UINT8, TYPES_THERMOSTAT, 0, NODE_FIELD(u8PIHeatingDemand) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_OCCUPIEDCOOLSETPOINT,    E_ZCL_INT16, TYPES_THERMOSTAT, 1, NODE_FIELD(i16OccupiedCoolingSetpoint) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_OCCUPIEDHEATSETPOINT,    E_ZCL_INT16, TYPES_THERMOSTAT, 1, NODE_FIELD(i16OccupiedHeatingSetpoint) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_COLTROLSEQUENCEOFOPERATION, E_ZCL_ENUM8, TYPES_THERMOSTAT, 0, CONSTANT(4) },
+    { E_ZB_CLUSTERID_THERMOSTAT,    E_ZB_ATTRIBUTEID_TSTAT_SYSTEMMODE,              E_ZCL_ENUM8, TYPES_THERMOSTAT, 1, NODE_FIELD(u8SystemMode) },
+};
+
+static const tsZclCommand asZclCommands[] =
+{
+    { E_SL_MSG_IDENTIFY_SEND,               E_ZB_CLUSTERID_IDENTIFY,      0x00, 2, eIdentify },
+    { E_SL_MSG_IDENTIFY_QUERY,              E_ZB_CLUSTERID_IDENTIFY,      0x01, 0, eNoAction },
+    { E_SL_MSG_IDENTIFY_TRIGGER_EFFECT,     E_ZB_CLUSTERID_IDENTIFY,      0x40, 2, eNoAction },
+
+    { E_SL_MSG_ADD_GROUP_REQUEST,           E_ZB_CLUSTERID_GROUPS,        0x00, 2, eAddGroup },
+    { E_SL_MSG_VIEW_GROUP,                  E_ZB_CLUSTERID_GROUPS,        0x01, 2, eViewGroup },
+    { E_SL_MSG_GET_GROUP_MEMBERSHIP_REQUEST,E_ZB_CLUSTERID_GROUPS,        0x02, 1, eGetGroupMembership },
+    { E_SL_MSG_REMOVE_GROUP_REQUEST,        E_ZB_CLUSTERID_GROUPS,        0x03, 2, eRemoveGroup },
+    { E_SL_MSG_REMOVE_ALL_GROUPS,           E_ZB_CLUSTERID_GROUPS,        0x04, 0, eRemoveAllGroups },
+    { E_SL_MSG_ADD_GROUP_IF_IDENTIFY,       E_ZB_CLUSTERID_GROUPS,        0x05, 2, eAddGroupIfIdentify },
+
+    { E_SL_MSG_ADD_SCENE,                   E_ZB_CLUSTERID_SCENES,        0x00, 7, eAddScene },
+    { E_SL_MSG_VIEW_SCENE,                  E_ZB_CLUSTERID_SCENES,        0x01, 3, eViewScene },
+    { E_SL_MSG_REMOVE_SCENE,                E_ZB_CLUSTERID_SCENES,        0x02, 3, eRemoveScene },
+    { E_SL_MSG_REMOVE_ALL_SCENES,           E_ZB_CLUSTERID_SCENES,        0x03, 2, eRemoveAllScenes },
+    { E_SL_MSG_STORE_SCENE,                 E_ZB_CLUSTERID_SCENES,        0x04, 3, eStoreScene },
+    { E_SL_MSG_RECALL_SCENE,                E_ZB_CLUSTERID_SCENES,        0x05, 3, eRecallScene },
+    { E_SL_MSG_SCENE_MEMBERSHIP_REQUEST,    E_ZB_CLUSTERID_SCENES,        0x06, 2, eSceneMembership },
+
+    { E_SL_MSG_ONOFF,                       E_ZB_CLUSTERID_ONOFF,         0x00, 1, eOnOff },
+    { E_SL_MSG_ONOFF_TIMED,                 E_ZB_CLUSTERID_ONOFF,         0x42, 5, eOnOffTimed },
+    { E_SL_MSG_ONOFF_EFFECTS,               E_ZB_CLUSTERID_ONOFF,         0x40, 2, eOnOffEffect },
+
+    { E_SL_MSG_MOVE_TO_LEVEL,               E_ZB_CLUSTERID_LEVEL_CONTROL, 0x01, 3, eLevelMove },
+    { E_SL_MSG_MOVE_TO_LEVEL_ONOFF,         E_ZB_CLUSTERID_LEVEL_CONTROL, 0x00, 4, eLevelMoveToLevel },
+    { E_SL_MSG_MOVE_STEP,                   E_ZB_CLUSTERID_LEVEL_CONTROL, 0x02, 5, eLevelStep },
+    { E_SL_MSG_MOVE_STOP_MOVE,              E_ZB_CLUSTERID_LEVEL_CONTROL, 0x03, 0, eLevelStop },
+    { E_SL_MSG_MOVE_STOP_ONOFF,             E_ZB_CLUSTERID_LEVEL_CONTROL, 0x07, 0, eLevelStop },
+
+    { E_SL_MSG_MOVE_TO_HUE,                 E_ZB_CLUSTERID_COLOR_CONTROL, 0x00, 4, eColourCommand },
+    { E_SL_MSG_MOVE_HUE,                    E_ZB_CLUSTERID_COLOR_CONTROL, 0x01, 2, eColourCommand },
+    { E_SL_MSG_STEP_HUE,                    E_ZB_CLUSTERID_COLOR_CONTROL, 0x02, 3, eColourCommand },
+    { E_SL_MSG_MOVE_TO_SATURATION,          E_ZB_CLUSTERID_COLOR_CONTROL, 0x03, 3, eColourCommand },
+    { E_SL_MSG_MOVE_SATURATION,             E_ZB_CLUSTERID_COLOR_CONTROL, 0x04, 2, eColourCommand },
+    { E_SL_MSG_STEP_SATURATION,             E_ZB_CLUSTERID_COLOR_CONTROL, 0x05, 3, eColourCommand },
+    { E_SL_MSG_MOVE_TO_HUE_SATURATION,      E_ZB_CLUSTERID_COLOR_CONTROL, 0x06, 4, eColourCommand },
+    { E_SL_MSG_MOVE_TO_COLOUR,              E_ZB_CLUSTERID_COLOR_CONTROL, 0x07, 6, eColourCommand },
+    { E_SL_MSG_MOVE_COLOUR,                 E_ZB_CLUSTERID_COLOR_CONTROL, 0x08, 4, eColourCommand },
+    { E_SL_MSG_STEP_COLOUR,                 E_ZB_CLUSTERID_COLOR_CONTROL, 0x09, 6, eColourCommand },
+    { E_SL_MSG_MOVE_TO_COLOUR_TEMPERATURE,  E_ZB_CLUSTERID_COLOR_CONTROL, 0x0A, 4, eColourCommand },
+    { E_SL_MSG_ENHANCED_MOVE_TO_HUE,        E_ZB_CLUSTERID_COLOR_CONTROL, 0x40, 5, eColourCommand },
+    { E_SL_MSG_ENHANCED_MOVE_HUE,           E_ZB_CLUSTERID_COLOR_CONTROL, 0x41, 3, eColourCommand },
+    { E_SL_MSG_ENHANCED_STEP_HUE,           E_ZB_CLUSTERID_COLOR_CONTROL, 0x42, 5, eColourCommand },
+    { E_SL_MSG_ENHANCED_MOVE_TO_HUE_SATURATION, E_ZB_CLUSTERID_COLOR_CONTROL, 0x43, 5, eColourCommand },
+    { E_SL_MSG_COLOUR_LOOP_SET,             E_ZB_CLUSTERID_COLOR_CONTROL, 0x44, 7, eColourCommand },
+    { E_SL_MSG_STOP_MOVE_STEP,              E_ZB_CLUSTERID_COLOR_CONTROL, 0x47, 0, eColourCommand },
+    { E_SL_MSG_MOVE_COLOUR_TEMPERATURE,     E_ZB_CLUSTERID_COLOR_CONTROL, 0x4B, 7, eColourCommand },
+    { E_SL_MSG_STEP_COLOUR_TEMPERATURE,     E_ZB_CLUSTERID_COLOR_CONTROL, 0x4C, 9, eColourCommand },
+};
+
+/** Options */
+static uint32_t         u32NumLamps = DEFAULT_LAMPS;
+static uint32_t         u32NumThermostats = DEFAULT_THERMOSTATS;
+static uint32_t         u32JoinRate = DEFAULT_JOIN_RATE;
+static uint32_t         u32Fanout = DEFAULT_FANOUT;
+static uint32_t         u32HopUs = DEFAULT_HOP_MS * 1000;
+static uint32_t         u32JitterUs = DEFAULT_JITTER_MS * 1000;
+static double           dLoss = 0;
+static uint32_t         u32AirtimeUs = DEFAULT_AIRTIME_US;
+static uint32_t         u32Baud = DEFAULT_BAUD;
+static uint32_t         u32TxBufferSize = DEFAULT_TX_BUFFER;
+static uint32_t         u32ReportIntervalUs = DEFAULT_REPORT_S * 1000000;
+static int              bReportChanges = 0;
+static uint32_t         u32StatsIntervalUs = DEFAULT_STATS_S * 1000000;
+static uint32_t         u32Seed = 1;
+/** Base of the nodes' IEEE addresses, moved by -i so that emulators run side by side don't share addresses */
+static uint64_t         u64IEEEAddressBase = NODE_IEEE_ADDRESS_BASE;
+
+static tsNode          *asNodes = NULL;
+static uint32_t         u32NumNodes = 0;
+
+/** Nodes a command is addressed to */
+static uint32_t        *pu32Targets = NULL;
+
+/** Events, as a heap ordered by due time */
+static tsEvent         *asEvents = NULL;
+static uint32_t         u32NumEvents = 0;
+static uint32_t         u32MaxEvents = 0;
+static uint32_t         u32EventOrder = 0;
+
+/** Time the channel is next free */
+static uint64_t         u64AirFree = 0;
+
+/** Time the serial line will have sent everything written to it */
+static uint64_t         u64LineTime = 0;
+
+static uint32_t         u32RandomState;
+
+static tsSL_Pty         sPty;
+static tsSL_PtyReceiver sReceiver;
+
+static volatile sig_atomic_t bRunning = 1;
+
+/** The control bridge */
+static struct
+{
+    teState             eState;
+    uint32_t            u32Boot;                /**< Counts boots, so that frames in the air are forgotten by a reset */
+    uint64_t            u64StateTimer;          /**< Time the current state moves on (PDM available retries, formation) */
+    int                 bFormed;                /**< A network has been formed, and is kept in the PDM */
+    uint32_t            u32ChannelMask;
+    uint64_t            u64ExtPanIDSet;         /**< Extended PAN ID set by the host, 0 to choose one */
+    uint8_t             u8Channel;
+    uint16_t            u16PanID;
+    uint64_t            u64ExtPanID;
+    uint8_t             u8SequenceNo;
+    uint8_t             u8ReportSequenceNo;
+    uint32_t            u32NextJoin;            /**< Next node to try to join */
+    uint64_t            u64NextJoinTime;
+} sBridge;
+
+/** Records being loaded from or saved to the host's PDM. The firmware does nothing
+ *  else while it waits for the host, and neither does the emulator */
+static struct
+{
+    uint16_t            u16RecordID;            /**< Record being loaded or saved, 0 for none */
+    int                 bSaving;
+    uint8_t            *pu8Data;
+    uint32_t            u32Size;
+    uint32_t            u32Received;            /**< Loads: bytes received so far */
+    uint32_t            u32Block;               /**< Saves: blocks sent so far */
+    uint32_t            u32NumBlocks;
+    uint64_t            u64Timeout;
+    int                 bTrailer;               /**< The host follows the last block of a record with an empty response */
+
+    int                 bSaveNetwork;           /**< The network record needs saving */
+    uint64_t            u64SaveJoinedDue;       /**< Time to save the joined nodes record, 0 if it doesn't need it */
+    uint64_t            u64SaveJoinedLatest;
+} sPdm;
+
+/** Statistics */
+static struct
+{
+    uint64_t            u64Start;
+    uint32_t            u32Joined;
+    uint32_t            u32Commands;
+    uint32_t            u32CommandsUnhandled;
+    uint32_t            u32CommandsIgnored;     /**< Arrived while the control bridge was busy with the PDM */
+    uint32_t            u32FramesSent;
+    uint32_t            u32Responses;
+    uint32_t            u32Reports;
+    uint32_t            u32Announces;
+    uint32_t            u32AirFrames;
+    uint32_t            u32AirLost;             /**< Frames lost over the air, including ones that were retried */
+    uint32_t            u32AirFailed;           /**< Frames that never got through */
+    uint32_t            u32Forgotten;           /**< Frames that arrived after a reset */
+    uint64_t            u64AirBacklogMax;
+    uint32_t            u32PdmSaves;
+    uint32_t            u32PdmLoads;
+
+    uint32_t            u32LastCommands;
+    uint32_t            u32LastFramesSent;
+    uint64_t            u64LastTime;
+} sStats;
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -l <link>          Symbolic link to create to the pty, to pass to zigbee-jip-daemon -s.\n");
+    fprintf(stderr, "    -n <lamps>         Number of colour lamps, half HA and half ZLL. Default %d.\n", DEFAULT_LAMPS);
+    fprintf(stderr, "    -t <thermostats>   Number of thermostats. Default %d.\n", DEFAULT_THERMOSTATS);
+    fprintf(stderr, "    -j <rate>          Nodes joining per second once the network has formed. Default %d.\n", DEFAULT_JOIN_RATE);
+    fprintf(stderr, "    -f <fanout>        Nodes below each router in the tree, up to 255. Default %d.\n", DEFAULT_FANOUT);
+    fprintf(stderr, "    -d <ms>            Latency of each hop. Default %d.\n", DEFAULT_HOP_MS);
+    fprintf(stderr, "    -J <ms>            Most jitter added to each hop. Default %d.\n", DEFAULT_JITTER_MS);
+    fprintf(stderr, "    -p <percent>       Chance of a frame being lost over the air. Default 0.\n");
+    fprintf(stderr, "    -a <us>            Time each frame holds the channel. Default %d.\n", DEFAULT_AIRTIME_US);
+    fprintf(stderr, "    -B <baud>          Baud rate of the serial line to the daemon, 0 for no limit. Default %d.\n", DEFAULT_BAUD);
+    fprintf(stderr, "    -b <bytes>         Size of the transmit buffer; frames that don't fit are dropped. Default %d.\n", DEFAULT_TX_BUFFER);
+    fprintf(stderr, "    -r <seconds>       Interval between thermostat temperature reports, 0 for none. Default %d.\n", DEFAULT_REPORT_S);
+    fprintf(stderr, "    -c                 Lamps report changes to their state.\n");
+    fprintf(stderr, "    -s <seconds>       Interval between statistics, 0 for only at exit. Default %d.\n", DEFAULT_STATS_S);
+    fprintf(stderr, "    -S <seed>          Seed for the random numbers. Default 1.\n");
+    fprintf(stderr, "    -i <instance>      Instance number, giving the nodes distinct IEEE addresses from other emulators. Default 0.\n");
+    exit(EXIT_FAILURE);
+}
+
+
+static void vQuitSignalHandler(int sig)
+{
+    bRunning = 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *pcLink = NULL;
+    uint32_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "l:n:t:j:f:d:J:p:a:B:b:r:cs:S:i:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'l': pcLink = optarg; break;
+            case 'n': u32NumLamps = strtoul(optarg, NULL, 0); break;
+            case 't': u32NumThermostats = strtoul(optarg, NULL, 0); break;
+            case 'j': u32JoinRate = strtoul(optarg, NULL, 0); break;
+            case 'f': u32Fanout = strtoul(optarg, NULL, 0); break;
+            case 'd': u32HopUs = strtoul(optarg, NULL, 0) * 1000; break;
+            case 'J': u32JitterUs = strtoul(optarg, NULL, 0) * 1000; break;
+            case 'p': dLoss = atof(optarg) / 100.0; break;
+            case 'a': u32AirtimeUs = strtoul(optarg, NULL, 0); break;
+            case 'B': u32Baud = strtoul(optarg, NULL, 0); break;
+            case 'b': u32TxBufferSize = strtoul(optarg, NULL, 0); break;
+            case 'r': u32ReportIntervalUs = strtoul(optarg, NULL, 0) * 1000000; break;
+            case 'c': bReportChanges = 1; break;
+            case 's': u32StatsIntervalUs = strtoul(optarg, NULL, 0) * 1000000; break;
+            case 'S': u32Seed = strtoul(optarg, NULL, 0); break;
+            case 'i': u64IEEEAddressBase = NODE_IEEE_ADDRESS_BASE + ((uint64_t)strtoul(optarg, NULL, 0) << 32); break;
+            default: print_usage_exit(argv);
+        }
+    }
+
+    u32NumNodes = u32NumLamps + u32NumThermostats;
+    if ((optind != argc) || (u32NumNodes == 0) || (u32NumNodes > (0xFFF8 - NODE_SHORT_ADDRESS_BASE)) ||
+        (u32JoinRate == 0) || (u32Fanout == 0) || (u32Fanout > 255) ||
+        (dLoss < 0) || (dLoss >= 1) || (u32TxBufferSize < SL_PTY_MAX_FRAME_BYTES))
+    {
+        print_usage_exit(argv);
+    }
+
+    asNodes = calloc(u32NumNodes, sizeof(tsNode));
+    pu32Targets = malloc(sizeof(uint32_t) * u32NumNodes);
+    u32MaxEvents = u32NumNodes + 1024;
+    asEvents = malloc(sizeof(tsEvent) * u32MaxEvents);
+    if (!asNodes || !pu32Targets || !asEvents)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    u32RandomState = u32Seed ? u32Seed : 1;
+    for (i = 0; i < u32NumNodes; i++)
+    {
+        tsNode *psNode = &asNodes[i];
+
+        if (i < u32NumLamps)
+        {
+            psNode->eType = (i & 1) ? E_NODE_ZLL_LAMP : E_NODE_HA_LAMP;
+        }
+        else
+        {
+            psNode->eType = E_NODE_THERMOSTAT;
+        }
+        psNode->u8Depth = (i < u32Fanout) ? 1 : (asNodes[(i / u32Fanout) - 1].u8Depth + 1);
+
+        psNode->u8Level = 0xFE;
+        psNode->u8OnLevel = 0xFF;
+        psNode->u8Saturation = 0xFE;
+        psNode->u16X = 0x616B;
+        psNode->u16Y = 0x607D;
+        psNode->u16ColourTemperature = 250;
+        psNode->u8ColourMode = 2;
+        psNode->u8EnhancedColourMode = 2;
+        psNode->bGlobalSceneControl = 1;
+
+        psNode->i16LocalTemperature = 2000;
+        psNode->i16OccupiedCoolingSetpoint = 2600;
+        psNode->i16OccupiedHeatingSetpoint = 2000;
+        psNode->u8SystemMode = 1;
+    }
+
+    if (eSL_PtyOpen(&sPty, pcLink, u32TxBufferSize) != E_SL_OK)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("Emulating a control bridge with %u lamps and %u thermostats, %u deep\n",
+           u32NumLamps, u32NumThermostats, asNodes[u32NumNodes - 1].u8Depth);
+    fflush(stdout);
+
+    signal(SIGINT, vQuitSignalHandler);
+    signal(SIGTERM, vQuitSignalHandler);
+
+    vRun();
+    vReport();
+
+    vSL_PtyClose(&sPty);
+    return EXIT_SUCCESS;
+}
+
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+static uint64_t u64TimeNow(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000) + (sNow.tv_nsec / 1000);
+}
+
+
+/** xorshift32, so that runs with the same seed are the same */
+static uint32_t u32Random(void)
+{
+    u32RandomState ^= u32RandomState << 13;
+    u32RandomState ^= u32RandomState >> 17;
+    u32RandomState ^= u32RandomState << 5;
+    return u32RandomState;
+}
+
+
+static int bRandomChance(double dProbability)
+{
+    return (dProbability > 0) && ((u32Random() / 4294967296.0) < dProbability);
+}
+
+
+static uint16_t u16Get(const uint8_t *pu8Data)
+{
+    return (pu8Data[0] << 8) | pu8Data[1];
+}
+
+
+static uint32_t u32Get(const uint8_t *pu8Data)
+{
+    return ((uint32_t)u16Get(pu8Data) << 16) | u16Get(&pu8Data[2]);
+}
+
+
+static uint64_t u64Get(const uint8_t *pu8Data)
+{
+    return ((uint64_t)u32Get(pu8Data) << 32) | u32Get(&pu8Data[4]);
+}
+
+
+static void vFrameInit(tsFrame *psFrame, uint16_t u16Type)
+{
+    psFrame->u16Type = u16Type;
+    psFrame->u16Length = 0;
+}
+
+
+static void vPut8(tsFrame *psFrame, uint8_t u8Value)
+{
+    if (psFrame->u16Length < SL_PTY_MAX_PAYLOAD)
+    {
+        psFrame->au8Payload[psFrame->u16Length++] = u8Value;
+    }
+}
+
+
+static void vPut16(tsFrame *psFrame, uint16_t u16Value)
+{
+    vPut8(psFrame, u16Value >> 8);
+    vPut8(psFrame, u16Value & 0xFF);
+}
+
+
+static void vPut32(tsFrame *psFrame, uint32_t u32Value)
+{
+    vPut16(psFrame, u32Value >> 16);
+    vPut16(psFrame, u32Value & 0xFFFF);
+}
+
+
+static void vPut64(tsFrame *psFrame, uint64_t u64Value)
+{
+    vPut32(psFrame, u64Value >> 32);
+    vPut32(psFrame, u64Value & 0xFFFFFFFF);
+}
+
+
+static uint16_t u16ShortAddress(uint32_t u32Node)
+{
+    return NODE_SHORT_ADDRESS_BASE + u32Node;
+}
+
+
+/** Joined node with a short address, or NO_NODE */
+static uint32_t u32FindNode(uint16_t u16Address)
+{
+    uint32_t u32Node = u16Address - NODE_SHORT_ADDRESS_BASE;
+
+    if ((u16Address < NODE_SHORT_ADDRESS_BASE) || (u32Node >= u32NumNodes) || !asNodes[u32Node].bJoined)
+    {
+        return NO_NODE;
+    }
+    return u32Node;
+}
+
+
+static int bHasCluster(const tsNode *psNode, uint16_t u16ClusterID)
+{
+    const tsEndpoint *psEndpoint = &asEndpoints[psNode->eType];
+    int i;
+
+    for (i = 0; i < psEndpoint->u8NumClusters; i++)
+    {
+        if (psEndpoint->pau16Clusters[i] == u16ClusterID)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/****************************************************************************/
+/***        Serial line                                                   ***/
+/****************************************************************************/
+
+/** Put a frame into the transmit buffer, or drop it if there isn't room */
+static void vSendFrame(const tsFrame *psFrame)
+{
+    if (eSL_PtySendFrame(&sPty, psFrame->u16Type, psFrame->u16Length, psFrame->au8Payload) == E_SL_OK)
+    {
+        sStats.u32FramesSent++;
+    }
+}
+
+
+static void vSendStatus(uint8_t u8Status, uint8_t u8SequenceNo, uint16_t u16MessageType)
+{
+    tsFrame sFrame;
+
+    vFrameInit(&sFrame, E_SL_MSG_STATUS);
+    vPut8(&sFrame, u8Status);
+    vPut8(&sFrame, u8SequenceNo);
+    vPut16(&sFrame, u16MessageType);
+    vSendFrame(&sFrame);
+}
+
+
+/** Write as much of the transmit buffer as the baud rate allows. Returns when to try again */
+static uint64_t u64FlushLine(uint64_t u64Now)
+{
+    uint64_t u64BytesUs;
+    uint64_t u64Allowed;
+    uint32_t u32Written;
+
+    if (!u32Baud)
+    {
+        u32SL_PtyFlush(&sPty, UINT32_MAX);
+        return UINT64_MAX;
+    }
+
+    /* 10 bits to the byte on the wire */
+    u64BytesUs = 10000000ULL / u32Baud;
+    if (u64BytesUs == 0)
+    {
+        u64BytesUs = 1;
+    }
+    if (u64LineTime < u64Now)
+    {
+        u64LineTime = u64Now;
+    }
+    u64Allowed = ((u64Now + (LINE_BURST_BYTES * u64BytesUs)) - u64LineTime) / u64BytesUs;
+
+    u32Written = u32SL_PtyFlush(&sPty, (uint32_t)u64Allowed);
+    u64LineTime += u32Written * u64BytesUs;
+
+    if (!sPty.u32TxBytes)
+    {
+        return UINT64_MAX;
+    }
+    /* Room for another byte once the line has sent the next one */
+    return u64LineTime - (LINE_BURST_BYTES * u64BytesUs) + u64BytesUs;
+}
+
+
+/****************************************************************************/
+/***        Events                                                        ***/
+/****************************************************************************/
+
+static int bEventBefore(const tsEvent *psA, const tsEvent *psB)
+{
+    return (psA->u64Due < psB->u64Due) || ((psA->u64Due == psB->u64Due) && ((int32_t)(psA->u32Order - psB->u32Order) < 0));
+}
+
+
+static void vEventPush(uint64_t u64Due, uint32_t u32Node, tsFrame *psFrame)
+{
+    tsEvent sEvent;
+    uint32_t u32Index;
+
+    if (u32NumEvents == u32MaxEvents)
+    {
+        tsEvent *asMoreEvents = realloc(asEvents, sizeof(tsEvent) * u32MaxEvents * 2);
+
+        if (!asMoreEvents)
+        {
+            free(psFrame);
+            return;
+        }
+        asEvents = asMoreEvents;
+        u32MaxEvents *= 2;
+    }
+
+    sEvent.u64Due = u64Due;
+    sEvent.u32Order = u32EventOrder++;
+    sEvent.u32Node = u32Node;
+    sEvent.u32Boot = sBridge.u32Boot;
+    sEvent.psFrame = psFrame;
+
+    u32Index = u32NumEvents++;
+    while (u32Index > 0)
+    {
+        uint32_t u32Parent = (u32Index - 1) / 2;
+
+        if (!bEventBefore(&sEvent, &asEvents[u32Parent]))
+        {
+            break;
+        }
+        asEvents[u32Index] = asEvents[u32Parent];
+        u32Index = u32Parent;
+    }
+    asEvents[u32Index] = sEvent;
+}
+
+
+static void vEventPop(void)
+{
+    tsEvent sLast = asEvents[--u32NumEvents];
+    uint32_t u32Index = 0;
+
+    for (;;)
+    {
+        uint32_t u32Child = (u32Index * 2) + 1;
+
+        if (u32Child >= u32NumEvents)
+        {
+            break;
+        }
+        if (((u32Child + 1) < u32NumEvents) && bEventBefore(&asEvents[u32Child + 1], &asEvents[u32Child]))
+        {
+            u32Child++;
+        }
+        if (!bEventBefore(&asEvents[u32Child], &sLast))
+        {
+            break;
+        }
+        asEvents[u32Index] = asEvents[u32Child];
+        u32Index = u32Child;
+    }
+    if (u32NumEvents)
+    {
+        asEvents[u32Index] = sLast;
+    }
+}
+
+
+/****************************************************************************/
+/***        Radio                                                         ***/
+/****************************************************************************/
+
+/** Carry a frame between the coordinator and a node. Each attempt holds the channel for
+ *  the airtime, once it is free, then takes the latency of each hop. Frames with APS acks
+ *  are tried again when the ack doesn't come back. The retries wait out the ack in the
+ *  future, so they don't hold the channel against frames sent meanwhile.
+ *  Returns 0 if the frame was lost, otherwise 1 with the time it arrived */
+static int bAirTransfer(const tsNode *psNode, int bAck, uint64_t u64Send, uint64_t *pu64Arrival)
+{
+    uint64_t u64Start = (u64Send > u64AirFree) ? u64Send : u64AirFree;
+    int iAttempt;
+
+    if ((u64Start - u64Send) > sStats.u64AirBacklogMax)
+    {
+        sStats.u64AirBacklogMax = u64Start - u64Send;
+    }
+    u64AirFree = u64Start + u32AirtimeUs;
+
+    for (iAttempt = 0; iAttempt <= (bAck ? APS_MAX_RETRIES : 0); iAttempt++)
+    {
+        uint64_t u64Arrival = u64Start + u32AirtimeUs;
+        int i;
+
+        for (i = 0; i < psNode->u8Depth; i++)
+        {
+            u64Arrival += u32HopUs + (u32JitterUs ? (u32Random() % (u32JitterUs + 1)) : 0);
+        }
+        sStats.u32AirFrames++;
+
+        if (!bRandomChance(dLoss))
+        {
+            *pu64Arrival = u64Arrival;
+            return 1;
+        }
+        sStats.u32AirLost++;
+        u64Start += APS_ACK_WAIT_US;
+    }
+    sStats.u32AirFailed++;
+    return 0;
+}
+
+
+/** Send a frame from a node to the host, over the air and then up the serial line */
+static void vNodeSend(const tsNode *psNode, int bAck, uint64_t u64Send, const tsFrame *psFrame)
+{
+    uint64_t u64Arrival;
+    tsFrame *psCopy;
+
+    if (!bAirTransfer(psNode, bAck, u64Send, &u64Arrival))
+    {
+        return;
+    }
+    psCopy = malloc(sizeof(tsFrame));
+    if (!psCopy)
+    {
+        return;
+    }
+    memcpy(psCopy, psFrame, sizeof(tsFrame));
+    vEventPush(u64Arrival, NO_NODE, psCopy);
+}
+
+
+/** Send a frame from the coordinator itself to the host, after its processing time */
+static void vLocalSend(uint64_t u64Now, const tsFrame *psFrame)
+{
+    tsFrame *psCopy = malloc(sizeof(tsFrame));
+
+    if (!psCopy)
+    {
+        return;
+    }
+    memcpy(psCopy, psFrame, sizeof(tsFrame));
+    vEventPush(u64Now + NODE_PROCESSING_US, NO_NODE, psCopy);
+}
+
+
+/****************************************************************************/
+/***        Attributes                                                    ***/
+/****************************************************************************/
+
+static uint8_t u8TypeSize(uint8_t u8Type)
+{
+    switch (u8Type)
+    {
+        case (E_ZCL_BOOL):
+        case (E_ZCL_GINT8):
+        case (E_ZCL_BMAP8):
+        case (E_ZCL_UINT8):
+        case (E_ZCL_INT8):
+        case (E_ZCL_ENUM8):
+            return 1;
+        case (E_ZCL_GINT16):
+        case (E_ZCL_BMAP16):
+        case (E_ZCL_UINT16):
+        case (E_ZCL_INT16):
+        case (E_ZCL_ENUM16):
+            return 2;
+        case (E_ZCL_GINT32):
+        case (E_ZCL_BMAP32):
+        case (E_ZCL_UINT32):
+        case (E_ZCL_INT32):
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+
+static const tsAttribute *psFindAttribute(const tsNode *psNode, uint16_t u16ClusterID, uint16_t u16AttributeID)
+{
+    int i;
+
+    for (i = 0; i < (sizeof(asAttributes) / sizeof(tsAttribute)); i++)
+    {
+        if ((asAttributes[i].u16ClusterID == u16ClusterID) &&
+            (asAttributes[i].u16AttributeID == u16AttributeID) &&
+            (asAttributes[i].u8Types & (1 << psNode->eType)))
+        {
+            return &asAttributes[i];
+        }
+    }
+    return NULL;
+}
+
+
+static uint32_t u32AttributeGet(const tsNode *psNode, const tsAttribute *psAttribute)
+{
+    const uint8_t *pu8Field = (const uint8_t *)psNode + psAttribute->iOffset;
+
+    if (psAttribute->iOffset < 0)
+    {
+        return psAttribute->u32Constant;
+    }
+    switch (u8TypeSize(psAttribute->u8Type))
+    {
+        case (1): return *pu8Field;
+        case (2): return *(const uint16_t *)pu8Field;
+        default:  return *(const uint32_t *)pu8Field;
+    }
+}
+
+
+static void vAttributeSet(tsNode *psNode, const tsAttribute *psAttribute, uint32_t u32Value)
+{
+    uint8_t *pu8Field = (uint8_t *)psNode + psAttribute->iOffset;
+
+    switch (u8TypeSize(psAttribute->u8Type))
+    {
+        case (1): *pu8Field = u32Value; break;
+        case (2): *(uint16_t *)pu8Field = u32Value; break;
+        default:  *(uint32_t *)pu8Field = u32Value; break;
+    }
+}
+
+
+static void vPutAttribute(tsFrame *psFrame, const tsNode *psNode, const tsAttribute *psAttribute)
+{
+    uint32_t u32Value = u32AttributeGet(psNode, psAttribute);
+
+    vPut8(psFrame, psAttribute->u8Type);
+    switch (u8TypeSize(psAttribute->u8Type))
+    {
+        case (1): vPut8(psFrame, u32Value); break;
+        case (2): vPut16(psFrame, u32Value); break;
+        default:  vPut32(psFrame, u32Value); break;
+    }
+}
+
+
+/** A node reports an attribute to the coordinator */
+static void vSendReport(uint32_t u32Node, uint16_t u16ClusterID, uint16_t u16AttributeID, uint64_t u64Send)
+{
+    tsNode *psNode = &asNodes[u32Node];
+    const tsAttribute *psAttribute = psFindAttribute(psNode, u16ClusterID, u16AttributeID);
+    tsFrame sFrame;
+
+    if (!psAttribute)
+    {
+        return;
+    }
+    vFrameInit(&sFrame, E_SL_MSG_ATTRIBUTE_REPORT);
+    vPut8(&sFrame, sBridge.u8ReportSequenceNo++);
+    vPut16(&sFrame, u16ShortAddress(u32Node));
+    vPut8(&sFrame, asEndpoints[psNode->eType].u8Endpoint);
+    vPut16(&sFrame, u16ClusterID);
+    vPut16(&sFrame, u16AttributeID);
+    vPut8(&sFrame, ZCL_SUCCESS);
+    vPutAttribute(&sFrame, psNode, psAttribute);
+
+    sStats.u32Reports++;
+    vNodeSend(psNode, 1, u64Send, &sFrame);
+}
+
+
+/** Record that a command changed an attribute, for lamps to report */
+static void vChanged(tsCommand *psCommand, uint16_t u16ClusterID, uint16_t u16AttributeID)
+{
+    int i;
+
+    for (i = 0; i < psCommand->u8NumChanged; i++)
+    {
+        if ((psCommand->au16Changed[i][0] == u16ClusterID) && (psCommand->au16Changed[i][1] == u16AttributeID))
+        {
+            return;
+        }
+    }
+    if (psCommand->u8NumChanged < MAX_CHANGES)
+    {
+        psCommand->au16Changed[psCommand->u8NumChanged][0] = u16ClusterID;
+        psCommand->au16Changed[psCommand->u8NumChanged][1] = u16AttributeID;
+        psCommand->u8NumChanged++;
+    }
+}
+
+
+/****************************************************************************/
+/***        Persistent data                                               ***/
+/****************************************************************************/
+
+static void vPdmSendLoadRequest(uint16_t u16RecordID, uint64_t u64Now)
+{
+    tsFrame sFrame;
+
+    free(sPdm.pu8Data);
+    sPdm.pu8Data = NULL;
+    sPdm.u32Size = 0;
+    sPdm.u32Received = 0;
+    sPdm.u16RecordID = u16RecordID;
+    sPdm.bSaving = 0;
+    sPdm.u64Timeout = u64Now + PDM_TIMEOUT_US;
+
+    vFrameInit(&sFrame, E_SL_MSG_PDM_LOAD_RECORD_REQUEST);
+    vPut16(&sFrame, u16RecordID);
+    vSendFrame(&sFrame);
+    sStats.u32PdmLoads++;
+}
+
+
+static void vPdmSendBlock(uint64_t u64Now)
+{
+    uint32_t u32Offset = sPdm.u32Block * PDM_BLOCK_SIZE;
+    uint32_t u32BlockSize = sPdm.u32Size - u32Offset;
+    tsFrame sFrame;
+
+    if (u32BlockSize > PDM_BLOCK_SIZE)
+    {
+        u32BlockSize = PDM_BLOCK_SIZE;
+    }
+
+    /* Blocks are numbered from 1, as pdm_host.c does */
+    vFrameInit(&sFrame, E_SL_MSG_PDM_SAVE_RECORD_REQUEST);
+    vPut16(&sFrame, sPdm.u16RecordID);
+    vPut32(&sFrame, sPdm.u32Size);
+    vPut32(&sFrame, sPdm.u32NumBlocks);
+    vPut32(&sFrame, sPdm.u32Block + 1);
+    vPut32(&sFrame, u32BlockSize);
+    memcpy(&sFrame.au8Payload[sFrame.u16Length], &sPdm.pu8Data[u32Offset], u32BlockSize);
+    sFrame.u16Length += u32BlockSize;
+    vSendFrame(&sFrame);
+
+    sPdm.u64Timeout = u64Now + PDM_TIMEOUT_US;
+}
+
+
+/** Start saving a record, which takes its data */
+static void vPdmSave(uint16_t u16RecordID, uint8_t *pu8Data, uint32_t u32Size, uint64_t u64Now)
+{
+    free(sPdm.pu8Data);
+    sPdm.pu8Data = pu8Data;
+    sPdm.u32Size = u32Size;
+    sPdm.u16RecordID = u16RecordID;
+    sPdm.bSaving = 1;
+    sPdm.u32Block = 0;
+    sPdm.u32NumBlocks = (u32Size + PDM_BLOCK_SIZE - 1) / PDM_BLOCK_SIZE;
+    sStats.u32PdmSaves++;
+    vPdmSendBlock(u64Now);
+}
+
+
+static void vPdmSaveNetwork(uint64_t u64Now)
+{
+    tsFrame sRecord;
+    uint8_t *pu8Data;
+
+    vFrameInit(&sRecord, 0);
+    vPut8(&sRecord, PDM_NETWORK_VERSION);
+    vPut8(&sRecord, sBridge.u8Channel);
+    vPut16(&sRecord, sBridge.u16PanID);
+    vPut64(&sRecord, sBridge.u64ExtPanID);
+    vPut32(&sRecord, u32NumNodes);
+
+    pu8Data = malloc(sRecord.u16Length);
+    if (!pu8Data)
+    {
+        return;
+    }
+    memcpy(pu8Data, sRecord.au8Payload, sRecord.u16Length);
+    sPdm.bSaveNetwork = 0;
+    vPdmSave(PDM_ID_NETWORK, pu8Data, sRecord.u16Length, u64Now);
+}
+
+
+static void vPdmSaveJoined(uint64_t u64Now)
+{
+    uint32_t u32Size = (u32NumNodes + 7) / 8;
+    uint8_t *pu8Data = calloc(1, u32Size);
+    uint32_t i;
+
+    if (!pu8Data)
+    {
+        return;
+    }
+    for (i = 0; i < u32NumNodes; i++)
+    {
+        if (asNodes[i].bJoined)
+        {
+            pu8Data[i / 8] |= 1 << (i % 8);
+        }
+    }
+    sPdm.u64SaveJoinedDue = 0;
+    vPdmSave(PDM_ID_JOINED, pu8Data, u32Size, u64Now);
+}
+
+
+/** The joined nodes need saving. Wait for joins to settle so that each doesn't save it */
+static void vPdmJoinedChanged(uint64_t u64Now)
+{
+    if (!sPdm.u64SaveJoinedDue)
+    {
+        sPdm.u64SaveJoinedLatest = u64Now + PDM_SAVE_MAX_US;
+    }
+    sPdm.u64SaveJoinedDue = u64Now + PDM_SAVE_DEBOUNCE_US;
+    if (sPdm.u64SaveJoinedDue > sPdm.u64SaveJoinedLatest)
+    {
+        sPdm.u64SaveJoinedDue = sPdm.u64SaveJoinedLatest;
+    }
+}
+
+
+/** Start saving whatever needs it, if nothing else is going on with the PDM */
+static void vPdmService(uint64_t u64Now)
+{
+    if (sPdm.u16RecordID)
+    {
+        if (u64Now >= sPdm.u64Timeout)
+        {
+            fprintf(stderr, "PDM record 0x%04X: no answer from the host\n", sPdm.u16RecordID);
+            sPdm.u16RecordID = 0;
+        }
+        return;
+    }
+    if (sPdm.bSaveNetwork)
+    {
+        vPdmSaveNetwork(u64Now);
+    }
+    else if (sPdm.u64SaveJoinedDue && (u64Now >= sPdm.u64SaveJoinedDue))
+    {
+        vPdmSaveJoined(u64Now);
+    }
+}
+
+
+/****************************************************************************/
+/***        Control bridge                                                ***/
+/****************************************************************************/
+
+static void vSendEndpointLists(void)
+{
+    /* The control bridge's own endpoint, as app_start.c announces it */
+    static const uint16_t au16Clusters[] =
+    {
+        0x0000, 0x0001, 0x0003, 0x0004, 0x0005, 0x0006, 0x0008, 0x0019, 0x0101, 0x1000, 0x0300, 0x0201,
+        0x0204, 0x0405, 0x0500, 0x0400, 0x0402, 0x0403, 0x0405, 0x0406, 0x0702, 0x0b03, 0x0b04,
+    };
+    tsFrame sFrame;
+    int i;
+
+    vFrameInit(&sFrame, E_SL_MSG_NODE_CLUSTER_LIST);
+    vPut8(&sFrame, 1);
+    vPut16(&sFrame, E_ZB_PROFILEID_HA);
+    for (i = 0; i < (sizeof(au16Clusters) / sizeof(uint16_t)); i++)
+    {
+        vPut16(&sFrame, au16Clusters[i]);
+    }
+    vSendFrame(&sFrame);
+
+    vFrameInit(&sFrame, E_SL_MSG_NODE_CLUSTER_LIST);
+    vPut8(&sFrame, 2);
+    vPut16(&sFrame, E_ZB_PROFILEID_ZLL);
+    vPut16(&sFrame, E_ZB_CLUSTERID_ZLL_COMMISIONING);
+    vSendFrame(&sFrame);
+}
+
+
+static void vSendNetworkJoinedFormed(uint8_t u8Status)
+{
+    tsFrame sFrame;
+
+    vFrameInit(&sFrame, E_SL_MSG_NETWORK_JOINED_FORMED);
+    vPut8(&sFrame, u8Status);
+    vPut16(&sFrame, 0x0000);
+    vPut64(&sFrame, u64IEEEAddressBase | 0xFFFFFF);
+    vPut8(&sFrame, sBridge.u8Channel);
+    vPut64(&sFrame, sBridge.u64ExtPanID);
+    vPut16(&sFrame, sBridge.u16PanID);
+    vSendFrame(&sFrame);
+}
+
+
+static void vSendRestart(uint16_t u16Type, uint8_t u8State)
+{
+    tsFrame sFrame;
+
+    vFrameInit(&sFrame, u16Type);
+    vPut8(&sFrame, u8State);
+    vSendFrame(&sFrame);
+}
+
+
+/** Start a report timer for a thermostat that has joined */
+static void vStartReports(uint32_t u32Node, uint64_t u64Now)
+{
+    if ((asNodes[u32Node].eType == E_NODE_THERMOSTAT) && u32ReportIntervalUs)
+    {
+        vEventPush(u64Now + (u32Random() % u32ReportIntervalUs), u32Node, NULL);
+    }
+}
+
+
+/** Records have been loaded, or there were none: tell the host how the network is */
+static void vStart(uint64_t u64Now)
+{
+    uint32_t i;
+
+    vSendEndpointLists();
+    if (sBridge.bFormed)
+    {
+        sBridge.eState = E_STATE_RUNNING;
+        vSendNetworkJoinedFormed(0);
+        vSendRestart(E_SL_MSG_RESTART_PROVISIONED, 6);
+        sBridge.u32NextJoin = 0;
+        sBridge.u64NextJoinTime = u64Now;
+        for (i = 0; i < u32NumNodes; i++)
+        {
+            if (asNodes[i].bJoined)
+            {
+                vStartReports(i, u64Now);
+            }
+        }
+        printf("Network restored on channel %d, PAN 0x%04X, %u nodes joined\n",
+               sBridge.u8Channel, sBridge.u16PanID, sStats.u32Joined);
+    }
+    else
+    {
+        sBridge.eState = E_STATE_FACTORY_NEW;
+        vSendRestart(E_SL_MSG_RESTART_FACTORY_NEW, 0);
+        printf("Factory new, waiting for the network to be started\n");
+    }
+    fflush(stdout);
+}
+
+
+/** Power up: wait for the host's PDM, then load the records */
+static void vBoot(uint64_t u64Now)
+{
+    uint32_t i;
+
+    sBridge.u32Boot++;
+    sBridge.eState = E_STATE_PDM_WAIT;
+    sBridge.u64StateTimer = u64Now;
+    sBridge.bFormed = 0;
+    sBridge.u8SequenceNo = 0;
+    sBridge.u32ChannelMask = 0;
+    sBridge.u64ExtPanIDSet = 0;
+
+    /* The network is forgotten until it is loaded again; the nodes themselves don't forget it */
+    for (i = 0; i < u32NumNodes; i++)
+    {
+        asNodes[i].bJoined = 0;
+    }
+    sStats.u32Joined = 0;
+
+    free(sPdm.pu8Data);
+    memset(&sPdm, 0, sizeof(sPdm));
+}
+
+
+static void vHandlePdmLoadResponse(const uint8_t *pu8Payload, uint16_t u16Length, uint64_t u64Now)
+{
+    uint8_t u8Status;
+    uint32_t u32TotalSize, u32NumBlocks, u32Block, u32BlockSize;
+    int bDone = 0;
+
+    /* The firmware acknowledges every block */
+    vSendStatus(STATUS_OK, 0, E_SL_MSG_PDM_LOAD_RECORD_RESPONSE);
+
+    if ((sBridge.eState != E_STATE_PDM_LOAD) || (u16Length < 1))
+    {
+        return;
+    }
+
+    u8Status = pu8Payload[0];
+    if ((u8Status == 0) && sPdm.bTrailer)
+    {
+        /* End of the previous record, after the request for this one went out */
+        sPdm.bTrailer = 0;
+        return;
+    }
+    if ((u8Status == 0) || (u16Length < 19) || (u16Get(&pu8Payload[1]) != sPdm.u16RecordID))
+    {
+        bDone = 1;
+    }
+    else
+    {
+        u32TotalSize = u32Get(&pu8Payload[3]);
+        u32NumBlocks = u32Get(&pu8Payload[7]);
+        u32Block     = u32Get(&pu8Payload[11]);
+        u32BlockSize = u32Get(&pu8Payload[15]);
+
+        if (!sPdm.pu8Data && (u32TotalSize > 0) && (u32TotalSize < (1 << 20)))
+        {
+            sPdm.pu8Data = calloc(1, u32TotalSize);
+            sPdm.u32Size = u32TotalSize;
+        }
+        if (sPdm.pu8Data && (u32BlockSize <= (u16Length - 19)) && ((sPdm.u32Received + u32BlockSize) <= sPdm.u32Size))
+        {
+            memcpy(&sPdm.pu8Data[sPdm.u32Received], &pu8Payload[19], u32BlockSize);
+            sPdm.u32Received += u32BlockSize;
+        }
+        bDone = sPdm.bTrailer = (u32Block >= u32NumBlocks);
+    }
+
+    if (!bDone)
+    {
+        sPdm.u64Timeout = u64Now + PDM_TIMEOUT_US;
+        return;
+    }
+
+    if (sPdm.u16RecordID == PDM_ID_NETWORK)
+    {
+        if (sPdm.pu8Data && (sPdm.u32Received == sPdm.u32Size) && (sPdm.u32Size >= 16) &&
+            (sPdm.pu8Data[0] == PDM_NETWORK_VERSION))
+        {
+            sBridge.bFormed      = 1;
+            sBridge.u8Channel    = sPdm.pu8Data[1];
+            sBridge.u16PanID     = u16Get(&sPdm.pu8Data[2]);
+            sBridge.u64ExtPanID  = u64Get(&sPdm.pu8Data[4]);
+            if (u32Get(&sPdm.pu8Data[12]) != u32NumNodes)
+            {
+                printf("The network was saved with %u nodes, not %u\n", u32Get(&sPdm.pu8Data[12]), u32NumNodes);
+            }
+        }
+        if (sBridge.bFormed)
+        {
+            vPdmSendLoadRequest(PDM_ID_JOINED, u64Now);
+            return;
+        }
+    }
+    else if ((sPdm.u16RecordID == PDM_ID_JOINED) && sPdm.pu8Data)
+    {
+        uint32_t i;
+
+        for (i = 0; (i < u32NumNodes) && ((i / 8) < sPdm.u32Received); i++)
+        {
+            if (sPdm.pu8Data[i / 8] & (1 << (i % 8)))
+            {
+                asNodes[i].bJoined = 1;
+                sStats.u32Joined++;
+            }
+        }
+    }
+
+    free(sPdm.pu8Data);
+    sPdm.pu8Data = NULL;
+    sPdm.u16RecordID = 0;
+    vStart(u64Now);
+}
+
+
+static void vHandlePdmSaveResponse(const uint8_t *pu8Payload, uint16_t u16Length, uint64_t u64Now)
+{
+    if (!sPdm.u16RecordID || !sPdm.bSaving)
+    {
+        return;
+    }
+    if ((u16Length < 1) || (pu8Payload[0] != 0))
+    {
+        fprintf(stderr, "PDM record 0x%04X: host failed to save block %u\n", sPdm.u16RecordID, sPdm.u32Block + 1);
+    }
+
+    sPdm.u32Block++;
+    if (sPdm.u32Block < sPdm.u32NumBlocks)
+    {
+        vPdmSendBlock(u64Now);
+    }
+    else
+    {
+        sPdm.u16RecordID = 0;
+    }
+}
+
+
+/** The network has formed */
+static void vFormed(uint64_t u64Now)
+{
+    uint32_t u32Mask = sBridge.u32ChannelMask;
+    int i;
+
+    /* A channel number, or a mask of channels to choose from */
+    if ((u32Mask >= 11) && (u32Mask <= 26))
+    {
+        sBridge.u8Channel = u32Mask;
+    }
+    else
+    {
+        sBridge.u8Channel = 11;
+        for (i = 11; i <= 26; i++)
+        {
+            if (u32Mask & (1 << i))
+            {
+                sBridge.u8Channel = i;
+                break;
+            }
+        }
+    }
+    do
+    {
+        sBridge.u16PanID = u32Random() & 0xFFFF;
+    } while ((sBridge.u16PanID == 0) || (sBridge.u16PanID == 0xFFFF));
+    sBridge.u64ExtPanID = sBridge.u64ExtPanIDSet ? sBridge.u64ExtPanIDSet :
+                          (((uint64_t)u32Random() << 32) | u32Random());
+
+    sBridge.bFormed = 1;
+    sBridge.eState = E_STATE_RUNNING;
+    sBridge.u32NextJoin = 0;
+    sBridge.u64NextJoinTime = u64Now;
+    vSendNetworkJoinedFormed(1);
+    sPdm.bSaveNetwork = 1;
+
+    printf("Network formed on channel %d, PAN 0x%04X\n", sBridge.u8Channel, sBridge.u16PanID);
+    fflush(stdout);
+}
+
+
+/** Let the next node join, if it is time */
+static void vJoinNodes(uint64_t u64Now)
+{
+    while ((sBridge.u32NextJoin < u32NumNodes) && (u64Now >= sBridge.u64NextJoinTime))
+    {
+        uint32_t u32Node = sBridge.u32NextJoin++;
+        tsNode *psNode = &asNodes[u32Node];
+        tsFrame sFrame;
+
+        if (psNode->bJoined || psNode->bLeft)
+        {
+            continue;
+        }
+        psNode->bJoined = 1;
+        sStats.u32Joined++;
+
+        /* The announcement is a broadcast, so if it is lost the host only finds the node from its neighbour tables */
+        vFrameInit(&sFrame, E_SL_MSG_DEVICE_ANNOUNCE);
+        vPut16(&sFrame, u16ShortAddress(u32Node));
+        vPut64(&sFrame, u64IEEEAddressBase + u32Node);
+        vPut8(&sFrame, E_ZB_MAC_CAPABILITY_ALLOCATE_ADDRESS | E_ZB_MAC_CAPABILITY_RXON_WHEN_IDLE |
+                       E_ZB_MAC_CAPABILITY_POWERED | E_ZB_MAC_CAPABILITY_FFD);
+        sStats.u32Announces++;
+        vNodeSend(psNode, 0, u64Now, &sFrame);
+
+        vStartReports(u32Node, u64Now);
+        vPdmJoinedChanged(u64Now);
+        sBridge.u64NextJoinTime += 1000000 / u32JoinRate;
+    }
+}
+
+
+/** A node's report timer */
+static void vNodeReportTimer(uint32_t u32Node, uint64_t u64Now)
+{
+    tsNode *psNode = &asNodes[u32Node];
+
+    if (!psNode->bJoined || (sBridge.eState != E_STATE_RUNNING))
+    {
+        return;
+    }
+
+    /* Wander around the heating setpoint */
+    psNode->i16LocalTemperature += (int16_t)(u32Random() % 21) - 10;
+    if (psNode->i16LocalTemperature < (psNode->i16OccupiedHeatingSetpoint - 300))
+    {
+        psNode->i16LocalTemperature += 50;
+    }
+    else if (psNode->i16LocalTemperature > (psNode->i16OccupiedHeatingSetpoint + 300))
+    {
+        psNode->i16LocalTemperature -= 50;
+    }
+    psNode->u8PIHeatingDemand = (psNode->i16LocalTemperature < psNode->i16OccupiedHeatingSetpoint) ? 100 : 0;
+
+    vSendReport(u32Node, E_ZB_CLUSTERID_THERMOSTAT, E_ZB_ATTRIBUTEID_TSTAT_LOCALTEMPERATURE, u64Now);
+    vEventPush(u64Now + u32ReportIntervalUs, u32Node, NULL);
+}
+
+
+/****************************************************************************/
+/***        ZDP commands                                                  ***/
+/****************************************************************************/
+
+/** Send a node's answer to a ZDP request back to the host, if the request reaches it */
+static void vZdpExchange(uint32_t u32Node, uint64_t u64Now, const tsFrame *psResponse)
+{
+    tsNode *psNode = &asNodes[u32Node];
+    uint64_t u64Arrival;
+
+    if (bAirTransfer(psNode, 1, u64Now, &u64Arrival))
+    {
+        sStats.u32Responses++;
+        vNodeSend(psNode, 1, u64Arrival + NODE_PROCESSING_US, psResponse);
+    }
+}
+
+
+static void vHandleAddressRequest(uint16_t u16Type, const uint8_t *pu8Payload, uint16_t u16Length, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint32_t u32Node;
+    tsFrame sFrame;
+
+    if (u16Type == E_SL_MSG_IEEE_ADDRESS_REQUEST)
+    {
+        /* Target, short address of interest, request type, start index */
+        u32Node = u32FindNode(u16Get(&pu8Payload[2]));
+    }
+    else
+    {
+        /* Target, IEEE address of interest, request type, start index */
+        uint64_t u64IEEEAddress = u64Get(&pu8Payload[2]);
+
+        u32Node = NO_NODE;
+        if ((u64IEEEAddress >= u64IEEEAddressBase) && ((u64IEEEAddress - u64IEEEAddressBase) < u32NumNodes) &&
+            asNodes[u64IEEEAddress - u64IEEEAddressBase].bJoined)
+        {
+            u32Node = u64IEEEAddress - u64IEEEAddressBase;
+        }
+    }
+    if (u32Node == NO_NODE)
+    {
+        return;
+    }
+
+    vFrameInit(&sFrame, u16Type | 0x8000);
+    vPut8(&sFrame, u8SequenceNo);
+    vPut8(&sFrame, ZDP_SUCCESS);
+    vPut64(&sFrame, u64IEEEAddressBase + u32Node);
+    vPut16(&sFrame, u16ShortAddress(u32Node));
+    vPut8(&sFrame, 0);
+    vPut8(&sFrame, 0);
+    vZdpExchange(u32Node, u64Now, &sFrame);
+}
+
+
+static void vHandleNodeDescriptorRequest(const uint8_t *pu8Payload, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint32_t u32Node = u32FindNode(u16Get(pu8Payload));
+    tsFrame sFrame;
+
+    if (u32Node == NO_NODE)
+    {
+        return;
+    }
+    vFrameInit(&sFrame, E_SL_MSG_NODE_DESCRIPTOR_RESPONSE);
+    vPut8(&sFrame, u8SequenceNo);
+    vPut8(&sFrame, ZDP_SUCCESS);
+    vPut16(&sFrame, u16ShortAddress(u32Node));
+    vPut16(&sFrame, 0x1037);                    /* Manufacturer */
+    vPut16(&sFrame, 0x007F);                    /* Maximum incoming transfer */
+    vPut16(&sFrame, 0x007F);                    /* Maximum outgoing transfer */
+    vPut16(&sFrame, 0x0000);                    /* Server mask */
+    vPut8(&sFrame, 0x00);                       /* Descriptor capability */
+    vPut8(&sFrame, E_ZB_MAC_CAPABILITY_ALLOCATE_ADDRESS | E_ZB_MAC_CAPABILITY_RXON_WHEN_IDLE |
+                   E_ZB_MAC_CAPABILITY_POWERED | E_ZB_MAC_CAPABILITY_FFD);
+    vPut8(&sFrame, 0x7F);                       /* Maximum buffer size */
+    vPut16(&sFrame, 0x0001);                    /* Router */
+    vZdpExchange(u32Node, u64Now, &sFrame);
+}
+
+
+static void vHandleSimpleDescriptorRequest(const uint8_t *pu8Payload, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint32_t u32Node = u32FindNode(u16Get(pu8Payload));
+    const tsEndpoint *psEndpoint;
+    tsFrame sFrame;
+    int i;
+
+    if (u32Node == NO_NODE)
+    {
+        return;
+    }
+    psEndpoint = &asEndpoints[asNodes[u32Node].eType];
+
+    vFrameInit(&sFrame, E_SL_MSG_SIMPLE_DESCRIPTOR_RESPONSE);
+    vPut8(&sFrame, u8SequenceNo);
+    if (pu8Payload[2] != psEndpoint->u8Endpoint)
+    {
+        vPut8(&sFrame, ZDP_NOT_ACTIVE);
+        vPut16(&sFrame, u16ShortAddress(u32Node));
+        vPut8(&sFrame, 0);
+    }
+    else
+    {
+        vPut8(&sFrame, ZDP_SUCCESS);
+        vPut16(&sFrame, u16ShortAddress(u32Node));
+        vPut8(&sFrame, 8 + (2 * psEndpoint->u8NumClusters));
+        vPut8(&sFrame, psEndpoint->u8Endpoint);
+        vPut16(&sFrame, psEndpoint->u16ProfileID);
+        vPut16(&sFrame, psEndpoint->u16DeviceID);
+        vPut8(&sFrame, 0x00);                   /* Device version */
+        vPut8(&sFrame, psEndpoint->u8NumClusters);
+        for (i = 0; i < psEndpoint->u8NumClusters; i++)
+        {
+            vPut16(&sFrame, psEndpoint->pau16Clusters[i]);
+        }
+        vPut8(&sFrame, 0);
+    }
+    vZdpExchange(u32Node, u64Now, &sFrame);
+}
+
+
+static void vHandleActiveEndpointRequest(const uint8_t *pu8Payload, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint32_t u32Node = u32FindNode(u16Get(pu8Payload));
+    tsFrame sFrame;
+
+    if (u32Node == NO_NODE)
+    {
+        return;
+    }
+    vFrameInit(&sFrame, E_SL_MSG_ACTIVE_ENDPOINT_REQUEST | 0x8000);
+    vPut8(&sFrame, u8SequenceNo);
+    vPut8(&sFrame, ZDP_SUCCESS);
+    vPut16(&sFrame, u16ShortAddress(u32Node));
+    vPut8(&sFrame, 1);
+    vPut8(&sFrame, asEndpoints[asNodes[u32Node].eType].u8Endpoint);
+    vZdpExchange(u32Node, u64Now, &sFrame);
+}
+
+
+static int bMatchClusters(const tsEndpoint *psEndpoint, const uint8_t *pu8Clusters, uint8_t u8NumClusters)
+{
+    int i, j;
+
+    for (i = 0; i < u8NumClusters; i++)
+    {
+        for (j = 0; j < psEndpoint->u8NumClusters; j++)
+        {
+            if (u16Get(&pu8Clusters[2 * i]) == psEndpoint->pau16Clusters[j])
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+static void vHandleMatchDescriptorRequest(const uint8_t *pu8Payload, uint16_t u16Length, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint16_t u16Target = u16Get(pu8Payload);
+    uint16_t u16ProfileID = u16Get(&pu8Payload[2]);
+    uint8_t u8NumInputClusters = pu8Payload[4];
+    uint32_t u32Node, u32First, u32Last;
+    tsFrame sFrame;
+
+    if (u16Length < (5 + (2 * u8NumInputClusters)))
+    {
+        return;
+    }
+
+    if (u16Target >= E_ZB_BROADCAST_ADDRESS_LOWPOWERROUTERS)
+    {
+        /* Broadcast: only nodes that match answer */
+        u32First = 0;
+        u32Last = u32NumNodes;
+    }
+    else
+    {
+        if ((u32Node = u32FindNode(u16Target)) == NO_NODE)
+        {
+            return;
+        }
+        u32First = u32Node;
+        u32Last = u32Node + 1;
+    }
+
+    for (u32Node = u32First; u32Node < u32Last; u32Node++)
+    {
+        const tsEndpoint *psEndpoint = &asEndpoints[asNodes[u32Node].eType];
+        int bMatch;
+
+        if (!asNodes[u32Node].bJoined)
+        {
+            continue;
+        }
+        bMatch = (psEndpoint->u16ProfileID == u16ProfileID) && bMatchClusters(psEndpoint, &pu8Payload[5], u8NumInputClusters);
+        if (!bMatch && ((u32Last - u32First) > 1))
+        {
+            continue;
+        }
+
+        vFrameInit(&sFrame, E_SL_MSG_MATCH_DESCRIPTOR_RESPONSE);
+        vPut8(&sFrame, u8SequenceNo);
+        vPut8(&sFrame, ZDP_SUCCESS);
+        vPut16(&sFrame, u16ShortAddress(u32Node));
+        vPut8(&sFrame, bMatch ? 1 : 0);
+        if (bMatch)
+        {
+            vPut8(&sFrame, psEndpoint->u8Endpoint);
+        }
+        vZdpExchange(u32Node, u64Now, &sFrame);
+    }
+}
+
+
+static void vHandleManagementLqiRequest(const uint8_t *pu8Payload, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint16_t u16Target = u16Get(pu8Payload);
+    uint8_t u8StartIndex = pu8Payload[2];
+    uint32_t u32Node = NO_NODE;
+    uint32_t u32FirstChild, u32Child;
+    uint32_t au32Children[255];
+    uint32_t u32NumChildren = 0;
+    tsFrame sFrame;
+    int i;
+
+    if (u16Target == 0x0000)
+    {
+        u32FirstChild = 0;
+    }
+    else if ((u32Node = u32FindNode(u16Target)) != NO_NODE)
+    {
+        u32FirstChild = (u32Node + 1) * u32Fanout;
+    }
+    else
+    {
+        return;
+    }
+
+    /* The neighbour table only holds the children, which is all the host looks at */
+    for (u32Child = u32FirstChild; (u32Child < (u32FirstChild + u32Fanout)) && (u32Child < u32NumNodes); u32Child++)
+    {
+        if (asNodes[u32Child].bJoined)
+        {
+            au32Children[u32NumChildren++] = u32Child;
+        }
+    }
+
+    vFrameInit(&sFrame, E_SL_MSG_MANAGEMENT_LQI_RESPONSE);
+    vPut8(&sFrame, u8SequenceNo);
+    vPut8(&sFrame, ZDP_SUCCESS);
+    vPut8(&sFrame, u32NumChildren);
+    i = (u8StartIndex < u32NumChildren) ? (u32NumChildren - u8StartIndex) : 0;
+    if (i > 3)
+    {
+        i = 3;
+    }
+    vPut8(&sFrame, i);
+    vPut8(&sFrame, u8StartIndex);
+    for (i = u8StartIndex; (i < u32NumChildren) && (i < (u8StartIndex + 3)); i++)
+    {
+        tsNode *psChild = &asNodes[au32Children[i]];
+
+        vPut16(&sFrame, u16ShortAddress(au32Children[i]));
+        vPut64(&sFrame, sBridge.u64ExtPanID);
+        vPut64(&sFrame, u64IEEEAddressBase + au32Children[i]);
+        vPut8(&sFrame, psChild->u8Depth);
+        vPut8(&sFrame, 0xC0 + (u32Random() % 0x40));
+        /* Router, child, receiver on when idle */
+        vPut8(&sFrame, 0x01 | (0x01 << 4) | (0x01 << 6));
+    }
+
+    if (u32Node == NO_NODE)
+    {
+        sStats.u32Responses++;
+        vLocalSend(u64Now, &sFrame);
+    }
+    else
+    {
+        vZdpExchange(u32Node, u64Now, &sFrame);
+    }
+}
+
+
+static void vHandleRemoveDevice(const uint8_t *pu8Payload, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint64_t u64IEEEAddress = u64Get(&pu8Payload[2]);
+    uint8_t bRejoin = pu8Payload[11];
+    uint32_t u32Node;
+    tsNode *psNode;
+    uint64_t u64Arrival;
+    tsFrame sFrame;
+
+    if ((u64IEEEAddress < u64IEEEAddressBase) || ((u64IEEEAddress - u64IEEEAddressBase) >= u32NumNodes))
+    {
+        return;
+    }
+    u32Node = u64IEEEAddress - u64IEEEAddressBase;
+    psNode = &asNodes[u32Node];
+    if (!psNode->bJoined || !bAirTransfer(psNode, 1, u64Now, &u64Arrival))
+    {
+        return;
+    }
+
+    vFrameInit(&sFrame, E_SL_MSG_LEAVE_CONFIRMATION);
+    vPut8(&sFrame, u8SequenceNo);
+    vPut8(&sFrame, ZDP_SUCCESS);
+    sStats.u32Responses++;
+    vNodeSend(psNode, 1, u64Arrival + NODE_PROCESSING_US, &sFrame);
+
+    vFrameInit(&sFrame, E_SL_MSG_LEAVE_INDICATION);
+    vPut64(&sFrame, u64IEEEAddress);
+    vPut8(&sFrame, bRejoin);
+    vNodeSend(psNode, 0, u64Arrival + NODE_PROCESSING_US, &sFrame);
+
+    psNode->bJoined = 0;
+    psNode->u8NumGroups = 0;
+    psNode->u8NumScenes = 0;
+    sStats.u32Joined--;
+    if (bRejoin)
+    {
+        /* It comes back as the join rate allows */
+        if (u32Node < sBridge.u32NextJoin)
+        {
+            sBridge.u32NextJoin = u32Node;
+        }
+        if (sBridge.u64NextJoinTime < u64Now)
+        {
+            sBridge.u64NextJoinTime = u64Now;
+        }
+    }
+    else
+    {
+        psNode->bLeft = 1;
+    }
+    vPdmJoinedChanged(u64Now);
+}
+
+
+/****************************************************************************/
+/***        ZCL commands                                                  ***/
+/****************************************************************************/
+
+static int iFindGroup(const tsNode *psNode, uint16_t u16GroupID)
+{
+    int i;
+
+    for (i = 0; i < psNode->u8NumGroups; i++)
+    {
+        if (psNode->au16Groups[i] == u16GroupID)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static int iFindScene(const tsNode *psNode, uint16_t u16GroupID, uint8_t u8SceneID)
+{
+    int i;
+
+    for (i = 0; i < psNode->u8NumScenes; i++)
+    {
+        if ((psNode->asScenes[i].u16GroupID == u16GroupID) && (psNode->asScenes[i].u8SceneID == u8SceneID))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static void vRemoveScene(tsNode *psNode, int iScene)
+{
+    psNode->asScenes[iScene] = psNode->asScenes[--psNode->u8NumScenes];
+}
+
+
+/** Remove the scenes of a group, or every group if it is 0xFFFF */
+static void vRemoveScenes(tsNode *psNode, uint16_t u16GroupID)
+{
+    int i;
+
+    for (i = psNode->u8NumScenes - 1; i >= 0; i--)
+    {
+        if ((u16GroupID == 0xFFFF) || (psNode->asScenes[i].u16GroupID == u16GroupID))
+        {
+            vRemoveScene(psNode, i);
+        }
+    }
+}
+
+
+/** Start the cluster specific response to a command */
+static void vResponseInit(tsCommand *psCommand, uint16_t u16Type)
+{
+    vFrameInit(&psCommand->sResponse, u16Type);
+    vPut8(&psCommand->sResponse, psCommand->u8SequenceNo);
+    vPut8(&psCommand->sResponse, psCommand->u8Endpoint);
+    vPut16(&psCommand->sResponse, psCommand->u16ClusterID);
+}
+
+
+static void vSetOn(tsCommand *psCommand, uint8_t bOn)
+{
+    if (psCommand->psNode->bOn != bOn)
+    {
+        psCommand->psNode->bOn = bOn;
+        vChanged(psCommand, E_ZB_CLUSTERID_ONOFF, E_ZB_ATTRIBUTEID_ONOFF_ONOFF);
+    }
+}
+
+
+static void vSetLevel(tsCommand *psCommand, int iLevel)
+{
+    if (iLevel < 1)
+    {
+        iLevel = 1;
+    }
+    if (iLevel > 0xFE)
+    {
+        iLevel = 0xFE;
+    }
+    if (psCommand->psNode->u8Level != iLevel)
+    {
+        psCommand->psNode->u8Level = iLevel;
+        vChanged(psCommand, E_ZB_CLUSTERID_LEVEL_CONTROL, E_ZB_ATTRIBUTEID_LEVEL_CURRENTLEVEL);
+    }
+}
+
+
+static uint8_t eNoAction(tsCommand *psCommand)
+{
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eIdentify(tsCommand *psCommand)
+{
+    psCommand->psNode->u16IdentifyTime = u16Get(psCommand->pu8Payload);
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eAddGroup(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8Status = ZCL_SUCCESS;
+
+    if (iFindGroup(psNode, u16GroupID) >= 0)
+    {
+        u8Status = ZCL_DUPLICATE_EXISTS;
+    }
+    else if (psNode->u8NumGroups == NODE_MAX_GROUPS)
+    {
+        u8Status = ZCL_INSUFFICIENT_SPACE;
+    }
+    else
+    {
+        psNode->au16Groups[psNode->u8NumGroups++] = u16GroupID;
+    }
+
+    vResponseInit(psCommand, E_SL_MSG_ADD_GROUP_RESPONSE);
+    vPut8(&psCommand->sResponse, u8Status);
+    vPut16(&psCommand->sResponse, u16GroupID);
+    return u8Status;
+}
+
+
+static uint8_t eViewGroup(tsCommand *psCommand)
+{
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8Status = (iFindGroup(psCommand->psNode, u16GroupID) >= 0) ? ZCL_SUCCESS : ZCL_NOT_FOUND;
+
+    vResponseInit(psCommand, E_SL_MSG_VIEW_GROUP | 0x8000);
+    vPut8(&psCommand->sResponse, u8Status);
+    vPut16(&psCommand->sResponse, u16GroupID);
+    return u8Status;
+}
+
+
+static uint8_t eGetGroupMembership(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    uint8_t u8NumGroups = psCommand->pu8Payload[0];
+    uint16_t u16CountPosition;
+    int i, j;
+
+    if (psCommand->u16Length < (1 + (2 * u8NumGroups)))
+    {
+        return ZCL_MALFORMED_COMMAND;
+    }
+
+    vResponseInit(psCommand, E_SL_MSG_GET_GROUP_MEMBERSHIP_RESPONSE);
+    vPut8(&psCommand->sResponse, NODE_MAX_GROUPS - psNode->u8NumGroups);
+    u16CountPosition = psCommand->sResponse.u16Length;
+    vPut8(&psCommand->sResponse, 0);
+    for (i = 0; i < psNode->u8NumGroups; i++)
+    {
+        int bListed = (u8NumGroups == 0);
+
+        for (j = 0; j < u8NumGroups; j++)
+        {
+            if (u16Get(&psCommand->pu8Payload[1 + (2 * j)]) == psNode->au16Groups[i])
+            {
+                bListed = 1;
+            }
+        }
+        if (bListed)
+        {
+            vPut16(&psCommand->sResponse, psNode->au16Groups[i]);
+            psCommand->sResponse.au8Payload[u16CountPosition]++;
+        }
+    }
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eRemoveGroup(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    int iGroup = iFindGroup(psNode, u16GroupID);
+    uint8_t u8Status = ZCL_NOT_FOUND;
+
+    if (iGroup >= 0)
+    {
+        psNode->au16Groups[iGroup] = psNode->au16Groups[--psNode->u8NumGroups];
+        vRemoveScenes(psNode, u16GroupID);
+        u8Status = ZCL_SUCCESS;
+    }
+
+    vResponseInit(psCommand, E_SL_MSG_REMOVE_GROUP_RESPONSE);
+    vPut8(&psCommand->sResponse, u8Status);
+    vPut16(&psCommand->sResponse, u16GroupID);
+    return u8Status;
+}
+
+
+static uint8_t eRemoveAllGroups(tsCommand *psCommand)
+{
+    int i;
+
+    for (i = 0; i < psCommand->psNode->u8NumGroups; i++)
+    {
+        vRemoveScenes(psCommand->psNode, psCommand->psNode->au16Groups[i]);
+    }
+    psCommand->psNode->u8NumGroups = 0;
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eAddGroupIfIdentify(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+
+    if (psNode->u16IdentifyTime && (iFindGroup(psNode, u16GroupID) < 0) && (psNode->u8NumGroups < NODE_MAX_GROUPS))
+    {
+        psNode->au16Groups[psNode->u8NumGroups++] = u16GroupID;
+    }
+    return ZCL_SUCCESS;
+}
+
+
+/** Check the group of a scenes command exists. Returns the ZCL status */
+static uint8_t eSceneGroup(tsCommand *psCommand, uint16_t u16GroupID)
+{
+    if (!bHasCluster(psCommand->psNode, E_ZB_CLUSTERID_SCENES))
+    {
+        return ZCL_UNSUPPORTED_CLUSTER;
+    }
+    if ((u16GroupID != 0) && (iFindGroup(psCommand->psNode, u16GroupID) < 0))
+    {
+        return ZCL_INVALID_FIELD;
+    }
+    return ZCL_SUCCESS;
+}
+
+
+static void vSceneResponse(tsCommand *psCommand, uint16_t u16Type, uint8_t u8Status, uint16_t u16GroupID, uint8_t u8SceneID)
+{
+    vResponseInit(psCommand, u16Type);
+    vPut8(&psCommand->sResponse, u8Status);
+    vPut16(&psCommand->sResponse, u16GroupID);
+    vPut8(&psCommand->sResponse, u8SceneID);
+}
+
+
+static void vStoreScene(tsNode *psNode, tsScene *psScene)
+{
+    psScene->bOn = psNode->bOn;
+    psScene->u8Level = psNode->u8Level;
+    psScene->u8ColourMode = psNode->u8ColourMode;
+    psScene->u8Hue = psNode->u8Hue;
+    psScene->u8Saturation = psNode->u8Saturation;
+    psScene->u16X = psNode->u16X;
+    psScene->u16Y = psNode->u16Y;
+    psScene->u16ColourTemperature = psNode->u16ColourTemperature;
+}
+
+
+/** Store the current state in a scene, adding it if it is new. Returns the ZCL status */
+static uint8_t eSaveScene(tsCommand *psCommand, uint16_t u16GroupID, uint8_t u8SceneID, uint16_t u16TransitionTime)
+{
+    tsNode *psNode = psCommand->psNode;
+    int iScene = iFindScene(psNode, u16GroupID, u8SceneID);
+
+    if (iScene < 0)
+    {
+        if (psNode->u8NumScenes == NODE_MAX_SCENES)
+        {
+            return ZCL_INSUFFICIENT_SPACE;
+        }
+        iScene = psNode->u8NumScenes++;
+        psNode->asScenes[iScene].u16GroupID = u16GroupID;
+        psNode->asScenes[iScene].u8SceneID = u8SceneID;
+        psNode->asScenes[iScene].u16TransitionTime = u16TransitionTime;
+    }
+    vStoreScene(psNode, &psNode->asScenes[iScene]);
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eViewScene(tsCommand *psCommand)
+{
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8SceneID = psCommand->pu8Payload[2];
+    uint8_t u8Status = eSceneGroup(psCommand, u16GroupID);
+    int iScene = -1;
+
+    if ((u8Status == ZCL_SUCCESS) && ((iScene = iFindScene(psCommand->psNode, u16GroupID, u8SceneID)) < 0))
+    {
+        u8Status = ZCL_NOT_FOUND;
+    }
+    vSceneResponse(psCommand, E_SL_MSG_VIEW_SCENE | 0x8000, u8Status, u16GroupID, u8SceneID);
+    if (u8Status == ZCL_SUCCESS)
+    {
+        vPut16(&psCommand->sResponse, psCommand->psNode->asScenes[iScene].u16TransitionTime);
+        vPut8(&psCommand->sResponse, 0);        /* Name */
+        vPut16(&psCommand->sResponse, 0);       /* Extension fields */
+    }
+    return u8Status;
+}
+
+
+static uint8_t eAddScene(tsCommand *psCommand)
+{
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8SceneID = psCommand->pu8Payload[2];
+    uint8_t u8Status = eSceneGroup(psCommand, u16GroupID);
+
+    /* The host's add scene carries no extension fields, so the scene takes the current state */
+    if (u8Status == ZCL_SUCCESS)
+    {
+        u8Status = eSaveScene(psCommand, u16GroupID, u8SceneID, u16Get(&psCommand->pu8Payload[3]));
+    }
+    vSceneResponse(psCommand, E_SL_MSG_ADD_SCENE | 0x8000, u8Status, u16GroupID, u8SceneID);
+    return u8Status;
+}
+
+
+static uint8_t eRemoveScene(tsCommand *psCommand)
+{
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8SceneID = psCommand->pu8Payload[2];
+    uint8_t u8Status = eSceneGroup(psCommand, u16GroupID);
+    int iScene;
+
+    if (u8Status == ZCL_SUCCESS)
+    {
+        if ((iScene = iFindScene(psCommand->psNode, u16GroupID, u8SceneID)) < 0)
+        {
+            u8Status = ZCL_NOT_FOUND;
+        }
+        else
+        {
+            vRemoveScene(psCommand->psNode, iScene);
+        }
+    }
+    vSceneResponse(psCommand, E_SL_MSG_REMOVE_SCENE_RESPONSE, u8Status, u16GroupID, u8SceneID);
+    return u8Status;
+}
+
+
+static uint8_t eRemoveAllScenes(tsCommand *psCommand)
+{
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8Status = eSceneGroup(psCommand, u16GroupID);
+
+    if (u8Status == ZCL_SUCCESS)
+    {
+        vRemoveScenes(psCommand->psNode, u16GroupID);
+    }
+    vResponseInit(psCommand, E_SL_MSG_REMOVE_ALL_SCENES | 0x8000);
+    vPut8(&psCommand->sResponse, u8Status);
+    vPut16(&psCommand->sResponse, u16GroupID);
+    return u8Status;
+}
+
+
+static uint8_t eStoreScene(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8SceneID = psCommand->pu8Payload[2];
+    uint8_t u8Status = eSceneGroup(psCommand, u16GroupID);
+
+    if (u8Status == ZCL_SUCCESS)
+    {
+        u8Status = eSaveScene(psCommand, u16GroupID, u8SceneID, 0);
+    }
+    if (u8Status == ZCL_SUCCESS)
+    {
+        psNode->u8CurrentScene = u8SceneID;
+        psNode->u16CurrentGroup = u16GroupID;
+        psNode->bSceneValid = 1;
+        vChanged(psCommand, E_ZB_CLUSTERID_SCENES, E_ZB_ATTRIBUTEID_SCENE_CURRENTSCENE);
+    }
+    vSceneResponse(psCommand, E_SL_MSG_STORE_SCENE_RESPONSE, u8Status, u16GroupID, u8SceneID);
+    return u8Status;
+}
+
+
+static uint8_t eRecallScene(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8SceneID = psCommand->pu8Payload[2];
+    uint8_t u8Status = eSceneGroup(psCommand, u16GroupID);
+    tsScene *psScene;
+    int iScene;
+
+    if (u8Status != ZCL_SUCCESS)
+    {
+        return u8Status;
+    }
+    if ((iScene = iFindScene(psNode, u16GroupID, u8SceneID)) < 0)
+    {
+        return ZCL_NOT_FOUND;
+    }
+    psScene = &psNode->asScenes[iScene];
+
+    vSetOn(psCommand, psScene->bOn);
+    vSetLevel(psCommand, psScene->u8Level);
+    psNode->u8ColourMode = psScene->u8ColourMode;
+    psNode->u8Hue = psScene->u8Hue;
+    psNode->u8Saturation = psScene->u8Saturation;
+    psNode->u16X = psScene->u16X;
+    psNode->u16Y = psScene->u16Y;
+    psNode->u16ColourTemperature = psScene->u16ColourTemperature;
+    psNode->u8CurrentScene = u8SceneID;
+    psNode->u16CurrentGroup = u16GroupID;
+    psNode->bSceneValid = 1;
+    vChanged(psCommand, E_ZB_CLUSTERID_SCENES, E_ZB_ATTRIBUTEID_SCENE_CURRENTSCENE);
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eSceneMembership(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    uint16_t u16GroupID = u16Get(psCommand->pu8Payload);
+    uint8_t u8Status = eSceneGroup(psCommand, u16GroupID);
+    uint16_t u16CountPosition;
+    int i;
+
+    vResponseInit(psCommand, E_SL_MSG_SCENE_MEMBERSHIP_RESPONSE);
+    vPut8(&psCommand->sResponse, u8Status);
+    vPut8(&psCommand->sResponse, NODE_MAX_SCENES - psNode->u8NumScenes);
+    vPut16(&psCommand->sResponse, u16GroupID);
+    u16CountPosition = psCommand->sResponse.u16Length;
+    vPut8(&psCommand->sResponse, 0);
+    if (u8Status == ZCL_SUCCESS)
+    {
+        for (i = 0; i < psNode->u8NumScenes; i++)
+        {
+            if (psNode->asScenes[i].u16GroupID == u16GroupID)
+            {
+                vPut8(&psCommand->sResponse, psNode->asScenes[i].u8SceneID);
+                psCommand->sResponse.au8Payload[u16CountPosition]++;
+            }
+        }
+    }
+    return u8Status;
+}
+
+
+/** Any change of state leaves the current scene */
+static void vSceneInvalid(tsCommand *psCommand)
+{
+    if (psCommand->psNode->bSceneValid)
+    {
+        psCommand->psNode->bSceneValid = 0;
+    }
+}
+
+
+static uint8_t eOnOff(tsCommand *psCommand)
+{
+    uint8_t u8Mode = psCommand->pu8Payload[0];
+
+    if (u8Mode > 2)
+    {
+        return ZCL_INVALID_FIELD;
+    }
+    psCommand->u8CommandID = u8Mode;
+    vSetOn(psCommand, (u8Mode == 2) ? !psCommand->psNode->bOn : u8Mode);
+    vSceneInvalid(psCommand);
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eOnOffTimed(tsCommand *psCommand)
+{
+    psCommand->psNode->u16OnTime = u16Get(&psCommand->pu8Payload[1]);
+    psCommand->psNode->u16OffWaitTime = u16Get(&psCommand->pu8Payload[3]);
+    vSetOn(psCommand, 1);
+    vSceneInvalid(psCommand);
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eOnOffEffect(tsCommand *psCommand)
+{
+    vSetOn(psCommand, 0);
+    vSceneInvalid(psCommand);
+    return ZCL_SUCCESS;
+}
+
+
+/** Level commands come with or without on/off, which is the same command ID plus 4 */
+static void vLevelWithOnOff(tsCommand *psCommand, int iLevel)
+{
+    if (psCommand->pu8Payload[0])
+    {
+        psCommand->u8CommandID += 4;
+        vSetOn(psCommand, iLevel > 1);
+    }
+    vSetLevel(psCommand, iLevel);
+    vSceneInvalid(psCommand);
+}
+
+
+static uint8_t eLevelMove(tsCommand *psCommand)
+{
+    /* The move runs at once to its end */
+    vLevelWithOnOff(psCommand, (psCommand->pu8Payload[1] == 0) ? 0xFE : 1);
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eLevelMoveToLevel(tsCommand *psCommand)
+{
+    vLevelWithOnOff(psCommand, psCommand->pu8Payload[1]);
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eLevelStep(tsCommand *psCommand)
+{
+    int iStep = psCommand->pu8Payload[2];
+
+    vLevelWithOnOff(psCommand, psCommand->psNode->u8Level + ((psCommand->pu8Payload[1] == 0) ? iStep : -iStep));
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eLevelStop(tsCommand *psCommand)
+{
+    return ZCL_SUCCESS;
+}
+
+
+static uint8_t eColourCommand(tsCommand *psCommand)
+{
+    tsNode *psNode = psCommand->psNode;
+    const uint8_t *pu8Payload = psCommand->pu8Payload;
+    uint8_t u8ColourMode = psNode->u8ColourMode;
+
+    switch (psCommand->u8CommandID)
+    {
+        case (0x00):    /* Move to hue */
+            psNode->u8Hue = pu8Payload[0];
+            u8ColourMode = 0;
+            break;
+        case (0x02):    /* Step hue */
+            psNode->u8Hue += (pu8Payload[0] == 1) ? pu8Payload[1] : -pu8Payload[1];
+            u8ColourMode = 0;
+            break;
+        case (0x03):    /* Move to saturation */
+            psNode->u8Saturation = pu8Payload[0];
+            u8ColourMode = 0;
+            break;
+        case (0x05):    /* Step saturation */
+            psNode->u8Saturation += (pu8Payload[0] == 1) ? pu8Payload[1] : -pu8Payload[1];
+            u8ColourMode = 0;
+            break;
+        case (0x06):    /* Move to hue and saturation */
+            psNode->u8Hue = pu8Payload[0];
+            psNode->u8Saturation = pu8Payload[1];
+            u8ColourMode = 0;
+            break;
+        case (0x07):    /* Move to colour */
+            psNode->u16X = u16Get(&pu8Payload[0]);
+            psNode->u16Y = u16Get(&pu8Payload[2]);
+            vChanged(psCommand, E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTX);
+            vChanged(psCommand, E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTY);
+            u8ColourMode = 1;
+            break;
+        case (0x09):    /* Step colour */
+            psNode->u16X += (int16_t)u16Get(&pu8Payload[0]);
+            psNode->u16Y += (int16_t)u16Get(&pu8Payload[2]);
+            u8ColourMode = 1;
+            break;
+        case (0x0A):    /* Move to colour temperature */
+            psNode->u16ColourTemperature = u16Get(&pu8Payload[0]);
+            vChanged(psCommand, E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_COLOURTEMPERATURE);
+            u8ColourMode = 2;
+            break;
+        case (0x40):    /* Enhanced move to hue */
+            psNode->u16EnhancedHue = u16Get(&pu8Payload[1]);
+            psNode->u8Hue = psNode->u16EnhancedHue >> 8;
+            u8ColourMode = 0;
+            break;
+        case (0x43):    /* Enhanced move to hue and saturation */
+            psNode->u8Saturation = pu8Payload[0];
+            psNode->u16EnhancedHue = u16Get(&pu8Payload[1]);
+            psNode->u8Hue = psNode->u16EnhancedHue >> 8;
+            u8ColourMode = 0;
+            break;
+        default:
+            /* Moves, loops and stops leave the colour where it is */
+            return ZCL_SUCCESS;
+    }
+
+    if (u8ColourMode == 0)
+    {
+        vChanged(psCommand, E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTHUE);
+        vChanged(psCommand, E_ZB_CLUSTERID_COLOR_CONTROL, E_ZB_ATTRIBUTEID_COLOUR_CURRENTSAT);
+    }
+    psNode->u8ColourMode = u8ColourMode;
+    psNode->u8EnhancedColourMode = u8ColourMode;
+    vSceneInvalid(psCommand);
+    return ZCL_SUCCESS;
+}
+
+
+/** Find the nodes a ZCL command is addressed to. Returns how many */
+static uint32_t u32FindTargets(uint8_t u8AddressMode, uint16_t u16Address, uint8_t u8Endpoint, int *pbUnicast)
+{
+    uint32_t u32NumTargets = 0;
+    uint32_t u32Node;
+
+    *pbUnicast = 0;
+    switch (u8AddressMode)
+    {
+        case (E_ZB_ADDRESS_MODE_SHORT):
+        case (E_ZB_ADDRESS_MODE_SHORT_NO_ACK):
+            if (u16Address >= E_ZB_BROADCAST_ADDRESS_LOWPOWERROUTERS)
+            {
+                break;
+            }
+            if (((u32Node = u32FindNode(u16Address)) != NO_NODE) &&
+                (asEndpoints[asNodes[u32Node].eType].u8Endpoint == u8Endpoint))
+            {
+                pu32Targets[u32NumTargets++] = u32Node;
+            }
+            *pbUnicast = 1;
+            return u32NumTargets;
+
+        case (E_ZB_ADDRESS_MODE_GROUP):
+            for (u32Node = 0; u32Node < u32NumNodes; u32Node++)
+            {
+                if (asNodes[u32Node].bJoined && (iFindGroup(&asNodes[u32Node], u16Address) >= 0))
+                {
+                    pu32Targets[u32NumTargets++] = u32Node;
+                }
+            }
+            return u32NumTargets;
+
+        default:
+            break;
+    }
+
+    /* Broadcast */
+    for (u32Node = 0; u32Node < u32NumNodes; u32Node++)
+    {
+        if (asNodes[u32Node].bJoined)
+        {
+            pu32Targets[u32NumTargets++] = u32Node;
+        }
+    }
+    return u32NumTargets;
+}
+
+
+/** Send a command's answer from the node, and report the attributes it changed */
+static void vZclAnswer(tsCommand *psCommand, uint8_t u8Status)
+{
+    uint64_t u64Send = psCommand->u64Arrival + NODE_PROCESSING_US;
+    int i;
+
+    if (psCommand->bUnicast)
+    {
+        if (psCommand->sResponse.u16Type == 0)
+        {
+            vFrameInit(&psCommand->sResponse, E_SL_MSG_DEFAULT_RESPONSE);
+            vPut8(&psCommand->sResponse, psCommand->u8SequenceNo);
+            vPut8(&psCommand->sResponse, psCommand->u8Endpoint);
+            vPut16(&psCommand->sResponse, psCommand->u16ClusterID);
+            vPut8(&psCommand->sResponse, psCommand->u8CommandID);
+            vPut8(&psCommand->sResponse, u8Status);
+        }
+        sStats.u32Responses++;
+        vNodeSend(psCommand->psNode, psCommand->bAck, u64Send, &psCommand->sResponse);
+    }
+
+    if (bReportChanges)
+    {
+        for (i = 0; i < psCommand->u8NumChanged; i++)
+        {
+            vSendReport(psCommand->u32Node, psCommand->au16Changed[i][0], psCommand->au16Changed[i][1], u64Send);
+        }
+    }
+}
+
+
+/** Carry a ZCL command to each node it is addressed to. Returns 0 if the command is malformed */
+static int bHandleZclCommand(const tsZclCommand *psZclCommand, const uint8_t *pu8Payload, uint16_t u16Length,
+                             uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint32_t u32NumTargets, i;
+    uint64_t u64Arrival;
+    tsCommand sCommand;
+    int bUnicast;
+
+    if (u16Length < (ZCL_ADDRESS_HEADER + psZclCommand->u8Length))
+    {
+        return 0;
+    }
+
+    u32NumTargets = u32FindTargets(pu8Payload[0], u16Get(&pu8Payload[1]), pu8Payload[4], &bUnicast);
+    for (i = 0; i < u32NumTargets; i++)
+    {
+        memset(&sCommand, 0, sizeof(tsCommand));
+        sCommand.u8SequenceNo   = u8SequenceNo;
+        sCommand.u32Node        = pu32Targets[i];
+        sCommand.psNode         = &asNodes[pu32Targets[i]];
+        sCommand.u8Endpoint     = asEndpoints[sCommand.psNode->eType].u8Endpoint;
+        sCommand.bUnicast       = bUnicast;
+        sCommand.bAck           = (pu8Payload[0] == E_ZB_ADDRESS_MODE_SHORT);
+        sCommand.pu8Payload     = &pu8Payload[ZCL_ADDRESS_HEADER];
+        sCommand.u16Length      = u16Length - ZCL_ADDRESS_HEADER;
+        sCommand.u16ClusterID   = psZclCommand->u16ClusterID;
+        sCommand.u8CommandID    = psZclCommand->u8CommandID;
+
+        if (!bAirTransfer(sCommand.psNode, sCommand.bAck, u64Now, &u64Arrival))
+        {
+            continue;
+        }
+        sCommand.u64Arrival = u64Arrival;
+
+        if (!bHasCluster(sCommand.psNode, psZclCommand->u16ClusterID))
+        {
+            vZclAnswer(&sCommand, ZCL_UNSUPPORTED_CLUSTER);
+        }
+        else
+        {
+            vZclAnswer(&sCommand, psZclCommand->prHandler(&sCommand));
+        }
+    }
+    return 1;
+}
+
+
+static void vHandleReadAttributes(const uint8_t *pu8Payload, uint16_t u16Length, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint16_t u16ClusterID = u16Get(&pu8Payload[5]);
+    uint8_t u8NumAttributes = pu8Payload[11];
+    uint32_t u32NumTargets, i;
+    uint64_t u64Arrival;
+    int bUnicast, bAck = (pu8Payload[0] == E_ZB_ADDRESS_MODE_SHORT);
+    int j;
+
+    if (u16Length < (12 + (2 * u8NumAttributes)))
+    {
+        return;
+    }
+
+    u32NumTargets = u32FindTargets(pu8Payload[0], u16Get(&pu8Payload[1]), pu8Payload[4], &bUnicast);
+    for (i = 0; i < u32NumTargets; i++)
+    {
+        uint32_t u32Node = pu32Targets[i];
+        tsNode *psNode = &asNodes[u32Node];
+
+        if (!bAirTransfer(psNode, bAck, u64Now, &u64Arrival))
+        {
+            continue;
+        }
+
+        /* The firmware passes each attribute of the response up on its own */
+        for (j = 0; j < u8NumAttributes; j++)
+        {
+            uint16_t u16AttributeID = u16Get(&pu8Payload[12 + (2 * j)]);
+            const tsAttribute *psAttribute = psFindAttribute(psNode, u16ClusterID, u16AttributeID);
+            tsFrame sFrame;
+
+            vFrameInit(&sFrame, E_SL_MSG_READ_ATTRIBUTE_RESPONSE);
+            vPut8(&sFrame, u8SequenceNo);
+            vPut16(&sFrame, u16ShortAddress(u32Node));
+            vPut8(&sFrame, asEndpoints[psNode->eType].u8Endpoint);
+            vPut16(&sFrame, u16ClusterID);
+            vPut16(&sFrame, u16AttributeID);
+            if (psAttribute)
+            {
+                vPut8(&sFrame, ZCL_SUCCESS);
+                vPutAttribute(&sFrame, psNode, psAttribute);
+            }
+            else
+            {
+                vPut8(&sFrame, ZCL_UNSUPPORTED_ATTRIBUTE);
+                vPut8(&sFrame, E_ZCL_NULL);
+            }
+            sStats.u32Responses++;
+            vNodeSend(psNode, bAck, u64Arrival + NODE_PROCESSING_US, &sFrame);
+        }
+    }
+}
+
+
+static void vHandleWriteAttributes(const uint8_t *pu8Payload, uint16_t u16Length, uint8_t u8SequenceNo, uint64_t u64Now)
+{
+    uint16_t u16ClusterID = u16Get(&pu8Payload[5]);
+    uint8_t u8NumAttributes = pu8Payload[11];
+    uint32_t u32NumTargets, i;
+    uint64_t u64Arrival;
+    int bUnicast, bAck = (pu8Payload[0] == E_ZB_ADDRESS_MODE_SHORT);
+    int j;
+
+    u32NumTargets = u32FindTargets(pu8Payload[0], u16Get(&pu8Payload[1]), pu8Payload[4], &bUnicast);
+    for (i = 0; i < u32NumTargets; i++)
+    {
+        uint32_t u32Node = pu32Targets[i];
+        tsNode *psNode = &asNodes[u32Node];
+        uint16_t u16Position = 12;
+        uint16_t u16FailedAttribute = 0;
+        uint8_t u8Status = ZCL_SUCCESS;
+        tsFrame sFrame;
+
+        if (!bAirTransfer(psNode, bAck, u64Now, &u64Arrival))
+        {
+            continue;
+        }
+
+        for (j = 0; (j < u8NumAttributes) && ((u16Position + 3) <= u16Length); j++)
+        {
+            uint16_t u16AttributeID = u16Get(&pu8Payload[u16Position]);
+            uint8_t u8Type = pu8Payload[u16Position + 2];
+            uint8_t u8Size = u8TypeSize(u8Type);
+            const tsAttribute *psAttribute = psFindAttribute(psNode, u16ClusterID, u16AttributeID);
+            uint8_t u8AttributeStatus = ZCL_SUCCESS;
+            uint32_t u32Value = 0;
+            int k;
+
+            u16Position += 3;
+            if ((u8Size == 0) || ((u16Position + u8Size) > u16Length))
+            {
+                u8Status = ZCL_MALFORMED_COMMAND;
+                u16FailedAttribute = u16AttributeID;
+                break;
+            }
+            for (k = 0; k < u8Size; k++)
+            {
+                u32Value = (u32Value << 8) | pu8Payload[u16Position + k];
+            }
+            u16Position += u8Size;
+
+            if (!psAttribute)
+            {
+                u8AttributeStatus = ZCL_UNSUPPORTED_ATTRIBUTE;
+            }
+            else if (!psAttribute->bWritable)
+            {
+                u8AttributeStatus = ZCL_READ_ONLY;
+            }
+            else if (psAttribute->u8Type != u8Type)
+            {
+                u8AttributeStatus = ZCL_INVALID_DATA_TYPE;
+            }
+            else
+            {
+                vAttributeSet(psNode, psAttribute, u32Value);
+            }
+            if ((u8AttributeStatus != ZCL_SUCCESS) && (u8Status == ZCL_SUCCESS))
+            {
+                u8Status = u8AttributeStatus;
+                u16FailedAttribute = u16AttributeID;
+            }
+        }
+
+        if (!bUnicast)
+        {
+            continue;
+        }
+
+        /* The write attributes response comes up as the raw ZCL frame */
+        vFrameInit(&sFrame, E_SL_MSG_DATA_INDICATION);
+        vPut8(&sFrame, 0);
+        vPut16(&sFrame, asEndpoints[psNode->eType].u16ProfileID);
+        vPut16(&sFrame, u16ClusterID);
+        vPut8(&sFrame, asEndpoints[psNode->eType].u8Endpoint);
+        vPut8(&sFrame, pu8Payload[3]);
+        vPut8(&sFrame, E_ZB_ADDRESS_MODE_SHORT);
+        vPut16(&sFrame, u16ShortAddress(u32Node));
+        vPut8(&sFrame, E_ZB_ADDRESS_MODE_SHORT);
+        vPut16(&sFrame, 0x0000);
+        vPut8(&sFrame, ZCL_FC_SERVER_TO_CLIENT);
+        vPut8(&sFrame, u8SequenceNo);
+        vPut8(&sFrame, ZCL_WRITE_ATTRIBUTES_RESPONSE);
+        vPut8(&sFrame, u8Status);
+        if (u8Status != ZCL_SUCCESS)
+        {
+            vPut16(&sFrame, u16FailedAttribute);
+        }
+        sStats.u32Responses++;
+        vNodeSend(psNode, bAck, u64Arrival + NODE_PROCESSING_US, &sFrame);
+    }
+}
+
+
+/****************************************************************************/
+/***        Commands from the host                                        ***/
+/****************************************************************************/
+
+static const tsZclCommand *psFindZclCommand(uint16_t u16Type)
+{
+    int i;
+
+    for (i = 0; i < (sizeof(asZclCommands) / sizeof(tsZclCommand)); i++)
+    {
+        if (asZclCommands[i].u16MessageType == u16Type)
+        {
+            return &asZclCommands[i];
+        }
+    }
+    return NULL;
+}
+
+
+/** Check a command is long enough. Returns 0 and sends an error status if it is not */
+static int bCheckLength(uint16_t u16Type, uint16_t u16Length, uint16_t u16Needed, uint8_t u8SequenceNo)
+{
+    if (u16Length < u16Needed)
+    {
+        vSendStatus(STATUS_INCORRECT_PARAMETERS, u8SequenceNo, u16Type);
+        return 0;
+    }
+    return 1;
+}
+
+
+static void vHandleCommand(tsSL_PtyReceiver *psReceiver, uint64_t u64Now)
+{
+    uint16_t u16Type = psReceiver->u16Type;
+    uint16_t u16Length = psReceiver->u16Length;
+    const uint8_t *pu8Payload = psReceiver->au8Payload;
+    const tsZclCommand *psZclCommand;
+    uint8_t u8SequenceNo;
+    int bNetwork = (sBridge.eState == E_STATE_RUNNING);
+
+    /* The firmware answers nothing but the PDM while it waits for it */
+    switch (u16Type)
+    {
+        case (E_SL_MSG_PDM_AVAILABLE_RESPONSE):
+            if (sBridge.eState == E_STATE_PDM_WAIT)
+            {
+                sBridge.eState = E_STATE_PDM_LOAD;
+                vPdmSendLoadRequest(PDM_ID_NETWORK, u64Now);
+            }
+            return;
+        case (E_SL_MSG_PDM_LOAD_RECORD_RESPONSE):
+            vHandlePdmLoadResponse(pu8Payload, u16Length, u64Now);
+            return;
+        case (E_SL_MSG_PDM_SAVE_RECORD_RESPONSE):
+            vHandlePdmSaveResponse(pu8Payload, u16Length, u64Now);
+            return;
+        case (E_SL_MSG_PDM_DELETE_ALL_RECORDS_RESPONSE):
+            return;
+        default:
+            break;
+    }
+    if ((sBridge.eState == E_STATE_PDM_WAIT) || (sBridge.eState == E_STATE_PDM_LOAD) || sPdm.u16RecordID)
+    {
+        sStats.u32CommandsIgnored++;
+        return;
+    }
+
+    sStats.u32Commands++;
+    u8SequenceNo = sBridge.u8SequenceNo++;
+
+    if ((psZclCommand = psFindZclCommand(u16Type)) != NULL)
+    {
+        if (!bCheckLength(u16Type, u16Length, ZCL_ADDRESS_HEADER + psZclCommand->u8Length, u8SequenceNo))
+        {
+            return;
+        }
+        vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+        if (bNetwork)
+        {
+            bHandleZclCommand(psZclCommand, pu8Payload, u16Length, u8SequenceNo, u64Now);
+        }
+        return;
+    }
+
+    switch (u16Type)
+    {
+        case (E_SL_MSG_GET_VERSION):
+        {
+            tsFrame sFrame;
+
+            vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            vFrameInit(&sFrame, E_SL_MSG_VERSION_LIST);
+            vPut32(&sFrame, EMULATOR_VERSION);
+            vSendFrame(&sFrame);
+            break;
+        }
+
+        case (E_SL_MSG_RESET):
+            vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            printf("Reset\n");
+            fflush(stdout);
+            vBoot(u64Now);
+            break;
+
+        case (E_SL_MSG_ERASE_PERSISTENT_DATA):
+        {
+            tsFrame sFrame;
+            uint32_t i;
+
+            vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            vFrameInit(&sFrame, E_SL_MSG_PDM_DELETE_ALL_RECORDS_REQUEST);
+            vSendFrame(&sFrame);
+
+            /* The network is gone, and the nodes join the next one formed */
+            sBridge.bFormed = 0;
+            sBridge.eState = E_STATE_FACTORY_NEW;
+            sPdm.bSaveNetwork = 0;
+            sPdm.u64SaveJoinedDue = 0;
+            for (i = 0; i < u32NumNodes; i++)
+            {
+                asNodes[i].bJoined = 0;
+                asNodes[i].bLeft = 0;
+                asNodes[i].u8NumGroups = 0;
+                asNodes[i].u8NumScenes = 0;
+            }
+            sStats.u32Joined = 0;
+            printf("Persistent data erased\n");
+            fflush(stdout);
+            break;
+        }
+
+        case (E_SL_MSG_SET_EXT_PANID):
+            if (bCheckLength(u16Type, u16Length, 8, u8SequenceNo))
+            {
+                sBridge.u64ExtPanIDSet = u64Get(pu8Payload);
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            }
+            break;
+
+        case (E_SL_MSG_SET_CHANNELMASK):
+            if (bCheckLength(u16Type, u16Length, 4, u8SequenceNo))
+            {
+                sBridge.u32ChannelMask = u32Get(pu8Payload);
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            }
+            break;
+
+        case (E_SL_MSG_SET_SECURITY):
+        case (E_SL_MSG_SET_DEVICETYPE):
+        case (E_SL_MSG_PERMIT_JOINING_REQUEST):
+        case (E_SL_MSG_NETWORK_WHITELIST_ENABLE):
+        case (E_SL_MSG_BIND):
+        case (E_SL_MSG_UNBIND):
+            vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            break;
+
+        case (E_SL_MSG_START_NETWORK):
+            if (sBridge.eState != E_STATE_FACTORY_NEW)
+            {
+                vSendStatus(STATUS_STACK_ALREADY_STARTED, u8SequenceNo, u16Type);
+                break;
+            }
+            vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            sBridge.eState = E_STATE_FORMING;
+            sBridge.u64StateTimer = u64Now + FORMATION_US;
+            break;
+
+        case (E_SL_MSG_GET_PERMIT_JOIN):
+        {
+            tsFrame sFrame;
+
+            vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+            vFrameInit(&sFrame, E_SL_MSG_GET_PERMIT_JOIN_RESPONSE);
+            vPut8(&sFrame, bNetwork && (sBridge.u32NextJoin < u32NumNodes));
+            vSendFrame(&sFrame);
+            break;
+        }
+
+        case (E_SL_MSG_NETWORK_ADDRESS_REQUEST):
+        case (E_SL_MSG_IEEE_ADDRESS_REQUEST):
+            if (bCheckLength(u16Type, u16Length, (u16Type == E_SL_MSG_IEEE_ADDRESS_REQUEST) ? 6 : 12, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleAddressRequest(u16Type, pu8Payload, u16Length, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_NODE_DESCRIPTOR_REQUEST):
+            if (bCheckLength(u16Type, u16Length, 2, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleNodeDescriptorRequest(pu8Payload, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_SIMPLE_DESCRIPTOR_REQUEST):
+            if (bCheckLength(u16Type, u16Length, 3, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleSimpleDescriptorRequest(pu8Payload, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_ACTIVE_ENDPOINT_REQUEST):
+            if (bCheckLength(u16Type, u16Length, 2, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleActiveEndpointRequest(pu8Payload, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_MATCH_DESCRIPTOR_REQUEST):
+            if (bCheckLength(u16Type, u16Length, 6, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleMatchDescriptorRequest(pu8Payload, u16Length, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_MANAGEMENT_LQI_REQUEST):
+            if (bCheckLength(u16Type, u16Length, 3, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleManagementLqiRequest(pu8Payload, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_NETWORK_REMOVE_DEVICE):
+            if (bCheckLength(u16Type, u16Length, 12, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleRemoveDevice(pu8Payload, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_READ_ATTRIBUTE_REQUEST):
+            if (bCheckLength(u16Type, u16Length, 12, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleReadAttributes(pu8Payload, u16Length, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        case (E_SL_MSG_WRITE_ATTRIBUTE_REQUEST):
+            if (bCheckLength(u16Type, u16Length, 12, u8SequenceNo))
+            {
+                vSendStatus(STATUS_OK, u8SequenceNo, u16Type);
+                if (bNetwork)
+                {
+                    vHandleWriteAttributes(pu8Payload, u16Length, u8SequenceNo, u64Now);
+                }
+            }
+            break;
+
+        default:
+            sStats.u32CommandsUnhandled++;
+            vSendStatus(STATUS_UNHANDLED_COMMAND, u8SequenceNo, u16Type);
+            break;
+    }
+}
+
+
+/****************************************************************************/
+/***        Main loop                                                     ***/
+/****************************************************************************/
+
+static void vPrintStats(uint64_t u64Now)
+{
+    double dInterval = (u64Now - sStats.u64LastTime) / 1e6;
+    uint32_t u32Backlog = (u64AirFree > u64Now) ? (uint32_t)((u64AirFree - u64Now) / 1000) : 0;
+
+    if (dInterval <= 0)
+    {
+        dInterval = 1;
+    }
+    printf("%7.1fs: %u/%u joined, %u commands (%.0f/s), %u frames sent (%.0f/s), %u responses, %u reports, "
+           "%u lost in the air, %u dropped, air backlog %ums\n",
+           (u64Now - sStats.u64Start) / 1e6, sStats.u32Joined, u32NumNodes,
+           sStats.u32Commands, (sStats.u32Commands - sStats.u32LastCommands) / dInterval,
+           sStats.u32FramesSent, (sStats.u32FramesSent - sStats.u32LastFramesSent) / dInterval,
+           sStats.u32Responses, sStats.u32Reports, sStats.u32AirFailed, sPty.u32Dropped, u32Backlog);
+    fflush(stdout);
+
+    sStats.u32LastCommands = sStats.u32Commands;
+    sStats.u32LastFramesSent = sStats.u32FramesSent;
+    sStats.u64LastTime = u64Now;
+}
+
+
+static void vRun(void)
+{
+    uint64_t u64Now = u64TimeNow();
+    uint64_t u64NextStats = u64Now + u32StatsIntervalUs;
+    uint32_t i;
+
+    sStats.u64Start = u64Now;
+    sStats.u64LastTime = u64Now;
+    vSL_PtyReceiverInit(&sReceiver);
+    vBoot(u64Now);
+
+    while (bRunning)
+    {
+        struct pollfd sPoll;
+        struct timespec sTimeout;
+        uint64_t u64Next = u64Now + 1000000;
+        uint64_t u64Line;
+
+        u64Now = u64TimeNow();
+
+        switch (sBridge.eState)
+        {
+            case (E_STATE_PDM_WAIT):
+                if (u64Now >= sBridge.u64StateTimer)
+                {
+                    tsFrame sFrame;
+
+                    vFrameInit(&sFrame, E_SL_MSG_PDM_AVAILABLE_REQUEST);
+                    vSendFrame(&sFrame);
+                    sBridge.u64StateTimer = u64Now + PDM_AVAILABLE_RETRY_US;
+                }
+                if (sBridge.u64StateTimer < u64Next)
+                {
+                    u64Next = sBridge.u64StateTimer;
+                }
+                break;
+
+            case (E_STATE_PDM_LOAD):
+                if (u64Now >= sPdm.u64Timeout)
+                {
+                    /* The host didn't answer: carry on as if there was nothing saved */
+                    fprintf(stderr, "PDM record 0x%04X: no answer from the host\n", sPdm.u16RecordID);
+                    sPdm.u16RecordID = 0;
+                    vStart(u64Now);
+                }
+                else if (sPdm.u64Timeout < u64Next)
+                {
+                    u64Next = sPdm.u64Timeout;
+                }
+                break;
+
+            case (E_STATE_FORMING):
+                if (u64Now >= sBridge.u64StateTimer)
+                {
+                    vFormed(u64Now);
+                }
+                else if (sBridge.u64StateTimer < u64Next)
+                {
+                    u64Next = sBridge.u64StateTimer;
+                }
+                break;
+
+            case (E_STATE_RUNNING):
+                if (!sPdm.u16RecordID)
+                {
+                    vJoinNodes(u64Now);
+                    if ((sBridge.u32NextJoin < u32NumNodes) && (sBridge.u64NextJoinTime < u64Next))
+                    {
+                        u64Next = sBridge.u64NextJoinTime;
+                    }
+                }
+                vPdmService(u64Now);
+                if (sPdm.u16RecordID && (sPdm.u64Timeout < u64Next))
+                {
+                    u64Next = sPdm.u64Timeout;
+                }
+                if (!sPdm.u16RecordID && sPdm.u64SaveJoinedDue && (sPdm.u64SaveJoinedDue < u64Next))
+                {
+                    u64Next = sPdm.u64SaveJoinedDue;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        /* Frames that have come in over the air, and report timers. Frames wait while
+         * the firmware is busy with the PDM, and are forgotten if it was reset */
+        while (u32NumEvents && (asEvents[0].u64Due <= u64Now))
+        {
+            tsEvent sEvent = asEvents[0];
+
+            if (sEvent.psFrame && sPdm.u16RecordID && (sEvent.u32Boot == sBridge.u32Boot))
+            {
+                break;
+            }
+            vEventPop();
+            if (!sEvent.psFrame)
+            {
+                vNodeReportTimer(sEvent.u32Node, u64Now);
+                continue;
+            }
+            if ((sEvent.u32Boot == sBridge.u32Boot) && (sBridge.eState == E_STATE_RUNNING))
+            {
+                vSendFrame(sEvent.psFrame);
+            }
+            else
+            {
+                sStats.u32Forgotten++;
+            }
+            free(sEvent.psFrame);
+        }
+        if (u32NumEvents && !sPdm.u16RecordID && (asEvents[0].u64Due < u64Next))
+        {
+            u64Next = asEvents[0].u64Due;
+        }
+
+        u64Line = u64FlushLine(u64Now);
+        if (u64Line < u64Next)
+        {
+            u64Next = u64Line;
+        }
+
+        if (u32StatsIntervalUs)
+        {
+            if (u64Now >= u64NextStats)
+            {
+                vPrintStats(u64Now);
+                u64NextStats += u32StatsIntervalUs;
+            }
+            if (u64NextStats < u64Next)
+            {
+                u64Next = u64NextStats;
+            }
+        }
+
+        sPoll.fd = sPty.iMasterFd;
+        sPoll.events = POLLIN;
+        sPoll.revents = 0;
+
+        u64Now = u64TimeNow();
+        u64Next = (u64Next > u64Now) ? (u64Next - u64Now) : 0;
+        sTimeout.tv_sec = u64Next / 1000000;
+        sTimeout.tv_nsec = (u64Next % 1000000) * 1000;
+
+        if (ppoll(&sPoll, 1, &sTimeout, NULL) < 0)
+        {
+            if (errno != EINTR)
+            {
+                perror("poll");
+                break;
+            }
+            continue;
+        }
+
+        u64Now = u64TimeNow();
+        if (sPoll.revents & POLLIN)
+        {
+            uint8_t au8Buffer[1024];
+            ssize_t iRead = read(sPty.iMasterFd, au8Buffer, sizeof(au8Buffer));
+
+            for (i = 0; (iRead > 0) && (i < iRead); i++)
+            {
+                if (bSL_PtyReceiveByte(&sReceiver, au8Buffer[i]))
+                {
+                    vHandleCommand(&sReceiver, u64Now);
+                }
+            }
+        }
+    }
+}
+
+
+static void vReport(void)
+{
+    uint64_t u64Now = u64TimeNow();
+
+    vPrintStats(u64Now);
+    printf("\nRan for %.1fs\n", (u64Now - sStats.u64Start) / 1e6);
+    printf("Nodes:      %u of %u joined, %u announcements\n", sStats.u32Joined, u32NumNodes, sStats.u32Announces);
+    printf("Commands:   %u, %u unhandled, %u ignored while busy with the PDM\n",
+           sStats.u32Commands, sStats.u32CommandsUnhandled, sStats.u32CommandsIgnored);
+    printf("Network:    %u responses, %u reports, %u frames over the air, %u lost, %u never got through\n",
+           sStats.u32Responses, sStats.u32Reports, sStats.u32AirFrames, sStats.u32AirLost, sStats.u32AirFailed);
+    printf("            longest wait for the channel %.1fms, %u frames forgotten by resets\n",
+           sStats.u64AirBacklogMax / 1e3, sStats.u32Forgotten);
+    printf("Serial:     %u frames sent, %u dropped, transmit buffer peaked at %u of %u bytes\n",
+           sStats.u32FramesSent, sPty.u32Dropped, sPty.u32TxBufferMax, sPty.u32TxBufferSize);
+    if (sPty.u32InputQueueSamples)
+    {
+        printf("            daemon's unread input averaged %.0f bytes, peaked at %u\n",
+               (double)sPty.u64InputQueueTotal / sPty.u32InputQueueSamples, sPty.u32InputQueueMax);
+    }
+    printf("PDM:        %u records loaded, %u saved\n", sStats.u32PdmLoads, sStats.u32PdmSaves);
+}
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
@@ -52,6 +52,7 @@
 #include <libdaemon/daemon.h>
 
 #include "SerialLink.h"
+#include "SerialTrace.h"
 #include "Serial.h"
 #include "Utils.h"
 
@@ -75,6 +76,9 @@
 
 #define SL_MAX_CALLBACK_QUEUES 3
 
+/** Time the callback thread waits for callbacks before checking if it should stop */
+#define SL_CALLBACK_WAIT_MS 1000
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -122,7 +126,18 @@ typedef struct
 /** Structure of data for the serial link */
 typedef struct
 {
+    int     iIndex;                         /**< Index of this link */
     int     iSerialFd;
+    int     bOpen;                          /**< The link has been opened and its threads started */
+    
+    /** State of the frame being received */
+    struct
+    {
+        teSL_RxState        eState;
+        uint8_t             u8CRC;
+        uint16_t            u16Bytes;
+        bool                bInEsc;
+    } sRx;
 
 #ifndef WIN32
     pthread_mutex_t         mutex;
@@ -156,6 +171,18 @@ typedef struct
 
     
     tsUtilsThread sSerialReader;
+    
+    /** Statistics. Each counter has one writer, except the callback queue depth */
+    struct
+    {
+        volatile uint32_t   u32TxFrames;            /**< Frames sent */
+        volatile uint32_t   u32RxFrames;            /**< Frames received */
+        volatile uint32_t   u32RxDropped;           /**< Received frames dropped for a bad length or CRC */
+        volatile uint32_t   u32Unhandled;           /**< Received frames no one was waiting or listening for */
+        volatile uint32_t   u32CallbackDepth;       /**< Messages in the callback queue */
+        volatile uint32_t   u32CallbackMaxDepth;    /**< Most messages there have been in the callback queue */
+        tsUtilsHistogram    sCallbackWait;          /**< Time from receiving a message to calling its callback */
+    } sStats;
 } tsSerialLink;
 
 
@@ -163,6 +190,7 @@ typedef struct
 typedef struct
 {
     tsSL_Message            sMessage;       /** The received message */ 
+    uint64_t                u64Received;    /**< Time the message was received */
     tprSL_MessageCallback   prCallback;     /**< User supplied callback function for this message type */
     void *                  pvUser;         /**< User supplied data for the callback function */
 } tsCallbackThreadData;
@@ -176,12 +204,14 @@ typedef struct
 
 static uint8_t u8SL_CalculateCRC(uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data);
 
-static int iSL_TxByte(bool bSpecialCharacter, uint8_t u8Data);
+static int iSL_TxByte(tsSerialLink *psSerialLink, bool bSpecialCharacter, uint8_t u8Data);
 
-static bool bSL_RxByte(uint8_t *pu8Data);
+static bool bSL_RxByte(tsSerialLink *psSerialLink, uint8_t *pu8Data);
 
-static teSL_Status eSL_WriteMessage(uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data);
-static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uint16_t u16MaxLength, uint8_t *pu8Message);
+static teSL_Status eSL_WriteMessage(tsSerialLink *psSerialLink, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data);
+static teSL_Status eSL_ReadMessage(tsSerialLink *psSerialLink, uint16_t *pu16Type, uint16_t *pu16Length, uint16_t u16MaxLength, uint8_t *pu8Message);
+
+static teSL_Status eSL_MessageQueueWait(tsSerialLink *psSerialLink, uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t *pu16Length, void **ppvMessage);
 
 static void *pvReaderThread(tsUtilsThread *psThreadInfo);
 
@@ -192,91 +222,136 @@ static void *pvCallbackHandlerThread(tsUtilsThread *psThreadInfo);
 /***        Exported Variables                                            ***/
 /****************************************************************************/
 
-extern int verbosity;
-
 /****************************************************************************/
 /***        Local Variables                                               ***/
 /****************************************************************************/
 
-static tsSerialLink sSerialLink;
+static tsSerialLink asSerialLinks[SL_MAX_LINKS];
+
+/** Link selected by this thread */
+static __thread int iLinkSelected = 0;
 
 /****************************************************************************/
 /***        Exported Functions                                            ***/
 /****************************************************************************/
 
 
-teSL_Status eSL_Init(char *cpSerialDevice, uint32_t u32BaudRate)
+teSL_Status eSL_Init(int iLink, char *cpSerialDevice, uint32_t u32BaudRate)
 {
+    tsSerialLink *psSerialLink;
     int i;
     
-    if (eSerial_Init(cpSerialDevice, u32BaudRate, &sSerialLink.iSerialFd) != E_SERIAL_OK)
+    if ((iLink < 0) || (iLink >= SL_MAX_LINKS))
+    {
+        daemon_log(LOG_ERR, "Link %d is out of range", iLink);
+        return E_SL_ERROR;
+    }
+    psSerialLink = &asSerialLinks[iLink];
+    psSerialLink->iIndex = iLink;
+    psSerialLink->sRx.eState = E_STATE_RX_WAIT_START;
+    
+    if (eSerial_Init(cpSerialDevice, u32BaudRate, &psSerialLink->iSerialFd) != E_SERIAL_OK)
     {
         return E_SL_ERROR_SERIAL;
     }
     
     /* Initialise serial link mutex */
-    pthread_mutex_init(&sSerialLink.mutex, NULL);
+    pthread_mutex_init(&psSerialLink->mutex, NULL);
     
     /* Initialise message callbacks */
-    pthread_mutex_init(&sSerialLink.sCallbacks.mutex, NULL);
-    sSerialLink.sCallbacks.psListHead = NULL;
+    pthread_mutex_init(&psSerialLink->sCallbacks.mutex, NULL);
+    psSerialLink->sCallbacks.psListHead = NULL;
     
     /* Initialise message wait queue */
     for (i = 0; i < SL_MAX_MESSAGE_QUEUES; i++)
     {
-        pthread_mutex_init(&sSerialLink.asReaderMessageQueue[i].mutex, NULL);
-        pthread_cond_init(&sSerialLink.asReaderMessageQueue[i].cond_data_available, NULL);
-        sSerialLink.asReaderMessageQueue[i].u16Type = 0;
+        pthread_mutex_init(&psSerialLink->asReaderMessageQueue[i].mutex, NULL);
+        pthread_cond_init(&psSerialLink->asReaderMessageQueue[i].cond_data_available, NULL);
+        psSerialLink->asReaderMessageQueue[i].u16Type = 0;
     }
     
-    /* Initialise callback queue */
-    if (eUtils_QueueCreate(&sSerialLink.sCallbackQueue, SL_MAX_CALLBACK_QUEUES, 0) != E_UTILS_OK)
+    /* Initialise callback queue. Only the callback thread takes callbacks from it */
+    if (eUtils_QueueCreate(&psSerialLink->sCallbackQueue, SL_MAX_CALLBACK_QUEUES, UTILS_QUEUE_SINGLE_CONSUMER) != E_UTILS_OK)
     {
         daemon_log(LOG_ERR, "Error creating callabck queue\n");
         return E_SL_ERROR;
     }
     
     /* Start the callback handler thread */
-    sSerialLink.sCallbackThread.pvThreadData = &sSerialLink;
-    if (eUtils_ThreadStart(pvCallbackHandlerThread, &sSerialLink.sCallbackThread, E_THREAD_JOINABLE) != E_UTILS_OK)
+    psSerialLink->sCallbackThread.pvThreadData = psSerialLink;
+    if (eUtils_ThreadStart(pvCallbackHandlerThread, &psSerialLink->sCallbackThread, E_THREAD_JOINABLE) != E_UTILS_OK)
     {
         daemon_log(LOG_ERR, "Failed to start callback handler thread");
         return E_SL_ERROR;
     }
     
     /* Start the serial reader thread */
-    sSerialLink.sSerialReader.pvThreadData = &sSerialLink;
-    if (eUtils_ThreadStart(pvReaderThread, &sSerialLink.sSerialReader, E_THREAD_JOINABLE) != E_UTILS_OK)
+    psSerialLink->sSerialReader.pvThreadData = psSerialLink;
+    if (eUtils_ThreadStart(pvReaderThread, &psSerialLink->sSerialReader, E_THREAD_JOINABLE) != E_UTILS_OK)
     {
         daemon_log(LOG_ERR, "Failed to start serial reader thread");
         return E_SL_ERROR;
     }
     
+    psSerialLink->bOpen = 1;
     return E_SL_OK;
 }
 
 
 teSL_Status eSL_Destroy(void)
 {
-    eUtils_ThreadStop(&sSerialLink.sSerialReader);
+    tsSerialLink *psSerialLink = &asSerialLinks[iLinkSelected];
+    
+    if (!psSerialLink->bOpen)
+    {
+        return E_SL_ERROR;
+    }
+    
+    eUtils_ThreadStop(&psSerialLink->sSerialReader);
  
-    while (sSerialLink.sCallbacks.psListHead)
+    while (psSerialLink->sCallbacks.psListHead)
     {   
-        eSL_RemoveListener(sSerialLink.sCallbacks.psListHead->u16Type, sSerialLink.sCallbacks.psListHead->prCallback);
+        eSL_RemoveListener(psSerialLink->sCallbacks.psListHead->u16Type, psSerialLink->sCallbacks.psListHead->prCallback);
     }
     
+    psSerialLink->bOpen = 0;
     return E_SL_OK;
 }
 
 
+void vSL_SelectLink(int iLink)
+{
+    if ((iLink >= 0) && (iLink < SL_MAX_LINKS))
+    {
+        iLinkSelected = iLink;
+    }
+}
+
+
+int iSL_SelectedLink(void)
+{
+    return iLinkSelected;
+}
+
+
 teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage, uint8_t *pu8SequenceNo)
 {
+    tsSerialLink *psSerialLink = &asSerialLinks[iLinkSelected];
     teSL_Status eStatus;
+    uint64_t u64Start;
     
-    /* Make sure there is only one thread sending messages to the node at a time. */
-    pthread_mutex_lock(&sSerialLink.mutex);
+    /* Make sure there is only one thread sending messages to the node at a time.
+     * Only time waiting for the mutex when another thread is sending. */
+    if (pthread_mutex_trylock(&psSerialLink->mutex) != 0)
+    {
+        u64Start = u64Utils_LatencyStart();
+        pthread_mutex_lock(&psSerialLink->mutex);
+        vUtils_LatencyStage(E_UTILS_LATENCY_LOCK, u64Start);
+    }
     
-    eStatus = eSL_WriteMessage(u16Type, u16Length, (uint8_t *)pvMessage);
+    u64Start = u64Utils_LatencyStart();
+    eStatus = eSL_WriteMessage(psSerialLink, u16Type, u16Length, (uint8_t *)pvMessage);
+    vUtils_LatencyStage(E_UTILS_LATENCY_TX, u64Start);
     
     if (eStatus == E_SL_OK)
     {
@@ -305,15 +380,27 @@ teSL_Status eSL_SendMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessag
             free(psStatus);
         }
     }
-    pthread_mutex_unlock(&sSerialLink.mutex);
+    pthread_mutex_unlock(&psSerialLink->mutex);
     return eStatus;
 }
 
 
 teSL_Status eSL_MessageWait(uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t *pu16Length, void **ppvMessage)
+{
+    teSL_Status eStatus;
+    uint64_t u64Start = u64Utils_LatencyStart();
+    
+    eStatus = eSL_MessageQueueWait(&asSerialLinks[iLinkSelected], u16Type, u32WaitTimeout, pu16Length, ppvMessage);
+    
+    /* Status messages are the node acknowledging a command, anything else is the network's answer */
+    vUtils_LatencyStage((u16Type == E_SL_MSG_STATUS) ? E_UTILS_LATENCY_TX_STATUS : E_UTILS_LATENCY_RESPONSE, u64Start);
+    return eStatus;
+}
+
+
+static teSL_Status eSL_MessageQueueWait(tsSerialLink *psSerialLink, uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t *pu16Length, void **ppvMessage)
 {
     int i;
-    tsSerialLink *psSerialLink = &sSerialLink;
     
     for (i = 0; i < SL_MAX_MESSAGE_QUEUES; i++)
     {
@@ -388,6 +475,7 @@ teSL_Status eSL_MessageWait(uint16_t u16Type, uint32_t u32WaitTimeout, uint16_t
 
 teSL_Status eSL_AddListener(uint16_t u16Type, tprSL_MessageCallback prCallback, void *pvUser)
 {
+    tsSerialLink *psSerialLink = &asSerialLinks[iLinkSelected];
     tsSL_CallbackEntry *psCurrentEntry;
     tsSL_CallbackEntry *psNewEntry;
     
@@ -404,16 +492,16 @@ teSL_Status eSL_AddListener(uint16_t u16Type, tprSL_MessageCallback prCallback,
     psNewEntry->pvUser      = pvUser;
     psNewEntry->psNext      = NULL;
     
-    pthread_mutex_lock(&sSerialLink.sCallbacks.mutex);
-    if (sSerialLink.sCallbacks.psListHead == NULL)
+    pthread_mutex_lock(&psSerialLink->sCallbacks.mutex);
+    if (psSerialLink->sCallbacks.psListHead == NULL)
     {
         /* Insert at start of list */
-        sSerialLink.sCallbacks.psListHead = psNewEntry;
+        psSerialLink->sCallbacks.psListHead = psNewEntry;
     }
     else
     {
         /* Insert at end of list */
-        psCurrentEntry = sSerialLink.sCallbacks.psListHead;
+        psCurrentEntry = psSerialLink->sCallbacks.psListHead;
         while (psCurrentEntry->psNext)
         {
             psCurrentEntry = psCurrentEntry->psNext;
@@ -421,29 +509,52 @@ teSL_Status eSL_AddListener(uint16_t u16Type, tprSL_MessageCallback prCallback,
         
         psCurrentEntry->psNext = psNewEntry;
     }
-    pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
+    pthread_mutex_unlock(&psSerialLink->sCallbacks.mutex);
+    return E_SL_OK;
+}
+
+
+teSL_Status eSL_StatsDump(FILE *psStream)
+{
+    tsSerialLink *psSerialLink = &asSerialLinks[iLinkSelected];
+    tsUtilsHistogramSummary sSummary;
+    
+    fprintf(psStream, "# Serial link %d\n", psSerialLink->iIndex);
+    fprintf(psStream, "%-40s %10u\n", "Frames sent",               psSerialLink->sStats.u32TxFrames);
+    fprintf(psStream, "%-40s %10u\n", "Frames received",           psSerialLink->sStats.u32RxFrames);
+    fprintf(psStream, "%-40s %10u\n", "Frames dropped",            psSerialLink->sStats.u32RxDropped);
+    fprintf(psStream, "%-40s %10u\n", "Frames unhandled",          psSerialLink->sStats.u32Unhandled);
+    fprintf(psStream, "%-40s %10u\n", "Callback queue depth",      psSerialLink->sStats.u32CallbackDepth);
+    fprintf(psStream, "%-40s %10u\n", "Callback queue max depth",  psSerialLink->sStats.u32CallbackMaxDepth);
+    
+    vUtils_HistogramSummarise(&psSerialLink->sStats.sCallbackWait, &sSummary);
+    fprintf(psStream, "# Serial link latencies (us)\n");
+    fprintf(psStream, "%-40s %10s %10s %10s %10s %10s %10s\n", "Queue", "Count", "Mean", "P50", "P90", "P99", "Max");
+    fprintf(psStream, "%-40s %10u %10u %10u %10u %10u %10u\n", "Callback queue wait",
+            sSummary.u32Count, sSummary.u32Mean, sSummary.u32P50, sSummary.u32P90, sSummary.u32P99, sSummary.u32Max);
     return E_SL_OK;
 }
 
 
 teSL_Status eSL_RemoveListener(uint16_t u16Type, tprSL_MessageCallback prCallback)
 {
+    tsSerialLink *psSerialLink = &asSerialLinks[iLinkSelected];
     tsSL_CallbackEntry *psCurrentEntry;
     tsSL_CallbackEntry *psOldEntry = NULL;
     
     DBG_vPrintf(DBG_SERIALLINK_CB, "Remove handler %p for message type 0x%04x\n", prCallback, u16Type);
     
-    pthread_mutex_lock(&sSerialLink.sCallbacks.mutex);
+    pthread_mutex_lock(&psSerialLink->sCallbacks.mutex);
     
-    if (sSerialLink.sCallbacks.psListHead->prCallback == prCallback)
+    if (psSerialLink->sCallbacks.psListHead->prCallback == prCallback)
     {
         /* Start of the list */
-        psOldEntry = sSerialLink.sCallbacks.psListHead;
-        sSerialLink.sCallbacks.psListHead = psOldEntry->psNext;
+        psOldEntry = psSerialLink->sCallbacks.psListHead;
+        psSerialLink->sCallbacks.psListHead = psOldEntry->psNext;
     }
     else
     {
-        psCurrentEntry = sSerialLink.sCallbacks.psListHead;
+        psCurrentEntry = psSerialLink->sCallbacks.psListHead;
         while (psCurrentEntry->psNext)
         {
             if (psCurrentEntry->psNext->prCallback == prCallback)
@@ -454,7 +565,7 @@ teSL_Status eSL_RemoveListener(uint16_t u16Type, tprSL_MessageCallback prCallbac
             }
         }
     }
-    pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
+    pthread_mutex_unlock(&psSerialLink->sCallbacks.mutex);
     
     if (!psOldEntry)
     {
@@ -473,31 +584,28 @@ teSL_Status eSL_RemoveListener(uint16_t u16Type, tprSL_MessageCallback prCallbac
 /****************************************************************************/
 
 
-static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uint16_t u16MaxLength, uint8_t *pu8Message)
+static teSL_Status eSL_ReadMessage(tsSerialLink *psSerialLink, uint16_t *pu16Type, uint16_t *pu16Length, uint16_t u16MaxLength, uint8_t *pu8Message)
 {
-
-    static teSL_RxState eRxState = E_STATE_RX_WAIT_START;
-    static uint8_t u8CRC;
+    /* Receive state is kept with the link, as a frame may arrive over several reads */
+    teSL_RxState *peRxState = &psSerialLink->sRx.eState;
     uint8_t u8Data;
-    static uint16_t u16Bytes;
-    static bool bInEsc = FALSE;
 
-    while(bSL_RxByte(&u8Data))
+    while(bSL_RxByte(psSerialLink, &u8Data))
     {
         DBG_vPrintf(DBG_SERIALLINK_COMMS, "0x%02x\n", u8Data);
         switch(u8Data)
         {
 
         case SL_START_CHAR:
-            u16Bytes = 0;
-            bInEsc = FALSE;
+            psSerialLink->sRx.u16Bytes = 0;
+            psSerialLink->sRx.bInEsc = FALSE;
             DBG_vPrintf(DBG_SERIALLINK_COMMS, "RX Start\n");
-            eRxState = E_STATE_RX_WAIT_TYPEMSB;
+            *peRxState = E_STATE_RX_WAIT_TYPEMSB;
             break;
 
         case SL_ESC_CHAR:
             DBG_vPrintf(DBG_SERIALLINK_COMMS, "Got ESC\n");
-            bInEsc = TRUE;
+            psSerialLink->sRx.bInEsc = TRUE;
             break;
 
         case SL_END_CHAR:
@@ -507,11 +615,15 @@ static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uin
             {
                 /* Sanity check length before attempting to CRC the message */
                 DBG_vPrintf(DBG_SERIALLINK_COMMS, "Length > MaxLength\n");
-                eRxState = E_STATE_RX_WAIT_START;
+                if (*peRxState != E_STATE_RX_WAIT_START)
+                {
+                    psSerialLink->sStats.u32RxDropped++;
+                }
+                *peRxState = E_STATE_RX_WAIT_START;
                 break;
             }
             
-            if(u8CRC == u8SL_CalculateCRC(*pu16Type, *pu16Length, pu8Message))
+            if(psSerialLink->sRx.u8CRC == u8SL_CalculateCRC(*pu16Type, *pu16Length, pu8Message))
             {
 #if DBG_SERIALLINK
                 int i;
@@ -523,20 +635,22 @@ static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uin
                 printf("}\n");
 #endif /* DBG_SERIALLINK */
                 
-                eRxState = E_STATE_RX_WAIT_START;
+                *peRxState = E_STATE_RX_WAIT_START;
                 return E_SL_OK;
             }
             DBG_vPrintf(DBG_SERIALLINK_COMMS, "CRC BAD\n");
+            psSerialLink->sStats.u32RxDropped++;
+            *peRxState = E_STATE_RX_WAIT_START;
             break;
 
         default:
-            if(bInEsc)
+            if(psSerialLink->sRx.bInEsc)
             {
                 u8Data ^= 0x10;
-                bInEsc = FALSE;
+                psSerialLink->sRx.bInEsc = FALSE;
             }
 
-            switch(eRxState)
+            switch(*peRxState)
             {
 
                 case E_STATE_RX_WAIT_START:
@@ -545,17 +659,17 @@ static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uin
 
                 case E_STATE_RX_WAIT_TYPEMSB:
                     *pu16Type = (uint16_t)u8Data << 8;
-                    eRxState++;
+                    (*peRxState)++;
                     break;
 
                 case E_STATE_RX_WAIT_TYPELSB:
                     *pu16Type += (uint16_t)u8Data;
-                    eRxState++;
+                    (*peRxState)++;
                     break;
 
                 case E_STATE_RX_WAIT_LENMSB:
                     *pu16Length = (uint16_t)u8Data << 8;
-                    eRxState++;
+                    (*peRxState)++;
                     break;
 
                 case E_STATE_RX_WAIT_LENLSB:
@@ -564,31 +678,32 @@ static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uin
                     if(*pu16Length > u16MaxLength)
                     {
                         DBG_vPrintf(DBG_SERIALLINK_COMMS, "Length > MaxLength\n");
-                        eRxState = E_STATE_RX_WAIT_START;
+                        psSerialLink->sStats.u32RxDropped++;
+                        *peRxState = E_STATE_RX_WAIT_START;
                     }
                     else
                     {
-                        eRxState++;
+                        (*peRxState)++;
                     }
                     break;
 
                 case E_STATE_RX_WAIT_CRC:
                     DBG_vPrintf(DBG_SERIALLINK_COMMS, "CRC %02x\n", u8Data);
-                    u8CRC = u8Data;
-                    eRxState++;
+                    psSerialLink->sRx.u8CRC = u8Data;
+                    (*peRxState)++;
                     break;
 
                 case E_STATE_RX_WAIT_DATA:
-                    if(u16Bytes < *pu16Length)
+                    if(psSerialLink->sRx.u16Bytes < *pu16Length)
                     {
                         DBG_vPrintf(DBG_SERIALLINK_COMMS, "Data\n");
-                        pu8Message[u16Bytes++] = u8Data;
+                        pu8Message[psSerialLink->sRx.u16Bytes++] = u8Data;
                     }
                     break;
 
                 default:
                     DBG_vPrintf(DBG_SERIALLINK_COMMS, "Unknown state\n");
-                    eRxState = E_STATE_RX_WAIT_START;
+                    *peRxState = E_STATE_RX_WAIT_START;
             }
             break;
 
@@ -611,7 +726,7 @@ static teSL_Status eSL_ReadMessage(uint16_t *pu16Type, uint16_t *pu16Length, uin
  * RETURNS:
  * void
  ****************************************************************************/
-static teSL_Status eSL_WriteMessage(uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data)
+static teSL_Status eSL_WriteMessage(tsSerialLink *psSerialLink, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data)
 {
     int n;
     uint8_t u8CRC;
@@ -620,41 +735,31 @@ static teSL_Status eSL_WriteMessage(uint16_t u16Type, uint16_t u16Length, uint8_
 
     DBG_vPrintf(DBG_SERIALLINK_COMMS, "(%d, %d, %02x)\n", u16Type, u16Length, u8CRC);
 
-    if (verbosity >= 10)
-    {
-        char acBuffer[4096];
-        int iPosition = 0, i;
-        
-        iPosition = sprintf(&acBuffer[iPosition], "Host->Node 0x%04X (Length % 4d)", u16Type, u16Length);
-        for (i = 0; i < u16Length; i++)
-        {
-            iPosition += sprintf(&acBuffer[iPosition], " 0x%02X", pu8Data[i]);
-        }
-        daemon_log(LOG_DEBUG, "%s", acBuffer);
-    }
+    vSL_TraceFrame(E_SL_TRACE_HOST_TO_NODE, u16Type, u16Length, pu8Data);
+    psSerialLink->sStats.u32TxFrames++;
     
     /* Send start character */
-    if (iSL_TxByte(TRUE, SL_START_CHAR) < 0) return E_SL_ERROR;
+    if (iSL_TxByte(psSerialLink, TRUE, SL_START_CHAR) < 0) return E_SL_ERROR;
 
     /* Send message type */
-    if (iSL_TxByte(FALSE, (u16Type >> 8) & 0xff) < 0) return E_SL_ERROR;
-    if (iSL_TxByte(FALSE, (u16Type >> 0) & 0xff) < 0) return E_SL_ERROR;
+    if (iSL_TxByte(psSerialLink, FALSE, (u16Type >> 8) & 0xff) < 0) return E_SL_ERROR;
+    if (iSL_TxByte(psSerialLink, FALSE, (u16Type >> 0) & 0xff) < 0) return E_SL_ERROR;
 
     /* Send message length */
-    if (iSL_TxByte(FALSE, (u16Length >> 8) & 0xff) < 0) return E_SL_ERROR;
-    if (iSL_TxByte(FALSE, (u16Length >> 0) & 0xff) < 0) return E_SL_ERROR;
+    if (iSL_TxByte(psSerialLink, FALSE, (u16Length >> 8) & 0xff) < 0) return E_SL_ERROR;
+    if (iSL_TxByte(psSerialLink, FALSE, (u16Length >> 0) & 0xff) < 0) return E_SL_ERROR;
 
     /* Send message checksum */
-    if (iSL_TxByte(FALSE, u8CRC) < 0) return E_SL_ERROR;
+    if (iSL_TxByte(psSerialLink, FALSE, u8CRC) < 0) return E_SL_ERROR;
 
     /* Send message payload */  
     for(n = 0; n < u16Length; n++)
     {       
-        if (iSL_TxByte(FALSE, pu8Data[n]) < 0) return E_SL_ERROR;
+        if (iSL_TxByte(psSerialLink, FALSE, pu8Data[n]) < 0) return E_SL_ERROR;
     }
 
     /* Send end character */
-    if (iSL_TxByte(TRUE, SL_END_CHAR) < 0) return E_SL_ERROR;
+    if (iSL_TxByte(psSerialLink, TRUE, SL_END_CHAR) < 0) return E_SL_ERROR;
 
     return E_SL_OK;
 }
@@ -688,18 +793,18 @@ static uint8_t u8SL_CalculateCRC(uint16_t u16Type, uint16_t u16Length, uint8_t *
  * RETURNS:
  * void
  ****************************************************************************/
-static int iSL_TxByte(bool bSpecialCharacter, uint8_t u8Data)
+static int iSL_TxByte(tsSerialLink *psSerialLink, bool bSpecialCharacter, uint8_t u8Data)
 {
     if(!bSpecialCharacter && (u8Data < 0x10))
     {
         u8Data ^= 0x10;
 
-        if (eSerial_Write(SL_ESC_CHAR) != E_SERIAL_OK) return -1;
+        if (eSerial_Write(psSerialLink->iSerialFd, SL_ESC_CHAR) != E_SERIAL_OK) return -1;
         //DBG_vPrintf(DBG_SERIALLINK_COMMS, " 0x%02x", SL_ESC_CHAR);
     }
     //DBG_vPrintf(DBG_SERIALLINK_COMMS, " 0x%02x", u8Data);
 
-    return eSerial_Write(u8Data);
+    return eSerial_Write(psSerialLink->iSerialFd, u8Data);
 }
 
 
@@ -714,9 +819,9 @@ static int iSL_TxByte(bool bSpecialCharacter, uint8_t u8Data)
  * RETURNS:
  * void
  ****************************************************************************/
-static bool bSL_RxByte(uint8_t *pu8Data)
+static bool bSL_RxByte(tsSerialLink *psSerialLink, uint8_t *pu8Data)
 {
-    if (eSerial_Read(pu8Data) == E_SERIAL_OK)
+    if (eSerial_Read(psSerialLink->iSerialFd, pu8Data) == E_SERIAL_OK)
     {
         return TRUE;
     }
@@ -789,10 +894,12 @@ static void *pvReaderThread(tsUtilsThread *psThreadInfo)
 {
     tsSerialLink *psSerialLink = (tsSerialLink *)psThreadInfo->pvThreadData;
     tsSL_Message  sMessage;
+    uint64_t u64Received;
     int iHandled;
     
     DBG_vPrintf(DBG_SERIALLINK, "Starting\n");
     
+    vSL_SelectLink(psSerialLink->iIndex);
     psThreadInfo->eState = E_THREAD_RUNNING;
 
     while (psThreadInfo->eState == E_THREAD_RUNNING)
@@ -802,22 +909,13 @@ static void *pvReaderThread(tsUtilsThread *psThreadInfo)
         /* Initialise length to large value so CRC is skipped if end received */
         sMessage.u16Length = 0xFFFF;
         
-        if (eSL_ReadMessage(&sMessage.u16Type, &sMessage.u16Length, SL_MAX_MESSAGE_LENGTH, sMessage.au8Message) == E_SL_OK)
+        if (eSL_ReadMessage(psSerialLink, &sMessage.u16Type, &sMessage.u16Length, SL_MAX_MESSAGE_LENGTH, sMessage.au8Message) == E_SL_OK)
         {
             iHandled = 0;
             
-            if (verbosity >= 10)
-            {
-                char acBuffer[4096];
-                int iPosition = 0, i;
-                
-                iPosition = sprintf(&acBuffer[iPosition], "Node->Host 0x%04X (Length % 4d)", sMessage.u16Type, sMessage.u16Length);
-                for (i = 0; i < sMessage.u16Length; i++)
-                {
-                    iPosition += sprintf(&acBuffer[iPosition], " 0x%02X", sMessage.au8Message[i]);
-                }
-                daemon_log(LOG_DEBUG, "%s", acBuffer);
-            }
+            vSL_TraceFrame(E_SL_TRACE_NODE_TO_HOST, sMessage.u16Type, sMessage.u16Length, sMessage.au8Message);
+            psSerialLink->sStats.u32RxFrames++;
+            u64Received = u64Utils_LatencyNow();
             
             if (sMessage.u16Type == E_SL_MSG_LOG)
             {
@@ -879,6 +977,14 @@ static void *pvReaderThread(tsUtilsThread *psThreadInfo)
                             memcpy(&psCallbackData->sMessage, &sMessage, sizeof(tsSL_Message));
                             psCallbackData->prCallback = psCurrentEntry->prCallback;
                             psCallbackData->pvUser = psCurrentEntry->pvUser;
+                            psCallbackData->u64Received = u64Received;
+                            
+                            /* Count the message in before it can be counted out by the handler thread */
+                            uint32_t u32Depth = __sync_add_and_fetch(&psSerialLink->sStats.u32CallbackDepth, 1);
+                            if (u32Depth > psSerialLink->sStats.u32CallbackMaxDepth)
+                            {
+                                psSerialLink->sStats.u32CallbackMaxDepth = u32Depth;
+                            }
                             
                             if (eUtils_QueueQueue(&psSerialLink->sCallbackQueue, psCallbackData) == E_UTILS_OK)
                             {
@@ -887,15 +993,17 @@ static void *pvReaderThread(tsUtilsThread *psThreadInfo)
                             else
                             {
                                 daemon_log(LOG_DEBUG, "Failed to queue message for callback");
+                                __sync_sub_and_fetch(&psSerialLink->sStats.u32CallbackDepth, 1);
                                 free(psCallbackData);
                             }
                         }
                     }
                 }
-                pthread_mutex_unlock(&sSerialLink.sCallbacks.mutex);
+                pthread_mutex_unlock(&psSerialLink->sCallbacks.mutex);
             }
             if (!iHandled)
             {
+                psSerialLink->sStats.u32Unhandled++;
                 daemon_log(LOG_DEBUG, "Message 0x%04X was not handled", sMessage.u16Type);
             }
         }
@@ -925,16 +1033,29 @@ static void *pvCallbackHandlerThread(tsUtilsThread *psThreadInfo)
 
     DBG_vPrintf(DBG_SERIALLINK, "Starting\n");
     
+    /* Callbacks act on the link their message came from */
+    vSL_SelectLink(psSerialLink->iIndex);
     psThreadInfo->eState = E_THREAD_RUNNING;
     
     while (psThreadInfo->eState == E_THREAD_RUNNING)
     {
-        tsCallbackThreadData *psCallbackData;
+        tsCallbackThreadData *apsCallbackData[SL_MAX_CALLBACK_QUEUES];
+        uint32_t u32NumCallbacks = 0;
+        uint32_t i;
+        
+        /* Take all the callbacks that are waiting, freeing the queue for the reader thread */
+        (void)eUtils_QueueDequeueBatch(&psSerialLink->sCallbackQueue, SL_CALLBACK_WAIT_MS,
+                                       (void **)apsCallbackData, SL_MAX_CALLBACK_QUEUES, &u32NumCallbacks);
         
-        if (eUtils_QueueDequeue(&psSerialLink->sCallbackQueue, (void**)&psCallbackData) == E_UTILS_OK)
+        for (i = 0; i < u32NumCallbacks; i++)
         {
+            tsCallbackThreadData *psCallbackData = apsCallbackData[i];
+            
             DBG_vPrintf(DBG_SERIALLINK_CB, "Calling callback %p for message 0x%04X\n", psCallbackData->prCallback, psCallbackData->sMessage.u16Type);
             
+            __sync_sub_and_fetch(&psSerialLink->sStats.u32CallbackDepth, 1);
+            vUtils_HistogramRecord(&psSerialLink->sStats.sCallbackWait, u64Utils_LatencyNow() - psCallbackData->u64Received);
+            
             psCallbackData->prCallback(psCallbackData->pvUser, psCallbackData->sMessage.u16Length, psCallbackData->sMessage.au8Message);
             
             free(psCallbackData);
@@ -49,6 +49,8 @@ extern "C" {
 /***        Include files                                                 ***/
 /****************************************************************************/
 
+#include <stdio.h>
+
 #include "Serial.h"
 
 /****************************************************************************/
@@ -57,6 +59,9 @@ extern "C" {
 
 #define PACKED __attribute__((__packed__))
 
+/** Number of control bridges that may be connected at once, each on its own link */
+#define SL_MAX_LINKS 4
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -318,11 +323,33 @@ typedef void (*tprSL_MessageCallback)(void *pvUser, uint16_t u16Length, void *pv
 /***        Exported Functions                                            ***/
 /****************************************************************************/
 
-teSL_Status eSL_Init(char *cpSerialDevice, uint32_t u32BaudRate);
+/** Open a serial device as one of the links and start its threads.
+ *  The reader and callback threads of the link run with it selected, so
+ *  callbacks for its messages act on it.
+ *  \param iLink            Link to open, 0 to SL_MAX_LINKS - 1
+ *  \param cpSerialDevice   Serial device to open
+ *  \param u32BaudRate      Baud rate of the device
+ *  \return E_SL_OK on success
+ */
+teSL_Status eSL_Init(int iLink, char *cpSerialDevice, uint32_t u32BaudRate);
 
+/** Stop the selected link and remove its listeners */
 teSL_Status eSL_Destroy(void);
 
 
+/** Select the link that the calling thread sends on, waits for messages on
+ *  and adds listeners to. Each thread starts with link 0 selected.
+ *  \param iLink            Link to select
+ */
+void vSL_SelectLink(int iLink);
+
+
+/** Get the link selected by the calling thread
+ *  \return Index of the link
+ */
+int iSL_SelectedLink(void);
+
+
 /** Send a command message to the serial device.
  *  This also listens for the returned Status message.
  *  If one is received, the status for the message is returned, otherwise
@@ -366,6 +393,15 @@ teSL_Status eSL_AddListener(uint16_t u16Type, tprSL_MessageCallback prCallback,
 teSL_Status eSL_RemoveListener(uint16_t u16Type, tprSL_MessageCallback prCallback);
 
 
+/** Write the selected serial link's statistics to a stream as text: frames sent and
+ *  received, received frames dropped as corrupt, the depth of the callback
+ *  queue and how long messages wait in it for their callbacks.
+ *  \param psStream         Stream to write to
+ *  \return E_SL_OK on success.
+ */
+teSL_Status eSL_StatsDump(FILE *psStream);
+
+
 /****************************************************************************/
 /***        Local Functions                                               ***/
 /****************************************************************************/
@@ -0,0 +1,362 @@
+/****************************************************************************
+ *
+ * MODULE:             SerialLink
+ *
+ * COMPONENT:          SerialPty.c
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Lee Mitchell
+ *
+ * DESCRIPTION:
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "SerialPty.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+#define SL_START_CHAR           0x01
+#define SL_ESC_CHAR             0x02
+#define SL_END_CHAR             0x03
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static void vSampleInputQueue(tsSL_Pty *psPty);
+static void vTxByte(tsSL_Pty *psPty, int bSpecialCharacter, uint8_t u8Data);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+teSL_Status eSL_PtyOpen(tsSL_Pty *psPty, const char *pcLink, uint32_t u32TxBufferSize)
+{
+    struct termios sOptions;
+    char *pcSlave;
+    
+    memset(psPty, 0, sizeof(tsSL_Pty));
+    psPty->iSlaveFd = -1;
+    
+    psPty->pu8TxBuffer = malloc(u32TxBufferSize);
+    if (!psPty->pu8TxBuffer)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return E_SL_ERROR_NOMEM;
+    }
+    psPty->u32TxBufferSize = u32TxBufferSize;
+    
+    psPty->iMasterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((psPty->iMasterFd < 0) || (grantpt(psPty->iMasterFd) != 0) || (unlockpt(psPty->iMasterFd) != 0) || !(pcSlave = ptsname(psPty->iMasterFd)))
+    {
+        perror("pty");
+        return E_SL_ERROR_SERIAL;
+    }
+    
+    /* Hold the slave open, so the pty survives the daemon reopening it, and to see how much it has left unread */
+    psPty->iSlaveFd = open(pcSlave, O_RDWR | O_NOCTTY);
+    if (psPty->iSlaveFd < 0)
+    {
+        perror(pcSlave);
+        return E_SL_ERROR_SERIAL;
+    }
+    if (tcgetattr(psPty->iSlaveFd, &sOptions) == 0)
+    {
+        cfmakeraw(&sOptions);
+        tcsetattr(psPty->iSlaveFd, TCSANOW, &sOptions);
+    }
+    fcntl(psPty->iMasterFd, F_SETFL, fcntl(psPty->iMasterFd, F_GETFL) | O_NONBLOCK);
+    
+    if (pcLink)
+    {
+        unlink(pcLink);
+        if (symlink(pcSlave, pcLink) != 0)
+        {
+            perror(pcLink);
+            return E_SL_ERROR_SERIAL;
+        }
+        psPty->pcLink = strdup(pcLink);
+    }
+    
+    printf("Serial device: %s\n", pcLink ? pcLink : pcSlave);
+    fflush(stdout);
+    return E_SL_OK;
+}
+
+
+void vSL_PtyClose(tsSL_Pty *psPty)
+{
+    if (psPty->pcLink)
+    {
+        unlink(psPty->pcLink);
+        free(psPty->pcLink);
+        psPty->pcLink = NULL;
+    }
+    if (psPty->iSlaveFd >= 0)
+    {
+        close(psPty->iSlaveFd);
+        psPty->iSlaveFd = -1;
+    }
+    if (psPty->iMasterFd >= 0)
+    {
+        close(psPty->iMasterFd);
+        psPty->iMasterFd = -1;
+    }
+    free(psPty->pu8TxBuffer);
+    psPty->pu8TxBuffer = NULL;
+}
+
+
+teSL_Status eSL_PtySendFrame(tsSL_Pty *psPty, uint16_t u16Type, uint16_t u16Length, const uint8_t *pu8Payload)
+{
+    uint8_t u8CRC = 0;
+    int i;
+    
+    if ((psPty->u32TxBytes + 2 + (2 * (5 + u16Length))) > psPty->u32TxBufferSize)
+    {
+        psPty->u32Dropped++;
+        return E_SL_ERROR_NOMEM;
+    }
+    
+    u8CRC ^= (u16Type >> 8) & 0xFF;
+    u8CRC ^= (u16Type >> 0) & 0xFF;
+    u8CRC ^= (u16Length >> 8) & 0xFF;
+    u8CRC ^= (u16Length >> 0) & 0xFF;
+    for (i = 0; i < u16Length; i++)
+    {
+        u8CRC ^= pu8Payload[i];
+    }
+    
+    vTxByte(psPty, 1, SL_START_CHAR);
+    vTxByte(psPty, 0, (u16Type >> 8) & 0xFF);
+    vTxByte(psPty, 0, (u16Type >> 0) & 0xFF);
+    vTxByte(psPty, 0, (u16Length >> 8) & 0xFF);
+    vTxByte(psPty, 0, (u16Length >> 0) & 0xFF);
+    vTxByte(psPty, 0, u8CRC);
+    for (i = 0; i < u16Length; i++)
+    {
+        vTxByte(psPty, 0, pu8Payload[i]);
+    }
+    vTxByte(psPty, 1, SL_END_CHAR);
+    
+    if (psPty->u32TxBytes > psPty->u32TxBufferMax)
+    {
+        psPty->u32TxBufferMax = psPty->u32TxBytes;
+    }
+    return E_SL_OK;
+}
+
+
+uint32_t u32SL_PtyFlush(tsSL_Pty *psPty, uint32_t u32MaxBytes)
+{
+    uint32_t u32Written = 0;
+    
+    while (psPty->u32TxBytes && (u32Written < u32MaxBytes))
+    {
+        uint32_t u32Bytes = psPty->u32TxBytes;
+        ssize_t iWritten;
+        
+        if (u32Bytes > (u32MaxBytes - u32Written))
+        {
+            u32Bytes = u32MaxBytes - u32Written;
+        }
+        iWritten = write(psPty->iMasterFd, psPty->pu8TxBuffer, u32Bytes);
+        if (iWritten <= 0)
+        {
+            break;
+        }
+        memmove(psPty->pu8TxBuffer, &psPty->pu8TxBuffer[iWritten], psPty->u32TxBytes - iWritten);
+        psPty->u32TxBytes -= iWritten;
+        u32Written += iWritten;
+    }
+    vSampleInputQueue(psPty);
+    return u32Written;
+}
+
+
+void vSL_PtyReceiverInit(tsSL_PtyReceiver *psReceiver)
+{
+    memset(psReceiver, 0, sizeof(tsSL_PtyReceiver));
+    psReceiver->iState = -1;
+}
+
+
+int bSL_PtyReceiveByte(tsSL_PtyReceiver *psReceiver, uint8_t u8Data)
+{
+    switch (u8Data)
+    {
+        case SL_START_CHAR:
+            psReceiver->iState = 0;
+            psReceiver->bEscape = 0;
+            psReceiver->u16Bytes = 0;
+            psReceiver->u8CRC = 0;
+            return 0;
+            
+        case SL_ESC_CHAR:
+            psReceiver->bEscape = 1;
+            return 0;
+            
+        case SL_END_CHAR:
+        {
+            uint8_t u8CRC = 0;
+            int i;
+            
+            if (psReceiver->iState < 0)
+            {
+                return 0;
+            }
+            psReceiver->iState = -1;
+            
+            u8CRC ^= psReceiver->u16Type >> 8;
+            u8CRC ^= psReceiver->u16Type & 0xFF;
+            u8CRC ^= psReceiver->u16Length >> 8;
+            u8CRC ^= psReceiver->u16Length & 0xFF;
+            for (i = 0; i < psReceiver->u16Bytes; i++)
+            {
+                u8CRC ^= psReceiver->au8Payload[i];
+            }
+            if ((psReceiver->u16Bytes != psReceiver->u16Length) || (u8CRC != psReceiver->u8CRC))
+            {
+                psReceiver->u32Corrupt++;
+                return 0;
+            }
+            return 1;
+        }
+        
+        default:
+            break;
+    }
+    
+    if (psReceiver->bEscape)
+    {
+        u8Data ^= 0x10;
+        psReceiver->bEscape = 0;
+    }
+    
+    switch (psReceiver->iState)
+    {
+        case -1:
+            break;
+        case 0:
+            psReceiver->u16Type = u8Data << 8;
+            psReceiver->iState++;
+            break;
+        case 1:
+            psReceiver->u16Type |= u8Data;
+            psReceiver->iState++;
+            break;
+        case 2:
+            psReceiver->u16Length = u8Data << 8;
+            psReceiver->iState++;
+            break;
+        case 3:
+            psReceiver->u16Length |= u8Data;
+            psReceiver->iState++;
+            if (psReceiver->u16Length > SL_PTY_MAX_PAYLOAD)
+            {
+                psReceiver->u32Corrupt++;
+                psReceiver->iState = -1;
+            }
+            break;
+        case 4:
+            psReceiver->u8CRC = u8Data;
+            psReceiver->iState++;
+            break;
+        default:
+            if (psReceiver->u16Bytes < psReceiver->u16Length)
+            {
+                psReceiver->au8Payload[psReceiver->u16Bytes] = u8Data;
+            }
+            psReceiver->u16Bytes++;
+            break;
+    }
+    return 0;
+}
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+static void vSampleInputQueue(tsSL_Pty *psPty)
+{
+    int iUnread;
+    
+    if (ioctl(psPty->iSlaveFd, FIONREAD, &iUnread) == 0)
+    {
+        psPty->u64InputQueueTotal += iUnread;
+        psPty->u32InputQueueSamples++;
+        if (iUnread > psPty->u32InputQueueMax)
+        {
+            psPty->u32InputQueueMax = iUnread;
+        }
+    }
+}
+
+
+static void vTxByte(tsSL_Pty *psPty, int bSpecialCharacter, uint8_t u8Data)
+{
+    if (!bSpecialCharacter && (u8Data < 0x10))
+    {
+        psPty->pu8TxBuffer[psPty->u32TxBytes++] = SL_ESC_CHAR;
+        u8Data ^= 0x10;
+    }
+    psPty->pu8TxBuffer[psPty->u32TxBytes++] = u8Data;
+}
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
@@ -0,0 +1,159 @@
+/****************************************************************************
+ *
+ * MODULE:             SerialLink
+ *
+ * COMPONENT:          SerialPty.h
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Lee Mitchell
+ *
+ * DESCRIPTION:
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+#ifndef  SERIALPTY_H_INCLUDED
+#define  SERIALPTY_H_INCLUDED
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+
+#include "SerialLink.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/** Largest payload of a frame sent or received through a pty */
+#define SL_PTY_MAX_PAYLOAD      256
+
+/** Longest a frame can be once it is escaped */
+#define SL_PTY_MAX_FRAME_BYTES  (2 + (2 * (5 + SL_PTY_MAX_PAYLOAD)))
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/** A pty standing in for the control bridge's serial port, for the tools
+ *  that play the part of the control bridge to an unmodified daemon.
+ *  Frames to the daemon go through a transmit buffer of a fixed size, as
+ *  they would on the node.
+ */
+typedef struct
+{
+    int                 iMasterFd;
+    int                 iSlaveFd;               /**< Held open so the pty survives the daemon reopening it */
+    char               *pcLink;                 /**< Symbolic link to the slave, if one was made */
+    
+    uint8_t            *pu8TxBuffer;
+    uint32_t            u32TxBytes;
+    uint32_t            u32TxBufferSize;
+    
+    uint32_t            u32TxBufferMax;         /**< Most bytes the transmit buffer has held */
+    uint32_t            u32Dropped;             /**< Frames dropped because the transmit buffer was full */
+    uint64_t            u64InputQueueTotal;     /**< Sum of the samples of the daemon's unread input */
+    uint32_t            u32InputQueueSamples;
+    uint32_t            u32InputQueueMax;
+} tsSL_Pty;
+
+
+/** Receiver of frames from the daemon */
+typedef struct
+{
+    int                 iState;                 /**< Number of header bytes received, or -1 waiting for start */
+    int                 bEscape;
+    uint16_t            u16Type;
+    uint16_t            u16Length;
+    uint16_t            u16Bytes;
+    uint8_t             u8CRC;
+    uint32_t            u32Corrupt;             /**< Frames discarded for a bad length or CRC */
+    uint8_t             au8Payload[SL_PTY_MAX_PAYLOAD];
+} tsSL_PtyReceiver;
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+/** Open a pty for the daemon to use as its serial port
+ *  \param psPty            Pty to open
+ *  \param pcLink           Symbolic link to create to the slave, or NULL
+ *  \param u32TxBufferSize  Size of the transmit buffer
+ *  \return E_SL_OK on success
+ */
+teSL_Status eSL_PtyOpen(tsSL_Pty *psPty, const char *pcLink, uint32_t u32TxBufferSize);
+
+/** Close a pty and remove its link
+ *  \param psPty            Pty to close
+ */
+void vSL_PtyClose(tsSL_Pty *psPty);
+
+/** Frame a message and put it into the transmit buffer
+ *  \param psPty            Pty to send on
+ *  \param u16Type          Message type
+ *  \param u16Length        Length of the payload
+ *  \param pu8Payload       Payload
+ *  \return E_SL_OK on success, E_SL_ERROR_NOMEM if the frame was dropped for lack of room
+ */
+teSL_Status eSL_PtySendFrame(tsSL_Pty *psPty, uint16_t u16Type, uint16_t u16Length, const uint8_t *pu8Payload);
+
+/** Write the transmit buffer to the daemon, as far as it will take it
+ *  \param psPty            Pty to write
+ *  \param u32MaxBytes      Most bytes to write, to pace the output to a baud rate
+ *  \return Number of bytes written
+ */
+uint32_t u32SL_PtyFlush(tsSL_Pty *psPty, uint32_t u32MaxBytes);
+
+/** Prepare a receiver for the first frame
+ *  \param psReceiver       Receiver to initialise
+ */
+void vSL_PtyReceiverInit(tsSL_PtyReceiver *psReceiver);
+
+/** Receive a byte from the daemon
+ *  \param psReceiver       Receiver
+ *  \param u8Data           Byte received
+ *  \return 1 when a frame is complete and its type, length and payload are in the receiver
+ */
+int bSL_PtyReceiveByte(tsSL_PtyReceiver *psReceiver, uint8_t u8Data);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif  /* SERIALPTY_H_INCLUDED */
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
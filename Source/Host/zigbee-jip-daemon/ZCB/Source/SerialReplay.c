@@ -0,0 +1,894 @@
+/****************************************************************************
+ *
+ * MODULE:             SerialLink
+ *
+ * COMPONENT:          SerialReplay.c
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Lee Mitchell
+ *
+ * DESCRIPTION:
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+/** zcb-replay plays a capture taken with zigbee-jip-daemon's --capture option
+ *  back to an unmodified daemon, standing in for the control bridge on a pty.
+ *
+ *  The capture is split into commands from the host, the responses the node
+ *  sent to them - the status naming the command's type, and frames of the
+ *  command's type with the top bit set, matched by sequence number where the
+ *  response carries one - and the rest, which are events the node sent of its
+ *  own accord. Events are played back on the captured timeline, scaled by the
+ *  speed factor, from when the daemon sends its first command. Each command
+ *  the daemon sends is answered with the responses to the first unanswered
+ *  captured command of the same type, preferring one with the same payload,
+ *  at the same delay as they were captured.
+ *
+ *  Frames are sent through a transmit buffer of the size of the control
+ *  bridge's, and are dropped if the daemon doesn't read them fast enough to
+ *  make room. At the end the driver reports how late frames were sent, how
+ *  much the daemon left unread in its serial input, and the frames dropped;
+ *  given the daemon's latency socket it also fetches the daemon's own
+ *  statistics, including how long events wait for its main loop.
+ */
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "SerialTrace.h"
+#include "SerialPty.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/** Default size of the transmit buffer */
+#define DEFAULT_TX_BUFFER       4096
+
+/** Default time after a command its responses are looked for in the capture */
+#define DEFAULT_WINDOW_MS       10000
+
+/** Default time to wait for more commands after the capture has been played */
+#define DEFAULT_IDLE_MS         2000
+
+/** Marks the end of a list of records */
+#define NO_RECORD               0xFFFFFFFF
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/** What a captured frame is to the replay */
+typedef enum
+{
+    E_ROLE_COMMAND,                             /**< Sent by the host */
+    E_ROLE_RESPONSE,                            /**< Sent by the node in response to a command */
+    E_ROLE_EVENT,                               /**< Sent by the node of its own accord */
+} teRole;
+
+
+/** A captured frame */
+typedef struct
+{
+    uint64_t            u64Time;                /**< Time the frame was captured (us) */
+    uint32_t            u32Payload;             /**< Offset of the payload in the payload store */
+    uint16_t            u16Type;
+    uint16_t            u16Length;
+    teRole              eRole;
+    uint32_t            u32Next;                /**< Commands: next command of the same type. Responses: next response to the same command */
+    uint32_t            u32FirstResponse;       /**< Commands: first response */
+    uint32_t            u32LastResponse;        /**< Commands: last response */
+    uint8_t             u8SequenceNo;           /**< Commands: sequence number given in the status */
+    uint8_t             bStatus;                /**< Commands: status has been seen */
+    uint8_t             bUsed;                  /**< Commands: responses have been played */
+} tsRecord;
+
+
+/** A response waiting to be sent */
+typedef struct
+{
+    uint64_t            u64Due;
+    uint32_t            u32Record;
+} tsPending;
+
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static int iLoadCapture(const char *pcPath);
+static void vClassify(void);
+static void vRun(void);
+static void vReport(void);
+static void vFetchDaemonStats(const char *pcPath);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+static tsRecord        *asRecords = NULL;
+static uint32_t         u32NumRecords = 0;
+static uint8_t         *pu8Payloads = NULL;
+static uint32_t         u32PayloadBytes = 0;
+
+/** First command of each type */
+static uint32_t         au32FirstCommand[0x10000];
+
+/** Responses waiting to be sent, as a heap ordered by due time */
+static tsPending       *asPending = NULL;
+static uint32_t         u32NumPending = 0;
+static uint32_t         u32MaxPending = 0;
+
+/** Options */
+static double           dSpeed = 1.0;
+static uint32_t         u32TxBufferSize = DEFAULT_TX_BUFFER;
+static uint32_t         u32WindowMs = DEFAULT_WINDOW_MS;
+static uint32_t         u32IdleMs = DEFAULT_IDLE_MS;
+
+static tsSL_Pty         sPty;
+static tsSL_PtyReceiver sReceiver;
+
+static volatile sig_atomic_t bRunning = 1;
+
+/** Statistics */
+static struct
+{
+    uint32_t            u32Commands;
+    uint32_t            u32Responses;
+    uint32_t            u32Events;
+    uint64_t            u64CaptureUs;
+    
+    uint32_t            u32EventsSent;
+    uint32_t            u32ResponsesSent;
+    uint32_t            u32CommandsReceived;
+    uint32_t            u32CommandsExact;
+    uint32_t            u32CommandsByType;
+    uint32_t            u32CommandsRepeated;
+    uint32_t            u32CommandsUnanswered;
+    uint64_t            u64ReplayUs;
+    
+    uint32_t           *pu32Lag;                /**< How late each frame was sent (us) */
+    uint32_t            u32NumLag;
+    uint32_t            u32LagCapacity;
+    uint32_t            u32MaxLag;
+} sStats;
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+static void print_usage_exit(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options] <capture file>\n", argv[0]);
+    fprintf(stderr, "  Options:\n");
+    fprintf(stderr, "    -x <speed>         Play back this many times faster than captured, 0 for no delays. Default 1.\n");
+    fprintf(stderr, "    -l <link>          Symbolic link to create to the pty, to pass to zigbee-jip-daemon -s.\n");
+    fprintf(stderr, "    -b <bytes>         Size of the transmit buffer; frames that don't fit are dropped. Default %d.\n", DEFAULT_TX_BUFFER);
+    fprintf(stderr, "    -w <ms>            Time after a captured command to look for its responses. Default %d.\n", DEFAULT_WINDOW_MS);
+    fprintf(stderr, "    -i <ms>            Time to wait for more commands after the capture has been played. Default %d.\n", DEFAULT_IDLE_MS);
+    fprintf(stderr, "    -L <socket>        zigbee-jip-daemon's latency socket, to fetch its statistics from at the end.\n");
+    exit(EXIT_FAILURE);
+}
+
+
+static void vQuitSignalHandler(int sig)
+{
+    bRunning = 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *pcLink = NULL;
+    const char *pcLatencySocket = NULL;
+    int c;
+    
+    while ((c = getopt(argc, argv, "x:l:b:w:i:L:h")) != -1)
+    {
+        switch (c)
+        {
+            case 'x': dSpeed = atof(optarg); break;
+            case 'l': pcLink = optarg; break;
+            case 'b': u32TxBufferSize = strtoul(optarg, NULL, 0); break;
+            case 'w': u32WindowMs = strtoul(optarg, NULL, 0); break;
+            case 'i': u32IdleMs = strtoul(optarg, NULL, 0); break;
+            case 'L': pcLatencySocket = optarg; break;
+            default: print_usage_exit(argv);
+        }
+    }
+    
+    if ((optind != (argc - 1)) || (dSpeed < 0) || (u32TxBufferSize < SL_PTY_MAX_FRAME_BYTES))
+    {
+        print_usage_exit(argv);
+    }
+    
+    if (iLoadCapture(argv[optind]) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    vClassify();
+    
+    printf("Capture: %u frames over %.3fs: %u commands, %u responses, %u events\n",
+           u32NumRecords, sStats.u64CaptureUs / 1e6, sStats.u32Commands, sStats.u32Responses, sStats.u32Events);
+    
+    asPending = malloc(sizeof(tsPending) * (sStats.u32Responses + 1));
+    sStats.u32LagCapacity = sStats.u32Events + sStats.u32Responses + 1;
+    sStats.pu32Lag = malloc(sizeof(uint32_t) * sStats.u32LagCapacity);
+    if (!asPending || !sStats.pu32Lag)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    u32MaxPending = sStats.u32Responses + 1;
+    
+    if (eSL_PtyOpen(&sPty, pcLink, u32TxBufferSize) != E_SL_OK)
+    {
+        return EXIT_FAILURE;
+    }
+    printf("Waiting for the daemon's first command\n");
+    fflush(stdout);
+    
+    signal(SIGINT, vQuitSignalHandler);
+    signal(SIGTERM, vQuitSignalHandler);
+    
+    vRun();
+    vReport();
+    
+    if (pcLatencySocket)
+    {
+        vFetchDaemonStats(pcLatencySocket);
+    }
+    
+    vSL_PtyClose(&sPty);
+    return EXIT_SUCCESS;
+}
+
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+static uint64_t u64TimeNow(void)
+{
+    struct timespec sNow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000000) + (sNow.tv_nsec / 1000);
+}
+
+
+/** Scale a captured interval by the speed factor */
+static uint64_t u64Scale(uint64_t u64Interval)
+{
+    if (dSpeed == 0)
+    {
+        return 0;
+    }
+    return (uint64_t)(u64Interval / dSpeed);
+}
+
+
+static int iLoadCapture(const char *pcPath)
+{
+    tsSL_CaptureRecord sFrame;
+    teSL_Status eStatus;
+    uint32_t u32MaxRecords = 0;
+    uint32_t u32MaxPayloadBytes = 0;
+    int bFirst = 1;
+    FILE *psFile = fopen(pcPath, "r");
+    
+    if (!psFile)
+    {
+        perror(pcPath);
+        return -1;
+    }
+    
+    while ((eStatus = eSL_CaptureRead(psFile, bFirst, &sFrame)) == E_SL_OK)
+    {
+        tsRecord *psRecord;
+        
+        bFirst = 0;
+        if (u32NumRecords == u32MaxRecords)
+        {
+            u32MaxRecords = u32MaxRecords ? (u32MaxRecords * 2) : 1024;
+            asRecords = realloc(asRecords, sizeof(tsRecord) * u32MaxRecords);
+        }
+        if (((u32PayloadBytes + sFrame.u16Length) > u32MaxPayloadBytes) || !pu8Payloads)
+        {
+            u32MaxPayloadBytes = u32MaxPayloadBytes ? (u32MaxPayloadBytes * 2) : 65536;
+            pu8Payloads = realloc(pu8Payloads, u32MaxPayloadBytes);
+        }
+        if (!asRecords || !pu8Payloads)
+        {
+            fprintf(stderr, "Out of memory\n");
+            fclose(psFile);
+            return -1;
+        }
+        
+        psRecord = &asRecords[u32NumRecords++];
+        memset(psRecord, 0, sizeof(tsRecord));
+        psRecord->u64Time = sFrame.u64Time;
+        psRecord->u16Type = sFrame.u16Type;
+        psRecord->u16Length = sFrame.u16Length;
+        psRecord->u32Payload = u32PayloadBytes;
+        psRecord->eRole = (sFrame.u8Direction == E_SL_TRACE_HOST_TO_NODE) ? E_ROLE_COMMAND : E_ROLE_EVENT;
+        psRecord->u32Next = NO_RECORD;
+        psRecord->u32FirstResponse = NO_RECORD;
+        psRecord->u32LastResponse = NO_RECORD;
+        memcpy(&pu8Payloads[u32PayloadBytes], sFrame.au8Payload, sFrame.u16Length);
+        u32PayloadBytes += sFrame.u16Length;
+    }
+    fclose(psFile);
+    
+    if (eStatus != E_SL_NOMESSAGE)
+    {
+        fprintf(stderr, "%s: not a capture, or truncated\n", pcPath);
+        return -1;
+    }
+    if (!u32NumRecords)
+    {
+        fprintf(stderr, "%s: no frames captured\n", pcPath);
+        return -1;
+    }
+    return 0;
+}
+
+
+/** Add a response to a command */
+static void vAddResponse(uint32_t u32Command, uint32_t u32Response)
+{
+    tsRecord *psCommand = &asRecords[u32Command];
+    
+    asRecords[u32Response].eRole = E_ROLE_RESPONSE;
+    if (psCommand->u32LastResponse == NO_RECORD)
+    {
+        psCommand->u32FirstResponse = u32Response;
+    }
+    else
+    {
+        asRecords[psCommand->u32LastResponse].u32Next = u32Response;
+    }
+    psCommand->u32LastResponse = u32Response;
+}
+
+
+/** Split the node's frames into responses to commands and events */
+static void vClassify(void)
+{
+    uint32_t *pu32Open = malloc(sizeof(uint32_t) * u32NumRecords);
+    uint32_t au32LastCommand[0x10000];
+    uint32_t u32FirstOpen = 0, u32NumOpen = 0;
+    uint32_t u32Index, i;
+    
+    for (i = 0; i < 0x10000; i++)
+    {
+        au32FirstCommand[i] = NO_RECORD;
+        au32LastCommand[i] = NO_RECORD;
+    }
+    
+    for (u32Index = 0; u32Index < u32NumRecords; u32Index++)
+    {
+        tsRecord *psRecord = &asRecords[u32Index];
+        uint8_t *pu8Payload = &pu8Payloads[psRecord->u32Payload];
+        uint32_t u32Match = NO_RECORD;
+        
+        /* Commands only get responses for so long after they were sent */
+        while ((u32FirstOpen < u32NumOpen) &&
+               ((psRecord->u64Time - asRecords[pu32Open[u32FirstOpen]].u64Time) > ((uint64_t)u32WindowMs * 1000)))
+        {
+            u32FirstOpen++;
+        }
+        
+        if (psRecord->eRole == E_ROLE_COMMAND)
+        {
+            if (au32LastCommand[psRecord->u16Type] == NO_RECORD)
+            {
+                au32FirstCommand[psRecord->u16Type] = u32Index;
+            }
+            else
+            {
+                asRecords[au32LastCommand[psRecord->u16Type]].u32Next = u32Index;
+            }
+            au32LastCommand[psRecord->u16Type] = u32Index;
+            pu32Open[u32NumOpen++] = u32Index;
+            sStats.u32Commands++;
+            continue;
+        }
+        
+        if ((psRecord->u16Type == E_SL_MSG_STATUS) && (psRecord->u16Length >= 4))
+        {
+            /* Status for the oldest command of the type it names that hasn't had one */
+            uint16_t u16MessageType = (pu8Payload[2] << 8) | pu8Payload[3];
+            
+            for (i = u32FirstOpen; i < u32NumOpen; i++)
+            {
+                tsRecord *psCommand = &asRecords[pu32Open[i]];
+                
+                if ((psCommand->u16Type == u16MessageType) && !psCommand->bStatus)
+                {
+                    psCommand->bStatus = 1;
+                    psCommand->u8SequenceNo = pu8Payload[1];
+                    u32Match = pu32Open[i];
+                    break;
+                }
+            }
+        }
+        else if (psRecord->u16Type & 0x8000)
+        {
+            uint32_t u32Unanswered = NO_RECORD;
+            
+            /* The latest command of the type responded to with the sequence number the response starts
+             * with, or failing that the oldest one that has had its status but no response yet */
+            for (i = u32NumOpen; i > u32FirstOpen; i--)
+            {
+                tsRecord *psCommand = &asRecords[pu32Open[i - 1]];
+                
+                if (((psCommand->u16Type | 0x8000) != psRecord->u16Type) || !psCommand->bStatus)
+                {
+                    continue;
+                }
+                if ((psRecord->u16Length > 0) && (psCommand->u8SequenceNo == pu8Payload[0]))
+                {
+                    u32Match = pu32Open[i - 1];
+                    break;
+                }
+                if (psCommand->u32LastResponse == NO_RECORD ||
+                    asRecords[psCommand->u32LastResponse].u16Type == E_SL_MSG_STATUS)
+                {
+                    u32Unanswered = pu32Open[i - 1];
+                }
+            }
+            if (u32Match == NO_RECORD)
+            {
+                u32Match = u32Unanswered;
+            }
+        }
+        
+        if (u32Match != NO_RECORD)
+        {
+            vAddResponse(u32Match, u32Index);
+            sStats.u32Responses++;
+        }
+        else
+        {
+            sStats.u32Events++;
+        }
+    }
+    
+    sStats.u64CaptureUs = asRecords[u32NumRecords - 1].u64Time - asRecords[0].u64Time;
+    free(pu32Open);
+}
+
+
+static void vPendingPush(uint64_t u64Due, uint32_t u32Record)
+{
+    uint32_t u32Index = u32NumPending++;
+    
+    while (u32Index > 0)
+    {
+        uint32_t u32Parent = (u32Index - 1) / 2;
+        
+        if (asPending[u32Parent].u64Due <= u64Due)
+        {
+            break;
+        }
+        asPending[u32Index] = asPending[u32Parent];
+        u32Index = u32Parent;
+    }
+    asPending[u32Index].u64Due = u64Due;
+    asPending[u32Index].u32Record = u32Record;
+}
+
+
+static void vPendingPop(void)
+{
+    tsPending sLast = asPending[--u32NumPending];
+    uint32_t u32Index = 0;
+    
+    for (;;)
+    {
+        uint32_t u32Child = (u32Index * 2) + 1;
+        
+        if (u32Child >= u32NumPending)
+        {
+            break;
+        }
+        if (((u32Child + 1) < u32NumPending) && (asPending[u32Child + 1].u64Due < asPending[u32Child].u64Due))
+        {
+            u32Child++;
+        }
+        if (sLast.u64Due <= asPending[u32Child].u64Due)
+        {
+            break;
+        }
+        asPending[u32Index] = asPending[u32Child];
+        u32Index = u32Child;
+    }
+    if (u32NumPending)
+    {
+        asPending[u32Index] = sLast;
+    }
+}
+
+
+/** Put a node frame into the transmit buffer, or drop it if there isn't room */
+static void vSendFrame(uint32_t u32Record, uint64_t u64Due, uint64_t u64Now)
+{
+    tsRecord *psRecord = &asRecords[u32Record];
+    uint32_t u32Lag;
+    
+    if (eSL_PtySendFrame(&sPty, psRecord->u16Type, psRecord->u16Length, &pu8Payloads[psRecord->u32Payload]) != E_SL_OK)
+    {
+        return;
+    }
+    
+    if (sStats.u32NumLag == sStats.u32LagCapacity)
+    {
+        /* Repeated answers can send more frames than were captured */
+        uint32_t *pu32Lag = realloc(sStats.pu32Lag, sizeof(uint32_t) * sStats.u32LagCapacity * 2);
+        
+        if (pu32Lag)
+        {
+            sStats.pu32Lag = pu32Lag;
+            sStats.u32LagCapacity *= 2;
+        }
+    }
+    
+    u32Lag = (u64Now > u64Due) ? (uint32_t)(u64Now - u64Due) : 0;
+    if (sStats.u32NumLag < sStats.u32LagCapacity)
+    {
+        sStats.pu32Lag[sStats.u32NumLag++] = u32Lag;
+    }
+    if (u32Lag > sStats.u32MaxLag)
+    {
+        sStats.u32MaxLag = u32Lag;
+    }
+}
+
+
+/** Find the captured command to answer a command from the daemon with */
+static void vHandleCommand(tsSL_PtyReceiver *psReceiver, uint64_t u64Now)
+{
+    uint32_t u32Command, u32Response;
+    uint32_t u32ByType = NO_RECORD;
+    uint32_t u32Repeat = NO_RECORD;
+    
+    sStats.u32CommandsReceived++;
+    
+    for (u32Command = au32FirstCommand[psReceiver->u16Type]; u32Command != NO_RECORD; u32Command = asRecords[u32Command].u32Next)
+    {
+        tsRecord *psCommand = &asRecords[u32Command];
+        
+        if (psCommand->bUsed)
+        {
+            u32Repeat = u32Command;
+            continue;
+        }
+        if ((psCommand->u16Length == psReceiver->u16Length) &&
+            (memcmp(&pu8Payloads[psCommand->u32Payload], psReceiver->au8Payload, psReceiver->u16Length) == 0))
+        {
+            sStats.u32CommandsExact++;
+            break;
+        }
+        if (u32ByType == NO_RECORD)
+        {
+            u32ByType = u32Command;
+        }
+    }
+    
+    if (u32Command == NO_RECORD)
+    {
+        if (u32ByType != NO_RECORD)
+        {
+            u32Command = u32ByType;
+            sStats.u32CommandsByType++;
+        }
+        else if (u32Repeat != NO_RECORD)
+        {
+            /* Every captured command of the type has been answered, so answer as the last one was */
+            u32Command = u32Repeat;
+            sStats.u32CommandsRepeated++;
+        }
+        else
+        {
+            sStats.u32CommandsUnanswered++;
+            return;
+        }
+    }
+    
+    asRecords[u32Command].bUsed = 1;
+    for (u32Response = asRecords[u32Command].u32FirstResponse; u32Response != NO_RECORD; u32Response = asRecords[u32Response].u32Next)
+    {
+        if (u32NumPending == u32MaxPending)
+        {
+            tsPending *asMorePending = realloc(asPending, sizeof(tsPending) * u32MaxPending * 2);
+            
+            if (!asMorePending)
+            {
+                break;
+            }
+            asPending = asMorePending;
+            u32MaxPending *= 2;
+        }
+        vPendingPush(u64Now + u64Scale(asRecords[u32Response].u64Time - asRecords[u32Command].u64Time), u32Response);
+    }
+}
+
+
+/** Next captured event at or after an index */
+static uint32_t u32NextEvent(uint32_t u32Index)
+{
+    while ((u32Index < u32NumRecords) && (asRecords[u32Index].eRole != E_ROLE_EVENT))
+    {
+        u32Index++;
+    }
+    return u32Index;
+}
+
+
+static void vRun(void)
+{
+    uint64_t u64Start = 0;
+    uint64_t u64CaptureStart;
+    uint64_t u64CaptureEnd = asRecords[u32NumRecords - 1].u64Time;
+    uint64_t u64LastCommand = 0;
+    uint32_t u32Event;
+    uint32_t i;
+    int bStarted = 0;
+    
+    vSL_PtyReceiverInit(&sReceiver);
+    
+    /* The captured timeline starts at the first command, as the replay does */
+    u64CaptureStart = asRecords[0].u64Time;
+    for (i = 0; i < u32NumRecords; i++)
+    {
+        if (asRecords[i].eRole == E_ROLE_COMMAND)
+        {
+            u64CaptureStart = asRecords[i].u64Time;
+            break;
+        }
+    }
+    u32Event = u32NextEvent(0);
+    
+    while (bRunning)
+    {
+        struct pollfd sPoll;
+        struct timespec sTimeout;
+        uint64_t u64Now = u64TimeNow();
+        uint64_t u64Next = u64Now + 1000000;
+        
+        if (bStarted)
+        {
+            /* Send everything that is due, in order */
+            for (;;)
+            {
+                uint64_t u64EventDue = 0;
+                
+                if (u32Event < u32NumRecords)
+                {
+                    uint64_t u64Time = asRecords[u32Event].u64Time;
+                    u64EventDue = u64Start + ((u64Time > u64CaptureStart) ? u64Scale(u64Time - u64CaptureStart) : 0);
+                }
+                
+                if ((u32Event < u32NumRecords) && (u64EventDue <= u64Now) &&
+                    (!u32NumPending || (u64EventDue <= asPending[0].u64Due)))
+                {
+                    vSendFrame(u32Event, u64EventDue, u64Now);
+                    sStats.u32EventsSent++;
+                    u32Event = u32NextEvent(u32Event + 1);
+                }
+                else if (u32NumPending && (asPending[0].u64Due <= u64Now))
+                {
+                    vSendFrame(asPending[0].u32Record, asPending[0].u64Due, u64Now);
+                    sStats.u32ResponsesSent++;
+                    vPendingPop();
+                }
+                else
+                {
+                    if ((u32Event < u32NumRecords) && (u64EventDue < u64Next))
+                    {
+                        u64Next = u64EventDue;
+                    }
+                    if (u32NumPending && (asPending[0].u64Due < u64Next))
+                    {
+                        u64Next = asPending[0].u64Due;
+                    }
+                    break;
+                }
+            }
+            u32SL_PtyFlush(&sPty, UINT32_MAX);
+            
+            if ((u32Event >= u32NumRecords) && !u32NumPending && !sPty.u32TxBytes)
+            {
+                /* Played it all. Finish once the time the capture covers has passed,
+                 * and the daemon has stopped sending commands */
+                uint64_t u64Idle = u64LastCommand + ((uint64_t)u32IdleMs * 1000);
+                uint64_t u64End = u64Start + ((u64CaptureEnd > u64CaptureStart) ? u64Scale(u64CaptureEnd - u64CaptureStart) : 0);
+                
+                if (u64End > u64Idle)
+                {
+                    u64Idle = u64End;
+                }
+
+                if (u64Now >= u64Idle)
+                {
+                    sStats.u64ReplayUs = u64Now - u64Start;
+                    break;
+                }
+                if (u64Idle < u64Next)
+                {
+                    u64Next = u64Idle;
+                }
+            }
+        }
+        
+        sPoll.fd = sPty.iMasterFd;
+        sPoll.events = POLLIN | (sPty.u32TxBytes ? POLLOUT : 0);
+        sPoll.revents = 0;
+        
+        u64Now = u64TimeNow();
+        u64Next = (u64Next > u64Now) ? (u64Next - u64Now) : 0;
+        sTimeout.tv_sec = u64Next / 1000000;
+        sTimeout.tv_nsec = (u64Next % 1000000) * 1000;
+        
+        if (ppoll(&sPoll, 1, &sTimeout, NULL) < 0)
+        {
+            if (errno != EINTR)
+            {
+                perror("poll");
+                break;
+            }
+            continue;
+        }
+        
+        if (sPoll.revents & POLLIN)
+        {
+            uint8_t au8Buffer[1024];
+            ssize_t iRead = read(sPty.iMasterFd, au8Buffer, sizeof(au8Buffer));
+            
+            for (i = 0; (iRead > 0) && (i < iRead); i++)
+            {
+                if (bSL_PtyReceiveByte(&sReceiver, au8Buffer[i]))
+                {
+                    u64Now = u64TimeNow();
+                    if (!bStarted)
+                    {
+                        bStarted = 1;
+                        u64Start = u64Now;
+                        printf("Playing back at speed %g\n", dSpeed);
+                        fflush(stdout);
+                    }
+                    if (sStats.u32CommandsReceived < sStats.u32Commands)
+                    {
+                        /* Only commands the capture accounts for hold the replay open,
+                         * so that periodic ones do not keep it running for ever */
+                        u64LastCommand = u64Now;
+                    }
+                    vHandleCommand(&sReceiver, u64Now);
+                }
+            }
+        }
+    }
+    
+    if (!sStats.u64ReplayUs && bStarted)
+    {
+        sStats.u64ReplayUs = u64TimeNow() - u64Start;
+    }
+}
+
+
+static int iCompareLag(const void *pvA, const void *pvB)
+{
+    uint32_t u32A = *(const uint32_t *)pvA;
+    uint32_t u32B = *(const uint32_t *)pvB;
+    
+    return (u32A > u32B) - (u32A < u32B);
+}
+
+
+static void vReport(void)
+{
+    uint32_t u32P50 = 0, u32P90 = 0, u32P99 = 0;
+    
+    if (sStats.u32NumLag)
+    {
+        qsort(sStats.pu32Lag, sStats.u32NumLag, sizeof(uint32_t), iCompareLag);
+        u32P50 = sStats.pu32Lag[(sStats.u32NumLag - 1) * 50 / 100];
+        u32P90 = sStats.pu32Lag[(sStats.u32NumLag - 1) * 90 / 100];
+        u32P99 = sStats.pu32Lag[(sStats.u32NumLag - 1) * 99 / 100];
+    }
+    
+    printf("Replay: %.3fs at speed %g\n", sStats.u64ReplayUs / 1e6, dSpeed);
+    printf("  Frames sent:          %u of %u events, %u responses\n", sStats.u32EventsSent, sStats.u32Events, sStats.u32ResponsesSent);
+    printf("  Frames dropped:       %u (transmit buffer full, daemon not reading)\n", sPty.u32Dropped);
+    printf("  Commands received:    %u: %u matched exactly, %u by type, %u repeated, %u unanswered, %u corrupt\n",
+           sStats.u32CommandsReceived, sStats.u32CommandsExact, sStats.u32CommandsByType,
+           sStats.u32CommandsRepeated, sStats.u32CommandsUnanswered, sReceiver.u32Corrupt);
+    printf("  Send lag (us):        p50 %u, p90 %u, p99 %u, max %u\n", u32P50, u32P90, u32P99, sStats.u32MaxLag);
+    printf("  Daemon unread input:  mean %.0f, max %u bytes\n",
+           sPty.u32InputQueueSamples ? ((double)sPty.u64InputQueueTotal / sPty.u32InputQueueSamples) : 0.0,
+           sPty.u32InputQueueMax);
+    printf("  Transmit buffer:      max %u of %u bytes\n", sPty.u32TxBufferMax, u32TxBufferSize);
+    fflush(stdout);
+}
+
+
+static void vFetchDaemonStats(const char *pcPath)
+{
+    struct sockaddr_un sAddress;
+    char acBuffer[4096];
+    ssize_t iRead;
+    int iSocket;
+    
+    memset(&sAddress, 0, sizeof(struct sockaddr_un));
+    sAddress.sun_family = AF_UNIX;
+    strncpy(sAddress.sun_path, pcPath, sizeof(sAddress.sun_path) - 1);
+    
+    iSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((iSocket < 0) || (connect(iSocket, (struct sockaddr *)&sAddress, sizeof(struct sockaddr_un)) != 0))
+    {
+        perror(pcPath);
+        if (iSocket >= 0)
+        {
+            close(iSocket);
+        }
+        return;
+    }
+    
+    printf("Daemon statistics:\n");
+    while ((iRead = read(iSocket, acBuffer, sizeof(acBuffer))) > 0)
+    {
+        fwrite(acBuffer, 1, iRead, stdout);
+    }
+    close(iSocket);
+}
+
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
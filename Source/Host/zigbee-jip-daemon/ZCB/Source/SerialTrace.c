@@ -0,0 +1,570 @@
+/****************************************************************************
+ *
+ * MODULE:             SerialLink
+ *
+ * COMPONENT:          SerialTrace.c
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Lee Mitchell
+ *
+ * DESCRIPTION:
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <endian.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "SerialTrace.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/** Marks the start of a trace file */
+#define SL_TRACE_MAGIC          "SLTR"
+
+/** Version of the trace file format */
+#define SL_TRACE_VERSION        1
+
+/** Size of the header of each frame in a trace file */
+#define SL_TRACE_RECORD_HEADER  (sizeof(uint64_t) + (2 * sizeof(uint16_t)) + (2 * sizeof(uint8_t)))
+
+/** Marks the start of a capture file */
+#define SL_CAPTURE_MAGIC        "SLCP"
+
+/** Version of the capture file format */
+#define SL_CAPTURE_VERSION      1
+
+/** Size of the header of each frame in a capture file */
+#define SL_CAPTURE_RECORD_HEADER (sizeof(uint64_t) + (2 * sizeof(uint16_t)) + sizeof(uint8_t))
+
+/** Longest time captured frames are left buffered before they are written out */
+#define SL_CAPTURE_FLUSH_US     1000000
+
+#define SL_TRACE_NAME(eType)    { eType, #eType }
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/** Slot in a trace ring */
+typedef struct
+{
+    volatile uint32_t   u32Sequence;            /**< Number of the frame in the slot plus 1, or 0 while it is being written */
+    tsSL_TraceRecord    sRecord;
+} tsSL_TraceSlot;
+
+
+/** Ring of traced frames with a single writer */
+typedef struct
+{
+    volatile uint32_t   u32Head;                /**< Number of frames written */
+    tsSL_TraceSlot      asSlots[SL_TRACE_RING_SIZE];
+} tsSL_TraceRing;
+
+
+/** Name of a message type */
+typedef struct
+{
+    uint16_t            u16Type;
+    const char         *pcName;
+} tsSL_MessageName;
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static void vSL_CaptureFrame(uint64_t u64Time, teSL_TraceDirection eDirection, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+static tsSL_TraceRing asTraceRings[E_SL_TRACE_NUM_DIRECTIONS];
+
+/** Capture file, or NULL when not capturing */
+static FILE *psCaptureFile = NULL;
+
+/** Time the capture file was last flushed */
+static uint64_t u64CaptureFlushed;
+
+/** Serialises frames in both directions into the capture file */
+static pthread_mutex_t sCaptureMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const tsSL_MessageName asMessageNames[] =
+{
+    SL_TRACE_NAME(E_SL_MSG_STATUS),
+    SL_TRACE_NAME(E_SL_MSG_LOG),
+    SL_TRACE_NAME(E_SL_MSG_DATA_INDICATION),
+    SL_TRACE_NAME(E_SL_MSG_NODE_CLUSTER_LIST),
+    SL_TRACE_NAME(E_SL_MSG_NODE_ATTRIBUTE_LIST),
+    SL_TRACE_NAME(E_SL_MSG_NODE_COMMAND_ID_LIST),
+    SL_TRACE_NAME(E_SL_MSG_RESTART_PROVISIONED),
+    SL_TRACE_NAME(E_SL_MSG_RESTART_FACTORY_NEW),
+    SL_TRACE_NAME(E_SL_MSG_GET_VERSION),
+    SL_TRACE_NAME(E_SL_MSG_VERSION_LIST),
+    SL_TRACE_NAME(E_SL_MSG_SET_EXT_PANID),
+    SL_TRACE_NAME(E_SL_MSG_SET_CHANNELMASK),
+    SL_TRACE_NAME(E_SL_MSG_SET_SECURITY),
+    SL_TRACE_NAME(E_SL_MSG_SET_DEVICETYPE),
+    SL_TRACE_NAME(E_SL_MSG_START_NETWORK),
+    SL_TRACE_NAME(E_SL_MSG_NETWORK_JOINED_FORMED),
+    SL_TRACE_NAME(E_SL_MSG_NETWORK_REMOVE_DEVICE),
+    SL_TRACE_NAME(E_SL_MSG_NETWORK_WHITELIST_ENABLE),
+    SL_TRACE_NAME(E_SL_MSG_AUTHENTICATE_DEVICE_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_AUTHENTICATE_DEVICE_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_RESET),
+    SL_TRACE_NAME(E_SL_MSG_ERASE_PERSISTENT_DATA),
+    SL_TRACE_NAME(E_SL_MSG_GET_PERMIT_JOIN),
+    SL_TRACE_NAME(E_SL_MSG_GET_PERMIT_JOIN_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_BIND),
+    SL_TRACE_NAME(E_SL_MSG_UNBIND),
+    SL_TRACE_NAME(E_SL_MSG_NETWORK_ADDRESS_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_IEEE_ADDRESS_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_IEEE_ADDRESS_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_NODE_DESCRIPTOR_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_NODE_DESCRIPTOR_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_SIMPLE_DESCRIPTOR_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_SIMPLE_DESCRIPTOR_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_POWER_DESCRIPTOR_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_ACTIVE_ENDPOINT_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_MATCH_DESCRIPTOR_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_MATCH_DESCRIPTOR_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_MANAGEMENT_LEAVE_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_LEAVE_CONFIRMATION),
+    SL_TRACE_NAME(E_SL_MSG_LEAVE_INDICATION),
+    SL_TRACE_NAME(E_SL_MSG_PERMIT_JOINING_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_MANAGEMENT_NETWPRK_UPDATE_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_SYSTEM_SERVER_DISCOVERY),
+    SL_TRACE_NAME(E_SL_MSG_COMPLEX_DESCRIPTOR_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_DEVICE_ANNOUNCE),
+    SL_TRACE_NAME(E_SL_MSG_MANAGEMENT_LQI_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_MANAGEMENT_LQI_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_READ_ATTRIBUTE_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_READ_ATTRIBUTE_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_DEFAULT_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_ATTRIBUTE_REPORT),
+    SL_TRACE_NAME(E_SL_MSG_WRITE_ATTRIBUTE_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_WRITE_ATTRIBUTE_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_ADD_GROUP_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_ADD_GROUP_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_VIEW_GROUP),
+    SL_TRACE_NAME(E_SL_MSG_GET_GROUP_MEMBERSHIP_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_GET_GROUP_MEMBERSHIP_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_REMOVE_GROUP_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_REMOVE_GROUP_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_REMOVE_ALL_GROUPS),
+    SL_TRACE_NAME(E_SL_MSG_ADD_GROUP_IF_IDENTIFY),
+    SL_TRACE_NAME(E_SL_MSG_IDENTIFY_SEND),
+    SL_TRACE_NAME(E_SL_MSG_IDENTIFY_QUERY),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_TO_LEVEL),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_TO_LEVEL_ONOFF),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_STEP),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_STOP_MOVE),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_STOP_ONOFF),
+    SL_TRACE_NAME(E_SL_MSG_ONOFF),
+    SL_TRACE_NAME(E_SL_MSG_VIEW_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_ADD_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_REMOVE_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_REMOVE_SCENE_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_REMOVE_ALL_SCENES),
+    SL_TRACE_NAME(E_SL_MSG_STORE_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_STORE_SCENE_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_RECALL_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_SCENE_MEMBERSHIP_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_SCENE_MEMBERSHIP_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_TO_HUE),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_HUE),
+    SL_TRACE_NAME(E_SL_MSG_STEP_HUE),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_TO_SATURATION),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_SATURATION),
+    SL_TRACE_NAME(E_SL_MSG_STEP_SATURATION),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_TO_HUE_SATURATION),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_TO_COLOUR),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_COLOUR),
+    SL_TRACE_NAME(E_SL_MSG_STEP_COLOUR),
+    SL_TRACE_NAME(E_SL_MSG_INITIATE_TOUCHLINK),
+    SL_TRACE_NAME(E_SL_MSG_TOUCHLINK_STATUS),
+    SL_TRACE_NAME(E_SL_MSG_IDENTIFY_TRIGGER_EFFECT),
+    SL_TRACE_NAME(E_SL_MSG_ONOFF_TIMED),
+    SL_TRACE_NAME(E_SL_MSG_ONOFF_EFFECTS),
+    SL_TRACE_NAME(E_SL_MSG_ADD_ENHANCED_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_VIEW_ENHANCED_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_COPY_SCENE),
+    SL_TRACE_NAME(E_SL_MSG_ENHANCED_MOVE_TO_HUE),
+    SL_TRACE_NAME(E_SL_MSG_ENHANCED_MOVE_HUE),
+    SL_TRACE_NAME(E_SL_MSG_ENHANCED_STEP_HUE),
+    SL_TRACE_NAME(E_SL_MSG_ENHANCED_MOVE_TO_HUE_SATURATION),
+    SL_TRACE_NAME(E_SL_MSG_COLOUR_LOOP_SET),
+    SL_TRACE_NAME(E_SL_MSG_STOP_MOVE_STEP),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_TO_COLOUR_TEMPERATURE),
+    SL_TRACE_NAME(E_SL_MSG_MOVE_COLOUR_TEMPERATURE),
+    SL_TRACE_NAME(E_SL_MSG_STEP_COLOUR_TEMPERATURE),
+    SL_TRACE_NAME(E_SL_MSG_LOCK_UNLOCK_DOOR),
+    SL_TRACE_NAME(E_SL_MSG_PDM_AVAILABLE_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_PDM_AVAILABLE_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_PDM_SAVE_RECORD_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_PDM_SAVE_RECORD_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_PDM_LOAD_RECORD_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_PDM_LOAD_RECORD_RESPONSE),
+    SL_TRACE_NAME(E_SL_MSG_PDM_DELETE_ALL_RECORDS_REQUEST),
+    SL_TRACE_NAME(E_SL_MSG_PDM_DELETE_ALL_RECORDS_RESPONSE),
+};
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+void vSL_TraceFrame(teSL_TraceDirection eDirection, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data)
+{
+    tsSL_TraceRing *psRing = &asTraceRings[eDirection];
+    uint32_t u32Frame = psRing->u32Head;
+    tsSL_TraceSlot *psSlot = &psRing->asSlots[u32Frame & (SL_TRACE_RING_SIZE - 1)];
+    struct timespec sNow;
+    
+    clock_gettime(CLOCK_REALTIME, &sNow);
+    
+    /* Readers skip the slot until it has been filled in again */
+    psSlot->u32Sequence = 0;
+    __sync_synchronize();
+    
+    psSlot->sRecord.u64Time     = ((uint64_t)sNow.tv_sec * 1000000) + (sNow.tv_nsec / 1000);
+    psSlot->sRecord.u16Type     = u16Type;
+    psSlot->sRecord.u16Length   = u16Length;
+    psSlot->sRecord.u8Direction = eDirection;
+    psSlot->sRecord.u8Captured  = (u16Length < SL_TRACE_MAX_PAYLOAD) ? u16Length : SL_TRACE_MAX_PAYLOAD;
+    memcpy(psSlot->sRecord.au8Payload, pu8Data, psSlot->sRecord.u8Captured);
+    
+    __sync_synchronize();
+    psSlot->u32Sequence = u32Frame + 1;
+    psRing->u32Head = u32Frame + 1;
+    
+    if (psCaptureFile)
+    {
+        vSL_CaptureFrame(psSlot->sRecord.u64Time, eDirection, u16Type, u16Length, pu8Data);
+    }
+}
+
+
+teSL_Status eSL_TraceWrite(FILE *psStream)
+{
+    tsSL_TraceRecord *asRecords;
+    uint32_t au32Count[E_SL_TRACE_NUM_DIRECTIONS];
+    uint32_t au32Next[E_SL_TRACE_NUM_DIRECTIONS];
+    uint8_t au8Header[8] = SL_TRACE_MAGIC;
+    teSL_Status eStatus = E_SL_OK;
+    int iDirection;
+    
+    asRecords = malloc(sizeof(tsSL_TraceRecord) * SL_TRACE_RING_SIZE * E_SL_TRACE_NUM_DIRECTIONS);
+    if (!asRecords)
+    {
+        return E_SL_ERROR_NOMEM;
+    }
+    
+    /* Copy each ring, skipping frames that are overwritten while they are copied */
+    for (iDirection = 0; iDirection < E_SL_TRACE_NUM_DIRECTIONS; iDirection++)
+    {
+        tsSL_TraceRing *psRing = &asTraceRings[iDirection];
+        tsSL_TraceRecord *psRecords = &asRecords[iDirection * SL_TRACE_RING_SIZE];
+        uint32_t u32Head = psRing->u32Head;
+        uint32_t u32Frame = (u32Head > SL_TRACE_RING_SIZE) ? (u32Head - SL_TRACE_RING_SIZE) : 0;
+        
+        au32Count[iDirection] = 0;
+        au32Next[iDirection] = 0;
+        __sync_synchronize();
+        
+        for (; u32Frame != u32Head; u32Frame++)
+        {
+            tsSL_TraceSlot *psSlot = &psRing->asSlots[u32Frame & (SL_TRACE_RING_SIZE - 1)];
+            
+            if (psSlot->u32Sequence != (u32Frame + 1))
+            {
+                continue;
+            }
+            __sync_synchronize();
+            memcpy(&psRecords[au32Count[iDirection]], &psSlot->sRecord, sizeof(tsSL_TraceRecord));
+            __sync_synchronize();
+            if (psSlot->u32Sequence != (u32Frame + 1))
+            {
+                continue;
+            }
+            au32Count[iDirection]++;
+        }
+    }
+    
+    au8Header[4] = SL_TRACE_VERSION;
+    if (fwrite(au8Header, sizeof(au8Header), 1, psStream) != 1)
+    {
+        eStatus = E_SL_ERROR;
+    }
+    
+    /* Merge the directions in time order */
+    while (eStatus == E_SL_OK)
+    {
+        tsSL_TraceRecord *psRecord = NULL;
+        uint8_t au8Record[SL_TRACE_RECORD_HEADER];
+        uint64_t u64Time;
+        uint16_t u16Value;
+        int iOldest = -1;
+        
+        for (iDirection = 0; iDirection < E_SL_TRACE_NUM_DIRECTIONS; iDirection++)
+        {
+            tsSL_TraceRecord *psCandidate = &asRecords[(iDirection * SL_TRACE_RING_SIZE) + au32Next[iDirection]];
+            
+            if ((au32Next[iDirection] < au32Count[iDirection]) &&
+                ((!psRecord) || (psCandidate->u64Time < psRecord->u64Time)))
+            {
+                psRecord = psCandidate;
+                iOldest = iDirection;
+            }
+        }
+        if (!psRecord)
+        {
+            break;
+        }
+        au32Next[iOldest]++;
+        
+        u64Time = htobe64(psRecord->u64Time);
+        memcpy(&au8Record[0], &u64Time, sizeof(uint64_t));
+        u16Value = htons(psRecord->u16Type);
+        memcpy(&au8Record[8], &u16Value, sizeof(uint16_t));
+        u16Value = htons(psRecord->u16Length);
+        memcpy(&au8Record[10], &u16Value, sizeof(uint16_t));
+        au8Record[12] = psRecord->u8Direction;
+        au8Record[13] = psRecord->u8Captured;
+        
+        if ((fwrite(au8Record, sizeof(au8Record), 1, psStream) != 1) ||
+            (fwrite(psRecord->au8Payload, 1, psRecord->u8Captured, psStream) != psRecord->u8Captured))
+        {
+            eStatus = E_SL_ERROR;
+        }
+    }
+    
+    free(asRecords);
+    return eStatus;
+}
+
+
+teSL_Status eSL_TraceRead(FILE *psStream, int bFirst, tsSL_TraceRecord *psRecord)
+{
+    uint8_t au8Record[SL_TRACE_RECORD_HEADER];
+    uint64_t u64Time;
+    uint16_t u16Value;
+    
+    if (bFirst)
+    {
+        uint8_t au8Header[8];
+        
+        if ((fread(au8Header, sizeof(au8Header), 1, psStream) != 1) ||
+            (memcmp(au8Header, SL_TRACE_MAGIC, 4) != 0) || (au8Header[4] != SL_TRACE_VERSION))
+        {
+            return E_SL_ERROR;
+        }
+    }
+    
+    if (fread(au8Record, sizeof(au8Record), 1, psStream) != 1)
+    {
+        return E_SL_NOMESSAGE;
+    }
+    
+    memcpy(&u64Time, &au8Record[0], sizeof(uint64_t));
+    psRecord->u64Time = be64toh(u64Time);
+    memcpy(&u16Value, &au8Record[8], sizeof(uint16_t));
+    psRecord->u16Type = ntohs(u16Value);
+    memcpy(&u16Value, &au8Record[10], sizeof(uint16_t));
+    psRecord->u16Length = ntohs(u16Value);
+    psRecord->u8Direction = au8Record[12];
+    psRecord->u8Captured = au8Record[13];
+    
+    if ((psRecord->u8Direction >= E_SL_TRACE_NUM_DIRECTIONS) || (psRecord->u8Captured > SL_TRACE_MAX_PAYLOAD) ||
+        (fread(psRecord->au8Payload, 1, psRecord->u8Captured, psStream) != psRecord->u8Captured))
+    {
+        return E_SL_ERROR;
+    }
+    return E_SL_OK;
+}
+
+
+teSL_Status eSL_CaptureStart(const char *pcPath)
+{
+    uint8_t au8Header[8] = SL_CAPTURE_MAGIC;
+    FILE *psFile = fopen(pcPath, "w");
+    
+    if (!psFile)
+    {
+        return E_SL_ERROR;
+    }
+    
+    au8Header[4] = SL_CAPTURE_VERSION;
+    if (fwrite(au8Header, sizeof(au8Header), 1, psFile) != 1)
+    {
+        fclose(psFile);
+        return E_SL_ERROR;
+    }
+    
+    pthread_mutex_lock(&sCaptureMutex);
+    if (psCaptureFile)
+    {
+        fclose(psCaptureFile);
+    }
+    psCaptureFile = psFile;
+    u64CaptureFlushed = 0;
+    pthread_mutex_unlock(&sCaptureMutex);
+    return E_SL_OK;
+}
+
+
+teSL_Status eSL_CaptureStop(void)
+{
+    teSL_Status eStatus = E_SL_OK;
+    
+    pthread_mutex_lock(&sCaptureMutex);
+    if (psCaptureFile)
+    {
+        if (fclose(psCaptureFile) != 0)
+        {
+            eStatus = E_SL_ERROR;
+        }
+        psCaptureFile = NULL;
+    }
+    pthread_mutex_unlock(&sCaptureMutex);
+    return eStatus;
+}
+
+
+teSL_Status eSL_CaptureRead(FILE *psStream, int bFirst, tsSL_CaptureRecord *psRecord)
+{
+    uint8_t au8Record[SL_CAPTURE_RECORD_HEADER];
+    uint64_t u64Time;
+    uint16_t u16Value;
+    
+    if (bFirst)
+    {
+        uint8_t au8Header[8];
+        
+        if ((fread(au8Header, sizeof(au8Header), 1, psStream) != 1) ||
+            (memcmp(au8Header, SL_CAPTURE_MAGIC, 4) != 0) || (au8Header[4] != SL_CAPTURE_VERSION))
+        {
+            return E_SL_ERROR;
+        }
+    }
+    
+    if (fread(au8Record, sizeof(au8Record), 1, psStream) != 1)
+    {
+        return E_SL_NOMESSAGE;
+    }
+    
+    memcpy(&u64Time, &au8Record[0], sizeof(uint64_t));
+    psRecord->u64Time = be64toh(u64Time);
+    memcpy(&u16Value, &au8Record[8], sizeof(uint16_t));
+    psRecord->u16Type = ntohs(u16Value);
+    memcpy(&u16Value, &au8Record[10], sizeof(uint16_t));
+    psRecord->u16Length = ntohs(u16Value);
+    psRecord->u8Direction = au8Record[12];
+    
+    if ((psRecord->u8Direction >= E_SL_TRACE_NUM_DIRECTIONS) || (psRecord->u16Length > SL_CAPTURE_MAX_PAYLOAD) ||
+        (fread(psRecord->au8Payload, 1, psRecord->u16Length, psStream) != psRecord->u16Length))
+    {
+        return E_SL_ERROR;
+    }
+    return E_SL_OK;
+}
+
+
+const char *pcSL_MessageName(uint16_t u16Type)
+{
+    int i;
+    
+    for (i = 0; i < (sizeof(asMessageNames) / sizeof(tsSL_MessageName)); i++)
+    {
+        if (asMessageNames[i].u16Type == u16Type)
+        {
+            return asMessageNames[i].pcName;
+        }
+    }
+    return NULL;
+}
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+static void vSL_CaptureFrame(uint64_t u64Time, teSL_TraceDirection eDirection, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data)
+{
+    uint8_t au8Record[SL_CAPTURE_RECORD_HEADER];
+    uint64_t u64Value = htobe64(u64Time);
+    uint16_t u16Value;
+    
+    if (u16Length > SL_CAPTURE_MAX_PAYLOAD)
+    {
+        /* Longer than any frame the serial link can receive, so it can't be played back */
+        return;
+    }
+    
+    memcpy(&au8Record[0], &u64Value, sizeof(uint64_t));
+    u16Value = htons(u16Type);
+    memcpy(&au8Record[8], &u16Value, sizeof(uint16_t));
+    u16Value = htons(u16Length);
+    memcpy(&au8Record[10], &u16Value, sizeof(uint16_t));
+    au8Record[12] = eDirection;
+    
+    pthread_mutex_lock(&sCaptureMutex);
+    if (psCaptureFile)
+    {
+        fwrite(au8Record, sizeof(au8Record), 1, psCaptureFile);
+        fwrite(pu8Data, 1, u16Length, psCaptureFile);
+        
+        /* Keep the file up to date without writing it out for every frame */
+        if ((u64Time - u64CaptureFlushed) >= SL_CAPTURE_FLUSH_US)
+        {
+            fflush(psCaptureFile);
+            u64CaptureFlushed = u64Time;
+        }
+    }
+    pthread_mutex_unlock(&sCaptureMutex);
+}
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
@@ -0,0 +1,178 @@
+/****************************************************************************
+ *
+ * MODULE:             SerialLink
+ *
+ * COMPONENT:          SerialTrace.h
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Lee Mitchell
+ *
+ * DESCRIPTION:
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+#ifndef  SERIALTRACE_H_INCLUDED
+#define  SERIALTRACE_H_INCLUDED
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "SerialLink.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/** Number of frames kept for each direction. Must be a power of 2 */
+#define SL_TRACE_RING_SIZE      1024
+
+/** Number of bytes of each frame's payload that are kept */
+#define SL_TRACE_MAX_PAYLOAD    64
+
+/** Largest payload of a captured frame, as the largest message the serial link receives */
+#define SL_CAPTURE_MAX_PAYLOAD  256
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/** Direction of a traced frame */
+typedef enum
+{
+    E_SL_TRACE_HOST_TO_NODE,
+    E_SL_TRACE_NODE_TO_HOST,
+    E_SL_TRACE_NUM_DIRECTIONS,
+} teSL_TraceDirection;
+
+
+/** A traced frame */
+typedef struct
+{
+    uint64_t            u64Time;                /**< Time the frame was sent or received (us since the epoch) */
+    uint16_t            u16Type;                /**< Message type */
+    uint16_t            u16Length;              /**< Length of the payload */
+    uint8_t             u8Direction;            /**< \ref teSL_TraceDirection */
+    uint8_t             u8Captured;             /**< Number of bytes of the payload kept */
+    uint8_t             au8Payload[SL_TRACE_MAX_PAYLOAD];
+} tsSL_TraceRecord;
+
+
+/** A captured frame */
+typedef struct
+{
+    uint64_t            u64Time;                /**< Time the frame was sent or received (us since the epoch) */
+    uint16_t            u16Type;                /**< Message type */
+    uint16_t            u16Length;              /**< Length of the payload */
+    uint8_t             u8Direction;            /**< \ref teSL_TraceDirection */
+    uint8_t             au8Payload[SL_CAPTURE_MAX_PAYLOAD];
+} tsSL_CaptureRecord;
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+/** Serial link frames are always traced into rings in memory, one per direction.
+ *  Each ring only has one writer at a time - frames to the node are written
+ *  with the serial link locked, frames from the node by the reader thread -
+ *  so tracing takes no locks and costs a copy of the frame. The rings can be
+ *  written to a file at any time without stopping the writers, in a compact
+ *  binary form that \ref eSL_TraceRead reads back.
+ */
+
+/** Trace a frame
+ *  \param eDirection       Direction of the frame
+ *  \param u16Type          Message type
+ *  \param u16Length        Length of the payload
+ *  \param pu8Data          Payload
+ */
+void vSL_TraceFrame(teSL_TraceDirection eDirection, uint16_t u16Type, uint16_t u16Length, uint8_t *pu8Data);
+
+/** Write the traced frames to a stream, oldest first
+ *  \param psStream         Stream to write to
+ *  \return E_SL_OK on success
+ */
+teSL_Status eSL_TraceWrite(FILE *psStream);
+
+/** Read the next frame from a stream written by \ref eSL_TraceWrite.
+ *  The header of the stream is checked before the first frame is read.
+ *  \param psStream         Stream to read from
+ *  \param bFirst           True to read the header first
+ *  \param psRecord[out]    Pointer to location to store the frame
+ *  \return E_SL_OK on success, E_SL_NOMESSAGE at the end of the stream, E_SL_ERROR if the stream is not a trace
+ */
+teSL_Status eSL_TraceRead(FILE *psStream, int bFirst, tsSL_TraceRecord *psRecord);
+
+/** While a capture is running every traced frame is also appended, whole,
+ *  to a capture file, which zcb-replay can play back to the daemon.
+ */
+
+/** Start capturing frames to a file
+ *  \param pcPath           Path of the file, which is truncated
+ *  \return E_SL_OK on success
+ */
+teSL_Status eSL_CaptureStart(const char *pcPath);
+
+/** Stop capturing frames and close the capture file
+ *  \return E_SL_OK on success
+ */
+teSL_Status eSL_CaptureStop(void);
+
+/** Read the next frame from a capture file.
+ *  The header of the file is checked before the first frame is read.
+ *  \param psStream         Stream to read from
+ *  \param bFirst           True to read the header first
+ *  \param psRecord[out]    Pointer to location to store the frame
+ *  \return E_SL_OK on success, E_SL_NOMESSAGE at the end of the file, E_SL_ERROR if the file is not a capture
+ */
+teSL_Status eSL_CaptureRead(FILE *psStream, int bFirst, tsSL_CaptureRecord *psRecord);
+
+/** Get the name of a message type
+ *  \param u16Type          Message type
+ *  \return The name of the type in \ref SerialLink.h, or NULL if it is not known
+ */
+const char *pcSL_MessageName(uint16_t u16Type);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif  /* SERIALTRACE_H_INCLUDED */
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
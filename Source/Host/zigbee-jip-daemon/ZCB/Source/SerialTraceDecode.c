@@ -0,0 +1,182 @@
+/****************************************************************************
+ *
+ * MODULE:             SerialLink
+ *
+ * COMPONENT:          SerialTraceDecode.c
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Lee Mitchell
+ *
+ * DESCRIPTION:
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "SerialTrace.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static void vPrintFrame(uint64_t u64Time, uint8_t u8Direction, uint16_t u16Type, uint16_t u16Length,
+                        uint16_t u16Captured, uint8_t *pu8Payload);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+static const char *apcDirections[E_SL_TRACE_NUM_DIRECTIONS] =
+{
+    "Host->Node",
+    "Node->Host",
+};
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+
+/** Print a serial trace or capture written by zigbee-jip-daemon as text */
+int main(int argc, char *argv[])
+{
+    tsSL_TraceRecord sRecord;
+    tsSL_CaptureRecord sFrame;
+    teSL_Status eStatus;
+    FILE *psFile = stdin;
+    int bFirst = 1;
+    
+    if (argc > 2)
+    {
+        fprintf(stderr, "Usage: %s [trace or capture file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    
+    if ((argc == 2) && (strcmp(argv[1], "-") != 0))
+    {
+        psFile = fopen(argv[1], "r");
+        if (!psFile)
+        {
+            perror(argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    while ((eStatus = eSL_TraceRead(psFile, bFirst, &sRecord)) == E_SL_OK)
+    {
+        bFirst = 0;
+        vPrintFrame(sRecord.u64Time, sRecord.u8Direction, sRecord.u16Type, sRecord.u16Length, sRecord.u8Captured, sRecord.au8Payload);
+    }
+    
+    if ((eStatus == E_SL_ERROR) && bFirst && (fseek(psFile, 0, SEEK_SET) == 0))
+    {
+        /* Not a trace, so try it as a capture */
+        while ((eStatus = eSL_CaptureRead(psFile, bFirst, &sFrame)) == E_SL_OK)
+        {
+            bFirst = 0;
+            vPrintFrame(sFrame.u64Time, sFrame.u8Direction, sFrame.u16Type, sFrame.u16Length, sFrame.u16Length, sFrame.au8Payload);
+        }
+    }
+    
+    if (eStatus != E_SL_NOMESSAGE)
+    {
+        fprintf(stderr, "%s: not a serial trace or capture, or truncated\n", (argc == 2) ? argv[1] : "stdin");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+static void vPrintFrame(uint64_t u64Time, uint8_t u8Direction, uint16_t u16Type, uint16_t u16Length,
+                        uint16_t u16Captured, uint8_t *pu8Payload)
+{
+    const char *pcName = pcSL_MessageName(u16Type);
+    time_t tSeconds = u64Time / 1000000;
+    struct tm sTime;
+    char acTime[32];
+    int i;
+    
+    localtime_r(&tSeconds, &sTime);
+    strftime(acTime, sizeof(acTime), "%Y-%m-%d %H:%M:%S", &sTime);
+    
+    printf("%s.%06u %s 0x%04X %-40s (Length % 4d)", acTime, (unsigned int)(u64Time % 1000000),
+           apcDirections[u8Direction], u16Type, pcName ? pcName : "?", u16Length);
+    
+    if ((u16Type == E_SL_MSG_STATUS) && (u16Captured >= 4))
+    {
+        /* Status, sequence number, and the type of the message the status is for */
+        uint16_t u16MessageType = (pu8Payload[2] << 8) | pu8Payload[3];
+        
+        pcName = pcSL_MessageName(u16MessageType);
+        printf(" Status %d, Sequence %d, for 0x%04X %s", pu8Payload[0], pu8Payload[1],
+               u16MessageType, pcName ? pcName : "?");
+    }
+    else
+    {
+        for (i = 0; i < u16Captured; i++)
+        {
+            printf(" 0x%02X", pu8Payload[i]);
+        }
+        if (u16Captured < u16Length)
+        {
+            printf(" ...");
+        }
+    }
+    printf("\n");
+}
+
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
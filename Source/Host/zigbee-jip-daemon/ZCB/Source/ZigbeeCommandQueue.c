@@ -0,0 +1,674 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee - JIP daemon
+ *
+ * COMPONENT:          Queue of commands sent to each Zigbee node
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Matt Redfearn
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2014. All rights reserved
+ *
+ ***************************************************************************/
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <libdaemon/daemon.h>
+
+#include "ZigbeeControlBridge.h"
+#include "ZigbeeCommandQueue.h"
+#include "ZigbeeNetwork.h"
+#include "ZigbeeZLL.h"
+#include "Utils.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+#define DBG_COMMANDQUEUE 0
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/** Commands that must be sent in the order they were queued are in the same group */
+typedef enum
+{
+    E_COMMAND_GROUP_ONOFF_LEVEL,
+    E_COMMAND_GROUP_COLOUR,
+    E_COMMAND_GROUP_ATTRIBUTE,
+} teCommandGroup;
+
+
+/** A command waiting to be sent */
+typedef struct _tsQueuedCommand
+{
+    struct _tsQueuedCommand *psNext;
+    uint64_t            u64Queued;          /**< Time the command, or the one it replaced, was queued */
+    tsZcbCommand        sCommand;
+} tsQueuedCommand;
+
+
+/** Commands waiting to be sent to one node */
+typedef struct _tsNodeQueue
+{
+    struct _tsNodeQueue *psNext;
+    uint16_t            u16ShortAddress;
+    uint8_t             u8Shard;            /**< Control bridge whose network the node is in */
+    int                 bMailbox;           /**< Node sleeps when idle, so commands wait until it is heard from */
+    uint64_t            u64AwakeUntil;      /**< Time until which the node is expected to take commands */
+    uint32_t            u32Depth;           /**< Number of commands waiting */
+    tsQueuedCommand     *psHead;
+    tsQueuedCommand     *psTail;
+} tsNodeQueue;
+
+
+/** Statistics of the command queue */
+typedef struct
+{
+    uint32_t            u32Queued;          /**< Commands added to the end of a node's queue */
+    uint32_t            u32Superseded;      /**< Commands that replaced a waiting command */
+    uint32_t            u32Refused;         /**< Commands refused as the node's queue was full */
+    uint32_t            u32Sent;            /**< Commands sent and acknowledged */
+    uint32_t            u32Failed;          /**< Commands sent that failed, or whose node had gone */
+    uint32_t            u32Held;            /**< Commands held in the mailbox of a sleeping node */
+    uint32_t            u32Expired;         /**< Commands dropped as their sleeping node wasn't heard from in time */
+    uint32_t            u32Heard;           /**< Times a node with commands held was heard from */
+    uint32_t            u32Depth;           /**< Commands waiting now */
+    uint32_t            u32MaxDepth;        /**< Most commands waiting at once */
+    tsUtilsHistogram    sWait;              /**< Time from queueing the latest value to sending it */
+    tsUtilsHistogram    sSend;              /**< Time to send a command and get its default response */
+} tsCommandQueueStats;
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static teCommandGroup eCommandQueue_Group(teZcbCommand eCommand);
+static int iCommandQueue_Replaces(tsZcbCommand *psCommand, tsZcbCommand *psWaiting);
+static tsNodeQueue *psCommandQueue_NextReady(uint64_t u64Now, int iShard);
+static void *pvCommandQueue_SenderThread(tsUtilsThread *psThreadInfo);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+int              bZCB_CommandQueue          = 1;
+
+int              bZCB_CommandMailbox        = 1;
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+/** Protects the node queues and bStopping, signalled when a command is queued or a sleeping node heard from.
+ *  Broadcast, as each control bridge's sender waits on it for its own nodes */
+static pthread_mutex_t      sCommandQueueMutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       sCommandQueueCond   = PTHREAD_COND_INITIALIZER;
+
+/** Nodes with commands waiting, in the order they are to be served */
+static tsNodeQueue          *psNodeQueues       = NULL;
+
+static int                  bStopping           = 0;
+
+static int                  bStarted            = 0;
+
+/** A sender for each control bridge, so a slow network doesn't hold up the others */
+static tsUtilsThread        asSenderThreads[ZCB_MAX_SHARDS];
+
+static int                  iNumSenders         = 0;
+
+static tsCommandQueueStats  sCommandQueueStats;
+
+static const char *apcCommandNames[E_ZCB_COMMAND_NUM] =
+{
+    "On/Off",
+    "Move to level",
+    "Move to hue",
+    "Move to saturation",
+    "Move to hue and saturation",
+    "Move to colour",
+    "Move to colour temperature",
+    "Move colour temperature",
+    "Colour loop set",
+    "Write attribute",
+};
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+teZcbStatus eZCB_CommandQueueStart(void)
+{
+    if (!bZCB_CommandQueue)
+    {
+        return E_ZCB_OK;
+    }
+
+    bStopping = 0;
+    bStarted = 1;
+    for (iNumSenders = 0; iNumSenders < iZCB_NumShards; iNumSenders++)
+    {
+        asSenderThreads[iNumSenders].pvThreadData = (void *)(intptr_t)iNumSenders;
+        if (eUtils_ThreadStart(pvCommandQueue_SenderThread, &asSenderThreads[iNumSenders], E_THREAD_JOINABLE) != E_UTILS_OK)
+        {
+            daemon_log(LOG_ERR, "Failed to start command queue thread");
+            vZCB_CommandQueueFinish();
+            return E_ZCB_ERROR;
+        }
+    }
+    return E_ZCB_OK;
+}
+
+
+void vZCB_CommandQueueFinish(void)
+{
+    if (!bStarted)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sCommandQueueMutex);
+    bStopping = 1;
+    pthread_cond_broadcast(&sCommandQueueCond);
+    pthread_mutex_unlock(&sCommandQueueMutex);
+
+    while (iNumSenders > 0)
+    {
+        eUtils_ThreadStop(&asSenderThreads[--iNumSenders]);
+    }
+    bStarted = 0;
+
+    while (psNodeQueues)
+    {
+        tsNodeQueue *psNodeQueue = psNodeQueues;
+        psNodeQueues = psNodeQueue->psNext;
+
+        while (psNodeQueue->psHead)
+        {
+            tsQueuedCommand *psQueuedCommand = psNodeQueue->psHead;
+            psNodeQueue->psHead = psQueuedCommand->psNext;
+            free(psQueuedCommand);
+        }
+        free(psNodeQueue);
+    }
+    sCommandQueueStats.u32Depth = 0;
+}
+
+
+teZcbStatus eZCB_CommandQueue(tsZCB_Node *psZCBNode, tsZcbCommand *psCommand)
+{
+    tsNodeQueue *psNodeQueue;
+    tsNodeQueue *psLastNodeQueue = NULL;
+    tsQueuedCommand *psQueuedCommand;
+    tsQueuedCommand *psLastInGroup = NULL;
+    teCommandGroup eGroup;
+    uint64_t u64Now;
+
+    if (!bStarted)
+    {
+        return eZCB_CommandSend(psZCBNode, psCommand);
+    }
+
+    eGroup = eCommandQueue_Group(psCommand->eCommand);
+    u64Now = u64Utils_LatencyNow();
+
+    pthread_mutex_lock(&sCommandQueueMutex);
+
+    for (psNodeQueue = psNodeQueues; psNodeQueue; psNodeQueue = psNodeQueue->psNext)
+    {
+        if ((psNodeQueue->u16ShortAddress == psZCBNode->u16ShortAddress) && (psNodeQueue->u8Shard == psZCBNode->u8Shard))
+        {
+            break;
+        }
+        psLastNodeQueue = psNodeQueue;
+    }
+
+    if (psNodeQueue)
+    {
+        for (psQueuedCommand = psNodeQueue->psHead; psQueuedCommand; psQueuedCommand = psQueuedCommand->psNext)
+        {
+            if (eCommandQueue_Group(psQueuedCommand->sCommand.eCommand) == eGroup)
+            {
+                psLastInGroup = psQueuedCommand;
+            }
+        }
+
+        /* Replace the last waiting command of the group if it is the same command.
+         * Any commands after it are in other groups, so order within each group is kept. */
+        if (psLastInGroup && iCommandQueue_Replaces(psCommand, &psLastInGroup->sCommand))
+        {
+            DBG_vPrintf(DBG_COMMANDQUEUE, "Node 0x%04X: %s replaces waiting command\n",
+                        psZCBNode->u16ShortAddress, apcCommandNames[psCommand->eCommand]);
+            psLastInGroup->sCommand  = *psCommand;
+            psLastInGroup->u64Queued = u64Now;
+            sCommandQueueStats.u32Superseded++;
+            pthread_mutex_unlock(&sCommandQueueMutex);
+            return E_ZCB_OK;
+        }
+
+        if (psNodeQueue->u32Depth >= ZCB_COMMAND_QUEUE_DEPTH)
+        {
+            sCommandQueueStats.u32Refused++;
+            pthread_mutex_unlock(&sCommandQueueMutex);
+            daemon_log(LOG_WARNING, "Node 0x%04X: command queue full", psZCBNode->u16ShortAddress);
+            return E_ZCB_INSUFFICIENT_SPACE;
+        }
+    }
+
+    psQueuedCommand = malloc(sizeof(tsQueuedCommand));
+    if (!psQueuedCommand)
+    {
+        pthread_mutex_unlock(&sCommandQueueMutex);
+        return E_ZCB_ERROR_NO_MEM;
+    }
+    psQueuedCommand->psNext    = NULL;
+    psQueuedCommand->u64Queued = u64Now;
+    psQueuedCommand->sCommand  = *psCommand;
+
+    if (!psNodeQueue)
+    {
+        psNodeQueue = malloc(sizeof(tsNodeQueue));
+        if (!psNodeQueue)
+        {
+            free(psQueuedCommand);
+            pthread_mutex_unlock(&sCommandQueueMutex);
+            return E_ZCB_ERROR_NO_MEM;
+        }
+        memset(psNodeQueue, 0, sizeof(tsNodeQueue));
+        psNodeQueue->u16ShortAddress = psZCBNode->u16ShortAddress;
+        psNodeQueue->u8Shard = psZCBNode->u8Shard;
+        psNodeQueue->bMailbox = bZCB_CommandMailbox && !(psZCBNode->u8MacCapability & E_ZB_MAC_CAPABILITY_RXON_WHEN_IDLE);
+
+        /* Served after the nodes already waiting */
+        if (psLastNodeQueue)
+        {
+            psLastNodeQueue->psNext = psNodeQueue;
+        }
+        else
+        {
+            psNodeQueues = psNodeQueue;
+        }
+    }
+
+    if (psNodeQueue->psTail)
+    {
+        psNodeQueue->psTail->psNext = psQueuedCommand;
+    }
+    else
+    {
+        psNodeQueue->psHead = psQueuedCommand;
+    }
+    psNodeQueue->psTail = psQueuedCommand;
+    psNodeQueue->u32Depth++;
+
+    DBG_vPrintf(DBG_COMMANDQUEUE, "Node 0x%04X: %s queued, %d waiting\n",
+                psZCBNode->u16ShortAddress, apcCommandNames[psCommand->eCommand], psNodeQueue->u32Depth);
+
+    sCommandQueueStats.u32Queued++;
+    if (psNodeQueue->bMailbox && (psNodeQueue->u64AwakeUntil < u64Now))
+    {
+        sCommandQueueStats.u32Held++;
+    }
+    sCommandQueueStats.u32Depth++;
+    if (sCommandQueueStats.u32Depth > sCommandQueueStats.u32MaxDepth)
+    {
+        sCommandQueueStats.u32MaxDepth = sCommandQueueStats.u32Depth;
+    }
+
+    pthread_cond_broadcast(&sCommandQueueCond);
+    pthread_mutex_unlock(&sCommandQueueMutex);
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_CommandSend(tsZCB_Node *psZCBNode, tsZcbCommand *psCommand)
+{
+    switch (psCommand->eCommand)
+    {
+        case (E_ZCB_COMMAND_ONOFF):
+            return eZBZLL_OnOff(psZCBNode, 0, psCommand->uArgs.sOnOff.u8Mode);
+
+        case (E_ZCB_COMMAND_MOVE_TO_LEVEL):
+            return eZBZLL_MoveToLevel(psZCBNode, 0, psCommand->uArgs.sMoveToLevel.u8OnOff,
+                                      psCommand->uArgs.sMoveToLevel.u8Level,
+                                      psCommand->uArgs.sMoveToLevel.u16TransitionTime);
+
+        case (E_ZCB_COMMAND_MOVE_TO_HUE):
+            return eZBZLL_MoveToHue(psZCBNode, 0, psCommand->uArgs.sMoveToHue.u8Hue,
+                                    psCommand->uArgs.sMoveToHue.u16TransitionTime);
+
+        case (E_ZCB_COMMAND_MOVE_TO_SATURATION):
+            return eZBZLL_MoveToSaturation(psZCBNode, 0, psCommand->uArgs.sMoveToSaturation.u8Saturation,
+                                           psCommand->uArgs.sMoveToSaturation.u16TransitionTime);
+
+        case (E_ZCB_COMMAND_MOVE_TO_HUE_SATURATION):
+            return eZBZLL_MoveToHueSaturation(psZCBNode, 0, psCommand->uArgs.sMoveToHueSaturation.u8Hue,
+                                              psCommand->uArgs.sMoveToHueSaturation.u8Saturation,
+                                              psCommand->uArgs.sMoveToHueSaturation.u16TransitionTime);
+
+        case (E_ZCB_COMMAND_MOVE_TO_COLOUR):
+            return eZBZLL_MoveToColour(psZCBNode, 0, psCommand->uArgs.sMoveToColour.u16X,
+                                       psCommand->uArgs.sMoveToColour.u16Y,
+                                       psCommand->uArgs.sMoveToColour.u16TransitionTime);
+
+        case (E_ZCB_COMMAND_MOVE_TO_COLOUR_TEMPERATURE):
+            return eZBZLL_MoveToColourTemperature(psZCBNode, 0, psCommand->uArgs.sMoveToColourTemperature.u16ColourTemperature,
+                                                  psCommand->uArgs.sMoveToColourTemperature.u16TransitionTime);
+
+        case (E_ZCB_COMMAND_MOVE_COLOUR_TEMPERATURE):
+            return eZBZLL_MoveColourTemperature(psZCBNode, 0, psCommand->uArgs.sMoveColourTemperature.u8Mode,
+                                                psCommand->uArgs.sMoveColourTemperature.u16Rate,
+                                                psCommand->uArgs.sMoveColourTemperature.u16ColourTemperatureMin,
+                                                psCommand->uArgs.sMoveColourTemperature.u16ColourTemperatureMax);
+
+        case (E_ZCB_COMMAND_COLOUR_LOOP_SET):
+            return eZBZLL_ColourLoopSet(psZCBNode, 0, psCommand->uArgs.sColourLoopSet.u8UpdateFlags,
+                                        psCommand->uArgs.sColourLoopSet.u8Action,
+                                        psCommand->uArgs.sColourLoopSet.u8Direction,
+                                        psCommand->uArgs.sColourLoopSet.u16Time,
+                                        psCommand->uArgs.sColourLoopSet.u16StartHue);
+
+        case (E_ZCB_COMMAND_WRITE_ATTRIBUTE):
+            return eZCB_WriteAttributeRequest(psZCBNode, psCommand->uArgs.sWriteAttribute.u16ClusterID, 0, 0, 0,
+                                              psCommand->uArgs.sWriteAttribute.u16AttributeID,
+                                              psCommand->uArgs.sWriteAttribute.eType,
+                                              psCommand->uArgs.sWriteAttribute.au8Data);
+
+        default:
+            return E_ZCB_ERROR;
+    }
+}
+
+
+void vZCB_CommandQueueNodeHeard(uint16_t u16ShortAddress)
+{
+    tsNodeQueue *psNodeQueue;
+    int iShard = iZCB_ShardSelected();
+
+    if (!bStarted)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sCommandQueueMutex);
+    for (psNodeQueue = psNodeQueues; psNodeQueue; psNodeQueue = psNodeQueue->psNext)
+    {
+        if ((psNodeQueue->u16ShortAddress == u16ShortAddress) && (psNodeQueue->u8Shard == iShard))
+        {
+            if (psNodeQueue->bMailbox)
+            {
+                DBG_vPrintf(DBG_COMMANDQUEUE, "Node 0x%04X: heard, %d commands held\n", u16ShortAddress, psNodeQueue->u32Depth);
+                psNodeQueue->u64AwakeUntil = u64Utils_LatencyNow() + (ZCB_COMMAND_MAILBOX_AWAKE_MS * 1000ULL);
+                sCommandQueueStats.u32Heard++;
+                pthread_cond_broadcast(&sCommandQueueCond);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sCommandQueueMutex);
+}
+
+
+void vZCB_CommandQueueStatsDump(FILE *psStream)
+{
+    tsUtilsHistogramSummary sWait, sSend;
+    uint32_t u32Requests = sCommandQueueStats.u32Queued + sCommandQueueStats.u32Superseded;
+
+    fprintf(psStream, "# Command queue\n");
+    fprintf(psStream, "%-40s %10u\n", "Commands requested",          u32Requests);
+    fprintf(psStream, "%-40s %10u\n", "Commands superseded",         sCommandQueueStats.u32Superseded);
+    fprintf(psStream, "%-40s %10u\n", "Commands refused, queue full",sCommandQueueStats.u32Refused);
+    fprintf(psStream, "%-40s %10u\n", "Commands sent",               sCommandQueueStats.u32Sent);
+    fprintf(psStream, "%-40s %10u\n", "Commands failed",             sCommandQueueStats.u32Failed);
+    fprintf(psStream, "%-40s %10u\n", "Commands held for sleeping nodes", sCommandQueueStats.u32Held);
+    fprintf(psStream, "%-40s %10u\n", "Commands expired while held", sCommandQueueStats.u32Expired);
+    fprintf(psStream, "%-40s %10u\n", "Sleeping nodes heard from",   sCommandQueueStats.u32Heard);
+    fprintf(psStream, "%-40s %10u\n", "Command queue depth",         sCommandQueueStats.u32Depth);
+    fprintf(psStream, "%-40s %10u\n", "Command queue max depth",     sCommandQueueStats.u32MaxDepth);
+    fprintf(psStream, "%-40s %10.2f\n", "Commands requested per command sent",
+            (double)u32Requests / (sCommandQueueStats.u32Sent + sCommandQueueStats.u32Failed ?
+                                   sCommandQueueStats.u32Sent + sCommandQueueStats.u32Failed : 1));
+
+    vUtils_HistogramSummarise(&sCommandQueueStats.sWait, &sWait);
+    vUtils_HistogramSummarise(&sCommandQueueStats.sSend, &sSend);
+    fprintf(psStream, "# Command queue latencies (us)\n");
+    fprintf(psStream, "%-40s %10s %10s %10s %10s %10s %10s\n", "Queue", "Count", "Mean", "P50", "P90", "P99", "Max");
+    fprintf(psStream, "%-40s %10u %10u %10u %10u %10u %10u\n", "Command wait",
+            sWait.u32Count, sWait.u32Mean, sWait.u32P50, sWait.u32P90, sWait.u32P99, sWait.u32Max);
+    fprintf(psStream, "%-40s %10u %10u %10u %10u %10u %10u\n", "Command send",
+            sSend.u32Count, sSend.u32Mean, sSend.u32P50, sSend.u32P90, sSend.u32P99, sSend.u32Max);
+}
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+static teCommandGroup eCommandQueue_Group(teZcbCommand eCommand)
+{
+    switch (eCommand)
+    {
+        case (E_ZCB_COMMAND_ONOFF):
+        case (E_ZCB_COMMAND_MOVE_TO_LEVEL):
+            /* Move to level switches the lamp on or off too */
+            return E_COMMAND_GROUP_ONOFF_LEVEL;
+
+        case (E_ZCB_COMMAND_WRITE_ATTRIBUTE):
+            return E_COMMAND_GROUP_ATTRIBUTE;
+
+        default:
+            return E_COMMAND_GROUP_COLOUR;
+    }
+}
+
+
+static int iCommandQueue_Replaces(tsZcbCommand *psCommand, tsZcbCommand *psWaiting)
+{
+    if (psCommand->eCommand != psWaiting->eCommand)
+    {
+        return 0;
+    }
+
+    switch (psCommand->eCommand)
+    {
+        case (E_ZCB_COMMAND_ONOFF):
+            /* A toggle depends on the state before it, so is never replaced */
+            return (psCommand->uArgs.sOnOff.u8Mode != 2) && (psWaiting->uArgs.sOnOff.u8Mode != 2);
+
+        case (E_ZCB_COMMAND_WRITE_ATTRIBUTE):
+            return (psCommand->uArgs.sWriteAttribute.u16ClusterID   == psWaiting->uArgs.sWriteAttribute.u16ClusterID) &&
+                   (psCommand->uArgs.sWriteAttribute.u16AttributeID == psWaiting->uArgs.sWriteAttribute.u16AttributeID);
+
+        default:
+            return 1;
+    }
+}
+
+
+/* First node of a control bridge in turn with a command that can be sent now, i.e. that isn't waiting to hear from a sleeping node */
+static tsNodeQueue *psCommandQueue_NextReady(uint64_t u64Now, int iShard)
+{
+    tsNodeQueue *psNodeQueue;
+
+    for (psNodeQueue = psNodeQueues; psNodeQueue; psNodeQueue = psNodeQueue->psNext)
+    {
+        if ((psNodeQueue->u8Shard == iShard) && (!psNodeQueue->bMailbox || (psNodeQueue->u64AwakeUntil >= u64Now)))
+        {
+            break;
+        }
+    }
+    return psNodeQueue;
+}
+
+
+static void *pvCommandQueue_SenderThread(tsUtilsThread *psThreadInfo)
+{
+    int iShard = (int)(intptr_t)psThreadInfo->pvThreadData;
+
+    DBG_vPrintf(DBG_COMMANDQUEUE, "Starting for control bridge %d\n", iShard);
+
+    /* Commands are sent through this thread's control bridge to the nodes in its network */
+    vZCB_ShardSelect(iShard);
+    psThreadInfo->eState = E_THREAD_RUNNING;
+
+    while (1)
+    {
+        tsNodeQueue *psNodeQueue;
+        tsQueuedCommand *psQueuedCommand;
+        tsZCB_Node *psZCBNode;
+        teZcbStatus eStatus;
+        uint16_t u16ShortAddress;
+        uint64_t u64Start;
+        int bExpired;
+
+        pthread_mutex_lock(&sCommandQueueMutex);
+        while (!bStopping && ((psNodeQueue = psCommandQueue_NextReady(u64Utils_LatencyNow(), iShard)) == NULL))
+        {
+            /* Woken when a command is queued or a sleeping node is heard from */
+            pthread_cond_wait(&sCommandQueueCond, &sCommandQueueMutex);
+        }
+        if (bStopping)
+        {
+            pthread_mutex_unlock(&sCommandQueueMutex);
+            break;
+        }
+
+        /* Take the first command of the node, then move the node to the back */
+        if (psNodeQueue == psNodeQueues)
+        {
+            psNodeQueues = psNodeQueue->psNext;
+        }
+        else
+        {
+            tsNodeQueue *psPreviousNodeQueue = psNodeQueues;
+
+            while (psPreviousNodeQueue->psNext != psNodeQueue)
+            {
+                psPreviousNodeQueue = psPreviousNodeQueue->psNext;
+            }
+            psPreviousNodeQueue->psNext = psNodeQueue->psNext;
+        }
+        psNodeQueue->psNext = NULL;
+
+        u16ShortAddress = psNodeQueue->u16ShortAddress;
+        psQueuedCommand = psNodeQueue->psHead;
+        psNodeQueue->psHead = psQueuedCommand->psNext;
+        psNodeQueue->u32Depth--;
+        sCommandQueueStats.u32Depth--;
+
+        bExpired = psNodeQueue->bMailbox &&
+                   (u64Utils_LatencyNow() - psQueuedCommand->u64Queued > ZCB_COMMAND_MAILBOX_HOLD_MS * 1000ULL);
+
+        if (psNodeQueue->psHead)
+        {
+            tsNodeQueue *psLastNodeQueue = psNodeQueues;
+
+            if (psLastNodeQueue)
+            {
+                while (psLastNodeQueue->psNext)
+                {
+                    psLastNodeQueue = psLastNodeQueue->psNext;
+                }
+                psLastNodeQueue->psNext = psNodeQueue;
+            }
+            else
+            {
+                psNodeQueues = psNodeQueue;
+            }
+        }
+        else
+        {
+            free(psNodeQueue);
+            psNodeQueue = NULL;
+        }
+        pthread_mutex_unlock(&sCommandQueueMutex);
+
+        if (bExpired)
+        {
+            daemon_log(LOG_DEBUG, "Node 0x%04X: %s dropped, node not heard from in time", u16ShortAddress,
+                       apcCommandNames[psQueuedCommand->sCommand.eCommand]);
+            __sync_add_and_fetch(&sCommandQueueStats.u32Expired, 1);
+            free(psQueuedCommand);
+            continue;
+        }
+
+        /* From here the command can't be replaced, so this is when its value is final */
+        u64Start = u64Utils_LatencyNow();
+        vUtils_HistogramRecord(&sCommandQueueStats.sWait, u64Start - psQueuedCommand->u64Queued);
+
+        psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress);
+        if (psZCBNode)
+        {
+            eStatus = eZCB_CommandSend(psZCBNode, &psQueuedCommand->sCommand);
+            eUtils_LockUnlock(&psZCBNode->sLock);
+        }
+        else
+        {
+            DBG_vPrintf(DBG_COMMANDQUEUE, "Node 0x%04X has gone\n", u16ShortAddress);
+            eStatus = E_ZCB_UNKNOWN_NODE;
+        }
+        vUtils_HistogramRecord(&sCommandQueueStats.sSend, u64Utils_LatencyNow() - u64Start);
+
+        if (eStatus == E_ZCB_OK)
+        {
+            __sync_add_and_fetch(&sCommandQueueStats.u32Sent, 1);
+        }
+        else
+        {
+            __sync_add_and_fetch(&sCommandQueueStats.u32Failed, 1);
+            daemon_log(LOG_DEBUG, "Node 0x%04X: %s failed (%d)", u16ShortAddress,
+                       apcCommandNames[psQueuedCommand->sCommand.eCommand], eStatus);
+        }
+
+        /* Nobody is waiting for the result, so count it against the node's comms */
+        if (psZCBNode && ((psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress)) != NULL))
+        {
+            vZCB_NodeUpdateComms(psZCBNode, eStatus);
+            eUtils_LockUnlock(&psZCBNode->sLock);
+        }
+        free(psQueuedCommand);
+    }
+
+    DBG_vPrintf(DBG_COMMANDQUEUE, "Exit\n");
+
+    /* Return from thread clearing resources */
+    eUtils_ThreadFinish(psThreadInfo);
+    return NULL;
+}
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
@@ -54,11 +54,13 @@
 #include <libdaemon/daemon.h>
 
 #include "ZigbeeControlBridge.h"
+#include "ZigbeeCommandQueue.h"
 #include "ZigbeeConstant.h"
 #include "ZigbeeNetwork.h"
 #include "ZigbeeUtils.h"
 #include "ZigbeePDM.h"
 #include "SerialLink.h"
+#include "SerialTrace.h"
 #include "Utils.h"
 
 #ifdef USE_ZEROCONF
@@ -90,10 +92,16 @@ static void ZCB_HandleNetworkJoined             (void *pvUser, uint16_t u16Lengt
 static void ZCB_HandleDeviceAnnounce            (void *pvUser, uint16_t u16Length, void *pvMessage);
 static void ZCB_HandleDeviceLeave               (void *pvUser, uint16_t u16Length, void *pvMessage);
 static void ZCB_HandleMatchDescriptorResponse   (void *pvUser, uint16_t u16Length, void *pvMessage);
+static void ZCB_HandleIEEEAddressResponse       (void *pvUser, uint16_t u16Length, void *pvMessage);
+static void ZCB_HandleNodeDescriptorResponse    (void *pvUser, uint16_t u16Length, void *pvMessage);
+static void ZCB_HandleSimpleDescriptorResponse  (void *pvUser, uint16_t u16Length, void *pvMessage);
+static void ZCB_HandleAddGroupResponse          (void *pvUser, uint16_t u16Length, void *pvMessage);
 static void ZCB_HandleAttributeReport           (void *pvUser, uint16_t u16Length, void *pvMessage);
 
 static teZcbStatus eZCB_ConfigureControlBridge  (void);
 
+static teZcbStatus eZCB_SendAddGroupMembershipPolicy(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t *pu8SequenceNo, tsZcbDeliveryPolicy *psPolicy);
+
 /****************************************************************************/
 /***        Exported Variables                                            ***/
 /****************************************************************************/
@@ -103,10 +111,8 @@ teStartMode      eStartMode          = CONFIG_DEFAULT_START_MODE;
 teChannel        eChannel            = CONFIG_DEFAULT_CHANNEL;
 uint64_t         u64PanID            = CONFIG_DEFAULT_PANID;
 
-/* Network parameters in use */
-teChannel        eChannelInUse       = 0;
-uint64_t         u64PanIDInUse       = 0;
-uint16_t         u16PanIDInUse       = 0;
+/* Control bridges, each with its own network parameters */
+tsZCB_Shard      asZCB_Shards[ZCB_MAX_SHARDS];
 
 tsUtilsQueue    sZcbEventQueue;
 
@@ -117,9 +123,15 @@ int              bZCB_EnableAPSAck  = 1;
 /***        Local Variables                                               ***/
 /****************************************************************************/
 
-
-/** Firmware version of the connected device */
-uint32_t u32ZCB_SoftwareVersion = 0;
+/** Event queue statistics */
+static struct
+{
+    volatile uint32_t   u32Queued;              /**< Events queued */
+    volatile uint32_t   u32Refused;             /**< Events not queued because the queue was full */
+    volatile uint32_t   u32Depth;               /**< Events in the queue */
+    volatile uint32_t   u32MaxDepth;            /**< Most events there have been in the queue */
+    tsUtilsHistogram    sWait;                  /**< Time from queueing an event to the main loop taking it */
+} sZcbEventStats;
 
 
 extern int verbosity;
@@ -129,37 +141,53 @@ extern int verbosity;
 /****************************************************************************/
 
 
-teZcbStatus eZCB_Init(char *cpSerialDevice, uint32_t u32BaudRate, char *pcPDMFile)
+teZcbStatus eZCB_Init(uint32_t u32BaudRate, char *pcPDMFile)
 {
-    if (eSL_Init(cpSerialDevice, u32BaudRate) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
+    int iShard;
     
-    /* Create the event queue for the control bridge. The queue will not block if space is not available */
-    if (eUtils_QueueCreate(&sZcbEventQueue, 100, UTILS_QUEUE_NONBLOCK_INPUT) != E_UTILS_OK)
+    /* Create the event queue for the control bridges. The queue will not block if space is not available.
+     * Only the main loop takes events from it, so it needn't be locked */
+    if (eUtils_QueueCreate(&sZcbEventQueue, 100, UTILS_QUEUE_NONBLOCK_INPUT | UTILS_QUEUE_SINGLE_CONSUMER) != E_UTILS_OK)
     {
         daemon_log(LOG_ERR, "Error initialising event queue");
         return E_ZCB_ERROR;
     }
     
-    memset(&sZCB_Network, 0, sizeof(sZCB_Network));
-    eUtils_LockCreate(&sZCB_Network.sLock);
-    eUtils_LockCreate(&sZCB_Network.sNodes.sLock);
-    
-    /* Register listeners */
-    eSL_AddListener(E_SL_MSG_NODE_CLUSTER_LIST,         ZCB_HandleNodeClusterList,          NULL);
-    eSL_AddListener(E_SL_MSG_NODE_ATTRIBUTE_LIST,       ZCB_HandleNodeClusterAttributeList, NULL);
-    eSL_AddListener(E_SL_MSG_NODE_COMMAND_ID_LIST,      ZCB_HandleNodeCommandIDList,        NULL);
-    eSL_AddListener(E_SL_MSG_NETWORK_JOINED_FORMED,     ZCB_HandleNetworkJoined,            NULL);
-    eSL_AddListener(E_SL_MSG_DEVICE_ANNOUNCE,           ZCB_HandleDeviceAnnounce,           NULL);
-    eSL_AddListener(E_SL_MSG_LEAVE_INDICATION,          ZCB_HandleDeviceLeave,              NULL);
-    eSL_AddListener(E_SL_MSG_MATCH_DESCRIPTOR_RESPONSE, ZCB_HandleMatchDescriptorResponse,  NULL);
-    eSL_AddListener(E_SL_MSG_RESTART_PROVISIONED,       ZCB_HandleRestartProvisioned,       NULL);
-    eSL_AddListener(E_SL_MSG_RESTART_FACTORY_NEW,       ZCB_HandleRestartFactoryNew,        NULL);
-    eSL_AddListener(E_SL_MSG_ATTRIBUTE_REPORT,          ZCB_HandleAttributeReport,          NULL);
+    for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+    {
+        /* Listeners are added to the link of the selected control bridge, and called with it selected */
+        vZCB_ShardSelect(iShard);
+        
+        if (eSL_Init(iShard, asZCB_Shards[iShard].pcSerialDevice, u32BaudRate) != E_SL_OK)
+        {
+            vZCB_ShardSelect(0);
+            return E_ZCB_COMMS_FAILED;
+        }
+        
+        memset(&sZCB_Network, 0, sizeof(sZCB_Network));
+        eUtils_LockCreateHere(&sZCB_Network.sLock);
+        eUtils_LockCreateHere(&sZCB_Network.sNodes.sLock);
+        sZCB_Network.sNodes.u8Shard = iShard;
+        
+        /* Register listeners */
+        eSL_AddListener(E_SL_MSG_NODE_CLUSTER_LIST,         ZCB_HandleNodeClusterList,          NULL);
+        eSL_AddListener(E_SL_MSG_NODE_ATTRIBUTE_LIST,       ZCB_HandleNodeClusterAttributeList, NULL);
+        eSL_AddListener(E_SL_MSG_NODE_COMMAND_ID_LIST,      ZCB_HandleNodeCommandIDList,        NULL);
+        eSL_AddListener(E_SL_MSG_NETWORK_JOINED_FORMED,     ZCB_HandleNetworkJoined,            NULL);
+        eSL_AddListener(E_SL_MSG_DEVICE_ANNOUNCE,           ZCB_HandleDeviceAnnounce,           NULL);
+        eSL_AddListener(E_SL_MSG_LEAVE_INDICATION,          ZCB_HandleDeviceLeave,              NULL);
+        eSL_AddListener(E_SL_MSG_MATCH_DESCRIPTOR_RESPONSE, ZCB_HandleMatchDescriptorResponse,  NULL);
+        eSL_AddListener(E_SL_MSG_IEEE_ADDRESS_RESPONSE,     ZCB_HandleIEEEAddressResponse,      NULL);
+        eSL_AddListener(E_SL_MSG_NODE_DESCRIPTOR_RESPONSE,  ZCB_HandleNodeDescriptorResponse,   NULL);
+        eSL_AddListener(E_SL_MSG_SIMPLE_DESCRIPTOR_RESPONSE,ZCB_HandleSimpleDescriptorResponse, NULL);
+        eSL_AddListener(E_SL_MSG_ADD_GROUP_RESPONSE,        ZCB_HandleAddGroupResponse,         NULL);
+        eSL_AddListener(E_SL_MSG_RESTART_PROVISIONED,       ZCB_HandleRestartProvisioned,       NULL);
+        eSL_AddListener(E_SL_MSG_RESTART_FACTORY_NEW,       ZCB_HandleRestartFactoryNew,        NULL);
+        eSL_AddListener(E_SL_MSG_ATTRIBUTE_REPORT,          ZCB_HandleAttributeReport,          NULL);
+    }
+    vZCB_ShardSelect(0);
    
-    // Get the PDM going so that the node can get the information it needs.
+    // Get the PDM going so that the nodes can get the information they need.
     ePDM_Init(pcPDMFile);
 
     return E_ZCB_OK;
@@ -168,25 +196,133 @@ teZcbStatus eZCB_Init(char *cpSerialDevice, uint32_t u32BaudRate, char *pcPDMFil
 
 teZcbStatus eZCB_Finish(void)
 {
+    int iShard;
+    
+    /* The PDM is closed first, so removing the nodes below leaves them in the interview cache */
     ePDM_Destory();
-    eSL_Destroy();
+    
+    for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+    {
+        vZCB_ShardSelect(iShard);
+        eSL_Destroy();
+    }
     
     if (eUtils_QueueDestroy(&sZcbEventQueue) != E_UTILS_OK)
     {
         daemon_log(LOG_ERR, "Error destroying event queue");
     }
     
-    while (sZCB_Network.sNodes.psNext)
+    for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+    {
+        vZCB_ShardSelect(iShard);
+        while (sZCB_Network.sNodes.psNext)
+        {
+            eZCB_RemoveNode(sZCB_Network.sNodes.psNext);
+        }
+        eZCB_RemoveNode(&sZCB_Network.sNodes);
+        eUtils_LockDestroy(&sZCB_Network.sLock);
+    }
+    vZCB_ShardSelect(0);
+    
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_TraceWrite(FILE *psStream)
+{
+    if (eSL_TraceWrite(psStream) != E_SL_OK)
+    {
+        return E_ZCB_ERROR;
+    }
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_CaptureStart(const char *pcPath)
+{
+    if (eSL_CaptureStart(pcPath) != E_SL_OK)
+    {
+        return E_ZCB_ERROR;
+    }
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_CaptureStop(void)
+{
+    if (eSL_CaptureStop() != E_SL_OK)
+    {
+        return E_ZCB_ERROR;
+    }
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_StatsDump(FILE *psStream)
+{
+    tsUtilsHistogramSummary sSummary;
+    int iSelected = iZCB_ShardSelected();
+    int iShard;
+    
+    for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+    {
+        vZCB_ShardSelect(iShard);
+        eSL_StatsDump(psStream);
+    }
+    vZCB_ShardSelect(iSelected);
+    
+    fprintf(psStream, "# Event queue\n");
+    fprintf(psStream, "%-40s %10u\n", "Events queued",             sZcbEventStats.u32Queued);
+    fprintf(psStream, "%-40s %10u\n", "Events refused, queue full",sZcbEventStats.u32Refused);
+    fprintf(psStream, "%-40s %10u\n", "Event queue depth",         sZcbEventStats.u32Depth);
+    fprintf(psStream, "%-40s %10u\n", "Event queue max depth",     sZcbEventStats.u32MaxDepth);
+    
+    vUtils_HistogramSummarise(&sZcbEventStats.sWait, &sSummary);
+    fprintf(psStream, "# Event queue latencies (us)\n");
+    fprintf(psStream, "%-40s %10s %10s %10s %10s %10s %10s\n", "Queue", "Count", "Mean", "P50", "P90", "P99", "Max");
+    fprintf(psStream, "%-40s %10u %10u %10u %10u %10u %10u\n", "Event queue wait",
+            sSummary.u32Count, sSummary.u32Mean, sSummary.u32P50, sSummary.u32P90, sSummary.u32P99, sSummary.u32Max);
+    
+    vZCB_DeliveryStatsDump(psStream);
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_QueueEvent(tsZcbEvent *psEvent)
+{
+    uint32_t u32Depth;
+    
+    psEvent->u64Queued = u64Utils_LatencyNow();
+    psEvent->u8Shard   = iZCB_ShardSelected();
+    
+    /* Count the event in before the main loop can count it out */
+    u32Depth = __sync_add_and_fetch(&sZcbEventStats.u32Depth, 1);
+    if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
     {
-        eZCB_RemoveNode(sZCB_Network.sNodes.psNext);
+        __sync_sub_and_fetch(&sZcbEventStats.u32Depth, 1);
+        __sync_add_and_fetch(&sZcbEventStats.u32Refused, 1);
+        return E_ZCB_ERROR;
     }
-    eZCB_RemoveNode(&sZCB_Network.sNodes);
-    eUtils_LockDestroy(&sZCB_Network.sLock);
     
+    __sync_add_and_fetch(&sZcbEventStats.u32Queued, 1);
+    if (u32Depth > sZcbEventStats.u32MaxDepth)
+    {
+        sZcbEventStats.u32MaxDepth = u32Depth;
+    }
     return E_ZCB_OK;
 }
 
 
+void vZCB_EventDequeued(tsZcbEvent *psEvent)
+{
+    __sync_sub_and_fetch(&sZcbEventStats.u32Depth, 1);
+    vUtils_HistogramRecord(&sZcbEventStats.sWait, u64Utils_LatencyNow() - psEvent->u64Queued);
+    
+    /* The event is handled for the control bridge it came from */
+    vZCB_ShardSelect(psEvent->u8Shard);
+}
+
+
 teZcbStatus eZCB_EstablishComms(void)
 {
     if (eSL_SendMessage(E_SL_MSG_GET_VERSION, 0, NULL, NULL) == E_SL_OK)
@@ -197,8 +333,11 @@ teZcbStatus eZCB_EstablishComms(void)
         /* Wait 300ms for the versions message to arrive */
         if (eSL_MessageWait(E_SL_MSG_VERSION_LIST, 300, &u16Length, (void**)&u32Version) == E_SL_OK)
         {
-            u32ZCB_SoftwareVersion = ntohl(*u32Version);
-            daemon_log(LOG_INFO, "Connected to control bridge version 0x%08x", u32ZCB_SoftwareVersion);
+            tsZCB_Shard *psShard = &asZCB_Shards[iZCB_ShardSelected()];
+            
+            psShard->u32SoftwareVersion = ntohl(*u32Version);
+            daemon_log(LOG_INFO, "Connected to control bridge %d (%s) version 0x%08x", 
+                       iZCB_ShardSelected(), psShard->pcSerialDevice, psShard->u32SoftwareVersion);
             free(u32Version);
             
             DBG_vPrintf(DBG_ZCB, "Reset control bridge\n");
@@ -576,6 +715,8 @@ teZcbStatus eZCB_LeaveRequest(tsZCB_Node *psZCBNode)
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
     
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    
     DBG_vPrintf(DBG_ZCB, "\n\n\nRequesting node 0x%04X to leave network\n", psZCBNode->u16ShortAddress);
     
     sManagementLeaveRequest.u16TargetAddress    = htons(psZCBNode->u16ShortAddress);
@@ -658,6 +799,8 @@ teZcbStatus eZCB_NeighbourTableRequest(tsZCB_Node *psZCBNode)
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
     int i;
     
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    
     u16ShortAddress = psZCBNode->u16ShortAddress;
     
     /* Unlock the node during this process, because it can take time, and we don't want to be holding a node lock when 
@@ -737,6 +880,13 @@ teZcbStatus eZCB_NeighbourTableRequest(tsZCB_Node *psZCBNode)
         
         if (psZCBNode)
         {
+            /* The control bridge's own table gives the node's link to it. Otherwise
+             * keep the best link the node has to any of its neighbours */
+            if ((u16ShortAddress == 0x0000) ||
+                (psManagementLQIResponse->asNeighbours[i].u8LQI > psZCBNode->sComms.u8LQI))
+            {
+                psZCBNode->sComms.u8LQI = psManagementLQIResponse->asNeighbours[i].u8LQI;
+            }
             eUtils_LockUnlock(&psZCBNode->sLock);
         }
         else
@@ -763,7 +913,7 @@ teZcbStatus eZCB_NeighbourTableRequest(tsZCB_Node *psZCBNode)
         psEvent->eEvent                                 = E_ZCB_EVENT_DEVICE_ANNOUNCE;
         psEvent->uData.sDeviceAnnounce.u16ShortAddress  = psManagementLQIResponse->asNeighbours[i].u16ShortAddress;
         
-        if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
+        if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
         {
             DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
             free(psEvent);
@@ -794,7 +944,7 @@ done:
 }
 
 
-teZcbStatus eZCB_IEEEAddressRequest(tsZCB_Node *psZCBNode)
+teZcbStatus eZCB_SendIEEEAddressRequest(tsZCB_Node *psZCBNode, uint8_t *pu8SequenceNo)
 {
     struct _IEEEAddressRequest
     {
@@ -804,6 +954,69 @@ teZcbStatus eZCB_IEEEAddressRequest(tsZCB_Node *psZCBNode)
         uint8_t     u8StartIndex;
     } __attribute__((__packed__)) sIEEEAddressRequest;
     
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    
+    DBG_vPrintf(DBG_ZCB, "Send IEEE Address request to 0x%04X\n", psZCBNode->u16ShortAddress);
+    
+    sIEEEAddressRequest.u16TargetAddress    = htons(psZCBNode->u16ShortAddress);
+    sIEEEAddressRequest.u16ShortAddress     = htons(psZCBNode->u16ShortAddress);
+    sIEEEAddressRequest.u8RequestType       = 0;
+    sIEEEAddressRequest.u8StartIndex        = 0;
+    
+    if (eSL_SendMessage(E_SL_MSG_IEEE_ADDRESS_REQUEST, sizeof(struct _IEEEAddressRequest), &sIEEEAddressRequest, pu8SequenceNo) != E_SL_OK)
+    {
+        return E_ZCB_COMMS_FAILED;
+    }
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_SendNodeDescriptorRequest(tsZCB_Node *psZCBNode, uint8_t *pu8SequenceNo)
+{
+    struct _NodeDescriptorRequest
+    {
+        uint16_t    u16TargetAddress;
+    } __attribute__((__packed__)) sNodeDescriptorRequest;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    
+    DBG_vPrintf(DBG_ZCB, "Send Node Descriptor request to 0x%04X\n", psZCBNode->u16ShortAddress);
+    
+    sNodeDescriptorRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
+    
+    if (eSL_SendMessage(E_SL_MSG_NODE_DESCRIPTOR_REQUEST, sizeof(struct _NodeDescriptorRequest), &sNodeDescriptorRequest, pu8SequenceNo) != E_SL_OK)
+    {
+        return E_ZCB_COMMS_FAILED;
+    }
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_SendSimpleDescriptorRequest(tsZCB_Node *psZCBNode, uint8_t u8Endpoint, uint8_t *pu8SequenceNo)
+{
+    struct _SimpleDescriptorRequest
+    {
+        uint16_t    u16TargetAddress;
+        uint8_t     u8Endpoint;
+    } __attribute__((__packed__)) sSimpleDescriptorRequest;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    
+    DBG_vPrintf(DBG_ZCB, "Send Simple Desciptor request for Endpoint %d to 0x%04X\n", u8Endpoint, psZCBNode->u16ShortAddress);
+    
+    sSimpleDescriptorRequest.u16TargetAddress       = htons(psZCBNode->u16ShortAddress);
+    sSimpleDescriptorRequest.u8Endpoint             = u8Endpoint;
+    
+    if (eSL_SendMessage(E_SL_MSG_SIMPLE_DESCRIPTOR_REQUEST, sizeof(struct _SimpleDescriptorRequest), &sSimpleDescriptorRequest, pu8SequenceNo) != E_SL_OK)
+    {
+        return E_ZCB_COMMS_FAILED;
+    }
+    return E_ZCB_OK;
+}
+
+
+teZcbStatus eZCB_IEEEAddressRequest(tsZCB_Node *psZCBNode)
+{
     struct _IEEEAddressResponse
     {
         uint8_t     u8SequenceNo;
@@ -819,14 +1032,7 @@ teZcbStatus eZCB_IEEEAddressRequest(tsZCB_Node *psZCBNode)
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
     
-    DBG_vPrintf(DBG_ZCB, "Send IEEE Address request to 0x%04X\n", psZCBNode->u16ShortAddress);
-    
-    sIEEEAddressRequest.u16TargetAddress    = htons(psZCBNode->u16ShortAddress);
-    sIEEEAddressRequest.u16ShortAddress     = htons(psZCBNode->u16ShortAddress);
-    sIEEEAddressRequest.u8RequestType       = 0;
-    sIEEEAddressRequest.u8StartIndex        = 0;
-    
-    if (eSL_SendMessage(E_SL_MSG_IEEE_ADDRESS_REQUEST, sizeof(struct _IEEEAddressRequest), &sIEEEAddressRequest, &u8SequenceNo) != E_SL_OK)
+    if (eZCB_SendIEEEAddressRequest(psZCBNode, &u8SequenceNo) != E_ZCB_OK)
     {
         goto done;
     }
@@ -867,11 +1073,6 @@ done:
 
 teZcbStatus eZCB_NodeDescriptorRequest(tsZCB_Node *psZCBNode)
 {
-    struct _NodeDescriptorRequest
-    {
-        uint16_t    u16TargetAddress;
-    } __attribute__((__packed__)) sNodeDescriptorRequest;
-    
     struct _tNodeDescriptorResponse
     {
         uint8_t     u8SequenceNo;
@@ -891,11 +1092,7 @@ teZcbStatus eZCB_NodeDescriptorRequest(tsZCB_Node *psZCBNode)
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
     
-    DBG_vPrintf(DBG_ZCB, "Send Node Descriptor request to 0x%04X\n", psZCBNode->u16ShortAddress);
-    
-    sNodeDescriptorRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
-    
-    if (eSL_SendMessage(E_SL_MSG_NODE_DESCRIPTOR_REQUEST, sizeof(struct _NodeDescriptorRequest), &sNodeDescriptorRequest, &u8SequenceNo) != E_SL_OK)
+    if (eZCB_SendNodeDescriptorRequest(psZCBNode, &u8SequenceNo) != E_ZCB_OK)
     {
         goto done;
     }
@@ -937,12 +1134,6 @@ done:
 
 teZcbStatus eZCB_SimpleDescriptorRequest(tsZCB_Node *psZCBNode, uint8_t u8Endpoint)
 {
-    struct _SimpleDescriptorRequest
-    {
-        uint16_t    u16TargetAddress;
-        uint8_t     u8Endpoint;
-    } __attribute__((__packed__)) sSimpleDescriptorRequest;
-    
     struct _tSimpleDescriptorResponse
     {
         uint8_t     u8SequenceNo;
@@ -964,12 +1155,7 @@ teZcbStatus eZCB_SimpleDescriptorRequest(tsZCB_Node *psZCBNode, uint8_t u8Endpoi
     int iPosition, i;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
     
-    DBG_vPrintf(DBG_ZCB, "Send Simple Desciptor request for Endpoint %d to 0x%04X\n", u8Endpoint, psZCBNode->u16ShortAddress);
-    
-    sSimpleDescriptorRequest.u16TargetAddress       = htons(psZCBNode->u16ShortAddress);
-    sSimpleDescriptorRequest.u8Endpoint             = u8Endpoint;
-    
-    if (eSL_SendMessage(E_SL_MSG_SIMPLE_DESCRIPTOR_REQUEST, sizeof(struct _SimpleDescriptorRequest), &sSimpleDescriptorRequest, &u8SequenceNo) != E_SL_OK)
+    if (eZCB_SendSimpleDescriptorRequest(psZCBNode, u8Endpoint, &u8SequenceNo) != E_ZCB_OK)
     {
         goto done;
     }
@@ -1080,17 +1266,14 @@ teZcbStatus eZCB_ReadAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16Cluster
     uint16_t u16Length;
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
     
     DBG_vPrintf(DBG_ZCB, "Send Read Attribute request to 0x%04X\n", psZCBNode->u16ShortAddress);
     
-    if (bZCB_EnableAPSAck)
-    {
-        sReadAttributeRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-    }
-    else
-    {
-        sReadAttributeRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-    }
+    vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_QUERY, &sPolicy);
+    sReadAttributeRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
     sReadAttributeRequest.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
     
     if ((eStatus = eZCB_GetEndpoints(psZCBNode, u16ClusterID, &sReadAttributeRequest.u8SourceEndpoint, &sReadAttributeRequest.u8DestinationEndpoint)) != E_ZCB_OK)
@@ -1112,8 +1295,8 @@ teZcbStatus eZCB_ReadAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16Cluster
     
     while (1)
     {
-        /* Wait 1 second for the message to arrive */
-        if (eSL_MessageWait(E_SL_MSG_READ_ATTRIBUTE_RESPONSE, 1000, &u16Length, (void**)&psReadAttributeResponseAddressed) != E_SL_OK)
+        /* Wait for the message to arrive as long as the node's delivery policy allows */
+        if (eSL_MessageWait(E_SL_MSG_READ_ATTRIBUTE_RESPONSE, sPolicy.u16TimeoutMs, &u16Length, (void**)&psReadAttributeResponseAddressed) != E_SL_OK)
         {
             if (verbosity > LOG_INFO)
             {
@@ -1306,17 +1489,14 @@ teZcbStatus eZCB_WriteAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16Cluste
     uint16_t u16Length = sizeof(struct _WriteAttributeRequest) - sizeof(sWriteAttributeRequest.uData);
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
     
     DBG_vPrintf(DBG_ZCB, "Send Write Attribute request to 0x%04X\n", psZCBNode->u16ShortAddress);
     
-    if (bZCB_EnableAPSAck)
-    {
-        sWriteAttributeRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-    }
-    else
-    {
-        sWriteAttributeRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-    }
+    vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONFIGURE, &sPolicy);
+    sWriteAttributeRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
     sWriteAttributeRequest.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
     
     if ((eStatus = eZCB_GetEndpoints(psZCBNode, u16ClusterID, &sWriteAttributeRequest.u8SourceEndpoint, &sWriteAttributeRequest.u8DestinationEndpoint)) != E_ZCB_OK)
@@ -1392,9 +1572,9 @@ teZcbStatus eZCB_WriteAttributeRequest(tsZCB_Node *psZCBNode, uint16_t u16Cluste
     
     while (1)
     {
-        /* Wait 1 second for the message to arrive */
+        /* Wait for the message to arrive as long as the node's delivery policy allows */
         /**\todo handle data indication here for now - BAD Idea! Implement a general case handler in future! */
-        if (eSL_MessageWait(E_SL_MSG_DATA_INDICATION, 1000, &u16Length, (void**)&psDataIndication) != E_SL_OK)
+        if (eSL_MessageWait(E_SL_MSG_DATA_INDICATION, sPolicy.u16TimeoutMs, &u16Length, (void**)&psDataIndication) != E_SL_OK)
         {
             if (verbosity > LOG_INFO)
             {
@@ -1429,7 +1609,7 @@ done:
 }
 
 
-teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo)
+teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo, uint32_t u32TimeoutMs)
 {
     uint16_t u16Length;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
@@ -1438,8 +1618,8 @@ teZcbStatus eZCB_GetDefaultResponse(uint8_t u8SequenceNo)
 
     while (1)
     {
-        /* Wait 1 second for a default response message to arrive */
-        if (eSL_MessageWait(E_SL_MSG_DEFAULT_RESPONSE, 1000, &u16Length, (void**)&psDefaultResponse) != E_SL_OK)
+        /* Wait for a default response message to arrive */
+        if (eSL_MessageWait(E_SL_MSG_DEFAULT_RESPONSE, u32TimeoutMs, &u16Length, (void**)&psDefaultResponse) != E_SL_OK)
         {
             daemon_log(LOG_ERR, "No response to command sequence number %d received", u8SequenceNo);
             goto done;
@@ -1464,17 +1644,16 @@ done:
 }
 
 
-teZcbStatus eZCB_AddGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress)
+teZcbStatus eZCB_SendAddGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t *pu8SequenceNo)
 {
-    struct _AddGroupMembershipRequest
-    {
-        uint8_t     u8TargetAddressMode;
-        uint16_t    u16TargetAddress;
-        uint8_t     u8SourceEndpoint;
-        uint8_t     u8DestinationEndpoint;
-        uint16_t    u16GroupAddress;
-    } __attribute__((__packed__)) sAddGroupMembershipRequest;
+    tsZcbDeliveryPolicy sPolicy;
     
+    return eZCB_SendAddGroupMembershipPolicy(psZCBNode, u16GroupAddress, pu8SequenceNo, &sPolicy);
+}
+
+
+teZcbStatus eZCB_AddGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress)
+{
     struct _sAddGroupMembershipResponse
     {
         uint8_t     u8SequenceNo;
@@ -1486,36 +1665,24 @@ teZcbStatus eZCB_AddGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
     
     uint16_t u16Length;
     uint8_t u8SequenceNo;
-    teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
-    
-    DBG_vPrintf(DBG_ZCB, "Send add group membership 0x%04X request to 0x%04X\n", u16GroupAddress, psZCBNode->u16ShortAddress);
+    teZcbStatus eStatus;
+    tsZcbDeliveryPolicy sPolicy;
     
-    if (bZCB_EnableAPSAck)
+    eStatus = eZCB_SendAddGroupMembershipPolicy(psZCBNode, u16GroupAddress, &u8SequenceNo, &sPolicy);
+    if (eStatus == E_ZCB_COMMS_FAILED)
     {
-        sAddGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-    }
-    else
-    {
-        sAddGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
+        goto done;
     }
-    sAddGroupMembershipRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
-    
-    if ((eStatus = eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_GROUPS, &sAddGroupMembershipRequest.u8SourceEndpoint, &sAddGroupMembershipRequest.u8DestinationEndpoint)) != E_ZCB_OK)
+    else if (eStatus != E_ZCB_OK)
     {
         return eStatus;
     }
-    
-    sAddGroupMembershipRequest.u16GroupAddress = htons(u16GroupAddress);
-
-    if (eSL_SendMessage(E_SL_MSG_ADD_GROUP_REQUEST, sizeof(struct _AddGroupMembershipRequest), &sAddGroupMembershipRequest, &u8SequenceNo) != E_SL_OK)
-    {
-        goto done;
-    }
+    eStatus = E_ZCB_COMMS_FAILED;
     
     while (1)
     {
-        /* Wait 1 second for the add group response message to arrive */
-        if (eSL_MessageWait(E_SL_MSG_ADD_GROUP_RESPONSE, 1000, &u16Length, (void**)&psAddGroupMembershipResponse) != E_SL_OK)
+        /* Wait for the add group response message to arrive as long as the node's delivery policy allows */
+        if (eSL_MessageWait(E_SL_MSG_ADD_GROUP_RESPONSE, sPolicy.u16TimeoutMs, &u16Length, (void**)&psAddGroupMembershipResponse) != E_SL_OK)
         {
             daemon_log(LOG_ERR, "No response to add group membership request");
             goto done;
@@ -1568,17 +1735,14 @@ teZcbStatus eZCB_RemoveGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupA
     uint16_t u16Length;
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
     
     DBG_vPrintf(DBG_ZCB, "Send remove group membership 0x%04X request to 0x%04X\n", u16GroupAddress, psZCBNode->u16ShortAddress);
     
-    if (bZCB_EnableAPSAck)
-    {
-        sRemoveGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-    }
-    else
-    {
-        sRemoveGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-    }
+    vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONFIGURE, &sPolicy);
+    sRemoveGroupMembershipRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
     sRemoveGroupMembershipRequest.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
     
     if (eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_GROUPS, &sRemoveGroupMembershipRequest.u8SourceEndpoint, &sRemoveGroupMembershipRequest.u8DestinationEndpoint) != E_ZCB_OK)
@@ -1595,8 +1759,8 @@ teZcbStatus eZCB_RemoveGroupMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupA
     
     while (1)
     {
-        /* Wait 1 second for the remove group response message to arrive */
-        if (eSL_MessageWait(E_SL_MSG_REMOVE_GROUP_RESPONSE, 1000, &u16Length, (void**)&psRemoveGroupMembershipResponse) != E_SL_OK)
+        /* Wait for the remove group response message to arrive as long as the node's delivery policy allows */
+        if (eSL_MessageWait(E_SL_MSG_REMOVE_GROUP_RESPONSE, sPolicy.u16TimeoutMs, &u16Length, (void**)&psRemoveGroupMembershipResponse) != E_SL_OK)
         {
             daemon_log(LOG_ERR, "No response to remove group membership request");
             goto done;
@@ -1651,18 +1815,15 @@ teZcbStatus eZCB_GetGroupMembership(tsZCB_Node *psZCBNode)
     uint16_t u16Length;
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
     int i;
     
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    
     DBG_vPrintf(DBG_ZCB, "Send get group membership request to 0x%04X\n", psZCBNode->u16ShortAddress);
     
-    if (bZCB_EnableAPSAck)
-    {
-        sGetGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-    }
-    else
-    {
-        sGetGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-    }
+    vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_QUERY, &sPolicy);
+    sGetGroupMembershipRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
     sGetGroupMembershipRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
     
     if (eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_GROUPS, &sGetGroupMembershipRequest.u8SourceEndpoint, &sGetGroupMembershipRequest.u8DestinationEndpoint) != E_ZCB_OK)
@@ -1679,8 +1840,8 @@ teZcbStatus eZCB_GetGroupMembership(tsZCB_Node *psZCBNode)
     
     while (1)
     {
-        /* Wait 1 second for the descriptor message to arrive */
-        if (eSL_MessageWait(E_SL_MSG_GET_GROUP_MEMBERSHIP_RESPONSE, 1000, &u16Length, (void**)&psGetGroupMembershipResponse) != E_SL_OK)
+        /* Wait for the descriptor message to arrive as long as the node's delivery policy allows */
+        if (eSL_MessageWait(E_SL_MSG_GET_GROUP_MEMBERSHIP_RESPONSE, sPolicy.u16TimeoutMs, &u16Length, (void**)&psGetGroupMembershipResponse) != E_SL_OK)
         {
             daemon_log(LOG_ERR, "No response to group membership request");
             goto done;
@@ -1718,6 +1879,7 @@ teZcbStatus eZCB_GetGroupMembership(tsZCB_Node *psZCBNode)
         }
     }
     eStatus = E_ZCB_OK;
+    (void)ePDM_InterviewSave(psZCBNode);
 done:
     vZCB_NodeUpdateComms(psZCBNode, eStatus);
     free(psGetGroupMembershipResponse);
@@ -1736,17 +1898,14 @@ teZcbStatus eZCB_ClearGroupMembership(tsZCB_Node *psZCBNode)
     } __attribute__((__packed__)) sClearGroupMembershipRequest;
     
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
     
     DBG_vPrintf(DBG_ZCB, "Send clear group membership request to 0x%04X\n", psZCBNode->u16ShortAddress);
     
-    if (bZCB_EnableAPSAck)
-    {
-        sClearGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-    }
-    else
-    {
-        sClearGroupMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-    }
+    vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONFIGURE, &sPolicy);
+    sClearGroupMembershipRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
     sClearGroupMembershipRequest.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
     
     if (eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_GROUPS, &sClearGroupMembershipRequest.u8SourceEndpoint, &sClearGroupMembershipRequest.u8DestinationEndpoint) != E_ZCB_OK)
@@ -1790,20 +1949,16 @@ teZcbStatus eZCB_RemoveScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
     uint16_t u16Length;
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
 
     DBG_vPrintf(DBG_ZCB, "Send remove scene %d (Group 0x%04X) for Endpoint %d to 0x%04X\n", 
                 u8SceneID, u16GroupAddress, sRemoveSceneRequest.u8DestinationEndpoint, psZCBNode->u16ShortAddress);
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sRemoveSceneRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sRemoveSceneRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONFIGURE, &sPolicy);
+        sRemoveSceneRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sRemoveSceneRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
         
         if (eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_SCENES, &sRemoveSceneRequest.u8SourceEndpoint, &sRemoveSceneRequest.u8DestinationEndpoint) != E_ZCB_OK)
@@ -1825,6 +1980,11 @@ teZcbStatus eZCB_RemoveScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
     
     sRemoveSceneRequest.u16GroupAddress  = htons(u16GroupAddress);
     sRemoveSceneRequest.u8SceneID        = u8SceneID;
+    
+    if (!psZCBNode)
+    {
+        return eZCB_SendGroupMessage(E_SL_MSG_REMOVE_SCENE, sizeof(struct _RemoveSceneRequest), &sRemoveSceneRequest);
+    }
 
     if (eSL_SendMessage(E_SL_MSG_REMOVE_SCENE, sizeof(struct _RemoveSceneRequest), &sRemoveSceneRequest, &u8SequenceNo) != E_SL_OK)
     {
@@ -1833,8 +1993,8 @@ teZcbStatus eZCB_RemoveScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
     
     while (1)
     {
-        /* Wait 1 second for the descriptor message to arrive */
-        if (eSL_MessageWait(E_SL_MSG_REMOVE_SCENE_RESPONSE, 1000, &u16Length, (void**)&psRemoveSceneResponse) != E_SL_OK)
+        /* Wait for the descriptor message to arrive as long as the node's delivery policy allows */
+        if (eSL_MessageWait(E_SL_MSG_REMOVE_SCENE_RESPONSE, sPolicy.u16TimeoutMs, &u16Length, (void**)&psRemoveSceneResponse) != E_SL_OK)
         {
             daemon_log(LOG_ERR, "No response to remove scene request");
             goto done;
@@ -1889,20 +2049,16 @@ teZcbStatus eZCB_StoreScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uin
     uint16_t u16Length;
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
 
     DBG_vPrintf(DBG_ZCB, "Send store scene %d (Group 0x%04X)\n", 
                 u8SceneID, u16GroupAddress);
     
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sStoreSceneRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sStoreSceneRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONFIGURE, &sPolicy);
+        sStoreSceneRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sStoreSceneRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
         
         if (eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_SCENES, &sStoreSceneRequest.u8SourceEndpoint, &sStoreSceneRequest.u8DestinationEndpoint) != E_ZCB_OK)
@@ -1924,6 +2080,11 @@ teZcbStatus eZCB_StoreScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uin
     
     sStoreSceneRequest.u16GroupAddress  = htons(u16GroupAddress);
     sStoreSceneRequest.u8SceneID        = u8SceneID;
+    
+    if (!psZCBNode)
+    {
+        return eZCB_SendGroupMessage(E_SL_MSG_STORE_SCENE, sizeof(struct _StoreSceneRequest), &sStoreSceneRequest);
+    }
 
     if (eSL_SendMessage(E_SL_MSG_STORE_SCENE, sizeof(struct _StoreSceneRequest), &sStoreSceneRequest, &u8SequenceNo) != E_SL_OK)
     {
@@ -1932,8 +2093,8 @@ teZcbStatus eZCB_StoreScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uin
     
     while (1)
     {
-        /* Wait 1 second for the descriptor message to arrive */
-        if (eSL_MessageWait(E_SL_MSG_STORE_SCENE_RESPONSE, 1000, &u16Length, (void**)&psStoreSceneResponse) != E_SL_OK)
+        /* Wait for the descriptor message to arrive as long as the node's delivery policy allows */
+        if (eSL_MessageWait(E_SL_MSG_STORE_SCENE_RESPONSE, sPolicy.u16TimeoutMs, &u16Length, (void**)&psStoreSceneResponse) != E_SL_OK)
         {
             daemon_log(LOG_ERR, "No response to store scene request");
             goto done;
@@ -1966,6 +2127,7 @@ done:
 teZcbStatus eZCB_RecallScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t u8SceneID)
 {
     uint8_t         u8SequenceNo;
+    uint8_t         u8Attempts = 0;
     struct _RecallSceneRequest
     {
         uint8_t     u8TargetAddressMode;
@@ -1977,20 +2139,16 @@ teZcbStatus eZCB_RecallScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
     } __attribute__((__packed__)) sRecallSceneRequest;
 
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
     
     if (psZCBNode)
     {
         DBG_vPrintf(DBG_ZCB, "Send recall scene %d (Group 0x%04X) to 0x%04X\n", 
                 u8SceneID, u16GroupAddress, psZCBNode->u16ShortAddress);
         
-        if (bZCB_EnableAPSAck)
-        {
-            sRecallSceneRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sRecallSceneRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sRecallSceneRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sRecallSceneRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
         
         if (eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_SCENES, &sRecallSceneRequest.u8SourceEndpoint, &sRecallSceneRequest.u8DestinationEndpoint) != E_ZCB_OK)
@@ -2016,19 +2174,23 @@ teZcbStatus eZCB_RecallScene(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
     sRecallSceneRequest.u16GroupAddress  = htons(u16GroupAddress);
     sRecallSceneRequest.u8SceneID        = u8SceneID;
     
-    if (eSL_SendMessage(E_SL_MSG_RECALL_SCENE, sizeof(struct _RecallSceneRequest), &sRecallSceneRequest, &u8SequenceNo) != E_SL_OK)
+    if (!psZCBNode)
     {
-        goto done;
+        return eZCB_SendGroupMessage(E_SL_MSG_RECALL_SCENE, sizeof(struct _RecallSceneRequest), &sRecallSceneRequest);
     }
     
-    if (psZCBNode)
-    {
-        eStatus = eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
+    do
     {
-        eStatus = E_ZCB_OK;
-    }
+        if (eSL_SendMessage(E_SL_MSG_RECALL_SCENE, sizeof(struct _RecallSceneRequest), &sRecallSceneRequest, &u8SequenceNo) != E_SL_OK)
+        {
+            goto done;
+        }
+        
+        eStatus = eZCB_GetDefaultResponse(u8SequenceNo, sPolicy.u16TimeoutMs);
+        u8Attempts++;
+    } while ((eStatus == E_ZCB_COMMS_FAILED) && (u8Attempts <= sPolicy.u8Retries));
+    
+    vZCB_NodeDeliveryRecord(psZCBNode, &sPolicy, u8Attempts, eStatus);
 done:
     return eStatus;
 }
@@ -2060,18 +2222,15 @@ teZcbStatus eZCB_GetSceneMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
     uint16_t u16Length;
     uint8_t u8SequenceNo;
     teZcbStatus eStatus = E_ZCB_COMMS_FAILED;
+    tsZcbDeliveryPolicy sPolicy;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
     
     DBG_vPrintf(DBG_ZCB, "Send get scene membership for group 0x%04X to 0x%04X\n", 
                 u16GroupAddress, psZCBNode->u16ShortAddress);
     
-    if (bZCB_EnableAPSAck)
-    {
-        sGetSceneMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-    }
-    else
-    {
-        sGetSceneMembershipRequest.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-    }
+    vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_QUERY, &sPolicy);
+    sGetSceneMembershipRequest.u8TargetAddressMode   = sPolicy.u8AddressMode;
     sGetSceneMembershipRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
     
     if (eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_SCENES, &sGetSceneMembershipRequest.u8SourceEndpoint, &sGetSceneMembershipRequest.u8DestinationEndpoint) != E_ZCB_OK)
@@ -2088,8 +2247,8 @@ teZcbStatus eZCB_GetSceneMembership(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
     
     while (1)
     {
-        /* Wait 1 second for the response to arrive */
-        if (eSL_MessageWait(E_SL_MSG_SCENE_MEMBERSHIP_RESPONSE, 1000, &u16Length, (void**)&psGetSceneMembershipResponse) != E_SL_OK)
+        /* Wait for the response to arrive as long as the node's delivery policy allows */
+        if (eSL_MessageWait(E_SL_MSG_SCENE_MEMBERSHIP_RESPONSE, sPolicy.u16TimeoutMs, &u16Length, (void**)&psGetSceneMembershipResponse) != E_SL_OK)
         {
             daemon_log(LOG_ERR, "No response to get scene membership request");
             goto done;
@@ -2360,10 +2519,10 @@ static void ZCB_HandleNetworkJoined(void *pvUser, uint16_t u16Length, void *pvMe
                 psMessageExt->u16PanID,
                 (unsigned long long int)psMessageExt->u64PanID);
         
-        /* Update global network information */
-        eChannelInUse = psMessageExt->u8Channel;
-        u64PanIDInUse = psMessageExt->u64PanID;
-        u16PanIDInUse = psMessageExt->u16PanID;
+        /* Update the control bridge's network information */
+        asZCB_Shards[iZCB_ShardSelected()].eChannelInUse = psMessageExt->u8Channel;
+        asZCB_Shards[iZCB_ShardSelected()].u64PanIDInUse = psMessageExt->u64PanID;
+        asZCB_Shards[iZCB_ShardSelected()].u16PanIDInUse = psMessageExt->u16PanID;
     }
     else
     {
@@ -2398,12 +2557,42 @@ static void ZCB_HandleNetworkJoined(void *pvUser, uint16_t u16Length, void *pvMe
     psEvent->eEvent = (psMessageShort->u8Status == 0 ? E_ZCB_EVENT_NETWORK_JOINED : E_ZCB_EVENT_NETWORK_FORMED);
  
     eUtils_LockUnlock(&sZCB_Network.sNodes.sLock);
-    if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
+    if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
     {
         DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
         free(psEvent);
     }
     
+    if (psMessageShort->u8Status == 0)
+    {
+        /* The network was restored by the control bridge, so are the nodes that were interviewed
+         * in it. They are checked as the device comms check reaches them, rather than interviewed again */
+        uint32_t u32NumNodes;
+        uint16_t *pau16ShortAddresses;
+        
+        if ((ePDM_InterviewRestore(&u32NumNodes, &pau16ShortAddresses) == E_ZCB_OK) && (u32NumNodes > 0))
+        {
+            psEvent = malloc(sizeof(tsZcbEvent));
+            if (!psEvent)
+            {
+                daemon_log(LOG_CRIT, "Memory allocation failure allocating event");
+                free(pau16ShortAddresses);
+                return;
+            }
+            psEvent->eEvent                                     = E_ZCB_EVENT_NODES_RESTORED;
+            psEvent->uData.sNodesRestored.u32NumNodes           = u32NumNodes;
+            psEvent->uData.sNodesRestored.pau16ShortAddresses   = pau16ShortAddresses;
+            
+            if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
+            {
+                /* The nodes join the JIP network when they are next announced instead */
+                DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
+                free(pau16ShortAddresses);
+                free(psEvent);
+            }
+        }
+    }
+    
     /* Test thermostat */
 #if 0
     {
@@ -2425,7 +2614,7 @@ static void ZCB_HandleNetworkJoined(void *pvUser, uint16_t u16Length, void *pvMe
             eUtils_LockUnlock(&psZCBNode->sLock);
             
             
-            if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
+            if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
             {
                 DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
                 free(psEvent);
@@ -2477,7 +2666,10 @@ static void ZCB_HandleDeviceAnnounce(void *pvUser, uint16_t u16Length, void *pvM
         
         eUtils_LockUnlock(&psZCBNode->sLock);
 
-        if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
+        /* A device that sleeps is awake as it announces itself */
+        vZCB_CommandQueueNodeHeard(psMessage->u16ShortAddress);
+
+        if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
         {
             DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
             free(psEvent);
@@ -2517,7 +2709,7 @@ static void ZCB_HandleDeviceLeave(void *pvUser, uint16_t u16Length, void *pvMess
     psEvent->uData.sDeviceLeft.u64IEEEAddress       = psMessage->u64IEEEAddress;
     psEvent->uData.sDeviceLeft.bRejoin              = psMessage->bRejoin;
     
-    if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
+    if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
     {
         DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
         free(psEvent);
@@ -2588,17 +2780,190 @@ static void ZCB_HandleMatchDescriptorResponse(void *pvUser, uint16_t u16Length,
             eUtils_LockUnlock(&psZCBNode->sLock);
             DBG_vPrintf(DBG_ZCB, "Queue new node event\n");
             
-            if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
+            if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
             {
                 DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
                 free(psEvent);
             }
+            return;
         }
     }
+    
+    /* Let an interview of the node know that it has no matching endpoints */
+    psEvent->eEvent                                     = E_ZCB_EVENT_INTERVIEW_RESPONSE;
+    psEvent->uData.sInterviewResponse.u16MessageType    = E_SL_MSG_MATCH_DESCRIPTOR_RESPONSE;
+    psEvent->uData.sInterviewResponse.u16ShortAddress   = psMatchDescriptorResponse->u16ShortAddress;
+    psEvent->uData.sInterviewResponse.u16GroupAddress   = 0;
+    psEvent->uData.sInterviewResponse.u8SequenceNo      = psMatchDescriptorResponse->u8SequenceNo;
+    psEvent->uData.sInterviewResponse.u8Status          = psMatchDescriptorResponse->u8Status;
+    
+    if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
+    {
+        DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
+        free(psEvent);
+    }
     return;
 }
 
 
+/** Queue an event for a response to an interview request */
+static void ZCB_QueueInterviewResponse(uint16_t u16MessageType, uint16_t u16ShortAddress, uint16_t u16GroupAddress, uint8_t u8SequenceNo, uint8_t u8Status)
+{
+    tsZcbEvent *psEvent = malloc(sizeof(tsZcbEvent));
+    if (!psEvent)
+    {
+        daemon_log(LOG_CRIT, "Memory allocation failure allocating event");
+        return;
+    }
+    
+    psEvent->eEvent                                     = E_ZCB_EVENT_INTERVIEW_RESPONSE;
+    psEvent->uData.sInterviewResponse.u16MessageType    = u16MessageType;
+    psEvent->uData.sInterviewResponse.u16ShortAddress   = u16ShortAddress;
+    psEvent->uData.sInterviewResponse.u16GroupAddress   = u16GroupAddress;
+    psEvent->uData.sInterviewResponse.u8SequenceNo      = u8SequenceNo;
+    psEvent->uData.sInterviewResponse.u8Status          = u8Status;
+    
+    if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
+    {
+        DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
+        free(psEvent);
+    }
+}
+
+
+static void ZCB_HandleIEEEAddressResponse(void *pvUser, uint16_t u16Length, void *pvMessage)
+{
+    tsZCB_Node *psZCBNode;
+    struct _IEEEAddressResponse
+    {
+        uint8_t     u8SequenceNo;
+        uint8_t     u8Status;
+        uint64_t    u64IEEEAddress;
+        uint16_t    u16ShortAddress;
+    } __attribute__((__packed__)) *psIEEEAddressResponse = (struct _IEEEAddressResponse *)pvMessage;
+    
+    uint16_t u16ShortAddress = ntohs(psIEEEAddressResponse->u16ShortAddress);
+    
+    if (psIEEEAddressResponse->u8Status == E_ZCB_OK)
+    {
+        if ((psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress)) != NULL)
+        {
+            psZCBNode->u64IEEEAddress = be64toh(psIEEEAddressResponse->u64IEEEAddress);
+            DBG_vPrintf(DBG_ZCB, "Short address 0x%04X has IEEE Address 0x%016llX\n", psZCBNode->u16ShortAddress, (unsigned long long int)psZCBNode->u64IEEEAddress);
+            eUtils_LockUnlock(&psZCBNode->sLock);
+        }
+    }
+    
+    ZCB_QueueInterviewResponse(E_SL_MSG_IEEE_ADDRESS_RESPONSE, u16ShortAddress, 0,
+                               psIEEEAddressResponse->u8SequenceNo, psIEEEAddressResponse->u8Status);
+}
+
+
+static void ZCB_HandleNodeDescriptorResponse(void *pvUser, uint16_t u16Length, void *pvMessage)
+{
+    tsZCB_Node *psZCBNode;
+    struct _tNodeDescriptorResponse
+    {
+        uint8_t     u8SequenceNo;
+        uint8_t     u8Status;
+        uint16_t    u16ShortAddress;
+        uint16_t    u16ManufacturerID;
+        uint16_t    u16MaxRxLength;
+        uint16_t    u16MaxTxLength;
+        uint16_t    u16ServerMask;
+        uint8_t     u8DescriptorCapability;
+        uint8_t     u8MacCapability;
+        uint8_t     u8MaxBufferSize;
+        uint16_t    u16Bitfield;
+    } __attribute__((__packed__)) *psNodeDescriptorResponse = (struct _tNodeDescriptorResponse *)pvMessage;
+    
+    uint16_t u16ShortAddress = ntohs(psNodeDescriptorResponse->u16ShortAddress);
+    
+    if (psNodeDescriptorResponse->u8Status == E_ZCB_OK)
+    {
+        if ((psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress)) != NULL)
+        {
+            psZCBNode->u8MacCapability = psNodeDescriptorResponse->u8MacCapability;
+            eUtils_LockUnlock(&psZCBNode->sLock);
+        }
+    }
+    
+    ZCB_QueueInterviewResponse(E_SL_MSG_NODE_DESCRIPTOR_RESPONSE, u16ShortAddress, 0,
+                               psNodeDescriptorResponse->u8SequenceNo, psNodeDescriptorResponse->u8Status);
+}
+
+
+static void ZCB_HandleSimpleDescriptorResponse(void *pvUser, uint16_t u16Length, void *pvMessage)
+{
+    tsZCB_Node *psZCBNode;
+    struct _tSimpleDescriptorResponse
+    {
+        uint8_t     u8SequenceNo;
+        uint8_t     u8Status;
+        uint16_t    u16ShortAddress;
+        uint8_t     u8Length;
+        uint8_t     u8Endpoint;
+        uint16_t    u16ProfileID;
+        uint16_t    u16DeviceID;
+        uint8_t     u8Bitfields;
+        uint8_t     u8InputClusterCount;
+        /* Input Clusters */
+        /* uint8_t     u8OutputClusterCount;*/
+        /* Output Clusters */
+    } __attribute__((__packed__)) *psSimpleDescriptorResponse = (struct _tSimpleDescriptorResponse *)pvMessage;
+    
+    uint16_t u16ShortAddress = ntohs(psSimpleDescriptorResponse->u16ShortAddress);
+    uint8_t u8Status = psSimpleDescriptorResponse->u8Status;
+    int iPosition, i;
+    
+    if ((u8Status == E_ZCB_OK) && (u16Length >= sizeof(struct _tSimpleDescriptorResponse)))
+    {
+        if ((psZCBNode = psZCB_FindNodeShortAddress(u16ShortAddress)) != NULL)
+        {
+            /* Set device ID */
+            psZCBNode->u16DeviceID = ntohs(psSimpleDescriptorResponse->u16DeviceID);
+            
+            if (eZCB_NodeAddEndpoint(psZCBNode, psSimpleDescriptorResponse->u8Endpoint, ntohs(psSimpleDescriptorResponse->u16ProfileID), NULL) != E_ZCB_OK)
+            {
+                u8Status = E_ZCB_ERROR;
+            }
+            
+            iPosition = sizeof(struct _tSimpleDescriptorResponse);
+            for (i = 0; (u8Status == E_ZCB_OK) && (i < psSimpleDescriptorResponse->u8InputClusterCount) && (iPosition < u16Length); i++)
+            {
+                uint16_t *psClusterID = (uint16_t *)&((uint8_t*)psSimpleDescriptorResponse)[iPosition];
+                if (eZCB_NodeAddCluster(psZCBNode, psSimpleDescriptorResponse->u8Endpoint, ntohs(*psClusterID)) != E_ZCB_OK)
+                {
+                    u8Status = E_ZCB_ERROR;
+                }
+                iPosition += sizeof(uint16_t);
+            }
+            eUtils_LockUnlock(&psZCBNode->sLock);
+        }
+    }
+    
+    ZCB_QueueInterviewResponse(E_SL_MSG_SIMPLE_DESCRIPTOR_RESPONSE, u16ShortAddress, 0,
+                               psSimpleDescriptorResponse->u8SequenceNo, u8Status);
+}
+
+
+static void ZCB_HandleAddGroupResponse(void *pvUser, uint16_t u16Length, void *pvMessage)
+{
+    struct _sAddGroupMembershipResponse
+    {
+        uint8_t     u8SequenceNo;
+        uint8_t     u8Endpoint;
+        uint16_t    u16ClusterID;
+        uint8_t     u8Status;
+        uint16_t    u16GroupAddress;
+    } __attribute__((__packed__)) *psAddGroupMembershipResponse = (struct _sAddGroupMembershipResponse *)pvMessage;
+    
+    /* The response does not say which node it is from */
+    ZCB_QueueInterviewResponse(E_SL_MSG_ADD_GROUP_RESPONSE, 0, ntohs(psAddGroupMembershipResponse->u16GroupAddress),
+                               psAddGroupMembershipResponse->u8SequenceNo, psAddGroupMembershipResponse->u8Status);
+}
+
+
 static void ZCB_HandleAttributeReport(void *pvUser, uint16_t u16Length, void *pvMessage)
 {
     teZcbStatus eStatus = E_ZCB_ERROR;
@@ -2632,6 +2997,9 @@ static void ZCB_HandleAttributeReport(void *pvUser, uint16_t u16Length, void *pv
                 psMessage->u16AttributeID
                );
     
+    /* A device that sleeps polls its parent after reporting, so can take commands held for it now */
+    vZCB_CommandQueueNodeHeard(psMessage->u16ShortAddress);
+    
     tsZcbEvent *psEvent = malloc(sizeof(tsZcbEvent));
     if (!psEvent)
     {
@@ -2698,7 +3066,7 @@ static void ZCB_HandleAttributeReport(void *pvUser, uint16_t u16Length, void *pv
 
     if (eStatus == E_ZCB_OK)
     {
-        if (eUtils_QueueQueue(&sZcbEventQueue, psEvent) != E_UTILS_OK)
+        if (eZCB_QueueEvent(psEvent) != E_ZCB_OK)
         {
             DBG_vPrintf(DBG_ZCB, "Error queue'ing event\n");
             free(psEvent);
@@ -2715,6 +3083,10 @@ static void ZCB_HandleAttributeReport(void *pvUser, uint16_t u16Length, void *pv
 static teZcbStatus eZCB_ConfigureControlBridge(void)
 {
 #define CONFIGURATION_INTERVAL 500000
+    tsZCB_Shard *psShard = &asZCB_Shards[iZCB_ShardSelected()];
+    teChannel eShardChannel = psShard->eChannel ? psShard->eChannel : eChannel;
+    uint64_t u64ShardPanID  = psShard->u64PanID ? psShard->u64PanID : u64PanID;
+    
     /* Set up configuration */
     switch (eStartMode)
     {
@@ -2723,10 +3095,10 @@ static teZcbStatus eZCB_ConfigureControlBridge(void)
             eZCB_SetDeviceType(E_MODE_COORDINATOR);
             usleep(CONFIGURATION_INTERVAL);
             
-            eZCB_SetChannelMask(eChannel);
+            eZCB_SetChannelMask(eShardChannel);
             usleep(CONFIGURATION_INTERVAL);
             
-            eZCB_SetExtendedPANID(u64PanID);
+            eZCB_SetExtendedPANID(u64ShardPanID);
             usleep(CONFIGURATION_INTERVAL);
             
             eZCB_StartNetwork();
@@ -2738,10 +3110,10 @@ static teZcbStatus eZCB_ConfigureControlBridge(void)
             eZCB_SetDeviceType(E_MODE_HA_COMPATABILITY);
             usleep(CONFIGURATION_INTERVAL);
 
-            eZCB_SetChannelMask(eChannel);
+            eZCB_SetChannelMask(eShardChannel);
             usleep(CONFIGURATION_INTERVAL);
             
-            eZCB_SetExtendedPANID(u64PanID);
+            eZCB_SetExtendedPANID(u64ShardPanID);
             usleep(CONFIGURATION_INTERVAL);
             
             eZCB_StartNetwork();
@@ -2753,10 +3125,10 @@ static teZcbStatus eZCB_ConfigureControlBridge(void)
             eZCB_SetDeviceType(E_MODE_ROUTER);
             usleep(CONFIGURATION_INTERVAL);
             
-            eZCB_SetChannelMask(eChannel);
+            eZCB_SetChannelMask(eShardChannel);
             usleep(CONFIGURATION_INTERVAL);
             
-            eZCB_SetExtendedPANID(u64PanID);
+            eZCB_SetExtendedPANID(u64ShardPanID);
             usleep(CONFIGURATION_INTERVAL);
             
             eZCB_StartNetwork();
@@ -2772,6 +3144,45 @@ static teZcbStatus eZCB_ConfigureControlBridge(void)
 }
 
 
+/** Send an add group membership request, as \ref eZCB_SendAddGroupMembership,
+ *  filling in psPolicy with how it was sent so that the response can be waited for.
+ */
+static teZcbStatus eZCB_SendAddGroupMembershipPolicy(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_t *pu8SequenceNo, tsZcbDeliveryPolicy *psPolicy)
+{
+    struct _AddGroupMembershipRequest
+    {
+        uint8_t     u8TargetAddressMode;
+        uint16_t    u16TargetAddress;
+        uint8_t     u8SourceEndpoint;
+        uint8_t     u8DestinationEndpoint;
+        uint16_t    u16GroupAddress;
+    } __attribute__((__packed__)) sAddGroupMembershipRequest;
+    
+    teZcbStatus eStatus;
+    
+    vZCB_ShardSelect(psZCBNode->u8Shard);
+    
+    DBG_vPrintf(DBG_ZCB, "Send add group membership 0x%04X request to 0x%04X\n", u16GroupAddress, psZCBNode->u16ShortAddress);
+    
+    vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONFIGURE, psPolicy);
+    sAddGroupMembershipRequest.u8TargetAddressMode   = psPolicy->u8AddressMode;
+    sAddGroupMembershipRequest.u16TargetAddress     = htons(psZCBNode->u16ShortAddress);
+    
+    if ((eStatus = eZCB_GetEndpoints(psZCBNode, E_ZB_CLUSTERID_GROUPS, &sAddGroupMembershipRequest.u8SourceEndpoint, &sAddGroupMembershipRequest.u8DestinationEndpoint)) != E_ZCB_OK)
+    {
+        return eStatus;
+    }
+    
+    sAddGroupMembershipRequest.u16GroupAddress = htons(u16GroupAddress);
+
+    if (eSL_SendMessage(E_SL_MSG_ADD_GROUP_REQUEST, sizeof(struct _AddGroupMembershipRequest), &sAddGroupMembershipRequest, pu8SequenceNo) != E_SL_OK)
+    {
+        return E_ZCB_COMMS_FAILED;
+    }
+    return E_ZCB_OK;
+}
+
+
 /* PDM Messages */
     
      
@@ -0,0 +1,705 @@
+/****************************************************************************
+ *
+ * MODULE:             Linux Zigbee - JIP daemon
+ *
+ * COMPONENT:          Interview of devices joining the Zigbee network
+ *
+ * REVISION:           $Revision: 43420 $
+ *
+ * DATED:              $Date: 2012-06-18 15:13:17 +0100 (Mon, 18 Jun 2012) $
+ *
+ * AUTHOR:             Matt Redfearn
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139].
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+/****************************************************************************/
+/***        Include files                                                 ***/
+/****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libdaemon/daemon.h>
+
+#include "ZigbeeControlBridge.h"
+#include "ZigbeeConstant.h"
+#include "ZigbeeInterview.h"
+#include "ZigbeeNetwork.h"
+#include "ZigbeePDM.h"
+#include "SerialLink.h"
+#include "Utils.h"
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+#define DBG_INTERVIEW 0
+
+/** Time to wait for a response to an interview request (ms) */
+#define INTERVIEW_RESPONSE_TIMEOUT_MS   5000
+
+/** Delay before the first retry of a request (ms). Doubled for each further retry */
+#define INTERVIEW_RETRY_DELAY_MS        1000
+
+/** Number of times a request is sent before giving up on the device */
+#define INTERVIEW_MAX_ATTEMPTS          5
+
+/** Longest time to wait before u32ZCB_InterviewProcess is called again (ms) */
+#define INTERVIEW_MAX_PROCESS_MS        1000
+
+/** Interviews of the control bridge selected by the calling thread */
+#define sInterviewShard (asInterviewShards[iZCB_ShardSelected()])
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+/** Steps of an interview */
+typedef enum
+{
+    E_INTERVIEW_STATE_MATCH_DESCRIPTOR,     /**< Find endpoints matching supported devices */
+    E_INTERVIEW_STATE_NODE_DESCRIPTOR,      /**< Read the node descriptor, if the IEEE address is not known */
+    E_INTERVIEW_STATE_IEEE_ADDRESS,         /**< Read the IEEE address */
+    E_INTERVIEW_STATE_SIMPLE_DESCRIPTOR,    /**< Read the simple descriptor of each endpoint not yet known */
+    E_INTERVIEW_STATE_ADD_GROUP,            /**< Add the device to the bulb group */
+    E_INTERVIEW_STATE_COMPLETE,             /**< Raise the device interviewed event */
+    E_INTERVIEW_STATE_FINISHED,             /**< Interview is over and can be freed */
+} teInterviewState;
+
+
+/** Interview of one device */
+typedef struct _tsInterview
+{
+    struct _tsInterview *psNext;
+
+    uint64_t            u64Deadline;        /**< Time to give up waiting for a response, or to send the next request */
+
+    teInterviewState    eState;
+
+    uint16_t            u16ShortAddress;
+    uint8_t             u8SequenceNo;       /**< Sequence number of the outstanding request */
+    uint8_t             u8EndpointIndex;    /**< Index of the next endpoint to check for a simple descriptor */
+    uint8_t             u8PendingResponses; /**< Number of match descriptor responses still expected */
+    uint8_t             u8Attempts;         /**< Number of times the request for this step has been sent */
+    uint8_t             bActive;            /**< The interview holds one of the iZCB_InterviewMaxActive slots */
+    uint8_t             bWaiting;           /**< A request is outstanding */
+} tsInterview;
+
+/****************************************************************************/
+/***        Local Function Prototypes                                     ***/
+/****************************************************************************/
+
+static uint64_t u64Interview_TimeNow(void);
+static uint32_t u32Interview_Process(void);
+static tsInterview *psInterview_Find(uint16_t u16ShortAddress);
+static void vInterview_NextStep(tsInterview *psInterview, teInterviewState eState);
+static void vInterview_Failed(tsInterview *psInterview, uint64_t u64Now);
+static void vInterview_Send(tsInterview *psInterview, uint64_t u64Now);
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+int              iZCB_InterviewMaxActive    = 4;
+
+uint32_t         u32ZCB_InterviewIntervalMs = 100;
+
+/****************************************************************************/
+/***        Local Variables                                               ***/
+/****************************************************************************/
+
+/** Interviews of each control bridge, which has its own active slots and rate limit */
+static struct
+{
+    tsInterview     *psInterviews;          /**< Interviews in the order they were started */
+    int             iNumActive;             /**< Number of interviews holding an active slot */
+    uint64_t        u64NextSendTime;        /**< Time the next request may be sent */
+} asInterviewShards[ZCB_MAX_SHARDS];
+
+/** Names of the steps for logging */
+static const char *apcStateNames[] =
+{
+    "match descriptor", "node descriptor", "IEEE address", "simple descriptor", "add group", "complete", "finished"
+};
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+teZcbStatus eZCB_InterviewStart(uint16_t u16ShortAddress, int bMatchDescriptor)
+{
+    tsInterview *psInterview = psInterview_Find(u16ShortAddress);
+    tsInterview **ppsTail;
+
+    if (psInterview)
+    {
+        if ((!bMatchDescriptor) && (psInterview->eState == E_INTERVIEW_STATE_MATCH_DESCRIPTOR))
+        {
+            /* Device has matching endpoints - find out about them */
+            DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X matched\n", u16ShortAddress);
+            vInterview_NextStep(psInterview, E_INTERVIEW_STATE_NODE_DESCRIPTOR);
+        }
+        else
+        {
+            DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X is already being interviewed\n", u16ShortAddress);
+        }
+        return E_ZCB_OK;
+    }
+
+    psInterview = malloc(sizeof(tsInterview));
+    if (!psInterview)
+    {
+        daemon_log(LOG_CRIT, "Memory allocation failure allocating interview");
+        return E_ZCB_ERROR_NO_MEM;
+    }
+    memset(psInterview, 0, sizeof(tsInterview));
+
+    psInterview->u16ShortAddress = u16ShortAddress;
+    psInterview->eState = bMatchDescriptor ? E_INTERVIEW_STATE_MATCH_DESCRIPTOR : E_INTERVIEW_STATE_NODE_DESCRIPTOR;
+
+    /* Add at the end so that devices are interviewed in the order they joined */
+    for (ppsTail = &sInterviewShard.psInterviews; *ppsTail; ppsTail = &(*ppsTail)->psNext);
+    *ppsTail = psInterview;
+
+    DBG_vPrintf(DBG_INTERVIEW, "Start interview of node 0x%04X at %s\n", u16ShortAddress, apcStateNames[psInterview->eState]);
+    return E_ZCB_OK;
+}
+
+
+void vZCB_InterviewResponse(tsZcbEvent *psEvent)
+{
+    tsInterview *psInterview;
+    tsZCB_Node *psZCBNode;
+    teInterviewState eExpectedState;
+    uint8_t u8Status = psEvent->uData.sInterviewResponse.u8Status;
+
+    switch (psEvent->uData.sInterviewResponse.u16MessageType)
+    {
+        case (E_SL_MSG_MATCH_DESCRIPTOR_RESPONSE):  eExpectedState = E_INTERVIEW_STATE_MATCH_DESCRIPTOR;    break;
+        case (E_SL_MSG_NODE_DESCRIPTOR_RESPONSE):   eExpectedState = E_INTERVIEW_STATE_NODE_DESCRIPTOR;     break;
+        case (E_SL_MSG_IEEE_ADDRESS_RESPONSE):      eExpectedState = E_INTERVIEW_STATE_IEEE_ADDRESS;        break;
+        case (E_SL_MSG_SIMPLE_DESCRIPTOR_RESPONSE): eExpectedState = E_INTERVIEW_STATE_SIMPLE_DESCRIPTOR;   break;
+        case (E_SL_MSG_ADD_GROUP_RESPONSE):         eExpectedState = E_INTERVIEW_STATE_ADD_GROUP;           break;
+        default:
+            return;
+    }
+
+    if (eExpectedState == E_INTERVIEW_STATE_ADD_GROUP)
+    {
+        /* Add group responses do not carry the address of the device, and the control bridge
+         * does not always send the right sequence number. Match the sequence number if possible,
+         * otherwise give it to the longest waiting interview adding the group.
+         */
+        tsInterview *psOldest = NULL;
+
+        for (psInterview = sInterviewShard.psInterviews; psInterview; psInterview = psInterview->psNext)
+        {
+            if ((psInterview->eState == E_INTERVIEW_STATE_ADD_GROUP) && psInterview->bWaiting)
+            {
+                if (psInterview->u8SequenceNo == psEvent->uData.sInterviewResponse.u8SequenceNo)
+                {
+                    break;
+                }
+                if ((!psOldest) && (psEvent->uData.sInterviewResponse.u16GroupAddress == ZCB_INTERVIEW_GROUP_ADDRESS))
+                {
+                    psOldest = psInterview;
+                }
+            }
+        }
+        if (!psInterview)
+        {
+            psInterview = psOldest;
+        }
+    }
+    else
+    {
+        psInterview = psInterview_Find(psEvent->uData.sInterviewResponse.u16ShortAddress);
+    }
+
+    if ((!psInterview) || (psInterview->eState != eExpectedState) || (!psInterview->bWaiting))
+    {
+        /* Response to a request made outside of an interview */
+        return;
+    }
+
+    if ((eExpectedState != E_INTERVIEW_STATE_MATCH_DESCRIPTOR) && (eExpectedState != E_INTERVIEW_STATE_ADD_GROUP) &&
+        (psInterview->u8SequenceNo != psEvent->uData.sInterviewResponse.u8SequenceNo))
+    {
+        DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X %s sequence number received 0x%02X does not match that sent 0x%02X\n",
+                    psInterview->u16ShortAddress, apcStateNames[eExpectedState],
+                    psEvent->uData.sInterviewResponse.u8SequenceNo, psInterview->u8SequenceNo);
+        return;
+    }
+
+    psZCBNode = psZCB_FindNodeShortAddress(psInterview->u16ShortAddress);
+    if (!psZCBNode)
+    {
+        DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X no longer in network\n", psInterview->u16ShortAddress);
+        psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+        return;
+    }
+    vZCB_NodeUpdateComms(psZCBNode, E_ZCB_OK);
+    eUtils_LockUnlock(&psZCBNode->sLock);
+
+    DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X %s response status %d\n", psInterview->u16ShortAddress, apcStateNames[eExpectedState], u8Status);
+
+    switch (eExpectedState)
+    {
+        case (E_INTERVIEW_STATE_MATCH_DESCRIPTOR):
+            /* Matching responses raise a device match event instead */
+            if (psInterview->u8PendingResponses > 0)
+            {
+                psInterview->u8PendingResponses--;
+            }
+            if (psInterview->u8PendingResponses == 0)
+            {
+                DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X has no matching endpoints\n", psInterview->u16ShortAddress);
+                psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+            }
+            break;
+
+        case (E_INTERVIEW_STATE_NODE_DESCRIPTOR):
+            if (u8Status == E_ZCB_OK)
+            {
+                vInterview_NextStep(psInterview, E_INTERVIEW_STATE_IEEE_ADDRESS);
+            }
+            else
+            {
+                vInterview_Failed(psInterview, u64Interview_TimeNow());
+            }
+            break;
+
+        case (E_INTERVIEW_STATE_IEEE_ADDRESS):
+            if (u8Status == E_ZCB_OK)
+            {
+                vInterview_NextStep(psInterview, E_INTERVIEW_STATE_SIMPLE_DESCRIPTOR);
+            }
+            else
+            {
+                vInterview_Failed(psInterview, u64Interview_TimeNow());
+            }
+            break;
+
+        case (E_INTERVIEW_STATE_SIMPLE_DESCRIPTOR):
+            if (u8Status == E_ZCB_OK)
+            {
+                /* Move on to the next endpoint */
+                uint8_t u8EndpointIndex = psInterview->u8EndpointIndex + 1;
+                vInterview_NextStep(psInterview, E_INTERVIEW_STATE_SIMPLE_DESCRIPTOR);
+                psInterview->u8EndpointIndex = u8EndpointIndex;
+            }
+            else
+            {
+                vInterview_Failed(psInterview, u64Interview_TimeNow());
+            }
+            break;
+
+        case (E_INTERVIEW_STATE_ADD_GROUP):
+            if ((u8Status == E_ZCB_OK) ||
+                (u8Status == E_ZCB_DUPLICATE_EXISTS) ||
+                (u8Status == E_ZCB_UNKNOWN_CLUSTER))
+            {
+                vInterview_NextStep(psInterview, E_INTERVIEW_STATE_COMPLETE);
+            }
+            else
+            {
+                vInterview_Failed(psInterview, u64Interview_TimeNow());
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void vZCB_InterviewCancel(uint16_t u16ShortAddress)
+{
+    tsInterview *psInterview = psInterview_Find(u16ShortAddress);
+
+    if (psInterview)
+    {
+        DBG_vPrintf(DBG_INTERVIEW, "Cancel interview of node 0x%04X\n", u16ShortAddress);
+        psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+    }
+}
+
+
+uint32_t u32ZCB_InterviewProcess(void)
+{
+    int iSelected = iZCB_ShardSelected();
+    uint32_t u32NextProcess = INTERVIEW_MAX_PROCESS_MS;
+    uint32_t u32ShardNextProcess;
+    int iShard;
+    
+    /* Each control bridge's interviews are sent through it, and wait for its responses */
+    for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+    {
+        vZCB_ShardSelect(iShard);
+        u32ShardNextProcess = u32Interview_Process();
+        if (u32ShardNextProcess < u32NextProcess)
+        {
+            u32NextProcess = u32ShardNextProcess;
+        }
+    }
+    vZCB_ShardSelect(iSelected);
+    return u32NextProcess;
+}
+
+
+void vZCB_InterviewFinish(void)
+{
+    int iShard;
+    
+    for (iShard = 0; iShard < ZCB_MAX_SHARDS; iShard++)
+    {
+        while (asInterviewShards[iShard].psInterviews)
+        {
+            tsInterview *psInterview = asInterviewShards[iShard].psInterviews;
+            asInterviewShards[iShard].psInterviews = psInterview->psNext;
+            free(psInterview);
+        }
+        asInterviewShards[iShard].iNumActive = 0;
+    }
+}
+
+/****************************************************************************/
+/***        Local Functions                                               ***/
+/****************************************************************************/
+
+/** Run the interviews of the selected control bridge
+ *  \return Time until they next need to be run (ms)
+ */
+static uint32_t u32Interview_Process(void)
+{
+    tsInterview **ppsInterview = &sInterviewShard.psInterviews;
+    uint64_t u64Now = u64Interview_TimeNow();
+    uint64_t u64NextProcess = u64Now + INTERVIEW_MAX_PROCESS_MS;
+
+    while (*ppsInterview)
+    {
+        tsInterview *psInterview = *ppsInterview;
+
+        if (psInterview->eState != E_INTERVIEW_STATE_FINISHED)
+        {
+            if (psInterview->u64Deadline <= u64Now)
+            {
+                if (psInterview->bWaiting)
+                {
+                    DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X no response to %s request\n",
+                                psInterview->u16ShortAddress, apcStateNames[psInterview->eState]);
+                    vInterview_Failed(psInterview, u64Now);
+                }
+                else if ((psInterview->eState == E_INTERVIEW_STATE_COMPLETE) ||
+                         (psInterview->bActive || (sInterviewShard.iNumActive < iZCB_InterviewMaxActive)))
+                {
+                    if ((psInterview->eState == E_INTERVIEW_STATE_COMPLETE) || (sInterviewShard.u64NextSendTime <= u64Now))
+                    {
+                        vInterview_Send(psInterview, u64Now);
+                    }
+                    else if (sInterviewShard.u64NextSendTime < u64NextProcess)
+                    {
+                        /* Held back by the rate limit */
+                        u64NextProcess = sInterviewShard.u64NextSendTime;
+                    }
+                }
+            }
+
+            if ((psInterview->eState != E_INTERVIEW_STATE_FINISHED) &&
+                (psInterview->u64Deadline > u64Now) && (psInterview->u64Deadline < u64NextProcess))
+            {
+                u64NextProcess = psInterview->u64Deadline;
+            }
+        }
+
+        if (psInterview->eState == E_INTERVIEW_STATE_FINISHED)
+        {
+            /* Remove the interview and free its slot */
+            if (psInterview->bActive)
+            {
+                sInterviewShard.iNumActive--;
+            }
+            *ppsInterview = psInterview->psNext;
+            free(psInterview);
+
+            /* A waiting interview may now start */
+            u64NextProcess = u64Now;
+        }
+        else
+        {
+            ppsInterview = &psInterview->psNext;
+        }
+    }
+
+    if ((u64NextProcess <= u64Now) && (sInterviewShard.psInterviews))
+    {
+        /* Something changed - have another look as soon as the rate limit allows */
+        u64NextProcess = (sInterviewShard.u64NextSendTime > u64Now) ? sInterviewShard.u64NextSendTime : u64Now + 1;
+    }
+
+    return (uint32_t)(u64NextProcess > u64Now ? u64NextProcess - u64Now : 0);
+}
+
+
+/** Get the monotonic time in milliseconds */
+static uint64_t u64Interview_TimeNow(void)
+{
+    struct timespec sNow;
+
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000) + (sNow.tv_nsec / 1000000);
+}
+
+
+static tsInterview *psInterview_Find(uint16_t u16ShortAddress)
+{
+    tsInterview *psInterview;
+
+    for (psInterview = sInterviewShard.psInterviews; psInterview; psInterview = psInterview->psNext)
+    {
+        if ((psInterview->u16ShortAddress == u16ShortAddress) && (psInterview->eState != E_INTERVIEW_STATE_FINISHED))
+        {
+            return psInterview;
+        }
+    }
+    return NULL;
+}
+
+
+/** Move an interview on to a step, to be sent when the limits allow */
+static void vInterview_NextStep(tsInterview *psInterview, teInterviewState eState)
+{
+    psInterview->eState             = eState;
+    psInterview->u8EndpointIndex    = 0;
+    psInterview->u8Attempts         = 0;
+    psInterview->bWaiting           = 0;
+    psInterview->u64Deadline        = 0;
+}
+
+
+/** A request failed or was not answered. Retry it later, or give up on the device */
+static void vInterview_Failed(tsInterview *psInterview, uint64_t u64Now)
+{
+    tsZCB_Node *psZCBNode = psZCB_FindNodeShortAddress(psInterview->u16ShortAddress);
+
+    psInterview->bWaiting = 0;
+
+    if (!psZCBNode)
+    {
+        psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+        return;
+    }
+
+    vZCB_NodeUpdateComms(psZCBNode, E_ZCB_COMMS_FAILED);
+
+    if (psInterview->u8Attempts < INTERVIEW_MAX_ATTEMPTS)
+    {
+        psInterview->u64Deadline = u64Now + (INTERVIEW_RETRY_DELAY_MS << (psInterview->u8Attempts - 1));
+        DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X retry %s in %dms\n", psInterview->u16ShortAddress,
+                    apcStateNames[psInterview->eState], (int)(psInterview->u64Deadline - u64Now));
+        eUtils_LockUnlock(&psZCBNode->sLock);
+        return;
+    }
+
+    if (psInterview->eState == E_INTERVIEW_STATE_MATCH_DESCRIPTOR)
+    {
+        /* The device may just not match anything supported */
+        DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X did not respond to match descriptor request\n", psInterview->u16ShortAddress);
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    else
+    {
+        daemon_log(LOG_INFO, "Zigbee node 0x%04X removed from network (no response to %s request).",
+                   psInterview->u16ShortAddress, apcStateNames[psInterview->eState]);
+        if (eZCB_RemoveNode(psZCBNode) != E_ZCB_OK)
+        {
+            DBG_vPrintf(DBG_INTERVIEW, "Error removing node from ZCB\n");
+        }
+    }
+    psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+}
+
+
+/** Send the request for the current step of an interview */
+static void vInterview_Send(tsInterview *psInterview, uint64_t u64Now)
+{
+    tsZCB_Node *psZCBNode = psZCB_FindNodeShortAddress(psInterview->u16ShortAddress);
+    teZcbStatus eStatus = E_ZCB_OK;
+    int iNumRequests = 1;
+    int bSent = 0;
+
+    if (!psZCBNode)
+    {
+        DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X no longer in network\n", psInterview->u16ShortAddress);
+        psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+        return;
+    }
+
+    /* Skip over steps that are not needed */
+    while (!bSent && (eStatus == E_ZCB_OK) && (psInterview->eState != E_INTERVIEW_STATE_FINISHED))
+    {
+        switch (psInterview->eState)
+        {
+            case (E_INTERVIEW_STATE_MATCH_DESCRIPTOR):
+            {
+                uint16_t au16Profile[] = { E_ZB_PROFILEID_HA, E_ZB_PROFILEID_ZLL };
+                uint16_t au16Cluster[] = { E_ZB_CLUSTERID_ONOFF, E_ZB_CLUSTERID_THERMOSTAT  };
+                int i;
+
+                psInterview->u8PendingResponses = 0;
+                for (i = 0; i < (sizeof(au16Profile)/sizeof(uint16_t)); i++)
+                {
+                    if (eZCB_MatchDescriptorRequest(psZCBNode->u16ShortAddress, au16Profile[i],
+                            sizeof(au16Cluster) / sizeof(uint16_t), au16Cluster,
+                            0, NULL, NULL) == E_ZCB_OK)
+                    {
+                        psInterview->u8PendingResponses++;
+                    }
+                    else
+                    {
+                        DBG_vPrintf(DBG_INTERVIEW, "Error sending match descriptor request\n");
+                    }
+                }
+                iNumRequests = sizeof(au16Profile)/sizeof(uint16_t);
+                eStatus = psInterview->u8PendingResponses ? E_ZCB_OK : E_ZCB_COMMS_FAILED;
+                bSent = 1;
+                break;
+            }
+
+            case (E_INTERVIEW_STATE_NODE_DESCRIPTOR):
+                if (psZCBNode->u64IEEEAddress)
+                {
+                    psInterview->eState = E_INTERVIEW_STATE_SIMPLE_DESCRIPTOR;
+                    psInterview->u8EndpointIndex = 0;
+                    break;
+                }
+                DBG_vPrintf(DBG_INTERVIEW, "New node 0x%04X, requesting IEEE address\n", psZCBNode->u16ShortAddress);
+                eStatus = eZCB_SendNodeDescriptorRequest(psZCBNode, &psInterview->u8SequenceNo);
+                bSent = 1;
+                break;
+
+            case (E_INTERVIEW_STATE_IEEE_ADDRESS):
+                eStatus = eZCB_SendIEEEAddressRequest(psZCBNode, &psInterview->u8SequenceNo);
+                bSent = 1;
+                break;
+
+            case (E_INTERVIEW_STATE_SIMPLE_DESCRIPTOR):
+                /* Find the next endpoint that has not been described */
+                while ((psInterview->u8EndpointIndex < psZCBNode->u32NumEndpoints) &&
+                       (psZCBNode->pasEndpoints[psInterview->u8EndpointIndex].u16ProfileID != 0))
+                {
+                    psInterview->u8EndpointIndex++;
+                }
+                if (psInterview->u8EndpointIndex >= psZCBNode->u32NumEndpoints)
+                {
+                    psInterview->eState = E_INTERVIEW_STATE_ADD_GROUP;
+                    break;
+                }
+                DBG_vPrintf(DBG_INTERVIEW, "Requesting node 0x%04X endpoint %d simple descriptor\n",
+                            psZCBNode->u16ShortAddress, psZCBNode->pasEndpoints[psInterview->u8EndpointIndex].u8Endpoint);
+                eStatus = eZCB_SendSimpleDescriptorRequest(psZCBNode, psZCBNode->pasEndpoints[psInterview->u8EndpointIndex].u8Endpoint,
+                                                           &psInterview->u8SequenceNo);
+                bSent = 1;
+                break;
+
+            case (E_INTERVIEW_STATE_ADD_GROUP):
+                eStatus = eZCB_SendAddGroupMembership(psZCBNode, ZCB_INTERVIEW_GROUP_ADDRESS, &psInterview->u8SequenceNo);
+                if ((eStatus == E_ZCB_UNKNOWN_CLUSTER) || (eStatus == E_ZCB_UNKNOWN_ENDPOINT))
+                {
+                    /* Device does not support groups */
+                    psInterview->eState = E_INTERVIEW_STATE_COMPLETE;
+                    eStatus = E_ZCB_OK;
+                    break;
+                }
+                bSent = 1;
+                break;
+
+            case (E_INTERVIEW_STATE_COMPLETE):
+            {
+                tsZcbEvent *psEvent = malloc(sizeof(tsZcbEvent));
+                if (psEvent)
+                {
+                    psEvent->eEvent                                     = E_ZCB_EVENT_DEVICE_INTERVIEWED;
+                    psEvent->uData.sDeviceInterviewed.u16ShortAddress   = psZCBNode->u16ShortAddress;
+
+                    if (eZCB_QueueEvent(psEvent) == E_ZCB_OK)
+                    {
+                        DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X interview complete\n", psZCBNode->u16ShortAddress);
+                        
+                        /* So the node needn't be interviewed again when the daemon restarts */
+                        (void)ePDM_InterviewSave(psZCBNode);
+                        psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+                        break;
+                    }
+                    free(psEvent);
+                }
+                /* Try again later */
+                DBG_vPrintf(DBG_INTERVIEW, "Error queue'ing interviewed event\n");
+                psInterview->u64Deadline = u64Now + INTERVIEW_RETRY_DELAY_MS;
+                eUtils_LockUnlock(&psZCBNode->sLock);
+                return;
+            }
+
+            default:
+                psInterview->eState = E_INTERVIEW_STATE_FINISHED;
+                break;
+        }
+    }
+
+    if (bSent)
+    {
+        if (!psInterview->bActive)
+        {
+            psInterview->bActive = 1;
+            sInterviewShard.iNumActive++;
+        }
+        sInterviewShard.u64NextSendTime = u64Now + (iNumRequests * u32ZCB_InterviewIntervalMs);
+        psInterview->u8Attempts++;
+    }
+    eUtils_LockUnlock(&psZCBNode->sLock);
+
+    if (bSent)
+    {
+        if (eStatus == E_ZCB_OK)
+        {
+            psInterview->bWaiting = 1;
+            psInterview->u64Deadline = u64Now + INTERVIEW_RESPONSE_TIMEOUT_MS;
+        }
+        else
+        {
+            DBG_vPrintf(DBG_INTERVIEW, "Node 0x%04X error sending %s request\n", psInterview->u16ShortAddress, apcStateNames[psInterview->eState]);
+            vInterview_Failed(psInterview, u64Now);
+        }
+    }
+}
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
+
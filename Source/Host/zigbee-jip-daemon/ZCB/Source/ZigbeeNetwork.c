@@ -56,6 +56,8 @@
 #include "ZigbeeControlBridge.h"
 #include "ZigbeeConstant.h"
 #include "ZigbeeNetwork.h"
+#include "ZigbeePDM.h"
+#include "SerialLink.h"
 #include "Utils.h"
 
 
@@ -66,28 +68,66 @@
 
 #define DBG_ZBNETWORK 0
 
+#if ZCB_MAX_SHARDS > SL_MAX_LINKS
+#error Each control bridge needs a serial link
+#endif
+
+/** Short address hash bucket of a node */
+#define ZCB_SHORT_ADDRESS_BUCKET(u16ShortAddress) ((u16ShortAddress) & (ZCB_NETWORK_SHORT_ADDRESS_BUCKETS - 1))
+
+/** Weight of the latest result in a node's moving average of requests answered, as a shift */
+#define ZCB_DELIVERY_RELIABILITY_SHIFT 4
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
 
+/** Statistics of delivering requests to nodes */
+typedef struct
+{
+    uint32_t            au32Ack[E_ZCB_DELIVERY_NUM];    /**< Requests sent with APS ack, by class */
+    uint32_t            au32NoAck[E_ZCB_DELIVERY_NUM];  /**< Requests sent without APS ack, by class */
+    uint32_t            u32FirstTime;       /**< Commands answered the first time they were sent */
+    uint32_t            u32Retried;         /**< Commands answered after being sent again */
+    uint32_t            u32Failed;          /**< Commands not answered however often they were sent */
+    uint32_t            u32Retries;         /**< Times commands were sent again */
+} tsDeliveryStats;
+
 /****************************************************************************/
 /***        Local Function Prototypes                                     ***/
 /****************************************************************************/
 
 static uint32_t u32TimevalDiff(struct timeval *psStartTime, struct timeval *psFinishTime);
 
+static void vZCB_ShortAddressHashAdd(tsZCB_Network *psNetwork, tsZCB_Node *psZCBNode);
+static void vZCB_ShortAddressHashRemove(tsZCB_Network *psNetwork, tsZCB_Node *psZCBNode);
+static tsZCB_Node *psZCB_ShortAddressHashFind(tsZCB_Network *psNetwork, uint16_t u16ShortAddress);
+static tsZCB_Node *psZCB_NetworkFindIEEEAddress(tsZCB_Network *psNetwork, uint64_t u64IEEEAddress);
+
 /****************************************************************************/
 /***        Exported Variables                                            ***/
 /****************************************************************************/
 
 
-tsZCB_Network sZCB_Network;
+tsZCB_Network    asZCB_Networks[ZCB_MAX_SHARDS];
+
+int              iZCB_NumShards             = 1;
+
+int              bZCB_AdaptiveDelivery      = 1;
 
 
 /****************************************************************************/
 /***        Local Variables                                               ***/
 /****************************************************************************/
 
+static tsDeliveryStats sDeliveryStats;
+
+static const char *apcDeliveryClassNames[E_ZCB_DELIVERY_NUM] =
+{
+    "commands",
+    "configuration",
+    "queries",
+};
 
 /****************************************************************************/
 /***        Exported Functions                                            ***/
@@ -143,12 +183,46 @@ void DBG_PrintNode(tsZCB_Node *psNode)
 }
 
 
+void vZCB_ShardSelect(int iShard)
+{
+    /* Each control bridge is on the serial link of the same index */
+    vSL_SelectLink(iShard);
+}
+
+
+int iZCB_ShardSelected(void)
+{
+    return iSL_SelectedLink();
+}
+
+
+teZcbStatus eZCB_SendGroupMessage(uint16_t u16Type, uint16_t u16Length, void *pvMessage)
+{
+    teZcbStatus eStatus = E_ZCB_OK;
+    int iSelected = iZCB_ShardSelected();
+    int iShard;
+    
+    for (iShard = 0; iShard < iZCB_NumShards; iShard++)
+    {
+        vZCB_ShardSelect(iShard);
+        if (eSL_SendMessage(u16Type, u16Length, pvMessage, NULL) != E_SL_OK)
+        {
+            DBG_vPrintf(DBG_ZBNETWORK, "Control bridge %d did not take group message 0x%04X\n", iShard, u16Type);
+            eStatus = E_ZCB_COMMS_FAILED;
+        }
+    }
+    vZCB_ShardSelect(iSelected);
+    return eStatus;
+}
+
+
 teZcbStatus eZCB_AddNode(uint16_t u16ShortAddress, uint64_t u64IEEEAddress, uint16_t u16DeviceID, uint8_t u8MacCapability, tsZCB_Node **ppsZCBNode)
 {
     teZcbStatus eStatus = E_ZCB_OK;
-    tsZCB_Node *psZCBNode = &sZCB_Network.sNodes;
+    tsZCB_Network *psNetwork = &sZCB_Network;
+    tsZCB_Node *psZCBNode = &psNetwork->sNodes;
     
-    eUtils_LockLock(&sZCB_Network.sLock);
+    eUtils_LockLock(&psNetwork->sLock);
     
     while (psZCBNode->psNext)
     {
@@ -158,7 +232,15 @@ teZcbStatus eZCB_AddNode(uint16_t u16ShortAddress, uint64_t u64IEEEAddress, uint
             {
                 DBG_vPrintf(DBG_ZBNETWORK, "IEEE address already in network - update short address\n");
                 eUtils_LockLock(&psZCBNode->psNext->sLock);
-                psZCBNode->psNext->u16ShortAddress = u16ShortAddress;
+                if (psZCBNode->psNext->u16ShortAddress != u16ShortAddress)
+                {
+                    vZCB_ShortAddressHashRemove(psNetwork, psZCBNode->psNext);
+                    psZCBNode->psNext->u16ShortAddress = u16ShortAddress;
+                    vZCB_ShortAddressHashAdd(psNetwork, psZCBNode->psNext);
+                    
+                    /* Keep the interview cache pointing at the node's new address */
+                    (void)ePDM_InterviewSave(psZCBNode->psNext);
+                }
                 
                 if (ppsZCBNode)
                 {
@@ -221,11 +303,14 @@ teZcbStatus eZCB_AddNode(uint16_t u16ShortAddress, uint64_t u64IEEEAddress, uint
     memset(psZCBNode->psNext, 0, sizeof(tsZCB_Node));
 
     /* Got to end of list without finding existing node - add it at the end of the list */
-    eUtils_LockCreate(&psZCBNode->psNext->sLock);
+    eUtils_LockCreateHere(&psZCBNode->psNext->sLock);
     psZCBNode->psNext->u16ShortAddress  = u16ShortAddress;
     psZCBNode->psNext->u64IEEEAddress   = u64IEEEAddress;
     psZCBNode->psNext->u8MacCapability  = u8MacCapability;
     psZCBNode->psNext->u16DeviceID      = u16DeviceID;
+    psZCBNode->psNext->sComms.u16Reliability = 0xFFFF;
+    psZCBNode->psNext->u8Shard          = psNetwork->sNodes.u8Shard;
+    vZCB_ShortAddressHashAdd(psNetwork, psZCBNode->psNext);
     
     DBG_vPrintf(DBG_ZBNETWORK, "Created new Node\n");
     DBG_PrintNode(psZCBNode->psNext);
@@ -237,7 +322,7 @@ teZcbStatus eZCB_AddNode(uint16_t u16ShortAddress, uint64_t u64IEEEAddress, uint
     }
 
 done:
-    eUtils_LockUnlock(&sZCB_Network.sLock);
+    eUtils_LockUnlock(&psNetwork->sLock);
     return eStatus;
 }
 
@@ -245,18 +330,19 @@ done:
 teZcbStatus eZCB_RemoveNode(tsZCB_Node *psZCBNode)
 {
     teZcbStatus eStatus = E_ZCB_ERROR;
-    tsZCB_Node *psZCBCurrentNode = &sZCB_Network.sNodes;
+    tsZCB_Network *psNetwork = &asZCB_Networks[psZCBNode->u8Shard];
+    tsZCB_Node *psZCBCurrentNode = &psNetwork->sNodes;
     int iNodeFreeable = 0;
     
     /* lock the list mutex and node mutex in the same order as everywhere else to avoid deadlock */
     
     eUtils_LockUnlock(&psZCBNode->sLock);
     
-    eUtils_LockLock(&sZCB_Network.sLock);
+    eUtils_LockLock(&psNetwork->sLock);
     
     eUtils_LockLock(&psZCBNode->sLock);
 
-    if (psZCBNode == &sZCB_Network.sNodes)
+    if (psZCBNode == &psNetwork->sNodes)
     {
         eStatus = E_ZCB_OK;
         iNodeFreeable = 0;
@@ -271,6 +357,7 @@ teZcbStatus eZCB_RemoveNode(tsZCB_Node *psZCBNode)
                 DBG_PrintNode(psZCBNode);
                 
                 psZCBCurrentNode->psNext = psZCBCurrentNode->psNext->psNext;
+                vZCB_ShortAddressHashRemove(psNetwork, psZCBNode);
                 eStatus = E_ZCB_OK;
                 iNodeFreeable = 1;
                 break;
@@ -282,6 +369,13 @@ teZcbStatus eZCB_RemoveNode(tsZCB_Node *psZCBNode)
     if (eStatus == E_ZCB_OK)
     {
         int i, j;
+        
+        if (iNodeFreeable)
+        {
+            /* Interview the node again if it comes back */
+            (void)ePDM_InterviewForget(psZCBNode->u64IEEEAddress);
+        }
+        
         for (i = 0; i < psZCBNode->u32NumEndpoints; i++)
         {
             DBG_vPrintf(DBG_ZBNETWORK, "Free endpoint %d\n", psZCBNode->pasEndpoints[i].u8Endpoint);
@@ -301,6 +395,10 @@ teZcbStatus eZCB_RemoveNode(tsZCB_Node *psZCBNode)
         
         free(psZCBNode->pau16Groups);
         
+        /* Anything still bound to the node must not be reached through it */
+        psZCBNode->sBinding.pvNode      = NULL;
+        psZCBNode->sBinding.pvContext   = NULL;
+        
         /* Unlock the node first so that it may be free'd */
         eUtils_LockUnlock(&psZCBNode->sLock);
         eUtils_LockDestroy(&psZCBNode->sLock);
@@ -309,97 +407,69 @@ teZcbStatus eZCB_RemoveNode(tsZCB_Node *psZCBNode)
             free(psZCBNode);
         }
     }
-    eUtils_LockUnlock(&sZCB_Network.sLock);
+    eUtils_LockUnlock(&psNetwork->sLock);
     return eStatus;
 }
 
 
 tsZCB_Node *psZCB_FindNodeIEEEAddress(uint64_t u64IEEEAddress)
 {
-    tsZCB_Node *psZCBNode = &sZCB_Network.sNodes;
+    int iSelected = iZCB_ShardSelected();
+    tsZCB_Node *psZCBNode;
+    int iShard;
     
-    eUtils_LockLock(&sZCB_Network.sLock);
-
-    while (psZCBNode)
+    /* Most lookups are for nodes of the control bridge already selected */
+    psZCBNode = psZCB_NetworkFindIEEEAddress(&asZCB_Networks[iSelected], u64IEEEAddress);
+    
+    for (iShard = 0; (psZCBNode == NULL) && (iShard < iZCB_NumShards); iShard++)
     {
-        if (psZCBNode->u64IEEEAddress == u64IEEEAddress)
+        if (iShard != iSelected)
         {
-            int iLockAttempts = 0;
-            
-            DBG_vPrintf(DBG_ZBNETWORK, "IEEE address 0x%016llX found in network\n", (unsigned long long int)u64IEEEAddress);
-            DBG_PrintNode(psZCBNode);
-            
-            while (++iLockAttempts < 5)
-            {
-                if (eUtils_LockLock(&psZCBNode->sLock) == E_UTILS_OK)
-                {
-                    break;
-                }
-                else
-                {
-                    eUtils_LockUnlock(&sZCB_Network.sLock);
-                    
-                    if (iLockAttempts == 5)
-                    {
-                        daemon_log(LOG_ERR, "\n\nError: Could not get lock on node!!\n");
-                        return NULL;
-                    }
-                    
-                    usleep(1000000);
-                    eUtils_LockLock(&sZCB_Network.sLock);
-                }
-            }
-            break;
+            psZCBNode = psZCB_NetworkFindIEEEAddress(&asZCB_Networks[iShard], u64IEEEAddress);
         }
-        psZCBNode = psZCBNode->psNext;
     }
-    
-    eUtils_LockUnlock(&sZCB_Network.sLock);
     return psZCBNode;
 }
 
 
 tsZCB_Node *psZCB_FindNodeShortAddress(uint16_t u16ShortAddress)
 {
-    tsZCB_Node *psZCBNode = &sZCB_Network.sNodes;
+    tsZCB_Network *psNetwork = &sZCB_Network;
+    tsZCB_Node *psZCBNode;
     
-    eUtils_LockLock(&sZCB_Network.sLock);
+    eUtils_LockLock(&psNetwork->sLock);
 
-    while (psZCBNode)
+    psZCBNode = psZCB_ShortAddressHashFind(psNetwork, u16ShortAddress);
+    if (psZCBNode)
     {
-        if (psZCBNode->u16ShortAddress == u16ShortAddress)
+        int iLockAttempts = 0;
+        
+        DBG_vPrintf(DBG_ZBNETWORK, "Short address 0x%04X found in network\n", u16ShortAddress);
+        DBG_PrintNode(psZCBNode);
+        
+        while (++iLockAttempts < 5)
         {
-            int iLockAttempts = 0;
-            
-            DBG_vPrintf(DBG_ZBNETWORK, "Short address 0x%04X found in network\n", u16ShortAddress);
-            DBG_PrintNode(psZCBNode);
-            
-            while (++iLockAttempts < 5)
+            if (eUtils_LockLock(&psZCBNode->sLock) == E_UTILS_OK)
             {
-                if (eUtils_LockLock(&psZCBNode->sLock) == E_UTILS_OK)
-                {
-                    break;
-                }
-                else
+                break;
+            }
+            else
+            {
+                eUtils_LockUnlock(&psNetwork->sLock);
+                
+                if (iLockAttempts == 5)
                 {
-                    eUtils_LockUnlock(&sZCB_Network.sLock);
-                    
-                    if (iLockAttempts == 5)
-                    {
-                        daemon_log(LOG_ERR, "\n\nError: Could not get lock on node!!\n");
-                        return NULL;
-                    }
-                    
-                    usleep(1000000);
-                    eUtils_LockLock(&sZCB_Network.sLock);
+                    daemon_log(LOG_ERR, "\n\nError: Could not get lock on node!!\n");
+                    return NULL;
                 }
+                
+                usleep(1000000);
+                eUtils_LockLock(&psNetwork->sLock);
             }
-            break;
         }
-        psZCBNode = psZCBNode->psNext;
     }
     
-    eUtils_LockUnlock(&sZCB_Network.sLock);
+    eUtils_LockUnlock(&psNetwork->sLock);
     return psZCBNode;
 }
 
@@ -716,10 +786,13 @@ void vZCB_NodeUpdateComms(tsZCB_Node *psZCBNode, teZcbStatus eStatus)
     {
         gettimeofday(&psZCBNode->sComms.sLastSuccessful, NULL);
         psZCBNode->sComms.u16SequentialFailures = 0;
+        psZCBNode->sComms.u16Reliability += (0xFFFF - psZCBNode->sComms.u16Reliability) >> ZCB_DELIVERY_RELIABILITY_SHIFT;
+        psZCBNode->bUnverified = 0;
     }
     else if (eStatus == E_ZCB_COMMS_FAILED)
     {
         psZCBNode->sComms.u16SequentialFailures++;
+        psZCBNode->sComms.u16Reliability -= psZCBNode->sComms.u16Reliability >> ZCB_DELIVERY_RELIABILITY_SHIFT;
     }
     else
     {
@@ -742,6 +815,148 @@ void vZCB_NodeUpdateComms(tsZCB_Node *psZCBNode, teZcbStatus eStatus)
 }
 
 
+
+void vZCB_NodeDeliveryPolicy(tsZCB_Node *psZCBNode, teZcbDeliveryClass eClass, tsZcbDeliveryPolicy *psPolicy)
+{
+    int bReliable, bVeryReliable, bGone, bAck;
+    
+    psPolicy->u16ShortAddress   = psZCBNode->u16ShortAddress;
+    psPolicy->eClass            = eClass;
+    
+    if (!bZCB_AdaptiveDelivery)
+    {
+        psPolicy->u8AddressMode = bZCB_EnableAPSAck ? E_ZB_ADDRESS_MODE_SHORT : E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
+        psPolicy->u16TimeoutMs  = ZCB_DELIVERY_TIMEOUT_MS;
+        psPolicy->u8Retries     = 0;
+        goto done;
+    }
+    
+    bGone           = psZCBNode->sComms.u16SequentialFailures >= ZCB_DELIVERY_GONE_FAILURES;
+    bReliable       = (psZCBNode->sComms.u16SequentialFailures == 0) &&
+                      (psZCBNode->sComms.u16Reliability >= ZCB_DELIVERY_RELIABLE) &&
+                      ((psZCBNode->sComms.u8LQI == 0) || (psZCBNode->sComms.u8LQI >= ZCB_DELIVERY_POOR_LQI));
+    bVeryReliable   = bReliable && (psZCBNode->sComms.u16Reliability >= ZCB_DELIVERY_VERY_RELIABLE);
+    
+    switch (eClass)
+    {
+        case (E_ZCB_DELIVERY_CONFIGURE):
+            bAck = !bVeryReliable;
+            break;
+            
+        case (E_ZCB_DELIVERY_CONTROL):
+        case (E_ZCB_DELIVERY_QUERY):
+        default:
+            bAck = !bReliable;
+            break;
+    }
+    
+    if (bGone)
+    {
+        /* Don't hold up other nodes with the stack's retries for one that has most likely left */
+        bAck = 0;
+    }
+    
+    if (bZCB_EnableAPSAck)
+    {
+        bAck = 1;
+    }
+    
+    psPolicy->u8AddressMode = bAck ? E_ZB_ADDRESS_MODE_SHORT : E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
+    psPolicy->u16TimeoutMs  = bAck ? ZCB_DELIVERY_ACK_TIMEOUT_MS : ZCB_DELIVERY_TIMEOUT_MS;
+    psPolicy->u8Retries     = ((eClass == E_ZCB_DELIVERY_CONTROL) && !bGone) ? 1 : 0;
+    
+    if ((eClass == E_ZCB_DELIVERY_CONTROL) &&
+        (psPolicy->u16TimeoutMs * (psPolicy->u8Retries + 1) > ZCB_DELIVERY_COMMAND_BUDGET_MS))
+    {
+        /* Share the budget between the attempts, so that a command sent again
+         * takes no longer than one sent once */
+        psPolicy->u16TimeoutMs = ZCB_DELIVERY_COMMAND_BUDGET_MS / (psPolicy->u8Retries + 1);
+    }
+    
+done:
+    if (psPolicy->u8AddressMode == E_ZB_ADDRESS_MODE_SHORT)
+    {
+        __sync_add_and_fetch(&sDeliveryStats.au32Ack[eClass], 1);
+    }
+    else
+    {
+        __sync_add_and_fetch(&sDeliveryStats.au32NoAck[eClass], 1);
+    }
+    DBG_vPrintf(DBG_ZBNETWORK, "Node 0x%04X: deliver %s %s ack, timeout %dms, %d retries (reliability 0x%04X, LQI %d, failures %d)\n",
+                psZCBNode->u16ShortAddress, apcDeliveryClassNames[eClass],
+                psPolicy->u8AddressMode == E_ZB_ADDRESS_MODE_SHORT ? "with" : "without",
+                psPolicy->u16TimeoutMs, psPolicy->u8Retries, psZCBNode->sComms.u16Reliability,
+                psZCBNode->sComms.u8LQI, psZCBNode->sComms.u16SequentialFailures);
+}
+
+
+void vZCB_NodeDeliveryRecord(tsZCB_Node *psZCBNode, tsZcbDeliveryPolicy *psPolicy, uint8_t u8Attempts, teZcbStatus eStatus)
+{
+    tsZCB_Node *psLockedNode = NULL;
+    
+    if (u8Attempts > 1)
+    {
+        __sync_add_and_fetch(&sDeliveryStats.u32Retries, u8Attempts - 1);
+    }
+    if (eStatus != E_ZCB_OK)
+    {
+        __sync_add_and_fetch(&sDeliveryStats.u32Failed, 1);
+    }
+    else if (u8Attempts > 1)
+    {
+        __sync_add_and_fetch(&sDeliveryStats.u32Retried, 1);
+    }
+    else
+    {
+        __sync_add_and_fetch(&sDeliveryStats.u32FirstTime, 1);
+    }
+    
+    if (u8Attempts <= 1)
+    {
+        return;
+    }
+    
+    if (!psZCBNode)
+    {
+        psZCBNode = psLockedNode = psZCB_FindNodeShortAddress(psPolicy->u16ShortAddress);
+        if (!psZCBNode)
+        {
+            return;
+        }
+    }
+    
+    /* The last attempt is counted by whoever takes the result. Count the ones before */
+    while (--u8Attempts)
+    {
+        vZCB_NodeUpdateComms(psZCBNode, E_ZCB_COMMS_FAILED);
+    }
+    
+    if (psLockedNode)
+    {
+        eUtils_LockUnlock(&psLockedNode->sLock);
+    }
+}
+
+
+void vZCB_DeliveryStatsDump(FILE *psStream)
+{
+    char acName[64];
+    int i;
+    
+    fprintf(psStream, "# Delivery to nodes\n");
+    for (i = 0; i < E_ZCB_DELIVERY_NUM; i++)
+    {
+        snprintf(acName, sizeof(acName), "Sent %s with APS ack", apcDeliveryClassNames[i]);
+        fprintf(psStream, "%-40s %10u\n", acName, sDeliveryStats.au32Ack[i]);
+        snprintf(acName, sizeof(acName), "Sent %s without APS ack", apcDeliveryClassNames[i]);
+        fprintf(psStream, "%-40s %10u\n", acName, sDeliveryStats.au32NoAck[i]);
+    }
+    fprintf(psStream, "%-40s %10u\n", "Commands answered first time",    sDeliveryStats.u32FirstTime);
+    fprintf(psStream, "%-40s %10u\n", "Commands answered after retry",   sDeliveryStats.u32Retried);
+    fprintf(psStream, "%-40s %10u\n", "Commands not answered",           sDeliveryStats.u32Failed);
+    fprintf(psStream, "%-40s %10u\n", "Command retries",                 sDeliveryStats.u32Retries);
+}
+
 tsZCB_Node *psZCB_NodeOldestComms(void)
 {
     tsZCB_Node *psZCBNode = &sZCB_Network.sNodes;
@@ -779,6 +994,103 @@ tsZCB_Node *psZCB_NodeOldestComms(void)
 /***        Local Functions                                               ***/
 /****************************************************************************/
 
+/** Find a locked node by IEEE address in a network */
+static tsZCB_Node *psZCB_NetworkFindIEEEAddress(tsZCB_Network *psNetwork, uint64_t u64IEEEAddress)
+{
+    tsZCB_Node *psZCBNode = &psNetwork->sNodes;
+    
+    eUtils_LockLock(&psNetwork->sLock);
+
+    while (psZCBNode)
+    {
+        if (psZCBNode->u64IEEEAddress == u64IEEEAddress)
+        {
+            int iLockAttempts = 0;
+            
+            DBG_vPrintf(DBG_ZBNETWORK, "IEEE address 0x%016llX found in network\n", (unsigned long long int)u64IEEEAddress);
+            DBG_PrintNode(psZCBNode);
+            
+            while (++iLockAttempts < 5)
+            {
+                if (eUtils_LockLock(&psZCBNode->sLock) == E_UTILS_OK)
+                {
+                    break;
+                }
+                else
+                {
+                    eUtils_LockUnlock(&psNetwork->sLock);
+                    
+                    if (iLockAttempts == 5)
+                    {
+                        daemon_log(LOG_ERR, "\n\nError: Could not get lock on node!!\n");
+                        return NULL;
+                    }
+                    
+                    usleep(1000000);
+                    eUtils_LockLock(&psNetwork->sLock);
+                }
+            }
+            break;
+        }
+        psZCBNode = psZCBNode->psNext;
+    }
+    
+    eUtils_LockUnlock(&psNetwork->sLock);
+    return psZCBNode;
+}
+
+
+/** Add a node to the short address hash. Network lock must be held */
+static void vZCB_ShortAddressHashAdd(tsZCB_Network *psNetwork, tsZCB_Node *psZCBNode)
+{
+    tsZCB_Node **ppsBucket = &psNetwork->apsShortAddressHash[ZCB_SHORT_ADDRESS_BUCKET(psZCBNode->u16ShortAddress)];
+    
+    psZCBNode->psNextShortAddress = *ppsBucket;
+    *ppsBucket = psZCBNode;
+}
+
+
+/** Remove a node from the short address hash. Network lock must be held */
+static void vZCB_ShortAddressHashRemove(tsZCB_Network *psNetwork, tsZCB_Node *psZCBNode)
+{
+    tsZCB_Node **ppsZCBNode = &psNetwork->apsShortAddressHash[ZCB_SHORT_ADDRESS_BUCKET(psZCBNode->u16ShortAddress)];
+    
+    while (*ppsZCBNode)
+    {
+        if (*ppsZCBNode == psZCBNode)
+        {
+            *ppsZCBNode = psZCBNode->psNextShortAddress;
+            psZCBNode->psNextShortAddress = NULL;
+            return;
+        }
+        ppsZCBNode = &(*ppsZCBNode)->psNextShortAddress;
+    }
+}
+
+
+/** Find a node by short address, the control bridge first. Network lock must be held */
+static tsZCB_Node *psZCB_ShortAddressHashFind(tsZCB_Network *psNetwork, uint16_t u16ShortAddress)
+{
+    tsZCB_Node *psZCBNode;
+    
+    if (psNetwork->sNodes.u16ShortAddress == u16ShortAddress)
+    {
+        return &psNetwork->sNodes;
+    }
+    
+    psZCBNode = psNetwork->apsShortAddressHash[ZCB_SHORT_ADDRESS_BUCKET(u16ShortAddress)];
+    while (psZCBNode)
+    {
+        if (psZCBNode->u16ShortAddress == u16ShortAddress)
+        {
+            break;
+        }
+        psZCBNode = psZCBNode->psNextShortAddress;
+    }
+    return psZCBNode;
+}
+
+
 static uint32_t u32TimevalDiff(struct timeval *psStartTime, struct timeval *psFinishTime)
 {
     uint32_t u32MSec;
@@ -47,6 +47,7 @@ extern "C" {
 /***        Include files                                                 ***/
 /****************************************************************************/
 
+#include <stdio.h>
 #include <stdint.h>
 
 #include "ZigbeeControlBridge.h"
@@ -55,6 +56,33 @@ extern "C" {
 /***        Macro Definitions                                             ***/
 /****************************************************************************/
 
+/** Number of buckets in the short address hash. Must be a power of 2 */
+#define ZCB_NETWORK_SHORT_ADDRESS_BUCKETS   256
+
+/** Time to wait for a node's response to a request sent without APS ack (ms) */
+#define ZCB_DELIVERY_TIMEOUT_MS             1000
+
+/** Time to wait for a node's response to a request sent with APS ack, long enough
+ *  for the stack to send the request again while waiting for its ack (ms) */
+#define ZCB_DELIVERY_ACK_TIMEOUT_MS         3500
+
+/** Longest time to wait for a node's responses to a command over all its attempts: a
+ *  command sent without APS ack and once more if unanswered, each waited for in full.
+ *  A command sent with APS ack is waited for less per attempt to fit (ms) */
+#define ZCB_DELIVERY_COMMAND_BUDGET_MS      (2 * ZCB_DELIVERY_TIMEOUT_MS)
+
+/** Proportion of requests a node must answer, of 0xFFFF, for it to be sent commands without APS ack */
+#define ZCB_DELIVERY_RELIABLE               0xE666
+
+/** Proportion of requests a node must answer, of 0xFFFF, for it to be sent configuration without APS ack */
+#define ZCB_DELIVERY_VERY_RELIABLE          0xFD70
+
+/** Link quality below which a node is sent commands with APS ack */
+#define ZCB_DELIVERY_POOR_LQI               64
+
+/** Number of sequential failures after which a node is taken to have gone, and is not retried */
+#define ZCB_DELIVERY_GONE_FAILURES          3
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
@@ -66,6 +94,10 @@ typedef struct
     
     tsZCB_Node              sNodes;             /**< Linked list of nodes.
                                                  *   The head is the control bridge */
+    
+    tsZCB_Node              *apsShortAddressHash[ZCB_NETWORK_SHORT_ADDRESS_BUCKETS];
+                                                /**< Nodes after the head, hashed by short address.
+                                                 *   Protected by sLock, as is the list */
 } tsZCB_Network;
 
 /****************************************************************************/
@@ -76,7 +108,11 @@ typedef struct
 /***        Exported Variables                                            ***/
 /****************************************************************************/
 
-extern tsZCB_Network sZCB_Network;
+/** Network of each control bridge */
+extern tsZCB_Network asZCB_Networks[ZCB_MAX_SHARDS];
+
+/** Network of the control bridge selected by the calling thread */
+#define sZCB_Network (asZCB_Networks[iZCB_ShardSelected()])
     
 
 /****************************************************************************/
@@ -99,6 +135,37 @@ teZcbStatus eZCB_NodeAddGroup(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress);
 
 void        vZCB_NodeUpdateComms(tsZCB_Node *psZCBNode, teZcbStatus eStatus);
 
+/** Choose how to deliver a request to a node from how reliably it has answered requests
+ *  before, as counted by \ref vZCB_NodeUpdateComms, and the quality of its link.
+ *  A node that answers reliably is sent commands without APS ack, saving the ack frame
+ *  and the retries of the stack, and a command that goes unanswered is sent once more.
+ *  A node that has been missing responses, or has a poor link, is sent with APS ack, and
+ *  configuration and queries to it are waited for longer. A node that has failed
+ *  \ref ZCB_DELIVERY_GONE_FAILURES times in a row is sent without APS ack and not retried,
+ *  so that a node that has gone does not hold up the rest.
+ *  Configuration is sent with APS ack unless the node is very reliable, and queries,
+ *  whose response shows they were delivered, only to a node that is not reliable.
+ *  Only commands are retried, by their sender; other requests are retried by their callers.
+ *  The wait for each attempt at a command sent with APS ack is shortened so that all of
+ *  its attempts fit in \ref ZCB_DELIVERY_COMMAND_BUDGET_MS.
+ *  \param psZCBNode        Locked node the request is to
+ *  \param eClass           Class of the request
+ *  \param psPolicy         Filled in with how to deliver it
+ */
+void        vZCB_NodeDeliveryPolicy(tsZCB_Node *psZCBNode, teZcbDeliveryClass eClass, tsZcbDeliveryPolicy *psPolicy);
+
+/** Count the result of delivering a command by its policy, and count each attempt
+ *  that went unanswered before it against the node.
+ *  \param psZCBNode        Locked node the command was sent to, or NULL to find it by its short address
+ *  \param psPolicy         Policy the command was sent by
+ *  \param u8Attempts       Number of times it was sent
+ *  \param eStatus          Status of the last attempt
+ */
+void        vZCB_NodeDeliveryRecord(tsZCB_Node *psZCBNode, tsZcbDeliveryPolicy *psPolicy, uint8_t u8Attempts, teZcbStatus eStatus);
+
+/** Write statistics of delivering requests to nodes to a stream as text */
+void        vZCB_DeliveryStatsDump(FILE *psStream);
+
 /** Find the first endpoint on a node that contains a cluster ID.
  *  \param psZCBNode        Pointer to node to search
  *  \param u16ClusterID     Cluster ID of interest
@@ -43,10 +43,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include <sqlite3.h>
 #include <libdaemon/daemon.h>
 
 #include "ZigbeePDM.h"
+#include "ZigbeeNetwork.h"
 #include "SerialLink.h"
 #include "Utils.h"
 
@@ -57,10 +60,67 @@
 #define DBG_PDM 0
 #define DBG_SQL 0
 
+#define PDM_BLOCK_SIZE 128
+
+/** A transaction is committed after this long even if the record being saved is never completed */
+#define PDM_TRANSACTION_TIMEOUT_MS  1000
+
+/** Interval at which the flush thread checks for a transaction due to be committed */
+#define PDM_FLUSH_POLL_MS           20
+
+/** A debounced commit is never put off for longer than this many debounce times */
+#define PDM_DEBOUNCE_MAX_FACTOR     4
+
+/** Version of the node descriptions kept in the interview cache. Descriptions of
+ *  any other version are ignored, so the nodes are interviewed again */
+#define PDM_INTERVIEW_VERSION       1
+
+/** Key of a record of a control bridge. Each control bridge's records are kept apart in the
+ *  upper bits of the id by its key in the bridge table, leaving the records of the first
+ *  control bridge ever used, key 0, as they always were */
+#define PDM_RECORD_KEY(iBridgeKey, u16RecordID) (((iBridgeKey) << 16) | (u16RecordID))
+
 /****************************************************************************/
 /***        Type Definitions                                              ***/
 /****************************************************************************/
 
+/** Statements prepared once when the database is opened */
+typedef enum
+{
+    E_PDM_STATEMENT_BEGIN,
+    E_PDM_STATEMENT_COMMIT,
+    E_PDM_STATEMENT_ROLLBACK,
+    E_PDM_STATEMENT_RECORD_BEGIN,
+    E_PDM_STATEMENT_RECORD_END,
+    E_PDM_STATEMENT_RECORD_ROLLBACK,
+    E_PDM_STATEMENT_LOAD,
+    E_PDM_STATEMENT_SAVE,
+    E_PDM_STATEMENT_TRIM,
+    E_PDM_STATEMENT_DELETE_ALL,
+    E_PDM_STATEMENT_INTERVIEW_LOAD,
+    E_PDM_STATEMENT_INTERVIEW_SAVE,
+    E_PDM_STATEMENT_INTERVIEW_FORGET,
+    E_PDM_STATEMENT_INTERVIEW_FORGET_ALL,
+    E_PDM_STATEMENT_COUNT,
+} tePDMStatement;
+
+/** Buffer a node description is written to or read from */
+typedef struct
+{
+    uint8_t     *pu8Data;
+    uint32_t    u32Length;
+    uint32_t    u32Position;
+} tsPDMBuffer;
+
+/** Row of the interview cache, read before the nodes are restored from it */
+typedef struct
+{
+    uint64_t    u64IEEEAddress;
+    uint16_t    u16ShortAddress;
+    uint16_t    u16DeviceID;
+    uint8_t     u8MacCapability;
+    tsPDMBuffer sDescription;
+} tsPDMInterviewRow;
 
 /****************************************************************************/
 /***        Local Function Prototypes                                     ***/
@@ -71,10 +131,32 @@ static void PDM_HandleLoadRequest           (void *pvUser, uint16_t u16Length, v
 static void PDM_HandleSaveRequest           (void *pvUser, uint16_t u16Length, void *pvMessage);
 static void PDM_HandleDeleteAllRequest      (void *pvUser, uint16_t u16Length, void *pvMessage);
 
+static teZcbStatus PDM_BridgeKeysLoad       (void);
+static int PDM_QueryInt                     (const char *pcSQL, const char *pcText, int *piValue);
+static int PDM_Execute                      (tePDMStatement eStatement);
+static teZcbStatus PDM_TransactionBegin     (void);
+static teZcbStatus PDM_TransactionCommit    (void);
+static void PDM_TransactionRollback         (void);
+static teZcbStatus PDM_RecordBegin          (int iRecordKey);
+static void PDM_RecordEnd                   (void);
+static void PDM_RecordRollback              (void);
+static uint64_t PDM_TimeNow                 (void);
+static void *PDM_FlushThread                (tsUtilsThread *psThreadInfo);
+
+static uint32_t PDM_InterviewEncode         (tsZCB_Node *psZCBNode, tsPDMBuffer *psBuffer);
+static teZcbStatus PDM_InterviewDecode      (tsZCB_Node *psZCBNode, tsPDMBuffer *psBuffer);
+static void PDM_Put8                        (tsPDMBuffer *psBuffer, uint8_t u8Value);
+static void PDM_Put16                       (tsPDMBuffer *psBuffer, uint16_t u16Value);
+static int PDM_Get8                         (tsPDMBuffer *psBuffer, uint8_t *pu8Value);
+static int PDM_Get16                        (tsPDMBuffer *psBuffer, uint16_t *pu16Value);
+
 /****************************************************************************/
 /***        Exported Variables                                            ***/
 /****************************************************************************/
 
+uint32_t u32PDM_DebounceMs = 0;
+
+int bPDM_InterviewCache = 1;
 
 /****************************************************************************/
 /***        Local Variables                                               ***/
@@ -83,14 +165,74 @@ static void PDM_HandleDeleteAllRequest      (void *pvUser, uint16_t u16Length, v
 static sqlite3 *pDb = NULL;
 static tsUtilsLock sLock;
 
+/** Key of each control bridge in \ref asZCB_Shards in the bridge table. Each control bridge's
+ *  listeners are given its key, and its nodes' rows in the interview cache are tagged with it */
+static int aiBridgeKeys[ZCB_MAX_SHARDS];
+
+static const char *apcStatementSQL[E_PDM_STATEMENT_COUNT] =
+{
+    [E_PDM_STATEMENT_BEGIN]         = "BEGIN",
+    [E_PDM_STATEMENT_COMMIT]        = "COMMIT",
+    [E_PDM_STATEMENT_ROLLBACK]      = "ROLLBACK",
+    [E_PDM_STATEMENT_RECORD_BEGIN]      = "SAVEPOINT record",
+    [E_PDM_STATEMENT_RECORD_END]        = "RELEASE record",
+    [E_PDM_STATEMENT_RECORD_ROLLBACK]   = "ROLLBACK TO record",
+    [E_PDM_STATEMENT_LOAD]          = "SELECT size,numblocks,block,blocksize,data FROM pdm WHERE id=?1 ORDER BY block",
+    [E_PDM_STATEMENT_SAVE]          = "INSERT OR REPLACE INTO pdm (id,size,numblocks,block,blocksize,data) VALUES (?1,?2,?3,?4,?5,?6)",
+    [E_PDM_STATEMENT_TRIM]          = "DELETE FROM pdm WHERE id=?1 AND block>?2",
+    [E_PDM_STATEMENT_DELETE_ALL]    = "DELETE FROM pdm WHERE (id>>16)=?1",
+    [E_PDM_STATEMENT_INTERVIEW_LOAD]        = "SELECT ieee,shortaddress,deviceid,maccapability,description FROM interview WHERE shard=?1",
+    [E_PDM_STATEMENT_INTERVIEW_SAVE]        = "INSERT OR REPLACE INTO interview (ieee,shortaddress,deviceid,maccapability,description,shard) VALUES (?1,?2,?3,?4,?5,?6)",
+    [E_PDM_STATEMENT_INTERVIEW_FORGET]      = "DELETE FROM interview WHERE ieee=?1",
+    [E_PDM_STATEMENT_INTERVIEW_FORGET_ALL]  = "DELETE FROM interview WHERE shard=?1",
+};
+
+/** Tables created when the database is opened. The interview cache keeps what was learnt
+ *  about each node by interviewing it, keyed by IEEE address, with the key of the control
+ *  bridge whose network it is in. The bridge table gives each control bridge a key by the
+ *  serial device it is connected to, so that its records stay its own whatever order the
+ *  control bridges are given in */
+static const char *apcTableDefs[] =
+{
+    "CREATE TABLE IF NOT EXISTS pdm (id INTEGER, size INTEGER, numblocks INTEGER, block INTEGER, blocksize INTEGER, data BLOB, PRIMARY KEY (id,block))",
+    "CREATE TABLE IF NOT EXISTS interview (ieee INTEGER PRIMARY KEY, shortaddress INTEGER, deviceid INTEGER, maccapability INTEGER, description BLOB, shard INTEGER DEFAULT 0)",
+    "CREATE TABLE IF NOT EXISTS bridge (id INTEGER PRIMARY KEY, device TEXT UNIQUE)",
+};
+
+/** Changes to tables made by earlier versions. Each fails harmlessly once it has been made */
+static const char *apcTableUpgrades[] =
+{
+    "ALTER TABLE interview ADD COLUMN shard INTEGER DEFAULT 0",
+};
+
+static sqlite3_stmt *apsStatements[E_PDM_STATEMENT_COUNT];
+
+/** Blocks are saved into a transaction that is kept open until the record is complete, or
+ *  with debouncing, until the record stops being rewritten. The blocks of the record being
+ *  saved are also within a savepoint, so that a record that fails is discarded without the
+ *  records saved before it. All protected by sLock. */
+static struct
+{
+    int         iOpen;              /**< Set while a transaction is open */
+    uint64_t    u64StartTime;       /**< Time the transaction was opened (ms) */
+    uint64_t    u64CommitTime;      /**< Time the flush thread should commit it (ms) */
+    int         iRecordOpen;        /**< Set while a record's savepoint is open */
+    int         iRecordKey;         /**< Key of the record, as PDM_RECORD_KEY */
+} sTransaction;
+
+static tsUtilsThread sFlushThread;
+
 /****************************************************************************/
 /***        Exported Functions                                            ***/
 /****************************************************************************/
 
 teZcbStatus ePDM_Init(char *pcPDMFile)
 {
+    int iSelected;
+    int i;
+    
     DBG_vPrintf(DBG_PDM, "Create database lock\n");
-    eUtils_LockCreate(&sLock);
+    eUtils_LockCreateHere(&sLock);
     
     if (strcmp(pcPDMFile, "disabled") == 0)
     {
@@ -100,20 +242,41 @@ teZcbStatus ePDM_Init(char *pcPDMFile)
     
     eUtils_LockLock(&sLock);
     
-    if (sqlite3_open_v2(pcPDMFile, &pDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK)
+    /* All access to the database is serialised by sLock, so sqlite's own mutexes aren't needed */
+    if (sqlite3_open_v2(pcPDMFile, &pDb, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK)
     { 
         daemon_log(LOG_ERR, "Error initialising PDM database (%s)", sqlite3_errmsg(pDb));
+        sqlite3_close(pDb);
+        pDb = NULL;
+        eUtils_LockUnlock(&sLock);
         return E_ZCB_ERROR; 
     }     
     DBG_vPrintf(DBG_PDM, "PDM Database opened\n");
     
     {
-        const char *pcTableDef = "CREATE TABLE IF NOT EXISTS pdm (id INTEGER, size INTEGER, numblocks INTEGER, block INTEGER, blocksize INTEGER, data BLOB, PRIMARY KEY (id,block))";
+        /* With a write ahead log, a commit appends to the log and syncs it once, rather than
+         * syncing both a rollback journal and the database */
+        const char *pcJournalMode = "PRAGMA journal_mode=WAL";
+        sqlite3_stmt *psStatement;
+        
+        DBG_vPrintf(DBG_SQL, "Execute SQL: '%s'\n", pcJournalMode);
+        
+        if ((sqlite3_prepare_v2(pDb, pcJournalMode, -1, &psStatement, NULL) != SQLITE_OK) ||
+            (sqlite3_step(psStatement) != SQLITE_ROW) ||
+            (strcmp((const char *)sqlite3_column_text(psStatement, 0), "wal") != 0))
+        {
+            daemon_log(LOG_INFO, "PDM database could not use write ahead logging (%s)", sqlite3_errmsg(pDb));
+        }
+        sqlite3_finalize(psStatement);
+    }
+    
+    for (i = 0; i < sizeof(apcTableDefs) / sizeof(apcTableDefs[0]); i++)
+    {
         char *pcErr;
         
-        DBG_vPrintf(DBG_SQL, "Execute SQL: '%s'\n", pcTableDef);
+        DBG_vPrintf(DBG_SQL, "Execute SQL: '%s'\n", apcTableDefs[i]);
         
-        if (sqlite3_exec(pDb, pcTableDef, NULL, NULL, &pcErr) != SQLITE_OK)
+        if (sqlite3_exec(pDb, apcTableDefs[i], NULL, NULL, &pcErr) != SQLITE_OK)
         {
             daemon_log(LOG_ERR, "Error creating table (%s)", pcErr);
             sqlite3_free(pcErr);
@@ -121,12 +284,51 @@ teZcbStatus ePDM_Init(char *pcPDMFile)
             return E_ZCB_ERROR;
         }
     }
+    
+    for (i = 0; i < sizeof(apcTableUpgrades) / sizeof(apcTableUpgrades[0]); i++)
+    {
+        DBG_vPrintf(DBG_SQL, "Execute SQL: '%s'\n", apcTableUpgrades[i]);
+        (void)sqlite3_exec(pDb, apcTableUpgrades[i], NULL, NULL, NULL);
+    }
+    
+    for (i = 0; i < E_PDM_STATEMENT_COUNT; i++)
+    {
+        DBG_vPrintf(DBG_SQL, "Prepare SQL: '%s'\n", apcStatementSQL[i]);
+        
+        if (sqlite3_prepare_v2(pDb, apcStatementSQL[i], -1, &apsStatements[i], NULL) != SQLITE_OK)
+        {
+            daemon_log(LOG_ERR, "Error preparing PDM statement '%s' (%s)", apcStatementSQL[i], sqlite3_errmsg(pDb));
+            eUtils_LockUnlock(&sLock);
+            return E_ZCB_ERROR;
+        }
+    }
     DBG_vPrintf(DBG_PDM, "PDM Database initialised\n");
+    
+    if (PDM_BridgeKeysLoad() != E_ZCB_OK)
+    {
+        eUtils_LockUnlock(&sLock);
+        return E_ZCB_ERROR;
+    }
+
+    sFlushThread.pvThreadData = NULL;
+    if (eUtils_ThreadStart(PDM_FlushThread, &sFlushThread, E_THREAD_JOINABLE) != E_UTILS_OK)
+    {
+        daemon_log(LOG_ERR, "Failed to start PDM flush thread");
+        eUtils_LockUnlock(&sLock);
+        return E_ZCB_ERROR;
+    }
 
-    eSL_AddListener(E_SL_MSG_PDM_AVAILABLE_REQUEST,         PDM_HandleAvailableRequest,     NULL);
-    eSL_AddListener(E_SL_MSG_PDM_LOAD_RECORD_REQUEST,       PDM_HandleLoadRequest,          NULL);
-    eSL_AddListener(E_SL_MSG_PDM_SAVE_RECORD_REQUEST,       PDM_HandleSaveRequest,          NULL);
-    eSL_AddListener(E_SL_MSG_PDM_DELETE_ALL_RECORDS_REQUEST,PDM_HandleDeleteAllRequest,     NULL);
+    /* Every control bridge keeps its records in the one database */
+    iSelected = iZCB_ShardSelected();
+    for (i = 0; i < iZCB_NumShards; i++)
+    {
+        vZCB_ShardSelect(i);
+        eSL_AddListener(E_SL_MSG_PDM_AVAILABLE_REQUEST,         PDM_HandleAvailableRequest,     &aiBridgeKeys[i]);
+        eSL_AddListener(E_SL_MSG_PDM_LOAD_RECORD_REQUEST,       PDM_HandleLoadRequest,          &aiBridgeKeys[i]);
+        eSL_AddListener(E_SL_MSG_PDM_SAVE_RECORD_REQUEST,       PDM_HandleSaveRequest,          &aiBridgeKeys[i]);
+        eSL_AddListener(E_SL_MSG_PDM_DELETE_ALL_RECORDS_REQUEST,PDM_HandleDeleteAllRequest,     &aiBridgeKeys[i]);
+    }
+    vZCB_ShardSelect(iSelected);
     
     eUtils_LockUnlock(&sLock);
     return E_ZCB_OK;
@@ -135,10 +337,25 @@ teZcbStatus ePDM_Init(char *pcPDMFile)
 
 teZcbStatus ePDM_Destory(void)
 {
+    int i;
+    
+    if (sFlushThread.pvPriv)
+    {
+        eUtils_ThreadStop(&sFlushThread);
+    }
+    
     eUtils_LockLock(&sLock);
     if (pDb)
     {
+        (void)PDM_TransactionCommit();
+        
+        for (i = 0; i < E_PDM_STATEMENT_COUNT; i++)
+        {
+            sqlite3_finalize(apsStatements[i]);
+            apsStatements[i] = NULL;
+        }
         sqlite3_close(pDb);
+        pDb = NULL;
         DBG_vPrintf(DBG_PDM, "PDM Database closed\n");
     }
     eUtils_LockUnlock(&sLock);
@@ -147,6 +364,221 @@ teZcbStatus ePDM_Destory(void)
 }
 
 
+teZcbStatus ePDM_InterviewSave(tsZCB_Node *psZCBNode)
+{
+    sqlite3_stmt *psStatement = apsStatements[E_PDM_STATEMENT_INTERVIEW_SAVE];
+    teZcbStatus eStatus = E_ZCB_ERROR;
+    tsPDMBuffer sBuffer;
+    
+    if (!pDb || !bPDM_InterviewCache || (psZCBNode->u32NumEndpoints == 0) || (psZCBNode->u64IEEEAddress == 0))
+    {
+        return E_ZCB_OK;
+    }
+    
+    /* Size the description, then write it */
+    sBuffer.pu8Data     = NULL;
+    sBuffer.u32Length   = PDM_InterviewEncode(psZCBNode, NULL);
+    sBuffer.u32Position = 0;
+    sBuffer.pu8Data     = malloc(sBuffer.u32Length);
+    if (!sBuffer.pu8Data)
+    {
+        daemon_log(LOG_CRIT, "Memory allocation failure allocating node description");
+        return E_ZCB_ERROR_NO_MEM;
+    }
+    (void)PDM_InterviewEncode(psZCBNode, &sBuffer);
+    
+    eUtils_LockLock(&sLock);
+    
+    DBG_vPrintf(DBG_PDM, "Save interview of node 0x%04X (0x%016llX), %d bytes\n", 
+                psZCBNode->u16ShortAddress, (unsigned long long int)psZCBNode->u64IEEEAddress, sBuffer.u32Length);
+    
+    /* Saved along with any PDM records, and committed by the flush thread if nothing else does.
+     * Not within a record being saved, so it is kept if that record is discarded */
+    PDM_RecordEnd();
+    if (PDM_TransactionBegin() != E_ZCB_OK)
+    {
+        goto done;
+    }
+    
+    if ((sqlite3_bind_int64(psStatement, 1, (sqlite3_int64)psZCBNode->u64IEEEAddress)  != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,   2, psZCBNode->u16ShortAddress)                 != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,   3, psZCBNode->u16DeviceID)                     != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,   4, psZCBNode->u8MacCapability)                 != SQLITE_OK) ||
+        (sqlite3_bind_blob(psStatement,  5, sBuffer.pu8Data, sBuffer.u32Length, SQLITE_STATIC) != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,   6, aiBridgeKeys[psZCBNode->u8Shard])           != SQLITE_OK))
+    {
+        DBG_vPrintf(DBG_PDM, "error in bind : %s\n", sqlite3_errmsg(pDb));
+        goto done;
+    }
+    
+    if (PDM_Execute(E_PDM_STATEMENT_INTERVIEW_SAVE) == SQLITE_DONE)
+    {
+        eStatus = E_ZCB_OK;
+    }
+
+done:
+    sqlite3_clear_bindings(psStatement);
+    eUtils_LockUnlock(&sLock);
+    free(sBuffer.pu8Data);
+    return eStatus;
+}
+
+
+teZcbStatus ePDM_InterviewForget(uint64_t u64IEEEAddress)
+{
+    teZcbStatus eStatus = E_ZCB_ERROR;
+    
+    /* Nodes are removed from the network at shutdown after the database is closed, and must stay cached */
+    if (!pDb || !bPDM_InterviewCache || (u64IEEEAddress == 0))
+    {
+        return E_ZCB_OK;
+    }
+    
+    eUtils_LockLock(&sLock);
+    
+    DBG_vPrintf(DBG_PDM, "Forget interview of node 0x%016llX\n", (unsigned long long int)u64IEEEAddress);
+    
+    PDM_RecordEnd();
+    if ((PDM_TransactionBegin() == E_ZCB_OK) &&
+        (sqlite3_bind_int64(apsStatements[E_PDM_STATEMENT_INTERVIEW_FORGET], 1, (sqlite3_int64)u64IEEEAddress) == SQLITE_OK) &&
+        (PDM_Execute(E_PDM_STATEMENT_INTERVIEW_FORGET) == SQLITE_DONE))
+    {
+        eStatus = E_ZCB_OK;
+    }
+    
+    eUtils_LockUnlock(&sLock);
+    return eStatus;
+}
+
+
+teZcbStatus ePDM_InterviewRestore(uint32_t *pu32NumNodes, uint16_t **ppau16ShortAddresses)
+{
+    sqlite3_stmt *psStatement = apsStatements[E_PDM_STATEMENT_INTERVIEW_LOAD];
+    tsPDMInterviewRow *pasRows = NULL;
+    uint32_t u32NumRows = 0;
+    uint16_t *pau16ShortAddresses = NULL;
+    uint32_t u32NumNodes = 0;
+    teZcbStatus eStatus = E_ZCB_OK;
+    int iResult;
+    uint32_t i;
+    
+    *pu32NumNodes           = 0;
+    *ppau16ShortAddresses   = NULL;
+    
+    if (!pDb || !bPDM_InterviewCache)
+    {
+        return E_ZCB_OK;
+    }
+    
+    /* Read the whole cache of the selected control bridge first, so the database isn't locked while nodes are */
+    eUtils_LockLock(&sLock);
+    sqlite3_bind_int(psStatement, 1, aiBridgeKeys[iZCB_ShardSelected()]);
+    while ((iResult = sqlite3_step(psStatement)) == SQLITE_ROW)
+    {
+        tsPDMInterviewRow *pasNewRows = realloc(pasRows, sizeof(tsPDMInterviewRow) * (u32NumRows + 1));
+        tsPDMInterviewRow *psRow;
+        
+        if (!pasNewRows)
+        {
+            daemon_log(LOG_CRIT, "Memory allocation failure reading interview cache");
+            eStatus = E_ZCB_ERROR_NO_MEM;
+            break;
+        }
+        pasRows = pasNewRows;
+        psRow = &pasRows[u32NumRows];
+        
+        psRow->u64IEEEAddress               = (uint64_t)sqlite3_column_int64(psStatement, 0);
+        psRow->u16ShortAddress              = sqlite3_column_int(psStatement, 1);
+        psRow->u16DeviceID                  = sqlite3_column_int(psStatement, 2);
+        psRow->u8MacCapability              = sqlite3_column_int(psStatement, 3);
+        psRow->sDescription.u32Length       = sqlite3_column_bytes(psStatement, 4);
+        psRow->sDescription.u32Position     = 0;
+        psRow->sDescription.pu8Data         = malloc(psRow->sDescription.u32Length + 1);
+        if (!psRow->sDescription.pu8Data)
+        {
+            daemon_log(LOG_CRIT, "Memory allocation failure reading interview cache");
+            eStatus = E_ZCB_ERROR_NO_MEM;
+            break;
+        }
+        memcpy(psRow->sDescription.pu8Data, sqlite3_column_blob(psStatement, 4), psRow->sDescription.u32Length);
+        u32NumRows++;
+    }
+    if ((eStatus == E_ZCB_OK) && (iResult != SQLITE_DONE))
+    {
+        daemon_log(LOG_ERR, "Error reading interview cache (%s)", sqlite3_errmsg(pDb));
+        eStatus = E_ZCB_ERROR;
+    }
+    sqlite3_reset(psStatement);
+    eUtils_LockUnlock(&sLock);
+    
+    if ((eStatus == E_ZCB_OK) && (u32NumRows > 0))
+    {
+        pau16ShortAddresses = malloc(sizeof(uint16_t) * u32NumRows);
+        if (!pau16ShortAddresses)
+        {
+            daemon_log(LOG_CRIT, "Memory allocation failure restoring nodes");
+            eStatus = E_ZCB_ERROR_NO_MEM;
+        }
+    }
+    
+    for (i = 0; (eStatus == E_ZCB_OK) && (i < u32NumRows); i++)
+    {
+        tsPDMInterviewRow *psRow = &pasRows[i];
+        tsZCB_Node *psZCBNode;
+        
+        /* Whatever the control bridge has told us about since it started is more up to date */
+        psZCBNode = psZCB_FindNodeIEEEAddress(psRow->u64IEEEAddress);
+        if (!psZCBNode)
+        {
+            psZCBNode = psZCB_FindNodeShortAddress(psRow->u16ShortAddress);
+        }
+        if (psZCBNode)
+        {
+            DBG_vPrintf(DBG_PDM, "Node 0x%04X (0x%016llX) is already known\n", 
+                        psRow->u16ShortAddress, (unsigned long long int)psRow->u64IEEEAddress);
+            eUtils_LockUnlock(&psZCBNode->sLock);
+            continue;
+        }
+        
+        if (eZCB_AddNode(psRow->u16ShortAddress, psRow->u64IEEEAddress, psRow->u16DeviceID, psRow->u8MacCapability, &psZCBNode) != E_ZCB_OK)
+        {
+            eStatus = E_ZCB_ERROR;
+            break;
+        }
+        
+        if (PDM_InterviewDecode(psZCBNode, &psRow->sDescription) != E_ZCB_OK)
+        {
+            /* It's interviewed instead when it is next heard from */
+            daemon_log(LOG_INFO, "Could not restore node 0x%04X (0x%016llX) from the interview cache", 
+                       psRow->u16ShortAddress, (unsigned long long int)psRow->u64IEEEAddress);
+            (void)eZCB_RemoveNode(psZCBNode);
+            continue;
+        }
+        
+        psZCBNode->bUnverified = 1;
+        pau16ShortAddresses[u32NumNodes++] = psZCBNode->u16ShortAddress;
+        eUtils_LockUnlock(&psZCBNode->sLock);
+    }
+    
+    for (i = 0; i < u32NumRows; i++)
+    {
+        free(pasRows[i].sDescription.pu8Data);
+    }
+    free(pasRows);
+    
+    if (u32NumNodes > 0)
+    {
+        daemon_log(LOG_INFO, "Restored %d nodes from the interview cache", u32NumNodes);
+        *pu32NumNodes           = u32NumNodes;
+        *ppau16ShortAddresses   = pau16ShortAddresses;
+    }
+    else
+    {
+        free(pau16ShortAddresses);
+    }
+    return eStatus;
+}
+
 /****************************************************************************/
 /***        Local Functions                                               ***/
 /****************************************************************************/
@@ -163,8 +595,7 @@ static void PDM_HandleAvailableRequest(void *pvUser, uint16_t u16Length, void *p
 
 static void PDM_HandleLoadRequest(void *pvUser, uint16_t u16Length, void *pvMessage)
 {
-    sqlite3_stmt *psStatement;
-    char *pcSQL;
+    sqlite3_stmt *psStatement = apsStatements[E_PDM_STATEMENT_LOAD];
     int iError = 1;
     int iSentRecords = 0;
     
@@ -173,7 +604,6 @@ static void PDM_HandleLoadRequest(void *pvUser, uint16_t u16Length, void *pvMess
         uint16_t    u16RecordID;
     } __attribute__((__packed__)) *psPDMLoadRecordRequest = (struct _tPDMLoadRequest *)pvMessage;
 
-#define PDM_BLOCK_SIZE 128
     struct _tPDMLoadResponse
     {
         uint8_t     u8Status;
@@ -193,28 +623,33 @@ static void PDM_HandleLoadRequest(void *pvUser, uint16_t u16Length, void *pvMess
     
     DBG_vPrintf(DBG_PDM, "Load record ID 0x%04X\n", psPDMLoadRecordRequest->u16RecordID);
     
-    pcSQL = sqlite3_mprintf("SELECT size,numblocks,block,blocksize,data FROM pdm WHERE id=%d", psPDMLoadRecordRequest->u16RecordID);
-    DBG_vPrintf(DBG_SQL, "Execute SQL '%s'\n", pcSQL);
-    
-    if (sqlite3_prepare_v2(pDb, pcSQL, -1, &psStatement, NULL) != SQLITE_OK)
+    if (sqlite3_bind_int(psStatement, 1, PDM_RECORD_KEY(*(int *)pvUser, psPDMLoadRecordRequest->u16RecordID)) != SQLITE_OK)
     {
-        DBG_vPrintf(DBG_PDM, "Error preparing query\n");
+        DBG_vPrintf(DBG_PDM, "Error binding query\n");
     }
     else
     {
         sLoadRecordResponse.u8Status = 1;
         while (sLoadRecordResponse.u8Status)
         {
+            int iBytes;
+            
             iError = 1;
             switch(sqlite3_step(psStatement))
             {
                 case(SQLITE_ROW):
+                    iBytes = sqlite3_column_bytes(psStatement, 4);
+                    if (iBytes > PDM_BLOCK_SIZE)
+                    {
+                        iBytes = PDM_BLOCK_SIZE;
+                    }
+                    
                     sLoadRecordResponse.u16RecordID     = htons(psPDMLoadRecordRequest->u16RecordID);
                     sLoadRecordResponse.u32TotalSize    = htonl(sqlite3_column_int(psStatement, 0));
                     sLoadRecordResponse.u32NumBlocks    = htonl(sqlite3_column_int(psStatement, 1));
                     sLoadRecordResponse.u32CurrentBlock = htonl(sqlite3_column_int(psStatement, 2));
                     sLoadRecordResponse.u32BlockSize    = htonl(sqlite3_column_int(psStatement, 3));
-                    memcpy(sLoadRecordResponse.au8Data, sqlite3_column_blob(psStatement, 4), sqlite3_column_bytes(psStatement, 4));
+                    memcpy(sLoadRecordResponse.au8Data, sqlite3_column_blob(psStatement, 4), iBytes);
                     
                     DBG_vPrintf(DBG_PDM, "Sending record ID 0x%04X (Block %d/%d, size %d/%d)\n",
                                 psPDMLoadRecordRequest->u16RecordID,
@@ -225,7 +660,7 @@ static void PDM_HandleLoadRequest(void *pvUser, uint16_t u16Length, void *pvMess
                     );                
                     
                     if (eSL_SendMessage(E_SL_MSG_PDM_LOAD_RECORD_RESPONSE, 
-                                        sizeof(struct _tPDMLoadResponse) - PDM_BLOCK_SIZE + sqlite3_column_bytes(psStatement, 4), 
+                                        sizeof(struct _tPDMLoadResponse) - PDM_BLOCK_SIZE + iBytes, 
                                         &sLoadRecordResponse, NULL) != E_SL_OK)
                     {
                         DBG_vPrintf(DBG_PDM, "Error sending message\n");
@@ -260,25 +695,15 @@ static void PDM_HandleLoadRequest(void *pvUser, uint16_t u16Length, void *pvMess
     }
 
     DBG_vPrintf(DBG_PDM, "Finished handling request\n");
-    if (sqlite3_finalize(psStatement) != SQLITE_OK)
-    {
-        DBG_vPrintf(DBG_PDM, "Error finalizing statement\n");
-    }
+    sqlite3_reset(psStatement);
+    sqlite3_clear_bindings(psStatement);
     eUtils_LockUnlock(&sLock);
-    sqlite3_free(pcSQL);
 }
 
 
 static void PDM_HandleSaveRequest           (void *pvUser, uint16_t u16Length, void *pvMessage)
 {
-    sqlite3_stmt *psStatement = NULL;
-    char *pcSQL = NULL;
-    enum 
-    { 
-        E_PDM_UNKNOWN, 
-        E_PDM_INSERT, 
-        E_PDM_UPDATE 
-    } eAction = E_PDM_UNKNOWN;
+    sqlite3_stmt *psStatement = apsStatements[E_PDM_STATEMENT_SAVE];
     
     struct _tPDMSaveRequest 
     {
@@ -313,114 +738,78 @@ static void PDM_HandleSaveRequest           (void *pvUser, uint16_t u16Length, v
                 psPDMSaveRecordRequest->u32BlockSize,
                 psPDMSaveRecordRequest->u32TotalSize);
     
-    pcSQL = sqlite3_mprintf("SELECT * FROM pdm WHERE id=%d AND block=%d", psPDMSaveRecordRequest->u16RecordID, psPDMSaveRecordRequest->u32CurrentBlock);
-    DBG_vPrintf(DBG_SQL, "Execute SQL '%s'\n", pcSQL);
-    
-    if (sqlite3_prepare_v2(pDb, pcSQL, -1, &psStatement, NULL) != SQLITE_OK)
+    if (psPDMSaveRecordRequest->u32BlockSize > PDM_BLOCK_SIZE)
     {
-        DBG_vPrintf(DBG_PDM, "Error preparing query\n");
+        DBG_vPrintf(DBG_PDM, "Block too big\n");
         goto done;
     }
-        
-    switch(sqlite3_step(psStatement))
+    
+    /* The blocks of a record all go into one transaction, and into a savepoint of their own */
+    if ((PDM_TransactionBegin() != E_ZCB_OK) ||
+        (PDM_RecordBegin(PDM_RECORD_KEY(*(int *)pvUser, psPDMSaveRecordRequest->u16RecordID)) != E_ZCB_OK))
     {
-        case(SQLITE_ROW):
-            // Got row already - so update it.
-            eAction = E_PDM_UPDATE;
-            break;
-        case(SQLITE_DONE):
-            // Row doesn't exist - insert it.
-            eAction = E_PDM_INSERT;
-            break;
-        case (SQLITE_ERROR):
-            DBG_vPrintf(DBG_PDM, "Error during SQL operation(%s)\n", sqlite3_errmsg(pDb));
-            goto done;
-        default:
-            DBG_vPrintf(DBG_PDM, "Unhandled return from sqlite3\n");
-            goto done;
+        goto done;
     }
-
-    if (sqlite3_finalize(psStatement) != SQLITE_OK)
+    
+    if ((sqlite3_bind_int(psStatement,  1, PDM_RECORD_KEY(*(int *)pvUser, psPDMSaveRecordRequest->u16RecordID)) != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,  2, psPDMSaveRecordRequest->u32TotalSize)    != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,  3, psPDMSaveRecordRequest->u32NumBlocks)    != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,  4, psPDMSaveRecordRequest->u32CurrentBlock) != SQLITE_OK) ||
+        (sqlite3_bind_int(psStatement,  5, psPDMSaveRecordRequest->u32BlockSize)    != SQLITE_OK) ||
+        (sqlite3_bind_blob(psStatement, 6, psPDMSaveRecordRequest->au8Data, psPDMSaveRecordRequest->u32BlockSize, SQLITE_STATIC) != SQLITE_OK))
     {
-        DBG_vPrintf(DBG_PDM, "Error finalizing statement\n");
-        goto done;
+        DBG_vPrintf(DBG_PDM, "error in bind : %s\n", sqlite3_errmsg(pDb));
+        goto rollback;
     }
     
-    sqlite3_free(pcSQL);
-    psStatement = NULL;
-    pcSQL = NULL;
+    if (PDM_Execute(E_PDM_STATEMENT_SAVE) != SQLITE_DONE)
+    {
+        goto rollback;
+    }
     
-    switch (eAction)
+    if (psPDMSaveRecordRequest->u32CurrentBlock >= psPDMSaveRecordRequest->u32NumBlocks)
     {
-        case (E_PDM_INSERT):
-            pcSQL = sqlite3_mprintf("INSERT INTO pdm VALUES (%d,%d,%d,%d,%d,?)", 
-                                    psPDMSaveRecordRequest->u16RecordID, 
-                                    psPDMSaveRecordRequest->u32TotalSize,
-                                    psPDMSaveRecordRequest->u32NumBlocks,
-                                    psPDMSaveRecordRequest->u32CurrentBlock,
-                                    psPDMSaveRecordRequest->u32BlockSize
-                                    );
-            DBG_vPrintf(DBG_SQL, "Execute SQL '%s'\n", pcSQL);
-            
-            if (sqlite3_prepare_v2(pDb, pcSQL, -1, &psStatement, NULL) != SQLITE_OK)
-            {
-                DBG_vPrintf(DBG_PDM, "Error preparing query\n");
-            }
-            else
-            {
-                if (sqlite3_bind_blob(psStatement, 1, psPDMSaveRecordRequest->au8Data, psPDMSaveRecordRequest->u32BlockSize, SQLITE_STATIC) != SQLITE_OK)
-                {
-                    DBG_vPrintf(DBG_PDM, "error in bind : %s\n", sqlite3_errmsg(pDb));
-                    goto done;
-                }
-            }
-            break;
-            
-        case (E_PDM_UPDATE):
-            pcSQL = sqlite3_mprintf("UPDATE pdm SET size=%d, numblocks=%d, blocksize=%d,data=? WHERE id=%d AND block=%d", 
-                                    psPDMSaveRecordRequest->u32TotalSize,
-                                    psPDMSaveRecordRequest->u32NumBlocks,
-                                    psPDMSaveRecordRequest->u32BlockSize,
-                                    psPDMSaveRecordRequest->u16RecordID, 
-                                    psPDMSaveRecordRequest->u32CurrentBlock
-                                    );
-            DBG_vPrintf(DBG_SQL, "Execute SQL '%s'\n", pcSQL);
-            
-            if (sqlite3_prepare_v2(pDb, pcSQL, -1, &psStatement, NULL) != SQLITE_OK)
+        uint64_t u64Now;
+        
+        /* Last block of the record (the control bridge numbers them from 1).
+         * Remove any blocks left over from a longer version of it */
+        sqlite3_bind_int(apsStatements[E_PDM_STATEMENT_TRIM], 1, PDM_RECORD_KEY(*(int *)pvUser, psPDMSaveRecordRequest->u16RecordID));
+        sqlite3_bind_int(apsStatements[E_PDM_STATEMENT_TRIM], 2, psPDMSaveRecordRequest->u32NumBlocks);
+        if (PDM_Execute(E_PDM_STATEMENT_TRIM) != SQLITE_DONE)
+        {
+            goto rollback;
+        }
+        PDM_RecordEnd();
+        
+        if (u32PDM_DebounceMs == 0)
+        {
+            if (PDM_TransactionCommit() != E_ZCB_OK)
             {
-                DBG_vPrintf(DBG_PDM, "Error preparing query\n");
+                goto rollback;
             }
-            else
+        }
+        else
+        {
+            /* Leave the transaction open a while, so a record that is saved again straight away
+             * is only written out once. Don't put it off for ever though. */
+            u64Now = PDM_TimeNow();
+            sTransaction.u64CommitTime = u64Now + u32PDM_DebounceMs;
+            if (sTransaction.u64CommitTime > (sTransaction.u64StartTime + (u32PDM_DebounceMs * PDM_DEBOUNCE_MAX_FACTOR)))
             {
-                if (sqlite3_bind_blob(psStatement, 1, psPDMSaveRecordRequest->au8Data, psPDMSaveRecordRequest->u32BlockSize, SQLITE_STATIC) != SQLITE_OK)
-                {
-                    DBG_vPrintf(DBG_PDM, "error in bind : %s\n", sqlite3_errmsg(pDb));
-                    goto done;
-                }
+                sTransaction.u64CommitTime = sTransaction.u64StartTime + (u32PDM_DebounceMs * PDM_DEBOUNCE_MAX_FACTOR);
             }
-            break;
-            
-        default:
-            DBG_vPrintf(DBG_PDM, "Unknown action\n");
-            goto done;
+        }
     }
     
-    
-    switch(sqlite3_step(psStatement))
-    {
-        case(SQLITE_DONE):
-            DBG_vPrintf(DBG_PDM, "Done\n");
-            sSaveRecordResponse.u8Status = 0;
-            break;
-        case (SQLITE_ERROR):
-            DBG_vPrintf(DBG_PDM, "Error during SQL operation(%s)\n", sqlite3_errmsg(pDb));
-            goto done;
-            break;
-        default:
-            DBG_vPrintf(DBG_PDM, "Unhandled return from sqlite3\n");
-            goto done;
-    }
+    DBG_vPrintf(DBG_PDM, "Done\n");
+    sSaveRecordResponse.u8Status = 0;
+    goto done;
 
+rollback:
+    /* Don't leave the record part written in a transaction that will be committed later.
+     * Records already saved into the transaction are kept */
+    PDM_RecordRollback();
+    
 done:
     if (eSL_SendMessage(E_SL_MSG_PDM_SAVE_RECORD_RESPONSE, sizeof(struct _tPDMSaveResponse), &sSaveRecordResponse, NULL) != E_SL_OK)
     {
@@ -428,20 +817,13 @@ done:
     }
 
     DBG_vPrintf(DBG_PDM, "Finished handling request\n");
-    if (sqlite3_finalize(psStatement) != SQLITE_OK)
-    {
-        DBG_vPrintf(DBG_PDM, "Error finalizing after statement\n");
-    }
+    sqlite3_clear_bindings(psStatement);
     eUtils_LockUnlock(&sLock);
-    sqlite3_free(pcSQL);
 }
 
 
 static void PDM_HandleDeleteAllRequest(void *pvUser, uint16_t u16Length, void *pvMessage)
 {
-    sqlite3_stmt *psStatement;
-    char *pcSQL;
-
     struct _tPDMDeleteAllResponse
     {
         uint8_t     u8Status;
@@ -453,42 +835,511 @@ static void PDM_HandleDeleteAllRequest(void *pvUser, uint16_t u16Length, void *p
     
     DBG_vPrintf(DBG_PDM, "Delete all records\n");
     
-    pcSQL = sqlite3_mprintf("DELETE FROM pdm");
-    DBG_vPrintf(DBG_SQL, "Execute SQL '%s'\n", pcSQL);
-    
-    if (sqlite3_prepare_v2(pDb, pcSQL, -1, &psStatement, NULL) != SQLITE_OK)
+    /* The network is being left, so none of its nodes are wanted either.
+     * The records of the other control bridges are kept. Records already saved are
+     * committed first, so that they are not lost if the delete fails */
+    if ((PDM_TransactionCommit() == E_ZCB_OK) &&
+        (PDM_TransactionBegin() == E_ZCB_OK) &&
+        (sqlite3_bind_int(apsStatements[E_PDM_STATEMENT_DELETE_ALL], 1, *(int *)pvUser) == SQLITE_OK) &&
+        (sqlite3_bind_int(apsStatements[E_PDM_STATEMENT_INTERVIEW_FORGET_ALL], 1, *(int *)pvUser) == SQLITE_OK) &&
+        (PDM_Execute(E_PDM_STATEMENT_DELETE_ALL) == SQLITE_DONE) &&
+        (PDM_Execute(E_PDM_STATEMENT_INTERVIEW_FORGET_ALL) == SQLITE_DONE) &&
+        (PDM_TransactionCommit() == E_ZCB_OK))
     {
-        DBG_vPrintf(DBG_PDM, "Error preparing query\n");
+        sDeleteAllResponse.u8Status = 1;
     }
     else
     {
-        switch(sqlite3_step(psStatement))
+        /* Don't leave the network half deleted for the flush thread to commit */
+        PDM_TransactionRollback();
+    }
+
+    if (eSL_SendMessage(E_SL_MSG_PDM_DELETE_ALL_RECORDS_RESPONSE, sizeof(struct _tPDMDeleteAllResponse), &sDeleteAllResponse, NULL) != E_SL_OK)
+    {
+        DBG_vPrintf(DBG_PDM, "Error sending message\n");
+    }
+
+    DBG_vPrintf(DBG_PDM, "Finished handling request\n");
+    eUtils_LockUnlock(&sLock);
+}
+
+
+/** Give each control bridge in \ref asZCB_Shards its key in the bridge table, adding the
+ *  serial devices not seen before. Records used to be kept by each control bridge's position
+ *  on the command line, so when the bridge table is first made each control bridge is given
+ *  its position as its key, and keeps the records saved in that order. A control bridge
+ *  added after that is given a key no records have.
+ *  Called with sLock held.
+ *  \return E_ZCB_OK if every control bridge has its key
+ */
+static teZcbStatus PDM_BridgeKeysLoad(void)
+{
+    /* Keys in use, by control bridges seen before or by records left by them */
+    static const char *apcKeysInUse[] =
+    {
+        "SELECT MAX(id) FROM bridge",
+        "SELECT MAX(id>>16) FROM pdm",
+        "SELECT MAX(shard) FROM interview",
+    };
+    int iNumBridges = 0;
+    int iNextKey = 0;
+    int iKey;
+    int i;
+    
+    if (PDM_QueryInt("SELECT COUNT(*) FROM bridge", NULL, &iNumBridges) != SQLITE_ROW)
+    {
+        return E_ZCB_ERROR;
+    }
+    
+    for (i = 0; (iNumBridges > 0) && (i < sizeof(apcKeysInUse) / sizeof(apcKeysInUse[0])); i++)
+    {
+        if (PDM_QueryInt(apcKeysInUse[i], NULL, &iKey) != SQLITE_ROW)
         {
-            case(SQLITE_DONE):
-                sDeleteAllResponse.u8Status = 1;
+            return E_ZCB_ERROR;
+        }
+        if (iKey >= iNextKey)
+        {
+            iNextKey = iKey + 1;
+        }
+    }
+    
+    for (i = 0; i < iZCB_NumShards; i++)
+    {
+        const char *pcDevice = asZCB_Shards[i].pcSerialDevice ? asZCB_Shards[i].pcSerialDevice : "";
+        char acSQL[64];
+        
+        switch (PDM_QueryInt("SELECT id FROM bridge WHERE device=?1", pcDevice, &aiBridgeKeys[i]))
+        {
+            case (SQLITE_ROW):
                 break;
-            case (SQLITE_ERROR):
-                DBG_vPrintf(DBG_PDM, "Error during SQL operation(%s)\n", sqlite3_errmsg(pDb));
-                sDeleteAllResponse.u8Status = 0;
+                
+            case (SQLITE_DONE):
+                aiBridgeKeys[i] = (iNumBridges == 0) ? i : iNextKey++;
+                snprintf(acSQL, sizeof(acSQL), "INSERT INTO bridge (id,device) VALUES (%d,?1)", aiBridgeKeys[i]);
+                if (PDM_QueryInt(acSQL, pcDevice, NULL) != SQLITE_DONE)
+                {
+                    return E_ZCB_ERROR;
+                }
                 break;
+                
             default:
-                DBG_vPrintf(DBG_PDM, "Unhandled return from sqlite3\n");
-                sDeleteAllResponse.u8Status = 0;
+                return E_ZCB_ERROR;
         }
+        daemon_log(LOG_INFO, "PDM records of control bridge %s are kept as bridge %d", pcDevice, aiBridgeKeys[i]);
     }
+    return E_ZCB_OK;
+}
 
-    if (eSL_SendMessage(E_SL_MSG_PDM_DELETE_ALL_RECORDS_RESPONSE, sizeof(struct _tPDMDeleteAllResponse), &sDeleteAllResponse, NULL) != E_SL_OK)
+
+/** Run a statement that is only used once, binding a text parameter and reading an integer.
+ *  A NULL result, e.g. MAX() of an empty table, reads as -1.
+ *  \param pcSQL            Statement
+ *  \param pcText           Text to bind to ?1, or NULL for none
+ *  \param piValue          Filled in with the first column of the first row, or NULL if none is wanted
+ *  \return SQLITE_ROW if a row was read, SQLITE_DONE if there was none, or an sqlite error
+ */
+static int PDM_QueryInt(const char *pcSQL, const char *pcText, int *piValue)
+{
+    sqlite3_stmt *psStatement;
+    int iResult;
+    
+    DBG_vPrintf(DBG_SQL, "Execute SQL: '%s'\n", pcSQL);
+    
+    if (((iResult = sqlite3_prepare_v2(pDb, pcSQL, -1, &psStatement, NULL)) != SQLITE_OK) ||
+        (pcText && ((iResult = sqlite3_bind_text(psStatement, 1, pcText, -1, SQLITE_STATIC)) != SQLITE_OK)))
     {
-        DBG_vPrintf(DBG_PDM, "Error sending message\n");
+        daemon_log(LOG_ERR, "Error in PDM statement '%s' (%s)", pcSQL, sqlite3_errmsg(pDb));
+        sqlite3_finalize(psStatement);
+        return iResult;
+    }
+    
+    iResult = sqlite3_step(psStatement);
+    if ((iResult == SQLITE_ROW) && piValue)
+    {
+        *piValue = (sqlite3_column_type(psStatement, 0) == SQLITE_NULL) ? -1 : sqlite3_column_int(psStatement, 0);
+    }
+    else if ((iResult != SQLITE_ROW) && (iResult != SQLITE_DONE))
+    {
+        daemon_log(LOG_ERR, "Error in PDM statement '%s' (%s)", pcSQL, sqlite3_errmsg(pDb));
     }
+    sqlite3_finalize(psStatement);
+    return iResult;
+}
 
-    DBG_vPrintf(DBG_PDM, "Finished handling request\n");
-    if (sqlite3_finalize(psStatement) != SQLITE_OK)
+
+/** Run one of the prepared statements that doesn't return rows, and reset it ready for next time.
+ *  The calling function should hold sLock.
+ *  \param eStatement       Statement to run
+ *  \return sqlite3 status, SQLITE_DONE on success
+ */
+static int PDM_Execute(tePDMStatement eStatement)
+{
+    int iResult;
+    
+    DBG_vPrintf(DBG_SQL, "Execute SQL '%s'\n", apcStatementSQL[eStatement]);
+    
+    iResult = sqlite3_step(apsStatements[eStatement]);
+    if (iResult != SQLITE_DONE)
     {
-        DBG_vPrintf(DBG_PDM, "Error finalizing statement\n");
+        DBG_vPrintf(DBG_PDM, "Error during SQL operation(%s)\n", sqlite3_errmsg(pDb));
     }
-    eUtils_LockUnlock(&sLock);
-    sqlite3_free(pcSQL);
+    sqlite3_reset(apsStatements[eStatement]);
+    return iResult;
+}
+
+
+/** Open a transaction, unless one is already open.
+ *  The calling function should hold sLock.
+ *  \return E_ZCB_OK on success
+ */
+static teZcbStatus PDM_TransactionBegin(void)
+{
+    if (sTransaction.iOpen)
+    {
+        return E_ZCB_OK;
+    }
+    
+    if (PDM_Execute(E_PDM_STATEMENT_BEGIN) != SQLITE_DONE)
+    {
+        daemon_log(LOG_ERR, "Error starting PDM transaction (%s)", sqlite3_errmsg(pDb));
+        return E_ZCB_ERROR;
+    }
+    
+    sTransaction.iOpen          = 1;
+    sTransaction.u64StartTime   = PDM_TimeNow();
+    sTransaction.u64CommitTime  = sTransaction.u64StartTime + PDM_TRANSACTION_TIMEOUT_MS;
+    return E_ZCB_OK;
+}
+
+
+/** Commit the open transaction, if there is one.
+ *  The calling function should hold sLock.
+ *  \return E_ZCB_OK on success
+ */
+static teZcbStatus PDM_TransactionCommit(void)
+{
+    if (!sTransaction.iOpen)
+    {
+        return E_ZCB_OK;
+    }
+    
+    sTransaction.iOpen          = 0;
+    sTransaction.iRecordOpen    = 0;
+    
+    if (PDM_Execute(E_PDM_STATEMENT_COMMIT) != SQLITE_DONE)
+    {
+        daemon_log(LOG_ERR, "Error committing PDM transaction (%s)", sqlite3_errmsg(pDb));
+        
+        /* Make sure the connection is left usable */
+        (void)PDM_Execute(E_PDM_STATEMENT_ROLLBACK);
+        return E_ZCB_ERROR;
+    }
+    return E_ZCB_OK;
+}
+
+
+/** Roll back the open transaction, if there is one.
+ *  Everything written since it was begun is lost, including any records whose commit was being debounced.
+ *  The calling function should hold sLock.
+ */
+static void PDM_TransactionRollback(void)
+{
+    if (!sTransaction.iOpen)
+    {
+        return;
+    }
+    
+    sTransaction.iOpen          = 0;
+    sTransaction.iRecordOpen    = 0;
+    
+    if (PDM_Execute(E_PDM_STATEMENT_ROLLBACK) != SQLITE_DONE)
+    {
+        daemon_log(LOG_ERR, "Error rolling back PDM transaction (%s)", sqlite3_errmsg(pDb));
+    }
+}
+
+
+/** Open a savepoint for the blocks of a record, in the open transaction, unless the record's
+ *  savepoint is already open. The savepoint of any other record is ended first, so a record
+ *  interleaved with another, e.g. from another control bridge, is kept if the other fails.
+ *  The calling function should hold sLock.
+ *  \param iRecordKey       Key of the record, as PDM_RECORD_KEY
+ *  \return E_ZCB_OK on success
+ */
+static teZcbStatus PDM_RecordBegin(int iRecordKey)
+{
+    if (sTransaction.iRecordOpen && (sTransaction.iRecordKey == iRecordKey))
+    {
+        return E_ZCB_OK;
+    }
+    
+    PDM_RecordEnd();
+    
+    if (PDM_Execute(E_PDM_STATEMENT_RECORD_BEGIN) != SQLITE_DONE)
+    {
+        daemon_log(LOG_ERR, "Error starting PDM record (%s)", sqlite3_errmsg(pDb));
+        return E_ZCB_ERROR;
+    }
+    
+    sTransaction.iRecordOpen    = 1;
+    sTransaction.iRecordKey     = iRecordKey;
+    return E_ZCB_OK;
+}
+
+
+/** End the savepoint of the record being saved, if there is one, leaving its blocks in the
+ *  open transaction. The calling function should hold sLock.
+ */
+static void PDM_RecordEnd(void)
+{
+    if (!sTransaction.iRecordOpen)
+    {
+        return;
+    }
+    
+    sTransaction.iRecordOpen = 0;
+    
+    if (PDM_Execute(E_PDM_STATEMENT_RECORD_END) != SQLITE_DONE)
+    {
+        daemon_log(LOG_ERR, "Error ending PDM record (%s)", sqlite3_errmsg(pDb));
+    }
+}
+
+
+/** Discard the blocks of the record being saved, if there is one, and end its savepoint.
+ *  Everything else in the open transaction is kept. The calling function should hold sLock.
+ */
+static void PDM_RecordRollback(void)
+{
+    if (!sTransaction.iRecordOpen)
+    {
+        return;
+    }
+    
+    if (PDM_Execute(E_PDM_STATEMENT_RECORD_ROLLBACK) != SQLITE_DONE)
+    {
+        daemon_log(LOG_ERR, "Error rolling back PDM record (%s)", sqlite3_errmsg(pDb));
+    }
+    PDM_RecordEnd();
+}
+
+
+/** Get the monotonic time in milliseconds */
+static uint64_t PDM_TimeNow(void)
+{
+    struct timespec sNow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return ((uint64_t)sNow.tv_sec * 1000) + (sNow.tv_nsec / 1000000);
+}
+
+
+/** Thread to commit transactions that have been left open for debouncing, or because
+ *  the control bridge stopped part way through saving a record. */
+static void *PDM_FlushThread(tsUtilsThread *psThreadInfo)
+{
+    DBG_vPrintf(DBG_PDM, "Starting\n");
+    
+    /* Run until told to stop, even if that happens before this thread first gets scheduled */
+    while (psThreadInfo->eState != E_THREAD_STOPPING)
+    {
+        eUtils_LockLock(&sLock);
+        if (sTransaction.iOpen && (PDM_TimeNow() >= sTransaction.u64CommitTime))
+        {
+            DBG_vPrintf(DBG_PDM, "Committing transaction\n");
+            (void)PDM_TransactionCommit();
+        }
+        eUtils_LockUnlock(&sLock);
+        
+        usleep(PDM_FLUSH_POLL_MS * 1000);
+    }
+    
+    DBG_vPrintf(DBG_PDM, "Exit\n");
+    
+    /* Return from thread clearing resources */
+    eUtils_ThreadFinish(psThreadInfo);
+    return NULL;
+}
+
+
+/** Write the description of a node to a buffer. All values are in network byte order:
+ *    u8 version, u16 number of endpoints, and for each endpoint
+ *      u8 endpoint, u16 profile ID, u16 number of clusters, and for each cluster
+ *        u16 cluster ID, u16 number of attributes, u16 attribute IDs, u16 number of commands, u8 command IDs
+ *    u16 number of groups, u16 group addresses
+ *  \param psZCBNode        Node to describe
+ *  \param psBuffer         Buffer to write to, or NULL to just find the length
+ *  \return Length of the description
+ */
+static uint32_t PDM_InterviewEncode(tsZCB_Node *psZCBNode, tsPDMBuffer *psBuffer)
+{
+    tsPDMBuffer sSizing = { NULL, 0, 0 };
+    int i, j, k;
+    
+    if (!psBuffer)
+    {
+        psBuffer = &sSizing;
+    }
+    
+    PDM_Put8(psBuffer, PDM_INTERVIEW_VERSION);
+    PDM_Put16(psBuffer, psZCBNode->u32NumEndpoints);
+    for (i = 0; i < psZCBNode->u32NumEndpoints; i++)
+    {
+        tsZCB_NodeEndpoint *psEndpoint = &psZCBNode->pasEndpoints[i];
+        
+        PDM_Put8(psBuffer, psEndpoint->u8Endpoint);
+        PDM_Put16(psBuffer, psEndpoint->u16ProfileID);
+        PDM_Put16(psBuffer, psEndpoint->u32NumClusters);
+        for (j = 0; j < psEndpoint->u32NumClusters; j++)
+        {
+            tsZCB_NodeCluster *psCluster = &psEndpoint->pasClusters[j];
+            
+            PDM_Put16(psBuffer, psCluster->u16ClusterID);
+            PDM_Put16(psBuffer, psCluster->u32NumAttributes);
+            for (k = 0; k < psCluster->u32NumAttributes; k++)
+            {
+                PDM_Put16(psBuffer, psCluster->pau16Attributes[k]);
+            }
+            PDM_Put16(psBuffer, psCluster->u32NumCommands);
+            for (k = 0; k < psCluster->u32NumCommands; k++)
+            {
+                PDM_Put8(psBuffer, psCluster->pau8Commands[k]);
+            }
+        }
+    }
+    PDM_Put16(psBuffer, psZCBNode->u32NumGroups);
+    for (i = 0; i < psZCBNode->u32NumGroups; i++)
+    {
+        PDM_Put16(psBuffer, psZCBNode->pau16Groups[i]);
+    }
+    return psBuffer->u32Position;
+}
+
+
+/** Add the endpoints, clusters, attributes, commands and groups in a node description to a node
+ *  \param psZCBNode        Locked node to add to
+ *  \param psBuffer         Description written by PDM_InterviewEncode
+ *  \return E_ZCB_OK on success, E_ZCB_ERROR if the description is not complete or not understood
+ */
+static teZcbStatus PDM_InterviewDecode(tsZCB_Node *psZCBNode, tsPDMBuffer *psBuffer)
+{
+    uint8_t u8Version;
+    uint16_t u16NumEndpoints, u16NumGroups;
+    int i, j, k;
+    
+    if (!PDM_Get8(psBuffer, &u8Version) || (u8Version != PDM_INTERVIEW_VERSION) ||
+        !PDM_Get16(psBuffer, &u16NumEndpoints) || (u16NumEndpoints == 0))
+    {
+        return E_ZCB_ERROR;
+    }
+    
+    for (i = 0; i < u16NumEndpoints; i++)
+    {
+        uint8_t u8Endpoint;
+        uint16_t u16ProfileID, u16NumClusters;
+        
+        if (!PDM_Get8(psBuffer, &u8Endpoint) || !PDM_Get16(psBuffer, &u16ProfileID) || !PDM_Get16(psBuffer, &u16NumClusters) ||
+            (eZCB_NodeAddEndpoint(psZCBNode, u8Endpoint, u16ProfileID, NULL) != E_ZCB_OK))
+        {
+            return E_ZCB_ERROR;
+        }
+        
+        for (j = 0; j < u16NumClusters; j++)
+        {
+            uint16_t u16ClusterID, u16NumAttributes, u16NumCommands, u16AttributeID;
+            uint8_t u8CommandID;
+            
+            if (!PDM_Get16(psBuffer, &u16ClusterID) || !PDM_Get16(psBuffer, &u16NumAttributes) ||
+                (eZCB_NodeAddCluster(psZCBNode, u8Endpoint, u16ClusterID) != E_ZCB_OK))
+            {
+                return E_ZCB_ERROR;
+            }
+            for (k = 0; k < u16NumAttributes; k++)
+            {
+                if (!PDM_Get16(psBuffer, &u16AttributeID))
+                {
+                    return E_ZCB_ERROR;
+                }
+                (void)eZCB_NodeAddAttribute(psZCBNode, u8Endpoint, u16ClusterID, u16AttributeID);
+            }
+            if (!PDM_Get16(psBuffer, &u16NumCommands))
+            {
+                return E_ZCB_ERROR;
+            }
+            for (k = 0; k < u16NumCommands; k++)
+            {
+                if (!PDM_Get8(psBuffer, &u8CommandID))
+                {
+                    return E_ZCB_ERROR;
+                }
+                (void)eZCB_NodeAddCommand(psZCBNode, u8Endpoint, u16ClusterID, u8CommandID);
+            }
+        }
+    }
+    
+    if (!PDM_Get16(psBuffer, &u16NumGroups))
+    {
+        return E_ZCB_ERROR;
+    }
+    for (i = 0; i < u16NumGroups; i++)
+    {
+        uint16_t u16GroupAddress;
+        
+        if (!PDM_Get16(psBuffer, &u16GroupAddress) || (eZCB_NodeAddGroup(psZCBNode, u16GroupAddress) != E_ZCB_OK))
+        {
+            return E_ZCB_ERROR;
+        }
+    }
+    return E_ZCB_OK;
+}
+
+
+/** Append a byte to a buffer. With no data, just count it */
+static void PDM_Put8(tsPDMBuffer *psBuffer, uint8_t u8Value)
+{
+    if (psBuffer->pu8Data && (psBuffer->u32Position < psBuffer->u32Length))
+    {
+        psBuffer->pu8Data[psBuffer->u32Position] = u8Value;
+    }
+    psBuffer->u32Position++;
+}
+
+
+/** Append a 16 bit value to a buffer in network byte order. With no data, just count it */
+static void PDM_Put16(tsPDMBuffer *psBuffer, uint16_t u16Value)
+{
+    PDM_Put8(psBuffer, u16Value >> 8);
+    PDM_Put8(psBuffer, u16Value & 0xFF);
+}
+
+
+/** Take a byte from a buffer.
+ *  \return 1 on success, 0 if the buffer is used up
+ */
+static int PDM_Get8(tsPDMBuffer *psBuffer, uint8_t *pu8Value)
+{
+    if (psBuffer->u32Position >= psBuffer->u32Length)
+    {
+        return 0;
+    }
+    *pu8Value = psBuffer->pu8Data[psBuffer->u32Position++];
+    return 1;
+}
+
+
+/** Take a 16 bit value in network byte order from a buffer.
+ *  \return 1 on success, 0 if the buffer is used up
+ */
+static int PDM_Get16(tsPDMBuffer *psBuffer, uint16_t *pu16Value)
+{
+    uint8_t u8High, u8Low;
+    
+    if (!PDM_Get8(psBuffer, &u8High) || !PDM_Get8(psBuffer, &u8Low))
+    {
+        return 0;
+    }
+    *pu16Value = (u8High << 8) | u8Low;
+    return 1;
 }
 
 
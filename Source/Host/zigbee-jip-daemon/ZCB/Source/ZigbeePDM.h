@@ -79,6 +79,29 @@ extern "C" {
 teZcbStatus ePDM_Init(char *pcPDMFile);
 teZcbStatus ePDM_Destory(void);
 
+/** Save the description of a node found by interviewing it (endpoints, clusters, attributes,
+ *  commands and groups) to the interview cache. Nodes with no endpoints are not saved.
+ *  The write goes into the open transaction, which is committed within a second.
+ *  \param psZCBNode        Node to save, which the calling function has locked
+ *  eturn E_ZCB_OK on success, or when there is no store or the cache is disabled
+ */
+teZcbStatus ePDM_InterviewSave(tsZCB_Node *psZCBNode);
+
+/** Remove a node from the interview cache, so that it is interviewed if it joins again.
+ *  \param u64IEEEAddress   IEEE address of the node
+ *  eturn E_ZCB_OK on success, or when there is no store or the cache is disabled
+ */
+teZcbStatus ePDM_InterviewForget(uint64_t u64IEEEAddress);
+
+/** Add the nodes in the interview cache that aren't already known to the network, without
+ *  interviewing them. They are marked unverified until they are next heard from.
+ *  \param pu32NumNodes         Location to store the number of nodes restored
+ *  \param ppau16ShortAddresses Location to store an array of their short addresses, which the
+ *                              calling function frees. NULL if no nodes were restored.
+ *  eturn E_ZCB_OK on success
+ */
+teZcbStatus ePDM_InterviewRestore(uint32_t *pu32NumNodes, uint16_t **ppau16ShortAddresses);
+
 /****************************************************************************/
 /***        Local Functions                                               ***/
 /****************************************************************************/
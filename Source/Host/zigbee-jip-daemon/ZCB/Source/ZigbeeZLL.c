@@ -78,7 +78,7 @@
 /***        Local Function Prototypes                                     ***/
 /****************************************************************************/
 
-
+static teZcbStatus eZBZLL_SendCommand(tsZcbDeliveryPolicy *psPolicy, uint16_t u16Type, uint16_t u16Length, void *pvMessage);
 
 /****************************************************************************/
 /***        Exported Variables                                            ***/
@@ -100,7 +100,7 @@ teZcbStatus eZBZLL_OnOff(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -111,6 +111,11 @@ teZcbStatus eZBZLL_OnOff(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_
         uint8_t     u8Mode;
     } __attribute__((__packed__)) sOnOffMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "On/Off (Set Mode=%d)\n", u8Mode);
     
     if (u8Mode > 2)
@@ -136,13 +141,12 @@ teZcbStatus eZBZLL_OnOff(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_
     
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sOnOffMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sOnOffMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
+        if (u8Mode == 2)
         {
-            sOnOffMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
+            /* A toggle that arrived but whose response was lost would be undone by sending it again */
+            sPolicy.u8Retries = 0;
         }
         sOnOffMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
@@ -167,19 +171,7 @@ teZcbStatus eZBZLL_OnOff(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, uint8_
     
     sOnOffMessage.u8Mode = u8Mode;
     
-    if (eSL_SendMessage(E_SL_MSG_ONOFF, sizeof(sOnOffMessage), &sOnOffMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_ONOFF, sizeof(sOnOffMessage), &sOnOffMessage);
 }
 
 
@@ -221,7 +213,7 @@ teZcbStatus eZBZLL_MoveToLevel(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -234,6 +226,11 @@ teZcbStatus eZBZLL_MoveToLevel(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
         uint16_t    u16TransitionTime;
     } __attribute__((__packed__)) sLevelMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Set Level %d\n", u8Level);
     
     if (u8Level > 254)
@@ -258,14 +255,8 @@ teZcbStatus eZBZLL_MoveToLevel(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sLevelMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sLevelMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sLevelMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sLevelMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_LEVEL_CONTROL);
@@ -292,19 +283,7 @@ teZcbStatus eZBZLL_MoveToLevel(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
     sLevelMessage.u16TransitionTime     = htons(u16TransitionTime);
    // sOnOffMessage.u8Gradient            = u8Gradient;
     
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_LEVEL_ONOFF, sizeof(sLevelMessage), &sLevelMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_MOVE_TO_LEVEL_ONOFF, sizeof(sLevelMessage), &sLevelMessage);
 }
 
 
@@ -359,7 +338,7 @@ teZcbStatus eZBZLL_MoveToHue(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -372,6 +351,11 @@ teZcbStatus eZBZLL_MoveToHue(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
         uint16_t    u16TransitionTime;
     } __attribute__((__packed__)) sMoveToHueMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Set Hue %d\n", u8Hue);
     
     psControlBridge = psZCB_FindNodeControlBridge();
@@ -391,14 +375,8 @@ teZcbStatus eZBZLL_MoveToHue(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sMoveToHueMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sMoveToHueMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sMoveToHueMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sMoveToHueMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_COLOR_CONTROL);
@@ -424,19 +402,7 @@ teZcbStatus eZBZLL_MoveToHue(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress, ui
     sMoveToHueMessage.u8Direction         = 0;
     sMoveToHueMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_HUE, sizeof(sMoveToHueMessage), &sMoveToHueMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_MOVE_TO_HUE, sizeof(sMoveToHueMessage), &sMoveToHueMessage);
 }
 
 
@@ -445,7 +411,7 @@ teZcbStatus eZBZLL_MoveToSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -457,6 +423,11 @@ teZcbStatus eZBZLL_MoveToSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
         uint16_t    u16TransitionTime;
     } __attribute__((__packed__)) sMoveToSaturationMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Set Saturation %d\n", u8Saturation);
     
     psControlBridge = psZCB_FindNodeControlBridge();
@@ -476,14 +447,8 @@ teZcbStatus eZBZLL_MoveToSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sMoveToSaturationMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sMoveToSaturationMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sMoveToSaturationMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sMoveToSaturationMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_COLOR_CONTROL);
@@ -508,19 +473,7 @@ teZcbStatus eZBZLL_MoveToSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupAddr
     sMoveToSaturationMessage.u8Saturation        = u8Saturation;
     sMoveToSaturationMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_SATURATION, sizeof(sMoveToSaturationMessage), &sMoveToSaturationMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_MOVE_TO_SATURATION, sizeof(sMoveToSaturationMessage), &sMoveToSaturationMessage);
 }
 
 
@@ -530,7 +483,7 @@ teZcbStatus eZBZLL_MoveToHueSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupA
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -543,6 +496,11 @@ teZcbStatus eZBZLL_MoveToHueSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupA
         uint16_t    u16TransitionTime;
     } __attribute__((__packed__)) sMoveToHueSaturationMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Set Hue %d, Saturation %d\n", u8Hue, u8Saturation);
     
     psControlBridge = psZCB_FindNodeControlBridge();
@@ -562,14 +520,8 @@ teZcbStatus eZBZLL_MoveToHueSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupA
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sMoveToHueSaturationMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sMoveToHueSaturationMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sMoveToHueSaturationMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sMoveToHueSaturationMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_COLOR_CONTROL);
@@ -595,19 +547,7 @@ teZcbStatus eZBZLL_MoveToHueSaturation(tsZCB_Node *psZCBNode, uint16_t u16GroupA
     sMoveToHueSaturationMessage.u8Saturation        = u8Saturation;
     sMoveToHueSaturationMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_HUE_SATURATION, sizeof(sMoveToHueSaturationMessage), &sMoveToHueSaturationMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_MOVE_TO_HUE_SATURATION, sizeof(sMoveToHueSaturationMessage), &sMoveToHueSaturationMessage);
 }
 
 
@@ -616,7 +556,7 @@ teZcbStatus eZBZLL_MoveToColour(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -629,6 +569,11 @@ teZcbStatus eZBZLL_MoveToColour(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
         uint16_t    u16TransitionTime;
     } __attribute__((__packed__)) sMoveToColourMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Set X %d, Y %d\n", u16X, u16Y);
     
     psControlBridge = psZCB_FindNodeControlBridge();
@@ -648,14 +593,8 @@ teZcbStatus eZBZLL_MoveToColour(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sMoveToColourMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sMoveToColourMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sMoveToColourMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sMoveToColourMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_COLOR_CONTROL);
@@ -681,19 +620,7 @@ teZcbStatus eZBZLL_MoveToColour(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress,
     sMoveToColourMessage.u16Y                = htons(u16Y);
     sMoveToColourMessage.u16TransitionTime   = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_COLOUR, sizeof(sMoveToColourMessage), &sMoveToColourMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_MOVE_TO_COLOUR, sizeof(sMoveToColourMessage), &sMoveToColourMessage);
 }
 
 
@@ -702,7 +629,7 @@ teZcbStatus eZBZLL_MoveToColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Gr
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -714,6 +641,11 @@ teZcbStatus eZBZLL_MoveToColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Gr
         uint16_t    u16TransitionTime;
     } __attribute__((__packed__)) sMoveToColourTemperatureMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Set colour temperature %d\n", u16ColourTemperature);
     
     psControlBridge = psZCB_FindNodeControlBridge();
@@ -733,14 +665,8 @@ teZcbStatus eZBZLL_MoveToColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Gr
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sMoveToColourTemperatureMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sMoveToColourTemperatureMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sMoveToColourTemperatureMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sMoveToColourTemperatureMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_COLOR_CONTROL);
@@ -765,19 +691,7 @@ teZcbStatus eZBZLL_MoveToColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Gr
     sMoveToColourTemperatureMessage.u16ColourTemperature    = htons(u16ColourTemperature);
     sMoveToColourTemperatureMessage.u16TransitionTime       = htons(u16TransitionTime);
 
-    if (eSL_SendMessage(E_SL_MSG_MOVE_TO_COLOUR_TEMPERATURE, sizeof(sMoveToColourTemperatureMessage), &sMoveToColourTemperatureMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_MOVE_TO_COLOUR_TEMPERATURE, sizeof(sMoveToColourTemperatureMessage), &sMoveToColourTemperatureMessage);
 }
 
 
@@ -786,7 +700,7 @@ teZcbStatus eZBZLL_MoveColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Grou
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -800,6 +714,11 @@ teZcbStatus eZBZLL_MoveColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Grou
         uint16_t    u16ColourTemperatureMax;
     } __attribute__((__packed__)) sMoveColourTemperatureMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Move colour temperature\n");
     
     psControlBridge = psZCB_FindNodeControlBridge();
@@ -819,14 +738,8 @@ teZcbStatus eZBZLL_MoveColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Grou
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sMoveColourTemperatureMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sMoveColourTemperatureMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sMoveColourTemperatureMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sMoveColourTemperatureMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_COLOR_CONTROL);
@@ -853,19 +766,7 @@ teZcbStatus eZBZLL_MoveColourTemperature(tsZCB_Node *psZCBNode, uint16_t u16Grou
     sMoveColourTemperatureMessage.u16ColourTemperatureMin   = htons(u16ColourTemperatureMin);
     sMoveColourTemperatureMessage.u16ColourTemperatureMax   = htons(u16ColourTemperatureMax);
     
-    if (eSL_SendMessage(E_SL_MSG_MOVE_COLOUR_TEMPERATURE, sizeof(sMoveColourTemperatureMessage), &sMoveColourTemperatureMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_MOVE_COLOUR_TEMPERATURE, sizeof(sMoveColourTemperatureMessage), &sMoveColourTemperatureMessage);
 }
 
 
@@ -874,7 +775,7 @@ teZcbStatus eZBZLL_ColourLoopSet(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress
     tsZCB_Node          *psControlBridge;
     tsZCB_NodeEndpoint  *psSourceEndpoint;
     tsZCB_NodeEndpoint  *psDestinationEndpoint;
-    uint8_t             u8SequenceNo;
+    tsZcbDeliveryPolicy sPolicy;
     
     struct
     {
@@ -889,6 +790,11 @@ teZcbStatus eZBZLL_ColourLoopSet(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress
         uint16_t    u16StartHue;
     } __attribute__((__packed__)) sColourLoopSetMessage;
     
+    if (psZCBNode)
+    {
+        vZCB_ShardSelect(psZCBNode->u8Shard);
+    }
+    
     DBG_vPrintf(DBG_ZLL, "Colour loop set\n");
     
     psControlBridge = psZCB_FindNodeControlBridge();
@@ -908,14 +814,8 @@ teZcbStatus eZBZLL_ColourLoopSet(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress
 
     if (psZCBNode)
     {
-        if (bZCB_EnableAPSAck)
-        {
-            sColourLoopSetMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT;
-        }
-        else
-        {
-            sColourLoopSetMessage.u8TargetAddressMode   = E_ZB_ADDRESS_MODE_SHORT_NO_ACK;
-        }
+        vZCB_NodeDeliveryPolicy(psZCBNode, E_ZCB_DELIVERY_CONTROL, &sPolicy);
+        sColourLoopSetMessage.u8TargetAddressMode   = sPolicy.u8AddressMode;
         sColourLoopSetMessage.u16TargetAddress      = htons(psZCBNode->u16ShortAddress);
         
         psDestinationEndpoint = psZCB_NodeFindEndpoint(psZCBNode, E_ZB_CLUSTERID_COLOR_CONTROL);
@@ -943,19 +843,7 @@ teZcbStatus eZBZLL_ColourLoopSet(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress
     sColourLoopSetMessage.u16Time                   = htons(u16Time);
     sColourLoopSetMessage.u16StartHue               = htons(u16StartHue);
     
-    if (eSL_SendMessage(E_SL_MSG_COLOUR_LOOP_SET, sizeof(sColourLoopSetMessage), &sColourLoopSetMessage, &u8SequenceNo) != E_SL_OK)
-    {
-        return E_ZCB_COMMS_FAILED;
-    }
-    
-    if (psZCBNode)
-    {
-        return eZCB_GetDefaultResponse(u8SequenceNo);
-    }
-    else
-    {
-        return E_ZCB_OK;
-    }
+    return eZBZLL_SendCommand(psZCBNode ? &sPolicy : NULL, E_SL_MSG_COLOUR_LOOP_SET, sizeof(sColourLoopSetMessage), &sColourLoopSetMessage);
 }
 
 
@@ -963,6 +851,47 @@ teZcbStatus eZBZLL_ColourLoopSet(tsZCB_Node *psZCBNode, uint16_t u16GroupAddress
 /***        Local Functions                                               ***/
 /****************************************************************************/
 
+/** Send a command, and if it is to a node wait for its default response,
+ *  sending it again as many times as the node's delivery policy allows.
+ *  \param psPolicy         Delivery policy of the node, NULL for a group, which is sent by every control bridge
+ *  \param u16Type          Serial message type of the command
+ *  \param u16Length        Length of the message
+ *  \param pvMessage        Message to send
+ *  \return Status of the last attempt
+ */
+static teZcbStatus eZBZLL_SendCommand(tsZcbDeliveryPolicy *psPolicy, uint16_t u16Type, uint16_t u16Length, void *pvMessage)
+{
+    teZcbStatus eStatus;
+    uint8_t u8SequenceNo;
+    uint8_t u8Attempts = 0;
+    
+    if (!psPolicy)
+    {
+        return eZCB_SendGroupMessage(u16Type, u16Length, pvMessage);
+    }
+    
+    do
+    {
+        if (eSL_SendMessage(u16Type, u16Length, pvMessage, &u8SequenceNo) != E_SL_OK)
+        {
+            /* The control bridge refused it, so sending it again won't help */
+            return E_ZCB_COMMS_FAILED;
+        }
+        
+        eStatus = eZCB_GetDefaultResponse(u8SequenceNo, psPolicy->u16TimeoutMs);
+        u8Attempts++;
+        
+        if (eStatus != E_ZCB_COMMS_FAILED)
+        {
+            break;
+        }
+        DBG_vPrintf(DBG_ZLL, "No response from 0x%04X to attempt %d\n", psPolicy->u16ShortAddress, u8Attempts);
+    } while (u8Attempts <= psPolicy->u8Retries);
+    
+    vZCB_NodeDeliveryRecord(NULL, psPolicy, u8Attempts, eStatus);
+    return eStatus;
+}
+
 
 
 /****************************************************************************/